@@ -0,0 +1,8 @@
+#!/bin/bash
+
+if [ $# != 3 ]; then
+    echo "Usage: bits <host:port> <name> <bits>"
+    exit 1
+fi
+
+curl --verbose -H "Content-Type: application/json" --data "{\"bits\":$3}" http://$1/bits/$2
@@ -1,32 +1,123 @@
 #ifndef _ECDL_CONTEXT_H
 #define _ECDL_CONTEXT_H
 
-#define NUM_R_POINTS 32
+/**
+ * Limits on the number of R points. The server picks the count for each job
+ * and it must be a power of 2
+ */
+#define MIN_R_POINTS 16
+#define MAX_R_POINTS 4096
+#define DEFAULT_R_POINTS 32
+
+// Most distinguished bits the walks can be set to while they run. The
+// walks check them in one 32-bit word
+#define MAX_DISTINGUISHED_BITS 32
 
 #include <vector>
 #include "BigInteger.h"
 #include "ECDLPParams.h"
 
+// 32-bit words per value in the callback parameters. Enough for the largest
+// field the CUDA kernels support
+#define POINT_WORDS 10
+
 /**
- Parameters passed to the callback when a distinguished point is found
+ Parameters passed to the callback when a distinguished point is found. The
+ values are 32-bit words, least significant first, so the walks report a
+ point without allocating
  */
 struct CallbackParameters {
-    BigInteger aStart;
-    BigInteger bStart;
-    BigInteger x;
-    BigInteger y;
+    unsigned int aStart[POINT_WORDS];
+    unsigned int bStart[POINT_WORDS];
+    unsigned int x[POINT_WORDS];
+    unsigned int y[POINT_WORDS];
     unsigned long long length;
 };
 
+/**
+ * Copies a value of len 32-bit words into a callback parameter
+ */
+inline bool setPointWords(unsigned int *dest, const unsigned int *words, int len)
+{
+    for(int i = 0; i < POINT_WORDS; i++) {
+        dest[i] = i < len ? words[i] : 0;
+    }
+
+    for(int i = POINT_WORDS; i < len; i++) {
+        if(words[i] != 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Copies a value of len native words into a callback parameter. Returns
+ * false if it does not fit
+ */
+inline bool setPointWords(unsigned int *dest, const unsigned long *words, int len)
+{
+    const int perWord = sizeof(unsigned long) / sizeof(unsigned int);
+
+    for(int i = 0; i < POINT_WORDS; i++) {
+        dest[i] = i / perWord < len ? (unsigned int)(words[i / perWord] >> (32 * (i % perWord))) : 0;
+    }
+
+    for(int i = POINT_WORDS; i < len * perWord; i++) {
+        if((unsigned int)(words[i / perWord] >> (32 * (i % perWord))) != 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+inline bool setPointWords(unsigned int *dest, const BigInteger &value)
+{
+    if(value.getBitLength() > POINT_WORDS * 32) {
+        return false;
+    }
+
+    value.getWords(dest, POINT_WORDS);
+
+    return true;
+}
+
+class WalkCheckpoint;
+
 class ECDLContext {
 
 public:
+    // Contexts are deleted through this class when jobs are put away
+    virtual ~ECDLContext() {}
+
     virtual bool init() = 0;
     virtual void reset() = 0;
     virtual bool stop() = 0;
     virtual bool run() = 0;
     virtual bool isRunning() = 0;
     virtual bool benchmark(unsigned long long *pointsPerSecond) = 0;
+
+    /**
+     * Adds the state of every walk to the checkpoint. Running walks pause
+     * between steps while their state is copied
+     */
+    virtual void saveWalks(WalkCheckpoint &checkpoint) = 0;
+
+    /**
+     * Makes init() resume walks from the checkpoint before it starts new
+     * ones. The checkpoint must outlive the context
+     */
+    virtual void resumeWalks(WalkCheckpoint *checkpoint) = 0;
+
+    /**
+     * Makes the walks stop at points with dBits low zero bits instead of
+     * the number in the parameters. Running walks continue and pick up the
+     * new value between steps. dBits must be from the number in the
+     * parameters to MAX_DISTINGUISHED_BITS
+     */
+    virtual void setDistinguishedBits(unsigned int dBits) = 0;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,116 @@
+#include "JobScheduler.h"
+
+JobScheduler::JobScheduler(unsigned int timeSlice)
+{
+    _timeSlice = timeSlice;
+    _current = -1;
+    _sliceStart = 0;
+    _lastUpdate = 0;
+}
+
+/**
+ * Adds a job that is not runnable yet. Returns its index
+ */
+int JobScheduler::addJob(unsigned int weight)
+{
+    Entry e;
+    e.weight = weight > 0 ? weight : JOB_DEFAULT_WEIGHT;
+    e.runnable = false;
+    e.woke = false;
+    e.virtualTime = 0.0;
+
+    _jobs.push_back(e);
+
+    return (int)_jobs.size() - 1;
+}
+
+/**
+ * Lowest virtual time of the runnable jobs other than except, or -1 if
+ * there are none
+ */
+double JobScheduler::lowestVirtualTime(int except)
+{
+    double lowest = -1.0;
+
+    for(int i = 0; i < (int)_jobs.size(); i++) {
+        if(i != except && _jobs[i].runnable && (lowest < 0.0 || _jobs[i].virtualTime < lowest)) {
+            lowest = _jobs[i].virtualTime;
+        }
+    }
+
+    return lowest;
+}
+
+void JobScheduler::setRunnable(int job, bool runnable)
+{
+    Entry &e = _jobs[job];
+
+    if(runnable && !e.runnable) {
+        double lowest = lowestVirtualTime(job);
+
+        if(lowest > e.virtualTime) {
+            e.virtualTime = lowest;
+        }
+        e.woke = true;
+    }
+
+    e.runnable = runnable;
+}
+
+/**
+ * Returns the job that should run at time now, in milliseconds, or -1 when
+ * no job is runnable. The time since the last call is charged to the job
+ * that was running
+ */
+int JobScheduler::next(unsigned int now)
+{
+    if(_current >= 0) {
+        _jobs[_current].virtualTime += (double)(now - _lastUpdate) / _jobs[_current].weight;
+    }
+    _lastUpdate = now;
+
+    int best = -1;
+    int preempt = -1;
+
+    for(int i = 0; i < (int)_jobs.size(); i++) {
+        Entry &e = _jobs[i];
+
+        if(!e.runnable) {
+            e.woke = false;
+            continue;
+        }
+
+        if(best < 0 || e.virtualTime < _jobs[best].virtualTime) {
+            best = i;
+        }
+
+        if(e.woke && _current >= 0 && i != _current && e.weight > _jobs[_current].weight
+            && (preempt < 0 || e.weight > _jobs[preempt].weight)) {
+            preempt = i;
+        }
+
+        e.woke = false;
+    }
+
+    int job = _current;
+
+    if(_current < 0 || !_jobs[_current].runnable) {
+        job = best;
+    } else if(preempt >= 0) {
+        job = preempt;
+    } else if(now - _sliceStart >= _timeSlice && best >= 0 && _jobs[best].virtualTime < _jobs[_current].virtualTime) {
+        job = best;
+    }
+
+    if(job != _current) {
+        _current = job;
+        _sliceStart = now;
+    }
+
+    return _current;
+}
+
+int JobScheduler::current()
+{
+    return _current;
+}
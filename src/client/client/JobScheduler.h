@@ -0,0 +1,58 @@
+#ifndef _JOB_SCHEDULER_H
+#define _JOB_SCHEDULER_H
+
+#include <vector>
+
+// Weight of a job that was given none
+#define JOB_DEFAULT_WEIGHT 1
+
+/**
+ * Decides which of the jobs of the client runs. One job runs at a time.
+ *
+ * The runnable jobs share the time in proportion to their weights. Each
+ * job has a virtual time, the time it ran divided by its weight, and the
+ * job with the lowest virtual time runs next. A job keeps running for at
+ * least a time slice before it is switched out, unless it stops being
+ * runnable, so switches stay rare. A job that becomes runnable starts from
+ * the lowest virtual time of the others, so time it was not runnable does
+ * not turn into credit. A job that becomes runnable with a higher weight
+ * than the running one preempts it right away
+ */
+class JobScheduler {
+
+private:
+    typedef struct {
+        unsigned int weight;
+        bool runnable;
+
+        // Set when the job became runnable since the last decision
+        bool woke;
+
+        // Milliseconds run divided by the weight
+        double virtualTime;
+    }Entry;
+
+    std::vector<Entry> _jobs;
+
+    // Milliseconds a job runs before another one may take over
+    unsigned int _timeSlice;
+
+    // Running job, -1 for none, and the time its slice and the last
+    // decision were made
+    int _current;
+    unsigned int _sliceStart;
+    unsigned int _lastUpdate;
+
+    double lowestVirtualTime(int except);
+
+public:
+    JobScheduler(unsigned int timeSlice);
+
+    int addJob(unsigned int weight);
+    void setRunnable(int job, bool runnable);
+
+    int next(unsigned int now);
+    int current();
+};
+
+#endif
@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "Metrics.h"
+#include "threads.h"
+#include "json/json.h"
+
+#define CACHE_LINE_SIZE 64
+
+// Words in a set of counters
+#define METRICS_WORDS (sizeof(MetricsCounters) / sizeof(unsigned long long))
+
+// Sets of counters, aligned to a cache line. The last one is shared by the
+// threads that found no free set
+static unsigned char _memory[(METRICS_MAX_SLOTS + 1) * METRICS_SLOT_SIZE + CACHE_LINE_SIZE];
+static bool _inUse[METRICS_MAX_SLOTS];
+
+// Counts of the sets that were released
+static MetricsCounters _released;
+
+static Mutex _mutex;
+
+static MetricsCounters *getSlot(int i)
+{
+    uintptr_t base = ((uintptr_t)_memory + CACHE_LINE_SIZE - 1) & ~(uintptr_t)(CACHE_LINE_SIZE - 1);
+
+    return (MetricsCounters *)(base + (uintptr_t)i * METRICS_SLOT_SIZE);
+}
+
+/**
+ * Adds the counters in src to dst. src may be written while it is read
+ */
+static void addCounters(MetricsCounters &dst, const MetricsCounters *src)
+{
+    unsigned long long *d = (unsigned long long *)&dst;
+    const volatile unsigned long long *s = (const volatile unsigned long long *)src;
+
+    for(unsigned int i = 0; i < METRICS_WORDS; i++) {
+        d[i] += s[i];
+    }
+}
+
+/**
+ * Gets a set of zeroed counters for the calling thread. When every set is
+ * taken, the thread shares the spare set with the others that found none,
+ * and some of their counts may be lost
+ */
+MetricsCounters *Metrics::acquire()
+{
+    MetricsCounters *counters = getSlot(METRICS_MAX_SLOTS);
+
+    _mutex.grab();
+
+    for(int i = 0; i < METRICS_MAX_SLOTS; i++) {
+        if(!_inUse[i]) {
+            _inUse[i] = true;
+            counters = getSlot(i);
+            memset(counters, 0, sizeof(MetricsCounters));
+            break;
+        }
+    }
+
+    _mutex.release();
+
+    return counters;
+}
+
+/**
+ * Gives back counters from acquire. Their counts stay in the totals
+ */
+void Metrics::release(MetricsCounters *counters)
+{
+    _mutex.grab();
+
+    for(int i = 0; i < METRICS_MAX_SLOTS; i++) {
+        if(_inUse[i] && getSlot(i) == counters) {
+            addCounters(_released, counters);
+            _inUse[i] = false;
+            break;
+        }
+    }
+
+    _mutex.release();
+}
+
+/**
+ * Sum of the counters of every thread since the client started
+ */
+MetricsCounters Metrics::getTotals()
+{
+    _mutex.grab();
+
+    MetricsCounters totals = _released;
+
+    for(int i = 0; i < METRICS_MAX_SLOTS; i++) {
+        if(_inUse[i]) {
+            addCounters(totals, getSlot(i));
+        }
+    }
+    addCounters(totals, getSlot(METRICS_MAX_SLOTS));
+
+    _mutex.release();
+
+    return totals;
+}
+
+/**
+ * Stats line for the log. Counts are totals and rates are over the ms
+ * milliseconds since the totals were last
+ */
+std::string Metrics::toJson(const MetricsCounters &totals, const MetricsCounters &last, unsigned int ms)
+{
+    double seconds = ms > 0 ? ms / 1000.0 : 1.0;
+
+    unsigned long long uploads = totals.uploads - last.uploads;
+    unsigned long long kernel = totals.kernelMicros - last.kernelMicros;
+    unsigned long long host = totals.hostMicros - last.hostMicros;
+
+    Json::Value root(Json::objectValue);
+
+    root["steps"] = (Json::UInt64)totals.steps;
+    root["steps_per_second"] = (totals.steps - last.steps) / seconds;
+    root["points"] = (Json::UInt64)totals.points;
+    root["points_per_second"] = (totals.points - last.points) / seconds;
+    root["cycle_drops"] = (Json::UInt64)totals.cycleDrops;
+    root["queue_drops"] = (Json::UInt64)totals.queueDrops;
+    root["cycle_escapes"] = (Json::UInt64)totals.cycleEscapes;
+    root["restarts"] = (Json::UInt64)totals.restarts;
+
+    root["uploads"] = (Json::UInt64)totals.uploads;
+    root["upload_failures"] = (Json::UInt64)totals.uploadFailures;
+    root["upload_batch"] = uploads > 0 ? (double)(totals.uploadedPoints - last.uploadedPoints) / uploads : 0.0;
+    root["upload_ms"] = uploads > 0 ? (totals.uploadMicros - last.uploadMicros) / 1000.0 / uploads : 0.0;
+
+    // Share of the time the devices were running kernels
+    if(kernel + host > 0) {
+        root["kernel_ms"] = kernel / 1000.0;
+        root["host_ms"] = host / 1000.0;
+        root["device_busy"] = (double)kernel / (kernel + host);
+    }
+
+    Json::FastWriter writer;
+    std::string line = writer.write(root);
+
+    // The writer ends the line
+    if(!line.empty() && line[line.size() - 1] == '\n') {
+        line.erase(line.size() - 1);
+    }
+
+    return line;
+}
+
+static void writeCounter(FILE *fp, const char *name, const char *type, const char *help, const std::string &id, unsigned long long value)
+{
+    fprintf(fp, "# HELP %s %s\n", name, help);
+    fprintf(fp, "# TYPE %s %s\n", name, type);
+    fprintf(fp, "%s{id=\"%s\"} %llu\n", name, id.c_str(), value);
+}
+
+/**
+ * Writes the totals in the Prometheus text format, for the textfile
+ * collector of the node exporter. The file is replaced in one rename so
+ * the collector never reads half of it
+ */
+void Metrics::writePrometheus(const std::string &path, const std::string &id, const MetricsCounters &totals)
+{
+    std::string tmpPath = path + ".tmp";
+
+    FILE *fp = fopen(tmpPath.c_str(), "w");
+    if(fp == NULL) {
+        throw std::string("Error creating metrics file " + tmpPath);
+    }
+
+    writeCounter(fp, "ecdl_steps_total", "counter", "Steps of all walks", id, totals.steps);
+    writeCounter(fp, "ecdl_points_total", "counter", "Distinguished points found", id, totals.points);
+    writeCounter(fp, "ecdl_cycle_drops_total", "counter", "Walks dropped for running too long", id, totals.cycleDrops);
+    writeCounter(fp, "ecdl_queue_drops_total", "counter", "Distinguished points dropped from a full queue", id, totals.queueDrops);
+    writeCounter(fp, "ecdl_cycle_escapes_total", "counter", "Fruitless cycles escaped", id, totals.cycleEscapes);
+    writeCounter(fp, "ecdl_restarts_total", "counter", "Walks moved to a new starting point", id, totals.restarts);
+    writeCounter(fp, "ecdl_kernel_microseconds_total", "counter", "Time the devices ran kernels", id, totals.kernelMicros);
+    writeCounter(fp, "ecdl_host_microseconds_total", "counter", "Time the device threads spent between kernels", id, totals.hostMicros);
+    writeCounter(fp, "ecdl_uploads_total", "counter", "Submissions to the server", id, totals.uploads);
+    writeCounter(fp, "ecdl_uploaded_points_total", "counter", "Points submitted to the server", id, totals.uploadedPoints);
+    writeCounter(fp, "ecdl_upload_microseconds_total", "counter", "Time taken by submissions", id, totals.uploadMicros);
+    writeCounter(fp, "ecdl_upload_failures_total", "counter", "Submissions that failed", id, totals.uploadFailures);
+
+    bool ok = !ferror(fp);
+    if(fclose(fp) != 0) {
+        ok = false;
+    }
+
+    if(!ok) {
+        remove(tmpPath.c_str());
+        throw std::string("Error writing metrics file " + tmpPath);
+    }
+
+#ifdef WIN32
+    // rename does not replace an existing file on Windows
+    remove(path.c_str());
+#endif
+
+    if(rename(tmpPath.c_str(), path.c_str()) != 0) {
+        throw std::string("Error replacing metrics file " + path);
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef _METRICS_H
+#define _METRICS_H
+
+#include <string>
+
+// Most sets of counters in use at once. Threads beyond it share one set
+#define METRICS_MAX_SLOTS 512
+
+// Bytes taken by one set of counters. It is a whole number of cache lines
+// and each set starts on one, so two threads never write to the same line
+#define METRICS_SLOT_SIZE 128
+
+/**
+ * Counters of one walk or upload thread. Every count is cumulative
+ */
+typedef struct {
+    // Steps of all walks
+    unsigned long long steps;
+
+    // Distinguished points found
+    unsigned long long points;
+
+    // Walks dropped for running far longer than a walk to a distinguished
+    // point should, which is what a walk caught in a cycle does
+    unsigned long long cycleDrops;
+
+    // Distinguished points the device found but had no room to queue
+    unsigned long long queueDrops;
+
+    // Fruitless cycles of the negation map that walks left
+    unsigned long long cycleEscapes;
+
+    // Walks moved to a new starting point
+    unsigned long long restarts;
+
+    // Microseconds the device ran kernels, and microseconds the host thread
+    // spent between them reading points and relaunching
+    unsigned long long kernelMicros;
+    unsigned long long hostMicros;
+
+    // Submissions to the server, the points in them and the microseconds
+    // they took, and submissions that failed
+    unsigned long long uploads;
+    unsigned long long uploadedPoints;
+    unsigned long long uploadMicros;
+    unsigned long long uploadFailures;
+}MetricsCounters;
+
+/**
+ * Hot-path counters for the live stats of the client.
+ *
+ * A thread acquires its own set of counters and is the only one writing
+ * them, with plain adds, so counting a step costs an add to a cache line
+ * the thread already owns. No locked instructions or barriers are used.
+ * The stats thread reads the sets while they are written, which gives
+ * totals that are at most a few steps behind. The counts of released sets
+ * are kept in the totals
+ */
+class Metrics {
+
+public:
+    static MetricsCounters *acquire();
+    static void release(MetricsCounters *counters);
+
+    static MetricsCounters getTotals();
+
+    static std::string toJson(const MetricsCounters &totals, const MetricsCounters &last, unsigned int ms);
+    static void writePrometheus(const std::string &path, const std::string &id, const MetricsCounters &totals);
+};
+
+#endif
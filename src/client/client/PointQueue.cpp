@@ -0,0 +1,109 @@
+#include <string.h>
+#include "PointQueue.h"
+
+/**
+ * Creates a queue of size records. size is rounded up to a power of 2
+ */
+PointQueue::PointQueue(unsigned int size)
+{
+    if(size < 2 || size > 0x80000000) {
+        throw std::string("Invalid point queue size");
+    }
+
+    unsigned int capacity = 2;
+    while(capacity < size) {
+        capacity <<= 1;
+    }
+
+    _cells = new Cell[capacity];
+    _mask = capacity - 1;
+
+    for(unsigned int i = 0; i < capacity; i++) {
+        _cells[i].sequence = i;
+    }
+
+    _head = 0;
+    _tail = 0;
+    _dropped = 0;
+}
+
+PointQueue::~PointQueue()
+{
+    delete[] _cells;
+}
+
+/**
+ * Adds a point. Returns false if the queue was full, in which case the
+ * point is dropped
+ */
+bool PointQueue::push(const struct CallbackParameters *p)
+{
+    unsigned int pos = atomicLoad(&_head);
+    Cell *cell = NULL;
+
+    while(true) {
+        cell = &_cells[pos & _mask];
+        int diff = (int)(atomicLoad(&cell->sequence) - pos);
+
+        if(diff == 0) {
+            // The cell is free. Claim it
+            unsigned int prev = atomicCompareAndSwap(&_head, pos, pos + 1);
+            if(prev == pos) {
+                break;
+            }
+            pos = prev;
+        } else if(diff < 0) {
+            // The consumer has not read this cell yet, so the queue is full
+            atomicAdd(&_dropped, 1);
+            return false;
+        } else {
+            // Another producer claimed it first
+            pos = atomicLoad(&_head);
+        }
+    }
+
+    memcpy(cell->record.a, p->aStart, sizeof(cell->record.a));
+    memcpy(cell->record.b, p->bStart, sizeof(cell->record.b));
+    memcpy(cell->record.x, p->x, sizeof(cell->record.x));
+    memcpy(cell->record.y, p->y, sizeof(cell->record.y));
+    cell->record.length = p->length;
+
+    // Publish the record to the consumer
+    atomicStore(&cell->sequence, pos + 1);
+
+    return true;
+}
+
+/**
+ * Moves up to count records into records and returns how many were moved.
+ * Only one thread may call this
+ */
+unsigned int PointQueue::pop(PointRecord *records, unsigned int count)
+{
+    unsigned int n = 0;
+
+    while(n < count) {
+        Cell *cell = &_cells[_tail & _mask];
+
+        if((int)(atomicLoad(&cell->sequence) - (_tail + 1)) < 0) {
+            break;
+        }
+
+        records[n] = cell->record;
+        n++;
+
+        // Free the cell for the producer that wraps around to it
+        atomicStore(&cell->sequence, _tail + _mask + 1);
+        _tail++;
+    }
+
+    return n;
+}
+
+/**
+ * Returns the number of points dropped since the last call
+ */
+unsigned int PointQueue::takeDropped()
+{
+    return atomicExchange(&_dropped, 0);
+}
@@ -0,0 +1,62 @@
+#ifndef _POINT_QUEUE_H
+#define _POINT_QUEUE_H
+
+#include "threads.h"
+#include "ECDLContext.h"
+
+// Default number of records the queue holds
+#define POINT_QUEUE_SIZE (1 << 15)
+
+// Keeps the producer and consumer indices on separate cache lines
+#define POINT_QUEUE_PADDING 64
+
+/**
+ * A distinguished point as fixed-size arrays of 32-bit words, least
+ * significant word first
+ */
+typedef struct {
+    unsigned int a[POINT_WORDS];
+    unsigned int b[POINT_WORDS];
+    unsigned int x[POINT_WORDS];
+    unsigned int y[POINT_WORDS];
+    unsigned long long length;
+}PointRecord;
+
+/**
+ * Bounded lock-free queue of distinguished points. Any number of threads
+ * push and a single thread pops.
+ *
+ * Each cell has a sequence number. A producer claims the cell at the head
+ * by advancing the head with a compare-and-swap when the sequence says the
+ * cell is free, writes the record and then publishes it by bumping the
+ * sequence. push() never locks or allocates. When the queue is full the
+ * point is dropped and counted
+ */
+class PointQueue {
+
+private:
+    typedef struct {
+        volatile unsigned int sequence;
+        PointRecord record;
+    }Cell;
+
+    Cell *_cells;
+    unsigned int _mask;
+
+    char _pad0[POINT_QUEUE_PADDING];
+    volatile unsigned int _head;
+    char _pad1[POINT_QUEUE_PADDING];
+    unsigned int _tail;
+    char _pad2[POINT_QUEUE_PADDING];
+    volatile unsigned int _dropped;
+
+public:
+    PointQueue(unsigned int size = POINT_QUEUE_SIZE);
+    ~PointQueue();
+
+    bool push(const struct CallbackParameters *p);
+    unsigned int pop(PointRecord *records, unsigned int count);
+    unsigned int takeDropped();
+};
+
+#endif
@@ -0,0 +1,153 @@
+#include <string.h>
+#include "PointSpool.h"
+#include "util.h"
+
+/**
+ * Opens the spool at path, creating it if it does not exist. Points left
+ * over from a previous run are kept and submitted first
+ */
+PointSpool::PointSpool(std::string path)
+{
+    _path = path;
+    _fp = fopen(path.c_str(), "r+b");
+
+    if(_fp == NULL) {
+        create();
+        return;
+    }
+
+    fseek(_fp, 0, SEEK_END);
+    long fileSize = ftell(_fp);
+
+    // A file without a header was being created when the process died,
+    // so it cannot hold any points
+    if(fileSize < (long)sizeof(PointSpoolHeader)) {
+        fclose(_fp);
+        create();
+        return;
+    }
+
+    fseek(_fp, 0, SEEK_SET);
+    if(fread(&_header, sizeof(_header), 1, _fp) != 1) {
+        fclose(_fp);
+        throw std::string("Error reading spool file " + path);
+    }
+
+    if(memcmp(_header.magic, POINT_SPOOL_MAGIC, 4) != 0 || _header.version != POINT_SPOOL_VERSION || _header.recordSize != sizeof(PointRecord)) {
+        fclose(_fp);
+        throw std::string("Invalid spool file " + path);
+    }
+
+    // A record cut short by a crash is ignored and overwritten by the next append
+    _count = (fileSize - sizeof(PointSpoolHeader)) / sizeof(PointRecord);
+
+    if(_header.consumed > _count) {
+        _header.consumed = _count;
+    }
+}
+
+PointSpool::~PointSpool()
+{
+    if(_fp != NULL) {
+        fclose(_fp);
+    }
+}
+
+/**
+ * Creates an empty spool, replacing any existing file
+ */
+void PointSpool::create()
+{
+    _fp = fopen(_path.c_str(), "w+b");
+    if(_fp == NULL) {
+        throw std::string("Error creating spool file " + _path);
+    }
+
+    memset(&_header, 0, sizeof(_header));
+    memcpy(_header.magic, POINT_SPOOL_MAGIC, 4);
+    _header.version = POINT_SPOOL_VERSION;
+    _header.recordSize = sizeof(PointRecord);
+    _header.consumed = 0;
+
+    _count = 0;
+
+    writeHeader();
+}
+
+void PointSpool::writeHeader()
+{
+    fseek(_fp, 0, SEEK_SET);
+    if(fwrite(&_header, sizeof(_header), 1, _fp) != 1) {
+        throw std::string("Error writing spool file " + _path);
+    }
+
+    util::syncFile(_fp);
+}
+
+/**
+ * Appends records to the spool. They are on disk when this returns
+ */
+void PointSpool::append(const PointRecord *records, unsigned int count)
+{
+    if(count == 0) {
+        return;
+    }
+
+    fseek(_fp, sizeof(PointSpoolHeader) + _count * sizeof(PointRecord), SEEK_SET);
+    if(fwrite(records, sizeof(PointRecord), count, _fp) != count) {
+        throw std::string("Error writing spool file " + _path);
+    }
+
+    util::syncFile(_fp);
+
+    _count += count;
+}
+
+/**
+ * Reads up to count of the oldest unconsumed records without consuming
+ * them. Returns the number read
+ */
+unsigned int PointSpool::read(std::vector<PointRecord> &records, unsigned int count)
+{
+    unsigned long long available = _count - _header.consumed;
+    if(count > available) {
+        count = (unsigned int)available;
+    }
+
+    records.resize(count);
+    if(count == 0) {
+        return 0;
+    }
+
+    fseek(_fp, sizeof(PointSpoolHeader) + _header.consumed * sizeof(PointRecord), SEEK_SET);
+    if(fread(&records[0], sizeof(PointRecord), count, _fp) != count) {
+        throw std::string("Error reading spool file " + _path);
+    }
+
+    return count;
+}
+
+/**
+ * Marks the count oldest records as submitted. The file is emptied once
+ * nothing is left in it
+ */
+void PointSpool::consume(unsigned int count)
+{
+    _header.consumed += count;
+
+    if(_header.consumed >= _count) {
+        fclose(_fp);
+        _fp = NULL;
+        create();
+    } else {
+        writeHeader();
+    }
+}
+
+/**
+ * Number of records waiting to be submitted
+ */
+unsigned long long PointSpool::size()
+{
+    return _count - _header.consumed;
+}
@@ -0,0 +1,63 @@
+#ifndef _POINT_SPOOL_H
+#define _POINT_SPOOL_H
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "PointQueue.h"
+
+#define POINT_SPOOL_MAGIC "ECSP"
+#define POINT_SPOOL_VERSION 1
+
+// The spool of a job is named after its id
+#define POINT_SPOOL_EXTENSION ".spool"
+
+/**
+ * Header at the start of the spool file
+ */
+typedef struct {
+    char magic[4];
+    unsigned int version;
+    unsigned int recordSize;
+    unsigned int reserved;
+
+    // Number of records at the start of the file that were submitted
+    unsigned long long consumed;
+}PointSpoolHeader;
+
+/**
+ * Append-only file of distinguished points that have not been submitted
+ * yet. The upload thread appends what it drains from the point queue and
+ * removes points once the server accepted them, so points survive the
+ * process dying and memory stays flat while the server is down.
+ *
+ * Each append is synced to disk once. Submitted points are only marked as
+ * consumed in the header, and the file is truncated once all its points
+ * are consumed. A crash between a submission and the header update sends
+ * those points again, which the server treats as duplicates
+ */
+class PointSpool {
+
+private:
+    std::string _path;
+    FILE *_fp;
+
+    PointSpoolHeader _header;
+
+    // Records in the file, consumed or not
+    unsigned long long _count;
+
+    void create();
+    void writeHeader();
+
+public:
+    PointSpool(std::string path);
+    ~PointSpool();
+
+    void append(const PointRecord *records, unsigned int count);
+    unsigned int read(std::vector<PointRecord> &records, unsigned int count);
+    void consume(unsigned int count);
+    unsigned long long size();
+};
+
+#endif
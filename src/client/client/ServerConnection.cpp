@@ -1,12 +1,15 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <ctype.h>
 #include <iostream>
 #include <string>
 #include <curl/curl.h>
 #include "json/json.h"
 #include "ServerConnection.h"
+#include "ECDLContext.h"
 #include "logger.h"
+#include "util.h"
 
 static std::string toString(int x)
 {
@@ -34,7 +37,79 @@ static std::string encodePoints(std::vector<DistinguishedPoint> points)
     return writer.write(root);
 }
 
-static int decodeStatusMsg(std::string encoded)
+/**
+ * Appends an unsigned LEB128 integer
+ */
+static void writeVarint(std::string &buf, unsigned long long value)
+{
+    while(value >= 0x80) {
+        buf += (char)((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+
+    buf += (char)value;
+}
+
+/**
+ * Appends the low len bytes of value, little endian
+ */
+static void writeInt(std::string &buf, const BigInteger &value, unsigned int len)
+{
+    size_t size = value.getByteLength() > len ? value.getByteLength() : len;
+    std::vector<unsigned char> bytes(size);
+
+    value.getBytes(&bytes[0], size);
+
+    buf.append((const char *)&bytes[0], len);
+}
+
+/**
+ * Encodes points in the binary format:
+ *
+ *  "ECDP", version byte, varint count and then for each point
+ *  varint length, a and b in nLen bytes, x in xLen bytes
+ *
+ * The x field holds x >> dBits, since those bits are 0 in a distinguished
+ * point, with the parity of y in the bit above it
+ */
+static std::string encodePointsBinary(std::vector<DistinguishedPoint> &points, const SubmitFormat &format)
+{
+    std::string buf(BINARY_MAGIC);
+    buf += (char)BINARY_VERSION;
+
+    writeVarint(buf, points.size());
+
+    BigInteger parityBit = BigInteger(2).pow(format.pBits - format.dBits);
+
+    for(unsigned int i = 0; i < points.size(); i++) {
+        writeVarint(buf, points[i].length);
+        writeInt(buf, points[i].a, format.nLen);
+        writeInt(buf, points[i].b, format.nLen);
+
+        BigInteger x = points[i].x.rshift(format.dBits);
+        if(points[i].y.lsb()) {
+            x = x + parityBit;
+        }
+        writeInt(buf, x, format.xLen);
+    }
+
+    return buf;
+}
+
+static SubmitFormat getSubmitFormat(const ParamsMsg &params)
+{
+    SubmitFormat format;
+
+    format.binary = params.binaryVersion == BINARY_VERSION;
+    format.dBits = params.dBits;
+    format.pBits = params.p.getBitLength();
+    format.nLen = (params.n.getBitLength() + 7) / 8;
+    format.xLen = (format.pBits - format.dBits + 8) / 8;
+
+    return format;
+}
+
+static int decodeStatusMsg(std::string encoded, bool &longPoll, unsigned int &dBits)
 {
     Json::Value root;
     Json::Reader reader;
@@ -46,6 +121,12 @@ static int decodeStatusMsg(std::string encoded)
 
     std::string statusString = root.get("status", "").asString();
 
+    // Servers that hold status requests say so in every response
+    longPoll = root.get("long_poll", false).asBool();
+
+    // Servers that cannot change the distinguished bits do not send them
+    dBits = root.get("bits", 0).asUInt();
+
     if(statusString == "unsolved") {
         return SERVER_STATUS_RUNNING;
     } else if(statusString == "solved") {
@@ -55,6 +136,14 @@ static int decodeStatusMsg(std::string encoded)
     throw "Unknown status '" + statusString + "'";
 }
 
+/**
+ * Name the server uses for a status
+ */
+static std::string encodeStatus(int status)
+{
+    return status == SERVER_STATUS_STOPPED ? "solved" : "unsolved";
+}
+
 /**
  * Reads a BigInteger from a JSON string
  */
@@ -91,18 +180,77 @@ static ParamsMsg decodeParametersMsg(std::string encoded)
     paramsMsg.qx = readBigInt(params, "qx");
     paramsMsg.qy = readBigInt(params, "qy");
     paramsMsg.dBits = params.get("bits", -1).asInt();
+    paramsMsg.negation = params.get("negation", false).asBool();
+
+    // Older servers only have rho walks
+    paramsMsg.kangaroo = params.get("walk", "rho").asString() == "kangaroo";
+    if(paramsMsg.kangaroo) {
+        paramsMsg.lower = readBigInt(params, "lower");
+        paramsMsg.upper = readBigInt(params, "upper");
+        paramsMsg.walks = params.get("walks", 1).asUInt();
+    }
 
-    // Decode R points
+    // Servers without the binary format do not send a version
+    paramsMsg.binaryVersion = root.get("binary_version", 0).asInt();
+    paramsMsg.maxBatchSize = root.get("max_batch_size", 0).asUInt();
+
+    // Decode R points. The walk selects them with a bit mask
     Json::Value points = root["points"];
-    for(int i = 0; i < 32; i++) {
+    unsigned int numRPoints = points.size();
+
+    if(numRPoints < MIN_R_POINTS || numRPoints > MAX_R_POINTS || (numRPoints & (numRPoints - 1)) != 0) {
+        throw std::string("Parsing error: invalid number of R points");
+    }
+
+    for(unsigned int i = 0; i < numRPoints; i++) {
         Json::Value point = points[i];
-        paramsMsg.rx[i] = readBigInt(point, "x");
-        paramsMsg.ry[i] = readBigInt(point, "y");
+        paramsMsg.rx.push_back(readBigInt(point, "x"));
+        paramsMsg.ry.push_back(readBigInt(point, "y"));
     }
 
     return paramsMsg;
 }
 
+/**
+ * Reads the Retry-After header of a response. Only the delay in seconds
+ * form is understood. Returns SERVER_BUSY_DELAY if there is none
+ */
+static unsigned int parseRetryAfter(const std::string &headers)
+{
+    const char *name = "retry-after:";
+    size_t nameLen = strlen(name);
+
+    size_t start = 0;
+    while(start < headers.size()) {
+        size_t end = headers.find('\n', start);
+        if(end == std::string::npos) {
+            end = headers.size();
+        }
+
+        std::string line = headers.substr(start, end - start);
+        start = end + 1;
+
+        // Header names are case insensitive
+        bool match = line.size() >= nameLen;
+        for(size_t i = 0; match && i < nameLen; i++) {
+            match = tolower(line[i]) == name[i];
+        }
+
+        if(!match) {
+            continue;
+        }
+
+        char *endPtr = NULL;
+        unsigned long seconds = strtoul(line.c_str() + nameLen, &endPtr, 10);
+
+        if(endPtr != line.c_str() + nameLen) {
+            return (unsigned int)seconds;
+        }
+    }
+
+    return SERVER_BUSY_DELAY;
+}
+
 /**
  * CURL callback. Appends data string
  */
@@ -135,113 +283,294 @@ ServerConnection::ServerConnection(std::string host, int port)
     sprintf(buf, "%d", port);
 
     _url = host + ":" + std::string(buf);
+
+    _longPoll = false;
+
+    curl_global_init(CURL_GLOBAL_ALL);
 }
 
+ServerConnection::~ServerConnection()
+{
+    for(size_t i = 0; i < _handles.size(); i++) {
+        curl_easy_cleanup(_handles[i]);
+    }
 
-ParamsMsg ServerConnection::getParameters(std::string id)
+    _mutex.destroy();
+}
+
+/**
+ * Takes an idle handle, or creates one if every handle is in use
+ */
+CURL *ServerConnection::acquireHandle()
 {
-    CURL *curl;
+    CURL *curl = NULL;
 
-    std::string url = _url + "/params/" + id;
-    std::string result;
-    long httpCode = 0; 
-    curl = curl_easy_init();
+    _mutex.grab();
+    if(!_handles.empty()) {
+        curl = _handles.back();
+        _handles.pop_back();
+    }
+    _mutex.release();
+
+    if(curl == NULL) {
+        curl = curl_easy_init();
+    }
+
+    if(curl == NULL) {
+        throw std::string("Error initializing curl");
+    }
+
+    return curl;
+}
+
+/**
+ * Returns a handle to the idle handles, keeping its connection open for
+ * the next request
+ */
+void ServerConnection::releaseHandle(CURL *curl)
+{
+    _mutex.grab();
+    _handles.push_back(curl);
+    _mutex.release();
+}
+
+/**
+ * Performs one request on curl. requestHeaders are whole header lines sent
+ * with a POST request
+ */
+CURLcode ServerConnection::perform(CURL *curl, std::string url, const std::string *body, std::string contentType, std::string &result, std::string &headerData, long *httpCode, const std::vector<std::string> *requestHeaders)
+{
+    struct curl_slist *headers = NULL;
+
+    // Clears the options of the last request but keeps its connection
+    curl_easy_reset(curl);
 
     curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curlCallback);
     curl_easy_setopt(curl, CURLOPT_WRITEDATA, &result);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, curlCallback);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &headerData);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, (long)SERVER_CONNECT_TIMEOUT);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT, (long)SERVER_TIMEOUT);
+
+    if(body != NULL) {
+        std::string header = "Content-Type: " + contentType;
+        headers = curl_slist_append(headers, header.c_str());
+
+        if(requestHeaders != NULL) {
+            for(size_t i = 0; i < requestHeaders->size(); i++) {
+                headers = curl_slist_append(headers, (*requestHeaders)[i].c_str());
+            }
+        }
+
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body->data());
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)body->size());
+    }
 
     CURLcode res = curl_easy_perform(curl);
-    if(res != CURLE_OK) {
+
+    if(res == CURLE_OK) {
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, httpCode);
+    }
+
+    curl_slist_free_all(headers);
+
+    return res;
+}
+
+/**
+ * Sends a GET request, or a POST request when body is not NULL, and returns
+ * the HTTP status code. A request that gets no response is retried with
+ * exponential backoff
+ */
+long ServerConnection::request(std::string url, const std::string *body, std::string contentType, std::string &result, std::string *headers, const std::vector<std::string> *requestHeaders)
+{
+    unsigned int delay = SERVER_RETRY_DELAY;
+
+    for(int attempt = 0; ; attempt++) {
+        long httpCode = 0;
+        std::string headerData;
+        result = "";
+
+        CURL *curl = acquireHandle();
+        CURLcode res = perform(curl, url, body, contentType, result, headerData, &httpCode, requestHeaders);
+        releaseHandle(curl);
+
+        if(res == CURLE_OK) {
+            if(headers != NULL) {
+                *headers = headerData;
+            }
+            return httpCode;
+        }
+
         std::string errorMsg(curl_easy_strerror(res));
-        printf("curl error: %s\n", errorMsg.c_str());
-        curl_easy_cleanup(curl);
-        throw errorMsg;
+
+        if(attempt == SERVER_RETRIES) {
+            throw errorMsg;
+        }
+
+        Logger::logInfo("curl error: %s. Retrying in %d ms", errorMsg.c_str(), delay);
+
+        // The jitter keeps clients that lost the server at the same time
+        // from reconnecting at the same time
+        util::sleep(delay + rand() % (delay / 2 + 1));
+        delay *= 2;
     }
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpCode);
+}
+
+ParamsMsg ServerConnection::getParameters(std::string id)
+{
+    std::string url = _url + "/params/" + id;
+    std::string result;
+
+    long httpCode = request(url, NULL, "", result);
 
     if(httpCode != 200) {
-        curl_easy_cleanup(curl);
         throw std::string("HTTP error " + toString(httpCode));
     }
 
-    curl_easy_cleanup(curl);
+    ParamsMsg paramsMsg = decodeParametersMsg(result);
 
-    return decodeParametersMsg(result);
-}
+    _mutex.grab();
+    _formats[id] = getSubmitFormat(paramsMsg);
+    _mutex.release();
 
+    return paramsMsg;
+}
 
-void ServerConnection::submitPoints(std::string id, std::vector<DistinguishedPoint> &points)
+/**
+ * Submits points in the binary format when the server takes it, and as
+ * JSON otherwise. A server that answers 415 to a binary submission gets
+ * JSON from then on.
+ *
+ * dropped are the walks dropped since the last submission that was taken,
+ * which the server counts against the client.
+ *
+ * Returns false if the server is too busy (HTTP 429). retryAfter is then
+ * set to the number of seconds it asked the client to wait
+ */
+bool ServerConnection::submitPoints(std::string id, std::vector<DistinguishedPoint> &points, unsigned long long dropped, unsigned int &retryAfter)
 {
-    std::string encodedPoints = encodePoints(points);
-
-    CURL *curl;
-
     std::string url = _url + "/submit/" + id;
     std::string result;
+    std::string headers;
     long httpCode = 0;
 
-    curl = curl_easy_init();
+    std::vector<std::string> requestHeaders;
+    if(!_clientId.empty()) {
+        requestHeaders.push_back(std::string(CLIENT_HEADER) + ": " + _clientId);
+    }
 
-    struct curl_slist *headers = NULL;
-    headers = curl_slist_append(headers, "Content-Type: application/json");
+    char droppedStr[24] = {0};
+    sprintf(droppedStr, "%llu", dropped);
+    requestHeaders.push_back(std::string(DROPPED_HEADER) + ": " + droppedStr);
 
-    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-    curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, NULL);
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, encodedPoints.c_str());
+    SubmitFormat format;
+    format.binary = false;
 
-    CURLcode res = curl_easy_perform(curl);
-    if(res != CURLE_OK) {
-        std::string errorMsg(curl_easy_strerror(res));        
-        curl_easy_cleanup(curl);
-        throw errorMsg;
+    _mutex.grab();
+    std::map<std::string, SubmitFormat>::iterator i = _formats.find(id);
+    if(i != _formats.end()) {
+        format = i->second;
+    }
+    _mutex.release();
+
+    if(format.binary) {
+        std::string body = encodePointsBinary(points, format);
+        httpCode = request(url, &body, BINARY_CONTENT_TYPE, result, &headers, &requestHeaders);
+
+        if(httpCode == 200) {
+            return true;
+        }
+
+        if(httpCode == 429) {
+            retryAfter = parseRetryAfter(headers);
+            return false;
+        }
+
+        if(httpCode != 415) {
+            throw std::string("HTTP error " + toString(httpCode));
+        }
+
+        Logger::logInfo("Server does not take binary submissions, using JSON");
+
+        _mutex.grab();
+        _formats[id].binary = false;
+        _mutex.release();
     }
 
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpCode);
+    std::string body = encodePoints(points);
+    httpCode = request(url, &body, "application/json", result, &headers, &requestHeaders);
+
+    if(httpCode == 429) {
+        retryAfter = parseRetryAfter(headers);
+        return false;
+    }
 
     if(httpCode != 200) {
-        curl_easy_cleanup(curl);
         throw std::string("HTTP error " + toString(httpCode));
     }
-    curl_easy_cleanup(curl);
+
+    return true;
 }
 
-int ServerConnection::getStatus(std::string id)
+/**
+ * Gets the status of a job. If current is a status and wait is not 0, a
+ * server that supports long polling holds the request until the status is
+ * no longer current, or the distinguished bits are no longer currentBits,
+ * for at most wait seconds. dBits is set to the distinguished bits the
+ * walks of the job stop at, or 0 if the server does not say
+ */
+int ServerConnection::getStatus(std::string id, int current, unsigned int wait, unsigned int currentBits, unsigned int *dBits)
 {
-    CURL *curl = NULL;
-    CURLcode res;
-    long httpCode = 0;
-
     std::string url = _url + "/status/" + id;
-    std::string result = "";
+    std::string result;
 
-    curl = curl_easy_init();
+    if(current >= 0 && wait > 0) {
+        url += "?status=" + encodeStatus(current) + "&wait=" + toString(wait);
 
-    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-    curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, NULL);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curlCallback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &result);
-    res = curl_easy_perform(curl);
-
-    if(res != CURLE_OK) {
-        std::string errorMsg(curl_easy_strerror(res));
-        curl_easy_cleanup(curl);
-        throw errorMsg;
+        // The server also answers when the distinguished bits change
+        if(currentBits > 0) {
+            url += "&bits=" + toString(currentBits);
+        }
     }
 
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpCode);
+    long httpCode = request(url, NULL, "", result);
 
     if(httpCode == 404) {
-        curl_easy_cleanup(curl);
         throw std::string("id does not exist");
     } else if(httpCode != 200) {
-        std::string errorMsg("HTTP error " + toString(httpCode));
-        curl_easy_cleanup(curl);
-        throw errorMsg;
+        throw std::string("HTTP error " + toString(httpCode));
     }
 
-    curl_easy_cleanup(curl);
-   
-    return decodeStatusMsg(result);
+    bool longPoll = false;
+    unsigned int bits = 0;
+    int status = decodeStatusMsg(result, longPoll, bits);
+    _longPoll = longPoll;
+
+    if(dBits != NULL) {
+        *dBits = bits;
+    }
+
+    return status;
+}
+
+/**
+ * True if the last status response came from a server that holds status
+ * requests. Otherwise the caller has to wait between requests itself
+ */
+bool ServerConnection::supportsLongPoll()
+{
+    return _longPoll;
+}
+
+/**
+ * Sets the name sent with submissions. Called before points are submitted
+ */
+void ServerConnection::setClientId(const std::string &clientId)
+{
+    _clientId = clientId;
 }
@@ -1,11 +1,41 @@
 #ifndef _SERVER_H
 #define _SERVER_H
 
+#include <map>
 #include <string>
+#include <vector>
+#include <curl/curl.h>
 #include "BigInteger.h"
+#include "threads.h"
 
 #define DEFAULT_PORT 9999
 
+// Requests that get no response are retried this many times. The delay
+// starts at SERVER_RETRY_DELAY milliseconds and doubles on each attempt
+#define SERVER_RETRIES 4
+#define SERVER_RETRY_DELAY 1000
+
+// Timeouts in seconds
+#define SERVER_CONNECT_TIMEOUT 30
+#define SERVER_TIMEOUT 120
+
+// Seconds to wait after an HTTP 429 that has no usable Retry-After header
+#define SERVER_BUSY_DELAY 30
+
+/**
+ * Binary format for submitting distinguished points. It is used when the
+ * server lists this version in /params, otherwise points are sent as JSON
+ */
+#define BINARY_CONTENT_TYPE "application/x-ecdl-points"
+#define BINARY_MAGIC "ECDP"
+#define BINARY_VERSION 1
+
+// Headers of a submission naming the client, and giving the walks it
+// dropped since its last submission. The server keeps stats of the walks
+// of each client from them
+#define CLIENT_HEADER "X-ECDL-Client"
+#define DROPPED_HEADER "X-ECDL-Dropped"
+
 enum {
     SERVER_STATUS_RUNNING,
     SERVER_STATUS_STOPPED
@@ -18,6 +48,19 @@ class ParamsMsg {
 
 public:
     unsigned int dBits;
+    bool negation;
+
+    // Kangaroo walk, the interval of the logarithm and the walks expected
+    bool kangaroo;
+    BigInteger lower;
+    BigInteger upper;
+    unsigned int walks;
+
+    // Binary submission version the server accepts, 0 for JSON only
+    int binaryVersion;
+
+    // Most points the server takes in one submission, 0 for no limit
+    unsigned int maxBatchSize;
     BigInteger p;
     BigInteger a;
     BigInteger b;
@@ -26,8 +69,8 @@ public:
     BigInteger gy;
     BigInteger qx;
     BigInteger qy;
-    BigInteger rx[32];
-    BigInteger ry[32];
+    std::vector<BigInteger> rx;
+    std::vector<BigInteger> ry;
 };
 
 /**
@@ -52,6 +95,19 @@ public:
     unsigned int length;
 };
 
+/**
+ * How the points of a job are submitted
+ */
+typedef struct {
+    bool binary;
+
+    // Field sizes of the binary format
+    unsigned int dBits;
+    unsigned int pBits;
+    unsigned int nLen;
+    unsigned int xLen;
+}SubmitFormat;
+
 /**
  * Represents a connection the server
  */
@@ -62,12 +118,39 @@ private:
     std::string _host;
     std::string _url;
 
+    // Submission format of each job, set when its parameters are read
+    std::map<std::string, SubmitFormat> _formats;
+
+    // Idle curl handles. Each keeps its connection to the server open.
+    // A status request can wait on the server for a long time, so every
+    // request in flight has its own handle
+    std::vector<CURL *> _handles;
+
+    // Set when the server holds status requests until the status changes
+    bool _longPoll;
+
+    // Name sent with submissions, empty for none
+    std::string _clientId;
+
+    // Guards _handles and _formats, since points are submitted from a
+    // different thread than the status is polled from
+    Mutex _mutex;
+
+    CURL *acquireHandle();
+    void releaseHandle(CURL *curl);
+
+    CURLcode perform(CURL *curl, std::string url, const std::string *body, std::string contentType, std::string &result, std::string &headers, long *httpCode, const std::vector<std::string> *requestHeaders);
+    long request(std::string url, const std::string *body, std::string contentType, std::string &result, std::string *headers = NULL, const std::vector<std::string> *requestHeaders = NULL);
+
 public:
     ServerConnection(std::string host, int port=DEFAULT_PORT);
+    ~ServerConnection();
 
-    int getStatus(std::string id);
+    int getStatus(std::string id, int current = -1, unsigned int wait = 0, unsigned int currentBits = 0, unsigned int *dBits = NULL);
+    bool supportsLongPoll();
+    void setClientId(const std::string &clientId);
     ParamsMsg getParameters(std::string id);
-    void submitPoints(std::string id, std::vector<DistinguishedPoint> &points);
+    bool submitPoints(std::string id, std::vector<DistinguishedPoint> &points, unsigned long long dropped, unsigned int &retryAfter);
 };
 
 #endif
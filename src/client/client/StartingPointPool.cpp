@@ -0,0 +1,335 @@
+#include <string.h>
+#include "StartingPointPool.h"
+#include "util.h"
+
+StartingPointPool::StartingPointPool(const ECDLPParams *params, bool offsetRestarts, unsigned int size)
+{
+    _params = *params;
+    _curve = ECCurve(_params.p, _params.n, _params.a, _params.b, _params.gx, _params.gy);
+
+    ECPoint g(_params.gx, _params.gy);
+    ECPoint q(_params.qx, _params.qy);
+
+    _fixedCurve = getFixedCurve(_curve);
+
+    if(_fixedCurve != NULL) {
+        _fixedCurve->setBasePoints(g, q);
+    } else {
+        _gTable = ECFixedBaseTable(_curve, g);
+        _qTable = ECFixedBaseTable(_curve, q);
+    }
+
+    _dpModulus = BigInteger(2).pow(_params.dBits);
+
+    if(_params.kangaroo) {
+        _width = _params.upper - _params.lower;
+        _wildBase = (_params.n - (_width >> 1)) % _params.n;
+    }
+
+    _size = size;
+
+    _running = true;
+    _thread = new Thread(&StartingPointPool::refillThreadEntry, this);
+
+    _offsetRestarts = offsetRestarts;
+    if(_offsetRestarts && _params.kangaroo) {
+        BigInteger t = kangarooOffset(_params);
+        ECPoint p = _curve.multiply(t, g);
+
+        t.getWords(_offsetPoint.a, STARTING_POINT_WORDS);
+        BigInteger(0).getWords(_offsetPoint.b, STARTING_POINT_WORDS);
+        p.x.getWords(_offsetPoint.x, STARTING_POINT_WORDS);
+        p.y.getWords(_offsetPoint.y, STARTING_POINT_WORDS);
+    } else if(_offsetRestarts) {
+        get(_offsetPoint);
+    }
+
+    if(_offsetRestarts) {
+
+        _offsetA = BigInteger(_offsetPoint.a, STARTING_POINT_WORDS);
+        _offsetB = BigInteger(_offsetPoint.b, STARTING_POINT_WORDS);
+        _offset = ECPoint(BigInteger(_offsetPoint.x, STARTING_POINT_WORDS), BigInteger(_offsetPoint.y, STARTING_POINT_WORDS));
+    }
+}
+
+StartingPointPool::~StartingPointPool()
+{
+    _running = false;
+    _thread->wait();
+    delete _thread;
+    delete _fixedCurve;
+
+    _mutex.destroy();
+}
+
+/**
+ * Copies len 32-bit words into a starting point value
+ */
+static void setWords(const unsigned int *words, int len, unsigned long *dest)
+{
+    const int perWord = sizeof(unsigned long) / sizeof(unsigned int);
+
+    memset(dest, 0, sizeof(unsigned long) * STARTING_POINT_WORDS);
+
+    for(int i = 0; i < len; i++) {
+        dest[i / perWord] |= (unsigned long)words[i] << (32 * (i % perWord));
+    }
+}
+
+/**
+ * Checks for the dBits low zero bits of a distinguished point
+ */
+static bool isDistinguished(const unsigned int *x, int len, unsigned int dBits)
+{
+    for(int i = 0; i < len && dBits > 0; i++) {
+        unsigned int mask = dBits >= 32 ? ~0u : (1u << dBits) - 1;
+
+        if(x[i] & mask) {
+            return false;
+        }
+
+        dBits = dBits >= 32 ? dBits - 32 : 0;
+    }
+
+    return true;
+}
+
+void *StartingPointPool::refillThreadEntry(void *ptr)
+{
+    ((StartingPointPool *)ptr)->refillThreadFunction();
+
+    return NULL;
+}
+
+/**
+ * Tops the pool up whenever it drops below half full
+ */
+void StartingPointPool::refillThreadFunction()
+{
+    while(_running) {
+        _mutex.grab();
+        size_t count = _points.size();
+        _mutex.release();
+
+        if(count >= _size / 2) {
+            util::sleep(10);
+            continue;
+        }
+
+        std::vector<StartingPoint> points;
+        generate(points, STARTING_POINT_BATCH_SIZE);
+
+        _mutex.grab();
+        _points.insert(_points.end(), points.begin(), points.end());
+        _mutex.release();
+    }
+}
+
+/**
+ * Coefficients of the i-th point of a batch for a kangaroo job. Even points
+ * are tame and odd points are wild
+ */
+void StartingPointPool::kangarooScalars(unsigned int i, BigInteger &a, BigInteger &b)
+{
+    BigInteger r = randomBigInteger(0, _width);
+
+    if(i & 1) {
+        a = (_wildBase + r) % _params.n;
+        b = BigInteger(1);
+    } else {
+        a = _params.lower + r;
+        b = BigInteger(0);
+    }
+}
+
+/**
+ * Generates up to count random points aG + bQ whose x is not a distinguished
+ * point. With the negation map each point is the one of P and -P with an
+ * even y, and a and b are negated to match
+ */
+void StartingPointPool::generate(std::vector<StartingPoint> &points, unsigned int count)
+{
+    if(_fixedCurve != NULL) {
+        generateFixed(points, count);
+        return;
+    }
+
+    std::vector<BigInteger> a(count);
+    std::vector<BigInteger> b(count);
+    std::vector<ECPointJacobian> sums(count);
+    std::vector<ECPoint> affine(count);
+
+    for(unsigned int i = 0; i < count; i++) {
+        if(_params.kangaroo) {
+            kangarooScalars(i, a[i], b[i]);
+        } else {
+            // 1 < a,b < n
+            a[i] = randomBigInteger(2, _params.n);
+            b[i] = randomBigInteger(2, _params.n);
+        }
+
+        _gTable.multiplyAdd(_curve, a[i], sums[i]);
+        _qTable.multiplyAdd(_curve, b[i], sums[i]);
+    }
+
+    _curve.toAffine(&sums[0], &affine[0], count);
+
+    for(unsigned int i = 0; i < count; i++) {
+        if(affine[i].isPointAtInfinity() || (affine[i].x % _dpModulus).isZero()) {
+            continue;
+        }
+
+        if(_params.negation && affine[i].y.lsb()) {
+            affine[i].y = _params.p - affine[i].y;
+            a[i] = _params.n - a[i];
+            b[i] = _params.n - b[i];
+        }
+
+        StartingPoint p;
+        a[i].getWords(p.a, STARTING_POINT_WORDS);
+        b[i].getWords(p.b, STARTING_POINT_WORDS);
+        affine[i].x.getWords(p.x, STARTING_POINT_WORDS);
+        affine[i].y.getWords(p.y, STARTING_POINT_WORDS);
+
+        points.push_back(p);
+    }
+}
+
+/**
+ * generate() on fixed-width integers. The point at infinity comes back as
+ * (0, 0), which is rejected as distinguished
+ */
+void StartingPointPool::generateFixed(std::vector<StartingPoint> &points, unsigned int count)
+{
+    int words = _fixedCurve->getWords();
+
+    std::vector<unsigned int> a(count * words);
+    std::vector<unsigned int> b(count * words);
+    std::vector<unsigned int> x(count * words);
+    std::vector<unsigned int> y(count * words);
+
+    for(unsigned int i = 0; i < count; i++) {
+        if(_params.kangaroo) {
+            BigInteger ka;
+            BigInteger kb;
+            kangarooScalars(i, ka, kb);
+
+            ka.getWords(&a[i * words], words);
+            kb.getWords(&b[i * words], words);
+        } else {
+            _fixedCurve->randomScalar(&a[i * words]);
+            _fixedCurve->randomScalar(&b[i * words]);
+        }
+    }
+
+    _fixedCurve->multiplyAdd(&a[0], &b[0], &x[0], &y[0], count, _params.negation);
+
+    for(unsigned int i = 0; i < count; i++) {
+        if(isDistinguished(&x[i * words], words, _params.dBits)) {
+            continue;
+        }
+
+        StartingPoint p;
+        setWords(&a[i * words], words, p.a);
+        setWords(&b[i * words], words, p.b);
+        setWords(&x[i * words], words, p.x);
+        setWords(&y[i * words], words, p.y);
+
+        points.push_back(p);
+    }
+}
+
+/**
+ * Takes a point from the pool. When the pool is empty the caller generates
+ * a batch itself and leaves the rest of it in the pool
+ */
+void StartingPointPool::get(StartingPoint &p)
+{
+    _mutex.grab();
+
+    while(_points.empty()) {
+        _mutex.release();
+
+        std::vector<StartingPoint> points;
+        generate(points, STARTING_POINT_BATCH_SIZE);
+
+        _mutex.grab();
+        _points.insert(_points.end(), points.begin(), points.end());
+    }
+
+    p = _points.back();
+    _points.pop_back();
+
+    _mutex.release();
+}
+
+void StartingPointPool::get(BigInteger &a, BigInteger &b, BigInteger &x, BigInteger &y)
+{
+    StartingPoint p;
+    get(p);
+
+    a = BigInteger(p.a, STARTING_POINT_WORDS);
+    b = BigInteger(p.b, STARTING_POINT_WORDS);
+    x = BigInteger(p.x, STARTING_POINT_WORDS);
+    y = BigInteger(p.y, STARTING_POINT_WORDS);
+}
+
+/**
+ * Gets the offset T = tG + uQ as (t, u, x, y), for walks that add it to
+ * their starting points themselves. Returns false without offset restarts
+ */
+bool StartingPointPool::getOffset(StartingPoint &t)
+{
+    if(!_offsetRestarts) {
+        return false;
+    }
+
+    t = _offsetPoint;
+
+    return true;
+}
+
+/**
+ * Replaces the starting point (a, b, x, y) of a walk that ended with the
+ * point to restart it from. In offset mode this is the old starting point
+ * plus T, otherwise a new point from the pool. Tame kangaroos keep b = 0.
+ *
+ * An offset starting point is not canonicalized. Otherwise -(S + T) + T = -S
+ * would restart the walk at S again, so the walk canonicalizes it instead
+ */
+void StartingPointPool::restart(BigInteger &a, BigInteger &b, BigInteger &x, BigInteger &y)
+{
+    if(!_offsetRestarts) {
+        get(a, b, x, y);
+        return;
+    }
+
+    ECPoint p(x, y);
+
+    do {
+        p = _curve.add(p, _offset);
+        a = (a + _offsetA) % _params.n;
+        b = (b + _offsetB) % _params.n;
+    }while(p.isPointAtInfinity() || a.isZero() || (b.isZero() && !_params.kangaroo) || (p.x % _dpModulus).isZero());
+
+    x = p.x;
+    y = p.y;
+}
+
+/**
+ * The server picks the jumps of a kangaroo job for a mean jump of about
+ * walks * sqrt(width) / 2, so a walk covers about that times 2^dBits before
+ * it stops. t is between that and twice that. A restarted walk then starts
+ * past the trail of the walk before instead of within a jump or two of it,
+ * where it would soon land on that trail and repeat its steps. The server
+ * keeps a walk within an eighth of the interval, so t is at most a quarter
+ * of its width
+ */
+BigInteger kangarooOffset(const ECDLPParams &params)
+{
+    BigInteger width = params.upper - params.lower;
+
+    BigInteger reach = (BigInteger((int)params.walks) << (int)(width.getBitLength() / 2 + params.dBits)) >> 1;
+
+    return randomBigInteger(reach, reach << 1);
+}
@@ -0,0 +1,106 @@
+#ifndef _STARTING_POINT_POOL_H
+#define _STARTING_POINT_POOL_H
+
+#include <vector>
+#include "BigInteger.h"
+#include "ecc.h"
+#include "FixedEcc.h"
+#include "threads.h"
+#include "ECDLPParams.h"
+
+// Number of points kept ready for restarting walks
+#define STARTING_POINT_POOL_SIZE 1024
+
+// Number of points generated with one inversion
+#define STARTING_POINT_BATCH_SIZE 256
+
+// Largest value a starting point holds. One word more than the largest
+// modulus RhoCPU is instantiated for, since n can be longer than p
+#define STARTING_POINT_BITS 576
+
+#define STARTING_POINT_WORDS (STARTING_POINT_BITS / (8 * sizeof(unsigned long)))
+
+/**
+ * Starting point aG + bQ of a random walk, as words least significant
+ * first. The pool hands these out without allocating
+ */
+typedef struct {
+    unsigned long a[STARTING_POINT_WORDS];
+    unsigned long b[STARTING_POINT_WORDS];
+    unsigned long x[STARTING_POINT_WORDS];
+    unsigned long y[STARTING_POINT_WORDS];
+}StartingPoint;
+
+/**
+ * Random starting points for the walks. aG and bQ are computed with
+ * fixed-base tables for G and Q and each batch of points is converted to
+ * affine with a single inversion. A background thread refills the pool
+ * so a walk that finds a distinguished point restarts without doing any
+ * scalar multiplication itself.
+ *
+ * With offset restarts a walk that ends restarts from its previous
+ * starting point plus a fixed random point T = tG + uQ instead, which
+ * costs one point addition.
+ *
+ * Kangaroo jobs alternate between tame points aG with a in the interval and
+ * wild points aG + Q with a within half its width of 0. Their T is tG, with
+ * t from kangarooOffset()
+ */
+class StartingPointPool {
+
+private:
+    ECDLPParams _params;
+    ECCurve _curve;
+
+    // Fixed-width routines for the curve, or NULL when it is too large for
+    // them and the BigInteger tables are used
+    ECFixedCurveBase *_fixedCurve;
+
+    ECFixedBaseTable _gTable;
+    ECFixedBaseTable _qTable;
+
+    // 2^dBits, for rejecting points that are already distinguished
+    BigInteger _dpModulus;
+
+    // Width of the interval of a kangaroo job and the lowest a of a wild point
+    BigInteger _width;
+    BigInteger _wildBase;
+
+    unsigned int _size;
+
+    // T and its coefficients, for offset restarts
+    bool _offsetRestarts;
+    ECPoint _offset;
+    BigInteger _offsetA;
+    BigInteger _offsetB;
+    StartingPoint _offsetPoint;
+
+    std::vector<StartingPoint> _points;
+    Mutex _mutex;
+
+    Thread *_thread;
+    volatile bool _running;
+
+    static void *refillThreadEntry(void *ptr);
+    void refillThreadFunction();
+
+    void kangarooScalars(unsigned int i, BigInteger &a, BigInteger &b);
+    void generate(std::vector<StartingPoint> &points, unsigned int count);
+    void generateFixed(std::vector<StartingPoint> &points, unsigned int count);
+
+public:
+    StartingPointPool(const ECDLPParams *params, bool offsetRestarts = true, unsigned int size = STARTING_POINT_POOL_SIZE);
+    ~StartingPointPool();
+
+    void get(StartingPoint &p);
+    void get(BigInteger &a, BigInteger &b, BigInteger &x, BigInteger &y);
+    bool getOffset(StartingPoint &t);
+    void restart(BigInteger &a, BigInteger &b, BigInteger &x, BigInteger &y);
+};
+
+/**
+ * Random t for the point T = tG a kangaroo walk restarts with
+ */
+BigInteger kangarooOffset(const ECDLPParams &params);
+
+#endif
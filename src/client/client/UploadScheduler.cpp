@@ -0,0 +1,131 @@
+#include <algorithm>
+#include "UploadScheduler.h"
+
+UploadScheduler::UploadScheduler(unsigned int minBatchSize)
+{
+    _rate = 0.0;
+    _latency = 0.0;
+    _minBatchSize = std::max(minBatchSize, 1u);
+    _maxBatchSize = UPLOAD_MAX_POINTS;
+    _backoff = 0;
+}
+
+/**
+ * Records that count points were found in the last ms milliseconds
+ */
+void UploadScheduler::recordPoints(unsigned int count, unsigned int ms)
+{
+    if(ms == 0) {
+        return;
+    }
+
+    double rate = (double)count * 1000.0 / ms;
+
+    _rate = UPLOAD_AVERAGE_WEIGHT * rate + (1.0 - UPLOAD_AVERAGE_WEIGHT) * _rate;
+}
+
+/**
+ * Records a successful submission that took ms milliseconds
+ */
+void UploadScheduler::recordSubmission(unsigned int ms)
+{
+    if(_latency == 0.0) {
+        _latency = ms;
+    } else {
+        _latency = UPLOAD_AVERAGE_WEIGHT * ms + (1.0 - UPLOAD_AVERAGE_WEIGHT) * _latency;
+    }
+
+    _backoff = 0;
+}
+
+/**
+ * Doubles the wait before the next submission, starting at the minimum
+ * interval
+ */
+void UploadScheduler::recordFailure()
+{
+    if(_backoff == 0) {
+        _backoff = UPLOAD_MIN_INTERVAL;
+    } else {
+        _backoff = std::min(_backoff * 2, (unsigned int)UPLOAD_MAX_BACKOFF);
+    }
+}
+
+/**
+ * The server asked the client to wait retryAfter seconds
+ */
+void UploadScheduler::recordBusy(unsigned int retryAfter)
+{
+    _backoff = std::min(std::max(retryAfter * 1000, (unsigned int)UPLOAD_MIN_INTERVAL), (unsigned int)UPLOAD_MAX_BACKOFF);
+}
+
+/**
+ * Sets the most points the server takes in one submission. 0 means the
+ * server sets no limit
+ */
+void UploadScheduler::setMaxBatchSize(unsigned int size)
+{
+    if(size == 0 || size > UPLOAD_MAX_POINTS) {
+        size = UPLOAD_MAX_POINTS;
+    }
+
+    _maxBatchSize = size;
+}
+
+/**
+ * Milliseconds between submissions
+ */
+unsigned int UploadScheduler::flushInterval()
+{
+    double interval = UPLOAD_MAX_INTERVAL;
+
+    if(_rate > 0.0) {
+        interval = UPLOAD_TARGET_POINTS * 1000.0 / _rate;
+    }
+
+    double minInterval = std::max((double)UPLOAD_MIN_INTERVAL, _latency * UPLOAD_LATENCY_FACTOR);
+
+    interval = std::max(interval, minInterval);
+    interval = std::min(interval, (double)UPLOAD_MAX_INTERVAL);
+
+    return (unsigned int)interval;
+}
+
+/**
+ * Number of waiting points that triggers a submission, which is also the
+ * most points sent at once
+ */
+unsigned int UploadScheduler::batchSize()
+{
+    double size = _rate * flushInterval() / 1000.0;
+
+    size = std::max(size, (double)_minBatchSize);
+    size = std::min(size, (double)_maxBatchSize);
+
+    return (unsigned int)size;
+}
+
+/**
+ * Milliseconds to wait after failed submissions, 0 when the last one
+ * succeeded
+ */
+unsigned int UploadScheduler::backoff()
+{
+    return _backoff;
+}
+
+/**
+ * Distinguished points per second
+ */
+double UploadScheduler::rate()
+{
+    return _rate;
+}
+
+/**
+ * Milliseconds per submission
+ */
+double UploadScheduler::latency()
+{
+    return _latency;
+}
@@ -0,0 +1,68 @@
+#ifndef _UPLOAD_SCHEDULER_H
+#define _UPLOAD_SCHEDULER_H
+
+// Points a submission should carry when the rate allows it
+#define UPLOAD_TARGET_POINTS 1024
+
+// Most points in one submission when the server sets no limit
+#define UPLOAD_MAX_POINTS 4096
+
+// Bounds on the time between submissions, in milliseconds
+#define UPLOAD_MIN_INTERVAL 1000
+#define UPLOAD_MAX_INTERVAL 300000
+
+// The interval is kept at least this many times the server latency so
+// that waiting on the server takes a small part of the upload thread's time
+#define UPLOAD_LATENCY_FACTOR 20
+
+// Longest wait after failed submissions, in milliseconds
+#define UPLOAD_MAX_BACKOFF 600000
+
+// Weight of a new measurement in the moving averages
+#define UPLOAD_AVERAGE_WEIGHT 0.25
+
+/**
+ * Decides when the upload thread submits and how many points it sends.
+ *
+ * The distinguished point rate and the server latency are tracked as
+ * moving averages. The flush interval is the time the walks take to find
+ * UPLOAD_TARGET_POINTS points, but never shorter than
+ * UPLOAD_LATENCY_FACTOR times the latency. The batch size is what the
+ * walks find in one interval, capped by the server's limit. Points are
+ * submitted once a batch is waiting or the interval has passed, so fast GPU
+ * nodes and slow CPU nodes both work without tuning
+ */
+class UploadScheduler {
+
+private:
+    // Distinguished points per second
+    double _rate;
+
+    // Milliseconds per submission
+    double _latency;
+
+    unsigned int _minBatchSize;
+    unsigned int _maxBatchSize;
+
+    // Milliseconds to wait before the next submission after a failure
+    unsigned int _backoff;
+
+public:
+    UploadScheduler(unsigned int minBatchSize = 1);
+
+    void recordPoints(unsigned int count, unsigned int ms);
+    void recordSubmission(unsigned int ms);
+    void recordFailure();
+    void recordBusy(unsigned int retryAfter);
+
+    void setMaxBatchSize(unsigned int size);
+
+    unsigned int batchSize();
+    unsigned int flushInterval();
+    unsigned int backoff();
+
+    double rate();
+    double latency();
+};
+
+#endif
@@ -0,0 +1,282 @@
+#include <stdio.h>
+#include <string.h>
+#include "WalkCheckpoint.h"
+#include "logger.h"
+#include "util.h"
+
+/**
+ * FNV-1a over the words of a value and its length
+ */
+static void hashValue(unsigned long long &hash, const BigInteger &x)
+{
+    unsigned int len = (unsigned int)x.getLength32();
+    std::vector<unsigned int> words(len + 1, 0);
+
+    words[0] = len;
+    if(len > 0) {
+        x.getWords(&words[1], len);
+    }
+
+    for(unsigned int i = 0; i < words.size(); i++) {
+        for(int j = 0; j < 4; j++) {
+            hash ^= (words[i] >> (8 * j)) & 0xff;
+            hash *= 0x100000001b3ULL;
+        }
+    }
+}
+
+/**
+ * Fingerprint of everything the walks depend on
+ */
+static unsigned long long getFingerprint(const ECDLPParams *params, const BigInteger *rx, const BigInteger *ry, int rPoints)
+{
+    unsigned long long hash = 0xcbf29ce484222325ULL;
+
+    hashValue(hash, params->p);
+    hashValue(hash, params->a);
+    hashValue(hash, params->b);
+    hashValue(hash, params->n);
+    hashValue(hash, params->gx);
+    hashValue(hash, params->gy);
+    hashValue(hash, params->qx);
+    hashValue(hash, params->qy);
+    hashValue(hash, BigInteger((int)params->dBits));
+    hashValue(hash, BigInteger(params->negation ? 1 : 0));
+
+    // Only kangaroo jobs hash the interval, so rho checkpoints still match
+    if(params->kangaroo) {
+        hashValue(hash, params->lower);
+        hashValue(hash, params->upper);
+    }
+
+    for(int i = 0; i < rPoints; i++) {
+        hashValue(hash, rx[i]);
+        hashValue(hash, ry[i]);
+    }
+
+    return hash;
+}
+
+/**
+ * Creates an empty checkpoint for the walks of a job
+ */
+WalkCheckpoint::WalkCheckpoint(const ECDLPParams *params, const BigInteger *rx, const BigInteger *ry, int rPoints)
+{
+    // Values are as long as the longer of p and n
+    _words = (unsigned int)params->p.getLength32();
+    if(params->n.getLength32() > _words) {
+        _words = (unsigned int)params->n.getLength32();
+    }
+
+    _fingerprint = getFingerprint(params, rx, ry, rPoints);
+    _negation = params->negation;
+    _next = 0;
+}
+
+void WalkCheckpoint::setValue(size_t walk, int value, const BigInteger &x)
+{
+    x.getWords(&_values[(walk * WALK_CHECKPOINT_VALUES + value) * _words], _words);
+}
+
+BigInteger WalkCheckpoint::getValue(size_t walk, int value)
+{
+    return BigInteger(&_values[(walk * WALK_CHECKPOINT_VALUES + value) * _words], _words);
+}
+
+/**
+ * Adds a walk. Called from every walk thread
+ */
+void WalkCheckpoint::add(const WalkState &walk)
+{
+    _mutex.grab();
+
+    size_t i = _lengths.size();
+
+    _values.resize((i + 1) * WALK_CHECKPOINT_VALUES * _words);
+    _lengths.push_back(walk.length);
+    _histories.push_back(walk.history);
+    _skipped.push_back(walk.skipped);
+
+    setValue(i, 0, walk.a);
+    setValue(i, 1, walk.b);
+    setValue(i, 2, walk.startX);
+    setValue(i, 3, walk.startY);
+    setValue(i, 4, walk.x);
+    setValue(i, 5, walk.y);
+
+    _mutex.release();
+}
+
+/**
+ * Takes the next walk that was not taken yet. Returns false when there are
+ * none left. With needStart, walks without their starting point are
+ * dropped. Called from every walk thread
+ */
+bool WalkCheckpoint::take(WalkState &walk, bool needStart)
+{
+    bool found = false;
+
+    _mutex.grab();
+
+    while(!found && _next < _lengths.size()) {
+        size_t i = _next++;
+
+        walk.startX = getValue(i, 2);
+        walk.startY = getValue(i, 3);
+
+        if(needStart && walk.startX.isZero() && walk.startY.isZero()) {
+            continue;
+        }
+
+        walk.a = getValue(i, 0);
+        walk.b = getValue(i, 1);
+        walk.x = getValue(i, 4);
+        walk.y = getValue(i, 5);
+        walk.length = _lengths[i];
+        walk.history = _histories[i];
+        walk.skipped = _skipped[i];
+
+        found = true;
+    }
+
+    _mutex.release();
+
+    return found;
+}
+
+unsigned long long WalkCheckpoint::size()
+{
+    _mutex.grab();
+    unsigned long long count = _lengths.size();
+    _mutex.release();
+
+    return count;
+}
+
+unsigned long long WalkCheckpoint::remaining()
+{
+    _mutex.grab();
+    unsigned long long count = _lengths.size() - _next;
+    _mutex.release();
+
+    return count;
+}
+
+/**
+ * Writes the walks to path. They are on disk when this returns
+ */
+void WalkCheckpoint::save(const std::string &path)
+{
+    std::string tmpPath = path + ".tmp";
+
+    WalkCheckpointHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, WALK_CHECKPOINT_MAGIC, 4);
+    header.version = WALK_CHECKPOINT_VERSION;
+    header.words = _words;
+    header.fingerprint = _fingerprint;
+    header.count = _lengths.size();
+
+    FILE *fp = fopen(tmpPath.c_str(), "wb");
+    if(fp == NULL) {
+        throw std::string("Error creating checkpoint file " + tmpPath);
+    }
+
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+
+    if(ok && header.count > 0) {
+        ok = fwrite(&_values[0], sizeof(unsigned int), _values.size(), fp) == _values.size()
+          && fwrite(&_lengths[0], sizeof(unsigned long long), _lengths.size(), fp) == _lengths.size()
+          && fwrite(&_histories[0], sizeof(unsigned long long), _histories.size(), fp) == _histories.size()
+          && fwrite(&_skipped[0], sizeof(unsigned int), _skipped.size(), fp) == _skipped.size();
+    }
+
+    if(ok) {
+        util::syncFile(fp);
+    }
+    fclose(fp);
+
+    if(!ok) {
+        remove(tmpPath.c_str());
+        throw std::string("Error writing checkpoint file " + tmpPath);
+    }
+
+#ifdef WIN32
+    // rename does not replace an existing file on Windows
+    remove(path.c_str());
+#endif
+
+    if(rename(tmpPath.c_str(), path.c_str()) != 0) {
+        throw std::string("Error replacing checkpoint file " + path);
+    }
+}
+
+/**
+ * Reads the walks saved in path. Returns false if there is no checkpoint,
+ * or it is for other parameters or cut short
+ */
+bool WalkCheckpoint::load(const std::string &path)
+{
+    FILE *fp = fopen(path.c_str(), "rb");
+    if(fp == NULL) {
+        return false;
+    }
+
+    WalkCheckpointHeader header;
+
+    if(fread(&header, sizeof(header), 1, fp) != 1
+        || memcmp(header.magic, WALK_CHECKPOINT_MAGIC, 4) != 0
+        || (header.version != WALK_CHECKPOINT_VERSION && header.version != WALK_CHECKPOINT_VERSION_NO_NEGATION)) {
+        Logger::logError("Ignoring invalid checkpoint file %s", path.c_str());
+        fclose(fp);
+        return false;
+    }
+
+    // Walks with the negation map do not step the same way without their
+    // history, so the points they would find could not be replayed
+    bool hasNegation = header.version != WALK_CHECKPOINT_VERSION_NO_NEGATION;
+
+    if(!hasNegation && _negation) {
+        Logger::logError("Ignoring checkpoint file %s: it has no negation map state", path.c_str());
+        fclose(fp);
+        return false;
+    }
+
+    if(header.words != _words || header.fingerprint != _fingerprint) {
+        Logger::logError("Ignoring checkpoint file %s: it is for other parameters", path.c_str());
+        fclose(fp);
+        return false;
+    }
+
+    std::vector<unsigned int> values(header.count * WALK_CHECKPOINT_VALUES * _words);
+    std::vector<unsigned long long> lengths(header.count);
+    std::vector<unsigned long long> histories(header.count, 0);
+    std::vector<unsigned int> skipped(header.count, 0);
+
+    bool ok = true;
+    if(header.count > 0) {
+        ok = fread(&values[0], sizeof(unsigned int), values.size(), fp) == values.size()
+          && fread(&lengths[0], sizeof(unsigned long long), lengths.size(), fp) == lengths.size();
+
+        if(ok && hasNegation) {
+            ok = fread(&histories[0], sizeof(unsigned long long), histories.size(), fp) == histories.size()
+              && fread(&skipped[0], sizeof(unsigned int), skipped.size(), fp) == skipped.size();
+        }
+    }
+    fclose(fp);
+
+    if(!ok) {
+        Logger::logError("Ignoring checkpoint file %s: it is cut short", path.c_str());
+        return false;
+    }
+
+    _mutex.grab();
+    _values.swap(values);
+    _lengths.swap(lengths);
+    _histories.swap(histories);
+    _skipped.swap(skipped);
+    _next = 0;
+    _mutex.release();
+
+    return true;
+}
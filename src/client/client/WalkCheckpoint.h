@@ -0,0 +1,109 @@
+#ifndef _WALK_CHECKPOINT_H
+#define _WALK_CHECKPOINT_H
+
+#include <string>
+#include <vector>
+#include "BigInteger.h"
+#include "ECDLPParams.h"
+#include "threads.h"
+
+#define WALK_CHECKPOINT_MAGIC "ECWC"
+#define WALK_CHECKPOINT_VERSION 2
+
+// Version without the negation map state, still read for jobs that do not
+// use the negation map
+#define WALK_CHECKPOINT_VERSION_NO_NEGATION 1
+
+// The checkpoint of a job is named after its id
+#define WALK_CHECKPOINT_EXTENSION ".ckpt"
+
+// Values stored for each walk: a, b, the starting point and the current point
+#define WALK_CHECKPOINT_VALUES 6
+
+/**
+ * Header at the start of the checkpoint file. It is followed by the values
+ * of every walk, then by their lengths and then by their negation map
+ * states, the histories and then the skipped counts
+ */
+typedef struct {
+    char magic[4];
+    unsigned int version;
+
+    // 32-bit words of each value
+    unsigned int words;
+    unsigned int reserved;
+
+    // Fingerprint of the parameters and R points the walks were made for
+    unsigned long long fingerprint;
+
+    // Number of walks
+    unsigned long long count;
+}WalkCheckpointHeader;
+
+/**
+ * State of one walk. The points are affine and canonical. startX and startY
+ * are 0 when the walk does not keep its starting point.
+ *
+ * With the negation map a walk also depends on the fingerprints of its last
+ * four points, newest in the low 16 bits, and on the R points it skipped at
+ * its current point. Both are 0 without the negation map
+ */
+typedef struct {
+    BigInteger a;
+    BigInteger b;
+    BigInteger startX;
+    BigInteger startY;
+    BigInteger x;
+    BigInteger y;
+    unsigned long long length;
+    unsigned long long history;
+    unsigned int skipped;
+}WalkState;
+
+/**
+ * The walks of a job, saved so they continue where they were after the
+ * client restarts. Every walk is independent and only depends on the
+ * parameters and R points of the job, so any context and any thread can
+ * resume any saved walk.
+ *
+ * The file is written to a temporary file, synced and then renamed over
+ * the old one, so a crash leaves either the old or the new checkpoint.
+ * Walks resumed from an older checkpoint walk some steps again and find
+ * distinguished points that were already sent, which the server treats as
+ * duplicates
+ */
+class WalkCheckpoint {
+
+private:
+    unsigned int _words;
+    unsigned long long _fingerprint;
+    bool _negation;
+
+    // WALK_CHECKPOINT_VALUES values of _words words for every walk
+    std::vector<unsigned int> _values;
+    std::vector<unsigned long long> _lengths;
+    std::vector<unsigned long long> _histories;
+    std::vector<unsigned int> _skipped;
+
+    // Next walk handed out by take()
+    size_t _next;
+
+    Mutex _mutex;
+
+    void setValue(size_t walk, int value, const BigInteger &x);
+    BigInteger getValue(size_t walk, int value);
+
+public:
+    WalkCheckpoint(const ECDLPParams *params, const BigInteger *rx, const BigInteger *ry, int rPoints);
+
+    void add(const WalkState &walk);
+    bool take(WalkState &walk, bool needStart = false);
+
+    unsigned long long size();
+    unsigned long long remaining();
+
+    void save(const std::string &path);
+    bool load(const std::string &path);
+};
+
+#endif
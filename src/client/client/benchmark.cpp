@@ -1,17 +1,40 @@
 #include "client.h"
 
+#include <fstream>
+
 #ifdef _CUDA
 #include "ECDLCuda.h"
 #include "kernels.h"
 #include "cudapp.h"
-#else
-#include "ECDLCPU.h"
 #endif
 
+#include "ECDLCPU.h"
+#include "StartingPointPool.h"
+#include "math/FpBenchmark.h"
+
 #include "BigInteger.h"
 #include "logger.h"
 
 #include "util.h"
+#include "json/json.h"
+
+// Largest integer in words that is benchmarked
+#define BENCHMARK_MAX_WORDS 8
+
+// Rounds of the Fermat test for the benchmark primes
+#define PRIME_TEST_ROUNDS 16
+
+// Shortest time each kind of restart is timed for, in milliseconds
+#define BENCHMARK_RESTART_TIME 500
+
+// Largest points per thread the walk is timed with
+#define BENCHMARK_MAX_POINTS 64
+
+// Shortest time a CUDA field operation is timed for, in milliseconds
+#define CUDA_FP_BENCHMARK_TIME 100
+
+// Curve the thread scaling is measured on
+#define SCALING_CURVE CURVE_128
 
 static const int bits[] = {
     64, 96, 128, 160, 192, 224
@@ -109,40 +132,41 @@ static const char *_paramStrings[][8] = {
     }
 };
 
+static ECDLPParams getBenchmarkParams(int curve)
+{
+    ECDLPParams params;
+    params.p = BigInteger(_paramStrings[curve][PARAM_P]);
+    params.a = BigInteger(_paramStrings[curve][PARAM_A]);
+    params.b = BigInteger(_paramStrings[curve][PARAM_B]);
+    params.n = BigInteger(_paramStrings[curve][PARAM_N]);
+    params.gx = BigInteger(_paramStrings[curve][PARAM_GX]);
+    params.gy = BigInteger(_paramStrings[curve][PARAM_GY]);
+    params.qx = BigInteger(_paramStrings[curve][PARAM_QX]);
+    params.qy = BigInteger(_paramStrings[curve][PARAM_QY]);
+    params.dBits = 32;
+    params.negation = false;
+    params.kangaroo = false;
+
+    return params;
+}
+
 void doBenchmark()
 {
-    #ifdef _CUDA
-    ECDLCudaContext *ctx;
-    #else
-    ECDLCpuContext *ctx;
-    #endif
+    ECDLContext *ctx;
 
-    BigInteger rx[ 32 ];
-    BigInteger ry[ 32 ];
+    BigInteger rx[ DEFAULT_R_POINTS ];
+    BigInteger ry[ DEFAULT_R_POINTS ];
 
     for(int i = 0; i < 6; i++) {
-        ECDLPParams params;
-        params.p = BigInteger(_paramStrings[i][0]);
-        params.a = BigInteger(_paramStrings[i][1]);
-        params.b = BigInteger(_paramStrings[i][2]);
-        params.n = BigInteger(_paramStrings[i][3]);
-        params.gx = BigInteger(_paramStrings[i][4]);
-        params.gy = BigInteger(_paramStrings[i][5]);
-        params.qx = BigInteger(_paramStrings[i][6]);
-        params.qy = BigInteger(_paramStrings[i][7]);
-        params.dBits = 32;
+        ECDLPParams params = getBenchmarkParams(i);
 
         ECCurve curve(params.p, params.n, params.a, params.b, params.gx, params.gy);
        
         ECPoint q(params.qx, params.qy); 
-        generateRPoints(curve, q, NULL, NULL, rx, ry, 32);
+        generateRPoints(curve, q, NULL, NULL, rx, ry, DEFAULT_R_POINTS);
 
         Logger::logInfo("Running benchmark for %d-bit prime curve\n", bits[i]);
-        #ifdef _CUDA
-        ctx = new ECDLCudaContext(_config.device, _config.blocks, _config.threads, _config.pointsPerThread, &params, rx, ry, 32, NULL);
-        #else
-        ctx = new ECDLCpuContext(_config.threads, _config.pointsPerThread, &params, rx, ry, 32, NULL);
-        #endif
+        ctx = getNewContext(&params, rx, ry, DEFAULT_R_POINTS, NULL);
         //ctx->init();
         ctx->benchmark(NULL);
         fflush(stdout);
@@ -150,3 +174,391 @@ void doBenchmark()
     }
 
 }
+
+/**
+ * Takes a number that passes the Fermat test for PRIME_TEST_ROUNDS random
+ * bases as prime, which is enough for timing the arithmetic
+ */
+static bool isProbablePrime(const BigInteger &n)
+{
+    BigInteger exponent = n - BigInteger(1);
+
+    for(int i = 0; i < PRIME_TEST_ROUNDS; i++) {
+        BigInteger a = randomBigInteger(2, exponent);
+
+        if(a.pow(exponent, n) != BigInteger(1)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Random prime with its top bit set, so that it takes up all of its words
+ */
+static BigInteger randomPrime(unsigned int bits)
+{
+    BigInteger min = BigInteger(2).pow(bits - 1);
+    BigInteger max = BigInteger(2).pow(bits);
+
+    while(true) {
+        BigInteger p = randomBigInteger(min, max);
+
+        if(!p.lsb()) {
+            p = p + BigInteger(1);
+        }
+
+        if(isProbablePrime(p)) {
+            return p;
+        }
+    }
+}
+
+/**
+ * Largest prime below 2^bits. It has the form 2^bits - c for a small c, so
+ * the pseudo-Mersenne reduction applies to it
+ */
+static BigInteger pseudoMersennePrime(unsigned int bits)
+{
+    BigInteger p = BigInteger(2).pow(bits) - BigInteger(1);
+
+    while(!isProbablePrime(p)) {
+        p = p - BigInteger(2);
+    }
+
+    return p;
+}
+
+static Json::Value encodeFpTimings(const char *backend, const char *reduction, int words, int bits, double sub, double multiply, double square, double inverse)
+{
+    Json::Value entry(Json::objectValue);
+    entry["backend"] = backend;
+    entry["reduction"] = reduction;
+    entry["words"] = words;
+    entry["bits"] = bits;
+    entry["sub_ns"] = sub;
+    entry["multiply_ns"] = multiply;
+    entry["square_ns"] = square;
+    entry["inverse_ns"] = inverse;
+
+    return entry;
+}
+
+/**
+ * Times the CPU field arithmetic for full-width primes of 1 to
+ * BENCHMARK_MAX_WORDS words, with both general reductions for a random
+ * prime and with the pseudo-Mersenne reduction for a prime just below 2^bits
+ */
+static void benchmarkCpuField(Json::Value &results)
+{
+    const char *backend = getFpBackend();
+
+    for(int words = 1; words <= BENCHMARK_MAX_WORDS; words++) {
+        int bits = words * sizeof(unsigned long) * 8;
+        BigInteger p = randomPrime(bits);
+
+        Logger::logInfo("Timing %s field arithmetic for %d-bit primes", backend, bits);
+
+        FpTimings barrett = benchmarkFp(p, FP_BENCHMARK_BARRETT);
+        results.append(encodeFpTimings(backend, "barrett", words, bits, barrett.sub, barrett.multiply, barrett.square, barrett.inverse));
+
+        FpTimings montgomery = benchmarkFp(p, FP_BENCHMARK_MONTGOMERY);
+        results.append(encodeFpTimings(backend, "montgomery", words, bits, montgomery.sub, montgomery.multiply, montgomery.square, montgomery.inverse));
+
+        BigInteger special = pseudoMersennePrime(bits);
+        FpTimings pseudoMersenne = benchmarkFp(special, FP_BENCHMARK_PSEUDO_MERSENNE);
+        results.append(encodeFpTimings(backend, "pseudo-mersenne", words, bits, pseudoMersenne.sub, pseudoMersenne.multiply, pseudoMersenne.square, pseudoMersenne.inverse));
+    }
+}
+
+#ifdef _CUDA
+/**
+ * Nanoseconds per operation over the whole grid. The iterations are doubled
+ * until a launch takes at least CUDA_FP_BENCHMARK_TIME
+ */
+static double timeCudaOperation(int words, int op, const unsigned int *x, const unsigned int *y)
+{
+    unsigned int blocks = _config.blocks;
+    unsigned int threads = _config.threads;
+    unsigned int iterations = 16;
+    float ms = 0.0f;
+
+    while(true) {
+        cudaError_t cudaError = cudaBenchmarkFp(words, op, blocks, threads, iterations, x, y, &ms);
+        if(cudaError != cudaSuccess) {
+            throw cudaError;
+        }
+
+        if(ms >= CUDA_FP_BENCHMARK_TIME) {
+            break;
+        }
+        iterations *= 2;
+    }
+
+    return (double)ms * 1000000.0 / ((double)blocks * threads * iterations);
+}
+
+/**
+ * Times the device field arithmetic for the modulus p of the given length in
+ * 32-bit words. initDeviceParams picks the reduction for p, which is given
+ * as the name of the entry
+ */
+static Json::Value timeCudaField(const BigInteger &p, int words, const char *reduction)
+{
+    int bits = words * 32;
+    BigInteger m = BigInteger(4).pow(bits) / p;
+
+    unsigned int pWords[MAX_WORDS] = {0};
+    unsigned int mWords[MAX_WORDS] = {0};
+    unsigned int x[MAX_WORDS] = {0};
+    unsigned int y[MAX_WORDS] = {0};
+
+    p.getWords(pWords, words);
+    m.getWords(mWords, (m.getBitLength() + 31) / 32);
+    randomBigInteger(2, p).getWords(x, words);
+    randomBigInteger(2, p).getWords(y, words);
+
+    cudaError_t cudaError = initDeviceParams(pWords, bits, mWords, m.getBitLength(), 32);
+    if(cudaError != cudaSuccess) {
+        throw cudaError;
+    }
+
+    return encodeFpTimings("cuda", reduction, words, bits,
+                           timeCudaOperation(words, FP_BENCHMARK_SUB, x, y),
+                           timeCudaOperation(words, FP_BENCHMARK_MULTIPLY, x, y),
+                           timeCudaOperation(words, FP_BENCHMARK_SQUARE, x, y),
+                           timeCudaOperation(words, FP_BENCHMARK_INVERSE, x, y));
+}
+
+/**
+ * Times the device field arithmetic on every device for full-width primes of
+ * 1 to BENCHMARK_MAX_WORDS 32-bit words, with the Barrett reduction for a
+ * random prime and the pseudo-Mersenne reduction for a prime just below 2^bits
+ */
+static void benchmarkCudaField(Json::Value &results)
+{
+    for(unsigned int i = 0; i < _config.devices.size(); i++) {
+        int device = _config.devices[i];
+
+        CUDA::DeviceInfo info;
+        CUDA::getDeviceInfo(device, info);
+        CUDA::setDevice(device);
+
+        for(int words = 1; words <= BENCHMARK_MAX_WORDS; words++) {
+            int bits = words * 32;
+
+            Logger::logInfo("Timing field arithmetic on %s for %d-bit primes", info.name.c_str(), bits);
+
+            try {
+                Json::Value entries[2];
+                entries[0] = timeCudaField(randomPrime(bits), words, "barrett");
+                entries[1] = timeCudaField(pseudoMersennePrime(bits), words, "pseudo-mersenne");
+
+                for(int j = 0; j < 2; j++) {
+                    entries[j]["device"] = info.name;
+                    entries[j]["blocks"] = _config.blocks;
+                    entries[j]["threads"] = _config.threads;
+                    results.append(entries[j]);
+                }
+            }catch(cudaError_t err) {
+                Logger::logError("CUDA error: %s", cudaGetErrorString(err));
+                return;
+            }
+        }
+    }
+}
+#endif
+
+/**
+ * Times the walk of one CPU thread for each number of points per thread.
+ * With 32 distinguished bits the walks practically never restart, so the
+ * restart cost is left out
+ */
+static void benchmarkWalk(const ECDLPParams &params, const BigInteger *rx, const BigInteger *ry, Json::Value &results)
+{
+    int bits = params.p.getBitLength();
+
+    for(unsigned int pointsPerThread = 1; pointsPerThread <= BENCHMARK_MAX_POINTS; pointsPerThread *= 2) {
+        Logger::logInfo("Timing the %d-bit walk with %d points per thread", bits, pointsPerThread);
+
+        ECDLCpuContext ctx(1, pointsPerThread, &params, rx, ry, DEFAULT_R_POINTS, NULL);
+
+        unsigned long long pointsPerSecond = 0;
+        ctx.benchmark(&pointsPerSecond);
+
+        Json::Value entry(Json::objectValue);
+        entry["backend"] = "cpu";
+        entry["bits"] = bits;
+        entry["points_per_thread"] = pointsPerThread;
+        entry["steps_per_second"] = (double)pointsPerSecond;
+        entry["iterations_per_second"] = (double)(pointsPerSecond / pointsPerThread);
+        results.append(entry);
+    }
+}
+
+static double timeRestarts(StartingPointPool *pool)
+{
+    BigInteger a;
+    BigInteger b;
+    BigInteger x;
+    BigInteger y;
+
+    pool->get(a, b, x, y);
+
+    unsigned long long count = 0;
+    unsigned int t = 0;
+
+    util::Timer timer;
+    timer.start();
+
+    do {
+        pool->restart(a, b, x, y);
+        count++;
+    }while((t = timer.getTime()) < BENCHMARK_RESTART_TIME);
+
+    return (double)t * 1000.0 / (double)count;
+}
+
+/**
+ * Times the walk with 1 thread up to a thread per core, each thread pinned
+ * to its own core, with the CPU points per thread in the settings. Only
+ * physical cores are used when cpu_physical_cores is set
+ */
+static void benchmarkScaling(const ECDLPParams &params, const BigInteger *rx, const BigInteger *ry, Json::Value &results)
+{
+#ifdef _CUDA
+    int pointsPerThread = _config.cpuPointsPerThread;
+#else
+    int pointsPerThread = _config.pointsPerThread;
+#endif
+    if(pointsPerThread < 1) {
+        pointsPerThread = 1;
+    }
+
+    CpuPlacement placement = ECDLCpuContext::getDefaultPlacement();
+    placement.physicalCores = _config.cpuPhysicalCores;
+
+    int cores = util::getCpuList(placement.physicalCores).size();
+
+    Logger::logInfo("Timing the %d-bit walk on 1 to %d threads", (int)params.p.getBitLength(), cores);
+
+    ECDLCpuContext ctx(cores, pointsPerThread, &params, rx, ry, DEFAULT_R_POINTS, NULL, true, &placement);
+    std::vector<ScalingResult> scaling = ctx.benchmarkScaling(cores);
+
+    for(unsigned int i = 0; i < scaling.size(); i++) {
+        Json::Value entry(Json::objectValue);
+        entry["bits"] = (int)params.p.getBitLength();
+        entry["threads"] = scaling[i].threads;
+        entry["points_per_thread"] = pointsPerThread;
+        entry["points_per_second"] = (double)scaling[i].pointsPerSecond;
+        entry["efficiency"] = scaling[i].efficiency;
+
+        Json::Value threads(Json::arrayValue);
+        for(unsigned int j = 0; j < scaling[i].threadPointsPerSecond.size(); j++) {
+            threads.append((double)scaling[i].threadPointsPerSecond[j]);
+        }
+        entry["thread_points_per_second"] = threads;
+
+        results.append(entry);
+    }
+}
+
+/**
+ * Microseconds per restart. Random restarts take a new point from a pool
+ * without a refill thread, so the caller pays for generating the points.
+ * Offset restarts add T to the previous starting point
+ */
+static void benchmarkRestarts(const ECDLPParams &params, Json::Value &results)
+{
+    Json::Value entry(Json::objectValue);
+    entry["bits"] = (int)params.p.getBitLength();
+
+    StartingPointPool *pool = new StartingPointPool(&params, false, 0);
+    entry["random_us"] = timeRestarts(pool);
+    delete pool;
+
+    pool = new StartingPointPool(&params, true, 0);
+    entry["offset_us"] = timeRestarts(pool);
+    delete pool;
+
+    results.append(entry);
+}
+
+/**
+ * Runs the benchmark suite and writes the results to a JSON file: the time
+ * per field operation for each integer length and backend, the walk speed
+ * of a CPU thread for each number of points per thread, the cost of a
+ * restart and how the CPU walk scales with the number of threads
+ */
+void doBenchmarkSuite(const std::string &fileName)
+{
+    Json::Value root(Json::objectValue);
+
+    root["build"]["cpu_backend"] = getFpBackend();
+#ifdef _CUDA
+    root["build"]["cuda"] = true;
+#else
+    root["build"]["cuda"] = false;
+#endif
+
+    Json::Value field(Json::arrayValue);
+    Json::Value walk(Json::arrayValue);
+    Json::Value restart(Json::arrayValue);
+    Json::Value scaling(Json::arrayValue);
+
+    benchmarkCpuField(field);
+#ifdef _CUDA
+    benchmarkCudaField(field);
+#endif
+
+    BigInteger rx[ DEFAULT_R_POINTS ];
+    BigInteger ry[ DEFAULT_R_POINTS ];
+
+    for(int i = 0; i < 6; i++) {
+        ECDLPParams params = getBenchmarkParams(i);
+
+        ECCurve curve(params.p, params.n, params.a, params.b, params.gx, params.gy);
+
+        ECPoint q(params.qx, params.qy);
+        generateRPoints(curve, q, NULL, NULL, rx, ry, DEFAULT_R_POINTS);
+
+        benchmarkWalk(params, rx, ry, walk);
+        benchmarkRestarts(params, restart);
+
+        if(i == SCALING_CURVE) {
+            benchmarkScaling(params, rx, ry, scaling);
+        }
+
+#ifdef _CUDA
+        Logger::logInfo("Timing the %d-bit walk on the GPUs", (int)params.p.getBitLength());
+
+        ECDLContext *ctx = getNewContext(&params, rx, ry, DEFAULT_R_POINTS, NULL);
+        unsigned long long pointsPerSecond = 0;
+        ctx->benchmark(&pointsPerSecond);
+        delete ctx;
+
+        Json::Value entry(Json::objectValue);
+        entry["backend"] = "cuda";
+        entry["bits"] = (int)params.p.getBitLength();
+        entry["steps_per_second"] = (double)pointsPerSecond;
+        walk.append(entry);
+#endif
+    }
+
+    root["field"] = field;
+    root["walk"] = walk;
+    root["restart"] = restart;
+    root["scaling"] = scaling;
+
+    std::ofstream file(fileName.c_str());
+    if(!file.is_open()) {
+        Logger::logError("Cannot write benchmark results to %s", fileName.c_str());
+        return;
+    }
+
+    Json::StyledWriter writer;
+    file << writer.write(root);
+
+    Logger::logInfo("Benchmark results written to %s", fileName.c_str());
+}
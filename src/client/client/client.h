@@ -2,6 +2,8 @@
 #define _CLIENT_H
 
 #include <string>
+#include <vector>
+#include "ECDLContext.h"
 
 typedef struct {
 
@@ -9,11 +11,57 @@ typedef struct {
     unsigned short serverPort;
     unsigned int pointCacheSize;
 
+    // Name the server keeps the walk stats of this client under. Empty
+    // means the server names it by address
+    std::string clientId;
+
+    // Restart walks from their previous starting point plus a fixed offset
+    // instead of from a new random point
+    bool offsetRestarts;
+
+    // Placement of the CPU worker threads: pinning to cores, one thread per
+    // physical core, and each worker allocating its walks on its own NUMA node
+    bool cpuAffinity;
+    bool cpuPhysicalCores;
+    bool cpuNumaAlloc;
+
+    // Seconds between saves of the walks, so a restarted client continues
+    // them. 0 disables saving and resuming
+    unsigned int checkpointInterval;
+
+    // Seconds between stats lines in the log, 0 for none. When metricsFile
+    // is set the counters are also written there in the Prometheus format
+    unsigned int statsInterval;
+    std::string metricsFile;
+
+    // Seconds a job runs before another job may take over, and the number
+    // of paused jobs whose walks are kept in memory. The walks of other
+    // paused jobs are saved to their checkpoints and their memory freed
+    unsigned int jobTimeSlice;
+    unsigned int pausedContexts;
+
+    // Most verbose messages logged, one of the LOG_LEVEL values
+    int logLevel;
+
 #ifdef _CUDA
     int device;
+
+    // Devices to run on. Empty means all devices
+    std::vector<int> devices;
     int blocks;
     int threads;
     int pointsPerThread;
+    int stepsPerLaunch;
+    int streams;
+
+    // Tune the grid shape of each device instead of using blocks, threads
+    // and pointsPerThread. Tuned shapes are kept in tuneCache
+    bool autoTune;
+    std::string tuneCache;
+
+    // CPU threads to run next to the GPUs. 0 disables them, -1 picks the count
+    int cpuThreads;
+    int cpuPointsPerThread;
 #else
     int threads;
     int pointsPerThread;
@@ -25,6 +73,8 @@ typedef struct {
 extern ClientConfig _config;
 
 ClientConfig loadConfig(std::string fileName);
+ECDLContext *getNewContext(const ECDLPParams *params, BigInteger *rx, BigInteger *ry, int numRPoints, void (*callback)(struct CallbackParameters *));
 void doBenchmark();
+void doBenchmarkSuite(const std::string &fileName);
 
 #endif
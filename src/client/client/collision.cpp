@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "BigInteger.h"
+#include "ECDLPParams.h"
+#include "WalkReplay.h"
+#include "logger.h"
+#include "util.h"
+#include "json/json.h"
+
+/**
+ * Finds where two walks that reached the same distinguished point collide,
+ * for the server's solver. The job and the walks are read from stdin as
+ * JSON, in the format of the server's /params response with these fields
+ * added:
+ *
+ *   "walks": [{"a": ..., "b": ...}, {"a": ..., "b": ...}]
+ *   "end": {"x": ..., "y": ...}
+ *   "max_bits": the most distinguished bits the job had, optional
+ *
+ * The result is written to stdout as JSON
+ */
+
+static BigInteger readBigInt(const Json::Value &root, const std::string &field)
+{
+    std::string s = root.get(field, "").asString();
+    if(s == "") {
+        throw std::string("Parsing error: " + field + " is not an integer");
+    }
+    return BigInteger(s);
+}
+
+static Json::Value encodePoint(const ReplayPoint &p)
+{
+    Json::Value point(Json::objectValue);
+
+    point["a"] = p.a.toString();
+    point["b"] = p.b.toString();
+    point["x"] = p.x.toString();
+    point["y"] = p.y.toString();
+
+    return point;
+}
+
+static const char *statusName(int status)
+{
+    switch(status) {
+        case REPLAY_COLLISION:
+            return "collision";
+        case REPLAY_ROBIN_HOOD:
+            return "robin_hood";
+        case REPLAY_TOO_LONG:
+            return "too_long";
+    }
+
+    return "no_collision";
+}
+
+static Json::Value replay(const Json::Value &root)
+{
+    const Json::Value &p = root["params"];
+
+    ECDLPParams params;
+    params.p = readBigInt(p, "p");
+    params.n = readBigInt(p, "n");
+    params.a = readBigInt(p, "a");
+    params.b = readBigInt(p, "b");
+    params.gx = readBigInt(p, "gx");
+    params.gy = readBigInt(p, "gy");
+    params.qx = readBigInt(p, "qx");
+    params.qy = readBigInt(p, "qy");
+    params.dBits = p.get("bits", 0).asInt();
+    params.negation = p.get("negation", false).asBool();
+    params.kangaroo = p.get("walk", "rho").asString() == "kangaroo";
+    if(params.kangaroo) {
+        params.lower = readBigInt(p, "lower");
+        params.upper = readBigInt(p, "upper");
+    }
+
+    const Json::Value &points = root["points"];
+    unsigned int numRPoints = points.size();
+
+    if(numRPoints == 0 || (numRPoints & (numRPoints - 1)) != 0) {
+        throw std::string("Parsing error: invalid number of R points");
+    }
+
+    std::vector<BigInteger> rx;
+    std::vector<BigInteger> ry;
+    std::vector<BigInteger> ra;
+    std::vector<BigInteger> rb;
+
+    for(unsigned int i = 0; i < numRPoints; i++) {
+        rx.push_back(readBigInt(points[i], "x"));
+        ry.push_back(readBigInt(points[i], "y"));
+        ra.push_back(readBigInt(points[i], "a"));
+        rb.push_back(readBigInt(points[i], "b"));
+    }
+
+    const Json::Value &walks = root["walks"];
+    if(walks.size() != 2) {
+        throw std::string("Parsing error: expected 2 walks");
+    }
+
+    const Json::Value &end = root["end"];
+
+    // Walks are dropped by the clients at 4 times the expected length for
+    // the most distinguished bits the job had
+    unsigned int maxBits = root.get("max_bits", params.dBits).asUInt();
+    unsigned long long maxLength = (unsigned long long)4 << maxBits;
+
+    WalkReplay *r = newWalkReplay(params, &rx[0], &ry[0], &ra[0], &rb[0], numRPoints);
+
+    unsigned int t0 = util::getSystemTime();
+
+    ReplayResult result = r->findCollision(readBigInt(walks[0], "a"), readBigInt(walks[0], "b"),
+                                           readBigInt(walks[1], "a"), readBigInt(walks[1], "b"),
+                                           readBigInt(end, "x"), readBigInt(end, "y"),
+                                           maxLength);
+
+    unsigned int ms = util::getSystemTime() - t0;
+
+    delete r;
+
+    Json::Value out(Json::objectValue);
+    out["status"] = statusName(result.status);
+    out["lengths"].append((Json::UInt64)result.length1);
+    out["lengths"].append((Json::UInt64)result.length2);
+    out["seconds"] = ms / 1000.0;
+
+    if(result.status == REPLAY_COLLISION) {
+        out["p1"] = encodePoint(result.p1);
+        out["p2"] = encodePoint(result.p2);
+    }
+
+    return out;
+}
+
+int main(int argc, char **argv)
+{
+    std::string input((std::istreambuf_iterator<char>(std::cin)), std::istreambuf_iterator<char>());
+
+    Json::Value root;
+    Json::Reader reader;
+
+    if(!reader.parse(input, root)) {
+        Logger::logError("JSON parsing error: " + reader.getFormattedErrorMessages());
+        return 1;
+    }
+
+    Json::Value out;
+
+    try {
+        out = replay(root);
+    } catch(std::string err) {
+        Logger::logError(err);
+        return 1;
+    }
+
+    Json::FastWriter writer;
+    fputs(writer.write(out).c_str(), stdout);
+
+    return 0;
+}
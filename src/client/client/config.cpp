@@ -1,7 +1,9 @@
 #include <fstream>
+#include <stdlib.h>
 #include "client.h"
 #include "json/json.h"
 #include "Config.h"
+#include "logger.h"
 
 static std::string readFile(std::string fileName)
 {
@@ -16,6 +18,62 @@ static std::string readFile(std::string fileName)
     return s;
 }
 
+#ifdef _CUDA
+/**
+ * Parses a comma separated list of devices, or "all". An empty list means all
+ * devices
+ */
+static std::vector<int> parseDeviceList(std::string s, int defaultDevice)
+{
+    std::vector<int> devices;
+
+    if(s == "all") {
+        return devices;
+    }
+
+    if(s == "") {
+        devices.push_back(defaultDevice);
+        return devices;
+    }
+
+    size_t start = 0;
+    while(start <= s.length()) {
+        size_t end = s.find(',', start);
+        if(end == std::string::npos) {
+            end = s.length();
+        }
+
+        std::string field = s.substr(start, end - start);
+        if(field.find_first_not_of(' ') != std::string::npos) {
+            devices.push_back(atoi(field.c_str()));
+        }
+
+        start = end + 1;
+    }
+
+    if(devices.size() == 0) {
+        throw std::string("Invalid device list: " + s);
+    }
+
+    return devices;
+}
+#endif
+
+/**
+ * Parses the restart mode. "offset" restarts a walk from its previous
+ * starting point plus a fixed point, "random" from a new random point
+ */
+static bool parseRestartMode(std::string s)
+{
+    if(s == "offset") {
+        return true;
+    } else if(s == "random") {
+        return false;
+    }
+
+    throw std::string("Invalid restart mode: " + s);
+}
+
 ClientConfig loadConfig(std::string fileName)
 {
     ClientConfig configObj;
@@ -24,12 +82,30 @@ ClientConfig loadConfig(std::string fileName)
     configObj.serverHost = config.get("server_host", "").asString();
     configObj.serverPort = config.get("server_port", "-1").asInt();
     configObj.pointCacheSize = config.get("point_cache_size").asInt();
+    configObj.clientId = config.get("client_id", "").asString();
+    configObj.offsetRestarts = parseRestartMode(config.get("restart_mode", "offset").asString());
+    configObj.cpuAffinity = config.get("cpu_affinity", "0").asInt() != 0;
+    configObj.cpuPhysicalCores = config.get("cpu_physical_cores", "0").asInt() != 0;
+    configObj.cpuNumaAlloc = config.get("cpu_numa_alloc", "1").asInt() != 0;
+    configObj.checkpointInterval = config.get("checkpoint_interval", "600").asInt();
+    configObj.statsInterval = config.get("stats_interval", "60").asInt();
+    configObj.metricsFile = config.get("metrics_file", "").asString();
+    configObj.jobTimeSlice = config.get("job_time_slice", "600").asInt();
+    configObj.pausedContexts = config.get("paused_contexts", "4").asInt();
+    configObj.logLevel = Logger::parseLevel(config.get("log_level", "info").asString());
 
 #ifdef _CUDA
     configObj.threads = config.get("cuda_threads", "32").asInt();
     configObj.blocks = config.get("cuda_blocks", "1").asInt();
     configObj.pointsPerThread = config.get("cuda_points_per_thread").asInt();
     configObj.device = config.get("cuda_device").asInt();
+    configObj.devices = parseDeviceList(config.get("cuda_devices", "").asString(), configObj.device);
+    configObj.stepsPerLaunch = config.get("cuda_steps_per_launch", "1").asInt();
+    configObj.streams = config.get("cuda_streams", "1").asInt();
+    configObj.autoTune = config.get("cuda_auto_tune", "0").asInt() != 0;
+    configObj.tuneCache = config.get("cuda_tune_cache", "tune.json").asString();
+    configObj.cpuThreads = config.get("hybrid_cpu_threads", "0").asInt();
+    configObj.cpuPointsPerThread = config.get("cpu_points_per_thread", "1").asInt();
     configObj.pointCacheSize = config.get("point_cache_size", "4").asInt();
 #else
     configObj.threads = config.get("cpu_threads", "-1").asInt();
@@ -0,0 +1,74 @@
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <stdint.h>
+#include <string.h>
+
+// Size of a cache line. Every array in an arena starts on one
+#define CACHE_LINE_SIZE 64
+
+// Unused bytes after the last array, so that the adjacent line prefetcher
+// never pulls in a line that another thread writes
+#define ARENA_PADDING (2 * CACHE_LINE_SIZE)
+
+/**
+ * One allocation holding the arrays of a walk thread. The arrays are
+ * reserved first, then allocated together. Each one starts on a cache line
+ * and the whole block is padded at both ends, so no line of it is shared
+ * with memory used by another thread.
+ *
+ * The memory is zeroed by allocate(), so it is first touched by the thread
+ * that allocates it and placed on that thread's NUMA node
+ */
+class Arena {
+
+private:
+    unsigned char *_mem;
+    unsigned char *_base;
+    size_t _size;
+
+    Arena(const Arena &);
+    Arena &operator=(const Arena &);
+
+public:
+    Arena() : _mem(NULL), _base(NULL), _size(0)
+    {
+    }
+
+    ~Arena()
+    {
+        delete[] _mem;
+    }
+
+    /**
+     * Reserves an array of count elements and returns its offset in the arena
+     */
+    template<typename T> size_t reserve(size_t count)
+    {
+        size_t offset = _size;
+
+        _size += (count * sizeof(T) + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1);
+
+        return offset;
+    }
+
+    /**
+     * Allocates the reserved arrays
+     */
+    void allocate()
+    {
+        size_t size = ARENA_PADDING + _size + ARENA_PADDING;
+
+        _mem = new unsigned char[size + CACHE_LINE_SIZE];
+        memset(_mem, 0, size + CACHE_LINE_SIZE);
+
+        _base = (unsigned char *)(((uintptr_t)_mem + CACHE_LINE_SIZE - 1) & ~(uintptr_t)(CACHE_LINE_SIZE - 1)) + ARENA_PADDING;
+    }
+
+    template<typename T> T *get(size_t offset)
+    {
+        return (T *)(_base + offset);
+    }
+};
+
+#endif
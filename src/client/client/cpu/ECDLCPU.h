@@ -6,6 +6,8 @@
 #include "ecc.h"
 
 #include "ECDLContext.h"
+#include "StartingPointPool.h"
+#include "WalkCheckpoint.h"
 
 #include <vector>
 
@@ -15,14 +17,49 @@ class RhoBase;
 typedef struct {
     ECDLCpuContext *instance;
     int threadId;
+
+    // Core the thread is pinned to, or -1
+    int core;
 }WorkerThreadParams;
 
+/**
+ * Where the worker threads run and allocate their memory
+ */
+typedef struct {
+    // Pin every worker thread to its own logical core
+    bool affinity;
+
+    // Use only one logical core of each physical core, for pinning and for
+    // the number of threads when it is not given
+    bool physicalCores;
+
+    // Each worker sets up its walks on its own thread after it is pinned, so
+    // that the kernel places their memory on the NUMA node of its core
+    bool localAlloc;
+}CpuPlacement;
+
 typedef struct {
     ECDLCpuContext *instance;
     int threadId;
+
+    // Number of threads in the benchmark
+    int numThreads;
+
+    // Core the thread is pinned to, or -1
+    int core;
     unsigned long long iterationsPerSecond;
 }BenchmarkThreadParams;
 
+/**
+ * Speed of the walk with a number of threads. The efficiency is the
+ * aggregate speed over the speed of one thread times the number of threads
+ */
+typedef struct {
+    int threads;
+    unsigned long long pointsPerSecond;
+    std::vector<unsigned long long> threadPointsPerSecond;
+    double efficiency;
+}ScalingResult;
 
 
 class ECDLCpuContext : public ECDLContext {
@@ -44,6 +81,9 @@ private:
     // Flag to indicate if the threads are running
     volatile bool _running;
 
+    // Number of worker threads that have not returned yet
+    volatile unsigned int _activeWorkers;
+
     // Callback that gets called when distinguished point is found 
     void (*_callback)(struct CallbackParameters *);
 
@@ -52,16 +92,48 @@ private:
 
     // R-points
     int _rPoints;
-    BigInteger _rx[ NUM_R_POINTS ];
-    BigInteger _ry[ NUM_R_POINTS ];
+    std::vector<BigInteger> _rx;
+    std::vector<BigInteger> _ry;
+
+    // Starting points for every worker thread
+    StartingPointPool *_pool;
+
+    // Placement of the workers, and the cores they are pinned to in order
+    CpuPlacement _placement;
+    std::vector<int> _cores;
+
+    // Number of benchmark threads that have set up their walks
+    volatile unsigned int _benchmarkReady;
+
+    // Saved walks that the workers continue, or NULL
+    WalkCheckpoint *_resume;
+
+    /**
+     * Saving the walks. Each request has a new number, and every worker
+     * copies its walks into _checkpoint between two steps and then sets
+     * its entry of _workerSaved to the number. The mutex keeps the workers
+     * from starting while walks are saved
+     */
+    Mutex _saveMutex;
+    volatile unsigned int _saveRequest;
+    std::vector<unsigned int> _workerSaved;
+    WalkCheckpoint *_checkpoint;
+
+    // Distinguished bits the walks stop at. Each worker passes a change on
+    // to its walks between two steps
+    volatile unsigned int _dBits;
 
     static void *workerThreadEntry(void *ptr);
     static void *benchmarkThreadEntry(void *ptr);
 
     void workerThreadFunction(int threadId);
-    void benchmarkThreadFunction(unsigned long long *iterationsPerSecond);
+    void benchmarkThreadFunction(BenchmarkThreadParams *params);
+    unsigned long long runBenchmark(int numThreads, bool pin, std::vector<unsigned long long> &threadPointsPerSecond);
 
     RhoBase *getRho(bool callback = true);
+    int getCore(int threadId);
+    bool workersSaved(unsigned int request);
+    bool useIFMA();
 
 public:
 
@@ -71,6 +143,10 @@ public:
     virtual bool stop();
     virtual bool isRunning();
     virtual bool benchmark(unsigned long long *pointsPerSecond);
+    virtual void saveWalks(WalkCheckpoint &checkpoint);
+    virtual void resumeWalks(WalkCheckpoint *checkpoint);
+    virtual void setDistinguishedBits(unsigned int dBits);
+    std::vector<ScalingResult> benchmarkScaling(int maxThreads);
 
     ECDLCpuContext(
                    unsigned int threads,
@@ -79,9 +155,13 @@ public:
                    const BigInteger *rx,
                    const BigInteger *ry,
                    int rPoints,
-                   void (*callback)(struct CallbackParameters *)
+                   void (*callback)(struct CallbackParameters *),
+                   bool offsetRestarts = true,
+                   const CpuPlacement *placement = NULL
                   );
 
+    static CpuPlacement getDefaultPlacement();
+
     virtual ~ECDLCpuContext();
 };
 
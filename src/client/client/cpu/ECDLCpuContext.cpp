@@ -3,8 +3,16 @@
 #include "util.h"
 #include "logger.h"
 #include "RhoCPU.h"
+#include "RhoIFMA.h"
 
-#define BENCHMARK_ITERATIONS 10000000
+// Time each benchmark thread runs for, in milliseconds
+#define BENCHMARK_TIME 2000
+
+// Time each benchmark thread walks for before it is timed, in milliseconds
+#define BENCHMARK_WARMUP_TIME 500
+
+// Steps done between reads of the timer
+#define BENCHMARK_BATCH 100
 
 ECDLCpuContext::ECDLCpuContext( unsigned int numThreads,
                                 unsigned int pointsPerThread,
@@ -12,46 +20,192 @@ ECDLCpuContext::ECDLCpuContext( unsigned int numThreads,
                                 const BigInteger *rx,
                                 const BigInteger *ry,
                                 int rPoints,
-                                void (*callback)(struct CallbackParameters *)
+                                void (*callback)(struct CallbackParameters *),
+                                bool offsetRestarts,
+                                const CpuPlacement *placement
                                 )
 {
-    _numThreads = numThreads;
+    _placement = placement ? *placement : getDefaultPlacement();
+    _cores = util::getCpuList(_placement.physicalCores);
+
+    // A negative count means a thread per core
+    _numThreads = (int)numThreads > 0 ? (int)numThreads : (int)_cores.size();
     _pointsPerThread = pointsPerThread;
     _callback = callback;
     _params = *params;
     _rPoints = rPoints;
     _running = false;
+    _activeWorkers = 0;
  
     // Copy random walk points
-    for(int i = 0; i < rPoints; i++) {
-        _rx[i] = rx[i];
-        _ry[i] = ry[i];
-    }
+    _rx.assign(rx, rx + rPoints);
+    _ry.assign(ry, ry + rPoints);
 
     // Set up curve using parameters 
     _curve = ECCurve(_params.p, _params.n, _params.a, _params.b, _params.gx, _params.gy);
+
+    _pool = new StartingPointPool(&_params, offsetRestarts);
+
+    _benchmarkReady = 0;
+
+    _resume = NULL;
+    _saveRequest = 0;
+    _checkpoint = NULL;
+    _dBits = _params.dBits;
+}
+
+/**
+ * Workers are not pinned by default, and set up their own walks
+ */
+CpuPlacement ECDLCpuContext::getDefaultPlacement()
+{
+    CpuPlacement placement;
+    placement.affinity = false;
+    placement.physicalCores = false;
+    placement.localAlloc = true;
+
+    return placement;
+}
+
+/**
+ * Core a worker is pinned to, or -1 when workers are not pinned. With more
+ * threads than cores the cores are used again in the same order
+ */
+int ECDLCpuContext::getCore(int threadId)
+{
+    if(!_placement.affinity || _cores.empty()) {
+        return -1;
+    }
+
+    return _cores[threadId % _cores.size()];
+}
+
+/**
+ * Walk for an N-word modulus, with the pseudo-Mersenne reduction when the
+ * modulus has that form
+ */
+template<int N> static RhoBase *newRhoCPU(const ECDLPParams *params,
+                                          const BigInteger *rx,
+                                          const BigInteger *ry,
+                                          int numRPoints,
+                                          int numPoints,
+                                          StartingPointPool *pool,
+                                          void (*callback)(struct CallbackParameters *),
+                                          WalkCheckpoint *checkpoint)
+{
+    if(isPseudoMersenne(params->p)) {
+        return new RhoCPU<N, FpPseudoMersenne<N> >(params, rx, ry, numRPoints, numPoints, pool, callback, checkpoint);
+    }
+
+    return new RhoCPU<N>(params, rx, ry, numRPoints, numPoints, pool, callback, checkpoint);
 }
 
 RhoBase *ECDLCpuContext::getRho(bool callback)
 {
-    return new RhoCPU(&_params, _rx, _ry, _rPoints, _pointsPerThread, callback ? _callback : NULL);
+    void (*callbackPtr)(struct CallbackParameters *) = callback ? _callback : NULL;
+
+    // Benchmark walks do not resume saved walks
+    WalkCheckpoint *resume = callback ? _resume : NULL;
+
+    int pLen = _params.p.getWordLength();
+
+#ifdef FP_IFMA_SUPPORTED
+    if(useIFMA()) {
+        switch(pLen) {
+            case 1:
+                return new RhoIFMA<1>(&_params, &_rx[0], &_ry[0], _rPoints, _pointsPerThread, _pool, callbackPtr, resume);
+            case 2:
+                return new RhoIFMA<2>(&_params, &_rx[0], &_ry[0], _rPoints, _pointsPerThread, _pool, callbackPtr, resume);
+            case 3:
+                return new RhoIFMA<3>(&_params, &_rx[0], &_ry[0], _rPoints, _pointsPerThread, _pool, callbackPtr, resume);
+            case 4:
+                return new RhoIFMA<4>(&_params, &_rx[0], &_ry[0], _rPoints, _pointsPerThread, _pool, callbackPtr, resume);
+            case 5:
+                return new RhoIFMA<5>(&_params, &_rx[0], &_ry[0], _rPoints, _pointsPerThread, _pool, callbackPtr, resume);
+            case 6:
+                return new RhoIFMA<6>(&_params, &_rx[0], &_ry[0], _rPoints, _pointsPerThread, _pool, callbackPtr, resume);
+            case 7:
+                return new RhoIFMA<7>(&_params, &_rx[0], &_ry[0], _rPoints, _pointsPerThread, _pool, callbackPtr, resume);
+            case 8:
+                return new RhoIFMA<8>(&_params, &_rx[0], &_ry[0], _rPoints, _pointsPerThread, _pool, callbackPtr, resume);
+        }
+    }
+#endif
+
+    // Instantiate the walk for the length of the modulus
+    switch(pLen) {
+        case 1:
+            return newRhoCPU<1>(&_params, &_rx[0], &_ry[0], _rPoints, _pointsPerThread, _pool, callbackPtr, resume);
+        case 2:
+            return newRhoCPU<2>(&_params, &_rx[0], &_ry[0], _rPoints, _pointsPerThread, _pool, callbackPtr, resume);
+        case 3:
+            return newRhoCPU<3>(&_params, &_rx[0], &_ry[0], _rPoints, _pointsPerThread, _pool, callbackPtr, resume);
+        case 4:
+            return newRhoCPU<4>(&_params, &_rx[0], &_ry[0], _rPoints, _pointsPerThread, _pool, callbackPtr, resume);
+        case 5:
+            return newRhoCPU<5>(&_params, &_rx[0], &_ry[0], _rPoints, _pointsPerThread, _pool, callbackPtr, resume);
+        case 6:
+            return newRhoCPU<6>(&_params, &_rx[0], &_ry[0], _rPoints, _pointsPerThread, _pool, callbackPtr, resume);
+        case 7:
+            return newRhoCPU<7>(&_params, &_rx[0], &_ry[0], _rPoints, _pointsPerThread, _pool, callbackPtr, resume);
+        case 8:
+            return newRhoCPU<8>(&_params, &_rx[0], &_ry[0], _rPoints, _pointsPerThread, _pool, callbackPtr, resume);
+    }
+
+    throw "Compile for larger integers";
+}
+
+/**
+ * The vectorized walk is used when the CPU supports it and the walks divide
+ * evenly into groups of IFMA_LANES. The negation map only has a scalar walk
+ */
+bool ECDLCpuContext::useIFMA()
+{
+#ifdef FP_IFMA_SUPPORTED
+    return ifmaSupported()
+        && _pointsPerThread % IFMA_LANES == 0
+        && _params.dBits <= IFMA_LIMB_BITS
+        && !_params.negation;
+#else
+    return false;
+#endif
 }
 
 ECDLCpuContext::~ECDLCpuContext()
 {
     _workerThreads.clear();
     _workerThreadParams.clear();
+
+    for(unsigned int i = 0; i < _workerCtx.size(); i++) {
+        delete _workerCtx[i];
+    }
+
+    delete _pool;
 }
 
 bool ECDLCpuContext::init()
 {
     reset();
 
-    
+#ifdef FP_IFMA_SUPPORTED
+    if(useIFMA()) {
+        Logger::logInfo("Using AVX-512 IFMA (%d walks per group)\n", IFMA_LANES);
+    }
+#endif
+
+    if(!useIFMA() && isPseudoMersenne(_params.p)) {
+        Logger::logInfo("Using pseudo-Mersenne reduction");
+    }
+
+    if(_placement.affinity) {
+        Logger::logInfo("Pinning %d threads to %s", _numThreads, _placement.physicalCores ? "physical cores" : "logical cores");
+    }
+
+    // With local allocation each worker sets up its walks when it starts
     for(int i = 0; i < _numThreads; i++) {
-        _workerCtx.push_back(getRho());
+        _workerCtx.push_back(_placement.localAlloc ? NULL : getRho());
     }
-    
+
     return true;
 }
 
@@ -66,9 +220,10 @@ bool ECDLCpuContext::stop()
     // TODO: Protect with mutex
     _running = false;
 
-    // Wait for threads to finish
-    for(int i = 0; i < _numThreads; i++) {
-        _workerThreads[i].wait();
+    // run() joins the threads. Joining them here as well would join each
+    // thread twice
+    while(atomicLoad(&_activeWorkers) > 0) {
+        util::sleep(1);
     }
 
     return true;
@@ -78,13 +233,23 @@ bool ECDLCpuContext::run()
 {
     _running = true;
 
+    // The threads keep pointers to their parameters, so they are all in
+    // place before the first thread starts
+    reset();
+    _workerThreadParams.resize(_numThreads);
+
+    // Walks that are being saved are saved before the workers start. The
+    // workers answer the requests made after this
+    _saveMutex.grab();
+    _workerSaved.assign(_numThreads, atomicLoad(&_saveRequest));
+    _activeWorkers = _numThreads;
+    _saveMutex.release();
+
     // Run the threads
     for(int i = 0; i < _numThreads; i++) {
-        WorkerThreadParams params;
-
-        params.threadId = i;
-        params.instance = this;
-        _workerThreadParams.push_back(params);
+        _workerThreadParams[i].threadId = i;
+        _workerThreadParams[i].core = getCore(i);
+        _workerThreadParams[i].instance = this;
 
         _workerThreads.push_back(Thread(&ECDLCpuContext::workerThreadEntry, &_workerThreadParams[i]));
     }
@@ -104,8 +269,14 @@ void *ECDLCpuContext::workerThreadEntry(void *ptr)
 {
     WorkerThreadParams *params = (WorkerThreadParams *)ptr;
 
+    if(params->core >= 0 && !setThreadAffinity(params->core)) {
+        Logger::logError("Cannot pin thread %d to core %d", params->threadId, params->core);
+    }
+
     ((ECDLCpuContext *)params->instance)->workerThreadFunction(params->threadId);
 
+    atomicAdd(&((ECDLCpuContext *)params->instance)->_activeWorkers, (unsigned int)-1);
+
     return NULL;
 }
 
@@ -114,37 +285,136 @@ void *ECDLCpuContext::workerThreadEntry(void *ptr)
  */
 void ECDLCpuContext::workerThreadFunction(int threadId)
 {
+    // The first touch of the walk buffers is on this thread, so they are on
+    // the NUMA node it runs on
+    if(_workerCtx[threadId] == NULL) {
+        _workerCtx[threadId] = getRho();
+    }
+
     RhoBase *r = _workerCtx[threadId];
 
+    unsigned int dBits = atomicLoad(&_dBits);
+    r->setDistinguishedBits(dBits);
+
     while(_running) {
         r->doStep();
+
+        if(atomicLoad(&_dBits) != dBits) {
+            dBits = atomicLoad(&_dBits);
+            r->setDistinguishedBits(dBits);
+        }
+
+        unsigned int request = atomicLoad(&_saveRequest);
+        if(request != _workerSaved[threadId]) {
+            r->saveWalks(*_checkpoint);
+            atomicStore(&_workerSaved[threadId], request);
+        }
     }
 }
 
+/**
+ * Checks if every worker has saved its walks for a request
+ */
+bool ECDLCpuContext::workersSaved(unsigned int request)
+{
+    for(unsigned int i = 0; i < _workerSaved.size(); i++) {
+        if(atomicLoad(&_workerSaved[i]) != request) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Copies the walks of every worker into the checkpoint. A running worker
+ * copies its own walks between two steps, so the other workers keep
+ * walking in the meantime
+ */
+void ECDLCpuContext::saveWalks(WalkCheckpoint &checkpoint)
+{
+    _saveMutex.grab();
+
+    _checkpoint = &checkpoint;
+    unsigned int request = atomicAdd(&_saveRequest, 1) + 1;
+
+    while(atomicLoad(&_activeWorkers) > 0 && !workersSaved(request)) {
+        util::sleep(1);
+    }
+
+    // The walks of workers that are not running, or that stopped before
+    // they saw the request, do not change any more
+    for(unsigned int i = 0; i < _workerCtx.size(); i++) {
+        if(_workerCtx[i] != NULL && (i >= _workerSaved.size() || atomicLoad(&_workerSaved[i]) != request)) {
+            _workerCtx[i]->saveWalks(checkpoint);
+        }
+    }
+
+    _checkpoint = NULL;
+
+    _saveMutex.release();
+}
+
+void ECDLCpuContext::resumeWalks(WalkCheckpoint *checkpoint)
+{
+    _resume = checkpoint;
+}
+
+void ECDLCpuContext::setDistinguishedBits(unsigned int dBits)
+{
+    atomicStore(&_dBits, dBits);
+}
+
 void *ECDLCpuContext::benchmarkThreadEntry(void *ptr)
 {
     BenchmarkThreadParams *params = (BenchmarkThreadParams *)ptr;
 
-    ((ECDLCpuContext *)params->instance)->benchmarkThreadFunction(&params->iterationsPerSecond);
+    if(params->core >= 0 && !setThreadAffinity(params->core)) {
+        Logger::logError("Cannot pin benchmark thread %d to core %d", params->threadId, params->core);
+    }
+
+    ((ECDLCpuContext *)params->instance)->benchmarkThreadFunction(params);
 
     return NULL;
 }
 
-void ECDLCpuContext::benchmarkThreadFunction(unsigned long long *iterationsPerSecond)
+/**
+ * Walks until every thread has set up its walks, then for
+ * BENCHMARK_WARMUP_TIME, and then counts the steps of BENCHMARK_TIME. All
+ * threads leave the first phase together, so they are timed over the same
+ * period
+ */
+void ECDLCpuContext::benchmarkThreadFunction(BenchmarkThreadParams *params)
 {
+    RhoBase *r = getRho(false);
+
+    atomicAdd(&_benchmarkReady, 1);
+    while(atomicLoad(&_benchmarkReady) < (unsigned int)params->numThreads) {
+        r->doStep();
+    }
+
     util::Timer timer;
     timer.start();
 
-    RhoBase *r = getRho(false);
-
-    for(int i = 0; i < BENCHMARK_ITERATIONS; i++)
-    {
+    while(timer.getTime() < BENCHMARK_WARMUP_TIME) {
         r->doStep();
     }
 
-    unsigned int t = timer.getTime();
+    unsigned long long iterations = 0;
+    unsigned int t = 0;
+
+    timer.start();
+
+    do {
+        for(int i = 0; i < BENCHMARK_BATCH; i++) {
+            r->doStep();
+        }
+        iterations += BENCHMARK_BATCH;
+    }while((t = timer.getTime()) < BENCHMARK_TIME);
 
-    *iterationsPerSecond = (unsigned long long) ((double)BENCHMARK_ITERATIONS / ((double)t/1000.0));
+    delete r;
+
+    params->iterationsPerSecond = (unsigned long long) ((double)iterations / ((double)t/1000.0));
 }
 
 bool ECDLCpuContext::isRunning()
@@ -152,23 +422,26 @@ bool ECDLCpuContext::isRunning()
     return _running;
 }
 
-bool ECDLCpuContext::benchmark(unsigned long long *pointsPerSecondOut)
+/**
+ * Runs the walk on numThreads threads, each pinned to its own core when pin
+ * is set, and returns the points per second of all of them
+ */
+unsigned long long ECDLCpuContext::runBenchmark(int numThreads, bool pin, std::vector<unsigned long long> &threadPointsPerSecond)
 {
-    int numThreads = _numThreads;
-    int pointsPerThread = _pointsPerThread;
-
-    std::vector<BenchmarkThreadParams *> params;
+    std::vector<BenchmarkThreadParams> params(numThreads);
     std::vector<Thread> threads;
 
+    _benchmarkReady = 0;
+
     // Start threads
     for(int i = 0; i < numThreads; i++) {
-        BenchmarkThreadParams *p = new BenchmarkThreadParams;
+        params[i].threadId = i;
+        params[i].numThreads = numThreads;
+        params[i].core = pin ? _cores[i % _cores.size()] : -1;
+        params[i].instance = this;
+        params[i].iterationsPerSecond = 0;
 
-        p->threadId = i;
-        p->instance = this;
-        params.push_back(p);
-
-        Thread t(benchmarkThreadEntry, p);
+        Thread t(benchmarkThreadEntry, &params[i]);
 
         threads.push_back(t);
     }
@@ -178,15 +451,24 @@ bool ECDLCpuContext::benchmark(unsigned long long *pointsPerSecondOut)
         threads[i].wait();
     }
 
-    unsigned long long iterationsPerSecond = 0;
     unsigned long long pointsPerSecond = 0;
-    
+    threadPointsPerSecond.clear();
+
     for(int i = 0; i < numThreads; i++) {
-        iterationsPerSecond += params[i]->iterationsPerSecond;
-        pointsPerSecond += params[i]->iterationsPerSecond * _pointsPerThread;
+        threadPointsPerSecond.push_back(params[i].iterationsPerSecond * _pointsPerThread);
+        pointsPerSecond += params[i].iterationsPerSecond * _pointsPerThread;
     }
 
-    Logger::logInfo("%lld iterations per second\n", iterationsPerSecond);
+    return pointsPerSecond;
+}
+
+bool ECDLCpuContext::benchmark(unsigned long long *pointsPerSecondOut)
+{
+    std::vector<unsigned long long> threadPointsPerSecond;
+
+    unsigned long long pointsPerSecond = runBenchmark(_numThreads, true, threadPointsPerSecond);
+
+    Logger::logInfo("%lld iterations per second\n", pointsPerSecond / _pointsPerThread);
     Logger::logInfo("%lld points per second\n", pointsPerSecond);
 
     if(pointsPerSecondOut) {
@@ -194,4 +476,30 @@ bool ECDLCpuContext::benchmark(unsigned long long *pointsPerSecondOut)
     }
 
     return true;
-}
\ No newline at end of file
+}
+
+/**
+ * Benchmarks 1 to maxThreads threads, pinned to the cores in order.
+ * An efficiency well below 1 means the threads slow each other down, e.g.
+ * through the allocator, shared caches or memory bandwidth
+ */
+std::vector<ScalingResult> ECDLCpuContext::benchmarkScaling(int maxThreads)
+{
+    std::vector<ScalingResult> results;
+
+    for(int numThreads = 1; numThreads <= maxThreads; numThreads++) {
+        ScalingResult result;
+
+        result.threads = numThreads;
+        result.pointsPerSecond = runBenchmark(numThreads, true, result.threadPointsPerSecond);
+
+        double single = results.empty() ? (double)result.pointsPerSecond : (double)results[0].pointsPerSecond;
+        result.efficiency = single > 0 ? (double)result.pointsPerSecond / (single * numThreads) : 0.0;
+
+        Logger::logInfo("%d threads: %lld points per second, efficiency %.2f", numThreads, result.pointsPerSecond, result.efficiency);
+
+        results.push_back(result);
+    }
+
+    return results;
+}
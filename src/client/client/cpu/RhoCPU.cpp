@@ -1,38 +1,164 @@
 #include "RhoCPU.h"
 #include "logger.h"
+#include "Words.h"
 
-static void copyWords(const unsigned long *src, unsigned long *dest, int n)
+/**
+ * Starts walk i at a new point from the pool
+ */
+template<int N, class FP> void RhoCPU<N, FP>::newWalk(int i)
 {
-    memcpy(dest, src, sizeof(unsigned long) * n);
+    unsigned int index = i * N;
+    unsigned int coefficient = i * COEFFICIENT_WORDS(N);
+
+    StartingPoint p;
+    _pool->get(p);
+
+    copyWords(p.a, &_a[coefficient], COEFFICIENT_WORDS(N));
+    copyWords(p.b, &_b[coefficient], COEFFICIENT_WORDS(N));
+
+    _fp.encode(p.x, &_startX[index]);
+    _fp.encode(p.y, &_startY[index]);
 }
 
 /**
- * Generates a random point on the curve
+ * Continues walk i from a saved walk. Walks without their starting point
+ * cannot be offset, so they are skipped with offset restarts. Returns false
+ * when there are no saved walks left
  */
-void RhoCPU::generateStartingPoint(BigInteger &x, BigInteger &y, BigInteger &a, BigInteger &b)
+template<int N, class FP> bool RhoCPU<N, FP>::resumeWalk(int i, WalkCheckpoint &checkpoint)
 {
-    unsigned long buf[FP_MAX];
+    unsigned int index = i * N;
+    unsigned int coefficient = i * COEFFICIENT_WORDS(N);
+
+    WalkState w;
+    if(!checkpoint.take(w, _offsetRestarts)) {
+        return false;
+    }
+
+    w.a.getWords(&_a[coefficient], COEFFICIENT_WORDS(N));
+    w.b.getWords(&_b[coefficient], COEFFICIENT_WORDS(N));
+
+    unsigned long words[N];
+
+    w.startX.getWords(words, N);
+    _fp.encode(words, &_startX[index]);
+    w.startY.getWords(words, N);
+    _fp.encode(words, &_startY[index]);
+
+    w.y.getWords(words, N);
+    _fp.encode(words, &_y[index]);
+    w.x.getWords(words, N);
+    _fp.encode(words, &_x[index]);
+
+    // With the negation map the walk continues from the R point after the
+    // ones it skipped, and its history decides when it is in a cycle
+    if(_params.negation) {
+        _rIdx[i] = (words[0] + w.skipped) & _rPointMask;
+        _history[i] = w.history;
+    } else {
+        _rIdx[i] = words[0] & _rPointMask;
+        _history[i] = cycleFingerprint(words);
+    }
+    _lengthBuf[i] = w.length;
+
+    return true;
+}
+
+/**
+ * Moves the starting point S of walk i to S + T, until it is a point with
+ * non-zero coefficients that is not distinguished. Tame kangaroos keep
+ * b = 0. Returns false if S is T or -T, which the addition does not handle
+ */
+template<int N, class FP> bool RhoCPU<N, FP>::offsetWalk(int i)
+{
+    unsigned long *sx = &_startX[i * N];
+    unsigned long *sy = &_startY[i * N];
+    unsigned long *a = &_a[i * COEFFICIENT_WORDS(N)];
+    unsigned long *b = &_b[i * COEFFICIENT_WORDS(N)];
+
+    unsigned long x[N];
 
     do {
-        // 1 < a,b < n
-        a = randomBigInteger(2, _params.n);
-        b = randomBigInteger(2, _params.n);
+        if(equalWords(sx, _tx, N)) {
+            return false;
+        }
+
+        // s = (Sy - Ty)/(Sx - Tx)
+        unsigned long run[N];
+        _fp.subModP(sx, _tx, run);
+        _fp.inverseModP(run, run);
+
+        unsigned long s[N];
+        _fp.subModP(sy, _ty, s);
+        _fp.multiplyModP(s, run, s);
+
+        // x = s^2 - Sx - Tx
+        unsigned long newX[N];
+        _fp.squareModP(s, newX);
+        _fp.subModP(newX, sx, newX);
+        _fp.subModP(newX, _tx, newX);
+
+        // y = s(Sx - x) - Sy
+        unsigned long k[N];
+        _fp.subModP(sx, newX, k);
+        _fp.multiplyModP(k, s, k);
+        _fp.subModP(k, sy, sy);
+
+        copyWords(newX, sx, N);
+
+        addModN(a, _tA, _n, COEFFICIENT_WORDS(N));
+        addModN(b, _tB, _n, COEFFICIENT_WORDS(N));
+
+        _fp.decode(sx, x);
+    }while(isZero(a, COEFFICIENT_WORDS(N)) || (isZero(b, COEFFICIENT_WORDS(N)) && !_params.kangaroo) || checkDistinguishedBits(x));
+
+    return true;
+}
+
+/**
+ * Moves walk i to its next starting point. In offset mode this is its old
+ * starting point plus T, otherwise a new point from the pool
+ */
+template<int N, class FP> void RhoCPU<N, FP>::restartWalk(int i)
+{
+    if(!_offsetRestarts || !offsetWalk(i)) {
+        newWalk(i);
+    }
 
-        // aG, bQ, aG + bQ
-        ECPoint p1 = _curve.multiply(a, _g);
-        ECPoint p2 = _curve.multiply(b, _q);
-        ECPoint p3 = _curve.add(p1, p2);
+    setPoint(i);
 
-        x = p3.getX();
-        y = p3.getY();
+    _metrics->restarts++;
+}
+
+/**
+ * Sets the current point of walk i to its starting point. With the negation
+ * map the walk starts at the canonical form of it
+ */
+template<int N, class FP> void RhoCPU<N, FP>::setPoint(int i)
+{
+    unsigned int index = i * N;
+
+    copyWords(&_startX[index], &_x[index], N);
+    copyWords(&_startY[index], &_y[index], N);
+
+    if(_params.negation) {
+        unsigned long y[N];
+        _fp.decode(&_y[index], y);
+
+        if(y[0] & 1) {
+            unsigned long zero[N] = {0};
+            _fp.subModP(zero, &_y[index], &_y[index]);
+        }
+    }
 
-        // Check that we don't start on a distinguished point
-        x.getWords(buf, _pLen);
-    }while((buf[0] & _dBitsMask) == 0);
+    unsigned long x[N];
+    _fp.decode(&_x[index], x);
 
+    _rIdx[i] = x[0] & _rPointMask;
+    _history[i] = cycleFingerprint(x);
 }
 
-bool inline RhoCPU::checkDistinguishedBits(const unsigned long *x)
+template<int N, class FP> bool inline RhoCPU<N, FP>::checkDistinguishedBits(const unsigned long *x)
 {
     if((x[ 0 ] & _dBitsMask) == 0) {
         return true;
@@ -41,66 +167,117 @@ bool inline RhoCPU::checkDistinguishedBits(const unsigned long *x)
     }
 }
 
-RhoCPU::RhoCPU(const ECDLPParams *params,
+/**
+ * Passes the distinguished point x, newY that walk i reached to the
+ * callback. x is canonical
+ */
+template<int N, class FP> void RhoCPU<N, FP>::reportPoint(int i, const unsigned long *x, const unsigned long *newY)
+{
+    unsigned long y[N];
+    _fp.decode(newY, y);
+
+    struct CallbackParameters cp;
+
+    if(!setPointWords(cp.aStart, &_a[i * COEFFICIENT_WORDS(N)], COEFFICIENT_WORDS(N))
+        || !setPointWords(cp.bStart, &_b[i * COEFFICIENT_WORDS(N)], COEFFICIENT_WORDS(N))
+        || !setPointWords(cp.x, x, N)
+        || !setPointWords(cp.y, y, N)) {
+        Logger::logError("Distinguished point does not fit in %d bits", POINT_WORDS * 32);
+        return;
+    }
+
+    cp.length = _lengthBuf[i];
+
+    _callback(&cp);
+}
+
+template<int N, class FP> RhoCPU<N, FP>::RhoCPU(const ECDLPParams *params,
                         const BigInteger *rx,
                         const BigInteger *ry,
                         int numRPoints,
                         int pointsInParallel,
-                        void (*callback)(struct CallbackParameters *)
-                        )
+                        StartingPointPool *pool,
+                        void (*callback)(struct CallbackParameters *),
+                        WalkCheckpoint *checkpoint
+                        ) : _fp(params->p)
 {
     // Copy parameters
     _params = *params;
 
-    _fp = getFp(_params.p);
-    _pLen = _params.p.getWordLength();
-
     // Create curve
     _curve = ECCurve(_params.p, _params.n, _params.a, _params.b, _params.gx, _params.gy);
 
-    // Create points
-    _g = ECPoint(_params.gx, _params.gy);
-    _q = ECPoint(_params.qx, _params.qy);
+    _pool = pool;
 
     _pointsInParallel = pointsInParallel;
 
-    // Initialize Barrett code for modulus P
-    BigInteger p = _curve.p();
-  
-    // Pointer to the coefficients of the starting points
-    _a = new BigInteger[pointsInParallel];
-    _b = new BigInteger[pointsInParallel];
-
-    for(int i = 0; i < pointsInParallel; i++) {
-        _a[i] = BigInteger(0);
-        _b[i] = BigInteger(0);
-    }
-
-    // (x,y) of the current points
-    _x = new unsigned long[pointsInParallel * _pLen];
-    _y = new unsigned long[pointsInParallel * _pLen];
-    _rx = new unsigned long[32 * _pLen];
-    _ry = new unsigned long[32 * _pLen];
-    _diffBuf = new unsigned long[pointsInParallel * _pLen];
-    _chainBuf = new unsigned long[pointsInParallel * _pLen];
-    _lengthBuf = new unsigned long long [pointsInParallel];
+    // The arrays used on every step come first, then the R points, then
+    // the starting points which are only used on restarts
+    size_t xOffset = _arena.reserve<unsigned long>(pointsInParallel * N);
+    size_t yOffset = _arena.reserve<unsigned long>(pointsInParallel * N);
+    size_t rIdxOffset = _arena.reserve<unsigned int>(pointsInParallel);
+    size_t lengthOffset = _arena.reserve<unsigned long long>(pointsInParallel);
+    size_t historyOffset = _arena.reserve<unsigned long long>(pointsInParallel);
+    size_t diffOffset = _arena.reserve<unsigned long>(pointsInParallel * N);
+    size_t chainOffset = _arena.reserve<unsigned long>(pointsInParallel * N);
+    size_t rTableOffset = _arena.reserve<unsigned long>(numRPoints * 2 * N);
+    size_t startXOffset = _arena.reserve<unsigned long>(pointsInParallel * N);
+    size_t startYOffset = _arena.reserve<unsigned long>(pointsInParallel * N);
+    size_t aOffset = _arena.reserve<unsigned long>(pointsInParallel * COEFFICIENT_WORDS(N));
+    size_t bOffset = _arena.reserve<unsigned long>(pointsInParallel * COEFFICIENT_WORDS(N));
+
+    _arena.allocate();
+
+    _x = _arena.get<unsigned long>(xOffset);
+    _y = _arena.get<unsigned long>(yOffset);
+    _rIdx = _arena.get<unsigned int>(rIdxOffset);
+    _lengthBuf = _arena.get<unsigned long long>(lengthOffset);
+    _history = _arena.get<unsigned long long>(historyOffset);
+    _diffBuf = _arena.get<unsigned long>(diffOffset);
+    _chainBuf = _arena.get<unsigned long>(chainOffset);
+    _rTable = _arena.get<unsigned long>(rTableOffset);
+    _startX = _arena.get<unsigned long>(startXOffset);
+    _startY = _arena.get<unsigned long>(startYOffset);
+    _a = _arena.get<unsigned long>(aOffset);
+    _b = _arena.get<unsigned long>(bOffset);
+
+    _rPoints = new ECPoint[numRPoints];
 
     // Initialize length to 1 (starting point counts as 1 point)
-    memset(_lengthBuf, 0, sizeof(unsigned int) * pointsInParallel);
     for(int i = 0; i < pointsInParallel; i++) {
         _lengthBuf[i] = 1;
     }
 
     // Copy R points
-    for(int i = 0; i < 32; i++) {
-        int index = i * _pLen;
-        rx[i].getWords(&_rx[index], _pLen);
-        ry[i].getWords(&_ry[index], _pLen);
+    for(int i = 0; i < numRPoints; i++) {
+        unsigned long *r = &_rTable[i * 2 * N];
+        rx[i].getWords(r, N);
+        ry[i].getWords(r + N, N);
+
+        _fp.encode(r, r);
+        _fp.encode(r + N, r + N);
+    }
+
+    for(int i = 0; i < numRPoints; i++) {
+        _rPoints[i] = ECPoint(rx[i], ry[i]);
+    }
+
+    _params.n.getWords(_n, COEFFICIENT_WORDS(N));
+
+    // Offset restarts add T to the starting points here rather than in the pool
+    StartingPoint t;
+    _offsetRestarts = _pool->getOffset(t);
+
+    if(_offsetRestarts) {
+        copyWords(t.a, _tA, COEFFICIENT_WORDS(N));
+        copyWords(t.b, _tB, COEFFICIENT_WORDS(N));
+
+        _fp.encode(t.x, _tx);
+        _fp.encode(t.y, _ty);
     }
 
     // Set mask for detecting distinguished points
-    _dBitsMask = ~0;
-    _dBitsMask >>= WORD_LENGTH_BITS - params->dBits;
+    setDistinguishedBits(params->dBits);
 
     // Mask for selecting R point
     _rPointMask = numRPoints - 1;
@@ -108,85 +285,222 @@ RhoCPU::RhoCPU(const ECDLPParams *params,
     // Gets called when distinguished point is found
     _callback = callback;
 
-    // Generate starting points and exponents
+    _metrics = Metrics::acquire();
+
+    // Continue the saved walks and start new ones for the rest
     for(unsigned int i = 0; i < _pointsInParallel; i++) {
-        BigInteger a;
-        BigInteger b;
-        BigInteger x;
-        BigInteger y;
+        if(checkpoint == NULL || !resumeWalk(i, *checkpoint)) {
+            newWalk(i);
+            setPoint(i);
+        }
+    }
+}
 
-        generateStartingPoint(x, y, a, b);
+template<int N, class FP> void RhoCPU<N, FP>::saveWalks(WalkCheckpoint &checkpoint)
+{
+    for(unsigned int i = 0; i < _pointsInParallel; i++) {
+        unsigned int index = i * N;
+        unsigned int coefficient = i * COEFFICIENT_WORDS(N);
+        unsigned long words[N];
+
+        WalkState w;
+        w.a = BigInteger(&_a[coefficient], COEFFICIENT_WORDS(N));
+        w.b = BigInteger(&_b[coefficient], COEFFICIENT_WORDS(N));
+
+        _fp.decode(&_startX[index], words);
+        w.startX = BigInteger(words, N);
+        _fp.decode(&_startY[index], words);
+        w.startY = BigInteger(words, N);
+
+        _fp.decode(&_y[index], words);
+        w.y = BigInteger(words, N);
+        _fp.decode(&_x[index], words);
+        w.x = BigInteger(words, N);
 
-        _a[i] = a;
-        _b[i] = b;
+        w.length = _lengthBuf[i];
 
-        x.getWords((unsigned long *)&_x[i * _pLen], _pLen);
-        y.getWords((unsigned long *)&_y[i * _pLen], _pLen);
+        if(_params.negation) {
+            w.history = _history[i];
+            w.skipped = (_rIdx[i] - words[0]) & _rPointMask;
+        } else {
+            w.history = 0;
+            w.skipped = 0;
+        }
+
+        checkpoint.add(w);
     }
 }
 
-RhoCPU::~RhoCPU()
+template<int N, class FP> RhoCPU<N, FP>::~RhoCPU()
 {
-    delete[] _x;
-    delete[] _y;
-    delete[] _rx;
-    delete[] _ry;
-    delete[] _diffBuf;
-    delete[] _chainBuf;
-    delete[] _lengthBuf;
+    delete[] _rPoints;
+
+    Metrics::release(_metrics);
 }
 
-void RhoCPU::doStepSingle()
+/**
+ * The negation map iteration on curve points: adds the first R point,
+ * starting from the one selected by x, whose sum does not select the same
+ * R point again. Used outside the inner loop only
+ */
+template<int N, class FP> ECPoint RhoCPU<N, FP>::mapPoint(ECPoint &p)
 {
-    unsigned long px[FP_MAX] = {0};
-    unsigned long py[FP_MAX] = {0};
+    unsigned long buf[N];
+
+    p.x.getWords(buf, N);
+    unsigned int idx = buf[0] & _rPointMask;
+
+    ECPoint r;
+    for(unsigned int i = 0; i <= _rPointMask; i++) {
+        unsigned int j = (idx + i) & _rPointMask;
+
+        r = _curve.add(p, _rPoints[j]);
+
+        if(r.y.lsb()) {
+            r.y = _params.p - r.y;
+        }
+
+        r.x.getWords(buf, N);
+        if((buf[0] & _rPointMask) != j) {
+            break;
+        }
+    }
+
+    return r;
+}
+
+/**
+ * Leaves the fruitless cycle through (x, y). The cycle is walked once and
+ * the point with the smallest x is doubled, so that all walks that fall
+ * into the cycle leave it at the same point
+ */
+template<int N, class FP> void RhoCPU<N, FP>::escapeCycle(BigInteger &x, BigInteger &y)
+{
+    ECPoint p(x, y);
+    ECPoint min = p;
+
+    for(int i = 0; i < NEGATION_CYCLE_MAX; i++) {
+        p = mapPoint(p);
+
+        if(p.x == x) {
+            break;
+        }
+
+        if(p.x < min.x) {
+            min = p;
+        }
+    }
+
+    p = _curve.doubl(min);
+
+    x = p.x;
+    y = p.y.lsb() ? _params.p - p.y : p.y;
+
+    _metrics->cycleEscapes++;
+}
+
+/**
+ * Applies the negation map to the sum newX, newY of walk i and R point idx.
+ * x is the canonical newX. Returns false when the R point has to be skipped,
+ * in which case the walk stays on its current point
+ */
+template<int N, class FP> bool RhoCPU<N, FP>::negationStep(unsigned int i, unsigned int idx, unsigned long *x, unsigned long *newX, unsigned long *newY)
+{
+    // Landing on the same R point again is how most fruitless 2-cycles start
+    if((x[0] & _rPointMask) == idx) {
+        _rIdx[i] = (idx + 1) & _rPointMask;
+        return false;
+    }
+
+    // Use the point with an even y
+    unsigned long y[N];
+    _fp.decode(newY, y);
+
+    if(y[0] & 1) {
+        unsigned long zero[N] = {0};
+        _fp.subModP(zero, newY, newY);
+    }
+
+    // Same point as 2 or 4 steps ago means the walk is in a fruitless cycle
+    unsigned long long history = _history[i];
+    unsigned int f = cycleFingerprint(x);
+
+    if(f == ((history >> 16) & 0xffff) || f == (history >> 48)) {
+        _fp.decode(newY, y);
+
+        BigInteger px(x, N);
+        BigInteger py(y, N);
+        escapeCycle(px, py);
+
+        px.getWords(x, N);
+        py.getWords(y, N);
+        _fp.encode(x, newX);
+        _fp.encode(y, newY);
+
+        f = cycleFingerprint(x);
+    }
+
+    _history[i] = (history << 16) | f;
+
+    return true;
+}
+
+template<int N, class FP> void RhoCPU<N, FP>::doStepSingle()
+{
+    unsigned long px[N] = {0};
+    unsigned long py[N] = {0};
 
     // Copy onto stack
-    copyWords(_x, px, _pLen);
-    copyWords(_y, py, _pLen);
+    copyWords(_x, px, N);
+    copyWords(_y, py, N);
 
-    int idx = px[0] & _rPointMask;
+    int idx = *_rIdx;
 
-    unsigned long run[FP_MAX] = {0};
-    _fp->subModP(px, &_rx[idx * _pLen], run);
+    unsigned long run[N] = {0};
+    _fp.subModP(px, getRX(idx), run);
 
-    unsigned long runInv[FP_MAX] = {0};
-    _fp->inverseModP(run, runInv);
+    unsigned long runInv[N] = {0};
+    _fp.inverseModP(run, runInv);
 
     // Calculate (Py - Qy)/(Px - Qx)
-    unsigned long rise[FP_MAX] = {0};
-    _fp->subModP(py, &_ry[idx * _pLen], rise);
+    unsigned long rise[N] = {0};
+    _fp.subModP(py, getRY(idx), rise);
 
-    unsigned long s[FP_MAX] = {0};
+    unsigned long s[N] = {0};
     
-    _fp->multiplyModP(runInv, rise, s);
+    _fp.multiplyModP(runInv, rise, s);
 
     // calculate s^2
-    unsigned long s2[FP_MAX] = {0};
-    _fp->squareModP(s, s2);
+    unsigned long s2[N] = {0};
+    _fp.squareModP(s, s2);
 
     // Rx = s^2 - Px - Qx
-    unsigned long newX[FP_MAX] = {0};
+    unsigned long newX[N] = {0};
 
-    _fp->subModP(s2, px, newX);
-    _fp->subModP(newX, &_rx[ idx * _pLen], newX);
+    _fp.subModP(s2, px, newX);
+    _fp.subModP(newX, getRX(idx), newX);
 
     // Ry = s(Px - Rx) - Py
-    unsigned long k[FP_MAX] = {0};
-    _fp->subModP(px, newX, k);
+    unsigned long k[N] = {0};
+    _fp.subModP(px, newX, k);
    
-    _fp->multiplyModP(k, s, k);
-    unsigned long newY[FP_MAX] = {0};
-    _fp->subModP(k, py, newY);
+    _fp.multiplyModP(k, s, k);
+    unsigned long newY[N] = {0};
+    _fp.subModP(k, py, newY);
 
     // Increment walk length
     (*_lengthBuf)++;
+    _metrics->steps++;
 
-    bool isDistinguishedPoint = checkDistinguishedBits(newX);
+    // The distinguished bits and the next R point are taken from the canonical x
+    unsigned long x[N] = {0};
+    _fp.decode(newX, x);
+
+    bool isDistinguishedPoint = checkDistinguishedBits(x);
 
     bool isFruitlessCycle = false;
 
-    if ( *_lengthBuf >= (unsigned long long)1 << (_params.dBits + 2)) {
+    if ( *_lengthBuf >= _maxLength) {
         isFruitlessCycle = true;
     }
     
@@ -194,132 +508,129 @@ void RhoCPU::doStepSingle()
     if(isDistinguishedPoint || isFruitlessCycle) {
         
         if(isDistinguishedPoint) {
-            Logger::logInfo("Found distinguished point!\n");
+            Logger::logDebug("Found distinguished point!\n");
+            _metrics->points++;
             // Call callback function
             if(_callback != NULL) {
-                struct CallbackParameters cp;
-
-                cp.aStart = *_a;
-                cp.bStart = *_b;
-                cp.x = BigInteger(newX, _pLen);
-                cp.y = BigInteger(newY, _pLen);
-                cp.length = *_lengthBuf;
-
-                _callback(&cp);
+                reportPoint(0, x, newY);
             }
         } else {
-            Logger::logInfo("Possible cycle found (%lld iterations), rejecting\n", *_lengthBuf);
+            Logger::logDebug("Possible cycle found (%lld iterations), rejecting\n", *_lengthBuf);
+            _metrics->cycleDrops++;
         }
 
         // Generate new starting point
-        BigInteger aNew;
-        BigInteger bNew;
-        BigInteger xNew;
-        BigInteger yNew;
-
-        // Generate new starting point
-        generateStartingPoint(xNew, yNew, aNew, bNew);
-
-        // Copy new point to memory
-        xNew.getWords(_x, _pLen);
-        yNew.getWords(_y, _pLen);
-        *_a = aNew;
-        *_b = bNew;
+        restartWalk(0);
 
         *_lengthBuf = 1;
 
     } else {
         // Write result to memory
-        copyWords(newX, _x, _pLen);
-        copyWords(newY, _y, _pLen);
+        copyWords(newX, _x, N);
+        copyWords(newY, _y, N);
+        *_rIdx = x[0] & _rPointMask;
     }
 }
 
 
-void RhoCPU::doStepMulti()
+template<int N, class FP> void RhoCPU<N, FP>::doStepMulti()
 {
     unsigned long *chainBuf = _chainBuf;
     unsigned long *diffBuf = _diffBuf;
     unsigned long long *lengthBuf = _lengthBuf;
 
-    // Initialize to 1
-    unsigned long product[FP_MAX] = {0};
-    product[0] = 1;
+    _metrics->steps += _pointsInParallel;
+
+    // Product of the differences. Starts with the first difference so
+    // that it does not depend on the representation of 1
+    unsigned long product[N] = {0};
 
     for(unsigned int i = 0; i < _pointsInParallel; i++) {
-        unsigned int index = i * _pLen;
+        unsigned int index = i * N;
 
-        unsigned int idx = _x[ index ] & _rPointMask;
-        unsigned long diff[FP_MAX];
+        unsigned int idx = _rIdx[i];
+        unsigned long diff[N];
 
-        _fp->subModP(&_x[index], &_rx[idx * _pLen], diff);
-        copyWords(diff, &diffBuf[ index ], _pLen);
-        
-        _fp->multiplyModP(product, diff, product);
-        copyWords(product, &chainBuf[ index ], _pLen);
+        _fp.subModP(&_x[index], getRX(idx), diff);
+        copyWords(diff, &diffBuf[ index ], N);
+
+        if(i == 0) {
+            copyWords(diff, product, N);
+        } else {
+            _fp.multiplyModP(product, diff, product);
+        }
+        copyWords(product, &chainBuf[ index ], N);
     }
     
 
-    unsigned long inverse[FP_MAX];
-    _fp->inverseModP(product, inverse);
+    unsigned long inverse[N];
+    _fp.inverseModP(product, inverse);
 
     // Extract inverse of the differences
     for(int i = _pointsInParallel - 1; i >= 0; i--) {
-        int index = i * _pLen;
+        int index = i * N;
 
         // Get the inverse of the last difference by multiplying the inverse
         // of the product of all the differences with the product of all but
         // the last difference
-        unsigned long invDiff[FP_MAX];
+        unsigned long invDiff[N];
         
         if(i >= 1) {
-            _fp->multiplyModP(inverse, &chainBuf[(i - 1) * _pLen], invDiff);
-            _fp->multiplyModP(inverse, &diffBuf[ index ], inverse);
+            _fp.multiplyModP(inverse, &chainBuf[(i - 1) * N], invDiff);
+            _fp.multiplyModP(inverse, &diffBuf[ index ], inverse);
         } else {
-            copyWords(inverse, invDiff, _pLen);
+            copyWords(inverse, invDiff, N);
         }
         
 
-        unsigned int idx = _x[ index ] & _rPointMask;
+        unsigned int idx = _rIdx[i];
 
-        unsigned long px[FP_MAX];
-        unsigned long py[FP_MAX];
+        unsigned long px[N];
+        unsigned long py[N];
 
         // Copy onto stack
-        copyWords(&_x[ index ], px, _pLen);
-        copyWords(&_y[ index ], py, _pLen);
+        copyWords(&_x[ index ], px, N);
+        copyWords(&_y[ index ], py, N);
      
         // Calculate slope (Py - Qy)/(Px - Qx)
-        unsigned long rise[FP_MAX];
-        _fp->subModP(py, &_ry[ idx * _pLen], rise);
-        unsigned long s[FP_MAX];
-        _fp->multiplyModP(invDiff, rise, s);
+        unsigned long rise[N];
+        _fp.subModP(py, getRY(idx), rise);
+        unsigned long s[N];
+        _fp.multiplyModP(invDiff, rise, s);
 
         // calculate s^2
-        unsigned long s2[FP_MAX];
-        _fp->squareModP(s, s2);
+        unsigned long s2[N];
+        _fp.squareModP(s, s2);
 
         // Rx = s^2 - Px - Qx
-        unsigned long newX[FP_MAX];
-        _fp->subModP(s2, px, newX);
-        _fp->subModP(newX, &_rx[ idx * _pLen], newX);
+        unsigned long newX[N];
+        _fp.subModP(s2, px, newX);
+        _fp.subModP(newX, getRX(idx), newX);
 
         // Ry = s(Px - Rx) - Py
-        unsigned long k[FP_MAX];
-        _fp->subModP(px, newX, k);
+        unsigned long k[N];
+        _fp.subModP(px, newX, k);
    
-        _fp->multiplyModP(k, s, k);
-        unsigned long newY[FP_MAX];
-        _fp->subModP(k, py, newY);
+        _fp.multiplyModP(k, s, k);
+        unsigned long newY[N];
+        _fp.subModP(k, py, newY);
+
+        // The distinguished bits and the next R point are taken from the canonical x
+        unsigned long x[N];
+        _fp.decode(newX, x);
+
+        if(_params.negation && !negationStep(i, idx, x, newX, newY)) {
+            continue;
+        }
 
         // Increment walk length
         lengthBuf[i]++;
 
-        bool isDistinguishedPoint = checkDistinguishedBits(newX);
+        bool isDistinguishedPoint = checkDistinguishedBits(x);
 
         bool isFruitlessCycle = false;
 
-        if ( lengthBuf[i] >= (unsigned long long)1 << (_params.dBits + 2)) {
+        if ( lengthBuf[i] >= _maxLength) {
             isFruitlessCycle = true;
         }
         
@@ -327,50 +638,54 @@ void RhoCPU::doStepMulti()
         if(isDistinguishedPoint || isFruitlessCycle) {
             
             if(isDistinguishedPoint) {
+                _metrics->points++;
 
                 // Call callback function
                 if(_callback != NULL) {
-                    struct CallbackParameters cp;
-                    cp.aStart = _a[i];
-                    cp.bStart = _b[i];
-                    cp.x = BigInteger(newX, _pLen);
-                    cp.y = BigInteger(newY, _pLen);
-                    cp.length = lengthBuf[i];
-                    _callback(&cp);
+                    reportPoint(i, x, newY);
                 }
             } else {
                 //printf("Possible cycle found (%lld iterations), rejecting\n", lengthBuf[i]);
+                _metrics->cycleDrops++;
             }
 
             // Generate new starting point
-            BigInteger aNew;
-            BigInteger bNew;
-            BigInteger xNew;
-            BigInteger yNew;
-
-            // Generate new starting point
-            generateStartingPoint(xNew, yNew, aNew, bNew);
-
-            // Copy new point to memory
-            xNew.getWords(&_x[index], _pLen);
-            yNew.getWords(&_y[index], _pLen);
-            _a[i] = aNew;
-            _b[i] = bNew;
-            lengthBuf[i] = 0;
+            restartWalk(i);
+            lengthBuf[i] = 1;
             
         } else {
             // Write result to memory
-            copyWords(newX, &_x[ index ], _pLen);
-            copyWords(newY, &_y[ index ], _pLen);
+            copyWords(newX, &_x[ index ], N);
+            copyWords(newY, &_y[ index ], N);
+            _rIdx[i] = x[0] & _rPointMask;
         }
     }
 }
 
-void RhoCPU::doStep()
+template<int N, class FP> void RhoCPU<N, FP>::doStep()
 {
-    if(_pointsInParallel > 1) {
+    // The negation map is only implemented in the batched walk
+    if(_pointsInParallel > 1 || _params.negation) {
         doStepMulti();
     } else {
         doStepSingle();
     }
-}
\ No newline at end of file
+}
+
+template class RhoCPU<1>;
+template class RhoCPU<2>;
+template class RhoCPU<3>;
+template class RhoCPU<4>;
+template class RhoCPU<5>;
+template class RhoCPU<6>;
+template class RhoCPU<7>;
+template class RhoCPU<8>;
+
+template class RhoCPU<1, FpPseudoMersenne<1> >;
+template class RhoCPU<2, FpPseudoMersenne<2> >;
+template class RhoCPU<3, FpPseudoMersenne<3> >;
+template class RhoCPU<4, FpPseudoMersenne<4> >;
+template class RhoCPU<5, FpPseudoMersenne<5> >;
+template class RhoCPU<6, FpPseudoMersenne<6> >;
+template class RhoCPU<7, FpPseudoMersenne<7> >;
+template class RhoCPU<8, FpPseudoMersenne<8> >;
@@ -1,40 +1,117 @@
 #ifndef _RHO_CPU_H
 #define _RHO_CPU_H
 
+#include <stdint.h>
 #include "ecc.h"
-#include "Fp.h"
+#include "FpMontgomery.h"
+#include "FpPseudoMersenne.h"
 #include "ECDLContext.h"
+#include "StartingPointPool.h"
+#include "WalkCheckpoint.h"
+#include "Arena.h"
+#include "Metrics.h"
 
-//#define N 8
+// Largest modulus in words that RhoCPU is instantiated for
 #define FP_MAX 8
 
+// Words of a starting point coefficient for an n-word modulus. The order
+// of the curve can be longer than p
+#define COEFFICIENT_WORDS(n) ((n) + 1)
+
+// Longest fruitless cycle that is walked when escaping from it. The server
+// uses the same value when it walks the negation map
+#define NEGATION_CYCLE_MAX 16
+
 class RhoBase {
 
+protected:
+    // Low bits of x that are 0 in a distinguished point, and the length at
+    // which a walk is taken to be in a fruitless cycle and dropped
+    unsigned long _dBitsMask;
+    unsigned long long _maxLength;
+
 public:
+    RhoBase()
+    {
+        _dBitsMask = 0;
+        _maxLength = 0;
+    }
+
+    virtual ~RhoBase() {}
     virtual void doStep() = 0;
-};
 
+    /**
+     * Makes the walks stop at dBits distinguished bits from the next step
+     * on. The length limit follows, but is never lowered, so walks that are
+     * longer than the limit of fewer bits are not dropped. Must not run at
+     * the same time as doStep()
+     */
+    void setDistinguishedBits(unsigned int dBits)
+    {
+        _dBitsMask = ~0;
+        _dBitsMask >>= WORD_LENGTH_BITS - dBits;
+
+        unsigned long long maxLength = (unsigned long long)1 << (dBits + 2);
+        if(maxLength > _maxLength) {
+            _maxLength = maxLength;
+        }
+    }
+
+    /**
+     * Adds the state of every walk to the checkpoint. Must not run at the
+     * same time as doStep()
+     */
+    virtual void saveWalks(WalkCheckpoint &checkpoint) = 0;
+};
 
+/**
+ * Fingerprint of a canonical x used to detect fruitless cycles
+ */
+inline unsigned int cycleFingerprint(const unsigned long *x)
+{
+    return (unsigned int)(x[0] >> 16) & 0xffff;
+}
+
+/**
+ * Parallel rho walk for an N-word modulus. The field arithmetic FP is a
+ * concrete member so the calls in the inner loop are resolved and
+ * inlined at compile time. Moduli of a special form get their own
+ * instantiation with FpPseudoMersenne.
+ */
+template<int N, class FP = FpMontgomery<N> >
 class RhoCPU : public RhoBase {
 
 private:
 
-    ECPoint _g;
-    ECPoint _q;
     ECDLPParams _params;
     ECCurve _curve;
 
-    // Starting G and Q coefficients
-    BigInteger *_a;
-    BigInteger *_b;
+    // Source of new starting points, shared with the other threads
+    StartingPointPool *_pool;
+
+    // Memory of the walks. The arrays below are all in it
+    Arena _arena;
+
+    // Starting G and Q coefficients, COEFFICIENT_WORDS(N) words each
+    unsigned long *_a;
+    unsigned long *_b;
+
+    // Starting points, in the representation used by _fp. Offset restarts
+    // continue from them
+    unsigned long *_startX;
+    unsigned long *_startY;
 
-    // Current X and Y coordinates
+    // Current X and Y coordinates, in the representation used by _fp
     unsigned long *_x;
     unsigned long *_y;
 
-    // R points
-    unsigned long *_rx;
-    unsigned long *_ry;
+    // Index of the R point to add next to each walk. It is taken from the
+    // canonical x, which is not the same as _x when _fp uses Montgomery form
+    unsigned int *_rIdx;
+
+    // R points. Ry[i] follows Rx[i], so a step reads one or two cache lines
+    // of the table
+    unsigned long *_rTable;
 
     // Buffers for simultaneous inversion
     unsigned long *_diffBuf;
@@ -43,32 +120,72 @@ private:
     // Length of each walk
     unsigned long long *_lengthBuf;
 
+    // Fingerprints of the last four points of each walk, newest in the low
+    // 16 bits. Only used by the negation map
+    unsigned long long *_history;
+
+    // R points as curve points, for leaving fruitless cycles
+    ECPoint *_rPoints;
+
+    // T = tG + uQ and its coefficients, for offset restarts. _tx and _ty
+    // are in the representation used by _fp
+    bool _offsetRestarts;
+    unsigned long _tx[N];
+    unsigned long _ty[N];
+    unsigned long _tA[COEFFICIENT_WORDS(N)];
+    unsigned long _tB[COEFFICIENT_WORDS(N)];
+
+    // Order of the curve
+    unsigned long _n[COEFFICIENT_WORDS(N)];
+
     unsigned int _pointsInParallel;
     unsigned int _rPointMask;
-    unsigned long _dBitsMask;
-    unsigned int _pLen;
 
-    FpBase *_fp;
+    FP _fp;
 
     void (*_callback)(struct CallbackParameters *);
 
-    void generateStartingPoint(BigInteger &x, BigInteger &y, BigInteger &a, BigInteger &b);
+    MetricsCounters *_metrics;
+
+    void newWalk(int i);
+    bool resumeWalk(int i, WalkCheckpoint &checkpoint);
+    bool offsetWalk(int i);
+    void restartWalk(int i);
+    void setPoint(int i);
     bool checkDistinguishedBits(const unsigned long *x);
+    void reportPoint(int i, const unsigned long *x, const unsigned long *newY);
+
+    ECPoint mapPoint(ECPoint &p);
+    void escapeCycle(BigInteger &x, BigInteger &y);
+    bool negationStep(unsigned int i, unsigned int idx, unsigned long *x, unsigned long *newX, unsigned long *newY);
 
     void doStepSingle();
     void doStepMulti();
 
+    const unsigned long *getRX(unsigned int idx)
+    {
+        return &_rTable[idx * 2 * N];
+    }
+
+    const unsigned long *getRY(unsigned int idx)
+    {
+        return &_rTable[idx * 2 * N + N];
+    }
+
 public:
     RhoCPU(const ECDLPParams *params,
                     const BigInteger *rx,
                     const BigInteger *ry,
                     int numRPoints,
                     int numPoints,
-                    void (*callback)(struct CallbackParameters *)
+                    StartingPointPool *pool,
+                    void (*callback)(struct CallbackParameters *),
+                    WalkCheckpoint *checkpoint = NULL
                     );
     virtual ~RhoCPU();
 
     virtual void doStep();
+    virtual void saveWalks(WalkCheckpoint &checkpoint);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,602 @@
+#include "RhoIFMA.h"
+#include "logger.h"
+#include "Words.h"
+
+#ifdef FP_IFMA_SUPPORTED
+
+template<int L> IFMA_TARGET static inline void loadLimbs(const unsigned long long *src, __m512i *v)
+{
+    for(int j = 0; j < L; j++) {
+        v[j] = _mm512_loadu_si512(&src[j * IFMA_LANES]);
+    }
+}
+
+template<int L> IFMA_TARGET static inline void storeLimbs(const __m512i *v, unsigned long long *dest)
+{
+    for(int j = 0; j < L; j++) {
+        _mm512_storeu_si512(&dest[j * IFMA_LANES], v[j]);
+    }
+}
+
+/**
+ * Looks up the R point of each lane
+ */
+template<int L> IFMA_TARGET static inline void gatherLimbs(const unsigned long long *table, int tableSize, __m512i idx, __m512i *v)
+{
+    for(int j = 0; j < L; j++) {
+        v[j] = _mm512_i64gather_epi64(idx, (const void *)&table[j * tableSize], 8);
+    }
+}
+
+/**
+ * Sets lane of the [limb][lane] storage limbs to x, which is in the
+ * representation of the scalar arithmetic
+ */
+template<int N> void RhoIFMA<N>::encodeLane(const unsigned long *x, unsigned long long *limbs, int lane)
+{
+    unsigned long words[N];
+    unsigned long long laneLimbs[L];
+
+    _scalarFp.multiplyModP(x, _toLimbs, words);
+    toLimbs<L>(words, N, laneLimbs);
+
+    for(int j = 0; j < L; j++) {
+        limbs[j * IFMA_LANES + lane] = laneLimbs[j];
+    }
+}
+
+/**
+ * Gets the canonical value of a lane of [limb][lane] storage that is in the
+ * representation of _fp
+ */
+template<int N> void RhoIFMA<N>::decodeLane(const unsigned long long *limbs, int lane, unsigned long *x)
+{
+    unsigned long words[N];
+
+    getLane(limbs, lane, words);
+    _scalarFp.multiplyModP(words, _fromLimbs, x);
+}
+
+/**
+ * Gets the value of lane from [limb][lane] storage as words
+ */
+template<int N> void RhoIFMA<N>::getLane(const unsigned long long *limbs, int lane, unsigned long *x)
+{
+    unsigned long long laneLimbs[L];
+
+    for(int j = 0; j < L; j++) {
+        laneLimbs[j] = limbs[j * IFMA_LANES + lane];
+    }
+    fromLimbs<L>(laneLimbs, x, N);
+}
+
+/**
+ * Starts walk i at a new point from the pool
+ */
+template<int N> void RhoIFMA<N>::newWalk(int i)
+{
+    StartingPoint p;
+    _pool->get(p);
+
+    copyWords(p.a, &_a[i * COEFFICIENT_WORDS(N)], COEFFICIENT_WORDS(N));
+    copyWords(p.b, &_b[i * COEFFICIENT_WORDS(N)], COEFFICIENT_WORDS(N));
+
+    _scalarFp.encode(p.x, &_startX[i * N]);
+    _scalarFp.encode(p.y, &_startY[i * N]);
+}
+
+/**
+ * Continues walk i from a saved walk. Walks without their starting point
+ * cannot be offset, so they are skipped with offset restarts. Returns false
+ * when there are no saved walks left
+ */
+template<int N> bool RhoIFMA<N>::resumeWalk(int i, WalkCheckpoint &checkpoint)
+{
+    int offset = (i / IFMA_LANES) * L * IFMA_LANES;
+    int lane = i % IFMA_LANES;
+
+    WalkState w;
+    if(!checkpoint.take(w, _offsetRestarts)) {
+        return false;
+    }
+
+    w.a.getWords(&_a[i * COEFFICIENT_WORDS(N)], COEFFICIENT_WORDS(N));
+    w.b.getWords(&_b[i * COEFFICIENT_WORDS(N)], COEFFICIENT_WORDS(N));
+
+    unsigned long words[N];
+    unsigned long encoded[N];
+
+    w.startX.getWords(words, N);
+    _scalarFp.encode(words, &_startX[i * N]);
+    w.startY.getWords(words, N);
+    _scalarFp.encode(words, &_startY[i * N]);
+
+    w.y.getWords(words, N);
+    _scalarFp.encode(words, encoded);
+    encodeLane(encoded, &_y[offset], lane);
+
+    w.x.getWords(words, N);
+    _scalarFp.encode(words, encoded);
+    encodeLane(encoded, &_x[offset], lane);
+
+    _rIdx[i] = words[0] & _rPointMask;
+    _lengthBuf[i] = w.length;
+
+    return true;
+}
+
+/**
+ * Moves the starting point S of walk i to S + T, until it is a point with
+ * non-zero coefficients that is not distinguished. Tame kangaroos keep
+ * b = 0. Returns false if S is T or -T, which the addition does not handle
+ */
+template<int N> bool RhoIFMA<N>::offsetWalk(int i)
+{
+    unsigned long *sx = &_startX[i * N];
+    unsigned long *sy = &_startY[i * N];
+    unsigned long *a = &_a[i * COEFFICIENT_WORDS(N)];
+    unsigned long *b = &_b[i * COEFFICIENT_WORDS(N)];
+
+    unsigned long x[N];
+
+    do {
+        if(equalWords(sx, _tx, N)) {
+            return false;
+        }
+
+        // s = (Sy - Ty)/(Sx - Tx)
+        unsigned long run[N];
+        _scalarFp.subModP(sx, _tx, run);
+        _scalarFp.inverseModP(run, run);
+
+        unsigned long s[N];
+        _scalarFp.subModP(sy, _ty, s);
+        _scalarFp.multiplyModP(s, run, s);
+
+        // x = s^2 - Sx - Tx
+        unsigned long newX[N];
+        _scalarFp.squareModP(s, newX);
+        _scalarFp.subModP(newX, sx, newX);
+        _scalarFp.subModP(newX, _tx, newX);
+
+        // y = s(Sx - x) - Sy
+        unsigned long k[N];
+        _scalarFp.subModP(sx, newX, k);
+        _scalarFp.multiplyModP(k, s, k);
+        _scalarFp.subModP(k, sy, sy);
+
+        copyWords(newX, sx, N);
+
+        addModN(a, _tA, _n, COEFFICIENT_WORDS(N));
+        addModN(b, _tB, _n, COEFFICIENT_WORDS(N));
+
+        _scalarFp.decode(sx, x);
+    }while(isZero(a, COEFFICIENT_WORDS(N)) || (isZero(b, COEFFICIENT_WORDS(N)) && !_params.kangaroo) || (x[0] & _dBitsMask) == 0);
+
+    return true;
+}
+
+/**
+ * Moves walk i to its next starting point. In offset mode this is its old
+ * starting point plus T, otherwise a new point from the pool
+ */
+template<int N> void RhoIFMA<N>::restartWalk(int i)
+{
+    if(!_offsetRestarts || !offsetWalk(i)) {
+        newWalk(i);
+    }
+
+    setPoint(i);
+
+    _metrics->restarts++;
+}
+
+/**
+ * Sets the current point of walk i to its starting point
+ */
+template<int N> void RhoIFMA<N>::setPoint(int i)
+{
+    int offset = (i / IFMA_LANES) * L * IFMA_LANES;
+    int lane = i % IFMA_LANES;
+
+    encodeLane(&_startX[i * N], &_x[offset], lane);
+    encodeLane(&_startY[i * N], &_y[offset], lane);
+
+    unsigned long x[N];
+    _scalarFp.decode(&_startX[i * N], x);
+
+    _rIdx[i] = x[0] & _rPointMask;
+}
+
+template<int N> RhoIFMA<N>::RhoIFMA(const ECDLPParams *params,
+                        const BigInteger *rx,
+                        const BigInteger *ry,
+                        int numRPoints,
+                        int pointsInParallel,
+                        StartingPointPool *pool,
+                        void (*callback)(struct CallbackParameters *),
+                        WalkCheckpoint *checkpoint
+                        ) : _fp(params->p), _scalarFp(params->p)
+{
+    // Copy parameters
+    _params = *params;
+
+    _pool = pool;
+
+    _pointsInParallel = pointsInParallel;
+    _groups = pointsInParallel / IFMA_LANES;
+    _numRPoints = numRPoints;
+
+    // A product with _toLimbs turns 64-bit Montgomery form into 52-bit limb
+    // Montgomery form, and one with _fromLimbs turns the limb form into the
+    // canonical value
+    BigInteger limbR = BigInteger(2).pow(IFMA_LIMB_BITS * L) % _params.p;
+    BigInteger wordR = BigInteger(2).pow(WORD_LENGTH_BITS * N) % _params.p;
+
+    limbR.getWords(_toLimbs, N);
+    ((wordR * limbR.invm(_params.p)) % _params.p).getWords(_fromLimbs, N);
+
+    // The arrays used on every step come first, then the R points, then
+    // the starting points which are only used on restarts
+    size_t xOffset = _arena.reserve<unsigned long long>(pointsInParallel * L);
+    size_t yOffset = _arena.reserve<unsigned long long>(pointsInParallel * L);
+    size_t rIdxOffset = _arena.reserve<unsigned long long>(pointsInParallel);
+    size_t lengthOffset = _arena.reserve<unsigned long long>(pointsInParallel);
+    size_t diffOffset = _arena.reserve<unsigned long long>(pointsInParallel * L);
+    size_t chainOffset = _arena.reserve<unsigned long long>(pointsInParallel * L);
+    size_t rxOffset = _arena.reserve<unsigned long long>(numRPoints * L);
+    size_t ryOffset = _arena.reserve<unsigned long long>(numRPoints * L);
+    size_t startXOffset = _arena.reserve<unsigned long>(pointsInParallel * N);
+    size_t startYOffset = _arena.reserve<unsigned long>(pointsInParallel * N);
+    size_t aOffset = _arena.reserve<unsigned long>(pointsInParallel * COEFFICIENT_WORDS(N));
+    size_t bOffset = _arena.reserve<unsigned long>(pointsInParallel * COEFFICIENT_WORDS(N));
+
+    _arena.allocate();
+
+    _x = _arena.get<unsigned long long>(xOffset);
+    _y = _arena.get<unsigned long long>(yOffset);
+    _rIdx = _arena.get<unsigned long long>(rIdxOffset);
+    _lengthBuf = _arena.get<unsigned long long>(lengthOffset);
+    _diffBuf = _arena.get<unsigned long long>(diffOffset);
+    _chainBuf = _arena.get<unsigned long long>(chainOffset);
+    _rx = _arena.get<unsigned long long>(rxOffset);
+    _ry = _arena.get<unsigned long long>(ryOffset);
+    _startX = _arena.get<unsigned long>(startXOffset);
+    _startY = _arena.get<unsigned long>(startYOffset);
+    _a = _arena.get<unsigned long>(aOffset);
+    _b = _arena.get<unsigned long>(bOffset);
+
+    // Initialize length to 1 (starting point counts as 1 point)
+    for(int i = 0; i < pointsInParallel; i++) {
+        _lengthBuf[i] = 1;
+    }
+
+    // Copy R points. The table is indexed [limb][point], which is lane
+    // order with numRPoints lanes
+    for(int i = 0; i < numRPoints; i++) {
+        unsigned long words[N];
+        unsigned long long limbs[L];
+
+        rx[i].getWords(words, N);
+        _scalarFp.encode(words, words);
+        _scalarFp.multiplyModP(words, _toLimbs, words);
+        toLimbs<L>(words, N, limbs);
+        for(int j = 0; j < L; j++) {
+            _rx[j * numRPoints + i] = limbs[j];
+        }
+
+        ry[i].getWords(words, N);
+        _scalarFp.encode(words, words);
+        _scalarFp.multiplyModP(words, _toLimbs, words);
+        toLimbs<L>(words, N, limbs);
+        for(int j = 0; j < L; j++) {
+            _ry[j * numRPoints + i] = limbs[j];
+        }
+    }
+
+    _params.n.getWords(_n, COEFFICIENT_WORDS(N));
+
+    // Offset restarts add T to the starting points here rather than in the pool
+    StartingPoint t;
+    _offsetRestarts = _pool->getOffset(t);
+
+    if(_offsetRestarts) {
+        copyWords(t.a, _tA, COEFFICIENT_WORDS(N));
+        copyWords(t.b, _tB, COEFFICIENT_WORDS(N));
+
+        _scalarFp.encode(t.x, _tx);
+        _scalarFp.encode(t.y, _ty);
+    }
+
+    // Set mask for detecting distinguished points
+    setDistinguishedBits(params->dBits);
+
+    // Mask for selecting R point
+    _rPointMask = numRPoints - 1;
+
+    // Gets called when distinguished point is found
+    _callback = callback;
+
+    _metrics = Metrics::acquire();
+
+    // Continue the saved walks and start new ones for the rest
+    for(unsigned int i = 0; i < _pointsInParallel; i++) {
+        if(checkpoint == NULL || !resumeWalk(i, *checkpoint)) {
+            newWalk(i);
+            setPoint(i);
+        }
+    }
+}
+
+template<int N> void RhoIFMA<N>::saveWalks(WalkCheckpoint &checkpoint)
+{
+    for(unsigned int i = 0; i < _pointsInParallel; i++) {
+        int offset = (i / IFMA_LANES) * L * IFMA_LANES;
+        int lane = i % IFMA_LANES;
+        unsigned long words[N];
+
+        WalkState w;
+        w.a = BigInteger(&_a[i * COEFFICIENT_WORDS(N)], COEFFICIENT_WORDS(N));
+        w.b = BigInteger(&_b[i * COEFFICIENT_WORDS(N)], COEFFICIENT_WORDS(N));
+
+        _scalarFp.decode(&_startX[i * N], words);
+        w.startX = BigInteger(words, N);
+        _scalarFp.decode(&_startY[i * N], words);
+        w.startY = BigInteger(words, N);
+
+        decodeLane(&_x[offset], lane, words);
+        w.x = BigInteger(words, N);
+        decodeLane(&_y[offset], lane, words);
+        w.y = BigInteger(words, N);
+
+        w.length = _lengthBuf[i];
+
+        // The IFMA walk does not use the negation map
+        w.history = 0;
+        w.skipped = 0;
+
+        checkpoint.add(w);
+    }
+}
+
+template<int N> RhoIFMA<N>::~RhoIFMA()
+{
+    Metrics::release(_metrics);
+}
+
+/**
+ * Reports the distinguished points in a group, and restarts the walks that
+ * found one or ran too long. x and y are canonical, indexed [limb][lane]
+ */
+template<int N> void RhoIFMA<N>::endWalks(int group, unsigned int lanes, unsigned int dpLanes, const unsigned long long *x, const unsigned long long *y)
+{
+    for(int lane = 0; lane < IFMA_LANES; lane++) {
+        if(!(lanes & (1 << lane))) {
+            continue;
+        }
+
+        int i = group * IFMA_LANES + lane;
+
+        if(dpLanes & (1 << lane)) {
+            _metrics->points++;
+
+            if(_callback != NULL) {
+                unsigned long px[N];
+                unsigned long py[N];
+                getLane(x, lane, px);
+                getLane(y, lane, py);
+
+                struct CallbackParameters cp;
+
+                if(!setPointWords(cp.aStart, &_a[i * COEFFICIENT_WORDS(N)], COEFFICIENT_WORDS(N))
+                    || !setPointWords(cp.bStart, &_b[i * COEFFICIENT_WORDS(N)], COEFFICIENT_WORDS(N))
+                    || !setPointWords(cp.x, px, N)
+                    || !setPointWords(cp.y, py, N)) {
+                    Logger::logError("Distinguished point does not fit in %d bits", POINT_WORDS * 32);
+                } else {
+                    cp.length = _lengthBuf[i];
+                    _callback(&cp);
+                }
+            }
+        } else {
+            _metrics->cycleDrops++;
+        }
+
+        // Generate new starting point
+        restartWalk(i);
+        _lengthBuf[i] = 1;
+    }
+}
+
+/**
+ * Inverts each lane of v. The lanes are combined with the scalar arithmetic
+ * so that only one inversion is needed.
+ */
+template<int N> IFMA_TARGET void RhoIFMA<N>::invertLanes(__m512i *v)
+{
+    __m512i canonical[L];
+    unsigned long long limbs[L * IFMA_LANES];
+
+    _fp.decode(v, canonical);
+    storeLimbs<L>(canonical, limbs);
+
+    unsigned long values[IFMA_LANES][N];
+    unsigned long chain[IFMA_LANES][N];
+
+    for(int lane = 0; lane < IFMA_LANES; lane++) {
+        unsigned long long laneLimbs[L];
+        for(int j = 0; j < L; j++) {
+            laneLimbs[j] = limbs[j * IFMA_LANES + lane];
+        }
+        fromLimbs<L>(laneLimbs, values[lane], N);
+
+        _scalarFp.encode(values[lane], values[lane]);
+
+        if(lane == 0) {
+            memcpy(chain[0], values[0], sizeof(chain[0]));
+        } else {
+            _scalarFp.multiplyModP(chain[lane - 1], values[lane], chain[lane]);
+        }
+    }
+
+    unsigned long inverse[N];
+    _scalarFp.inverseModP(chain[IFMA_LANES - 1], inverse);
+
+    for(int lane = IFMA_LANES - 1; lane >= 0; lane--) {
+        unsigned long laneInverse[N];
+
+        if(lane >= 1) {
+            _scalarFp.multiplyModP(inverse, chain[lane - 1], laneInverse);
+            _scalarFp.multiplyModP(inverse, values[lane], inverse);
+        } else {
+            memcpy(laneInverse, inverse, sizeof(inverse));
+        }
+
+        _scalarFp.decode(laneInverse, laneInverse);
+
+        unsigned long long laneLimbs[L];
+        toLimbs<L>(laneInverse, N, laneLimbs);
+        for(int j = 0; j < L; j++) {
+            limbs[j * IFMA_LANES + lane] = laneLimbs[j];
+        }
+    }
+
+    loadLimbs<L>(limbs, v);
+    _fp.encode(v, v);
+}
+
+template<int N> IFMA_TARGET void RhoIFMA<N>::doStep()
+{
+    const __m512i rPointMask = _mm512_set1_epi64(_rPointMask);
+    const __m512i dBitsMask = _mm512_set1_epi64(_dBitsMask);
+    const __m512i maxLength = _mm512_set1_epi64(_maxLength);
+    const __m512i one = _mm512_set1_epi64(1);
+
+    const int stride = L * IFMA_LANES;
+
+    // Set by the first group. Zeroed only so the compiler sees it set
+    __m512i product[L] = {};
+
+    _metrics->steps += _pointsInParallel;
+
+    for(unsigned int g = 0; g < _groups; g++) {
+        __m512i x[L];
+        __m512i rx[L];
+        __m512i diff[L];
+
+        __m512i idx = _mm512_loadu_si512(&_rIdx[g * IFMA_LANES]);
+
+        loadLimbs<L>(&_x[g * stride], x);
+        gatherLimbs<L>(_rx, _numRPoints, idx, rx);
+
+        _fp.subModP(x, rx, diff);
+        storeLimbs<L>(diff, &_diffBuf[g * stride]);
+
+        if(g == 0) {
+            for(int j = 0; j < L; j++) {
+                product[j] = diff[j];
+            }
+        } else {
+            _fp.multiplyModP(product, diff, product);
+        }
+        storeLimbs<L>(product, &_chainBuf[g * stride]);
+    }
+
+    __m512i inverse[L];
+    for(int j = 0; j < L; j++) {
+        inverse[j] = product[j];
+    }
+    invertLanes(inverse);
+
+    for(int g = _groups - 1; g >= 0; g--) {
+        __m512i invDiff[L];
+
+        if(g >= 1) {
+            __m512i tmp[L];
+
+            loadLimbs<L>(&_chainBuf[(g - 1) * stride], tmp);
+            _fp.multiplyModP(inverse, tmp, invDiff);
+
+            loadLimbs<L>(&_diffBuf[g * stride], tmp);
+            _fp.multiplyModP(inverse, tmp, inverse);
+        } else {
+            for(int j = 0; j < L; j++) {
+                invDiff[j] = inverse[j];
+            }
+        }
+
+        __m512i idx = _mm512_loadu_si512(&_rIdx[g * IFMA_LANES]);
+
+        __m512i px[L];
+        __m512i py[L];
+        __m512i rx[L];
+        __m512i ry[L];
+
+        loadLimbs<L>(&_x[g * stride], px);
+        loadLimbs<L>(&_y[g * stride], py);
+        gatherLimbs<L>(_rx, _numRPoints, idx, rx);
+        gatherLimbs<L>(_ry, _numRPoints, idx, ry);
+
+        // Calculate slope (Py - Qy)/(Px - Qx)
+        __m512i rise[L];
+        __m512i s[L];
+        _fp.subModP(py, ry, rise);
+        _fp.multiplyModP(invDiff, rise, s);
+
+        // calculate s^2
+        __m512i s2[L];
+        _fp.squareModP(s, s2);
+
+        // Rx = s^2 - Px - Qx
+        __m512i newX[L];
+        _fp.subModP(s2, px, newX);
+        _fp.subModP(newX, rx, newX);
+
+        // Ry = s(Px - Rx) - Py
+        __m512i k[L];
+        __m512i newY[L];
+        _fp.subModP(px, newX, k);
+        _fp.multiplyModP(k, s, k);
+        _fp.subModP(k, py, newY);
+
+        storeLimbs<L>(newX, &_x[g * stride]);
+        storeLimbs<L>(newY, &_y[g * stride]);
+
+        // The distinguished bits and the next R point are taken from the canonical x
+        __m512i x[L];
+        _fp.decode(newX, x);
+
+        _mm512_storeu_si512(&_rIdx[g * IFMA_LANES], _mm512_and_si512(x[0], rPointMask));
+
+        // Increment walk length
+        __m512i length = _mm512_add_epi64(_mm512_loadu_si512(&_lengthBuf[g * IFMA_LANES]), one);
+        _mm512_storeu_si512(&_lengthBuf[g * IFMA_LANES], length);
+
+        __mmask8 dpLanes = _mm512_testn_epi64_mask(x[0], dBitsMask);
+        __mmask8 cycleLanes = _mm512_cmpge_epu64_mask(length, maxLength);
+
+        if(dpLanes | cycleLanes) {
+            unsigned long long xLimbs[L * IFMA_LANES];
+            unsigned long long yLimbs[L * IFMA_LANES];
+
+            __m512i y[L];
+            _fp.decode(newY, y);
+
+            storeLimbs<L>(x, xLimbs);
+            storeLimbs<L>(y, yLimbs);
+
+            endWalks(g, dpLanes | cycleLanes, dpLanes, xLimbs, yLimbs);
+        }
+    }
+}
+
+template class RhoIFMA<1>;
+template class RhoIFMA<2>;
+template class RhoIFMA<3>;
+template class RhoIFMA<4>;
+template class RhoIFMA<5>;
+template class RhoIFMA<6>;
+template class RhoIFMA<7>;
+template class RhoIFMA<8>;
+
+#endif
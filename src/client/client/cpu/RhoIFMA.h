@@ -0,0 +1,122 @@
+#ifndef _RHO_IFMA_H
+#define _RHO_IFMA_H
+
+#include "RhoCPU.h"
+#include "FpIFMA.h"
+
+#ifdef FP_IFMA_SUPPORTED
+
+/**
+ * Parallel rho walk that advances IFMA_LANES walks at once using AVX-512 IFMA.
+ * The walks are split into groups of IFMA_LANES and the coordinates are stored
+ * limb by limb, so one load gives the same limb of every walk in a group. The
+ * number of walks must be a multiple of IFMA_LANES.
+ *
+ * The state of the walks is kept in one arena as in RhoCPU, and walks are
+ * restarted with the scalar arithmetic on words
+ */
+template<int N>
+class RhoIFMA : public RhoBase {
+
+private:
+    enum { L = IFMA_LIMBS(N) };
+
+    ECDLPParams _params;
+
+    // Source of new starting points, shared with the other threads
+    StartingPointPool *_pool;
+
+    // Memory of the walks. The arrays below are all in it
+    Arena _arena;
+
+    // Starting G and Q coefficients, COEFFICIENT_WORDS(N) words each
+    unsigned long *_a;
+    unsigned long *_b;
+
+    // Starting points, N words each in the representation of _scalarFp.
+    // Offset restarts continue from them
+    unsigned long *_startX;
+    unsigned long *_startY;
+
+    // Current X and Y coordinates in Montgomery form, indexed [group][limb][lane]
+    unsigned long long *_x;
+    unsigned long long *_y;
+
+    // Index of the R point to add next to each walk, from the canonical x
+    unsigned long long *_rIdx;
+
+    // R points in Montgomery form, indexed [limb][point] so they can be gathered
+    unsigned long long *_rx;
+    unsigned long long *_ry;
+
+    // Buffers for simultaneous inversion
+    unsigned long long *_diffBuf;
+    unsigned long long *_chainBuf;
+
+    // Length of each walk
+    unsigned long long *_lengthBuf;
+
+    unsigned int _pointsInParallel;
+    unsigned int _groups;
+    unsigned int _numRPoints;
+    unsigned int _rPointMask;
+
+    // T = tG + uQ and its coefficients, for offset restarts. _tx and _ty
+    // are in the representation of _scalarFp
+    bool _offsetRestarts;
+    unsigned long _tx[N];
+    unsigned long _ty[N];
+    unsigned long _tA[COEFFICIENT_WORDS(N)];
+    unsigned long _tB[COEFFICIENT_WORDS(N)];
+
+    // Order of the curve
+    unsigned long _n[COEFFICIENT_WORDS(N)];
+
+    // R mod P of the limbs, and 2^(64N)/R mod P. A scalar multiplication by
+    // the first turns a value in the representation of _scalarFp into that
+    // of _fp, one by the second turns a value of _fp into its canonical form
+    unsigned long _toLimbs[N];
+    unsigned long _fromLimbs[N];
+
+    FpIFMA<L> _fp;
+
+    // Scalar arithmetic for combining the inversions of the lanes and for
+    // restarting walks
+    FpMontgomery<N> _scalarFp;
+
+    void (*_callback)(struct CallbackParameters *);
+
+    MetricsCounters *_metrics;
+
+    void encodeLane(const unsigned long *x, unsigned long long *limbs, int lane);
+    void decodeLane(const unsigned long long *limbs, int lane, unsigned long *x);
+    void getLane(const unsigned long long *limbs, int lane, unsigned long *x);
+
+    void newWalk(int i);
+    bool resumeWalk(int i, WalkCheckpoint &checkpoint);
+    bool offsetWalk(int i);
+    void restartWalk(int i);
+    void setPoint(int i);
+    void endWalks(int group, unsigned int lanes, unsigned int dpLanes, const unsigned long long *x, const unsigned long long *y);
+
+    IFMA_TARGET void invertLanes(__m512i *v);
+
+public:
+    RhoIFMA(const ECDLPParams *params,
+                    const BigInteger *rx,
+                    const BigInteger *ry,
+                    int numRPoints,
+                    int numPoints,
+                    StartingPointPool *pool,
+                    void (*callback)(struct CallbackParameters *),
+                    WalkCheckpoint *checkpoint = NULL
+                    );
+    virtual ~RhoIFMA();
+
+    IFMA_TARGET virtual void doStep();
+    virtual void saveWalks(WalkCheckpoint &checkpoint);
+};
+
+#endif
+
+#endif
@@ -0,0 +1,649 @@
+#include <vector>
+#include "WalkReplay.h"
+#include "RhoCPU.h"
+#include "Words.h"
+
+/**
+ * Replay for an N-word modulus, with the field arithmetic FP of the CPU
+ * walk
+ */
+template<int N, class FP = FpMontgomery<N> >
+class WalkReplayCPU : public WalkReplay {
+
+private:
+    typedef struct {
+        // Point in the representation used by _fp, and the canonical x
+        unsigned long x[N];
+        unsigned long y[N];
+        unsigned long cx[N];
+
+        unsigned long a[COEFFICIENT_WORDS(N)];
+        unsigned long b[COEFFICIENT_WORDS(N)];
+
+        // Fingerprints of the last four points, newest in the low 16 bits.
+        // Only used by the negation map
+        unsigned long long history;
+
+        // R point to add next, and how many were skipped on this step
+        unsigned int rIdx;
+        unsigned int skipped;
+
+        unsigned long long length;
+    }Walk;
+
+    ECDLPParams _params;
+    ECCurve _curve;
+    FP _fp;
+
+    // R points in the representation used by _fp, y following x, and
+    // their coefficients, COEFFICIENT_WORDS(N) words each
+    std::vector<unsigned long> _rTable;
+    std::vector<unsigned long> _rA;
+    std::vector<unsigned long> _rB;
+
+    // R points and coefficients as integers, for leaving fruitless cycles
+    std::vector<ECPoint> _rPoints;
+    std::vector<BigInteger> _rBigA;
+    std::vector<BigInteger> _rBigB;
+
+    // Order of the curve
+    unsigned long _n[COEFFICIENT_WORDS(N)];
+
+    unsigned int _rPointMask;
+
+    const unsigned long *getRX(unsigned int idx)
+    {
+        return &_rTable[idx * 2 * N];
+    }
+
+    const unsigned long *getRY(unsigned int idx)
+    {
+        return &_rTable[idx * 2 * N + N];
+    }
+
+    void startWalk(Walk &w, const BigInteger &a, const BigInteger &b);
+    bool atPoint(const Walk &w, const unsigned long *x, const unsigned long *y);
+    ReplayPoint getPoint(const Walk &w);
+
+    bool addRPoint(Walk &w, const unsigned long *inverse);
+    void negationStep(Walk &w);
+    void mapPoint(ECPoint &p, BigInteger &a, BigInteger &b);
+    void escapeCycle(Walk &w);
+    void step(Walk **walks, int count);
+
+    const Walk *findRecent(const std::vector<Walk> &recent, unsigned long long count, const unsigned long *x);
+
+public:
+    WalkReplayCPU(const ECDLPParams &params,
+                  const BigInteger *rx,
+                  const BigInteger *ry,
+                  const BigInteger *ra,
+                  const BigInteger *rb,
+                  int numRPoints);
+
+    virtual ReplayResult findCollision(const BigInteger &a1, const BigInteger &b1,
+                                       const BigInteger &a2, const BigInteger &b2,
+                                       const BigInteger &endX, const BigInteger &endY,
+                                       unsigned long long maxLength);
+
+    virtual bool reaches(const BigInteger &a, const BigInteger &b,
+                         const BigInteger &x, const BigInteger &y,
+                         unsigned long long maxLength);
+};
+
+template<int N, class FP> WalkReplayCPU<N, FP>::WalkReplayCPU(const ECDLPParams &params,
+                        const BigInteger *rx,
+                        const BigInteger *ry,
+                        const BigInteger *ra,
+                        const BigInteger *rb,
+                        int numRPoints) : _fp(params.p)
+{
+    _params = params;
+    _curve = ECCurve(_params.p, _params.n, _params.a, _params.b, _params.gx, _params.gy);
+
+    _rTable.resize(numRPoints * 2 * N);
+    _rA.resize(numRPoints * COEFFICIENT_WORDS(N));
+    _rB.resize(numRPoints * COEFFICIENT_WORDS(N));
+
+    for(int i = 0; i < numRPoints; i++) {
+        unsigned long *r = &_rTable[i * 2 * N];
+        rx[i].getWords(r, N);
+        ry[i].getWords(r + N, N);
+
+        _fp.encode(r, r);
+        _fp.encode(r + N, r + N);
+
+        BigInteger a = ra[i] % _params.n;
+        BigInteger b = rb[i] % _params.n;
+
+        a.getWords(&_rA[i * COEFFICIENT_WORDS(N)], COEFFICIENT_WORDS(N));
+        b.getWords(&_rB[i * COEFFICIENT_WORDS(N)], COEFFICIENT_WORDS(N));
+
+        _rPoints.push_back(ECPoint(rx[i], ry[i]));
+        _rBigA.push_back(a);
+        _rBigB.push_back(b);
+    }
+
+    _params.n.getWords(_n, COEFFICIENT_WORDS(N));
+
+    _rPointMask = numRPoints - 1;
+}
+
+/**
+ * Starts w at aG + bQ. With the negation map it starts at the class of that
+ * point, since clients may report a starting point that is not canonical
+ */
+template<int N, class FP> void WalkReplayCPU<N, FP>::startWalk(Walk &w, const BigInteger &a, const BigInteger &b)
+{
+    BigInteger ka = a % _params.n;
+    BigInteger kb = b % _params.n;
+
+    ECPoint g(_params.gx, _params.gy);
+    ECPoint q(_params.qx, _params.qy);
+
+    ECPoint aG = _curve.multiply(ka, g);
+    ECPoint bQ = _curve.multiply(kb, q);
+    ECPoint p = _curve.add(aG, bQ);
+
+    unsigned long y[N];
+    p.x.getWords(w.cx, N);
+    p.y.getWords(y, N);
+    ka.getWords(w.a, COEFFICIENT_WORDS(N));
+    kb.getWords(w.b, COEFFICIENT_WORDS(N));
+
+    _fp.encode(w.cx, w.x);
+    _fp.encode(y, w.y);
+
+    if(_params.negation && p.y.lsb()) {
+        unsigned long zero[N] = {0};
+        _fp.subModP(zero, w.y, w.y);
+
+        negateModN(w.a, _n, COEFFICIENT_WORDS(N));
+        negateModN(w.b, _n, COEFFICIENT_WORDS(N));
+    }
+
+    w.history = cycleFingerprint(w.cx);
+    w.rIdx = w.cx[0] & _rPointMask;
+    w.skipped = 0;
+    w.length = 0;
+}
+
+/**
+ * True when w is at the point x, y. Both are canonical
+ */
+template<int N, class FP> bool WalkReplayCPU<N, FP>::atPoint(const Walk &w, const unsigned long *x, const unsigned long *y)
+{
+    if(!equalWords(w.cx, x, N)) {
+        return false;
+    }
+
+    unsigned long wy[N];
+    _fp.decode(w.y, wy);
+
+    return equalWords(wy, y, N);
+}
+
+template<int N, class FP> ReplayPoint WalkReplayCPU<N, FP>::getPoint(const Walk &w)
+{
+    unsigned long y[N];
+    _fp.decode(w.y, y);
+
+    ReplayPoint p;
+    p.a = BigInteger(w.a, COEFFICIENT_WORDS(N));
+    p.b = BigInteger(w.b, COEFFICIENT_WORDS(N));
+    p.x = BigInteger(w.cx, N);
+    p.y = BigInteger(y, N);
+
+    return p;
+}
+
+/**
+ * Adds R point w.rIdx to w, given the inverse of the difference of their x.
+ * Returns false when the negation map skips the R point, in which case the
+ * walk stays on its current point and tries the next one
+ */
+template<int N, class FP> bool WalkReplayCPU<N, FP>::addRPoint(Walk &w, const unsigned long *inverse)
+{
+    unsigned int idx = w.rIdx;
+
+    // s = (Py - Ry)/(Px - Rx)
+    unsigned long rise[N];
+    _fp.subModP(w.y, getRY(idx), rise);
+
+    unsigned long s[N];
+    _fp.multiplyModP(inverse, rise, s);
+
+    unsigned long s2[N];
+    _fp.squareModP(s, s2);
+
+    // x = s^2 - Px - Rx
+    unsigned long newX[N];
+    _fp.subModP(s2, w.x, newX);
+    _fp.subModP(newX, getRX(idx), newX);
+
+    // y = s(Px - x) - Py
+    unsigned long k[N];
+    _fp.subModP(w.x, newX, k);
+    _fp.multiplyModP(k, s, k);
+
+    unsigned long newY[N];
+    _fp.subModP(k, w.y, newY);
+
+    unsigned long x[N];
+    _fp.decode(newX, x);
+
+    // Landing on the same R point again is how most fruitless 2-cycles
+    // start. The last R point is taken when every one was skipped
+    if(_params.negation && (x[0] & _rPointMask) == idx && w.skipped < _rPointMask) {
+        w.rIdx = (idx + 1) & _rPointMask;
+        w.skipped++;
+        return false;
+    }
+
+    copyWords(newX, w.x, N);
+    copyWords(newY, w.y, N);
+    copyWords(x, w.cx, N);
+
+    addModN(w.a, &_rA[idx * COEFFICIENT_WORDS(N)], _n, COEFFICIENT_WORDS(N));
+    addModN(w.b, &_rB[idx * COEFFICIENT_WORDS(N)], _n, COEFFICIENT_WORDS(N));
+
+    if(_params.negation) {
+        negationStep(w);
+    }
+
+    w.rIdx = w.cx[0] & _rPointMask;
+    w.skipped = 0;
+    w.length++;
+
+    return true;
+}
+
+/**
+ * Moves w to the point of its class with an even y, and out of the
+ * fruitless cycle it is in
+ */
+template<int N, class FP> void WalkReplayCPU<N, FP>::negationStep(Walk &w)
+{
+    unsigned long y[N];
+    _fp.decode(w.y, y);
+
+    if(y[0] & 1) {
+        unsigned long zero[N] = {0};
+        _fp.subModP(zero, w.y, w.y);
+
+        negateModN(w.a, _n, COEFFICIENT_WORDS(N));
+        negateModN(w.b, _n, COEFFICIENT_WORDS(N));
+    }
+
+    // Same point as 2 or 4 steps ago means the walk is in a fruitless cycle
+    unsigned int f = cycleFingerprint(w.cx);
+
+    if(f == ((w.history >> 16) & 0xffff) || f == (w.history >> 48)) {
+        escapeCycle(w);
+        f = cycleFingerprint(w.cx);
+    }
+
+    w.history = (w.history << 16) | f;
+}
+
+/**
+ * The negation map iteration on curve points, with the coefficients. Used
+ * outside the inner loop only
+ */
+template<int N, class FP> void WalkReplayCPU<N, FP>::mapPoint(ECPoint &p, BigInteger &a, BigInteger &b)
+{
+    unsigned long buf[N];
+
+    p.x.getWords(buf, N);
+    unsigned int idx = buf[0] & _rPointMask;
+
+    ECPoint r;
+    BigInteger ra;
+    BigInteger rb;
+
+    for(unsigned int i = 0; i <= _rPointMask; i++) {
+        unsigned int j = (idx + i) & _rPointMask;
+
+        r = _curve.add(p, _rPoints[j]);
+        ra = (a + _rBigA[j]) % _params.n;
+        rb = (b + _rBigB[j]) % _params.n;
+
+        if(r.y.lsb()) {
+            r.y = _params.p - r.y;
+            ra = (_params.n - ra) % _params.n;
+            rb = (_params.n - rb) % _params.n;
+        }
+
+        r.x.getWords(buf, N);
+        if((buf[0] & _rPointMask) != j) {
+            break;
+        }
+    }
+
+    p = r;
+    a = ra;
+    b = rb;
+}
+
+/**
+ * Leaves the fruitless cycle w is in the same way as the client: the cycle
+ * is walked once and the point with the smallest x is doubled
+ */
+template<int N, class FP> void WalkReplayCPU<N, FP>::escapeCycle(Walk &w)
+{
+    unsigned long y[N];
+    _fp.decode(w.y, y);
+
+    BigInteger startX(w.cx, N);
+
+    ECPoint p(startX, BigInteger(y, N));
+    BigInteger a(w.a, COEFFICIENT_WORDS(N));
+    BigInteger b(w.b, COEFFICIENT_WORDS(N));
+
+    ECPoint min = p;
+    BigInteger minA = a;
+    BigInteger minB = b;
+
+    for(int i = 0; i < NEGATION_CYCLE_MAX; i++) {
+        mapPoint(p, a, b);
+
+        if(p.x == startX) {
+            break;
+        }
+
+        if(p.x < min.x) {
+            min = p;
+            minA = a;
+            minB = b;
+        }
+    }
+
+    p = _curve.doubl(min);
+    a = (minA + minA) % _params.n;
+    b = (minB + minB) % _params.n;
+
+    if(p.y.lsb()) {
+        p.y = _params.p - p.y;
+        a = (_params.n - a) % _params.n;
+        b = (_params.n - b) % _params.n;
+    }
+
+    p.x.getWords(w.cx, N);
+    p.y.getWords(y, N);
+    a.getWords(w.a, COEFFICIENT_WORDS(N));
+    b.getWords(w.b, COEFFICIENT_WORDS(N));
+
+    _fp.encode(w.cx, w.x);
+    _fp.encode(y, w.y);
+}
+
+/**
+ * Takes one step of each of the count walks, at most 2. The walks share one
+ * inversion, and an R point skipped by one of them costs another inversion
+ * for that walk only
+ */
+template<int N, class FP> void WalkReplayCPU<N, FP>::step(Walk **walks, int count)
+{
+    Walk *pending[2];
+
+    for(int i = 0; i < count; i++) {
+        pending[i] = walks[i];
+    }
+
+    while(count > 0) {
+        unsigned long diff[2][N];
+        unsigned long inverse[2][N];
+
+        for(int i = 0; i < count; i++) {
+            _fp.subModP(pending[i]->x, getRX(pending[i]->rIdx), diff[i]);
+        }
+
+        if(count == 2) {
+            unsigned long product[N];
+            unsigned long productInverse[N];
+
+            _fp.multiplyModP(diff[0], diff[1], product);
+            _fp.inverseModP(product, productInverse);
+
+            _fp.multiplyModP(productInverse, diff[1], inverse[0]);
+            _fp.multiplyModP(productInverse, diff[0], inverse[1]);
+        } else {
+            _fp.inverseModP(diff[0], inverse[0]);
+        }
+
+        int remaining = 0;
+        for(int i = 0; i < count; i++) {
+            if(!addRPoint(*pending[i], inverse[i])) {
+                pending[remaining++] = pending[i];
+            }
+        }
+
+        count = remaining;
+    }
+}
+
+/**
+ * The newest of the recent points with canonical x, or NULL. count points
+ * were added to recent so far
+ */
+template<int N, class FP> const typename WalkReplayCPU<N, FP>::Walk *WalkReplayCPU<N, FP>::findRecent(const std::vector<Walk> &recent, unsigned long long count, const unsigned long *x)
+{
+    unsigned long long size = count < REPLAY_WINDOW ? count : REPLAY_WINDOW;
+
+    for(unsigned long long i = 1; i <= size; i++) {
+        const Walk &w = recent[(count - i) % REPLAY_WINDOW];
+
+        if(w.cx[0] == x[0] && equalWords(w.cx, x, N)) {
+            return &w;
+        }
+    }
+
+    return NULL;
+}
+
+template<int N, class FP> ReplayResult WalkReplayCPU<N, FP>::findCollision(const BigInteger &a1, const BigInteger &b1,
+                        const BigInteger &a2, const BigInteger &b2,
+                        const BigInteger &endX, const BigInteger &endY,
+                        unsigned long long maxLength)
+{
+    ReplayResult result;
+    result.status = REPLAY_NO_COLLISION;
+    result.length1 = 0;
+    result.length2 = 0;
+
+    unsigned long ex[N];
+    unsigned long ey[N];
+    endX.getWords(ex, N);
+    endY.getWords(ey, N);
+
+    Walk w[2];
+    startWalk(w[0], a1, b1);
+    startWalk(w[1], a2, b2);
+
+    Walk start[2] = {w[0], w[1]};
+
+    unsigned long startY[2][N];
+    _fp.decode(start[0].y, startY[0]);
+    _fp.decode(start[1].y, startY[1]);
+
+    // Step both walks to the end point for their lengths. A walk that runs
+    // through the start of the other makes the collision a Robin Hood
+    bool passed[2];
+    bool done[2];
+
+    for(int i = 0; i < 2; i++) {
+        passed[i] = atPoint(w[i], start[1 - i].cx, startY[1 - i]);
+        done[i] = atPoint(w[i], ex, ey);
+    }
+
+    while(!done[0] || !done[1]) {
+        Walk *active[2];
+        int count = 0;
+
+        for(int i = 0; i < 2; i++) {
+            if(!done[i]) {
+                active[count++] = &w[i];
+            }
+        }
+
+        step(active, count);
+
+        for(int i = 0; i < 2; i++) {
+            if(done[i]) {
+                continue;
+            }
+
+            if(w[i].length > maxLength) {
+                result.status = REPLAY_TOO_LONG;
+                result.length1 = w[0].length;
+                result.length2 = w[1].length;
+                return result;
+            }
+
+            if(atPoint(w[i], start[1 - i].cx, startY[1 - i])) {
+                passed[i] = true;
+            }
+
+            done[i] = atPoint(w[i], ex, ey);
+        }
+    }
+
+    result.length1 = w[0].length;
+    result.length2 = w[1].length;
+
+    int longer = w[0].length >= w[1].length ? 0 : 1;
+
+    if(passed[longer]) {
+        result.status = REPLAY_ROBIN_HOOD;
+        return result;
+    }
+
+    // Advance the longer walk so that both are the same number of steps
+    // from the end
+    unsigned long long diff = w[longer].length - w[1 - longer].length;
+
+    w[0] = start[0];
+    w[1] = start[1];
+
+    Walk *longerWalk = &w[longer];
+
+    for(unsigned long long i = 0; i < diff; i++) {
+        step(&longerWalk, 1);
+    }
+
+    // Two walks that fall into the same fruitless cycle at different times
+    // can leave it a few steps out of step with each other, so the recent
+    // points of both walks are checked as well
+    std::vector<Walk> recent[2];
+    recent[0].resize(REPLAY_WINDOW);
+    recent[1].resize(REPLAY_WINDOW);
+
+    Walk *both[2] = {&w[0], &w[1]};
+
+    for(unsigned long long count = 0; ; count++) {
+
+        if(atPoint(w[0], ex, ey) || atPoint(w[1], ex, ey)) {
+            return result;
+        }
+
+        step(both, 2);
+
+        const Walk *match1 = NULL;
+        const Walk *match2 = NULL;
+
+        if(equalWords(w[0].cx, w[1].cx, N)) {
+            match1 = &w[0];
+            match2 = &w[1];
+        } else if((match2 = findRecent(recent[1], count, w[0].cx)) != NULL) {
+            match1 = &w[0];
+        } else if((match1 = findRecent(recent[0], count, w[1].cx)) != NULL) {
+            match2 = &w[1];
+        }
+
+        if(match1 != NULL && match2 != NULL) {
+            result.status = REPLAY_COLLISION;
+            result.p1 = getPoint(*match1);
+            result.p2 = getPoint(*match2);
+            return result;
+        }
+
+        recent[0][count % REPLAY_WINDOW] = w[0];
+        recent[1][count % REPLAY_WINDOW] = w[1];
+    }
+}
+
+/**
+ * True when the walk from aG + bQ reaches the point x, y within maxLength
+ * steps. Used to check the points clients report
+ */
+template<int N, class FP> bool WalkReplayCPU<N, FP>::reaches(const BigInteger &a, const BigInteger &b,
+                        const BigInteger &x, const BigInteger &y,
+                        unsigned long long maxLength)
+{
+    unsigned long px[N];
+    unsigned long py[N];
+    x.getWords(px, N);
+    y.getWords(py, N);
+
+    Walk w;
+    startWalk(w, a, b);
+
+    Walk *walk = &w;
+
+    while(!atPoint(w, px, py)) {
+        if(w.length > maxLength) {
+            return false;
+        }
+
+        step(&walk, 1);
+    }
+
+    return true;
+}
+
+/**
+ * Replay for an N-word modulus, with the pseudo-Mersenne reduction when the
+ * modulus has that form
+ */
+template<int N> static WalkReplay *newWalkReplayN(const ECDLPParams &params,
+                                                  const BigInteger *rx,
+                                                  const BigInteger *ry,
+                                                  const BigInteger *ra,
+                                                  const BigInteger *rb,
+                                                  int numRPoints)
+{
+    if(isPseudoMersenne(params.p)) {
+        return new WalkReplayCPU<N, FpPseudoMersenne<N> >(params, rx, ry, ra, rb, numRPoints);
+    }
+
+    return new WalkReplayCPU<N>(params, rx, ry, ra, rb, numRPoints);
+}
+
+WalkReplay *newWalkReplay(const ECDLPParams &params,
+                          const BigInteger *rx,
+                          const BigInteger *ry,
+                          const BigInteger *ra,
+                          const BigInteger *rb,
+                          int numRPoints)
+{
+    switch(params.p.getWordLength()) {
+        case 1:
+            return newWalkReplayN<1>(params, rx, ry, ra, rb, numRPoints);
+        case 2:
+            return newWalkReplayN<2>(params, rx, ry, ra, rb, numRPoints);
+        case 3:
+            return newWalkReplayN<3>(params, rx, ry, ra, rb, numRPoints);
+        case 4:
+            return newWalkReplayN<4>(params, rx, ry, ra, rb, numRPoints);
+        case 5:
+            return newWalkReplayN<5>(params, rx, ry, ra, rb, numRPoints);
+        case 6:
+            return newWalkReplayN<6>(params, rx, ry, ra, rb, numRPoints);
+        case 7:
+            return newWalkReplayN<7>(params, rx, ry, ra, rb, numRPoints);
+        case 8:
+            return newWalkReplayN<8>(params, rx, ry, ra, rb, numRPoints);
+    }
+
+    throw std::string("Compile for larger integers");
+}
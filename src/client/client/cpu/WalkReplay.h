@@ -0,0 +1,76 @@
+#ifndef _WALK_REPLAY_H
+#define _WALK_REPLAY_H
+
+#include "BigInteger.h"
+#include "ECDLPParams.h"
+
+// Points of each walk kept while looking for the collision. The server uses
+// the same number
+#define REPLAY_WINDOW 64
+
+// Outcomes of a replay
+#define REPLAY_COLLISION 0
+#define REPLAY_ROBIN_HOOD 1
+#define REPLAY_NO_COLLISION 2
+#define REPLAY_TOO_LONG 3
+
+/**
+ * A point of a walk and its coefficients, point = aG + bQ
+ */
+typedef struct {
+    BigInteger a;
+    BigInteger b;
+    BigInteger x;
+    BigInteger y;
+}ReplayPoint;
+
+typedef struct {
+    int status;
+
+    // Steps of each walk from its starting point to the end point
+    unsigned long long length1;
+    unsigned long long length2;
+
+    // The colliding points of walk 1 and walk 2, with REPLAY_COLLISION.
+    // They have the same x, and the same y or opposite ones
+    ReplayPoint p1;
+    ReplayPoint p2;
+}ReplayResult;
+
+/**
+ * Walks two starting points that reached the same distinguished point again
+ * to find where they met. The walks step the same way as the server's
+ * RhoSolver and the CPU client, negation map included, with the field
+ * arithmetic of RhoCPU.
+ *
+ * Both walks are first stepped to the end point to get their lengths, and
+ * to see if one runs through the start of the other. Then the longer one
+ * is advanced by the difference and both are stepped in lockstep until
+ * they meet. Walks stepped together share one inversion.
+ *
+ * A single walk can also be replayed, to check that it reaches the point a
+ * client reported
+ */
+class WalkReplay {
+
+public:
+    virtual ~WalkReplay() {}
+
+    virtual ReplayResult findCollision(const BigInteger &a1, const BigInteger &b1,
+                                       const BigInteger &a2, const BigInteger &b2,
+                                       const BigInteger &endX, const BigInteger &endY,
+                                       unsigned long long maxLength) = 0;
+
+    virtual bool reaches(const BigInteger &a, const BigInteger &b,
+                         const BigInteger &x, const BigInteger &y,
+                         unsigned long long maxLength) = 0;
+};
+
+WalkReplay *newWalkReplay(const ECDLPParams &params,
+                          const BigInteger *rx,
+                          const BigInteger *ry,
+                          const BigInteger *ra,
+                          const BigInteger *rb,
+                          int numRPoints);
+
+#endif
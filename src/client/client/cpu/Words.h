@@ -0,0 +1,90 @@
+#ifndef _WORDS_H
+#define _WORDS_H
+
+#include <string.h>
+
+/**
+ * Operations on numbers of n words, least significant first, used by the
+ * walks outside of the field arithmetic: copying points and keeping the
+ * coefficients of a walk mod the order of the curve
+ */
+
+inline void copyWords(const unsigned long *src, unsigned long *dest, int n)
+{
+    memcpy(dest, src, sizeof(unsigned long) * n);
+}
+
+inline bool equalWords(const unsigned long *a, const unsigned long *b, int n)
+{
+    return memcmp(a, b, sizeof(unsigned long) * n) == 0;
+}
+
+inline bool isZero(const unsigned long *a, int n)
+{
+    for(int i = 0; i < n; i++) {
+        if(a[i] != 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * a = (a + b) mod n for a, b < n. n is at least one bit shorter than len
+ * words, so the sum does not carry out. b may be a
+ */
+inline void addModN(unsigned long *a, const unsigned long *b, const unsigned long *n, int len)
+{
+    unsigned long carry = 0;
+
+    for(int i = 0; i < len; i++) {
+        unsigned long sum = a[i] + carry;
+        carry = sum < carry;
+
+        a[i] = sum + b[i];
+        carry += a[i] < sum;
+    }
+
+    // Leave a if it is less than n
+    for(int i = len - 1; i >= 0; i--) {
+        if(a[i] != n[i]) {
+            if(a[i] < n[i]) {
+                return;
+            }
+            break;
+        }
+    }
+
+    unsigned long borrow = 0;
+
+    for(int i = 0; i < len; i++) {
+        unsigned long diff = a[i] - n[i];
+        unsigned long nextBorrow = a[i] < n[i];
+
+        a[i] = diff - borrow;
+        borrow = nextBorrow | (diff < borrow);
+    }
+}
+
+/**
+ * a = -a mod n for a < n
+ */
+inline void negateModN(unsigned long *a, const unsigned long *n, int len)
+{
+    if(isZero(a, len)) {
+        return;
+    }
+
+    unsigned long borrow = 0;
+
+    for(int i = 0; i < len; i++) {
+        unsigned long diff = n[i] - a[i];
+        unsigned long nextBorrow = n[i] < a[i];
+
+        a[i] = diff - borrow;
+        borrow = nextBorrow | (diff < borrow);
+    }
+}
+
+#endif
@@ -3,6 +3,8 @@
 #include "BigInteger.h"
 
 #include "Fp.h"
+#include "FpMontgomery.h"
+#include "FpPseudoMersenne.h"
 
 /**
  * Prints a big integer in hex format to stdout
@@ -19,27 +21,61 @@ void printInt(const unsigned long *x, int len)
     printf("\n");
 }
 
-FpBase *getFp(BigInteger &p)
+/**
+ * Returns true if p = 2^k - c with c < 2^(k/2 - 1), which FpPseudoMersenne
+ * reduces with two folds
+ */
+bool isPseudoMersenne(const BigInteger &p)
+{
+    int k = (int)p.getBitLength();
+
+    if(k < 4) {
+        return false;
+    }
+
+    BigInteger c = BigInteger(2).pow(k) - p;
+
+    return (int)c.getBitLength() <= k / 2 - 1;
+}
+
+template<int N> static FpBase *newFp(BigInteger &p, int type)
+{
+    if(type == FP_AUTO || type == FP_PSEUDO_MERSENNE) {
+        if(isPseudoMersenne(p)) {
+            return new FpPseudoMersenne<N>(p);
+        }
+        type = FP_MONTGOMERY;
+    }
+
+    // Montgomery reduction requires an odd modulus
+    if(type == FP_MONTGOMERY && p.lsb()) {
+        return new FpMontgomery<N>(p);
+    }
+
+    return new Fp<N>(p);
+}
+
+FpBase *getFp(BigInteger &p, int type)
 {
     int pLen = p.getWordLength();
 
     switch(pLen) {
         case 1:
-        return new Fp<1>(p);
+        return newFp<1>(p, type);
         case 2:
-        return new Fp<2>(p);
+        return newFp<2>(p, type);
         case 3:
-        return new Fp<3>(p);
+        return newFp<3>(p, type);
         case 4:
-        return new Fp<4>(p);
+        return newFp<4>(p, type);
         case 5:
-        return new Fp<5>(p);
+        return newFp<5>(p, type);
         case 6:
-        return new Fp<6>(p);
+        return newFp<6>(p, type);
         case 7:
-        return new Fp<7>(p);
+        return newFp<7>(p, type);
         case 8:
-        return new Fp<8>(p);
+        return newFp<8>(p, type);
     }
 
     throw "Compile for larger integers";
@@ -5,25 +5,50 @@
 
 #ifdef _X86
 #include "x86.h"
+#elif defined(_X86_64)
+#include "x86_64.h"
 #else
 #include "gmp_math.h"
 #endif
 
+#include "FpInverse.h"
+
 // use unsigned long because it's the CPUs natural word length
 #define WORD_LENGTH_BITS (sizeof(unsigned long)*8)
 
 void printInt(const unsigned long *x, int len);
 
+/**
+ * Reduction methods that getFp() can choose from. FP_AUTO uses the
+ * pseudo-Mersenne reduction when the modulus has that form and Montgomery
+ * reduction otherwise
+ */
+enum {
+    FP_BARRETT,
+    FP_MONTGOMERY,
+    FP_PSEUDO_MERSENNE,
+    FP_AUTO
+};
 
 class FpBase {
 public:
+    virtual ~FpBase() {}
+
     virtual void subModP(const unsigned long *a, const unsigned long *b, unsigned long *diff) = 0;
     virtual void multiplyModP(const unsigned long *a, const unsigned long *b, unsigned long *c) = 0;
     virtual void squareModP(const unsigned long *a, unsigned long *aSquared) = 0;
     virtual void inverseModP(const unsigned long *input, unsigned long *inverse) = 0;
+
+    /**
+     * Converts a value mod P into the internal representation of the implementation
+     * and back again. All other operations take and return values in the internal form.
+     */
+    virtual void encode(const unsigned long *input, unsigned long *encoded) = 0;
+    virtual void decode(const unsigned long *encoded, unsigned long *output) = 0;
 };
 
-FpBase *getFp(BigInteger &p);
+bool isPseudoMersenne(const BigInteger &p);
+FpBase *getFp(BigInteger &p, int type = FP_AUTO);
 
 template <int N> 
 class Fp : public FpBase {
@@ -47,9 +72,6 @@ private:
     // Length of m in bits
     int _mBits;
 
-    // P in GMP format because GMP does the modular inversion
-    mpz_t _gmp_p;
-
     void getHighBits(const unsigned long *in, unsigned long *out);
     void reduceModP(const unsigned long *x, unsigned long *c);
 
@@ -71,11 +93,12 @@ public:
 
         _mWords = m.getWordLength();
         _mBits = m.getBitLength();
-        m.getWords(_m, _mWords);
-
-        mpz_init(_gmp_p);
 
-        mpz_import(_gmp_p, _pWords, GMP_BYTE_ORDER_LSB, sizeof(unsigned long), GMP_ENDIAN_LITTLE, 0, _p);
+        // If m is a word longer than p, the top word is 1 and reduceModP handles it
+        // with an addition, so only the low N words are stored
+        unsigned long mWords[N + 1];
+        m.getWords(mWords, N + 1);
+        memcpy(_m, mWords, sizeof(_m));
     }
 
 
@@ -83,6 +106,17 @@ public:
     void multiplyModP(const unsigned long *a, const unsigned long *b, unsigned long *c);
     void squareModP(const unsigned long *a, unsigned long *aSquared);
     void inverseModP(const unsigned long *input, unsigned long *inverse);
+
+    // Barrett reduction works directly on the residues
+    void encode(const unsigned long *input, unsigned long *encoded)
+    {
+        memcpy(encoded, input, sizeof(unsigned long) * N);
+    }
+
+    void decode(const unsigned long *encoded, unsigned long *output)
+    {
+        memcpy(output, encoded, sizeof(unsigned long) * N);
+    }
 };
 
 
@@ -108,7 +142,8 @@ template<int N> void Fp<N>::getHighBits(const unsigned long *in, unsigned long *
 
 /**
  * Performs reduction mod P using the barrett reduction. It is assumed that
- * the product is <= (p-1)^2
+ * the product is <= (p-1)^2, so the estimate of the quotient is at most 2
+ * too small
  */
 template<int N> void Fp<N>::reduceModP(const unsigned long *x, unsigned long *c)
 {
@@ -132,15 +167,19 @@ template<int N> void Fp<N>::reduceModP(const unsigned long *x, unsigned long *c)
     unsigned long qp[2*N] = {0};
     mul<N>(q, _p, qp);
 
-    // Subtract from x to get a k-bit value
-    sub<N>(x, qp, c);
+    // Subtract from x. The remainder is below 3p, which does not fit in N
+    // words when p fills its top word, so it is kept in N + 1 words
+    unsigned long r[N + 1];
+    unsigned long borrow = sub<N>(x, qp, r);
+    r[N] = x[N] - qp[N] - borrow;
 
-    qp[N-1] &= ((unsigned long)~0 >> (_pBits % WORD_LENGTH_BITS));
-
-    // Subtract again if necessary
-    if(greaterThanEqualTo<N>(c, _p)) {
-        sub<N>(c, _p, c);
+    // Subtract p at most twice
+    while(r[N] != 0 || greaterThanEqualTo<N>(r, _p)) {
+        borrow = sub<N>(r, _p, r);
+        r[N] -= borrow;
     }
+
+    memcpy(c, r, sizeof(unsigned long) * N);
 }
 
 /**
@@ -182,22 +221,6 @@ template<int N> void Fp<N>::squareModP(const unsigned long *a, unsigned long *aS
  */
 template<int N> void Fp<N>::inverseModP(const unsigned long *input, unsigned long *inverse)
 {
-    mpz_t a;
-    mpz_t aInv;
-
-    mpz_init(a);
-    mpz_init(aInv);
-
-    mpz_import(a, _pWords, GMP_BYTE_ORDER_LSB, sizeof(unsigned long), GMP_ENDIAN_LITTLE, 0, input);
-
-    mpz_invert(aInv, a, _gmp_p);
-
-    // Need to zero out the destination
-    memset(inverse, 0, sizeof(unsigned long) * N);
-
-    mpz_export(inverse, NULL, GMP_BYTE_ORDER_LSB, sizeof(unsigned long), GMP_ENDIAN_LITTLE, 0, aInv);
-
-    mpz_clear(a);
-    mpz_clear(aInv);
+    binaryInverse<N>(input, _p, inverse);
 }
 #endif
\ No newline at end of file
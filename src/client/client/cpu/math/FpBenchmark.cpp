@@ -0,0 +1,117 @@
+#include <string.h>
+#include "util.h"
+#include "Fp.h"
+#include "FpBenchmark.h"
+
+// Operations done between reads of the timer
+#define FP_BENCHMARK_BATCH 1000
+
+// Largest integer in words that getFp supports
+#define FP_BENCHMARK_MAX_WORDS 8
+
+enum {
+    OP_SUB,
+    OP_MULTIPLY,
+    OP_SQUARE,
+    OP_INVERSE
+};
+
+/**
+ * Name of the arithmetic the library was compiled with
+ */
+const char *getFpBackend()
+{
+#ifdef _X86
+    return "x86";
+#elif defined(_X86_64)
+    return "x86_64";
+#else
+    return "gmp";
+#endif
+}
+
+/**
+ * Does FP_BENCHMARK_BATCH operations. Each one takes the result of the one
+ * before, so the time is the latency of the operation
+ */
+static void runBatch(FpBase *fp, int op, unsigned long *x, const unsigned long *y)
+{
+    switch(op) {
+        case OP_SUB:
+            for(int i = 0; i < FP_BENCHMARK_BATCH; i++) {
+                fp->subModP(x, y, x);
+            }
+            break;
+        case OP_MULTIPLY:
+            for(int i = 0; i < FP_BENCHMARK_BATCH; i++) {
+                fp->multiplyModP(x, y, x);
+            }
+            break;
+        case OP_SQUARE:
+            for(int i = 0; i < FP_BENCHMARK_BATCH; i++) {
+                fp->squareModP(x, x);
+            }
+            break;
+        case OP_INVERSE:
+            for(int i = 0; i < FP_BENCHMARK_BATCH; i++) {
+                fp->inverseModP(x, x);
+            }
+            break;
+    }
+}
+
+static double timeOperation(FpBase *fp, int op, const unsigned long *a, const unsigned long *b)
+{
+    unsigned long x[FP_BENCHMARK_MAX_WORDS];
+    unsigned long y[FP_BENCHMARK_MAX_WORDS];
+
+    fp->encode(a, x);
+    fp->encode(b, y);
+
+    unsigned long long count = 0;
+    unsigned int t = 0;
+
+    util::Timer timer;
+    timer.start();
+
+    do {
+        runBatch(fp, op, x, y);
+        count += FP_BENCHMARK_BATCH;
+    }while((t = timer.getTime()) < FP_BENCHMARK_TIME);
+
+    return (double)t * 1000000.0 / (double)count;
+}
+
+/**
+ * Times the operations of getFp for the modulus p with one of the
+ * FP_BENCHMARK reductions on random operands
+ */
+FpTimings benchmarkFp(BigInteger &p, int reduction)
+{
+    int words = p.getWordLength();
+
+    unsigned long a[FP_BENCHMARK_MAX_WORDS] = {0};
+    unsigned long b[FP_BENCHMARK_MAX_WORDS] = {0};
+
+    randomBigInteger(2, p).getWords(a, words);
+    randomBigInteger(2, p).getWords(b, words);
+
+    int type = FP_BARRETT;
+    if(reduction == FP_BENCHMARK_MONTGOMERY) {
+        type = FP_MONTGOMERY;
+    } else if(reduction == FP_BENCHMARK_PSEUDO_MERSENNE) {
+        type = FP_PSEUDO_MERSENNE;
+    }
+
+    FpBase *fp = getFp(p, type);
+
+    FpTimings timings;
+    timings.sub = timeOperation(fp, OP_SUB, a, b);
+    timings.multiply = timeOperation(fp, OP_MULTIPLY, a, b);
+    timings.square = timeOperation(fp, OP_SQUARE, a, b);
+    timings.inverse = timeOperation(fp, OP_INVERSE, a, b);
+
+    delete fp;
+
+    return timings;
+}
@@ -0,0 +1,32 @@
+#ifndef _FP_BENCHMARK_H
+#define _FP_BENCHMARK_H
+
+#include "BigInteger.h"
+
+// Shortest time each operation is timed for, in milliseconds
+#define FP_BENCHMARK_TIME 200
+
+/**
+ * Nanoseconds per field operation
+ */
+typedef struct {
+    double sub;
+    double multiply;
+    double square;
+    double inverse;
+}FpTimings;
+
+/**
+ * Reductions that benchmarkFp can time. The pseudo-Mersenne reduction needs
+ * a modulus of that form
+ */
+enum {
+    FP_BENCHMARK_BARRETT,
+    FP_BENCHMARK_MONTGOMERY,
+    FP_BENCHMARK_PSEUDO_MERSENNE
+};
+
+const char *getFpBackend();
+FpTimings benchmarkFp(BigInteger &p, int reduction);
+
+#endif
@@ -0,0 +1,305 @@
+#ifndef _PRIME_FIELD_IFMA_H
+#define _PRIME_FIELD_IFMA_H
+
+#include "BigInteger.h"
+
+/**
+ * Montgomery arithmetic mod P on 8 values at once using AVX-512 IFMA. Each
+ * value is split into L limbs of 52 bits, and limb i of all 8 values is kept
+ * in one 512-bit register (structure of arrays). R = 2^(52 * L).
+ *
+ * The functions are compiled for AVX-512 using target attributes so the rest
+ * of the client can be built without AVX-512 flags. ifmaSupported() must be
+ * checked at run time before using this class.
+ */
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define FP_IFMA_SUPPORTED
+#endif
+
+#ifdef FP_IFMA_SUPPORTED
+
+// The intrinsics of GCC 12 start some results from an undefined value,
+// which -Wall reports in every function they are inlined into
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#include <immintrin.h>
+#pragma GCC diagnostic pop
+#include <string.h>
+
+#define IFMA_TARGET __attribute__((target("avx512f,avx512ifma")))
+
+#define IFMA_LANES 8
+#define IFMA_LIMB_BITS 52
+#define IFMA_LIMB_MASK ((1ULL << IFMA_LIMB_BITS) - 1)
+
+/**
+ * Number of 52-bit limbs needed for an N-word value
+ */
+#define IFMA_LIMBS(N) ((int)((N) * sizeof(unsigned long) * 8 + IFMA_LIMB_BITS - 1) / IFMA_LIMB_BITS)
+
+/**
+ * Returns true if the CPU and OS support AVX-512 IFMA
+ */
+inline bool ifmaSupported()
+{
+    __builtin_cpu_init();
+
+    return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512ifma");
+}
+
+/**
+ * Splits an n-word integer into 52-bit limbs
+ */
+template<int L> void toLimbs(const unsigned long *words, int n, unsigned long long *limbs)
+{
+    const int wordBits = sizeof(unsigned long) * 8;
+
+    for(int i = 0; i < L; i++) {
+        int bit = i * IFMA_LIMB_BITS;
+        int w = bit / wordBits;
+        int s = bit % wordBits;
+
+        unsigned long long limb = 0;
+
+        if(w < n) {
+            limb = (unsigned long long)words[w] >> s;
+        }
+        if(s + IFMA_LIMB_BITS > wordBits && w + 1 < n) {
+            limb |= (unsigned long long)words[w + 1] << (wordBits - s);
+        }
+
+        limbs[i] = limb & IFMA_LIMB_MASK;
+    }
+}
+
+/**
+ * Joins 52-bit limbs into an n-word integer
+ */
+template<int L> void fromLimbs(const unsigned long long *limbs, unsigned long *words, int n)
+{
+    const int wordBits = sizeof(unsigned long) * 8;
+
+    memset(words, 0, sizeof(unsigned long) * n);
+
+    for(int i = 0; i < L; i++) {
+        int bit = i * IFMA_LIMB_BITS;
+        int w = bit / wordBits;
+        int s = bit % wordBits;
+
+        if(w < n) {
+            words[w] |= (unsigned long)(limbs[i] << s);
+        }
+        if(s + IFMA_LIMB_BITS > wordBits && w + 1 < n) {
+            words[w + 1] |= (unsigned long)(limbs[i] >> (wordBits - s));
+        }
+    }
+}
+
+template<int L>
+class FpIFMA {
+
+private:
+    // Limbs of P
+    unsigned long long _p[L];
+
+    // -P^-1 mod 2^52
+    unsigned long long _k0;
+
+    // R^2 mod P, for converting into Montgomery form
+    unsigned long long _r2[L];
+
+    IFMA_TARGET void reduce(__m512i *t, __m512i *c);
+
+public:
+    FpIFMA() {}
+
+    FpIFMA(const BigInteger &p)
+    {
+        const int n = p.getWordLength();
+        unsigned long words[L * 2];
+
+        memset(words, 0, sizeof(words));
+        p.getWords(words, n);
+        toLimbs<L>(words, n, _p);
+
+        // Newton iteration for P^-1 mod 2^64
+        unsigned long long inv = 1;
+        for(int i = 0; i < 6; i++) {
+            inv *= 2 - _p[0] * inv;
+        }
+        _k0 = (0 - inv) & IFMA_LIMB_MASK;
+
+        BigInteger r2 = BigInteger(2).pow(2 * IFMA_LIMB_BITS * L) % p;
+        memset(words, 0, sizeof(words));
+        r2.getWords(words, n);
+        toLimbs<L>(words, n, _r2);
+    }
+
+    IFMA_TARGET void multiplyModP(const __m512i *a, const __m512i *b, __m512i *c);
+    IFMA_TARGET void squareModP(const __m512i *a, __m512i *c);
+    IFMA_TARGET void subModP(const __m512i *a, const __m512i *b, __m512i *c);
+    IFMA_TARGET void encode(const __m512i *a, __m512i *c);
+    IFMA_TARGET void decode(const __m512i *a, __m512i *c);
+};
+
+/**
+ * Given the L + 1 accumulators of a Montgomery product, normalizes them to
+ * 52-bit limbs and subtracts P if the value is >= P. The value must be < 2P.
+ */
+template<int L> IFMA_TARGET inline void FpIFMA<L>::reduce(__m512i *t, __m512i *c)
+{
+    const __m512i mask = _mm512_set1_epi64(IFMA_LIMB_MASK);
+
+    for(int j = 0; j < L - 1; j++) {
+        t[j + 1] = _mm512_add_epi64(t[j + 1], _mm512_srli_epi64(t[j], IFMA_LIMB_BITS));
+        t[j] = _mm512_and_si512(t[j], mask);
+    }
+
+    // d = t - p
+    __m512i d[L];
+    __m512i borrow = _mm512_setzero_si512();
+
+    for(int j = 0; j < L; j++) {
+        d[j] = _mm512_sub_epi64(_mm512_sub_epi64(t[j], _mm512_set1_epi64(_p[j])), borrow);
+        borrow = _mm512_srli_epi64(d[j], 63);
+        d[j] = _mm512_and_si512(d[j], mask);
+    }
+
+    // Keep t in the lanes where t < p
+    __mmask8 less = _mm512_test_epi64_mask(borrow, borrow);
+
+    for(int j = 0; j < L; j++) {
+        c[j] = _mm512_mask_blend_epi64(less, d[j], t[j]);
+    }
+}
+
+/**
+ * Montgomery multiplication c = abR^-1 mod P. Products are split into their
+ * low and high 52 bits. One limb of the result is cleared per iteration by
+ * adding a multiple of P, then everything shifts down a limb.
+ */
+template<int L> IFMA_TARGET inline void FpIFMA<L>::multiplyModP(const __m512i *a, const __m512i *b, __m512i *c)
+{
+    const __m512i zero = _mm512_setzero_si512();
+    const __m512i k0 = _mm512_set1_epi64(_k0);
+
+    __m512i p[L];
+    for(int j = 0; j < L; j++) {
+        p[j] = _mm512_set1_epi64(_p[j]);
+    }
+
+    __m512i t[L + 1];
+    for(int j = 0; j <= L; j++) {
+        t[j] = zero;
+    }
+
+    for(int i = 0; i < L; i++) {
+        for(int j = 0; j < L; j++) {
+            t[j] = _mm512_madd52lo_epu64(t[j], a[j], b[i]);
+            t[j + 1] = _mm512_madd52hi_epu64(t[j + 1], a[j], b[i]);
+        }
+
+        __m512i m = _mm512_madd52lo_epu64(zero, t[0], k0);
+
+        for(int j = 0; j < L; j++) {
+            t[j] = _mm512_madd52lo_epu64(t[j], p[j], m);
+            t[j + 1] = _mm512_madd52hi_epu64(t[j + 1], p[j], m);
+        }
+
+        // The low 52 bits of t[0] are now zero
+        __m512i carry = _mm512_srli_epi64(t[0], IFMA_LIMB_BITS);
+        for(int j = 0; j < L; j++) {
+            t[j] = t[j + 1];
+        }
+        t[L] = zero;
+        t[0] = _mm512_add_epi64(t[0], carry);
+    }
+
+    reduce(t, c);
+}
+
+template<int L> IFMA_TARGET inline void FpIFMA<L>::squareModP(const __m512i *a, __m512i *c)
+{
+    multiplyModP(a, a, c);
+}
+
+/**
+ * Subtraction mod P. Subtraction is the same in Montgomery form
+ */
+template<int L> IFMA_TARGET inline void FpIFMA<L>::subModP(const __m512i *a, const __m512i *b, __m512i *c)
+{
+    const __m512i mask = _mm512_set1_epi64(IFMA_LIMB_MASK);
+
+    __m512i d[L];
+    __m512i borrow = _mm512_setzero_si512();
+
+    for(int j = 0; j < L; j++) {
+        d[j] = _mm512_sub_epi64(_mm512_sub_epi64(a[j], b[j]), borrow);
+        borrow = _mm512_srli_epi64(d[j], 63);
+        d[j] = _mm512_and_si512(d[j], mask);
+    }
+
+    // Add P in the lanes that went negative
+    __mmask8 negative = _mm512_test_epi64_mask(borrow, borrow);
+    __m512i carry = _mm512_setzero_si512();
+
+    for(int j = 0; j < L; j++) {
+        __m512i s = _mm512_add_epi64(_mm512_add_epi64(d[j], _mm512_set1_epi64(_p[j])), carry);
+        carry = _mm512_srli_epi64(s, IFMA_LIMB_BITS);
+        c[j] = _mm512_mask_blend_epi64(negative, d[j], _mm512_and_si512(s, mask));
+    }
+}
+
+/**
+ * Converts a to aR mod P
+ */
+template<int L> IFMA_TARGET inline void FpIFMA<L>::encode(const __m512i *a, __m512i *c)
+{
+    __m512i r2[L];
+
+    for(int j = 0; j < L; j++) {
+        r2[j] = _mm512_set1_epi64(_r2[j]);
+    }
+
+    multiplyModP(a, r2, c);
+}
+
+/**
+ * Converts aR to a mod P. This is a Montgomery multiplication by 1
+ */
+template<int L> IFMA_TARGET inline void FpIFMA<L>::decode(const __m512i *a, __m512i *c)
+{
+    const __m512i zero = _mm512_setzero_si512();
+    const __m512i k0 = _mm512_set1_epi64(_k0);
+
+    __m512i t[L + 1];
+    for(int j = 0; j < L; j++) {
+        t[j] = a[j];
+    }
+    t[L] = zero;
+
+    for(int i = 0; i < L; i++) {
+        __m512i m = _mm512_madd52lo_epu64(zero, t[0], k0);
+
+        for(int j = 0; j < L; j++) {
+            __m512i p = _mm512_set1_epi64(_p[j]);
+            t[j] = _mm512_madd52lo_epu64(t[j], p, m);
+            t[j + 1] = _mm512_madd52hi_epu64(t[j + 1], p, m);
+        }
+
+        __m512i carry = _mm512_srli_epi64(t[0], IFMA_LIMB_BITS);
+        for(int j = 0; j < L; j++) {
+            t[j] = t[j + 1];
+        }
+        t[L] = zero;
+        t[0] = _mm512_add_epi64(t[0], carry);
+    }
+
+    reduce(t, c);
+}
+
+#endif
+
+#endif
@@ -0,0 +1,282 @@
+#ifndef _PRIME_FIELD_INVERSE_H
+#define _PRIME_FIELD_INVERSE_H
+
+#include <string.h>
+#include <limits.h>
+
+/**
+ * Fixed-width modular inversion using the optimized binary GCD from T. Pornin,
+ * "Optimized Binary GCD for Modular Inversion". Each outer iteration runs
+ * INV_BATCH_BITS binary GCD steps on 64-bit approximations of a and b, then
+ * applies the accumulated update to the full values. Everything lives on the
+ * stack so it can be called from the inner loop of multiple threads without
+ * going through the allocator.
+ */
+
+#if ULONG_MAX > 0xffffffffUL
+typedef __int128 inv_sdword_t;
+#define INV_BATCH_BITS 31
+#else
+typedef long long inv_sdword_t;
+#define INV_BATCH_BITS 29
+#endif
+
+#define INV_WORD_BITS ((int)sizeof(unsigned long) * 8)
+
+template<int N> bool isZero(const unsigned long *a)
+{
+    for(int i = 0; i < N; i++) {
+        if(a[i] != 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Returns the 64 bits of a starting at bit s
+ */
+template<int N> unsigned long long getBits64(const unsigned long *a, int s)
+{
+    unsigned long long bits = 0;
+    int shift = -(s % INV_WORD_BITS);
+
+    for(int i = s / INV_WORD_BITS; i < N && shift < 64; i++) {
+        unsigned long long word = a[i];
+
+        if(shift < 0) {
+            bits |= word >> -shift;
+        } else {
+            bits |= word << shift;
+        }
+        shift += INV_WORD_BITS;
+    }
+
+    return bits;
+}
+
+/**
+ * Arithmetic right shift of an N word two's complement value
+ */
+template<int N> void shiftRightSigned(unsigned long *a, int s)
+{
+    for(int i = 0; i < N - 1; i++) {
+        a[i] = (a[i] >> s) | (a[i + 1] << (INV_WORD_BITS - s));
+    }
+    a[N - 1] = (unsigned long)((long)a[N - 1] >> s);
+}
+
+/**
+ * Addition and subtraction without carry out. These are here rather than in
+ * the backends because they are used for N + 1 words
+ */
+template<int N> void addWords(const unsigned long *a, const unsigned long *b, unsigned long *sum)
+{
+    unsigned long carry = 0;
+
+    for(int i = 0; i < N; i++) {
+        unsigned long s = a[i] + carry;
+        carry = s < carry ? 1 : 0;
+        sum[i] = s + b[i];
+        carry += sum[i] < s ? 1 : 0;
+    }
+}
+
+template<int N> void subWords(const unsigned long *a, const unsigned long *b, unsigned long *diff)
+{
+    unsigned long borrow = 0;
+
+    for(int i = 0; i < N; i++) {
+        unsigned long d = a[i] - borrow;
+        borrow = d > a[i] ? 1 : 0;
+        borrow += d < b[i] ? 1 : 0;
+        diff[i] = d - b[i];
+    }
+}
+
+template<int N> void negate(unsigned long *a)
+{
+    unsigned long carry = 1;
+
+    for(int i = 0; i < N; i++) {
+        a[i] = ~a[i] + carry;
+        carry = (carry && a[i] == 0) ? 1 : 0;
+    }
+}
+
+/**
+ * out = (a * f + b * g) / 2^INV_BATCH_BITS where the division is exact. The
+ * result is made non-negative and the signs of f and g are flipped to match.
+ */
+template<int N> void updateGcd(const unsigned long *a, const unsigned long *b, long long &f, long long &g, unsigned long *out)
+{
+    unsigned long t[N + 1];
+    inv_sdword_t carry = 0;
+
+    for(int i = 0; i < N; i++) {
+        carry += (inv_sdword_t)a[i] * f + (inv_sdword_t)b[i] * g;
+        t[i] = (unsigned long)carry;
+        carry >>= INV_WORD_BITS;
+    }
+    t[N] = (unsigned long)carry;
+
+    shiftRightSigned<N + 1>(t, INV_BATCH_BITS);
+
+    if((long)t[N] < 0) {
+        negate<N + 1>(t);
+        f = -f;
+        g = -g;
+    }
+
+    memcpy(out, t, sizeof(unsigned long) * N);
+}
+
+/**
+ * out = (u * f + v * g) / 2^INV_BATCH_BITS mod p. mInv is -p^-1 mod 2^64
+ */
+template<int N> void updateCoefficient(const unsigned long *u, const unsigned long *v, long long f, long long g,
+                                       const unsigned long *p, unsigned long long mInv, unsigned long *out)
+{
+    // Multiple of p that makes the low bits zero
+    unsigned long low = u[0] * (unsigned long)f + v[0] * (unsigned long)g;
+    long long k = (long long)((low * mInv) & ((1ULL << INV_BATCH_BITS) - 1));
+
+    // |uf + vg + kp| < 2^(INV_BATCH_BITS + 1) p so the quotient is in (-2p, 2p)
+    unsigned long t[N + 1];
+    inv_sdword_t carry = 0;
+
+    for(int i = 0; i < N; i++) {
+        carry += (inv_sdword_t)u[i] * f + (inv_sdword_t)v[i] * g + (inv_sdword_t)p[i] * k;
+        t[i] = (unsigned long)carry;
+        carry >>= INV_WORD_BITS;
+    }
+    t[N] = (unsigned long)carry;
+
+    shiftRightSigned<N + 1>(t, INV_BATCH_BITS);
+
+    // Bring into the range [0, p)
+    unsigned long pWide[N + 1];
+    memcpy(pWide, p, sizeof(unsigned long) * N);
+    pWide[N] = 0;
+
+    while((long)t[N] < 0) {
+        addWords<N + 1>(t, pWide, t);
+    }
+
+    while(greaterThanEqualTo<N + 1>(t, pWide)) {
+        subWords<N + 1>(t, pWide, t);
+    }
+
+    memcpy(out, t, sizeof(unsigned long) * N);
+}
+
+/**
+ * Computes the inverse of a mod p where p is odd and 0 <= a < p. The inverse
+ * of 0 is returned as 0.
+ */
+template<int N> void binaryInverse(const unsigned long *input, const unsigned long *p, unsigned long *inverse)
+{
+    // -p^-1 mod 2^64 by Newton iteration
+    unsigned long long pInv = 1;
+    for(int i = 0; i < 6; i++) {
+        pInv *= 2 - (unsigned long long)p[0] * pInv;
+    }
+    unsigned long long mInv = 0 - pInv;
+
+    unsigned long a[N];
+    unsigned long b[N];
+    unsigned long u[N] = {0};
+    unsigned long v[N] = {0};
+
+    // Invariants: a = u * input mod p, b = v * input mod p
+    memcpy(a, input, sizeof(unsigned long) * N);
+    memcpy(b, p, sizeof(unsigned long) * N);
+    u[0] = 1;
+
+    while(!isZero<N>(a)) {
+
+        // Length of the larger of a and b
+        int len = 0;
+        for(int i = N - 1; i >= 0; i--) {
+            unsigned long w = a[i] | b[i];
+            if(w != 0) {
+                len = i * INV_WORD_BITS + INV_WORD_BITS - __builtin_clzl(w);
+                break;
+            }
+        }
+
+        // Approximate a and b using their low bits and their top bits
+        unsigned long long aBar;
+        unsigned long long bBar;
+
+        if(len <= 64) {
+            aBar = getBits64<N>(a, 0);
+            bBar = getBits64<N>(b, 0);
+        } else {
+            const unsigned long long lowMask = (1ULL << INV_BATCH_BITS) - 1;
+            aBar = (a[0] & lowMask) | (getBits64<N>(a, len - 64 + INV_BATCH_BITS) << INV_BATCH_BITS);
+            bBar = (b[0] & lowMask) | (getBits64<N>(b, len - 64 + INV_BATCH_BITS) << INV_BATCH_BITS);
+        }
+
+        // Run the binary GCD on the approximations, tracking the updates
+        long long f0 = 1;
+        long long g0 = 0;
+        long long f1 = 0;
+        long long g1 = 1;
+
+        int i = 0;
+        while(i < INV_BATCH_BITS) {
+
+            // Skip over the zero bits at once
+            if((aBar & 1) == 0) {
+                int z = aBar == 0 ? INV_BATCH_BITS : __builtin_ctzll(aBar);
+                if(z > INV_BATCH_BITS - i) {
+                    z = INV_BATCH_BITS - i;
+                }
+                aBar >>= z;
+                f1 <<= z;
+                g1 <<= z;
+                i += z;
+                continue;
+            }
+
+            if(aBar < bBar) {
+                unsigned long long t = aBar;
+                aBar = bBar;
+                bBar = t;
+
+                long long tf = f0;
+                long long tg = g0;
+                f0 = f1;
+                g0 = g1;
+                f1 = tf;
+                g1 = tg;
+            }
+            aBar = (aBar - bBar) >> 1;
+            f0 -= f1;
+            g0 -= g1;
+            f1 <<= 1;
+            g1 <<= 1;
+            i++;
+        }
+
+        unsigned long newA[N];
+        unsigned long newB[N];
+        updateGcd<N>(a, b, f0, g0, newA);
+        updateGcd<N>(a, b, f1, g1, newB);
+
+        unsigned long newU[N];
+        updateCoefficient<N>(u, v, f0, g0, p, mInv, newU);
+        updateCoefficient<N>(u, v, f1, g1, p, mInv, v);
+
+        memcpy(a, newA, sizeof(a));
+        memcpy(b, newB, sizeof(b));
+        memcpy(u, newU, sizeof(u));
+    }
+
+    // b is now gcd(input, p) = 1
+    memcpy(inverse, v, sizeof(unsigned long) * N);
+}
+
+#endif
@@ -0,0 +1,169 @@
+#ifndef _PRIME_FIELD_MONTGOMERY_H
+#define _PRIME_FIELD_MONTGOMERY_H
+
+#include "Fp.h"
+
+/**
+ * Arithmetic mod P using Montgomery reduction. Values are kept in the form
+ * aR mod P where R = 2^(N * WORD_LENGTH_BITS). P must be odd.
+ */
+template <int N>
+class FpMontgomery : public FpBase {
+
+private:
+    // Prime modulus
+    unsigned long _p[N];
+
+    // -P^-1 mod 2^WORD_LENGTH_BITS
+    unsigned long _pInv;
+
+    // R^2 mod P, for converting into Montgomery form
+    unsigned long _r2[N];
+
+    // R^3 mod P, for correcting the result of the inversion
+    unsigned long _r3[N];
+
+    void reduceModP(unsigned long *t, unsigned long *c);
+
+public:
+
+    FpMontgomery() {}
+
+    FpMontgomery(const BigInteger &p)
+    {
+        memset(_p, 0, sizeof(_p));
+        p.getWords(_p, N);
+
+        // Newton iteration for P^-1 mod 2^w. Each iteration doubles the number of correct bits
+        unsigned long inv = 1;
+        for(int i = 0; i < 7; i++) {
+            inv *= 2 - _p[0] * inv;
+        }
+        _pInv = (unsigned long)0 - inv;
+
+        BigInteger r = BigInteger(2).pow(N * WORD_LENGTH_BITS) % p;
+        BigInteger r2 = (r * r) % p;
+        BigInteger r3 = (r2 * r) % p;
+
+        r2.getWords(_r2, N);
+        r3.getWords(_r3, N);
+    }
+
+    void subModP(const unsigned long *a, const unsigned long *b, unsigned long *diff);
+    void multiplyModP(const unsigned long *a, const unsigned long *b, unsigned long *c);
+    void squareModP(const unsigned long *a, unsigned long *aSquared);
+    void inverseModP(const unsigned long *input, unsigned long *inverse);
+    void encode(const unsigned long *input, unsigned long *encoded);
+    void decode(const unsigned long *encoded, unsigned long *output);
+};
+
+/**
+ * Montgomery reduction. Given a 2N-word value t < PR, computes tR^-1 mod P.
+ * The contents of t are destroyed.
+ */
+template<int N> void FpMontgomery<N>::reduceModP(unsigned long *t, unsigned long *c)
+{
+    // Clear one word at a time by adding a multiple of P. The word that was
+    // cleared is used to hold the carry, which belongs to word i + N. Adding
+    // the carries is deferred because they do not affect the lower words.
+    for(int i = 0; i < N; i++) {
+        unsigned long u = t[i] * _pInv;
+        t[i] = mulAdd<N>(_p, u, &t[i]);
+    }
+
+    // Add the carries to the upper half
+    unsigned long high = 0;
+    for(int i = 0; i < N; i++) {
+        unsigned long s = t[N + i] + high;
+        high = s < high ? 1 : 0;
+        s += t[i];
+        high += s < t[i] ? 1 : 0;
+        t[N + i] = s;
+    }
+
+    // The result is now in the upper half and is less than 2P
+    if(high || greaterThanEqualTo<N>(&t[N], _p)) {
+        sub<N>(&t[N], _p, c);
+    } else {
+        memcpy(c, &t[N], sizeof(unsigned long) * N);
+    }
+}
+
+/**
+ * Subtraction mod P. Subtraction is the same in Montgomery form
+ */
+template<int N> void FpMontgomery<N>::subModP(const unsigned long *a, const unsigned long *b, unsigned long *diff)
+{
+    int borrow = sub<N>(a, b, diff);
+
+    // Check for negative
+    if(borrow) {
+        add<N>(diff, _p, diff);
+    }
+}
+
+/**
+ * Multiplication mod P
+ */
+template<int N> void FpMontgomery<N>::multiplyModP(const unsigned long *a, const unsigned long *b, unsigned long *c)
+{
+#ifdef _X86_64
+    // Multiplication and reduction are fused in assembly
+    montMul<N>(a, b, _p, _pInv, c);
+#else
+    unsigned long product[N*2];
+    mul<N>(a, b, product);
+    reduceModP(product, c);
+#endif
+}
+
+/**
+ * Square mod P
+ */
+template<int N> void FpMontgomery<N>::squareModP(const unsigned long *a, unsigned long *aSquared)
+{
+#ifdef _X86_64
+    montSquare<N>(a, _p, _pInv, aSquared);
+#else
+    unsigned long product[N*2];
+
+    square<N>(a, product);
+    reduceModP(product, aSquared);
+#endif
+}
+
+/**
+ * Modular inverse mod P. The input is aR, the inversion gives a^-1R^-1, and a
+ * Montgomery multiplication by R^3 brings it back to a^-1R
+ */
+template<int N> void FpMontgomery<N>::inverseModP(const unsigned long *input, unsigned long *inverse)
+{
+    unsigned long tmp[N];
+
+    binaryInverse<N>(input, _p, tmp);
+
+    multiplyModP(tmp, _r3, inverse);
+}
+
+/**
+ * Converts a to aR mod P
+ */
+template<int N> void FpMontgomery<N>::encode(const unsigned long *input, unsigned long *encoded)
+{
+    multiplyModP(input, _r2, encoded);
+}
+
+/**
+ * Converts aR to a mod P
+ */
+template<int N> void FpMontgomery<N>::decode(const unsigned long *encoded, unsigned long *output)
+{
+    unsigned long t[N*2];
+
+    memcpy(t, encoded, sizeof(unsigned long) * N);
+    memset(&t[N], 0, sizeof(unsigned long) * N);
+
+    reduceModP(t, output);
+}
+
+#endif
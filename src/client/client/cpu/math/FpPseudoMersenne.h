@@ -0,0 +1,173 @@
+#ifndef _PRIME_FIELD_PSEUDO_MERSENNE_H
+#define _PRIME_FIELD_PSEUDO_MERSENNE_H
+
+#include "Fp.h"
+
+/**
+ * Arithmetic mod a prime of the form P = 2^k - c where c < 2^(k/2 - 1). This
+ * covers pseudo-Mersenne primes such as 2^255 - 19 and secp256k1, and the
+ * generalized Mersenne primes whose c is short, such as P-192, P-224, P-384
+ * and P-521. Since 2^k = c mod P, the bits of a product above 2^k are folded
+ * back in by multiplying them by c, one word of c at a time. Two folds and
+ * one subtraction reduce any product of two residues. Values are kept as
+ * plain residues.
+ */
+template <int N>
+class FpPseudoMersenne : public FpBase {
+
+private:
+    // Prime modulus
+    unsigned long _p[N];
+
+    // c = 2^k - P
+    unsigned long _c[N];
+
+    // Length of c in words
+    int _cWords;
+
+    // k, the length of P in bits
+    int _pBits;
+
+    template<int H> void fold(const unsigned long *x, unsigned long *t);
+    void reduceModP(const unsigned long *x, unsigned long *c);
+
+public:
+
+    FpPseudoMersenne() {}
+
+    FpPseudoMersenne(const BigInteger &p)
+    {
+        _pBits = p.getBitLength();
+
+        BigInteger c = BigInteger(2).pow(_pBits) - p;
+
+        memset(_p, 0, sizeof(_p));
+        memset(_c, 0, sizeof(_c));
+        p.getWords(_p, N);
+        c.getWords(_c, N);
+        _cWords = c.getWordLength();
+    }
+
+    void subModP(const unsigned long *a, const unsigned long *b, unsigned long *diff);
+    void multiplyModP(const unsigned long *a, const unsigned long *b, unsigned long *c);
+    void squareModP(const unsigned long *a, unsigned long *aSquared);
+    void inverseModP(const unsigned long *input, unsigned long *inverse);
+
+    // The reduction works directly on the residues
+    void encode(const unsigned long *input, unsigned long *encoded)
+    {
+        memcpy(encoded, input, sizeof(unsigned long) * N);
+    }
+
+    void decode(const unsigned long *encoded, unsigned long *output)
+    {
+        memcpy(output, encoded, sizeof(unsigned long) * N);
+    }
+};
+
+/**
+ * Given a 2N-word value x = h * 2^k + l where h is at most H words, computes
+ * t = l + h * c, which is the same mod P. t is 2N words
+ */
+template<int N> template<int H> void FpPseudoMersenne<N>::fold(const unsigned long *x, unsigned long *t)
+{
+    int rShift = _pBits % WORD_LENGTH_BITS;
+    int lShift = WORD_LENGTH_BITS - rShift;
+    int index = _pBits / WORD_LENGTH_BITS;
+
+    // h = x >> k. x is shorter than 2k bits, so the last word it reads is
+    // at most x[2N - 1]
+    unsigned long high[H];
+    if(rShift > 0) {
+        for(int i = 0; i < H; i++) {
+            high[ i ] = (x[ index + i ] >> rShift) | (x[ index + i + 1 ] << lShift);
+        }
+    } else {
+        memcpy(high, &x[ index ], sizeof(high));
+    }
+
+    // l = x mod 2^k
+    memcpy(t, x, sizeof(unsigned long) * N);
+    memset(&t[ N ], 0, sizeof(unsigned long) * N);
+    if(rShift > 0) {
+        t[ N - 1 ] &= ((unsigned long)1 << rShift) - 1;
+    }
+
+    // Add h * c one word of c at a time. The carry out of each row goes into
+    // the words above it, which stay within 2N words because t < 2^(3k/2)
+    for(int j = 0; j < _cWords; j++) {
+        unsigned long carry = mulAdd<H>(high, _c[ j ], &t[ j ]);
+
+        for(int i = j + H; carry && i < 2 * N; i++) {
+            t[ i ] += carry;
+            carry = t[ i ] < carry ? 1 : 0;
+        }
+    }
+}
+
+/**
+ * Reduces a product of two residues mod P. After the first fold t < (c + 1)2^k
+ * and after the second t < 2^k + c^2 < 2P, so one subtraction is enough. The
+ * high part of the second fold is at most c, which is at most half of the
+ * words of P
+ */
+template<int N> void FpPseudoMersenne<N>::reduceModP(const unsigned long *x, unsigned long *c)
+{
+    unsigned long t[2 * N];
+    unsigned long u[2 * N];
+
+    fold<N>(x, t);
+    fold<(N + 1) / 2>(t, u);
+
+    // u can reach a word past P when P ends on a word boundary. The
+    // subtraction wraps it around
+    if(u[ N ] || greaterThanEqualTo<N>(u, _p)) {
+        sub<N>(u, _p, c);
+    } else {
+        memcpy(c, u, sizeof(unsigned long) * N);
+    }
+}
+
+/**
+ * Subtraction mod P
+ */
+template<int N> void FpPseudoMersenne<N>::subModP(const unsigned long *a, const unsigned long *b, unsigned long *diff)
+{
+    int borrow = sub<N>(a, b, diff);
+
+    // Check for negative
+    if(borrow) {
+        add<N>(diff, _p, diff);
+    }
+}
+
+/**
+ * Multiplication mod P
+ */
+template<int N> void FpPseudoMersenne<N>::multiplyModP(const unsigned long *a, const unsigned long *b, unsigned long *c)
+{
+    unsigned long product[N*2];
+    mul<N>(a, b, product);
+    reduceModP(product, c);
+}
+
+/**
+ * Square mod P
+ */
+template<int N> void FpPseudoMersenne<N>::squareModP(const unsigned long *a, unsigned long *aSquared)
+{
+    unsigned long product[N*2];
+
+    square<N>(a, product);
+    reduceModP(product, aSquared);
+}
+
+/**
+ * Modular inverse mod P
+ */
+template<int N> void FpPseudoMersenne<N>::inverseModP(const unsigned long *input, unsigned long *inverse)
+{
+    binaryInverse<N>(input, _p, inverse);
+}
+
+#endif
@@ -27,6 +27,14 @@ template<int N> void square(const unsigned long *a, unsigned long *product)
     mpn_sqr((long unsigned int*)product, (long unsigned int *)a, N);
 }
 
+/**
+ * Computes c = c + a * b where b is a single word. Returns the carry word
+ */
+template<int N> unsigned long mulAdd(const unsigned long *a, unsigned long b, unsigned long *c)
+{
+    return mpn_addmul_1((long unsigned int *)c, (const long unsigned int *)a, N, b);
+}
+
 /**
  * Returns true if a >= b
  */
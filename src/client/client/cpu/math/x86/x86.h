@@ -198,6 +198,22 @@ template<int N> void square(const unsigned long *a, unsigned long *product)
     }
 }
 
+/**
+ * Computes c = c + a * b where b is a single word. Returns the carry word
+ */
+template<int N> unsigned long mulAdd(const unsigned long *a, unsigned long b, unsigned long *c)
+{
+    unsigned long long carry = 0;
+
+    for(int i = 0; i < N; i++) {
+        unsigned long long t = (unsigned long long)a[i] * b + c[i] + carry;
+        c[i] = (unsigned long)t;
+        carry = t >> 32;
+    }
+
+    return (unsigned long)carry;
+}
+
 /**
  * Returns true if a >= b
  */
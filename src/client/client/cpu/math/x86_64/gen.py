@@ -0,0 +1,320 @@
+'''
+This program generates x86-64 assembly code for big integer arithmetic.
+
+The routines use the System V calling convention and 64-bit words. The
+multiplications use mulx, adcx and adox (BMI2 and ADX) so two carry chains
+can run at the same time.
+'''
+
+import sys
+
+# Scratch registers. The callee-saved ones are pushed when used
+SCRATCH = ["rax", "r10", "r11", "rbx", "rbp", "r12", "r13", "r14", "r15"]
+CALLEE_SAVED = ["rbx", "rbp", "r12", "r13", "r14", "r15"]
+
+def qword(reg, word):
+    if word == 0:
+        return "qword [%s]" % reg
+    return "qword [%s + %d]" % (reg, word * 8)
+
+def header(name):
+    print("global " + name)
+    print(name + ":")
+    print("")
+
+def push_regs(regs):
+    for r in regs:
+        if r in CALLEE_SAVED:
+            print("    push " + r)
+
+def pop_regs(regs):
+    for r in reversed(regs):
+        if r in CALLEE_SAVED:
+            print("    pop " + r)
+
+# Generate addition function. Returns the carry
+def gen_add(bits):
+    words = bits // 64
+
+    header("x64_add" + str(bits))
+
+    for i in range(words):
+        print("    mov rax, " + qword("rdi", i))
+        if i == 0:
+            print("    add rax, " + qword("rsi", i))
+        else:
+            print("    adc rax, " + qword("rsi", i))
+        print("    mov %s, rax" % qword("rdx", i))
+
+    print("    mov eax, 0")
+    print("    adc eax, 0")
+    print("    ret")
+    print("")
+
+# Generate subtraction function. Returns the borrow
+def gen_sub(bits):
+    words = bits // 64
+
+    header("x64_sub" + str(bits))
+
+    for i in range(words):
+        print("    mov rax, " + qword("rdi", i))
+        if i == 0:
+            print("    sub rax, " + qword("rsi", i))
+        else:
+            print("    sbb rax, " + qword("rsi", i))
+        print("    mov %s, rax" % qword("rdx", i))
+
+    print("    mov eax, 0")
+    print("    adc eax, 0")
+    print("    ret")
+    print("")
+
+# Emits the body of an aWords by bWords multiplication. a and b are pointers
+# to the operands and out is the pointer to the aWords + bWords result. The
+# product is accumulated one row (one word of b) at a time in a window of
+# registers; the low word of the window is written out after each row.
+def emit_multiply(a, b, out, aWords, bWords, regs):
+    window = regs[0:aWords + 1]
+    lo = regs[aWords + 1]
+    zero = regs[aWords + 2]
+
+    # First row: a * b[0]
+    print("    ; row 0")
+    print("    mov rdx, " + qword(b, 0))
+    print("    mulx %s, %s, %s" % (window[1], window[0], qword(a, 0)))
+    for i in range(1, aWords):
+        print("    mulx %s, %s, %s" % (window[i + 1], lo, qword(a, i)))
+        if i == 1:
+            print("    add %s, %s" % (window[i], lo))
+        else:
+            print("    adc %s, %s" % (window[i], lo))
+    if aWords > 1:
+        print("    adc %s, 0" % window[aWords])
+    print("    mov %s, %s" % (qword(out, 0), window[0]))
+
+    # The low register is free, it becomes the high word of the next row
+    window = window[1:] + [window[0]]
+
+    for j in range(1, bWords):
+        print("    ; row %d" % j)
+        print("    mov rdx, " + qword(b, j))
+
+        # Clears CF and OF
+        print("    xor %s, %s" % (zero, zero))
+
+        for i in range(aWords):
+            # The low word goes on the OF chain, the high word on the CF chain.
+            # The free register holds the high word and ends up as the top word
+            print("    mulx %s, %s, %s" % (window[aWords], lo, qword(a, i)))
+            print("    adox %s, %s" % (window[i], lo))
+            if i == aWords - 1:
+                print("    adcx %s, %s" % (window[aWords], zero))
+                print("    adox %s, %s" % (window[aWords], zero))
+            else:
+                print("    adcx %s, %s" % (window[i + 1], window[aWords]))
+
+        print("    mov %s, %s" % (qword(out, j), window[0]))
+        window = window[1:] + [window[0]]
+
+    # Write the remaining words
+    for i in range(aWords):
+        print("    mov %s, %s" % (qword(out, bWords + i), window[i]))
+
+# Generate multiplication function
+def gen_multiply(bits):
+    words = bits // 64
+
+    header("x64_mul" + str(bits))
+
+    regs = SCRATCH[0:words + 3]
+    push_regs(regs)
+
+    # rdx is used by mulx so move the output pointer
+    print("    mov rcx, rdx")
+    emit_multiply("rdi", "rsi", "rcx", words, words, regs)
+
+    pop_regs(regs)
+    print("    ret")
+    print("")
+
+# Performs N by 2N multiplication
+def gen_multiply2n(bits):
+    n1Words = bits // 64
+    n2Words = 2 * n1Words
+
+    header("x64_mul" + str(bits) + "_" + str(2 * bits))
+
+    # Put the longer operand in the window so there are fewer rows
+    regs = SCRATCH[0:n2Words + 3]
+    if len(regs) < n2Words + 3:
+        # Not enough registers, use the short operand for the window
+        regs = SCRATCH[0:n1Words + 3]
+        push_regs(regs)
+        print("    mov rcx, rdx")
+        emit_multiply("rdi", "rsi", "rcx", n1Words, n2Words, regs)
+    else:
+        push_regs(regs)
+        print("    mov rcx, rdx")
+        emit_multiply("rsi", "rdi", "rcx", n2Words, n1Words, regs)
+
+    pop_regs(regs)
+    print("    ret")
+    print("")
+
+# Squaring uses the multiplication routine with both operands the same
+def gen_square(bits):
+    header("x64_square" + str(bits))
+
+    print("    mov rdx, rsi")
+    print("    mov rsi, rdi")
+    print("    jmp x64_mul" + str(bits))
+    print("")
+
+# c = c + a * b where b is a single word. Returns the carry word
+def gen_muladd(bits):
+    words = bits // 64
+
+    header("x64_muladd" + str(bits))
+
+    # rdi = a, rsi = b, rdx = c
+    print("    mov rcx, rdx")
+    print("    mov rdx, rsi")
+
+    # r8 holds zero, r9/r10 alternate as the previous high word
+    print("    xor r8, r8")
+    print("    xor r9, r9")
+
+    hi = ["r10", "r9"]
+    for i in range(words):
+        prev = hi[(i + 1) % 2]
+        cur = hi[i % 2]
+        print("    mulx %s, rax, %s" % (cur, qword("rdi", i)))
+        print("    adcx rax, " + prev)
+        print("    adox rax, " + qword("rcx", i))
+        print("    mov %s, rax" % qword("rcx", i))
+
+    last = hi[(words - 1) % 2]
+    print("    mov rax, " + last)
+    print("    adcx rax, r8")
+    print("    adox rax, r8")
+    print("    ret")
+    print("")
+
+# Montgomery multiplication. c = a * b / 2^bits mod p, fused so the product
+# is reduced while it is being accumulated (CIOS). The arguments are
+# a, b, p, -p^-1 mod 2^64 and c. The result is fully reduced if a, b < p.
+def gen_montmul(bits):
+    words = bits // 64
+
+    header("x64_montmul" + str(bits))
+
+    regs = SCRATCH[0:words + 5]
+    t = regs[0:words + 2]
+    lo = regs[words + 2]
+    hi = regs[words + 3]
+    zero = regs[words + 4]
+
+    push_regs(regs)
+
+    # rdi = a, rsi = b, r9 = p, rcx = pInv, r8 = c
+    print("    mov r9, rdx")
+
+    for r in t:
+        print("    xor %s, %s" % (r, r))
+    print("    xor %s, %s" % (zero, zero))
+
+    for j in range(words):
+
+        # t = t + a * b[j]
+        print("    ; t += a * b[%d]" % j)
+        print("    mov rdx, " + qword("rsi", j))
+        print("    xor %s, %s" % (lo, lo))
+        for i in range(words):
+            print("    mulx %s, %s, %s" % (hi, lo, qword("rdi", i)))
+            print("    adox %s, %s" % (t[i], lo))
+            print("    adcx %s, %s" % (t[i + 1], hi))
+        print("    adox %s, %s" % (t[words], zero))
+        print("    adcx %s, %s" % (t[words + 1], zero))
+        print("    adox %s, %s" % (t[words + 1], zero))
+
+        # m = t[0] * pInv, t = (t + m * p) / 2^64
+        print("    ; t = (t + m * p) / 2^64")
+        print("    mov rdx, " + t[0])
+        print("    imul rdx, rcx")
+        print("    xor %s, %s" % (lo, lo))
+        for i in range(words):
+            print("    mulx %s, %s, %s" % (hi, lo, qword("r9", i)))
+            print("    adox %s, %s" % (t[i], lo))
+            print("    adcx %s, %s" % (t[i + 1], hi))
+        print("    adox %s, %s" % (t[words], zero))
+        print("    adcx %s, %s" % (t[words + 1], zero))
+        print("    adox %s, %s" % (t[words + 1], zero))
+
+        # t[0] is now zero and becomes the new top word
+        t = t[1:] + [t[0]]
+
+    # t < 2p. Subtract p and keep the original if it went negative
+    print("    ; conditional subtraction")
+    for i in range(words):
+        print("    mov %s, %s" % (qword("r8", i), t[i]))
+    for i in range(words):
+        if i == 0:
+            print("    sub %s, %s" % (t[i], qword("r9", i)))
+        else:
+            print("    sbb %s, %s" % (t[i], qword("r9", i)))
+    print("    sbb %s, 0" % t[words])
+    for i in range(words):
+        print("    cmovc %s, %s" % (t[i], qword("r8", i)))
+        print("    mov %s, %s" % (qword("r8", i), t[i]))
+
+    pop_regs(regs)
+    print("    ret")
+    print("")
+
+# Montgomery squaring using the multiplication routine. The arguments are
+# a, p, -p^-1 mod 2^64 and c
+def gen_montsquare(bits):
+    header("x64_montsquare" + str(bits))
+
+    print("    mov r8, rcx")
+    print("    mov rcx, rdx")
+    print("    mov rdx, rsi")
+    print("    mov rsi, rdi")
+    print("    jmp x64_montmul" + str(bits))
+    print("")
+
+def main():
+    if len(sys.argv) < 3:
+        print("Invalid arguments")
+        exit()
+
+    method = sys.argv[1]
+    bits = int(sys.argv[2])
+
+    if bits % 64 != 0:
+        print("Invalid length")
+        exit(1)
+
+    if method == "add":
+        gen_add(bits)
+    elif method == "sub":
+        gen_sub(bits)
+    elif method == "mul":
+        gen_multiply(bits)
+    elif method == "square":
+        gen_square(bits)
+    elif method == "mul2n":
+        gen_multiply2n(bits)
+    elif method == "muladd":
+        gen_muladd(bits)
+    elif method == "montmul":
+        gen_montmul(bits)
+    elif method == "montsquare":
+        gen_montsquare(bits)
+    else:
+        print("Invalid method")
+        exit(1)
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,1394 @@
+section .text
+global x64_add64
+x64_add64:
+
+    mov rax, qword [rdi]
+    add rax, qword [rsi]
+    mov qword [rdx], rax
+    mov eax, 0
+    adc eax, 0
+    ret
+
+global x64_sub64
+x64_sub64:
+
+    mov rax, qword [rdi]
+    sub rax, qword [rsi]
+    mov qword [rdx], rax
+    mov eax, 0
+    adc eax, 0
+    ret
+
+global x64_add128
+x64_add128:
+
+    mov rax, qword [rdi]
+    add rax, qword [rsi]
+    mov qword [rdx], rax
+    mov rax, qword [rdi + 8]
+    adc rax, qword [rsi + 8]
+    mov qword [rdx + 8], rax
+    mov eax, 0
+    adc eax, 0
+    ret
+
+global x64_sub128
+x64_sub128:
+
+    mov rax, qword [rdi]
+    sub rax, qword [rsi]
+    mov qword [rdx], rax
+    mov rax, qword [rdi + 8]
+    sbb rax, qword [rsi + 8]
+    mov qword [rdx + 8], rax
+    mov eax, 0
+    adc eax, 0
+    ret
+
+global x64_add192
+x64_add192:
+
+    mov rax, qword [rdi]
+    add rax, qword [rsi]
+    mov qword [rdx], rax
+    mov rax, qword [rdi + 8]
+    adc rax, qword [rsi + 8]
+    mov qword [rdx + 8], rax
+    mov rax, qword [rdi + 16]
+    adc rax, qword [rsi + 16]
+    mov qword [rdx + 16], rax
+    mov eax, 0
+    adc eax, 0
+    ret
+
+global x64_sub192
+x64_sub192:
+
+    mov rax, qword [rdi]
+    sub rax, qword [rsi]
+    mov qword [rdx], rax
+    mov rax, qword [rdi + 8]
+    sbb rax, qword [rsi + 8]
+    mov qword [rdx + 8], rax
+    mov rax, qword [rdi + 16]
+    sbb rax, qword [rsi + 16]
+    mov qword [rdx + 16], rax
+    mov eax, 0
+    adc eax, 0
+    ret
+
+global x64_add256
+x64_add256:
+
+    mov rax, qword [rdi]
+    add rax, qword [rsi]
+    mov qword [rdx], rax
+    mov rax, qword [rdi + 8]
+    adc rax, qword [rsi + 8]
+    mov qword [rdx + 8], rax
+    mov rax, qword [rdi + 16]
+    adc rax, qword [rsi + 16]
+    mov qword [rdx + 16], rax
+    mov rax, qword [rdi + 24]
+    adc rax, qword [rsi + 24]
+    mov qword [rdx + 24], rax
+    mov eax, 0
+    adc eax, 0
+    ret
+
+global x64_sub256
+x64_sub256:
+
+    mov rax, qword [rdi]
+    sub rax, qword [rsi]
+    mov qword [rdx], rax
+    mov rax, qword [rdi + 8]
+    sbb rax, qword [rsi + 8]
+    mov qword [rdx + 8], rax
+    mov rax, qword [rdi + 16]
+    sbb rax, qword [rsi + 16]
+    mov qword [rdx + 16], rax
+    mov rax, qword [rdi + 24]
+    sbb rax, qword [rsi + 24]
+    mov qword [rdx + 24], rax
+    mov eax, 0
+    adc eax, 0
+    ret
+
+global x64_add320
+x64_add320:
+
+    mov rax, qword [rdi]
+    add rax, qword [rsi]
+    mov qword [rdx], rax
+    mov rax, qword [rdi + 8]
+    adc rax, qword [rsi + 8]
+    mov qword [rdx + 8], rax
+    mov rax, qword [rdi + 16]
+    adc rax, qword [rsi + 16]
+    mov qword [rdx + 16], rax
+    mov rax, qword [rdi + 24]
+    adc rax, qword [rsi + 24]
+    mov qword [rdx + 24], rax
+    mov rax, qword [rdi + 32]
+    adc rax, qword [rsi + 32]
+    mov qword [rdx + 32], rax
+    mov eax, 0
+    adc eax, 0
+    ret
+
+global x64_sub320
+x64_sub320:
+
+    mov rax, qword [rdi]
+    sub rax, qword [rsi]
+    mov qword [rdx], rax
+    mov rax, qword [rdi + 8]
+    sbb rax, qword [rsi + 8]
+    mov qword [rdx + 8], rax
+    mov rax, qword [rdi + 16]
+    sbb rax, qword [rsi + 16]
+    mov qword [rdx + 16], rax
+    mov rax, qword [rdi + 24]
+    sbb rax, qword [rsi + 24]
+    mov qword [rdx + 24], rax
+    mov rax, qword [rdi + 32]
+    sbb rax, qword [rsi + 32]
+    mov qword [rdx + 32], rax
+    mov eax, 0
+    adc eax, 0
+    ret
+
+global x64_add384
+x64_add384:
+
+    mov rax, qword [rdi]
+    add rax, qword [rsi]
+    mov qword [rdx], rax
+    mov rax, qword [rdi + 8]
+    adc rax, qword [rsi + 8]
+    mov qword [rdx + 8], rax
+    mov rax, qword [rdi + 16]
+    adc rax, qword [rsi + 16]
+    mov qword [rdx + 16], rax
+    mov rax, qword [rdi + 24]
+    adc rax, qword [rsi + 24]
+    mov qword [rdx + 24], rax
+    mov rax, qword [rdi + 32]
+    adc rax, qword [rsi + 32]
+    mov qword [rdx + 32], rax
+    mov rax, qword [rdi + 40]
+    adc rax, qword [rsi + 40]
+    mov qword [rdx + 40], rax
+    mov eax, 0
+    adc eax, 0
+    ret
+
+global x64_sub384
+x64_sub384:
+
+    mov rax, qword [rdi]
+    sub rax, qword [rsi]
+    mov qword [rdx], rax
+    mov rax, qword [rdi + 8]
+    sbb rax, qword [rsi + 8]
+    mov qword [rdx + 8], rax
+    mov rax, qword [rdi + 16]
+    sbb rax, qword [rsi + 16]
+    mov qword [rdx + 16], rax
+    mov rax, qword [rdi + 24]
+    sbb rax, qword [rsi + 24]
+    mov qword [rdx + 24], rax
+    mov rax, qword [rdi + 32]
+    sbb rax, qword [rsi + 32]
+    mov qword [rdx + 32], rax
+    mov rax, qword [rdi + 40]
+    sbb rax, qword [rsi + 40]
+    mov qword [rdx + 40], rax
+    mov eax, 0
+    adc eax, 0
+    ret
+
+global x64_add448
+x64_add448:
+
+    mov rax, qword [rdi]
+    add rax, qword [rsi]
+    mov qword [rdx], rax
+    mov rax, qword [rdi + 8]
+    adc rax, qword [rsi + 8]
+    mov qword [rdx + 8], rax
+    mov rax, qword [rdi + 16]
+    adc rax, qword [rsi + 16]
+    mov qword [rdx + 16], rax
+    mov rax, qword [rdi + 24]
+    adc rax, qword [rsi + 24]
+    mov qword [rdx + 24], rax
+    mov rax, qword [rdi + 32]
+    adc rax, qword [rsi + 32]
+    mov qword [rdx + 32], rax
+    mov rax, qword [rdi + 40]
+    adc rax, qword [rsi + 40]
+    mov qword [rdx + 40], rax
+    mov rax, qword [rdi + 48]
+    adc rax, qword [rsi + 48]
+    mov qword [rdx + 48], rax
+    mov eax, 0
+    adc eax, 0
+    ret
+
+global x64_sub448
+x64_sub448:
+
+    mov rax, qword [rdi]
+    sub rax, qword [rsi]
+    mov qword [rdx], rax
+    mov rax, qword [rdi + 8]
+    sbb rax, qword [rsi + 8]
+    mov qword [rdx + 8], rax
+    mov rax, qword [rdi + 16]
+    sbb rax, qword [rsi + 16]
+    mov qword [rdx + 16], rax
+    mov rax, qword [rdi + 24]
+    sbb rax, qword [rsi + 24]
+    mov qword [rdx + 24], rax
+    mov rax, qword [rdi + 32]
+    sbb rax, qword [rsi + 32]
+    mov qword [rdx + 32], rax
+    mov rax, qword [rdi + 40]
+    sbb rax, qword [rsi + 40]
+    mov qword [rdx + 40], rax
+    mov rax, qword [rdi + 48]
+    sbb rax, qword [rsi + 48]
+    mov qword [rdx + 48], rax
+    mov eax, 0
+    adc eax, 0
+    ret
+
+global x64_add512
+x64_add512:
+
+    mov rax, qword [rdi]
+    add rax, qword [rsi]
+    mov qword [rdx], rax
+    mov rax, qword [rdi + 8]
+    adc rax, qword [rsi + 8]
+    mov qword [rdx + 8], rax
+    mov rax, qword [rdi + 16]
+    adc rax, qword [rsi + 16]
+    mov qword [rdx + 16], rax
+    mov rax, qword [rdi + 24]
+    adc rax, qword [rsi + 24]
+    mov qword [rdx + 24], rax
+    mov rax, qword [rdi + 32]
+    adc rax, qword [rsi + 32]
+    mov qword [rdx + 32], rax
+    mov rax, qword [rdi + 40]
+    adc rax, qword [rsi + 40]
+    mov qword [rdx + 40], rax
+    mov rax, qword [rdi + 48]
+    adc rax, qword [rsi + 48]
+    mov qword [rdx + 48], rax
+    mov rax, qword [rdi + 56]
+    adc rax, qword [rsi + 56]
+    mov qword [rdx + 56], rax
+    mov eax, 0
+    adc eax, 0
+    ret
+
+global x64_sub512
+x64_sub512:
+
+    mov rax, qword [rdi]
+    sub rax, qword [rsi]
+    mov qword [rdx], rax
+    mov rax, qword [rdi + 8]
+    sbb rax, qword [rsi + 8]
+    mov qword [rdx + 8], rax
+    mov rax, qword [rdi + 16]
+    sbb rax, qword [rsi + 16]
+    mov qword [rdx + 16], rax
+    mov rax, qword [rdi + 24]
+    sbb rax, qword [rsi + 24]
+    mov qword [rdx + 24], rax
+    mov rax, qword [rdi + 32]
+    sbb rax, qword [rsi + 32]
+    mov qword [rdx + 32], rax
+    mov rax, qword [rdi + 40]
+    sbb rax, qword [rsi + 40]
+    mov qword [rdx + 40], rax
+    mov rax, qword [rdi + 48]
+    sbb rax, qword [rsi + 48]
+    mov qword [rdx + 48], rax
+    mov rax, qword [rdi + 56]
+    sbb rax, qword [rsi + 56]
+    mov qword [rdx + 56], rax
+    mov eax, 0
+    adc eax, 0
+    ret
+
+global x64_mul64
+x64_mul64:
+
+    push rbx
+    mov rcx, rdx
+    ; row 0
+    mov rdx, qword [rsi]
+    mulx r10, rax, qword [rdi]
+    mov qword [rcx], rax
+    mov qword [rcx + 8], r10
+    pop rbx
+    ret
+
+global x64_square64
+x64_square64:
+
+    mov rdx, rsi
+    mov rsi, rdi
+    jmp x64_mul64
+
+global x64_mul64_128
+x64_mul64_128:
+
+    push rbx
+    push rbp
+    mov rcx, rdx
+    ; row 0
+    mov rdx, qword [rdi]
+    mulx r10, rax, qword [rsi]
+    mulx r11, rbx, qword [rsi + 8]
+    add r10, rbx
+    adc r11, 0
+    mov qword [rcx], rax
+    mov qword [rcx + 8], r10
+    mov qword [rcx + 16], r11
+    pop rbp
+    pop rbx
+    ret
+
+global x64_muladd64
+x64_muladd64:
+
+    mov rcx, rdx
+    mov rdx, rsi
+    xor r8, r8
+    xor r9, r9
+    mulx r10, rax, qword [rdi]
+    adcx rax, r9
+    adox rax, qword [rcx]
+    mov qword [rcx], rax
+    mov rax, r10
+    adcx rax, r8
+    adox rax, r8
+    ret
+
+global x64_montmul64
+x64_montmul64:
+
+    push rbx
+    push rbp
+    push r12
+    mov r9, rdx
+    xor rax, rax
+    xor r10, r10
+    xor r11, r11
+    xor r12, r12
+    ; t += a * b[0]
+    mov rdx, qword [rsi]
+    xor rbx, rbx
+    mulx rbp, rbx, qword [rdi]
+    adox rax, rbx
+    adcx r10, rbp
+    adox r10, r12
+    adcx r11, r12
+    adox r11, r12
+    ; t = (t + m * p) / 2^64
+    mov rdx, rax
+    imul rdx, rcx
+    xor rbx, rbx
+    mulx rbp, rbx, qword [r9]
+    adox rax, rbx
+    adcx r10, rbp
+    adox r10, r12
+    adcx r11, r12
+    adox r11, r12
+    ; conditional subtraction
+    mov qword [r8], r10
+    sub r10, qword [r9]
+    sbb r11, 0
+    cmovc r10, qword [r8]
+    mov qword [r8], r10
+    pop r12
+    pop rbp
+    pop rbx
+    ret
+
+global x64_montsquare64
+x64_montsquare64:
+
+    mov r8, rcx
+    mov rcx, rdx
+    mov rdx, rsi
+    mov rsi, rdi
+    jmp x64_montmul64
+
+global x64_mul128
+x64_mul128:
+
+    push rbx
+    push rbp
+    mov rcx, rdx
+    ; row 0
+    mov rdx, qword [rsi]
+    mulx r10, rax, qword [rdi]
+    mulx r11, rbx, qword [rdi + 8]
+    add r10, rbx
+    adc r11, 0
+    mov qword [rcx], rax
+    ; row 1
+    mov rdx, qword [rsi + 8]
+    xor rbp, rbp
+    mulx rax, rbx, qword [rdi]
+    adox r10, rbx
+    adcx r11, rax
+    mulx rax, rbx, qword [rdi + 8]
+    adox r11, rbx
+    adcx rax, rbp
+    adox rax, rbp
+    mov qword [rcx + 8], r10
+    mov qword [rcx + 16], r11
+    mov qword [rcx + 24], rax
+    pop rbp
+    pop rbx
+    ret
+
+global x64_square128
+x64_square128:
+
+    mov rdx, rsi
+    mov rsi, rdi
+    jmp x64_mul128
+
+global x64_mul128_256
+x64_mul128_256:
+
+    push rbx
+    push rbp
+    push r12
+    push r13
+    mov rcx, rdx
+    ; row 0
+    mov rdx, qword [rdi]
+    mulx r10, rax, qword [rsi]
+    mulx r11, r12, qword [rsi + 8]
+    add r10, r12
+    mulx rbx, r12, qword [rsi + 16]
+    adc r11, r12
+    mulx rbp, r12, qword [rsi + 24]
+    adc rbx, r12
+    adc rbp, 0
+    mov qword [rcx], rax
+    ; row 1
+    mov rdx, qword [rdi + 8]
+    xor r13, r13
+    mulx rax, r12, qword [rsi]
+    adox r10, r12
+    adcx r11, rax
+    mulx rax, r12, qword [rsi + 8]
+    adox r11, r12
+    adcx rbx, rax
+    mulx rax, r12, qword [rsi + 16]
+    adox rbx, r12
+    adcx rbp, rax
+    mulx rax, r12, qword [rsi + 24]
+    adox rbp, r12
+    adcx rax, r13
+    adox rax, r13
+    mov qword [rcx + 8], r10
+    mov qword [rcx + 16], r11
+    mov qword [rcx + 24], rbx
+    mov qword [rcx + 32], rbp
+    mov qword [rcx + 40], rax
+    pop r13
+    pop r12
+    pop rbp
+    pop rbx
+    ret
+
+global x64_muladd128
+x64_muladd128:
+
+    mov rcx, rdx
+    mov rdx, rsi
+    xor r8, r8
+    xor r9, r9
+    mulx r10, rax, qword [rdi]
+    adcx rax, r9
+    adox rax, qword [rcx]
+    mov qword [rcx], rax
+    mulx r9, rax, qword [rdi + 8]
+    adcx rax, r10
+    adox rax, qword [rcx + 8]
+    mov qword [rcx + 8], rax
+    mov rax, r9
+    adcx rax, r8
+    adox rax, r8
+    ret
+
+global x64_montmul128
+x64_montmul128:
+
+    push rbx
+    push rbp
+    push r12
+    push r13
+    mov r9, rdx
+    xor rax, rax
+    xor r10, r10
+    xor r11, r11
+    xor rbx, rbx
+    xor r13, r13
+    ; t += a * b[0]
+    mov rdx, qword [rsi]
+    xor rbp, rbp
+    mulx r12, rbp, qword [rdi]
+    adox rax, rbp
+    adcx r10, r12
+    mulx r12, rbp, qword [rdi + 8]
+    adox r10, rbp
+    adcx r11, r12
+    adox r11, r13
+    adcx rbx, r13
+    adox rbx, r13
+    ; t = (t + m * p) / 2^64
+    mov rdx, rax
+    imul rdx, rcx
+    xor rbp, rbp
+    mulx r12, rbp, qword [r9]
+    adox rax, rbp
+    adcx r10, r12
+    mulx r12, rbp, qword [r9 + 8]
+    adox r10, rbp
+    adcx r11, r12
+    adox r11, r13
+    adcx rbx, r13
+    adox rbx, r13
+    ; t += a * b[1]
+    mov rdx, qword [rsi + 8]
+    xor rbp, rbp
+    mulx r12, rbp, qword [rdi]
+    adox r10, rbp
+    adcx r11, r12
+    mulx r12, rbp, qword [rdi + 8]
+    adox r11, rbp
+    adcx rbx, r12
+    adox rbx, r13
+    adcx rax, r13
+    adox rax, r13
+    ; t = (t + m * p) / 2^64
+    mov rdx, r10
+    imul rdx, rcx
+    xor rbp, rbp
+    mulx r12, rbp, qword [r9]
+    adox r10, rbp
+    adcx r11, r12
+    mulx r12, rbp, qword [r9 + 8]
+    adox r11, rbp
+    adcx rbx, r12
+    adox rbx, r13
+    adcx rax, r13
+    adox rax, r13
+    ; conditional subtraction
+    mov qword [r8], r11
+    mov qword [r8 + 8], rbx
+    sub r11, qword [r9]
+    sbb rbx, qword [r9 + 8]
+    sbb rax, 0
+    cmovc r11, qword [r8]
+    mov qword [r8], r11
+    cmovc rbx, qword [r8 + 8]
+    mov qword [r8 + 8], rbx
+    pop r13
+    pop r12
+    pop rbp
+    pop rbx
+    ret
+
+global x64_montsquare128
+x64_montsquare128:
+
+    mov r8, rcx
+    mov rcx, rdx
+    mov rdx, rsi
+    mov rsi, rdi
+    jmp x64_montmul128
+
+global x64_mul192
+x64_mul192:
+
+    push rbx
+    push rbp
+    push r12
+    mov rcx, rdx
+    ; row 0
+    mov rdx, qword [rsi]
+    mulx r10, rax, qword [rdi]
+    mulx r11, rbp, qword [rdi + 8]
+    add r10, rbp
+    mulx rbx, rbp, qword [rdi + 16]
+    adc r11, rbp
+    adc rbx, 0
+    mov qword [rcx], rax
+    ; row 1
+    mov rdx, qword [rsi + 8]
+    xor r12, r12
+    mulx rax, rbp, qword [rdi]
+    adox r10, rbp
+    adcx r11, rax
+    mulx rax, rbp, qword [rdi + 8]
+    adox r11, rbp
+    adcx rbx, rax
+    mulx rax, rbp, qword [rdi + 16]
+    adox rbx, rbp
+    adcx rax, r12
+    adox rax, r12
+    mov qword [rcx + 8], r10
+    ; row 2
+    mov rdx, qword [rsi + 16]
+    xor r12, r12
+    mulx r10, rbp, qword [rdi]
+    adox r11, rbp
+    adcx rbx, r10
+    mulx r10, rbp, qword [rdi + 8]
+    adox rbx, rbp
+    adcx rax, r10
+    mulx r10, rbp, qword [rdi + 16]
+    adox rax, rbp
+    adcx r10, r12
+    adox r10, r12
+    mov qword [rcx + 16], r11
+    mov qword [rcx + 24], rbx
+    mov qword [rcx + 32], rax
+    mov qword [rcx + 40], r10
+    pop r12
+    pop rbp
+    pop rbx
+    ret
+
+global x64_square192
+x64_square192:
+
+    mov rdx, rsi
+    mov rsi, rdi
+    jmp x64_mul192
+
+global x64_mul192_384
+x64_mul192_384:
+
+    push rbx
+    push rbp
+    push r12
+    push r13
+    push r14
+    push r15
+    mov rcx, rdx
+    ; row 0
+    mov rdx, qword [rdi]
+    mulx r10, rax, qword [rsi]
+    mulx r11, r14, qword [rsi + 8]
+    add r10, r14
+    mulx rbx, r14, qword [rsi + 16]
+    adc r11, r14
+    mulx rbp, r14, qword [rsi + 24]
+    adc rbx, r14
+    mulx r12, r14, qword [rsi + 32]
+    adc rbp, r14
+    mulx r13, r14, qword [rsi + 40]
+    adc r12, r14
+    adc r13, 0
+    mov qword [rcx], rax
+    ; row 1
+    mov rdx, qword [rdi + 8]
+    xor r15, r15
+    mulx rax, r14, qword [rsi]
+    adox r10, r14
+    adcx r11, rax
+    mulx rax, r14, qword [rsi + 8]
+    adox r11, r14
+    adcx rbx, rax
+    mulx rax, r14, qword [rsi + 16]
+    adox rbx, r14
+    adcx rbp, rax
+    mulx rax, r14, qword [rsi + 24]
+    adox rbp, r14
+    adcx r12, rax
+    mulx rax, r14, qword [rsi + 32]
+    adox r12, r14
+    adcx r13, rax
+    mulx rax, r14, qword [rsi + 40]
+    adox r13, r14
+    adcx rax, r15
+    adox rax, r15
+    mov qword [rcx + 8], r10
+    ; row 2
+    mov rdx, qword [rdi + 16]
+    xor r15, r15
+    mulx r10, r14, qword [rsi]
+    adox r11, r14
+    adcx rbx, r10
+    mulx r10, r14, qword [rsi + 8]
+    adox rbx, r14
+    adcx rbp, r10
+    mulx r10, r14, qword [rsi + 16]
+    adox rbp, r14
+    adcx r12, r10
+    mulx r10, r14, qword [rsi + 24]
+    adox r12, r14
+    adcx r13, r10
+    mulx r10, r14, qword [rsi + 32]
+    adox r13, r14
+    adcx rax, r10
+    mulx r10, r14, qword [rsi + 40]
+    adox rax, r14
+    adcx r10, r15
+    adox r10, r15
+    mov qword [rcx + 16], r11
+    mov qword [rcx + 24], rbx
+    mov qword [rcx + 32], rbp
+    mov qword [rcx + 40], r12
+    mov qword [rcx + 48], r13
+    mov qword [rcx + 56], rax
+    mov qword [rcx + 64], r10
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop rbp
+    pop rbx
+    ret
+
+global x64_muladd192
+x64_muladd192:
+
+    mov rcx, rdx
+    mov rdx, rsi
+    xor r8, r8
+    xor r9, r9
+    mulx r10, rax, qword [rdi]
+    adcx rax, r9
+    adox rax, qword [rcx]
+    mov qword [rcx], rax
+    mulx r9, rax, qword [rdi + 8]
+    adcx rax, r10
+    adox rax, qword [rcx + 8]
+    mov qword [rcx + 8], rax
+    mulx r10, rax, qword [rdi + 16]
+    adcx rax, r9
+    adox rax, qword [rcx + 16]
+    mov qword [rcx + 16], rax
+    mov rax, r10
+    adcx rax, r8
+    adox rax, r8
+    ret
+
+global x64_montmul192
+x64_montmul192:
+
+    push rbx
+    push rbp
+    push r12
+    push r13
+    push r14
+    mov r9, rdx
+    xor rax, rax
+    xor r10, r10
+    xor r11, r11
+    xor rbx, rbx
+    xor rbp, rbp
+    xor r14, r14
+    ; t += a * b[0]
+    mov rdx, qword [rsi]
+    xor r12, r12
+    mulx r13, r12, qword [rdi]
+    adox rax, r12
+    adcx r10, r13
+    mulx r13, r12, qword [rdi + 8]
+    adox r10, r12
+    adcx r11, r13
+    mulx r13, r12, qword [rdi + 16]
+    adox r11, r12
+    adcx rbx, r13
+    adox rbx, r14
+    adcx rbp, r14
+    adox rbp, r14
+    ; t = (t + m * p) / 2^64
+    mov rdx, rax
+    imul rdx, rcx
+    xor r12, r12
+    mulx r13, r12, qword [r9]
+    adox rax, r12
+    adcx r10, r13
+    mulx r13, r12, qword [r9 + 8]
+    adox r10, r12
+    adcx r11, r13
+    mulx r13, r12, qword [r9 + 16]
+    adox r11, r12
+    adcx rbx, r13
+    adox rbx, r14
+    adcx rbp, r14
+    adox rbp, r14
+    ; t += a * b[1]
+    mov rdx, qword [rsi + 8]
+    xor r12, r12
+    mulx r13, r12, qword [rdi]
+    adox r10, r12
+    adcx r11, r13
+    mulx r13, r12, qword [rdi + 8]
+    adox r11, r12
+    adcx rbx, r13
+    mulx r13, r12, qword [rdi + 16]
+    adox rbx, r12
+    adcx rbp, r13
+    adox rbp, r14
+    adcx rax, r14
+    adox rax, r14
+    ; t = (t + m * p) / 2^64
+    mov rdx, r10
+    imul rdx, rcx
+    xor r12, r12
+    mulx r13, r12, qword [r9]
+    adox r10, r12
+    adcx r11, r13
+    mulx r13, r12, qword [r9 + 8]
+    adox r11, r12
+    adcx rbx, r13
+    mulx r13, r12, qword [r9 + 16]
+    adox rbx, r12
+    adcx rbp, r13
+    adox rbp, r14
+    adcx rax, r14
+    adox rax, r14
+    ; t += a * b[2]
+    mov rdx, qword [rsi + 16]
+    xor r12, r12
+    mulx r13, r12, qword [rdi]
+    adox r11, r12
+    adcx rbx, r13
+    mulx r13, r12, qword [rdi + 8]
+    adox rbx, r12
+    adcx rbp, r13
+    mulx r13, r12, qword [rdi + 16]
+    adox rbp, r12
+    adcx rax, r13
+    adox rax, r14
+    adcx r10, r14
+    adox r10, r14
+    ; t = (t + m * p) / 2^64
+    mov rdx, r11
+    imul rdx, rcx
+    xor r12, r12
+    mulx r13, r12, qword [r9]
+    adox r11, r12
+    adcx rbx, r13
+    mulx r13, r12, qword [r9 + 8]
+    adox rbx, r12
+    adcx rbp, r13
+    mulx r13, r12, qword [r9 + 16]
+    adox rbp, r12
+    adcx rax, r13
+    adox rax, r14
+    adcx r10, r14
+    adox r10, r14
+    ; conditional subtraction
+    mov qword [r8], rbx
+    mov qword [r8 + 8], rbp
+    mov qword [r8 + 16], rax
+    sub rbx, qword [r9]
+    sbb rbp, qword [r9 + 8]
+    sbb rax, qword [r9 + 16]
+    sbb r10, 0
+    cmovc rbx, qword [r8]
+    mov qword [r8], rbx
+    cmovc rbp, qword [r8 + 8]
+    mov qword [r8 + 8], rbp
+    cmovc rax, qword [r8 + 16]
+    mov qword [r8 + 16], rax
+    pop r14
+    pop r13
+    pop r12
+    pop rbp
+    pop rbx
+    ret
+
+global x64_montsquare192
+x64_montsquare192:
+
+    mov r8, rcx
+    mov rcx, rdx
+    mov rdx, rsi
+    mov rsi, rdi
+    jmp x64_montmul192
+
+global x64_mul256
+x64_mul256:
+
+    push rbx
+    push rbp
+    push r12
+    push r13
+    mov rcx, rdx
+    ; row 0
+    mov rdx, qword [rsi]
+    mulx r10, rax, qword [rdi]
+    mulx r11, r12, qword [rdi + 8]
+    add r10, r12
+    mulx rbx, r12, qword [rdi + 16]
+    adc r11, r12
+    mulx rbp, r12, qword [rdi + 24]
+    adc rbx, r12
+    adc rbp, 0
+    mov qword [rcx], rax
+    ; row 1
+    mov rdx, qword [rsi + 8]
+    xor r13, r13
+    mulx rax, r12, qword [rdi]
+    adox r10, r12
+    adcx r11, rax
+    mulx rax, r12, qword [rdi + 8]
+    adox r11, r12
+    adcx rbx, rax
+    mulx rax, r12, qword [rdi + 16]
+    adox rbx, r12
+    adcx rbp, rax
+    mulx rax, r12, qword [rdi + 24]
+    adox rbp, r12
+    adcx rax, r13
+    adox rax, r13
+    mov qword [rcx + 8], r10
+    ; row 2
+    mov rdx, qword [rsi + 16]
+    xor r13, r13
+    mulx r10, r12, qword [rdi]
+    adox r11, r12
+    adcx rbx, r10
+    mulx r10, r12, qword [rdi + 8]
+    adox rbx, r12
+    adcx rbp, r10
+    mulx r10, r12, qword [rdi + 16]
+    adox rbp, r12
+    adcx rax, r10
+    mulx r10, r12, qword [rdi + 24]
+    adox rax, r12
+    adcx r10, r13
+    adox r10, r13
+    mov qword [rcx + 16], r11
+    ; row 3
+    mov rdx, qword [rsi + 24]
+    xor r13, r13
+    mulx r11, r12, qword [rdi]
+    adox rbx, r12
+    adcx rbp, r11
+    mulx r11, r12, qword [rdi + 8]
+    adox rbp, r12
+    adcx rax, r11
+    mulx r11, r12, qword [rdi + 16]
+    adox rax, r12
+    adcx r10, r11
+    mulx r11, r12, qword [rdi + 24]
+    adox r10, r12
+    adcx r11, r13
+    adox r11, r13
+    mov qword [rcx + 24], rbx
+    mov qword [rcx + 32], rbp
+    mov qword [rcx + 40], rax
+    mov qword [rcx + 48], r10
+    mov qword [rcx + 56], r11
+    pop r13
+    pop r12
+    pop rbp
+    pop rbx
+    ret
+
+global x64_square256
+x64_square256:
+
+    mov rdx, rsi
+    mov rsi, rdi
+    jmp x64_mul256
+
+global x64_mul256_512
+x64_mul256_512:
+
+    push rbx
+    push rbp
+    push r12
+    push r13
+    mov rcx, rdx
+    ; row 0
+    mov rdx, qword [rsi]
+    mulx r10, rax, qword [rdi]
+    mulx r11, r12, qword [rdi + 8]
+    add r10, r12
+    mulx rbx, r12, qword [rdi + 16]
+    adc r11, r12
+    mulx rbp, r12, qword [rdi + 24]
+    adc rbx, r12
+    adc rbp, 0
+    mov qword [rcx], rax
+    ; row 1
+    mov rdx, qword [rsi + 8]
+    xor r13, r13
+    mulx rax, r12, qword [rdi]
+    adox r10, r12
+    adcx r11, rax
+    mulx rax, r12, qword [rdi + 8]
+    adox r11, r12
+    adcx rbx, rax
+    mulx rax, r12, qword [rdi + 16]
+    adox rbx, r12
+    adcx rbp, rax
+    mulx rax, r12, qword [rdi + 24]
+    adox rbp, r12
+    adcx rax, r13
+    adox rax, r13
+    mov qword [rcx + 8], r10
+    ; row 2
+    mov rdx, qword [rsi + 16]
+    xor r13, r13
+    mulx r10, r12, qword [rdi]
+    adox r11, r12
+    adcx rbx, r10
+    mulx r10, r12, qword [rdi + 8]
+    adox rbx, r12
+    adcx rbp, r10
+    mulx r10, r12, qword [rdi + 16]
+    adox rbp, r12
+    adcx rax, r10
+    mulx r10, r12, qword [rdi + 24]
+    adox rax, r12
+    adcx r10, r13
+    adox r10, r13
+    mov qword [rcx + 16], r11
+    ; row 3
+    mov rdx, qword [rsi + 24]
+    xor r13, r13
+    mulx r11, r12, qword [rdi]
+    adox rbx, r12
+    adcx rbp, r11
+    mulx r11, r12, qword [rdi + 8]
+    adox rbp, r12
+    adcx rax, r11
+    mulx r11, r12, qword [rdi + 16]
+    adox rax, r12
+    adcx r10, r11
+    mulx r11, r12, qword [rdi + 24]
+    adox r10, r12
+    adcx r11, r13
+    adox r11, r13
+    mov qword [rcx + 24], rbx
+    ; row 4
+    mov rdx, qword [rsi + 32]
+    xor r13, r13
+    mulx rbx, r12, qword [rdi]
+    adox rbp, r12
+    adcx rax, rbx
+    mulx rbx, r12, qword [rdi + 8]
+    adox rax, r12
+    adcx r10, rbx
+    mulx rbx, r12, qword [rdi + 16]
+    adox r10, r12
+    adcx r11, rbx
+    mulx rbx, r12, qword [rdi + 24]
+    adox r11, r12
+    adcx rbx, r13
+    adox rbx, r13
+    mov qword [rcx + 32], rbp
+    ; row 5
+    mov rdx, qword [rsi + 40]
+    xor r13, r13
+    mulx rbp, r12, qword [rdi]
+    adox rax, r12
+    adcx r10, rbp
+    mulx rbp, r12, qword [rdi + 8]
+    adox r10, r12
+    adcx r11, rbp
+    mulx rbp, r12, qword [rdi + 16]
+    adox r11, r12
+    adcx rbx, rbp
+    mulx rbp, r12, qword [rdi + 24]
+    adox rbx, r12
+    adcx rbp, r13
+    adox rbp, r13
+    mov qword [rcx + 40], rax
+    ; row 6
+    mov rdx, qword [rsi + 48]
+    xor r13, r13
+    mulx rax, r12, qword [rdi]
+    adox r10, r12
+    adcx r11, rax
+    mulx rax, r12, qword [rdi + 8]
+    adox r11, r12
+    adcx rbx, rax
+    mulx rax, r12, qword [rdi + 16]
+    adox rbx, r12
+    adcx rbp, rax
+    mulx rax, r12, qword [rdi + 24]
+    adox rbp, r12
+    adcx rax, r13
+    adox rax, r13
+    mov qword [rcx + 48], r10
+    ; row 7
+    mov rdx, qword [rsi + 56]
+    xor r13, r13
+    mulx r10, r12, qword [rdi]
+    adox r11, r12
+    adcx rbx, r10
+    mulx r10, r12, qword [rdi + 8]
+    adox rbx, r12
+    adcx rbp, r10
+    mulx r10, r12, qword [rdi + 16]
+    adox rbp, r12
+    adcx rax, r10
+    mulx r10, r12, qword [rdi + 24]
+    adox rax, r12
+    adcx r10, r13
+    adox r10, r13
+    mov qword [rcx + 56], r11
+    mov qword [rcx + 64], rbx
+    mov qword [rcx + 72], rbp
+    mov qword [rcx + 80], rax
+    mov qword [rcx + 88], r10
+    pop r13
+    pop r12
+    pop rbp
+    pop rbx
+    ret
+
+global x64_muladd256
+x64_muladd256:
+
+    mov rcx, rdx
+    mov rdx, rsi
+    xor r8, r8
+    xor r9, r9
+    mulx r10, rax, qword [rdi]
+    adcx rax, r9
+    adox rax, qword [rcx]
+    mov qword [rcx], rax
+    mulx r9, rax, qword [rdi + 8]
+    adcx rax, r10
+    adox rax, qword [rcx + 8]
+    mov qword [rcx + 8], rax
+    mulx r10, rax, qword [rdi + 16]
+    adcx rax, r9
+    adox rax, qword [rcx + 16]
+    mov qword [rcx + 16], rax
+    mulx r9, rax, qword [rdi + 24]
+    adcx rax, r10
+    adox rax, qword [rcx + 24]
+    mov qword [rcx + 24], rax
+    mov rax, r9
+    adcx rax, r8
+    adox rax, r8
+    ret
+
+global x64_montmul256
+x64_montmul256:
+
+    push rbx
+    push rbp
+    push r12
+    push r13
+    push r14
+    push r15
+    mov r9, rdx
+    xor rax, rax
+    xor r10, r10
+    xor r11, r11
+    xor rbx, rbx
+    xor rbp, rbp
+    xor r12, r12
+    xor r15, r15
+    ; t += a * b[0]
+    mov rdx, qword [rsi]
+    xor r13, r13
+    mulx r14, r13, qword [rdi]
+    adox rax, r13
+    adcx r10, r14
+    mulx r14, r13, qword [rdi + 8]
+    adox r10, r13
+    adcx r11, r14
+    mulx r14, r13, qword [rdi + 16]
+    adox r11, r13
+    adcx rbx, r14
+    mulx r14, r13, qword [rdi + 24]
+    adox rbx, r13
+    adcx rbp, r14
+    adox rbp, r15
+    adcx r12, r15
+    adox r12, r15
+    ; t = (t + m * p) / 2^64
+    mov rdx, rax
+    imul rdx, rcx
+    xor r13, r13
+    mulx r14, r13, qword [r9]
+    adox rax, r13
+    adcx r10, r14
+    mulx r14, r13, qword [r9 + 8]
+    adox r10, r13
+    adcx r11, r14
+    mulx r14, r13, qword [r9 + 16]
+    adox r11, r13
+    adcx rbx, r14
+    mulx r14, r13, qword [r9 + 24]
+    adox rbx, r13
+    adcx rbp, r14
+    adox rbp, r15
+    adcx r12, r15
+    adox r12, r15
+    ; t += a * b[1]
+    mov rdx, qword [rsi + 8]
+    xor r13, r13
+    mulx r14, r13, qword [rdi]
+    adox r10, r13
+    adcx r11, r14
+    mulx r14, r13, qword [rdi + 8]
+    adox r11, r13
+    adcx rbx, r14
+    mulx r14, r13, qword [rdi + 16]
+    adox rbx, r13
+    adcx rbp, r14
+    mulx r14, r13, qword [rdi + 24]
+    adox rbp, r13
+    adcx r12, r14
+    adox r12, r15
+    adcx rax, r15
+    adox rax, r15
+    ; t = (t + m * p) / 2^64
+    mov rdx, r10
+    imul rdx, rcx
+    xor r13, r13
+    mulx r14, r13, qword [r9]
+    adox r10, r13
+    adcx r11, r14
+    mulx r14, r13, qword [r9 + 8]
+    adox r11, r13
+    adcx rbx, r14
+    mulx r14, r13, qword [r9 + 16]
+    adox rbx, r13
+    adcx rbp, r14
+    mulx r14, r13, qword [r9 + 24]
+    adox rbp, r13
+    adcx r12, r14
+    adox r12, r15
+    adcx rax, r15
+    adox rax, r15
+    ; t += a * b[2]
+    mov rdx, qword [rsi + 16]
+    xor r13, r13
+    mulx r14, r13, qword [rdi]
+    adox r11, r13
+    adcx rbx, r14
+    mulx r14, r13, qword [rdi + 8]
+    adox rbx, r13
+    adcx rbp, r14
+    mulx r14, r13, qword [rdi + 16]
+    adox rbp, r13
+    adcx r12, r14
+    mulx r14, r13, qword [rdi + 24]
+    adox r12, r13
+    adcx rax, r14
+    adox rax, r15
+    adcx r10, r15
+    adox r10, r15
+    ; t = (t + m * p) / 2^64
+    mov rdx, r11
+    imul rdx, rcx
+    xor r13, r13
+    mulx r14, r13, qword [r9]
+    adox r11, r13
+    adcx rbx, r14
+    mulx r14, r13, qword [r9 + 8]
+    adox rbx, r13
+    adcx rbp, r14
+    mulx r14, r13, qword [r9 + 16]
+    adox rbp, r13
+    adcx r12, r14
+    mulx r14, r13, qword [r9 + 24]
+    adox r12, r13
+    adcx rax, r14
+    adox rax, r15
+    adcx r10, r15
+    adox r10, r15
+    ; t += a * b[3]
+    mov rdx, qword [rsi + 24]
+    xor r13, r13
+    mulx r14, r13, qword [rdi]
+    adox rbx, r13
+    adcx rbp, r14
+    mulx r14, r13, qword [rdi + 8]
+    adox rbp, r13
+    adcx r12, r14
+    mulx r14, r13, qword [rdi + 16]
+    adox r12, r13
+    adcx rax, r14
+    mulx r14, r13, qword [rdi + 24]
+    adox rax, r13
+    adcx r10, r14
+    adox r10, r15
+    adcx r11, r15
+    adox r11, r15
+    ; t = (t + m * p) / 2^64
+    mov rdx, rbx
+    imul rdx, rcx
+    xor r13, r13
+    mulx r14, r13, qword [r9]
+    adox rbx, r13
+    adcx rbp, r14
+    mulx r14, r13, qword [r9 + 8]
+    adox rbp, r13
+    adcx r12, r14
+    mulx r14, r13, qword [r9 + 16]
+    adox r12, r13
+    adcx rax, r14
+    mulx r14, r13, qword [r9 + 24]
+    adox rax, r13
+    adcx r10, r14
+    adox r10, r15
+    adcx r11, r15
+    adox r11, r15
+    ; conditional subtraction
+    mov qword [r8], rbp
+    mov qword [r8 + 8], r12
+    mov qword [r8 + 16], rax
+    mov qword [r8 + 24], r10
+    sub rbp, qword [r9]
+    sbb r12, qword [r9 + 8]
+    sbb rax, qword [r9 + 16]
+    sbb r10, qword [r9 + 24]
+    sbb r11, 0
+    cmovc rbp, qword [r8]
+    mov qword [r8], rbp
+    cmovc r12, qword [r8 + 8]
+    mov qword [r8 + 8], r12
+    cmovc rax, qword [r8 + 16]
+    mov qword [r8 + 16], rax
+    cmovc r10, qword [r8 + 24]
+    mov qword [r8 + 24], r10
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop rbp
+    pop rbx
+    ret
+
+global x64_montsquare256
+x64_montsquare256:
+
+    mov r8, rcx
+    mov rcx, rdx
+    mov rdx, rsi
+    mov rsi, rdi
+    jmp x64_montmul256
+
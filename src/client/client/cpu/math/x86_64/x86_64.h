@@ -0,0 +1,308 @@
+#ifndef _FP_X86_64_H
+#define _FP_X86_64_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gmp.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ Declarations for x86-64 assembly routines. The multiplications require BMI2 and ADX.
+ Addition and subtraction are generated up to 512 bits and the rest up to 256 bits;
+ longer integers use the GMP mpn routines
+ */
+int x64_sub64(const unsigned long *a, const unsigned long *b, unsigned long *diff);
+int x64_sub128(const unsigned long *a, const unsigned long *b, unsigned long *diff);
+int x64_sub192(const unsigned long *a, const unsigned long *b, unsigned long *diff);
+int x64_sub256(const unsigned long *a, const unsigned long *b, unsigned long *diff);
+int x64_sub320(const unsigned long *a, const unsigned long *b, unsigned long *diff);
+int x64_sub384(const unsigned long *a, const unsigned long *b, unsigned long *diff);
+int x64_sub448(const unsigned long *a, const unsigned long *b, unsigned long *diff);
+int x64_sub512(const unsigned long *a, const unsigned long *b, unsigned long *diff);
+
+void x64_add64(const unsigned long *a, const unsigned long *b, unsigned long *sum);
+void x64_add128(const unsigned long *a, const unsigned long *b, unsigned long *sum);
+void x64_add192(const unsigned long *a, const unsigned long *b, unsigned long *sum);
+void x64_add256(const unsigned long *a, const unsigned long *b, unsigned long *sum);
+void x64_add320(const unsigned long *a, const unsigned long *b, unsigned long *sum);
+void x64_add384(const unsigned long *a, const unsigned long *b, unsigned long *sum);
+void x64_add448(const unsigned long *a, const unsigned long *b, unsigned long *sum);
+void x64_add512(const unsigned long *a, const unsigned long *b, unsigned long *sum);
+
+void x64_mul64(const unsigned long *a, const unsigned long *b, unsigned long *product);
+void x64_mul128(const unsigned long *a, const unsigned long *b, unsigned long *product);
+void x64_mul192(const unsigned long *a, const unsigned long *b, unsigned long *product);
+void x64_mul256(const unsigned long *a, const unsigned long *b, unsigned long *product);
+
+void x64_mul64_128(const unsigned long *a, const unsigned long *b, unsigned long *product);
+void x64_mul128_256(const unsigned long *a, const unsigned long *b, unsigned long *product);
+void x64_mul192_384(const unsigned long *a, const unsigned long *b, unsigned long *product);
+void x64_mul256_512(const unsigned long *a, const unsigned long *b, unsigned long *product);
+
+void x64_square64(const unsigned long *a, unsigned long *product);
+void x64_square128(const unsigned long *a, unsigned long *product);
+void x64_square192(const unsigned long *a, unsigned long *product);
+void x64_square256(const unsigned long *a, unsigned long *product);
+
+unsigned long x64_muladd64(const unsigned long *a, unsigned long b, unsigned long *c);
+unsigned long x64_muladd128(const unsigned long *a, unsigned long b, unsigned long *c);
+unsigned long x64_muladd192(const unsigned long *a, unsigned long b, unsigned long *c);
+unsigned long x64_muladd256(const unsigned long *a, unsigned long b, unsigned long *c);
+
+void x64_montmul64(const unsigned long *a, const unsigned long *b, const unsigned long *p, unsigned long pInv, unsigned long *c);
+void x64_montmul128(const unsigned long *a, const unsigned long *b, const unsigned long *p, unsigned long pInv, unsigned long *c);
+void x64_montmul192(const unsigned long *a, const unsigned long *b, const unsigned long *p, unsigned long pInv, unsigned long *c);
+void x64_montmul256(const unsigned long *a, const unsigned long *b, const unsigned long *p, unsigned long pInv, unsigned long *c);
+
+void x64_montsquare64(const unsigned long *a, const unsigned long *p, unsigned long pInv, unsigned long *c);
+void x64_montsquare128(const unsigned long *a, const unsigned long *p, unsigned long pInv, unsigned long *c);
+void x64_montsquare192(const unsigned long *a, const unsigned long *p, unsigned long pInv, unsigned long *c);
+void x64_montsquare256(const unsigned long *a, const unsigned long *p, unsigned long pInv, unsigned long *c);
+
+#ifdef __cplusplus
+}
+#endif
+
+template<int N> int sub(const unsigned long *a, const unsigned long *b, unsigned long *diff)
+{
+    switch(N) {
+        case 1:
+            return x64_sub64(a, b, diff);
+        case 2:
+            return x64_sub128(a, b, diff);
+        case 3:
+            return x64_sub192(a, b, diff);
+        case 4:
+            return x64_sub256(a, b, diff);
+        case 5:
+            return x64_sub320(a, b, diff);
+        case 6:
+            return x64_sub384(a, b, diff);
+        case 7:
+            return x64_sub448(a, b, diff);
+        case 8:
+            return x64_sub512(a, b, diff);
+        default:
+            return mpn_sub_n((mp_limb_t *)diff, (const mp_limb_t *)a, (const mp_limb_t *)b, N);
+    }
+}
+
+template<int N> void add(const unsigned long *a, const unsigned long *b, unsigned long *sum)
+{
+    switch(N) {
+        case 1:
+            x64_add64(a, b, sum);
+            break;
+        case 2:
+            x64_add128(a, b, sum);
+            break;
+        case 3:
+            x64_add192(a, b, sum);
+            break;
+        case 4:
+            x64_add256(a, b, sum);
+            break;
+        case 5:
+            x64_add320(a, b, sum);
+            break;
+        case 6:
+            x64_add384(a, b, sum);
+            break;
+        case 7:
+            x64_add448(a, b, sum);
+            break;
+        case 8:
+            x64_add512(a, b, sum);
+            break;
+        default:
+            mpn_add_n((mp_limb_t *)sum, (const mp_limb_t *)a, (const mp_limb_t *)b, N);
+            break;
+    }
+}
+
+template<int N> void mul(const unsigned long *a, const unsigned long *b, unsigned long *product)
+{
+    switch(N) {
+        case 1:
+            x64_mul64(a, b, product);
+            break;
+        case 2:
+            x64_mul128(a, b, product);
+            break;
+        case 3:
+            x64_mul192(a, b, product);
+            break;
+        case 4:
+            x64_mul256(a, b, product);
+            break;
+        default:
+            mpn_mul_n((mp_limb_t *)product, (const mp_limb_t *)a, (const mp_limb_t *)b, N);
+            break;
+    }
+}
+
+template<int N1, int N2> void mul(const unsigned long *a, const unsigned long *b, unsigned long *product)
+{
+    switch(N1) {
+        case 1:
+            x64_mul64_128(a, b, product);
+            break;
+        case 2:
+            x64_mul128_256(a, b, product);
+            break;
+        case 3:
+            x64_mul192_384(a, b, product);
+            break;
+        case 4:
+            x64_mul256_512(a, b, product);
+            break;
+        default:
+            // mpn_mul takes the longer operand first
+            if(N1 >= N2) {
+                mpn_mul((mp_limb_t *)product, (const mp_limb_t *)a, N1, (const mp_limb_t *)b, N2);
+            } else {
+                mpn_mul((mp_limb_t *)product, (const mp_limb_t *)b, N2, (const mp_limb_t *)a, N1);
+            }
+            break;
+    }
+}
+
+template<int N> void square(const unsigned long *a, unsigned long *product)
+{
+    switch(N) {
+        case 1:
+            x64_square64(a, product);
+            break;
+        case 2:
+            x64_square128(a, product);
+            break;
+        case 3:
+            x64_square192(a, product);
+            break;
+        case 4:
+            x64_square256(a, product);
+            break;
+        default:
+            mpn_sqr((mp_limb_t *)product, (const mp_limb_t *)a, N);
+            break;
+    }
+}
+
+/**
+ * Computes c = c + a * b where b is a single word. Returns the carry word
+ */
+template<int N> unsigned long mulAdd(const unsigned long *a, unsigned long b, unsigned long *c)
+{
+    switch(N) {
+        case 1:
+            return x64_muladd64(a, b, c);
+        case 2:
+            return x64_muladd128(a, b, c);
+        case 3:
+            return x64_muladd192(a, b, c);
+        case 4:
+            return x64_muladd256(a, b, c);
+        default:
+            return mpn_addmul_1((mp_limb_t *)c, (const mp_limb_t *)a, N, b);
+    }
+}
+
+/**
+ * Montgomery reduction c = tR^-1 mod p of a 2N-word t < pR, for the sizes
+ * without a fused assembly routine. The contents of t are destroyed
+ */
+template<int N> void montReduce(unsigned long *t, const unsigned long *p, unsigned long pInv, unsigned long *c)
+{
+    // Clear one word at a time by adding a multiple of p
+    unsigned long high = 0;
+    for(int i = 0; i < N; i++) {
+        unsigned long carry = mpn_addmul_1((mp_limb_t *)&t[i], (const mp_limb_t *)p, N, t[i] * pInv);
+        high += mpn_add_1((mp_limb_t *)&t[i + N], (const mp_limb_t *)&t[i + N], N - i, carry);
+    }
+
+    // The result is in the upper half and is less than 2p
+    if(high || mpn_cmp((const mp_limb_t *)&t[N], (const mp_limb_t *)p, N) >= 0) {
+        mpn_sub_n((mp_limb_t *)c, (const mp_limb_t *)&t[N], (const mp_limb_t *)p, N);
+    } else {
+        memcpy(c, &t[N], sizeof(unsigned long) * N);
+    }
+}
+
+/**
+ * Montgomery multiplication c = abR^-1 mod p with R = 2^(64N). The product is
+ * reduced as it is accumulated. pInv is -p^-1 mod 2^64 and a, b must be < p
+ */
+template<int N> void montMul(const unsigned long *a, const unsigned long *b, const unsigned long *p, unsigned long pInv, unsigned long *c)
+{
+    switch(N) {
+        case 1:
+            x64_montmul64(a, b, p, pInv, c);
+            break;
+        case 2:
+            x64_montmul128(a, b, p, pInv, c);
+            break;
+        case 3:
+            x64_montmul192(a, b, p, pInv, c);
+            break;
+        case 4:
+            x64_montmul256(a, b, p, pInv, c);
+            break;
+        default:
+            {
+                unsigned long t[2 * N];
+                mpn_mul_n((mp_limb_t *)t, (const mp_limb_t *)a, (const mp_limb_t *)b, N);
+                montReduce<N>(t, p, pInv, c);
+            }
+            break;
+    }
+}
+
+/**
+ * Montgomery squaring c = a^2R^-1 mod p
+ */
+template<int N> void montSquare(const unsigned long *a, const unsigned long *p, unsigned long pInv, unsigned long *c)
+{
+    switch(N) {
+        case 1:
+            x64_montsquare64(a, p, pInv, c);
+            break;
+        case 2:
+            x64_montsquare128(a, p, pInv, c);
+            break;
+        case 3:
+            x64_montsquare192(a, p, pInv, c);
+            break;
+        case 4:
+            x64_montsquare256(a, p, pInv, c);
+            break;
+        default:
+            {
+                unsigned long t[2 * N];
+                mpn_sqr((mp_limb_t *)t, (const mp_limb_t *)a, N);
+                montReduce<N>(t, p, pInv, c);
+            }
+            break;
+    }
+}
+
+/**
+ * Returns true if a >= b
+ */
+template<int N> bool greaterThanEqualTo(const unsigned long *a, const unsigned long *b)
+{
+    for(int i = N - 1; i >= 0; i--) {
+        if(a[i] < b[i]) {
+            return false;
+        } else if(a[i] > b[i]) {
+            return true;
+        }
+    }
+
+    return true;
+}
+
+#endif
@@ -0,0 +1,30 @@
+#!/bin/bash
+
+# Script for generating x86-64 assembly code for big integer routines
+echo "section .text" > x86_64.asm
+
+gen()
+{
+    python gen.py $1 $2 >> x86_64.asm
+    if [ $? -ne 0 ]; then
+        echo "Error"
+        exit 1
+    fi
+}
+
+# Addition and subtraction are also needed at twice the length for Barrett reduction
+for ((bits=64; bits <=512; bits+=64))
+do
+    gen add $bits
+    gen sub $bits
+done
+
+for ((bits=64; bits <=256; bits+=64))
+do
+    gen mul $bits
+    gen square $bits
+    gen mul2n $bits
+    gen muladd $bits
+    gen montmul $bits
+    gen montsquare $bits
+done
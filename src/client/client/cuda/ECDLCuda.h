@@ -1,29 +1,67 @@
 #ifndef _ECDL_CUDA_H
 #define _ECDL_CUDA_H
 
+#include <vector>
 #include "ecc.h"
 #include "BigInteger.h"
 #include "ECDLContext.h"
 #include "RhoCUDA.h"
 #include "cudapp.h"
+#include "threads.h"
+#include "LaunchTuner.h"
 
+class ECDLCudaContext;
+
+typedef struct {
+    ECDLCudaContext *instance;
+    int deviceIndex;
+    bool success;
+    unsigned long long pointsPerSecond;
+}CudaWorkerParams;
+
+/**
+ * Runs one RhoCUDA per device. Every device reports its distinguished points
+ * through the same callback
+ */
 class ECDLCudaContext : public ECDLContext {
 
 private:
-    RhoCUDA *_rho;
+    std::vector<RhoCUDA *> _rho;
     ECDLPParams _params;
     ECCurve _curve;
     void (*_callback)(struct CallbackParameters *);
 
-    BigInteger _rx[NUM_R_POINTS];
-    BigInteger _ry[NUM_R_POINTS];
+    std::vector<BigInteger> _rx;
+    std::vector<BigInteger> _ry;
+
+    // Saved walks that the devices continue, or NULL
+    WalkCheckpoint *_resume;
+
+    // Distinguished bits the walks stop at
+    unsigned int _dBits;
 
-    unsigned int _device;
+    std::vector<int> _devices;
     unsigned int _blocks;
     unsigned int _threads;
     unsigned int _totalPoints;
     int _pointsPerThread;
     int _rPoints;
+    unsigned int _stepsPerLaunch;
+    unsigned int _numStreams;
+
+    // Grid shape of each device, and the tuning cache file. An empty file
+    // name uses the configured shape on every device
+    std::vector<LaunchConfig> _launch;
+    std::string _tuneCache;
+
+    RhoCUDA *getRho(int index, bool callback = true);
+
+    void tuneDevices();
+    bool tune(int device, LaunchConfig &best, unsigned long long &bestRate);
+    unsigned long long benchmarkConfig(int device, const LaunchConfig &config);
+
+    static void *workerThreadEntry(void *ptr);
+    static void *benchmarkThreadEntry(void *ptr);
 
 public:
 
@@ -33,8 +71,11 @@ public:
     virtual bool run();
     virtual bool stop();
     virtual bool isRunning();
+    virtual void saveWalks(WalkCheckpoint &checkpoint);
+    virtual void resumeWalks(WalkCheckpoint *checkpoint);
+    virtual void setDistinguishedBits(unsigned int dBits);
 
-    ECDLCudaContext( int device,
+    ECDLCudaContext( const std::vector<int> &devices,
                        unsigned int blocks,
                        unsigned int threads,
                        unsigned int pointsPerThread,
@@ -42,7 +83,10 @@ public:
                        const BigInteger *rx,
                        const BigInteger *ry,
                        int rPoints,
-                       void (*callback)(struct CallbackParameters *));
+                       void (*callback)(struct CallbackParameters *),
+                       unsigned int stepsPerLaunch = 1,
+                       unsigned int numStreams = 1,
+                       const std::string &tuneCache = "");
 
     virtual bool benchmark(unsigned long long *pointsPerSecond);
 };
@@ -9,7 +9,7 @@
 #include "util.h"
 
 
-ECDLCudaContext::ECDLCudaContext( int device,
+ECDLCudaContext::ECDLCudaContext( const std::vector<int> &devices,
                    unsigned int blocks,
                    unsigned int threads,
                    unsigned int pointsPerThread,
@@ -17,74 +17,357 @@ ECDLCudaContext::ECDLCudaContext( int device,
                    const BigInteger *rx,
                    const BigInteger *ry,
                    int rPoints,
-                   void (*callback)(struct CallbackParameters *))
+                   void (*callback)(struct CallbackParameters *),
+                   unsigned int stepsPerLaunch,
+                   unsigned int numStreams,
+                   const std::string &tuneCache)
 {
-    _device = device;
+    _devices = devices;
     _blocks = blocks;
     _threads = threads;
     _pointsPerThread = pointsPerThread;
     _params = *params;
 
-    for(int i = 0; i < rPoints; i++) {
-        _rx[i] = rx[i];
-        _ry[i] = ry[i];
-    }
+    _rx.assign(rx, rx + rPoints);
+    _ry.assign(ry, ry + rPoints);
 
     _rPoints = rPoints;
     _callback = callback;
+    _stepsPerLaunch = stepsPerLaunch;
+    _numStreams = numStreams;
+    _tuneCache = tuneCache;
+
+    _resume = NULL;
+    _dBits = _params.dBits;
 
-    _rho = NULL;
-    Logger::logInfo("ECDLCudaContext created");
+    Logger::logInfo("ECDLCudaContext created (%d devices)", _devices.size());
 }
 
 ECDLCudaContext::~ECDLCudaContext()
 {
-    delete _rho;
+    for(unsigned int i = 0; i < _rho.size(); i++) {
+        delete _rho[i];
+    }
+}
+
+RhoCUDA *ECDLCudaContext::getRho(int index, bool callback)
+{
+    void (*callbackPtr)(struct CallbackParameters *) = callback ? _callback : NULL;
+    const LaunchConfig &config = _launch[index];
+
+    // Benchmarks do not resume saved walks
+    WalkCheckpoint *resume = callback ? _resume : NULL;
+
+    RhoCUDA *r = new RhoCUDA(_devices[index], config.blocks, config.threads, config.pointsPerThread, &_params, &_rx[0], &_ry[0], _rPoints, callbackPtr, _stepsPerLaunch, _numStreams, resume);
+    r->setDistinguishedBits(_dBits);
+
+    return r;
+}
+
+/**
+ * Benchmarks a grid shape on a device. Returns 0 if it does not run
+ */
+unsigned long long ECDLCudaContext::benchmarkConfig(int device, const LaunchConfig &config)
+{
+    unsigned long long pointsPerSecond = 0;
+    RhoCUDA *r = new RhoCUDA(device, config.blocks, config.threads, config.pointsPerThread, &_params, &_rx[0], &_ry[0], _rPoints, NULL, _stepsPerLaunch, _numStreams);
+
+    if(!r->init() || !r->benchmark(&pointsPerSecond, TUNE_ITERATIONS)) {
+        pointsPerSecond = 0;
+    }
+    delete r;
+
+    Logger::logInfo("%d blocks, %d threads, %d points per thread: %lld points per second",
+                    config.blocks, config.threads, config.pointsPerThread, pointsPerSecond);
+
+    return pointsPerSecond;
+}
+
+/**
+ * Finds the grid shape of a device by benchmarking. Every block size is tried
+ * with as many blocks as fit on the device at once, then the points per
+ * thread are varied for the fastest of them
+ */
+bool ECDLCudaContext::tune(int device, LaunchConfig &best, unsigned long long &bestRate)
+{
+    int pWords = ((int)_params.p.getBitLength() + 31) / 32;
+
+    bestRate = 0;
+
+    std::vector<LaunchConfig> shapes = LaunchTuner::getGridShapes(device, pWords, _stepsPerLaunch, _rPoints, _pointsPerThread);
+    for(unsigned int i = 0; i < shapes.size(); i++) {
+        unsigned long long rate = benchmarkConfig(device, shapes[i]);
+
+        if(rate > bestRate) {
+            best = shapes[i];
+            bestRate = rate;
+        }
+    }
+
+    if(bestRate == 0) {
+        return false;
+    }
+
+    LaunchConfig grid = best;
+    std::vector<unsigned int> counts = LaunchTuner::getPointCounts(device, pWords, _stepsPerLaunch, grid, _numStreams);
+    for(unsigned int i = 0; i < counts.size(); i++) {
+        if(counts[i] == grid.pointsPerThread) {
+            continue;
+        }
+
+        LaunchConfig config = grid;
+        config.pointsPerThread = counts[i];
+
+        unsigned long long rate = benchmarkConfig(device, config);
+        if(rate > bestRate) {
+            best = config;
+            bestRate = rate;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Picks the grid shape of every device. With a tuning cache the shape found
+ * earlier for the same GPU model and integer length is used, and a device
+ * without one is tuned and added to the cache. A device that cannot be tuned
+ * uses the configured shape
+ */
+void ECDLCudaContext::tuneDevices()
+{
+    if(_launch.size() == _devices.size()) {
+        return;
+    }
+
+    LaunchConfig configured;
+    configured.blocks = _blocks;
+    configured.threads = _threads;
+    configured.pointsPerThread = _pointsPerThread;
+
+    _launch.assign(_devices.size(), configured);
+
+    if(_tuneCache == "") {
+        return;
+    }
+
+    LaunchTuner tuner(_tuneCache);
+    int pWords = ((int)_params.p.getBitLength() + 31) / 32;
+
+    for(unsigned int i = 0; i < _devices.size(); i++) {
+        CUDA::DeviceInfo devInfo;
+        LaunchConfig best;
+        unsigned long long rate = 0;
+
+        try {
+            CUDA::getDeviceInfo(_devices[i], devInfo);
+
+            if(!tuner.lookup(devInfo.name, pWords, _stepsPerLaunch, best)) {
+                Logger::logInfo("Tuning device %d (%s) for %d-word integers...", _devices[i], devInfo.name.c_str(), pWords);
+
+                if(!tune(_devices[i], best, rate)) {
+                    Logger::logError("No configuration ran on device %d", _devices[i]);
+                    continue;
+                }
+
+                tuner.store(devInfo.name, pWords, _stepsPerLaunch, best, rate);
+            }
+        } catch(cudaError_t cudaError) {
+            Logger::logError("Error tuning device %d: %s", _devices[i], cudaGetErrorString(cudaError));
+            continue;
+        }
+
+        _launch[i] = best;
+        Logger::logInfo("Device %d: %d blocks, %d threads, %d points per thread", _devices[i], best.blocks, best.threads, best.pointsPerThread);
+    }
 }
 
 bool ECDLCudaContext::init()
 {
-    Logger::logInfo("Creating RhoCUDA...");
-    _rho = new RhoCUDA(_device, _blocks, _threads, _pointsPerThread, &_params, _rx, _ry, _rPoints, _callback);
-    _rho->init();
+    tuneDevices();
+
+    for(unsigned int i = 0; i < _devices.size(); i++) {
+        Logger::logInfo("Creating RhoCUDA on device %d...", _devices[i]);
+        RhoCUDA *r = getRho(i);
+
+        if(!r->init()) {
+            Logger::logError("Error initializing device %d", _devices[i]);
+            delete r;
+            return false;
+        }
+
+        _rho.push_back(r);
+    }
 
     return true;
 }
 
+/**
+ * Entry point for the thread that runs a device
+ */
+void *ECDLCudaContext::workerThreadEntry(void *ptr)
+{
+    CudaWorkerParams *params = (CudaWorkerParams *)ptr;
+
+    params->success = params->instance->_rho[params->deviceIndex]->run();
+
+    if(!params->success) {
+        Logger::logError("Device %d stopped with an error", params->instance->_devices[params->deviceIndex]);
+    }
+
+    return NULL;
+}
+
+/**
+ * Runs every device in its own thread. This is a blocking call
+ */
 bool ECDLCudaContext::run()
 {
-    return _rho->run();
+    std::vector<CudaWorkerParams> params(_rho.size());
+    std::vector<Thread> threads;
+
+    for(unsigned int i = 0; i < _rho.size(); i++) {
+        params[i].instance = this;
+        params[i].deviceIndex = i;
+        params[i].success = false;
+
+        threads.push_back(Thread(&ECDLCudaContext::workerThreadEntry, &params[i]));
+    }
+
+    bool success = true;
+    for(unsigned int i = 0; i < threads.size(); i++) {
+        threads[i].wait();
+        success = success && params[i].success;
+    }
+
+    return success;
 }
 
 void ECDLCudaContext::reset()
 {
-    _rho->reset();
+    for(unsigned int i = 0; i < _rho.size(); i++) {
+        _rho[i]->reset();
+    }
 }
 
 bool ECDLCudaContext::stop()
 {
-    _rho->stop();
+    for(unsigned int i = 0; i < _rho.size(); i++) {
+        _rho[i]->stop();
+    }
 
     return true;
 }
 
 bool ECDLCudaContext::isRunning()
 {
-    return _rho->isRunning();
+    for(unsigned int i = 0; i < _rho.size(); i++) {
+        if(_rho[i]->isRunning()) {
+            return true;
+        }
+    }
+
+    return false;
 }
 
+/**
+ * Saves the walks of every device. Each device pauses while its own walks
+ * are copied
+ */
+void ECDLCudaContext::saveWalks(WalkCheckpoint &checkpoint)
+{
+    for(unsigned int i = 0; i < _rho.size(); i++) {
+        _rho[i]->saveWalks(checkpoint);
+    }
+}
+
+void ECDLCudaContext::resumeWalks(WalkCheckpoint *checkpoint)
+{
+    _resume = checkpoint;
+}
+
+void ECDLCudaContext::setDistinguishedBits(unsigned int dBits)
+{
+    _dBits = dBits;
+
+    for(unsigned int i = 0; i < _rho.size(); i++) {
+        _rho[i]->setDistinguishedBits(dBits);
+    }
+}
+
+void *ECDLCudaContext::benchmarkThreadEntry(void *ptr)
+{
+    CudaWorkerParams *params = (CudaWorkerParams *)ptr;
+    RhoCUDA *r = params->instance->_rho[params->deviceIndex];
+
+    params->pointsPerSecond = 0;
+    params->success = r->benchmark(&params->pointsPerSecond);
+
+    return NULL;
+}
+
+/**
+ * Benchmarks all devices at the same time. The result is the total for all
+ * devices
+ */
 bool ECDLCudaContext::benchmark(unsigned long long *pointsPerSecond)
 {
-    if (_rho != NULL) {
+    if (_rho.size() > 0) {
         throw std::string("Cannot run benchmark. GPU is currently busy");
     }
 
-    RhoCUDA *r = new RhoCUDA(_device, _blocks, _threads, _pointsPerThread, &_params, _rx, _ry, _rPoints, _callback);
+    bool success = true;
 
-    r->init();
-    r->benchmark(pointsPerSecond);
+    tuneDevices();
 
-    delete r;
+    for(unsigned int i = 0; i < _devices.size(); i++) {
+        RhoCUDA *r = getRho(i, false);
 
-    return true;
-}
\ No newline at end of file
+        if(!r->init()) {
+            Logger::logError("Error initializing device %d", _devices[i]);
+            delete r;
+            success = false;
+            goto end;
+        }
+
+        _rho.push_back(r);
+    }
+
+    {
+        std::vector<CudaWorkerParams> params(_rho.size());
+        std::vector<Thread> threads;
+
+        for(unsigned int i = 0; i < _rho.size(); i++) {
+            params[i].instance = this;
+            params[i].deviceIndex = i;
+            params[i].success = false;
+
+            threads.push_back(Thread(&ECDLCudaContext::benchmarkThreadEntry, &params[i]));
+        }
+
+        unsigned long long total = 0;
+        for(unsigned int i = 0; i < threads.size(); i++) {
+            threads[i].wait();
+            success = success && params[i].success;
+            total += params[i].pointsPerSecond;
+
+            Logger::logInfo("Device %d: %lld points per second", _devices[i], params[i].pointsPerSecond);
+        }
+
+        if(_rho.size() > 1) {
+            Logger::logInfo("Total: %lld points per second", total);
+        }
+
+        if(pointsPerSecond != NULL) {
+            *pointsPerSecond = total;
+        }
+    }
+
+end:
+    for(unsigned int i = 0; i < _rho.size(); i++) {
+        delete _rho[i];
+    }
+    _rho.clear();
+
+    return success;
+}
@@ -0,0 +1,47 @@
+#ifndef _ECDL_HYBRID_H
+#define _ECDL_HYBRID_H
+
+#include "ECDLContext.h"
+#include "threads.h"
+
+class ECDLHybridContext;
+
+typedef struct {
+    ECDLHybridContext *instance;
+    ECDLContext *ctx;
+    bool success;
+    unsigned long long pointsPerSecond;
+}HybridThreadParams;
+
+/**
+ * Runs a GPU context and a CPU context at the same time. Both report their
+ * distinguished points through their own callback, which is normally the same
+ * function. The contexts are deleted with this context
+ */
+class ECDLHybridContext : public ECDLContext {
+
+private:
+    ECDLContext *_gpu;
+    ECDLContext *_cpu;
+
+    static void *runThreadEntry(void *ptr);
+    static void *benchmarkThreadEntry(void *ptr);
+
+public:
+    ECDLHybridContext(ECDLContext *gpu, ECDLContext *cpu);
+    virtual ~ECDLHybridContext();
+
+    virtual bool init();
+    virtual void reset();
+    virtual bool run();
+    virtual bool stop();
+    virtual bool isRunning();
+    virtual bool benchmark(unsigned long long *pointsPerSecond);
+    virtual void saveWalks(WalkCheckpoint &checkpoint);
+    virtual void resumeWalks(WalkCheckpoint *checkpoint);
+    virtual void setDistinguishedBits(unsigned int dBits);
+
+    static int getCpuThreadCount(int requested, int numDevices, bool physicalCores = false);
+};
+
+#endif
@@ -0,0 +1,158 @@
+#include "ECDLHybrid.h"
+#include "logger.h"
+#include "util.h"
+
+ECDLHybridContext::ECDLHybridContext(ECDLContext *gpu, ECDLContext *cpu)
+{
+    _gpu = gpu;
+    _cpu = cpu;
+}
+
+ECDLHybridContext::~ECDLHybridContext()
+{
+    delete _gpu;
+    delete _cpu;
+}
+
+/**
+ * Gets the number of CPU threads to run next to the GPUs. A negative value
+ * uses every core except one for each GPU, because each GPU is fed by its own
+ * host thread. With physicalCores only physical cores are counted
+ */
+int ECDLHybridContext::getCpuThreadCount(int requested, int numDevices, bool physicalCores)
+{
+    if(requested >= 0) {
+        return requested;
+    }
+
+    int threads = (int)util::getCpuList(physicalCores).size() - numDevices;
+
+    return threads > 0 ? threads : 0;
+}
+
+bool ECDLHybridContext::init()
+{
+    if(!_gpu->init()) {
+        return false;
+    }
+
+    return _cpu->init();
+}
+
+void ECDLHybridContext::reset()
+{
+    _gpu->reset();
+    _cpu->reset();
+}
+
+void *ECDLHybridContext::runThreadEntry(void *ptr)
+{
+    HybridThreadParams *params = (HybridThreadParams *)ptr;
+
+    params->success = params->ctx->run();
+
+    return NULL;
+}
+
+/**
+ * Runs the CPU context in a new thread and the GPU context in this thread.
+ * This is a blocking call
+ */
+bool ECDLHybridContext::run()
+{
+    HybridThreadParams params;
+    params.instance = this;
+    params.ctx = _cpu;
+    params.success = false;
+
+    Thread cpuThread(&ECDLHybridContext::runThreadEntry, &params);
+
+    bool success = _gpu->run();
+
+    // Stop the CPU when the GPU stops with an error
+    if(!success) {
+        _cpu->stop();
+    }
+
+    cpuThread.wait();
+
+    return success && params.success;
+}
+
+bool ECDLHybridContext::stop()
+{
+    _gpu->stop();
+
+    if(_cpu->isRunning()) {
+        _cpu->stop();
+    }
+
+    return true;
+}
+
+bool ECDLHybridContext::isRunning()
+{
+    return _gpu->isRunning() || _cpu->isRunning();
+}
+
+void ECDLHybridContext::saveWalks(WalkCheckpoint &checkpoint)
+{
+    _gpu->saveWalks(checkpoint);
+    _cpu->saveWalks(checkpoint);
+}
+
+/**
+ * The GPU is initialized first, so it resumes the walks it saved and the
+ * CPU continues the rest
+ */
+void ECDLHybridContext::resumeWalks(WalkCheckpoint *checkpoint)
+{
+    _gpu->resumeWalks(checkpoint);
+    _cpu->resumeWalks(checkpoint);
+}
+
+void ECDLHybridContext::setDistinguishedBits(unsigned int dBits)
+{
+    _gpu->setDistinguishedBits(dBits);
+    _cpu->setDistinguishedBits(dBits);
+}
+
+void *ECDLHybridContext::benchmarkThreadEntry(void *ptr)
+{
+    HybridThreadParams *params = (HybridThreadParams *)ptr;
+
+    params->pointsPerSecond = 0;
+    params->success = params->ctx->benchmark(&params->pointsPerSecond);
+
+    return NULL;
+}
+
+/**
+ * Benchmarks the GPU and the CPU at the same time, so the result includes
+ * the cost of sharing the host
+ */
+bool ECDLHybridContext::benchmark(unsigned long long *pointsPerSecond)
+{
+    HybridThreadParams params;
+    params.instance = this;
+    params.ctx = _cpu;
+    params.success = false;
+    params.pointsPerSecond = 0;
+
+    Thread cpuThread(&ECDLHybridContext::benchmarkThreadEntry, &params);
+
+    unsigned long long gpuPointsPerSecond = 0;
+    bool success = _gpu->benchmark(&gpuPointsPerSecond);
+
+    cpuThread.wait();
+
+    Logger::logInfo("GPU: %lld points per second", gpuPointsPerSecond);
+    Logger::logInfo("CPU: %lld points per second", params.pointsPerSecond);
+    Logger::logInfo("Total: %lld points per second", gpuPointsPerSecond + params.pointsPerSecond);
+
+    if(pointsPerSecond != NULL) {
+        *pointsPerSecond = gpuPointsPerSecond + params.pointsPerSecond;
+    }
+
+    return success && params.success;
+}
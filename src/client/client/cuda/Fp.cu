@@ -2,6 +2,8 @@
 #define _FP_CU
 
 #include "util.cu"
+#include "carry.cu"
+#include "kernels.h"
 
 // Length of p in words
 __constant__ unsigned int _PWORDS;
@@ -21,13 +23,40 @@ __constant__ unsigned int _2P_CONST[10];
 __shared__ unsigned int _3P[10];
 __constant__ unsigned int _3P_CONST[10];
 
+// 4 * p
+__shared__ unsigned int _4P[10];
+__constant__ unsigned int _4P_CONST[10];
+
 // m = 2^2n / k
 __shared__ unsigned int _M[10];
 __constant__ unsigned int _M_CONST[10];
 
-// p - 2, used in modular inverse
-__shared__ unsigned int _PMINUS2[10];
-__constant__ unsigned int _PMINUS2_CONST[10];
+// Words of c when p = 2^k - c with c < 2^(k/2 - 1), or 0 when p does not
+// have that form and the Barrett reduction is used
+__constant__ unsigned int _PM_CWORDS;
+
+// c = 2^k - p
+__constant__ unsigned int _PM_C[10];
+
+// Bits of the top word of p that are below 2^k
+__constant__ unsigned int _PM_MASK;
+
+// Window width of the exponentiation in inverseModP
+#define INVERSE_WINDOW 4
+
+// Odd powers a, a^3, ..., a^(2^INVERSE_WINDOW - 1) kept by inverseModP
+#define INVERSE_TABLE_SIZE (1 << (INVERSE_WINDOW - 1))
+
+// A window and the zeros after it cover at least INVERSE_WINDOW bits, so a
+// 320-bit exponent has at most 80 windows plus a step of trailing squarings
+#define INVERSE_MAX_STEPS 96
+
+// Sliding window schedule of p - 2, built on the host. Each step squares
+// the result (step >> 16) times and then multiplies it by a^(step & 0xffff).
+// Every thread reads the same step at the same time, which the constant
+// cache broadcasts
+__constant__ unsigned int _INVERSE_STEPS[INVERSE_MAX_STEPS];
+__constant__ unsigned int _INVERSE_STEP_COUNT;
 
 // Lenght of p in bits
 __shared__ unsigned int _PBITS;
@@ -39,20 +68,33 @@ __constant__ unsigned int _MBITS_CONST;
 
 __constant__ unsigned int _NUM_POINTS;
 
+#ifdef INTERLEAVED_LAYOUT
 template<int N> __device__ int getIndex(int idx)
 {
     return N * (gridDim.x * blockDim.x * idx + blockIdx.x * blockDim.x + threadIdx.x);
 }
+#else
+/**
+ * Index of the first word of word group g of integer idx. Group g of integer
+ * idx of all threads is contiguous so a warp reads 512 consecutive bytes
+ */
+template<int N> __device__ int getGroupIndex(int idx, int g)
+{
+    return LAYOUT_GROUP_WORDS * ((LAYOUT_GROUPS(N) * idx + g) * gridDim.x * blockDim.x + blockIdx.x * blockDim.x + threadIdx.x);
+}
+#endif
 
 template<int N> __device__ void add(const unsigned int *a, const unsigned int *b, unsigned int *c)
 {
+    unsigned int carry = 0;
+
     // No carry in
-    asm volatile( "add.cc.u32 %0, %1, %2;\n\t" : "=r"(c[ 0 ]) : "r"(a[ 0 ]), "r"(b[ 0 ]) );
+    add_cc(c[ 0 ], a[ 0 ], b[ 0 ], carry);
 
     // Carry in and carry out    
     #pragma unroll
     for(int i = 1; i < N; i++) {
-        asm volatile( "addc.cc.u32 %0, %1, %2;\n\t" : "=r"(c[ i ]) : "r"(a[ i ]), "r"(b[ i ]) );
+        addc_cc(c[ i ], a[ i ], b[ i ], carry);
     }
 }
 
@@ -61,18 +103,20 @@ template<int N> __device__ void add(const unsigned int *a, const unsigned int *b
  */
 template<int N> __device__ unsigned int sub(const unsigned int *a, const unsigned int *b, unsigned int *c)
 {
+    unsigned int carry = 0;
+
     // No borrow in
-    asm volatile( "sub.cc.u32 %0, %1, %2;\n\t" : "=r"(c[ 0 ]) : "r"(a[ 0 ]), "r"(b[ 0 ]) );
+    sub_cc(c[ 0 ], a[ 0 ], b[ 0 ], carry);
 
     // Borrow in and borrow out
     #pragma unroll
     for(int i = 1; i < N; i++) {
-        asm volatile( "subc.cc.u32 %0, %1, %2;\n\t" : "=r"(c[ i ]) : "r"(a[ i ]), "r"(b[ i ]) );
+        subc_cc(c[ i ], a[ i ], b[ i ], carry);
     }
 
     // Return non-zero on borrow
     unsigned int borrow = 0;
-    asm volatile( "subc.u32 %0, %1, %2;\n\t" : "=r"(borrow) : "r"(0), "r"(0));
+    subc(borrow, 0, 0, carry);
 
     return borrow;
 }
@@ -82,7 +126,8 @@ template<int N> __device__ unsigned int sub(const unsigned int *a, const unsigne
  */
 template<int N> __device__ void multiply(const unsigned int *a, const unsigned int *b, unsigned int *c)
 {
-    
+    unsigned int carry = 0;
+
     // Compute low 32-bits of each 64-bit product
     for(int i = 0; i < N; i++) {
         c[i] = a[0] * b[i];
@@ -90,40 +135,247 @@ template<int N> __device__ void multiply(const unsigned int *a, const unsigned i
     }
 
     // Compute high 32-bits of each 64-bit product, perform add + carry
-    asm volatile( "mad.hi.cc.u32 %0, %1, %2, %3;\n\t" : "=r"(c[1]) : "r"(a[ 0 ]), "r"(b[ 0 ] ), "r"(c[1]) );
+    mad_hi_cc(c[1], a[ 0 ], b[ 0 ], c[1], carry);
 
     for(int i = 1; i < N-1; i++) {
-        asm volatile( "madc.hi.cc.u32 %0, %1, %2, %3;\n\t" : "=r"(c[i+1]) : "r"(a[ 0 ]), "r"(b[ i ]), "r"(c[i+1]));
+        madc_hi_cc(c[i+1], a[ 0 ], b[ i ], c[i+1], carry);
     }
 
-    asm volatile( "madc.hi.u32 %0, %1, %2, %3;\n\t" : "=r"(c[N]) : "r"(a[ 0 ]), "r"(b[ N-1 ]), "r"(c[N]));
+    madc_hi(c[N], a[ 0 ], b[ N-1 ], c[N], carry);
     
     for(int i = 1; i < N; i++) {
         unsigned int t = a[i];
-        asm volatile( "mad.lo.cc.u32 %0, %1, %2, %3;\n\t" : "=r"(c[i]) : "r"(t), "r"(b[0]), "r"(c[i]));
+        mad_lo_cc(c[i], t, b[0], c[i], carry);
 
         for(int j = 1; j < N; j++) {
-            asm volatile( "madc.lo.cc.u32 %0, %1, %2, %3;\n\t" : "=r"(c[ i + j ]) : "r"(t), "r"(b[j]),"r"(c[i+j]));
+            madc_lo_cc(c[ i + j ], t, b[j], c[i+j], carry);
         }
-        asm volatile( "addc.u32 %0, %1, %2;\n\t" : "=r"(c[ i + N ]) : "r"(c[ i + N ]), "r"(0) );
+        addc(c[ i + N ], c[ i + N ], 0, carry);
      
 
-        asm volatile( "mad.hi.cc.u32 %0, %1, %2, %3;\n\t" : "=r"(c[i+1]) : "r"(t), "r"(b[ 0 ] ), "r"(c[i+1]) );
+        mad_hi_cc(c[i+1], t, b[ 0 ], c[i+1], carry);
 
         for(int j = 1; j < N-1; j++) {
-            asm volatile( "madc.hi.cc.u32 %0, %1, %2, %3;\n\t" : "=r"(c[j+i+1]) : "r"(t), "r"(b[ j ] ), "r"(c[i+j+1]) );
+            madc_hi_cc(c[j+i+1], t, b[ j ], c[i+j+1], carry);
         }
-        asm volatile( "madc.hi.u32 %0, %1, %2, %3;\n\t" : "=r"(c[i+N]) : "r"(t), "r"(b[ N-1 ] ), "r"(c[i+N]) );
+        madc_hi(c[i+N], t, b[ N-1 ], c[i+N], carry);
     }
 }
 
 
 /**
- * Squares an N-word value
+ * Computes the low N + 1 words of an N x N word product. The upper words are
+ * not needed when the product is subtracted in the Barrett reduction
+ */
+template<int N> __device__ void multiplyLow(const unsigned int *a, const unsigned int *b, unsigned int *c)
+{
+    unsigned int carry = 0;
+
+    // Low 32-bits of the first row
+    #pragma unroll
+    for(int j = 0; j < N; j++) {
+        c[j] = a[0] * b[j];
+    }
+    c[N] = 0;
+
+    // High 32-bits of the first row
+    if(N == 1) {
+        mad_hi(c[1], a[0], b[0], c[1]);
+    } else {
+        mad_hi_cc(c[1], a[0], b[0], c[1], carry);
+
+        #pragma unroll
+        for(int j = 1; j < N - 1; j++) {
+            madc_hi_cc(c[j+1], a[0], b[j], c[j+1], carry);
+        }
+        madc_hi(c[N], a[0], b[N-1], c[N], carry);
+    }
+
+    // Every other row ends on word N. Products past it are skipped
+    #pragma unroll
+    for(int i = 1; i < N; i++) {
+        unsigned int t = a[i];
+
+        mad_lo_cc(c[i], t, b[0], c[i], carry);
+
+        #pragma unroll
+        for(int j = 1; j < N - i; j++) {
+            madc_lo_cc(c[i+j], t, b[j], c[i+j], carry);
+        }
+        madc_lo(c[N], t, b[N-i], c[N], carry);
+
+        if(i == N - 1) {
+            mad_hi(c[N], t, b[0], c[N]);
+        } else {
+            mad_hi_cc(c[i+1], t, b[0], c[i+1], carry);
+
+            #pragma unroll
+            for(int j = 1; j < N - i - 1; j++) {
+                madc_hi_cc(c[i+j+1], t, b[j], c[i+j+1], carry);
+            }
+            madc_hi(c[N], t, b[N-i-1], c[N], carry);
+        }
+    }
+}
+
+/**
+ * Computes words N - 1 to 2N - 1 of an N x N word product. Products that only
+ * affect words below N - 2 are skipped, so the result can be too small by the
+ * carries lost out of those words. That is at most 2N in word N - 2, which
+ * makes the result less than one unit too small in word N - 1
+ */
+template<int N> __device__ void multiplyHigh(const unsigned int *a, const unsigned int *b, unsigned int *c)
+{
+    unsigned int carry = 0;
+
+    // First word that is computed
+    const int s = N > 2 ? N - 2 : 0;
+
+    // Low 32-bits of the first row
+    #pragma unroll
+    for(int j = s; j < N; j++) {
+        c[j] = a[0] * b[j];
+    }
+
+    #pragma unroll
+    for(int j = N; j < 2 * N; j++) {
+        c[j] = 0;
+    }
+
+    // High 32-bits of the first row, starting with the ones that land on word s
+    const int h = s > 0 ? s - 1 : 0;
+
+    if(h == N - 1) {
+        mad_hi(c[N], a[0], b[N-1], c[N]);
+    } else {
+        mad_hi_cc(c[h+1], a[0], b[h], c[h+1], carry);
+
+        #pragma unroll
+        for(int j = h + 1; j < N - 1; j++) {
+            madc_hi_cc(c[j+1], a[0], b[j], c[j+1], carry);
+        }
+        madc_hi(c[N], a[0], b[N-1], c[N], carry);
+    }
+
+    #pragma unroll
+    for(int i = 1; i < N; i++) {
+        unsigned int t = a[i];
+
+        // Low 32-bits starting on word s or i
+        const int lo = s > i ? s - i : 0;
+
+        mad_lo_cc(c[i+lo], t, b[lo], c[i+lo], carry);
+
+        #pragma unroll
+        for(int j = lo + 1; j < N; j++) {
+            madc_lo_cc(c[i+j], t, b[j], c[i+j], carry);
+        }
+        addc(c[i+N], c[i+N], 0, carry);
+
+        // High 32-bits starting on word s or i + 1
+        const int hi = s > i + 1 ? s - i - 1 : 0;
+
+        if(hi == N - 1) {
+            mad_hi(c[i+N], t, b[N-1], c[i+N]);
+        } else {
+            mad_hi_cc(c[i+hi+1], t, b[hi], c[i+hi+1], carry);
+
+            #pragma unroll
+            for(int j = hi + 1; j < N - 1; j++) {
+                madc_hi_cc(c[i+j+1], t, b[j], c[i+j+1], carry);
+            }
+            madc_hi(c[i+N], t, b[N-1], c[i+N], carry);
+        }
+    }
+}
+
+/**
+ * Squares an N-word value. The products a[i] * a[j] with i < j are computed
+ * once and doubled, then the squares a[i] * a[i] are added
  */
 template<int N> __device__ void square(const unsigned int *a, unsigned int *c)
 {
-    multiply<N>(a, a, c);
+    unsigned int carry = 0;
+
+    if(N == 1) {
+        c[0] = a[0] * a[0];
+        mul_hi(c[1], a[0], a[0]);
+        return;
+    }
+
+    // Low 32-bits of the first row of cross products
+    c[0] = 0;
+
+    #pragma unroll
+    for(int j = 1; j < N; j++) {
+        c[j] = a[0] * a[j];
+    }
+
+    #pragma unroll
+    for(int j = N; j < 2 * N; j++) {
+        c[j] = 0;
+    }
+
+    // High 32-bits of the first row
+    if(N == 2) {
+        mad_hi(c[2], a[0], a[1], c[2]);
+    } else {
+        mad_hi_cc(c[2], a[0], a[1], c[2], carry);
+
+        #pragma unroll
+        for(int j = 2; j < N - 1; j++) {
+            madc_hi_cc(c[j+1], a[0], a[j], c[j+1], carry);
+        }
+        madc_hi(c[N], a[0], a[N-1], c[N], carry);
+    }
+
+    // Remaining rows of cross products
+    #pragma unroll
+    for(int i = 1; i < N - 1; i++) {
+        unsigned int t = a[i];
+
+        mad_lo_cc(c[2*i+1], t, a[i+1], c[2*i+1], carry);
+
+        #pragma unroll
+        for(int j = i + 2; j < N; j++) {
+            madc_lo_cc(c[i+j], t, a[j], c[i+j], carry);
+        }
+        addc(c[i+N], c[i+N], 0, carry);
+
+        if(i == N - 2) {
+            mad_hi(c[2*N-2], t, a[N-1], c[2*N-2]);
+        } else {
+            mad_hi_cc(c[2*i+2], t, a[i+1], c[2*i+2], carry);
+
+            #pragma unroll
+            for(int j = i + 2; j < N - 1; j++) {
+                madc_hi_cc(c[i+j+1], t, a[j], c[i+j+1], carry);
+            }
+            madc_hi(c[i+N], t, a[N-1], c[i+N], carry);
+        }
+    }
+
+    // Double the cross products
+    add_cc(c[1], c[1], c[1], carry);
+
+    #pragma unroll
+    for(int i = 2; i < 2 * N - 1; i++) {
+        addc_cc(c[i], c[i], c[i], carry);
+    }
+    addc(c[2*N-1], c[2*N-1], c[2*N-1], carry);
+
+    // Add the squares
+    mad_lo_cc(c[0], a[0], a[0], c[0], carry);
+    madc_hi_cc(c[1], a[0], a[0], c[1], carry);
+
+    #pragma unroll
+    for(int i = 1; i < N - 1; i++) {
+        madc_lo_cc(c[2*i], a[i], a[i], c[2*i], carry);
+        madc_hi_cc(c[2*i+1], a[i], a[i], c[2*i+1], carry);
+    }
+
+    madc_lo_cc(c[2*N-2], a[N-1], a[N-1], c[2*N-2], carry);
+    madc_hi(c[2*N-1], a[N-1], a[N-1], c[2*N-1], carry);
 }
 
 /**
@@ -135,13 +387,14 @@ __device__ void initFp()
         memcpy(_P, _P_CONST, sizeof(_P_CONST));
         memcpy(_M, _M_CONST, sizeof(_M_CONST));
         memcpy(_2P, _2P_CONST, sizeof(_2P_CONST));
-        memcpy(_3P, _3P_CONST, sizeof(_2P_CONST));
-        memcpy(_PMINUS2, _PMINUS2_CONST, sizeof(_PMINUS2_CONST));
+        memcpy(_3P, _3P_CONST, sizeof(_3P_CONST));
+        memcpy(_4P, _4P_CONST, sizeof(_4P_CONST));
         _PBITS = _PBITS_CONST;
     }
     __syncthreads();
 }
 
+#ifdef INTERLEAVED_LAYOUT
 template<int N> __device__ void readBigInt(const unsigned int *ara, int idx, unsigned int *x)
 {
     for(int i = 0; i < N; i++ ) {
@@ -171,13 +424,74 @@ template<int N> __device__ void writeBigInt(unsigned int *ara, int idx, const un
         ara[getIndex<N>(idx) + i] = x[i];
     }
 }
+#else
+/**
+ * Reads an integer from global memory with one 128-bit load per word group.
+ * The padding words of the last group are discarded
+ */
+template<int N> __device__ void readBigInt(const unsigned int *ara, int idx, unsigned int *x)
+{
+    #pragma unroll
+    for(int g = 0; g < LAYOUT_GROUPS(N); g++) {
+        uint4 v = *(const uint4 *)&ara[getGroupIndex<N>(idx, g)];
+
+        x[4 * g] = v.x;
+        if(4 * g + 1 < N) {
+            x[4 * g + 1] = v.y;
+        }
+        if(4 * g + 2 < N) {
+            x[4 * g + 2] = v.z;
+        }
+        if(4 * g + 3 < N) {
+            x[4 * g + 3] = v.w;
+        }
+    }
+}
+
+/**
+ * Retrives a single word from an integer in global memory
+ */
+template<int N> __device__ unsigned int readBigIntWord(const unsigned int *ara, int idx, int word)
+{
+    return ara[getGroupIndex<N>(idx, word / LAYOUT_GROUP_WORDS) + word % LAYOUT_GROUP_WORDS];
+}
+
+__device__ void writeBigInt(unsigned int *ara, int idx, const unsigned int *x, int len)
+{
+    int groups = (len + LAYOUT_GROUP_WORDS - 1) / LAYOUT_GROUP_WORDS;
+
+    for(int i = 0; i < len; i++) {
+        int g = i / LAYOUT_GROUP_WORDS;
+        ara[LAYOUT_GROUP_WORDS * ((groups * idx + g) * gridDim.x * blockDim.x + blockIdx.x * blockDim.x + threadIdx.x) + i % LAYOUT_GROUP_WORDS] = x[i];
+    }
+}
+
+/**
+ * Writes an integer to global memory with one 128-bit store per word group.
+ * The padding words of the last group are set to 0
+ */
+template<int N> __device__ void writeBigInt(unsigned int *ara, int idx, const unsigned int *x)
+{
+    #pragma unroll
+    for(int g = 0; g < LAYOUT_GROUPS(N); g++) {
+        uint4 v;
+
+        v.x = x[4 * g];
+        v.y = 4 * g + 1 < N ? x[4 * g + 1] : 0;
+        v.z = 4 * g + 2 < N ? x[4 * g + 2] : 0;
+        v.w = 4 * g + 3 < N ? x[4 * g + 3] : 0;
+
+        *(uint4 *)&ara[getGroupIndex<N>(idx, g)] = v;
+    }
+}
+#endif
 
 template<int N> __device__ unsigned int equalTo(const unsigned int *a, const unsigned int *b)
 {
     unsigned int result = 0xffffffff;
     for(int i = 0; i < N; i++) {
         unsigned int eq = 0;
-        asm volatile("set.eq.u32.u32 %0, %1, %2;\n\t" : "=r"(eq) : "r"(a[i]), "r"(b[i]));
+        set_eq(eq, a[i], b[i]);
         result &= eq; 
     }
 
@@ -191,7 +505,12 @@ template<int N> __device__ void rightShift(const unsigned int *in, unsigned int
 
     if(rShift > 0) {
         for(int i = 0; i < N; i++) {
+#if __CUDA_ARCH__ >= 320
+            // One funnel shift instead of two shifts and an or
+            out[ i ] = __funnelshift_r(in[ N - 1 + i ], in[ N + i ], rShift);
+#else
             out[ i ] = (in[ N - 1 + i ] >> rShift) | (in[ N + i ] << lShift);
+#endif
         }
     } else {
         for(int i = 0; i < N; i++) {
@@ -212,8 +531,8 @@ template<int N> __device__ unsigned int greaterThanEqualTo(const unsigned int *a
         unsigned int eq = 0;
         unsigned int x = a[i];
         unsigned int y = b[i];
-        asm volatile("set.lo.u32.u32 %0, %1, %2;\n\t" : "=r"(lt) : "r"(x), "r"(y));
-        asm volatile("set.eq.u32.u32 %0, %1, %2;\n\t" : "=r"(eq) : "r"(x), "r"(y));
+        set_lo(lt, x, y);
+        set_eq(eq, x, y);
 
         sum |= lt & mask;
         mask &= eq;
@@ -234,22 +553,105 @@ template<int N> __device__ void subModP(const unsigned int *a, const unsigned in
     }
 }
 
+/**
+ * Addition mod P, computed as a - (P - b)
+ */
+template<int N> __device__ void addModP(const unsigned int *a, const unsigned int *b, unsigned int *c)
+{
+    unsigned int p[N];
+    unsigned int negB[N];
+
+    copy<N>(_P, p);
+    sub<N>(p, b, negB);
+    subModP<N>(a, negB, c);
+}
+
+
+/**
+ * Given a 2N-word x = h * 2^k + l, computes t = l + h * c, which is the same
+ * mod p. Only the low H words of h can be non-zero. t is 2N words
+ */
+template<int N, int H> __device__ void foldModP(const unsigned int *x, unsigned int *t)
+{
+    unsigned int high[N];
+    rightShift<N>(x, high);
+
+    for(int i = 0; i < N; i++) {
+        t[i] = x[i];
+    }
+    t[N - 1] &= _PM_MASK;
+
+    for(int i = N; i < 2 * N; i++) {
+        t[i] = 0;
+    }
+
+    // Add h * c one word of c at a time. The loop bounds are constants so
+    // it unrolls, and every thread takes the same branches
+    for(int j = 0; j < (N + 1) / 2; j++) {
+        if(j < _PM_CWORDS) {
+            unsigned long long carry = 0;
+
+            for(int i = 0; i < H; i++) {
+                carry += (unsigned long long)high[i] * _PM_C[j] + t[i + j];
+                t[i + j] = (unsigned int)carry;
+                carry >>= 32;
+            }
+
+            for(int i = j + H; i < 2 * N; i++) {
+                carry += t[i];
+                t[i] = (unsigned int)carry;
+                carry >>= 32;
+            }
+        }
+    }
+}
+
+/**
+ * Reduction mod p = 2^k - c using only small multiplications by the words of
+ * c. After the first fold the value is below (c + 1)2^k and after the second
+ * below 2^k + c^2 < 2p, whose high part is at most c and so at most half of
+ * the words of p
+ */
+template<int N> __device__ void reducePseudoMersenneModP(const unsigned int *x, unsigned int *c)
+{
+    unsigned int t[2 * N];
+    unsigned int u[2 * N];
+
+    foldModP<N, N>(x, t);
+    foldModP<N, (N + 1) / 2>(t, u);
+
+    // u can reach a word past p when p ends on a word boundary. The
+    // subtraction wraps it around
+    if(u[N] || greaterThanEqualTo<N>(u, _P)) {
+        sub<N>(u, _P, c);
+    } else {
+        copy<N>(u, c);
+    }
+}
 
 /**
- * Barrett reduction
+ * Barrett reduction. Only the parts of the two products that affect the result
+ * are computed: the upper words of xHigh * m and the lower N + 1 words of q * p
  */
 template<int N> __device__ void reduceModP(const unsigned int *x, unsigned int *c)
 {
+    // Moduli of the form 2^k - c have their own reduction. _PM_CWORDS is the
+    // same for every thread, so the branch does not diverge
+    if(_PM_CWORDS > 0) {
+        reducePseudoMersenneModP<N>(x, c);
+        return;
+    }
+
     unsigned int xHigh[N];
     unsigned int xm[N*2];
     unsigned int q[N];
-    unsigned int qp[N*2];
+    unsigned int qp[N+1];
 
     // Get top N bits
     rightShift<N>(x, xHigh);
     
     // Multiply by m
-    multiply<N>(xHigh, _M, xm);
+    multiplyHigh<N>(xHigh, _M, xm);
 
     // Get the high bits of xHigh * m. 
     rightShift<N>(xm, q);
@@ -262,7 +664,7 @@ template<int N> __device__ void reduceModP(const unsigned int *x, unsigned int *
     }
 
     // Multiply by p
-    multiply<N>(q, _P, qp);
+    multiplyLow<N>(q, _P, qp);
     
     // Subtract from x
     unsigned int r[N+1];
@@ -273,13 +675,17 @@ template<int N> __device__ void reduceModP(const unsigned int *x, unsigned int *
     // But it could have been the case that there was a carry from the multiplication operation on
     // the lower bits, which will result in r being >= 2p because in that case we would be
     // doing x - (q-1) * p instead of x - q*p. So we need to check for >= 2p and >= p. Its more checks
-    // but saves us from doing a multiplication.
+    // but saves us from doing a multiplication. Skipping the lowest words of xHigh * m can make q
+    // one smaller again, so r can be up to 4p.
     
+    unsigned int gte4p = greaterThanEqualTo<N+1>(r, _4P);
     unsigned int gte3p = greaterThanEqualTo<N+1>(r, _3P);
     unsigned int gte2p = greaterThanEqualTo<N+1>(r, _2P);
     unsigned int gtep = greaterThanEqualTo<N+1>(r, _P);
 
-    if(gte3p) {
+    if(gte4p) {
+        sub<N>(r, _4P, c);
+    } else if(gte3p) {
         sub<N>(r, _3P, c);
     } else if(gte2p) {
         sub<N>(r, _2P, c);
@@ -290,18 +696,21 @@ template<int N> __device__ void reduceModP(const unsigned int *x, unsigned int *
     }
 }
 
+/**
+ * Multiplication mod P. The product stays in registers for the reduction
+ */
 template<int N> __device__ void multiplyModP(const unsigned int *a, const unsigned int *b, unsigned int *c)
 {
     unsigned int x[2*N];
     multiply<N>(a, b, x);
     reduceModP<N>(x, c);
 }
+
 /**
- * Square with montgomery reduction
+ * Square mod P
  */
 template<int N> __device__ void squareModP(const unsigned int *a, unsigned int *c)
 {
-    //multiplyModP<N>(a, a, c);
     unsigned int x[2*N];
     square<N>(a, x);
     reduceModP<N>(x, c);
@@ -309,37 +718,38 @@ template<int N> __device__ void squareModP(const unsigned int *a, unsigned int *
 
 
 /**
- * Computes multiplicative inverse of a mod P using x^(P-2) mod P
+ * Computes multiplicative inverse of a mod P using a^(P-2) mod P. The
+ * exponentiation is left to right with sliding windows, which takes about
+ * one multiplication per INVERSE_WINDOW + 1 bits of P instead of one per
+ * 2 bits
  */
 template<int N> __device__ void inverseModP(const unsigned int *a, unsigned int *inverse)
 {
-    unsigned int x[N];
-    copy<N>(a, x);
-
-    unsigned int y[N] = {0};
-    y[0] = 1;
-  
-    // First N -1 words in the exponent 
-    for(int j = 0; j < N-1; j++) {
-        unsigned int e = _PMINUS2[j];
-        for(int i = 0; i < 32; i++) {
-            if(e & 1) {
-                multiplyModP<N>(y, x, y);
-            }
+    unsigned int table[INVERSE_TABLE_SIZE][N];
+    unsigned int a2[N];
 
-            squareModP<N>(x, x);
-            e >>= 1;
-        }
+    copy<N>(a, table[0]);
+    squareModP<N>(a, a2);
+
+    for(int i = 1; i < INVERSE_TABLE_SIZE; i++) {
+        multiplyModP<N>(table[i - 1], a2, table[i]);
     }
 
-    // Last word in the exponent
-    unsigned int e = _PMINUS2[N-1];
-    while( e ) {
-        if( e & 1 ) {
-            multiplyModP<N>(y, x, y);
+    // The first window starts the result
+    unsigned int y[N];
+    copy<N>(table[(_INVERSE_STEPS[0] & 0xffff) >> 1], y);
+
+    for(unsigned int i = 1; i < _INVERSE_STEP_COUNT; i++) {
+        unsigned int step = _INVERSE_STEPS[i];
+
+        for(unsigned int j = step >> 16; j > 0; j--) {
+            squareModP<N>(y, y);
+        }
+
+        unsigned int digit = step & 0xffff;
+        if(digit != 0) {
+            multiplyModP<N>(y, table[digit >> 1], y);
         }
-        squareModP<N>(x, x);
-        e >>= 1;
     }
 
     copy<N>(y, inverse);
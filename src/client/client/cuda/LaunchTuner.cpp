@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <fstream>
+#include "gpu.h"
+
+#include "logger.h"
+#include "kernels.h"
+#include "LaunchTuner.h"
+
+/**
+ * Bytes of device memory used by the points of a launch configuration: x, y
+ * and the two batch inversion buffers, and the starting points when the
+ * persistent kernel is used
+ */
+static size_t getPointBytes(int pWords, unsigned int stepsPerLaunch, const LaunchConfig &config)
+{
+    size_t arrays = stepsPerLaunch > 1 ? 6 : 4;
+    size_t points = (size_t)config.blocks * config.threads * config.pointsPerThread;
+
+    return arrays * sizeof(unsigned int) * LAYOUT_WORDS(pWords) * points;
+}
+
+static size_t getFreeMemory()
+{
+    size_t freeBytes = 0;
+    size_t totalBytes = 0;
+
+    cudaError_t cudaError = cudaMemGetInfo(&freeBytes, &totalBytes);
+    if(cudaError != cudaSuccess) {
+        throw cudaError;
+    }
+
+    return freeBytes;
+}
+
+/**
+ * Loads the cache. A missing file is an empty cache
+ */
+LaunchTuner::LaunchTuner(const std::string &fileName)
+{
+    _fileName = fileName;
+    _cache = Json::Value(Json::objectValue);
+
+    std::ifstream file(fileName.c_str());
+    if(!file.is_open()) {
+        return;
+    }
+
+    Json::Reader reader;
+    if(!reader.parse(file, _cache) || !_cache.isObject()) {
+        Logger::logError("Ignoring invalid tuning cache %s", fileName.c_str());
+        _cache = Json::Value(Json::objectValue);
+    }
+}
+
+/**
+ * Looks up the configuration found for a GPU model and integer length.
+ * Returns false when there is none for the given steps per launch
+ */
+bool LaunchTuner::lookup(const std::string &deviceName, int pWords, unsigned int stepsPerLaunch, LaunchConfig &config)
+{
+    char key[16];
+    sprintf(key, "%d", pWords);
+
+    if(!_cache.isMember(deviceName) || !_cache[deviceName].isMember(key)) {
+        return false;
+    }
+
+    Json::Value entry = _cache[deviceName][key];
+    if(entry.get("steps_per_launch", 0).asUInt() != stepsPerLaunch) {
+        return false;
+    }
+
+    config.blocks = entry.get("blocks", 0).asUInt();
+    config.threads = entry.get("threads", 0).asUInt();
+    config.pointsPerThread = entry.get("points_per_thread", 0).asUInt();
+
+    return config.blocks > 0 && config.threads > 0 && config.pointsPerThread > 0;
+}
+
+/**
+ * Records the configuration for a GPU model and integer length and writes
+ * the cache to its file
+ */
+void LaunchTuner::store(const std::string &deviceName, int pWords, unsigned int stepsPerLaunch, const LaunchConfig &config, unsigned long long pointsPerSecond)
+{
+    char key[16];
+    sprintf(key, "%d", pWords);
+
+    Json::Value entry(Json::objectValue);
+    entry["blocks"] = config.blocks;
+    entry["threads"] = config.threads;
+    entry["points_per_thread"] = config.pointsPerThread;
+    entry["steps_per_launch"] = stepsPerLaunch;
+    entry["points_per_second"] = (double)pointsPerSecond;
+
+    _cache[deviceName][key] = entry;
+
+    Json::StyledWriter writer;
+    std::ofstream file(_fileName.c_str());
+
+    if(!file.is_open()) {
+        Logger::logError("Cannot write tuning cache %s", _fileName.c_str());
+        return;
+    }
+
+    file << writer.write(_cache);
+}
+
+/**
+ * Gets a grid shape for every block size from a warp up to TUNE_MAX_THREADS.
+ * Each shape has as many blocks as fit on the device at once for the
+ * register and shared memory use of the step kernel. Shapes whose points do
+ * not fit in device memory are left out
+ */
+std::vector<LaunchConfig> LaunchTuner::getGridShapes(int device, int pWords, unsigned int stepsPerLaunch, int rPoints, unsigned int pointsPerThread)
+{
+    cudaDeviceProp properties;
+    std::vector<LaunchConfig> shapes;
+
+    cudaError_t cudaError = cudaSetDevice(device);
+    if(cudaError != cudaSuccess) {
+        throw cudaError;
+    }
+
+    cudaError = cudaGetDeviceProperties(&properties, device);
+    if(cudaError != cudaSuccess) {
+        throw cudaError;
+    }
+
+    // The R points are in shared memory when they fit, like in copyRPointsToDevice
+    size_t rPointBytes = 2 * sizeof(unsigned int) * pWords * rPoints;
+    size_t sharedBytes = rPointBytes <= getSharedRPointLimit(device) ? rPointBytes : 0;
+
+    size_t freeBytes = getFreeMemory();
+    bool persistent = stepsPerLaunch > 1;
+
+    for(int threads = properties.warpSize; threads <= TUNE_MAX_THREADS; threads *= 2) {
+        cudaFuncAttributes attributes;
+        int blocksPerMP = 0;
+
+        cudaError = getDoStepKernelInfo(pWords, persistent, threads, sharedBytes, &attributes, &blocksPerMP);
+        if(cudaError != cudaSuccess) {
+            throw cudaError;
+        }
+
+        if(threads == properties.warpSize) {
+            Logger::logInfo("Step kernel: %d registers, %d bytes of local memory, at most %d threads per block",
+                            attributes.numRegs, (int)attributes.localSizeBytes, attributes.maxThreadsPerBlock);
+        }
+
+        if(threads > attributes.maxThreadsPerBlock || blocksPerMP == 0) {
+            break;
+        }
+
+        LaunchConfig config;
+        config.threads = threads;
+        config.blocks = blocksPerMP * properties.multiProcessorCount;
+        config.pointsPerThread = pointsPerThread;
+
+        if(getPointBytes(pWords, stepsPerLaunch, config) > freeBytes * TUNE_MEMORY_FRACTION) {
+            continue;
+        }
+
+        shapes.push_back(config);
+    }
+
+    return shapes;
+}
+
+/**
+ * Gets the powers of 2 from minPoints up to TUNE_MAX_POINTS that fit in
+ * device memory as points per thread for the grid
+ */
+std::vector<unsigned int> LaunchTuner::getPointCounts(int device, int pWords, unsigned int stepsPerLaunch, const LaunchConfig &grid, unsigned int minPoints)
+{
+    std::vector<unsigned int> counts;
+
+    cudaError_t cudaError = cudaSetDevice(device);
+    if(cudaError != cudaSuccess) {
+        throw cudaError;
+    }
+
+    size_t freeBytes = getFreeMemory();
+
+    for(unsigned int count = 1; count <= TUNE_MAX_POINTS; count *= 2) {
+        if(count < minPoints) {
+            continue;
+        }
+
+        LaunchConfig config = grid;
+        config.pointsPerThread = count;
+
+        if(getPointBytes(pWords, stepsPerLaunch, config) > freeBytes * TUNE_MEMORY_FRACTION) {
+            break;
+        }
+
+        counts.push_back(count);
+    }
+
+    return counts;
+}
@@ -0,0 +1,51 @@
+#ifndef _LAUNCH_TUNER_H
+#define _LAUNCH_TUNER_H
+
+#include <string>
+#include <vector>
+#include "json/json.h"
+
+// Kernel iterations each candidate configuration is benchmarked for
+#define TUNE_ITERATIONS 200
+
+// Largest block size that is tried
+#define TUNE_MAX_THREADS 512
+
+// Most points per thread that are tried
+#define TUNE_MAX_POINTS 64
+
+// Fraction of the free device memory the points of a candidate may use
+#define TUNE_MEMORY_FRACTION 0.5
+
+/**
+ * Grid shape of a device
+ */
+typedef struct {
+    unsigned int blocks;
+    unsigned int threads;
+    unsigned int pointsPerThread;
+}LaunchConfig;
+
+/**
+ * Picks the candidate grid shapes for a device from its properties and the
+ * register usage of the step kernel, and keeps the best shape found for
+ * each GPU model and integer length in a JSON file so a device is only
+ * tuned once
+ */
+class LaunchTuner {
+
+private:
+    std::string _fileName;
+    Json::Value _cache;
+
+public:
+    LaunchTuner(const std::string &fileName);
+
+    bool lookup(const std::string &deviceName, int pWords, unsigned int stepsPerLaunch, LaunchConfig &config);
+    void store(const std::string &deviceName, int pWords, unsigned int stepsPerLaunch, const LaunchConfig &config, unsigned long long pointsPerSecond);
+
+    static std::vector<LaunchConfig> getGridShapes(int device, int pWords, unsigned int stepsPerLaunch, int rPoints, unsigned int pointsPerThread);
+    static std::vector<unsigned int> getPointCounts(int device, int pWords, unsigned int stepsPerLaunch, const LaunchConfig &grid, unsigned int minPoints);
+};
+
+#endif
@@ -1,8 +1,7 @@
 #include <stdio.h>
 #include <string.h>
-#include <cuda.h>
-#include <cuda_runtime.h>
 #include <stdlib.h>
+#include <algorithm>
 
 #include "logger.h"
 #include "RhoCUDA.h"
@@ -10,6 +9,7 @@
 #include "ecc.h"
 #include "util.h"
 #include "cudapp.h"
+#include "StartingPointPool.h"
 
 void printBigInt(unsigned int *x, int len)
 {
@@ -80,11 +80,36 @@ void RhoCUDA::cudaException(cudaError_t error)
  
  idx is the index of the value
 
+ That is the layout when building with INTERLEAVED_LAYOUT. Otherwise each
+ row is split into rows of 4-word groups, so the device reads every group
+ with a 128-bit load and a warp reads 512 consecutive bytes. Word w of a
+ value is at
+
+ 4 * ((groups * idx + w / 4) * numThreads + threadId) + w % 4
+
+ where groups is the number of 4-word groups in the integer. The last
+ group is padded with zeros
+
  */
 
-unsigned int RhoCUDA::getIndex(unsigned int block, unsigned int thread, unsigned int idx)
+unsigned int RhoCUDA::getIndex(unsigned int block, unsigned int thread, unsigned int idx, unsigned int word)
 {
-    return _pWords * (_blocks * _threadsPerBlock * idx + block * _threadsPerBlock + thread);
+    return getIndex(block, thread, idx, word, _pWords);
+}
+
+/**
+ * Index of a word in an array of values that are words long, such as the
+ * negation map state
+ */
+unsigned int RhoCUDA::getIndex(unsigned int block, unsigned int thread, unsigned int idx, unsigned int word, unsigned int words)
+{
+#ifdef INTERLEAVED_LAYOUT
+    return words * (_blocks * _threadsPerBlock * idx + block * _threadsPerBlock + thread) + word;
+#else
+    unsigned int groups = LAYOUT_GROUPS(words);
+
+    return LAYOUT_GROUP_WORDS * ((groups * idx + word / LAYOUT_GROUP_WORDS) * _blocks * _threadsPerBlock + block * _threadsPerBlock + thread) + word % LAYOUT_GROUP_WORDS;
+#endif
 }
 
 /**
@@ -93,7 +118,7 @@ unsigned int RhoCUDA::getIndex(unsigned int block, unsigned int thread, unsigned
 void RhoCUDA::splatBigInt(unsigned int *ara, const unsigned int *x, unsigned int block, unsigned int thread, unsigned int index)
 {
     for(int i = 0; i < _pWords; i++) {
-        ara[getIndex(block, thread, index) + i] = x[i];
+        ara[getIndex(block, thread, index, i)] = x[i];
     }
 }
 
@@ -104,57 +129,71 @@ void RhoCUDA::splatBigInt(unsigned int *ara, const unsigned int *x, unsigned int
 void RhoCUDA::extractBigInt(unsigned int *x, const unsigned int *ara, unsigned int block, unsigned int thread, unsigned int index)
 {
     for(int i = 0; i < _pWords; i++) {
-        x[ i ] = ara[getIndex(block, thread, index) + i];
+        x[ i ] = ara[getIndex(block, thread, index, i)];
     }
 }
 
-void RhoCUDA::readX(unsigned int *x, unsigned int block, unsigned int thread, unsigned int index)
+void RhoCUDA::readX(unsigned int *x, unsigned int block, unsigned int thread, unsigned int index, cudaStream_t stream)
 {
-    readBigInt(x, _devX, block, thread, index);
+    readBigInt(x, _devX, block, thread, index, stream);
 }
 
-void RhoCUDA::readY(unsigned int *y, unsigned int block, unsigned int thread, unsigned int index)
+void RhoCUDA::readY(unsigned int *y, unsigned int block, unsigned int thread, unsigned int index, cudaStream_t stream)
 {
-    readBigInt(y, _devY, block, thread, index);
+    readBigInt(y, _devY, block, thread, index, stream);
 }
 
-void RhoCUDA::writeX(const unsigned int *x, unsigned int block, unsigned int thread, unsigned int index)
+void RhoCUDA::writeX(const unsigned int *x, unsigned int block, unsigned int thread, unsigned int index, cudaStream_t stream)
 {
-    writeBigInt(_devX, x, block, thread, index);
+    writeBigInt(_devX, x, block, thread, index, stream);
 }
 
-void RhoCUDA::writeY(const unsigned int *y, unsigned int block, unsigned int thread, unsigned int index)
+void RhoCUDA::writeY(const unsigned int *y, unsigned int block, unsigned int thread, unsigned int index, cudaStream_t stream)
 {
-    writeBigInt(_devY, y, block, thread, index);
+    writeBigInt(_devY, y, block, thread, index, stream);
 }
 
-
-void RhoCUDA::readBigInt(unsigned int *dest, const unsigned int *src, unsigned int block, unsigned int thread, unsigned int index)
+/**
+ * Copies an integer from the device, one copy per word group. The copies are
+ * queued on the stream and this waits for them
+ */
+void RhoCUDA::readBigInt(unsigned int *dest, const unsigned int *src, unsigned int block, unsigned int thread, unsigned int index, cudaStream_t stream)
 {
-    CUDA::memcpy(dest, &src[getIndex(block, thread, index)], _pWords * sizeof(unsigned int), cudaMemcpyDeviceToHost);
+    for(int i = 0; i < _pWords; i += LAYOUT_GROUP_WORDS) {
+        int words = std::min(_pWords - i, LAYOUT_GROUP_WORDS);
+
+        CUDA::memcpyAsync(&dest[i], &src[getIndex(block, thread, index, i)], words * sizeof(unsigned int), cudaMemcpyDeviceToHost, stream);
+    }
+    CUDA::streamSynchronize(stream);
 }
 
-void RhoCUDA::writeBigInt(unsigned int *dest, const unsigned int *src, unsigned int block, unsigned int thread, unsigned int index)
+/**
+ * Copies an integer to the device, one copy per word group. The copies are
+ * queued on the stream so they finish before the next kernel on that stream.
+ * src is copied before this returns
+ */
+void RhoCUDA::writeBigInt(unsigned int *dest, const unsigned int *src, unsigned int block, unsigned int thread, unsigned int index, cudaStream_t stream)
 {
-    CUDA::memcpy(&dest[getIndex(block, thread, index)], src, _pWords * sizeof(unsigned int), cudaMemcpyHostToDevice);
+    for(int i = 0; i < _pWords; i += LAYOUT_GROUP_WORDS) {
+        int words = std::min(_pWords - i, LAYOUT_GROUP_WORDS);
+
+        CUDA::memcpyAsync(&dest[getIndex(block, thread, index, i)], &src[i], words * sizeof(unsigned int), cudaMemcpyHostToDevice, stream);
+    }
 }
 
 
 
 void RhoCUDA::setRPoints()
 {
-    unsigned int rxAra[ _numRPoints * _pWords ];
-    unsigned int ryAra[ _numRPoints * _pWords ];
-
-    memset(rxAra, 0, sizeof(unsigned int) * _numRPoints * _pWords);
-    memset(ryAra, 0, sizeof(unsigned int) * _numRPoints * _pWords);
+    std::vector<unsigned int> rxAra(_numRPoints * _pWords, 0);
+    std::vector<unsigned int> ryAra(_numRPoints * _pWords, 0);
 
     for(unsigned int i = 0; i < _numRPoints; i++) {
         _rx[i].getWords(&rxAra[ i * _pWords]);
         _ry[i].getWords(&ryAra[ i * _pWords]);
     }
 
-    cudaError_t cudaError = copyRPointsToDevice(rxAra, ryAra, _pWords, _numRPoints);
+    cudaError_t cudaError = copyRPointsToDevice(&rxAra[0], &ryAra[0], _pWords, _numRPoints, _devRx, _devRy);
 
     if( cudaError != cudaSuccess ) {
         throw cudaError;
@@ -174,7 +213,31 @@ void RhoCUDA::setupDeviceConstants()
     unsigned int mAra[_mWords];
     _m.getWords(mAra);
 
-    cudaError = initDeviceParams(pAra, _pBits, mAra, _mBits, _params.dBits);
+    _deviceBits = atomicLoad(&_dBits);
+    cudaError = initDeviceParams(pAra, _pBits, mAra, _mBits, _deviceBits);
+
+    if(cudaError != cudaSuccess) {
+        throw cudaError;
+    }
+
+    // The order for the coefficients of starting points
+    unsigned int nAra[_pWords];
+    _params.n.getWords(nAra, _pWords);
+
+    cudaError = initDeviceOrder(nAra, _pWords);
+
+    if(cudaError != cudaSuccess) {
+        throw cudaError;
+    }
+
+    if(_params.negation) {
+        unsigned int aAra[_pWords];
+        _params.a.getWords(aAra, _pWords);
+
+        cudaError = initDeviceNegationParams(aAra, nAra, _pWords);
+    } else {
+        cudaError = disableDeviceNegation();
+    }
 
     if(cudaError != cudaSuccess) {
         throw cudaError;
@@ -182,67 +245,45 @@ void RhoCUDA::setupDeviceConstants()
 }
 
 /**
- * Generates a random point in the form aG + bQ. 
+ * Copies a change of the distinguished bits to the device. No stream may be
+ * running
  */
-void RhoCUDA::getRandomPoint(unsigned int *x, unsigned int *y, unsigned int *a, unsigned int *b)
+bool RhoCUDA::loadDistinguishedBits()
 {
-    unsigned int mask = (0x01 << _params.dBits) - 1;
-    do {
-        memset(x, 0, sizeof(unsigned int) * _pWords);
-        memset(y, 0, sizeof(unsigned int) * _pWords);
-        memset(a, 0, sizeof(unsigned int) * _pWords);
-        memset(b, 0, sizeof(unsigned int) * _pWords);
-
-        // points G and Q
-        ECPoint g(_params.gx, _params.gy);
-        ECPoint q(_params.qx, _params.qy);
-
-        // Random a and b
-        BigInteger m1 = randomBigInteger(2, _params.n);
-        BigInteger m2 = randomBigInteger(2, _params.n);
+    _deviceBits = atomicLoad(&_dBits);
 
-        // aG, bQ
-        ECPoint aG = _curve.multiply(m1, g);
-        ECPoint bQ = _curve.multiply(m2, q);
+    cudaError_t cudaError = setNumDistinguishedBits(_deviceBits);
+    if(cudaError != cudaSuccess) {
+        Logger::logError("CUDA error: %s\n", cudaGetErrorString(cudaError));
+        return false;
+    }
 
-        // aG + bQ
-        ECPoint sum = _curve.add(aG, bQ);
+    Logger::logInfo("Device %d: walks stop at %d distinguished bits", _device, _deviceBits);
 
-        // Convert to uint160 type
-        BigInteger sumX = sum.getX();
-        BigInteger sumY = sum.getY();
+    return true;
+}
 
-        sumX.getWords(x);
-        sumY.getWords(y);
-        m1.getWords(a);
-        m2.getWords(b);
-    }while((x[0] & mask) == 0);
+/**
+ * Makes the walks stop at dBits distinguished bits. A running context
+ * changes them once its streams have finished, and the walks continue
+ */
+void RhoCUDA::setDistinguishedBits(unsigned int dBits)
+{
+    atomicStore(&_dBits, dBits);
 }
 
 /**
- * Generates random 'a' and 'b' values
+ * Copies the constants of the context to the device again. Contexts on the
+ * same device share its constant memory, so another context may have
+ * replaced them since this one last ran
  */
-void RhoCUDA::generateExponentsHost()
+void RhoCUDA::loadDeviceConstants()
 {
-    Logger::logInfo("Generating exponents");
-    for(unsigned int block = 0; block < _blocks; block++) {
-        for(unsigned int index = 0; index < _pointsPerThread; index++) {
-            for(unsigned int thread = 0; thread < _threadsPerBlock; thread++) {
-                // TODO: Use better RNG here
-                BigInteger a = randomBigInteger(1, _params.n);
-                BigInteger b = randomBigInteger(1, _params.n);
-                unsigned int aWords[_pWords];
-                unsigned int bWords[_pWords];
-
-                memset(aWords, 0, _pWords * sizeof(unsigned int));
-                memset(bWords, 0, _pWords * sizeof(unsigned int));
-
-                a.getWords(aWords);
-                b.getWords(bWords);
-                splatBigInt(_aStart, aWords, block, thread, index);
-                splatBigInt(_bStart, bWords, block, thread, index);
-            }
-        }
+    setupDeviceConstants();
+    setRPoints();
+
+    if(_stepsPerLaunch > 1) {
+        setRestartParams();
     }
 }
 
@@ -327,162 +368,199 @@ void RhoCUDA::generateLookupTable(unsigned int *gx, unsigned int *gy, unsigned i
 }
 
 /**
- * Generates a random set of starting points for the random walks. Each
- * GPU thread has a different starting point
+ * Copies the multiples of G, Q and G + Q to the device
+ */
+void RhoCUDA::setupStartingPointTables()
+{
+    std::vector<unsigned int> gx(_pBits * _pWords);
+    std::vector<unsigned int> gy(_pBits * _pWords);
+    std::vector<unsigned int> qx(_pBits * _pWords);
+    std::vector<unsigned int> qy(_pBits * _pWords);
+    std::vector<unsigned int> gqx(_pBits * _pWords);
+    std::vector<unsigned int> gqy(_pBits * _pWords);
+
+    generateLookupTable(&gx[0], &gy[0], &qx[0], &qy[0], &gqx[0], &gqy[0]);
+
+    size_t size = _pBits * _pWords * sizeof(unsigned int);
+
+    CUDA::memcpy(_devGx, &gx[0], size, cudaMemcpyHostToDevice);
+    CUDA::memcpy(_devGy, &gy[0], size, cudaMemcpyHostToDevice);
+    CUDA::memcpy(_devQx, &qx[0], size, cudaMemcpyHostToDevice);
+    CUDA::memcpy(_devQy, &qy[0], size, cudaMemcpyHostToDevice);
+    CUDA::memcpy(_devGQx, &gqx[0], size, cudaMemcpyHostToDevice);
+    CUDA::memcpy(_devGQy, &gqy[0], size, cudaMemcpyHostToDevice);
+}
+
+/**
+ * Sets pointsPerThread points of each thread to aG + bQ for random a and b,
+ * or to tame and wild kangaroos for a kangaroo job. Everything is done on
+ * the device, the coefficients included, and all the arrays are in device
+ * memory. With the negation map the points are moved to the ones with an
+ * even y, and negation is their negation map state or NULL
  */
-void RhoCUDA::generateStartingPoints(bool doVerify)
-{   
+void RhoCUDA::generatePoints(unsigned int *x, unsigned int *y, unsigned int *a, unsigned int *b, unsigned int pointsPerThread, unsigned int *negation)
+{
+    unsigned long long seed = 0;
+    util::getRandomBytes((unsigned char *)&seed, sizeof(seed));
+
     cudaError_t cudaError = cudaSuccess;
 
-    Logger::logInfo("Generating starting points\n");
-    unsigned int gx[ _pBits * _pWords ];
-    unsigned int gy[ _pBits * _pWords ];
-    unsigned int qx[ _pBits * _pWords ];
-    unsigned int qy[ _pBits * _pWords ];
-    unsigned int gqx[ _pBits * _pWords ];
-    unsigned int gqy[ _pBits * _pWords ];
-
-    // Generate the lookup table to make point generation faster
-    generateLookupTable(gx, gy, qx, qy, gqx, gqy);
-
-    unsigned int *devGx = NULL;
-    unsigned int *devGy = NULL;
-    unsigned int *devQx = NULL;
-    unsigned int *devQy = NULL;
-    unsigned int *devGQx = NULL;
-    unsigned int *devGQy = NULL;
-
-    Logger::logInfo("Allocating device memory\n");
-    // Allocate tables in device memory and copy them over
-    try {
-        unsigned int size = _pBits * _pWords * sizeof(unsigned int);
-        devGx = (unsigned int *)CUDA::malloc(size);
-        devGy = (unsigned int *)CUDA::malloc(size);
-        devQx = (unsigned int *)CUDA::malloc(size);
-        devQy = (unsigned int *)CUDA::malloc(size);
-        devGQx = (unsigned int *)CUDA::malloc(size);
-        devGQy = (unsigned int *)CUDA::malloc(size);
-
-        CUDA::memcpy(devGx, gx, size, cudaMemcpyHostToDevice);
-        CUDA::memcpy(devGy, gy, size, cudaMemcpyHostToDevice);
-        CUDA::memcpy(devQx, qx, size, cudaMemcpyHostToDevice);
-        CUDA::memcpy(devQy, qy, size, cudaMemcpyHostToDevice);
-        CUDA::memcpy(devGQx, gqx, size, cudaMemcpyHostToDevice);
-        CUDA::memcpy(devGQy, gqy, size, cudaMemcpyHostToDevice);
-    } catch(cudaError_t e) {
-        cudaError = e;
-        goto end;
-    }
-
-    // Generate 'a' and 'b'
-    generateExponentsHost();
-
-    // Reset points to point at infinity
-    Logger::logInfo("Resetting points");
-    resetPoints(_blocks, _threadsPerBlock, _pointsPerThread, _devX, _devY);
+    if(_params.kangaroo) {
+        BigInteger width = _params.upper - _params.lower;
+
+        unsigned int n[_pWords];
+        unsigned int widthWords[_pWords];
+        unsigned int tameBase[_pWords];
+        unsigned int wildBase[_pWords];
+
+        _params.n.getWords(n, _pWords);
+        width.getWords(widthWords, _pWords);
+        _params.lower.getWords(tameBase, _pWords);
+        ((_params.n - (width >> 1)) % _params.n).getWords(wildBase, _pWords);
+
+        cudaError = cudaGenerateIntervalExponents(_pWords, _blocks, _threadsPerBlock, pointsPerThread, a, b, seed,
+                                                  n, widthWords, tameBase, wildBase);
+    } else {
+        cudaError = cudaGenerateExponents(_pWords, _blocks, _threadsPerBlock, pointsPerThread, a, b, seed);
+    }
+    if(cudaError != cudaSuccess) {
+        throw cudaError;
+    }
+
+    // Start at the point at infinity and add the multiples for each bit
+    cudaError = resetPoints(_blocks, _threadsPerBlock, pointsPerThread, x, y);
+    if(cudaError != cudaSuccess) {
+        throw cudaError;
+    }
 
     for(unsigned int i = 0; i < _pBits; i++) {
-        cudaError = multiplyAddG( _blocks, _threadsPerBlock, _pointsPerThread,
-                                  _devAStart, _devBStart,
-                                  devGx, devGy,
-                                  devQx, devQy,
-                                  devGQx, devGQy,
-                                  _devX, _devY,
+        cudaError = multiplyAddG( _blocks, _threadsPerBlock, pointsPerThread,
+                                  a, b,
+                                  _devGx, _devGy,
+                                  _devQx, _devQy,
+                                  _devGQx, _devGQy,
+                                  x, y,
                                   _devDiffBuf, _devChainBuf,
                                   i);
-        if( cudaError != cudaSuccess ) {
-            Logger::logInfo("ERROR!\n");
-            goto end;
+        if(cudaError != cudaSuccess) {
+            throw cudaError;
         }
     }
-    Logger::logInfo("Done");
 
-    if(doVerify) {
-        // Verify all points are valid
-        Logger::logInfo("Verifying points...");
-        fflush(stdout);
-        for(int block = 0; block < _blocks; block++) {
-            for(int thread = 0; thread < _threadsPerBlock; thread++) {
+    if(_params.negation) {
+        cudaError = cudaInitNegation(_pWords, _blocks, _threadsPerBlock, pointsPerThread, x, y, a, b, negation);
+        if(cudaError != cudaSuccess) {
+            throw cudaError;
+        }
+    }
+}
 
-                for(int i = 0; i < _pointsPerThread; i++) {
-                    Logger::logInfo("%d %d %d", block, thread, i);
-                    unsigned int xTest[_pWords];
-                    unsigned int yTest[_pWords];
-                    unsigned int aTest[_pWords];
-                    unsigned int bTest[_pWords];
+/**
+ * Checks that a random sample of the points in x and y are aG + bQ for
+ * their coefficients in a and b. The arrays are in device memory
+ */
+bool RhoCUDA::verifySample(const unsigned int *x, const unsigned int *y, const unsigned int *a, const unsigned int *b, unsigned int pointsPerThread)
+{
+    ECPoint g(_params.gx, _params.gy);
+    ECPoint q(_params.qx, _params.qy);
 
-                    memset(xTest, 0, sizeof(unsigned int) * _pWords);
-                    memset(yTest, 0, sizeof(unsigned int) * _pWords);
-                    memset(aTest, 0, sizeof(unsigned int) * _pWords);
-                    memset(bTest, 0, sizeof(unsigned int) * _pWords);
+    for(int k = 0; k < VERIFY_SAMPLE_POINTS; k++) {
+        unsigned int r[3];
+        util::getRandomBytes((unsigned char *)r, sizeof(r));
+
+        unsigned int block = r[0] % _blocks;
+        unsigned int thread = r[1] % _threadsPerBlock;
+        unsigned int index = r[2] % pointsPerThread;
+
+        unsigned int xWords[_pWords];
+        unsigned int yWords[_pWords];
+        unsigned int aWords[_pWords];
+        unsigned int bWords[_pWords];
+
+        readBigInt(xWords, x, block, thread, index, 0);
+        readBigInt(yWords, y, block, thread, index, 0);
+        readBigInt(aWords, a, block, thread, index, 0);
+        readBigInt(bWords, b, block, thread, index, 0);
+
+        BigInteger aBig(aWords, _pWords);
+        BigInteger bBig(bWords, _pWords);
+        BigInteger xBig(xWords, _pWords);
+        BigInteger yBig(yWords, _pWords);
+
+        ECPoint p1 = _curve.multiply(aBig, g);
+        ECPoint p2 = _curve.multiply(bBig, q);
+        ECPoint sum = _curve.add(p1, p2);
+
+        if(sum.getX() != xBig || sum.getY() != yBig) {
+            Logger::logError("Invalid starting point: block %d thread %d index %d", block, thread, index);
+            Logger::logError("a: %s", aBig.toString(16).c_str());
+            Logger::logError("b: %s", bBig.toString(16).c_str());
+            Logger::logError("Expected: [ %s, %s ]", sum.getX().toString(16).c_str(), sum.getY().toString(16).c_str());
+            Logger::logError("Actual: [ %s, %s ]", xBig.toString(16).c_str(), yBig.toString(16).c_str());
+            return false;
+        }
+    }
 
-                    readX(xTest, block, thread, i);
-                    readY(yTest, block, thread, i);
+    return true;
+}
 
-                    extractBigInt(aTest, _aStart, block, thread, i);
-                    extractBigInt(bTest, _bStart, block, thread, i);
+/**
+ * Sets every walk to a random starting point generated on the device.
+ * The coefficients are generated in device memory and then copied to the
+ * host in one go. Returns false if a point of the sample checked on the host
+ * is wrong
+ */
+bool RhoCUDA::generateStartingPoints()
+{
+    size_t arraySize = sizeof(unsigned int) * LAYOUT_WORDS(_pWords) * _numThreads * _pointsPerThread;
+    bool valid = false;
 
-                    BigInteger xBig(xTest, _pWords);
-                    BigInteger yBig(yTest, _pWords);
-                    BigInteger aBig(aTest, _pWords);
-                    BigInteger bBig(bTest, _pWords);
+    Logger::logInfo("Generating starting points");
+    unsigned int t0 = util::getSystemTime();
 
-                    ECPoint g(_params.gx, _params.gy);
-                    ECPoint q(_params.qx, _params.qy);
-                     
-                    ECPoint p(xBig, yBig);
+    unsigned int *devA = (unsigned int *)CUDA::malloc(arraySize);
+    unsigned int *devB = NULL;
 
-                    ECPoint p1 = _curve.multiply(aBig, g);
-                    ECPoint p2 = _curve.multiply(bBig, q);
-                    ECPoint sum = _curve.add(p1, p2);
+    try {
+        devB = (unsigned int *)CUDA::malloc(arraySize);
 
-                    if(!_curve.pointExists(p)) {
-                        Logger::logInfo("Error: Point is NOT on curve!\n");
-                        Logger::logInfo("Thread: %d index: %d\n", thread, i);
-                        Logger::logInfo("%s\n%s\n", xBig.toString(16).c_str(), yBig.toString(16).c_str());
+        generatePoints(_devX, _devY, devA, devB, _pointsPerThread, _devNegation);
 
-                        unsigned int a[_pWords];
-                        unsigned int b[_pWords];
+        CUDA::memcpy(_aStart, devA, arraySize, cudaMemcpyDeviceToHost);
+        CUDA::memcpy(_bStart, devB, arraySize, cudaMemcpyDeviceToHost);
 
-                        extractBigInt(a, _aStart, block, thread, i);
-                        extractBigInt(b, _bStart, block, thread, i);
-                        Logger::logInfo("a: ");
-                        printBigInt(a, _pWords);
-                        Logger::logInfo("b: ");
-                        printBigInt(b, _pWords);
+        Logger::logInfo("Generated %d starting points in %dms", _numThreads * _pointsPerThread, util::getSystemTime() - t0);
 
-                    }
+        valid = verifySample(_devX, _devY, devA, devB, _pointsPerThread);
+    } catch(cudaError_t err) {
+        cudaFree(devA);
+        cudaFree(devB);
+        throw err;
+    }
 
-                    if(sum.getX() != xBig || sum.getY() != yBig) {
-                        Logger::logInfo("INVALID STARTING POINT\n");
-                        Logger::logInfo("Thread: %d index: %d\n", thread, i);
-                        Logger::logInfo("a: %s\n", aBig.toString(16).c_str());
-                        Logger::logInfo("b: %s\n", bBig.toString(16).c_str());
-
-                        Logger::logInfo("Expected:\n");
-                        Logger::logInfo("[ %s, %s ]\n", sum.getX().toString(16).c_str(), sum.getY().toString(16).c_str());
-                        Logger::logInfo("Actual:\n");
-                        Logger::logInfo("[ %s, %s ]\n", xBig.toString(16).c_str(), yBig.toString(16).c_str());
-                        throw "ERROR";
-                    }
-                }
-            }
+    cudaFree(devA);
+    cudaFree(devB);
 
-        }
-    }
-end:
-    CUDA::free(devGx);
-    CUDA::free(devGy);
-    CUDA::free(devQx);
-    CUDA::free(devQy);
-    CUDA::free(devGQx);
-    CUDA::free(devGQy);
+    return valid;
+}
 
+/**
+ * Generates a new batch of spare points. Waits for the streams first since
+ * their refills read the old batch and the generation uses their buffers.
+ * Returns false if a point of the sample checked on the host is wrong
+ */
+bool RhoCUDA::generateSparePoints()
+{
+    cudaError_t cudaError = cudaDeviceSynchronize();
     if(cudaError != cudaSuccess) {
-        cudaException(cudaError);
+        throw cudaError;
     }
-}
 
+    generatePoints(_devSpareX, _devSpareY, _devSpareA, _devSpareB, _sparesPerThread, NULL);
+    _sparesUsed = 0;
+
+    return verifySample(_devSpareX, _devSpareY, _devSpareA, _devSpareB, _sparesPerThread);
+}
 
 /**
  * Allocates memory on the host and device according to the number of threads, and
@@ -491,7 +569,7 @@ end:
 void RhoCUDA::allocateBuffers()
 {
     size_t numPoints = _numThreads * _pointsPerThread;
-    size_t arraySize = sizeof(unsigned int) * _pWords * numPoints;
+    size_t arraySize = sizeof(unsigned int) * LAYOUT_WORDS(_pWords) * numPoints;
 
     Logger::logInfo("Allocating %ld bytes on device", arraySize * 4);
     Logger::logInfo("Allocating %ld bytes on host", arraySize * 2);
@@ -516,9 +594,9 @@ void RhoCUDA::allocateBuffers()
     // Map host memory to device address space
     _devBStart = (unsigned int *)CUDA::getDevicePointer(_bStart, 0);
 
-    // Each block gets a flag to notify that one of its threads found a distinguished point
-    _blockFlags = (unsigned int *)CUDA::hostAlloc(_blocks * sizeof(unsigned int), cudaHostAllocMapped);
-    memset(_blockFlags, 0, _blocks * sizeof(unsigned int));
+    // Each block gets a flag per stream to notify that one of its threads found a distinguished point
+    _blockFlags = (unsigned int *)CUDA::hostAlloc(_numStreams * _blocks * sizeof(unsigned int), cudaHostAllocMapped);
+    memset(_blockFlags, 0, _numStreams * _blocks * sizeof(unsigned int));
 
     _devBlockFlags = (unsigned int *)CUDA::getDevicePointer(_blockFlags, 0);
 
@@ -539,6 +617,68 @@ void RhoCUDA::allocateBuffers()
 
     // Allocate buffer to hold the multiplication chain when computing batch inverse
     _devChainBuf = (unsigned int *)CUDA::malloc(arraySize);
+
+    _devNegation = NULL;
+    if(_params.negation) {
+        Logger::logInfo("Using the negation map");
+        _devNegation = (unsigned int *)CUDA::malloc(sizeof(unsigned int) * LAYOUT_WORDS(NEGATION_STATE_WORDS) * numPoints);
+    }
+
+    // Multiples of G, Q and G + Q for generating starting points
+    size_t tableSize = sizeof(unsigned int) * _pBits * _pWords;
+    _devGx = (unsigned int *)CUDA::malloc(tableSize);
+    _devGy = (unsigned int *)CUDA::malloc(tableSize);
+    _devQx = (unsigned int *)CUDA::malloc(tableSize);
+    _devQy = (unsigned int *)CUDA::malloc(tableSize);
+    _devGQx = (unsigned int *)CUDA::malloc(tableSize);
+    _devGQy = (unsigned int *)CUDA::malloc(tableSize);
+
+    // R points
+    size_t rPointSize = sizeof(unsigned int) * _pWords * _numRPoints;
+    _devRx = (unsigned int *)CUDA::malloc(rPointSize);
+    _devRy = (unsigned int *)CUDA::malloc(rPointSize);
+
+    if(2 * rPointSize <= getSharedRPointLimit(_device)) {
+        Logger::logInfo("%d R points in shared memory", _numRPoints);
+    } else {
+        Logger::logInfo("%d R points in global memory", _numRPoints);
+    }
+}
+
+/**
+ * Logs the architecture the step kernel was built for. A device newer than
+ * every architecture in the build runs the kernel compiled from PTX at
+ * startup, and the binary version is then the one of the device
+ */
+void RhoCUDA::checkKernelBinary()
+{
+    cudaDeviceProp properties;
+    cudaFuncAttributes attributes;
+    int blocksPerMP = 0;
+
+    cudaError_t cudaError = cudaGetDeviceProperties(&properties, _device);
+    if(cudaError != cudaSuccess) {
+        throw cudaError;
+    }
+
+    cudaError = getDoStepKernelInfo(_pWords, _stepsPerLaunch > 1, _threadsPerBlock, 0, &attributes, &blocksPerMP);
+    if(cudaError != cudaSuccess) {
+        throw cudaError;
+    }
+
+#ifdef _HIP
+    // Code objects are built for each architecture in the build and there is
+    // nothing compiled at startup
+    Logger::logInfo("Step kernel running on %s, %d registers", properties.gcnArchName, attributes.numRegs);
+#else
+    int arch = properties.major * 10 + properties.minor;
+
+    if(attributes.ptxVersion != attributes.binaryVersion) {
+        Logger::logInfo("Warning: no native code for sm_%d in this build. The kernels were compiled from compute_%d PTX", arch, attributes.ptxVersion);
+    } else {
+        Logger::logInfo("Step kernel built for sm_%d, %d registers", attributes.binaryVersion, attributes.numRegs);
+    }
+#endif
 }
 
 /**
@@ -552,22 +692,527 @@ void RhoCUDA::freeBuffers()
     cudaFree(_devY);
     cudaFree(_devDiffBuf);
     cudaFree(_devChainBuf);
+    cudaFree(_devNegation);
+    cudaFree(_devRx);
+    cudaFree(_devRy);
+    cudaFree(_devGx);
+    cudaFree(_devGy);
+    cudaFree(_devQx);
+    cudaFree(_devQy);
+    cudaFree(_devGQx);
+    cudaFree(_devGQy);
     cudaFree(_blockFlags);
     cudaFree(_pointFoundFlags);
 
+    if(_stepsPerLaunch > 1) {
+        for(unsigned int i = 0; i < _numStreams; i++) {
+            cudaFreeHost(_streams[i].dpRecords);
+            cudaFreeHost(_streams[i].dpTail);
+            cudaFreeHost(_streams[i].dpDropped);
+        }
+        cudaFree(_devStartX);
+        cudaFree(_devStartY);
+        cudaFree(_devWalkStart);
+    } else {
+        for(unsigned int i = 0; i < _numStreams; i++) {
+            cudaFreeHost(_streams[i].refillSlots);
+        }
+        cudaFree(_devSpareX);
+        cudaFree(_devSpareY);
+        cudaFree(_devSpareA);
+        cudaFree(_devSpareB);
+    }
+
     delete[] _counters;
 }
 
 /**
- * Verifies that aG + bQ = (x,y)
+ * Splits the points of each thread between the streams
+ */
+void RhoCUDA::createStreams()
+{
+    _streams = new StreamState[_numStreams];
+
+    for(unsigned int i = 0; i < _numStreams; i++) {
+        StreamState &s = _streams[i];
+
+        memset(&s, 0, sizeof(StreamState));
+        s.firstPoint = i * _pointsPerThread / _numStreams;
+        s.numPoints = (i + 1) * _pointsPerThread / _numStreams - s.firstPoint;
+        s.counter = 1;
+        s.running = false;
+        s.blockFlags = &_blockFlags[i * _blocks];
+
+        cudaError_t cudaError = cudaStreamCreateWithFlags(&s.stream, cudaStreamNonBlocking);
+        if(cudaError == cudaSuccess) {
+            cudaError = cudaEventCreate(&s.kernelStart);
+        }
+        if(cudaError == cudaSuccess) {
+            cudaError = cudaEventCreate(&s.kernelStop);
+        }
+        if(cudaError != cudaSuccess) {
+            throw cudaError;
+        }
+    }
+
+    Logger::logInfo("%d streams", _numStreams);
+}
+
+void RhoCUDA::destroyStreams()
+{
+    if(_streams == NULL) {
+        return;
+    }
+
+    for(unsigned int i = 0; i < _numStreams; i++) {
+        if(_streams[i].stream != NULL) {
+            cudaStreamDestroy(_streams[i].stream);
+        }
+        if(_streams[i].kernelStart != NULL) {
+            cudaEventDestroy(_streams[i].kernelStart);
+        }
+        if(_streams[i].kernelStop != NULL) {
+            cudaEventDestroy(_streams[i].kernelStop);
+        }
+    }
+}
+
+/**
+ * Allocates the distinguished point queue of each stream and the starting
+ * points used by the persistent kernel
+ */
+void RhoCUDA::allocatePersistentBuffers()
+{
+    size_t numPoints = _numThreads * _pointsPerThread;
+    size_t arraySize = sizeof(unsigned int) * LAYOUT_WORDS(_pWords) * numPoints;
+
+    _devStartX = (unsigned int *)CUDA::malloc(arraySize);
+    _devStartY = (unsigned int *)CUDA::malloc(arraySize);
+
+    _devWalkStart = (unsigned long long *)CUDA::malloc(sizeof(unsigned long long) * numPoints);
+    cudaMemset(_devWalkStart, 0, sizeof(unsigned long long) * numPoints);
+
+    for(unsigned int i = 0; i < _numStreams; i++) {
+        StreamState &s = _streams[i];
+
+        // Room for 4 times the expected number of points per launch
+        unsigned long long expected = ((unsigned long long)_numThreads * s.numPoints * _stepsPerLaunch) >> _params.dBits;
+        unsigned int capacity = 256;
+        while(capacity < expected * 4 && capacity < (1 << 20)) {
+            capacity <<= 1;
+        }
+
+        Logger::logInfo("Distinguished point queue: %d records", capacity);
+
+        s.dpRecords = (DPRecord *)CUDA::hostAlloc(sizeof(DPRecord) * capacity, cudaHostAllocMapped);
+        memset(s.dpRecords, 0, sizeof(DPRecord) * capacity);
+
+        s.dpTail = (unsigned int *)CUDA::hostAlloc(sizeof(unsigned int), cudaHostAllocMapped);
+        *s.dpTail = 0;
+
+        s.dpDropped = (unsigned int *)CUDA::hostAlloc(sizeof(unsigned int), cudaHostAllocMapped);
+        *s.dpDropped = 0;
+
+        s.dpQueue.records = (DPRecord *)CUDA::getDevicePointer(s.dpRecords, 0);
+        s.dpQueue.tail = (unsigned int *)CUDA::getDevicePointer(s.dpTail, 0);
+        s.dpQueue.dropped = (unsigned int *)CUDA::getDevicePointer(s.dpDropped, 0);
+        s.dpQueue.head = 0;
+        s.dpQueue.capacity = capacity;
+        s.dpQueue.a = _devAStart;
+        s.dpQueue.b = _devBStart;
+        s.dpQueue.startX = _devStartX;
+        s.dpQueue.startY = _devStartY;
+        s.dpQueue.walkStart = _devWalkStart;
+        s.dpQueue.step = 0;
+    }
+}
+
+/**
+ * Allocates the spare points that walks are restarted at when every launch
+ * does one step, and the list of walks to restart of each stream
+ */
+void RhoCUDA::allocateSpareBuffers()
+{
+    _sparesPerThread = std::min((unsigned int)SPARE_POINTS_PER_THREAD, _pointsPerThread);
+    _numSpares = _numThreads * _sparesPerThread;
+    _sparesUsed = _numSpares;
+
+    size_t arraySize = sizeof(unsigned int) * LAYOUT_WORDS(_pWords) * _numSpares;
+
+    _devSpareX = (unsigned int *)CUDA::malloc(arraySize);
+    _devSpareY = (unsigned int *)CUDA::malloc(arraySize);
+    _devSpareA = (unsigned int *)CUDA::malloc(arraySize);
+    _devSpareB = (unsigned int *)CUDA::malloc(arraySize);
+
+    for(unsigned int i = 0; i < _numStreams; i++) {
+        StreamState &s = _streams[i];
+        size_t size = sizeof(unsigned int) * _numThreads * s.numPoints;
+
+        s.refillSlots = (unsigned int *)CUDA::hostAlloc(size, cudaHostAllocMapped);
+        s.devRefillSlots = (unsigned int *)CUDA::getDevicePointer(s.refillSlots, 0);
+    }
+
+    Logger::logInfo("%d spare starting points", _numSpares);
+}
+
+/**
+ * Saves the starting points, unless resumed walks already set them, and
+ * picks the point T = aG + bQ that the device adds to a starting point to
+ * restart a walk. For a kangaroo job T is aG with a from kangarooOffset(),
+ * which keeps tame walks tame and wild walks wild
+ */
+void RhoCUDA::setupPersistentKernel(bool copyStart)
+{
+    size_t arraySize = sizeof(unsigned int) * LAYOUT_WORDS(_pWords) * _numThreads * _pointsPerThread;
+
+    if(copyStart) {
+        CUDA::memcpy(_devStartX, _devX, arraySize, cudaMemcpyDeviceToDevice);
+        CUDA::memcpy(_devStartY, _devY, arraySize, cudaMemcpyDeviceToDevice);
+    }
+
+    ECPoint g(_params.gx, _params.gy);
+    ECPoint q(_params.qx, _params.qy);
+
+    BigInteger a;
+    BigInteger b;
+
+    if(_params.kangaroo) {
+        a = kangarooOffset(_params);
+        b = BigInteger(0);
+    } else {
+        a = randomBigInteger(2, _params.n);
+        b = randomBigInteger(2, _params.n);
+    }
+
+    ECPoint aG = _curve.multiply(a, g);
+    ECPoint bQ = _curve.multiply(b, q);
+    ECPoint t = _curve.add(aG, bQ);
+
+    _restartX.assign(_pWords, 0);
+    _restartY.assign(_pWords, 0);
+    _restartA.assign(_pWords, 0);
+    _restartB.assign(_pWords, 0);
+
+    t.getX().getWords(&_restartX[0], _pWords);
+    t.getY().getWords(&_restartY[0], _pWords);
+    a.getWords(&_restartA[0], _pWords);
+    b.getWords(&_restartB[0], _pWords);
+
+    setRestartParams();
+}
+
+/**
+ * Copies T = aG + bQ from setupPersistentKernel to the device
+ */
+void RhoCUDA::setRestartParams()
+{
+    unsigned int n[_pWords];
+    _params.n.getWords(n, _pWords);
+
+    cudaError_t cudaError = initDeviceRestartParams(n, &_restartX[0], &_restartY[0], &_restartA[0], &_restartB[0], _pWords);
+
+    if(cudaError != cudaSuccess) {
+        throw cudaError;
+    }
+}
+
+/**
+ * Replaces the generated starting points with saved walks until the saved
+ * walks run out. The persistent kernel restarts a walk from its starting
+ * point, so it only takes saved walks that have one. Returns false if there
+ * are no saved walks, and nothing is written
  */
-bool RhoCUDA::verifyPoint(BigInteger &x, BigInteger &y)
+bool RhoCUDA::loadWalks()
 {
-    ECPoint p = ECPoint(x, y);
+    if(_resume->remaining() == 0) {
+        return false;
+    }
+
+    bool persistent = _stepsPerLaunch > 1;
+    size_t numPoints = (size_t)_numThreads * _pointsPerThread;
+    size_t arrayWords = LAYOUT_WORDS(_pWords) * numPoints;
+    size_t arraySize = sizeof(unsigned int) * arrayWords;
+
+    std::vector<unsigned int> x(arrayWords, 0);
+    std::vector<unsigned int> y(arrayWords, 0);
+    std::vector<unsigned long long> walkStart(numPoints, 0);
+
+    // Negation map state of the resumed walks, written over the state
+    // cudaInitNegation gives every walk
+    std::vector<bool> isResumed(numPoints, false);
+    std::vector<unsigned long long> histories(numPoints, 0);
+    std::vector<unsigned int> skipped(numPoints, 0);
+
+    CUDA::memcpy(&x[0], _devX, arraySize, cudaMemcpyDeviceToHost);
+    CUDA::memcpy(&y[0], _devY, arraySize, cudaMemcpyDeviceToHost);
+
+    // The generated points are their own starting points
+    std::vector<unsigned int> startX(persistent ? x : std::vector<unsigned int>());
+    std::vector<unsigned int> startY(persistent ? y : std::vector<unsigned int>());
+
+    unsigned int resumed = 0;
+
+    for(unsigned int block = 0; block < _blocks; block++) {
+        for(unsigned int thread = 0; thread < _threadsPerBlock; thread++) {
+            for(unsigned int i = 0; i < _pointsPerThread; i++) {
+                unsigned int idx = _blocks * _threadsPerBlock * i + block * _threadsPerBlock + thread;
+
+                WalkState w;
+                if(!_resume->take(w, persistent)) {
+                    continue;
+                }
+
+                unsigned int words[_pWords];
+
+                w.x.getWords(words, _pWords);
+                splatBigInt(&x[0], words, block, thread, i);
+                w.y.getWords(words, _pWords);
+                splatBigInt(&y[0], words, block, thread, i);
+                w.a.getWords(words, _pWords);
+                splatBigInt(_aStart, words, block, thread, i);
+                w.b.getWords(words, _pWords);
+                splatBigInt(_bStart, words, block, thread, i);
+
+                // The length is the step counter minus the count the walk
+                // started at. The counters of the streams start at 1 and
+                // the step of the persistent kernel at 0
+                if(persistent) {
+                    w.startX.getWords(words, _pWords);
+                    splatBigInt(&startX[0], words, block, thread, i);
+                    w.startY.getWords(words, _pWords);
+                    splatBigInt(&startY[0], words, block, thread, i);
+                    walkStart[idx] = 0 - w.length;
+                } else {
+                    _counters[idx] = w.length > 0 ? 1 - w.length : 0;
+                }
+
+                isResumed[idx] = true;
+                histories[idx] = w.history;
+                skipped[idx] = w.skipped;
+
+                resumed++;
+            }
+        }
+    }
+
+    CUDA::memcpy(_devX, &x[0], arraySize, cudaMemcpyHostToDevice);
+    CUDA::memcpy(_devY, &y[0], arraySize, cudaMemcpyHostToDevice);
+
+    if(persistent) {
+        CUDA::memcpy(_devStartX, &startX[0], arraySize, cudaMemcpyHostToDevice);
+        CUDA::memcpy(_devStartY, &startY[0], arraySize, cudaMemcpyHostToDevice);
+        CUDA::memcpy(_devWalkStart, &walkStart[0], sizeof(unsigned long long) * numPoints, cudaMemcpyHostToDevice);
+    }
+
+    if(_params.negation) {
+        cudaError_t cudaError = cudaInitNegation(_pWords, _blocks, _threadsPerBlock, _pointsPerThread,
+                                                 _devX, _devY, _devAStart, _devBStart, _devNegation);
+        if(cudaError != cudaSuccess) {
+            throw cudaError;
+        }
+
+        size_t negationWords = LAYOUT_WORDS(NEGATION_STATE_WORDS) * numPoints;
+        std::vector<unsigned int> negation(negationWords);
+
+        CUDA::memcpy(&negation[0], _devNegation, sizeof(unsigned int) * negationWords, cudaMemcpyDeviceToHost);
 
-    if(!_curve.pointExists(p)) {
-        Logger::logError("x: %s\n", x.toString(16).c_str());
-        Logger::logError("y: %s\n", y.toString(16).c_str());
+        for(unsigned int block = 0; block < _blocks; block++) {
+            for(unsigned int thread = 0; thread < _threadsPerBlock; thread++) {
+                for(unsigned int i = 0; i < _pointsPerThread; i++) {
+                    unsigned int idx = _blocks * _threadsPerBlock * i + block * _threadsPerBlock + thread;
+
+                    if(!isResumed[idx]) {
+                        continue;
+                    }
+
+                    negation[getIndex(block, thread, i, 0, NEGATION_STATE_WORDS)] = (unsigned int)histories[idx];
+                    negation[getIndex(block, thread, i, 1, NEGATION_STATE_WORDS)] = (unsigned int)(histories[idx] >> 32);
+                    negation[getIndex(block, thread, i, 2, NEGATION_STATE_WORDS)] = skipped[idx];
+                }
+            }
+        }
+
+        CUDA::memcpy(_devNegation, &negation[0], sizeof(unsigned int) * negationWords, cudaMemcpyHostToDevice);
+    }
+
+    Logger::logInfo("Resumed %d of %d walks", resumed, (int)numPoints);
+
+    return true;
+}
+
+/**
+ * Copies the walks to the host. No kernel may be running on the device.
+ * Returns false on a CUDA error
+ */
+bool RhoCUDA::copyWalks()
+{
+    bool persistent = _stepsPerLaunch > 1;
+    size_t numPoints = (size_t)_numThreads * _pointsPerThread;
+    size_t arrayWords = LAYOUT_WORDS(_pWords) * numPoints;
+    size_t arraySize = sizeof(unsigned int) * arrayWords;
+
+    std::vector<unsigned long long> walkStart(persistent ? numPoints : 0);
+
+    _savedX.resize(arrayWords);
+    _savedY.resize(arrayWords);
+    _savedA.assign(_aStart, _aStart + arrayWords);
+    _savedB.assign(_bStart, _bStart + arrayWords);
+    _savedStartX.resize(persistent ? arrayWords : 0);
+    _savedStartY.resize(persistent ? arrayWords : 0);
+    _savedLengths.resize(numPoints);
+    _savedNegation.resize(_params.negation ? LAYOUT_WORDS(NEGATION_STATE_WORDS) * numPoints : 0);
+
+    try {
+        CUDA::memcpy(&_savedX[0], _devX, arraySize, cudaMemcpyDeviceToHost);
+        CUDA::memcpy(&_savedY[0], _devY, arraySize, cudaMemcpyDeviceToHost);
+
+        if(_params.negation) {
+            CUDA::memcpy(&_savedNegation[0], _devNegation, sizeof(unsigned int) * _savedNegation.size(), cudaMemcpyDeviceToHost);
+        }
+
+        if(persistent) {
+            CUDA::memcpy(&_savedStartX[0], _devStartX, arraySize, cudaMemcpyDeviceToHost);
+            CUDA::memcpy(&_savedStartY[0], _devStartY, arraySize, cudaMemcpyDeviceToHost);
+            CUDA::memcpy(&walkStart[0], _devWalkStart, sizeof(unsigned long long) * numPoints, cudaMemcpyDeviceToHost);
+        }
+    } catch(cudaError_t err) {
+        Logger::logError("CUDA error: %s\n", cudaGetErrorString(err));
+        return false;
+    }
+
+    for(unsigned int j = 0; j < _numStreams; j++) {
+        StreamState &s = _streams[j];
+
+        for(unsigned int i = s.firstPoint; i < s.firstPoint + s.numPoints; i++) {
+            for(unsigned int t = 0; t < _numThreads; t++) {
+                unsigned int idx = _numThreads * i + t;
+
+                _savedLengths[idx] = persistent ? s.dpQueue.step - walkStart[idx] : s.counter - _counters[idx];
+            }
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Adds the walks copied by copyWalks to the checkpoint and frees the copy
+ */
+void RhoCUDA::addWalks(WalkCheckpoint &checkpoint)
+{
+    bool persistent = _stepsPerLaunch > 1;
+
+    for(unsigned int block = 0; block < _blocks; block++) {
+        for(unsigned int thread = 0; thread < _threadsPerBlock; thread++) {
+            for(unsigned int i = 0; i < _pointsPerThread; i++) {
+                unsigned int idx = _blocks * _threadsPerBlock * i + block * _threadsPerBlock + thread;
+                unsigned int words[_pWords];
+
+                WalkState w;
+
+                extractBigInt(words, &_savedA[0], block, thread, i);
+                w.a = BigInteger(words, _pWords);
+                extractBigInt(words, &_savedB[0], block, thread, i);
+                w.b = BigInteger(words, _pWords);
+                extractBigInt(words, &_savedX[0], block, thread, i);
+                w.x = BigInteger(words, _pWords);
+                extractBigInt(words, &_savedY[0], block, thread, i);
+                w.y = BigInteger(words, _pWords);
+
+                // Only the persistent kernel keeps the starting points
+                if(persistent) {
+                    extractBigInt(words, &_savedStartX[0], block, thread, i);
+                    w.startX = BigInteger(words, _pWords);
+                    extractBigInt(words, &_savedStartY[0], block, thread, i);
+                    w.startY = BigInteger(words, _pWords);
+                }
+
+                w.length = _savedLengths[idx];
+
+                if(_params.negation) {
+                    w.history = ((unsigned long long)_savedNegation[getIndex(block, thread, i, 1, NEGATION_STATE_WORDS)] << 32)
+                              | _savedNegation[getIndex(block, thread, i, 0, NEGATION_STATE_WORDS)];
+                    w.skipped = _savedNegation[getIndex(block, thread, i, 2, NEGATION_STATE_WORDS)];
+                } else {
+                    w.history = 0;
+                    w.skipped = 0;
+                }
+
+                checkpoint.add(w);
+            }
+        }
+    }
+
+    std::vector<unsigned int>().swap(_savedX);
+    std::vector<unsigned int>().swap(_savedY);
+    std::vector<unsigned int>().swap(_savedA);
+    std::vector<unsigned int>().swap(_savedB);
+    std::vector<unsigned int>().swap(_savedStartX);
+    std::vector<unsigned int>().swap(_savedStartY);
+    std::vector<unsigned long long>().swap(_savedLengths);
+    std::vector<unsigned int>().swap(_savedNegation);
+}
+
+/**
+ * Adds the state of every walk to the checkpoint. While run() is walking,
+ * the device stops for as long as the walks take to copy to the host
+ */
+void RhoCUDA::saveWalks(WalkCheckpoint &checkpoint)
+{
+    if(!_initialized) {
+        return;
+    }
+
+    _saveMutex.grab();
+
+    unsigned int request = atomicAdd(&_saveRequest, 1) + 1;
+
+    while(atomicLoad(&_walking) && atomicLoad(&_saveDone) != request) {
+        util::sleep(1);
+    }
+
+    // Nothing runs on the device when run() is not walking
+    if(atomicLoad(&_saveDone) != request) {
+        cudaError_t cudaError = cudaSetDevice(_device);
+        _saveFailed = cudaError != cudaSuccess || !copyWalks();
+        atomicStore(&_saveDone, request);
+    }
+
+    bool failed = _saveFailed;
+    if(!failed) {
+        addWalks(checkpoint);
+    }
+
+    _saveMutex.release();
+
+    if(failed) {
+        throw std::string("Error copying the walks from the device");
+    }
+}
+
+/**
+ * Verifies that (x,y) is on the curve. x and y are _pWords words
+ */
+bool RhoCUDA::verifyPoint(const unsigned int *x, const unsigned int *y)
+{
+    bool exists = false;
+
+    if(_fixedCurve != NULL) {
+        unsigned int px[FIXED_ECC_MAX_WORDS] = {0};
+        unsigned int py[FIXED_ECC_MAX_WORDS] = {0};
+
+        memcpy(px, x, sizeof(unsigned int) * _pWords);
+        memcpy(py, y, sizeof(unsigned int) * _pWords);
+
+        exists = _fixedCurve->pointExists(px, py);
+    } else {
+        ECPoint p(BigInteger(x, _pWords), BigInteger(y, _pWords));
+        exists = _curve.pointExists(p);
+    }
+
+    if(!exists) {
+        Logger::logError("x: %s\n", BigInteger(x, _pWords).toString(16).c_str());
+        Logger::logError("y: %s\n", BigInteger(y, _pWords).toString(16).c_str());
         Logger::logError("Point is not on the curve\n");
         return false;
     }
@@ -582,9 +1227,18 @@ bool RhoCUDA::initializeDevice()
     CUDA::setDeviceFlags(cudaDeviceScheduleBlockingSync);
 
     try {
+        checkKernelBinary();
         allocateBuffers();
+        createStreams();
+
+        if(_stepsPerLaunch > 1) {
+            allocatePersistentBuffers();
+        } else {
+            allocateSpareBuffers();
+        }
 
         setupDeviceConstants();
+        setupStartingPointTables();
         setRPoints();
     }catch(cudaError_t err) {
         Logger::logError("CUDA Error: %s\n", cudaGetErrorString(err));
@@ -598,8 +1252,14 @@ bool RhoCUDA::initializeDevice()
 
 void RhoCUDA::uninitializeDevice()
 {
+    cudaSetDevice(_device);
+    destroyStreams();
     freeBuffers();
-    cudaDeviceReset();
+    delete[] _streams;
+    _streams = NULL;
+
+    // The device is not reset, since other contexts may still have walks
+    // on it
     _initialized = false;
 }
 
@@ -613,17 +1273,35 @@ RhoCUDA::RhoCUDA(int device, unsigned int blocks,
                                       const BigInteger *rx,
                                       const BigInteger *ry,
                                       int numRPoints,
-                                      void (*callback)(struct CallbackParameters *) )
+                                      void (*callback)(struct CallbackParameters *),
+                                      unsigned int stepsPerLaunch,
+                                      unsigned int numStreams,
+                                      WalkCheckpoint *resume)
 {
-    _mainCounter = 1;
     _blocks = blocks;
     _threadsPerBlock = threads;
     _pointsPerThread = pointsPerThread;
     _device = device;
     _callback = callback;
+    _resume = resume;
+    _saveRequest = 0;
+    _saveDone = 0;
+    _walking = 0;
+    _saveFailed = false;
+    _dBits = params->dBits;
+    _deviceBits = params->dBits;
     _runFlag = true;
     _params = *params;
     _numRPoints = numRPoints; 
+    _stepsPerLaunch = stepsPerLaunch == 0 ? 1 : stepsPerLaunch;
+
+    // Each stream needs at least one point per thread
+    _numStreams = numStreams == 0 ? 1 : numStreams;
+    if(_numStreams > _pointsPerThread) {
+        _numStreams = _pointsPerThread;
+    }
+    _streams = NULL;
+    _initialized = false;
     _params.p = params->p;
 
     _numThreads = _blocks * _threadsPerBlock;
@@ -639,22 +1317,37 @@ RhoCUDA::RhoCUDA(int device, unsigned int blocks,
     _mWords = (_mBits + 31) / 32;
 
     // Copy random walk points
-    for(unsigned int i = 0; i < _numRPoints; i++) {
-        _rx[ i ] = rx[ i ];
-        _ry[ i ] = ry[ i ];
-    }
+    _rx.assign(rx, rx + _numRPoints);
+    _ry.assign(ry, ry + _numRPoints);
 
     _curve = ECCurve(_params.p, _params.n, _params.a, _params.b, _params.gx, _params.gy);
+    _fixedCurve = getFixedCurve(_curve);
+
+    _metrics = Metrics::acquire();
 }
 
 /**
- * Initializes the context with random points
+ * Initializes the context with the saved walks, or with random points
  */
 bool RhoCUDA::init()
 {
     try { 
-        initializeDevice();
-        generateStartingPoints(false);
+        if(!initializeDevice()) {
+            return false;
+        }
+
+        if(!generateStartingPoints()) {
+            return false;
+        }
+
+        // Saved walks replace the generated starting points
+        bool resumed = _resume != NULL && loadWalks();
+
+        if(_stepsPerLaunch > 1) {
+            setupPersistentKernel(!resumed);
+        } else if(!generateSparePoints()) {
+            return false;
+        }
     } catch(cudaError_t err) {
         Logger::logError("CUDA Error: %s\n", cudaGetErrorString(err));
         return false;
@@ -676,15 +1369,19 @@ RhoCUDA::~RhoCUDA()
     if(_initialized) {
         uninitializeDevice();
     }
+
+    delete _fixedCurve;
+
+    Metrics::release(_metrics);
 }
 
 /**
  * Reads the flag from the GPU indicating if a point was found
  */
-bool RhoCUDA::pointFound()
+bool RhoCUDA::pointFound(StreamState &s)
 {
     for(int i = 0; i < _blocks; i++) {
-        if(_blockFlags[i]) {
+        if(s.blockFlags[i]) {
             return true;
         }
     }
@@ -692,46 +1389,128 @@ bool RhoCUDA::pointFound()
     return false;
 }
 
-bool RhoCUDA::doStep()
+/**
+ * Queues a kernel on the stream. Does not wait for the kernel to finish
+ */
+bool RhoCUDA::launchStream(StreamState &s)
 {
-    //do {
-    cudaError_t cudaError = cudaSuccess;
+    unsigned long long start = util::getTimeMicros();
+    cudaError_t cudaError = cudaEventRecord(s.kernelStart, s.stream);
+
+    if(cudaError == cudaSuccess && _stepsPerLaunch > 1) {
+        cudaError = cudaDoStepPersistentAsync(_pWords,
+            _blocks,
+            _threadsPerBlock,
+            s.firstPoint,
+            s.numPoints,
+            _stepsPerLaunch,
+            _devX,
+            _devY,
+            _devDiffBuf,
+            _devChainBuf,
+            _devNegation,
+            s.dpQueue,
+            s.stream);
+    } else if(cudaError == cudaSuccess) {
+        cudaError = cudaDoStepAsync(_pWords,
+            _blocks,
+            _threadsPerBlock,
+            s.firstPoint,
+            s.numPoints,
+            _devX,
+            _devY,
+            _devDiffBuf,
+            _devChainBuf,
+            _devNegation,
+            s.blockFlags,
+            _pointFoundFlags,
+            s.stream);
+    }
+
+    if(cudaError == cudaSuccess) {
+        cudaError = cudaEventRecord(s.kernelStop, s.stream);
+    }
+
+    if(cudaError != cudaSuccess) {
+        Logger::logError("CUDA error: %s\n", cudaGetErrorString(cudaError));
+        return false;
+    }
+
+    s.running = true;
+
+    _metrics->hostMicros += util::getTimeMicros() - start;
+
+    return true;
+}
+
+/**
+ * Waits for the kernel on the stream to finish and reads the distinguished
+ * points it found
+ */
+bool RhoCUDA::finishStream(StreamState &s)
+{
+    cudaError_t cudaError = cudaStreamSynchronize(s.stream);
+    s.running = false;
 
-    cudaError = cudaDoStep(_pWords,
-        _blocks,
-        _threadsPerBlock,
-        _pointsPerThread,
-        _devX,
-        _devY,
-        _devDiffBuf,
-        _devChainBuf,
-        _blockFlags,
-        _pointFoundFlags);
-   
     if(cudaError != cudaSuccess) {
         Logger::logError("CUDA error: %s\n", cudaGetErrorString(cudaError));
         return false;
     }
 
-    _mainCounter++;
+    unsigned long long start = util::getTimeMicros();
+
+    float ms = 0.0f;
+    if(cudaEventElapsedTime(&ms, s.kernelStart, s.kernelStop) == cudaSuccess) {
+        _metrics->kernelMicros += (unsigned long long)(ms * 1000.0f);
+    }
+    _metrics->steps += (unsigned long long)_numThreads * s.numPoints * _stepsPerLaunch;
+
+    bool success = false;
+
+    if(_stepsPerLaunch > 1) {
+        // The walks are already restarted by the device
+        s.dpQueue.step += _stepsPerLaunch;
+        s.counter += _stepsPerLaunch;
+
+        success = readDistinguishedPoints(s);
+    } else {
+        s.counter++;
+
+        success = readFlaggedPoints(s);
+    }
+
+    _metrics->hostMicros += util::getTimeMicros() - start;
+
+    return success;
+}
+
+/**
+ * Reads the points flagged by the last step on the stream and restarts their
+ * walks at spare points
+ */
+bool RhoCUDA::readFlaggedPoints(StreamState &s)
+{
+    unsigned int count = 0;
 
     for(unsigned int block = 0; block < _blocks; block++) {
 
-        if(_blockFlags[block] == 0) {
+        if(s.blockFlags[block] == 0) {
             continue;
         }
 
-        _blockFlags[block] = 0;
+        s.blockFlags[block] = 0;
 
         for(unsigned int thread = 0; thread < _threadsPerBlock; thread++)
         {
-            for(int i = 0; i < _pointsPerThread; i++)
+            for(unsigned int i = s.firstPoint; i < s.firstPoint + s.numPoints; i++)
             {
-                if(_pointFoundFlags[_blocks * _threadsPerBlock * i + block * _threadsPerBlock + thread] == 0) {
+                unsigned int idx = _blocks * _threadsPerBlock * i + block * _threadsPerBlock + thread;
+
+                if(_pointFoundFlags[idx] == 0) {
                     continue;
                 }
 
-                _pointFoundFlags[_blocks * _threadsPerBlock * i + block * _threadsPerBlock + thread] = 0;
+                _pointFoundFlags[idx] = 0;
 
                 unsigned int x[_pWords];
                 unsigned int y[_pWords];
@@ -744,8 +1523,8 @@ bool RhoCUDA::doStep()
                 memset(b, 0, _pWords * sizeof(unsigned int));
 
                 try {
-                    readX(x, block, thread, i);
-                    readY(y, block, thread, i);
+                    readX(x, block, thread, i, s.stream);
+                    readY(y, block, thread, i, s.stream);
                 } catch(cudaError_t err) {
                     Logger::logInfo("%s", cudaGetErrorString(err));
                     exit(1);
@@ -754,15 +1533,10 @@ bool RhoCUDA::doStep()
                 extractBigInt(a, _aStart, block, thread, i);
                 extractBigInt(b, _bStart, block, thread, i);
 
-                BigInteger xBig(x, _pWords);
-                BigInteger yBig(y, _pWords);
-                BigInteger aBig(a, _pWords);
-                BigInteger bBig(b, _pWords);
-                if(!verifyPoint(xBig, yBig)) {
+                if(!verifyPoint(x, y)) {
                     Logger::logError( "==== INVALID POINT ====\n" );
                     Logger::logInfo("Index: %d\n", i);
-                    Logger::logError("%s %s\n", aBig.toString(16).c_str(), bBig.toString(16).c_str());
-                    Logger::logError("[%s, %s]\n", xBig.toString(16).c_str(), yBig.toString(16).c_str());
+                    Logger::logError("%s %s\n", BigInteger(a, _pWords).toString(16).c_str(), BigInteger(b, _pWords).toString(16).c_str());
                     Logger::logInfo("a: ");
                     printBigInt(a, _pWords);
                     Logger::logInfo("b: ");
@@ -775,31 +1549,96 @@ bool RhoCUDA::doStep()
                 }
              
                 struct CallbackParameters p;
-                p.aStart = aBig;
-                p.bStart = bBig;
-                p.x = xBig;
-                p.y = yBig;
-                p.length = _mainCounter - _counters[i];
+                setPointWords(p.aStart, a, _pWords);
+                setPointWords(p.bStart, b, _pWords);
+                setPointWords(p.x, x, _pWords);
+                setPointWords(p.y, y, _pWords);
+                p.length = s.counter - _counters[idx];
 
                 _callback(&p);
-                
-                unsigned int newX[_pWords];
-                unsigned int newY[_pWords];
-                unsigned int newA[_pWords];
-                unsigned int newB[_pWords]; 
-                getRandomPoint(newX, newY, newA, newB);
-                
-                // Write a, b to host memory
-                splatBigInt(_aStart, newA, thread, block, i);
-                splatBigInt(_bStart, newB, thread, block, i);
-
-                // Write x, y to device memory
-                writeX(newX, block, thread, i);
-                writeY(newY, block, thread, i);
-
-                _counters[i] = _mainCounter;
+                _metrics->points++;
+                _metrics->restarts++;
+
+                s.refillSlots[count++] = idx;
+                _counters[idx] = s.counter;
+            }
+        }
+    }
+
+    if(count == 0) {
+        return true;
+    }
+
+    return refillWalks(s, count);
+}
+
+/**
+ * Restarts the count walks in the refill list of the stream at the next
+ * spare points, generating a new batch when they run out. The restarts are
+ * queued on the stream so they finish before its next step
+ */
+bool RhoCUDA::refillWalks(StreamState &s, unsigned int count)
+{
+    try {
+        for(unsigned int done = 0; done < count;) {
+            if(_sparesUsed == _numSpares && !generateSparePoints()) {
+                return false;
+            }
+
+            unsigned int n = std::min(count - done, _numSpares - _sparesUsed);
+
+            cudaError_t cudaError = cudaRefillWalksAsync(_pWords, &s.devRefillSlots[done], n,
+                                                         _devX, _devY, _devAStart, _devBStart, _devNegation,
+                                                         _devSpareX, _devSpareY, _devSpareA, _devSpareB,
+                                                         _sparesUsed, _numThreads, s.stream);
+            if(cudaError != cudaSuccess) {
+                throw cudaError;
             }
+
+            _sparesUsed += n;
+            done += n;
         }
+    } catch(cudaError_t err) {
+        Logger::logError("CUDA error: %s\n", cudaGetErrorString(err));
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Reads the records between head and tail of the distinguished point queue
+ */
+bool RhoCUDA::readDistinguishedPoints(StreamState &s)
+{
+    unsigned int tail = *((volatile unsigned int *)s.dpTail);
+
+    for(; s.dpQueue.head != tail; s.dpQueue.head++) {
+        const DPRecord *record = &s.dpRecords[s.dpQueue.head & (s.dpQueue.capacity - 1)];
+
+        if(!verifyPoint(record->x, record->y)) {
+            Logger::logError( "==== INVALID POINT ====\n" );
+            Logger::logError("%s %s\n", BigInteger(record->a, _pWords).toString(16).c_str(), BigInteger(record->b, _pWords).toString(16).c_str());
+            return false;
+        }
+
+        struct CallbackParameters p;
+        setPointWords(p.aStart, record->a, _pWords);
+        setPointWords(p.bStart, record->b, _pWords);
+        setPointWords(p.x, record->x, _pWords);
+        setPointWords(p.y, record->y, _pWords);
+        p.length = record->length;
+
+        _callback(&p);
+        _metrics->points++;
+        _metrics->restarts++;
+    }
+
+    unsigned int dropped = *((volatile unsigned int *)s.dpDropped);
+    if(dropped > 0) {
+        Logger::logInfo("Distinguished point queue full: %d points dropped", dropped);
+        _metrics->queueDrops += dropped;
+        *s.dpDropped = 0;
     }
 
     return true;
@@ -812,56 +1651,158 @@ bool RhoCUDA::run()
 {
     setRunFlag(true);
 
-    do {
-        if(!doStep()) {
-            return false;
+    // The current device is per host thread
+    cudaError_t cudaError = cudaSetDevice(_device);
+    if(cudaError != cudaSuccess) {
+        Logger::logError("CUDA error: %s\n", cudaGetErrorString(cudaError));
+        return false;
+    }
+
+    try {
+        loadDeviceConstants();
+    } catch(cudaError_t err) {
+        Logger::logError("CUDA Error: %s\n", cudaGetErrorString(err));
+        setRunFlag(false);
+        return false;
+    }
+
+    bool success = true;
+    unsigned int running = 0;
+
+    // Walks are not saved from another thread from here on
+    _saveMutex.grab();
+    atomicStore(&_walking, 1);
+    _saveMutex.release();
+
+    for(unsigned int i = 0; i < _numStreams; i++) {
+        if(!launchStream(_streams[i])) {
+            success = false;
+            break;
         }
-    }while(isRunning());
+        running++;
+    }
 
-    return true;
+    // Wait for the streams in turn and relaunch each one after its points are
+    // read. After an error or a stop the remaining streams are drained
+    for(unsigned int i = 0; running > 0; i = (i + 1) % _numStreams) {
+        StreamState &s = _streams[i];
+
+        if(!s.running) {
+            continue;
+        }
+        running--;
+
+        if(!finishStream(s)) {
+            success = false;
+            continue;
+        }
+
+        if(!success || !isRunning()) {
+            continue;
+        }
+
+        // To save the walks or change the distinguished bits the streams
+        // are not relaunched until all of them have finished
+        unsigned int request = atomicLoad(&_saveRequest);
+        bool save = request != atomicLoad(&_saveDone);
+        bool bits = atomicLoad(&_dBits) != _deviceBits;
+
+        if(save || bits) {
+            if(running > 0) {
+                continue;
+            }
+
+            if(save) {
+                _saveFailed = !copyWalks();
+                atomicStore(&_saveDone, request);
+            }
+
+            if(bits && !loadDistinguishedBits()) {
+                success = false;
+                continue;
+            }
+
+            for(unsigned int j = 0; j < _numStreams; j++) {
+                if(!launchStream(_streams[j])) {
+                    success = false;
+                    break;
+                }
+                running++;
+            }
+            continue;
+        }
+
+        if(!launchStream(s)) {
+            success = false;
+            continue;
+        }
+        running++;
+    }
+
+    atomicStore(&_walking, 0);
+
+    return success;
 }
 
-bool RhoCUDA::benchmark(unsigned long long *pointsPerSecondPtr)
+bool RhoCUDA::benchmark(unsigned long long *pointsPerSecondPtr, unsigned int iterations)
 {
     unsigned int t0 = 0;
     unsigned int t1 = 0;
-    unsigned int count = 1000;
+    unsigned int count = iterations;
+    unsigned int launches = count;
     bool success = true;
     float seconds = 0;
     unsigned int iterationsPerSecond = 0;
     unsigned long long pointsPerSecond = 0;
 
+    // The current device is per host thread
+    cudaError_t cudaError = cudaSetDevice(_device);
+    if(cudaError != cudaSuccess) {
+        Logger::logError("CUDA error: %s\n", cudaGetErrorString(cudaError));
+        return false;
+    }
+
+    if(_stepsPerLaunch > 1) {
+        launches = (count + _stepsPerLaunch - 1) / _stepsPerLaunch;
+        count = launches * _stepsPerLaunch;
+    }
+
     t0 = util::getSystemTime();
-    for(unsigned int i = 0; i < count; i++) {
-        cudaError_t cudaError = cudaSuccess;
-        
-        cudaError = cudaDoStep(
-                        _pWords,
-                        _blocks,
-                        _threadsPerBlock,
-                        _pointsPerThread,
-                        _devX,
-                        _devY,
-                        _devDiffBuf,
-                        _devChainBuf,
-                        _blockFlags,
-                        _pointFoundFlags);
+    for(unsigned int i = 0; i < launches; i++) {
+        // All streams run at the same time. Distinguished points are ignored
+        for(unsigned int j = 0; j < _numStreams; j++) {
+            if(!launchStream(_streams[j])) {
+                success = false;
+            }
+        }
 
+        cudaError = cudaDeviceSynchronize();
+
+        for(unsigned int j = 0; j < _numStreams; j++) {
+            StreamState &s = _streams[j];
+
+            s.running = false;
+            if(_stepsPerLaunch > 1) {
+                s.dpQueue.step += _stepsPerLaunch;
+                s.dpQueue.head = *s.dpTail;
+            }
+        }
 
         if(cudaError != cudaSuccess) {
             Logger::logError("CUDA error: %s\n", cudaGetErrorString( cudaError ));
             success = false;
-            goto end;
         }
 
-        i++;
+        if(!success) {
+            goto end;
+        }
     }
     t1 = util::getSystemTime();
   
     // Number of seconds that elapsed 
     seconds = (float)(t1 - t0)/1000;
     iterationsPerSecond = (unsigned int)count / seconds;
-    pointsPerSecond = iterationsPerSecond * _blocks * _threadsPerBlock * _pointsPerThread;
+    pointsPerSecond = (unsigned long long)iterationsPerSecond * _blocks * _threadsPerBlock * _pointsPerThread;
 
     Logger::logInfo("%d iterations in %dms (%d iterations per second)", count, (t1-t0), iterationsPerSecond);
     Logger::logInfo("%lld points per second", pointsPerSecond);
@@ -3,13 +3,64 @@
 
 #include "ECDLContext.h"
 #include "ecc.h"
+#include "FixedEcc.h"
 #include "BigInteger.h"
-#include <cuda_runtime.h>
+#include "gpu.h"
+#include "kernels.h"
+#include "WalkCheckpoint.h"
+#include "threads.h"
+#include "Metrics.h"
+
+// Spare starting points per thread that walks are restarted at after a
+// distinguished point when every launch does one step
+#define SPARE_POINTS_PER_THREAD 4
+
+// Number of generated points that are checked on the host
+#define VERIFY_SAMPLE_POINTS 16
+
+/**
+ * A range of the points of each thread that is launched on its own stream.
+ * While the host reads the distinguished points of one stream the kernels
+ * of the other streams keep the device busy
+ */
+typedef struct {
+    cudaStream_t stream;
+
+    // Points firstPoint to firstPoint + numPoints - 1 of each thread
+    unsigned int firstPoint;
+    unsigned int numPoints;
+
+    // Number of steps the points of this stream have done
+    unsigned long long counter;
+
+    // True while a kernel is queued on the stream
+    bool running;
+
+    // Recorded before and after each kernel, for timing it
+    cudaEvent_t kernelStart;
+    cudaEvent_t kernelStop;
+
+    // Flags for each block, in mapped host memory
+    unsigned int *blockFlags;
+
+    // Walks to restart at spare points after the last step, in mapped host
+    // memory
+    unsigned int *refillSlots;
+    unsigned int *devRefillSlots;
+
+    /**
+     * Persistent kernel state. The records, tail and dropped count are in
+     * mapped host memory
+     */
+    DPRecord *dpRecords;
+    unsigned int *dpTail;
+    unsigned int *dpDropped;
+    DPQueue dpQueue;
+}StreamState;
 
 class RhoCUDA {
 
 private:
-    unsigned long long _mainCounter;
     volatile bool _runFlag;
 
     unsigned int _pointsPerThread; 
@@ -18,6 +69,13 @@ private:
     unsigned int _numThreads;
     unsigned int _numRPoints;
 
+    // Number of steps per kernel launch. Above 1 the persistent kernel is used
+    unsigned int _stepsPerLaunch;
+
+    // Each stream works on a range of the points of every thread
+    unsigned int _numStreams;
+    StreamState *_streams;
+
     /**
      * Pointers to host memory
      */
@@ -43,11 +101,93 @@ private:
     unsigned int *_devX;
     unsigned int *_devY;
 
+    /**
+     * Negation map state of each point, NULL when the job does not use it
+     */
+    unsigned int *_devNegation;
+
+    /**
+     * The R points
+     */
+    unsigned int *_devRx;
+    unsigned int *_devRy;
+
+    /**
+     * Starting points used by the persistent kernel, shared by all streams
+     */
+    unsigned int *_devStartX;
+    unsigned int *_devStartY;
+    unsigned long long *_devWalkStart;
+
+    /**
+     * Multiples 2^i G, 2^i Q and 2^i (G + Q) that starting points are
+     * generated from
+     */
+    unsigned int *_devGx;
+    unsigned int *_devGy;
+    unsigned int *_devQx;
+    unsigned int *_devQy;
+    unsigned int *_devGQx;
+    unsigned int *_devGQy;
+
+    /**
+     * Spare starting points in device memory, generated in batches, for
+     * restarting walks when every launch does one step. The first
+     * _sparesUsed points are taken
+     */
+    unsigned int _sparesPerThread;
+    unsigned int _numSpares;
+    unsigned int _sparesUsed;
+    unsigned int *_devSpareX;
+    unsigned int *_devSpareY;
+    unsigned int *_devSpareA;
+    unsigned int *_devSpareB;
+
     ECDLPParams _params;
     ECCurve _curve;
 
-    BigInteger _rx[NUM_R_POINTS];
-    BigInteger _ry[NUM_R_POINTS];
+    // Fixed-width routines for verifying points, or NULL if the curve is
+    // too large for them
+    ECFixedCurveBase *_fixedCurve;
+
+    // Saved walks that init() continues, or NULL
+    WalkCheckpoint *_resume;
+
+    /**
+     * Saving the walks. While run() is walking it answers a request by
+     * letting every stream finish, copying the walks to the host arrays
+     * below and setting _saveDone to the number of the request. The walks
+     * are added to the checkpoint after the streams are launched again
+     */
+    Mutex _saveMutex;
+    volatile unsigned int _saveRequest;
+    volatile unsigned int _saveDone;
+    volatile unsigned int _walking;
+    bool _saveFailed;
+
+    // Distinguished bits the walks stop at, and the bits on the device. The
+    // device is changed while no stream is running
+    volatile unsigned int _dBits;
+    unsigned int _deviceBits;
+
+    std::vector<unsigned int> _savedX;
+    std::vector<unsigned int> _savedY;
+    std::vector<unsigned int> _savedA;
+    std::vector<unsigned int> _savedB;
+    std::vector<unsigned int> _savedStartX;
+    std::vector<unsigned int> _savedStartY;
+    std::vector<unsigned long long> _savedLengths;
+    std::vector<unsigned int> _savedNegation;
+
+    std::vector<BigInteger> _rx;
+    std::vector<BigInteger> _ry;
+
+    // T = aG + bQ and its a and b, which the persistent kernel adds to the
+    // starting point of a walk to restart it
+    std::vector<unsigned int> _restartX;
+    std::vector<unsigned int> _restartY;
+    std::vector<unsigned int> _restartA;
+    std::vector<unsigned int> _restartB;
 
     int _pBits;
     int _mBits;
@@ -61,43 +201,64 @@ private:
     
     void (*_callback)(struct CallbackParameters *);
 
-    void readX(unsigned int *x, unsigned int block, unsigned int thread, unsigned int index);
-    void readY(unsigned int *y, unsigned int block, unsigned int thread, unsigned int index);
+    MetricsCounters *_metrics;
+
+    void readX(unsigned int *x, unsigned int block, unsigned int thread, unsigned int index, cudaStream_t stream = 0);
+    void readY(unsigned int *y, unsigned int block, unsigned int thread, unsigned int index, cudaStream_t stream = 0);
     void readA(unsigned int *a, unsigned int block, unsigned int thread, unsigned int index);
     void readB(unsigned int *b, unsigned int block, unsigned int thread, unsigned int index);
 
-    void writeX(const unsigned int *x, unsigned int block, unsigned int thread, unsigned int index);
-    void writeY(const unsigned int *y, unsigned int block, unsigned int thread, unsigned int index);
+    void writeX(const unsigned int *x, unsigned int block, unsigned int thread, unsigned int index, cudaStream_t stream = 0);
+    void writeY(const unsigned int *y, unsigned int block, unsigned int thread, unsigned int index, cudaStream_t stream = 0);
     void writeA(const unsigned int *a, unsigned int block, unsigned int thread, unsigned int index);
     void writeB(const unsigned int *b, unsigned int block, unsigned int thread, unsigned int index);
 
     void splatBigInt(unsigned int *ara, const unsigned int *x, unsigned int block, unsigned int thread, unsigned int index );
     void extractBigInt(unsigned int *x, const unsigned int *ara, unsigned int block, unsigned int thread, unsigned int index);
 
-    void writeBigInt(unsigned int *dest, const unsigned int *src, unsigned int block, unsigned int thread, unsigned int index);
-    void readBigInt(unsigned int *dest, const unsigned int *src, unsigned int block, unsigned int thread, unsigned int index);
+    void writeBigInt(unsigned int *dest, const unsigned int *src, unsigned int block, unsigned int thread, unsigned int index, cudaStream_t stream);
+    void readBigInt(unsigned int *dest, const unsigned int *src, unsigned int block, unsigned int thread, unsigned int index, cudaStream_t stream);
 
-    unsigned int getIndex(unsigned int block, unsigned int thread, unsigned int idx);
+    unsigned int getIndex(unsigned int block, unsigned int thread, unsigned int idx, unsigned int word);
+    unsigned int getIndex(unsigned int block, unsigned int thread, unsigned int idx, unsigned int word, unsigned int words);
 
     // Initializaton
     void generateLookupTable(unsigned int *gx, unsigned int *gy, unsigned int *qx, unsigned int *qy, unsigned int *gqx, unsigned int *gqy);
 
-    void generateExponentsHost();
-    void generateStartingPoints(bool doVerify = false);
+    void setupStartingPointTables();
+    void generatePoints(unsigned int *x, unsigned int *y, unsigned int *a, unsigned int *b, unsigned int pointsPerThread, unsigned int *negation);
+    bool verifySample(const unsigned int *x, const unsigned int *y, const unsigned int *a, const unsigned int *b, unsigned int pointsPerThread);
+    bool generateStartingPoints();
+    bool generateSparePoints();
+    bool refillWalks(StreamState &s, unsigned int count);
+    bool loadWalks();
+    bool copyWalks();
+    void addWalks(WalkCheckpoint &checkpoint);
     void allocateBuffers();
     void freeBuffers();
     void setupDeviceConstants();
+    void loadDeviceConstants();
+    bool loadDistinguishedBits();
+    void checkKernelBinary();
 
     void uninitializeDevice();
     bool initializeDevice();
     bool getFlag();
-    void getRandomPoint(unsigned int *x, unsigned int *y, unsigned int *a, unsigned int *b);
-    bool verifyPoint(BigInteger &x, BigInteger &y);
+    bool verifyPoint(const unsigned int *x, const unsigned int *y);
     void setRunFlag(bool flag);
     void setRPoints();
-    bool pointFound();
+    bool pointFound(StreamState &s);
 
-    bool doStep();
+    bool launchStream(StreamState &s);
+    bool finishStream(StreamState &s);
+    bool readFlaggedPoints(StreamState &s);
+    bool readDistinguishedPoints(StreamState &s);
+    void setupPersistentKernel(bool copyStart);
+    void setRestartParams();
+    void allocatePersistentBuffers();
+    void allocateSpareBuffers();
+    void createStreams();
+    void destroyStreams();
 
     void cudaException(cudaError_t error);
 
@@ -110,7 +271,10 @@ public:
            const BigInteger *rx,
            const BigInteger *ry,
            int rPoints,
-           void (*callback)(struct CallbackParameters *));
+           void (*callback)(struct CallbackParameters *),
+           unsigned int stepsPerLaunch = 1,
+           unsigned int numStreams = 1,
+           WalkCheckpoint *resume = NULL);
 
     ~RhoCUDA();
     bool init();
@@ -118,9 +282,11 @@ public:
     bool run();
     bool stop();
     bool isRunning();
+    void saveWalks(WalkCheckpoint &checkpoint);
+    void setDistinguishedBits(unsigned int dBits);
 
     // Debug code
-    bool benchmark(unsigned long long *pointsPerSecond);
+    bool benchmark(unsigned long long *pointsPerSecond, unsigned int iterations = 1000);
 };
 
 #endif
\ No newline at end of file
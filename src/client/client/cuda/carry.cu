@@ -0,0 +1,193 @@
+#ifndef _CARRY_CU
+#define _CARRY_CU
+
+// Carry chain instructions the field arithmetic is built from, named after
+// the PTX instructions. With CUDA each one is the PTX instruction and the
+// carry is the condition code register, so the carry argument is not used
+// and consecutive calls must not be separated by other carry chains. With
+// HIP the carry is kept in the argument, 0 or 1, and the compiler builds
+// the chains of the AMD instruction set from the 64-bit sums
+
+#ifdef _HIP
+
+__device__ __forceinline__ void add_cc(unsigned int &d, unsigned int a, unsigned int b, unsigned int &carry)
+{
+    unsigned long long t = (unsigned long long)a + b;
+    d = (unsigned int)t;
+    carry = (unsigned int)(t >> 32);
+}
+
+__device__ __forceinline__ void addc_cc(unsigned int &d, unsigned int a, unsigned int b, unsigned int &carry)
+{
+    unsigned long long t = (unsigned long long)a + b + carry;
+    d = (unsigned int)t;
+    carry = (unsigned int)(t >> 32);
+}
+
+__device__ __forceinline__ void addc(unsigned int &d, unsigned int a, unsigned int b, unsigned int &carry)
+{
+    d = a + b + carry;
+}
+
+__device__ __forceinline__ void sub_cc(unsigned int &d, unsigned int a, unsigned int b, unsigned int &carry)
+{
+    unsigned long long t = (unsigned long long)a - b;
+    d = (unsigned int)t;
+    carry = (unsigned int)(t >> 32) & 1;
+}
+
+__device__ __forceinline__ void subc_cc(unsigned int &d, unsigned int a, unsigned int b, unsigned int &carry)
+{
+    unsigned long long t = (unsigned long long)a - b - carry;
+    d = (unsigned int)t;
+    carry = (unsigned int)(t >> 32) & 1;
+}
+
+__device__ __forceinline__ void subc(unsigned int &d, unsigned int a, unsigned int b, unsigned int &carry)
+{
+    d = a - b - carry;
+}
+
+__device__ __forceinline__ void mul_hi(unsigned int &d, unsigned int a, unsigned int b)
+{
+    d = (unsigned int)(((unsigned long long)a * b) >> 32);
+}
+
+__device__ __forceinline__ void mad_hi(unsigned int &d, unsigned int a, unsigned int b, unsigned int c)
+{
+    d = (unsigned int)(((unsigned long long)a * b) >> 32) + c;
+}
+
+__device__ __forceinline__ void mad_hi_cc(unsigned int &d, unsigned int a, unsigned int b, unsigned int c, unsigned int &carry)
+{
+    unsigned long long t = (((unsigned long long)a * b) >> 32) + c;
+    d = (unsigned int)t;
+    carry = (unsigned int)(t >> 32);
+}
+
+__device__ __forceinline__ void madc_hi_cc(unsigned int &d, unsigned int a, unsigned int b, unsigned int c, unsigned int &carry)
+{
+    unsigned long long t = (((unsigned long long)a * b) >> 32) + c + carry;
+    d = (unsigned int)t;
+    carry = (unsigned int)(t >> 32);
+}
+
+__device__ __forceinline__ void madc_hi(unsigned int &d, unsigned int a, unsigned int b, unsigned int c, unsigned int &carry)
+{
+    d = (unsigned int)(((unsigned long long)a * b) >> 32) + c + carry;
+}
+
+__device__ __forceinline__ void mad_lo_cc(unsigned int &d, unsigned int a, unsigned int b, unsigned int c, unsigned int &carry)
+{
+    unsigned long long t = (unsigned long long)(a * b) + c;
+    d = (unsigned int)t;
+    carry = (unsigned int)(t >> 32);
+}
+
+__device__ __forceinline__ void madc_lo_cc(unsigned int &d, unsigned int a, unsigned int b, unsigned int c, unsigned int &carry)
+{
+    unsigned long long t = (unsigned long long)(a * b) + c + carry;
+    d = (unsigned int)t;
+    carry = (unsigned int)(t >> 32);
+}
+
+__device__ __forceinline__ void madc_lo(unsigned int &d, unsigned int a, unsigned int b, unsigned int c, unsigned int &carry)
+{
+    d = a * b + c + carry;
+}
+
+__device__ __forceinline__ void set_eq(unsigned int &d, unsigned int a, unsigned int b)
+{
+    d = a == b ? 0xffffffff : 0;
+}
+
+__device__ __forceinline__ void set_lo(unsigned int &d, unsigned int a, unsigned int b)
+{
+    d = a < b ? 0xffffffff : 0;
+}
+
+#else
+
+__device__ __forceinline__ void add_cc(unsigned int &d, unsigned int a, unsigned int b, unsigned int &carry)
+{
+    asm volatile( "add.cc.u32 %0, %1, %2;\n\t" : "=r"(d) : "r"(a), "r"(b) );
+}
+
+__device__ __forceinline__ void addc_cc(unsigned int &d, unsigned int a, unsigned int b, unsigned int &carry)
+{
+    asm volatile( "addc.cc.u32 %0, %1, %2;\n\t" : "=r"(d) : "r"(a), "r"(b) );
+}
+
+__device__ __forceinline__ void addc(unsigned int &d, unsigned int a, unsigned int b, unsigned int &carry)
+{
+    asm volatile( "addc.u32 %0, %1, %2;\n\t" : "=r"(d) : "r"(a), "r"(b) );
+}
+
+__device__ __forceinline__ void sub_cc(unsigned int &d, unsigned int a, unsigned int b, unsigned int &carry)
+{
+    asm volatile( "sub.cc.u32 %0, %1, %2;\n\t" : "=r"(d) : "r"(a), "r"(b) );
+}
+
+__device__ __forceinline__ void subc_cc(unsigned int &d, unsigned int a, unsigned int b, unsigned int &carry)
+{
+    asm volatile( "subc.cc.u32 %0, %1, %2;\n\t" : "=r"(d) : "r"(a), "r"(b) );
+}
+
+__device__ __forceinline__ void subc(unsigned int &d, unsigned int a, unsigned int b, unsigned int &carry)
+{
+    asm volatile( "subc.u32 %0, %1, %2;\n\t" : "=r"(d) : "r"(a), "r"(b) );
+}
+
+__device__ __forceinline__ void mul_hi(unsigned int &d, unsigned int a, unsigned int b)
+{
+    asm volatile( "mul.hi.u32 %0, %1, %2;\n\t" : "=r"(d) : "r"(a), "r"(b) );
+}
+
+__device__ __forceinline__ void mad_hi(unsigned int &d, unsigned int a, unsigned int b, unsigned int c)
+{
+    asm volatile( "mad.hi.u32 %0, %1, %2, %3;\n\t" : "=r"(d) : "r"(a), "r"(b), "r"(c) );
+}
+
+__device__ __forceinline__ void mad_hi_cc(unsigned int &d, unsigned int a, unsigned int b, unsigned int c, unsigned int &carry)
+{
+    asm volatile( "mad.hi.cc.u32 %0, %1, %2, %3;\n\t" : "=r"(d) : "r"(a), "r"(b), "r"(c) );
+}
+
+__device__ __forceinline__ void madc_hi_cc(unsigned int &d, unsigned int a, unsigned int b, unsigned int c, unsigned int &carry)
+{
+    asm volatile( "madc.hi.cc.u32 %0, %1, %2, %3;\n\t" : "=r"(d) : "r"(a), "r"(b), "r"(c) );
+}
+
+__device__ __forceinline__ void madc_hi(unsigned int &d, unsigned int a, unsigned int b, unsigned int c, unsigned int &carry)
+{
+    asm volatile( "madc.hi.u32 %0, %1, %2, %3;\n\t" : "=r"(d) : "r"(a), "r"(b), "r"(c) );
+}
+
+__device__ __forceinline__ void mad_lo_cc(unsigned int &d, unsigned int a, unsigned int b, unsigned int c, unsigned int &carry)
+{
+    asm volatile( "mad.lo.cc.u32 %0, %1, %2, %3;\n\t" : "=r"(d) : "r"(a), "r"(b), "r"(c) );
+}
+
+__device__ __forceinline__ void madc_lo_cc(unsigned int &d, unsigned int a, unsigned int b, unsigned int c, unsigned int &carry)
+{
+    asm volatile( "madc.lo.cc.u32 %0, %1, %2, %3;\n\t" : "=r"(d) : "r"(a), "r"(b), "r"(c) );
+}
+
+__device__ __forceinline__ void madc_lo(unsigned int &d, unsigned int a, unsigned int b, unsigned int c, unsigned int &carry)
+{
+    asm volatile( "madc.lo.u32 %0, %1, %2, %3;\n\t" : "=r"(d) : "r"(a), "r"(b), "r"(c) );
+}
+
+__device__ __forceinline__ void set_eq(unsigned int &d, unsigned int a, unsigned int b)
+{
+    asm volatile( "set.eq.u32.u32 %0, %1, %2;\n\t" : "=r"(d) : "r"(a), "r"(b) );
+}
+
+__device__ __forceinline__ void set_lo(unsigned int &d, unsigned int a, unsigned int b)
+{
+    asm volatile( "set.lo.u32.u32 %0, %1, %2;\n\t" : "=r"(d) : "r"(a), "r"(b) );
+}
+
+#endif
+
+#endif
@@ -10,6 +10,22 @@ namespace CUDA {
         }
     }
 
+    void memcpyAsync(void *dest, const void *src, size_t count, enum cudaMemcpyKind kind, cudaStream_t stream)
+    {
+        cudaError_t cudaError = cudaMemcpyAsync(dest, src, count, kind, stream);
+        if(cudaError != cudaSuccess) {
+            throw cudaError;
+        }
+    }
+
+    void streamSynchronize(cudaStream_t stream)
+    {
+        cudaError_t cudaError = cudaStreamSynchronize(stream);
+        if(cudaError != cudaSuccess) {
+            throw cudaError;
+        }
+    }
+
     void *malloc(size_t size)
     {
         void *ptr;
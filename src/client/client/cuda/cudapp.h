@@ -1,8 +1,7 @@
 #ifndef _CUDAPP_H
 #define _CUDAPP_H
 
-#include<cuda.h>
-#include<cuda_runtime.h>
+#include "gpu.h"
 #include<string>
 
 namespace CUDA {
@@ -16,6 +15,8 @@ namespace CUDA {
     }DeviceInfo;
 
     void memcpy(void *dest, const void *src, size_t count, enum cudaMemcpyKind kind);
+    void memcpyAsync(void *dest, const void *src, size_t count, enum cudaMemcpyKind kind, cudaStream_t stream);
+    void streamSynchronize(cudaStream_t stream);
     void *malloc(size_t);
     void *hostAlloc(size_t size, unsigned int flags);
     void free(void *ptr);
@@ -0,0 +1,71 @@
+#ifndef _ECDL_GPU_H
+#define _ECDL_GPU_H
+
+// The GPU code is written against the CUDA runtime. Building with _HIP
+// compiles the same sources with hipcc for AMD devices, with the CUDA names
+// mapped to their HIP equivalents here
+#ifdef _HIP
+
+#include <hip/hip_runtime.h>
+
+#define cudaError_t hipError_t
+#define cudaSuccess hipSuccess
+#define cudaErrorInvalidDevice hipErrorInvalidDevice
+#define cudaGetErrorString hipGetErrorString
+#define cudaGetLastError hipGetLastError
+
+#define cudaDeviceProp hipDeviceProp_t
+#define cudaFuncAttributes hipFuncAttributes
+#define cudaGetDevice hipGetDevice
+#define cudaGetDeviceCount hipGetDeviceCount
+#define cudaGetDeviceProperties hipGetDeviceProperties
+#define cudaSetDevice hipSetDevice
+#define cudaSetDeviceFlags hipSetDeviceFlags
+#define cudaDeviceScheduleBlockingSync hipDeviceScheduleBlockingSync
+#define cudaDeviceSynchronize hipDeviceSynchronize
+#define cudaFuncGetAttributes hipFuncGetAttributes
+#define cudaOccupancyMaxActiveBlocksPerMultiprocessor hipOccupancyMaxActiveBlocksPerMultiprocessor
+
+#define cudaMalloc hipMalloc
+#define cudaFree hipFree
+#define cudaHostAlloc hipHostMalloc
+#define cudaHostAllocMapped hipHostMallocMapped
+#define cudaFreeHost hipHostFree
+#define cudaHostGetDevicePointer hipHostGetDevicePointer
+#define cudaMemGetInfo hipMemGetInfo
+#define cudaMemset hipMemset
+#define cudaMemcpy hipMemcpy
+#define cudaMemcpyAsync hipMemcpyAsync
+#define cudaMemcpyToSymbol hipMemcpyToSymbol
+#define cudaMemcpyKind hipMemcpyKind
+#define cudaMemcpyHostToDevice hipMemcpyHostToDevice
+#define cudaMemcpyDeviceToHost hipMemcpyDeviceToHost
+#define cudaMemcpyDeviceToDevice hipMemcpyDeviceToDevice
+
+#define cudaStream_t hipStream_t
+#define cudaStreamCreateWithFlags hipStreamCreateWithFlags
+#define cudaStreamNonBlocking hipStreamNonBlocking
+#define cudaStreamDestroy hipStreamDestroy
+#define cudaStreamSynchronize hipStreamSynchronize
+
+#define cudaEvent_t hipEvent_t
+#define cudaEventCreate hipEventCreate
+#define cudaEventRecord hipEventRecord
+#define cudaEventSynchronize hipEventSynchronize
+#define cudaEventElapsedTime hipEventElapsedTime
+#define cudaEventDestroy hipEventDestroy
+
+// Shared memory of a multiprocessor, which the HIP properties name
+// differently
+#define GPU_SHARED_MEM_PER_MP(properties) ((properties).maxSharedMemoryPerMultiProcessor)
+
+#else
+
+#include <cuda.h>
+#include <cuda_runtime.h>
+
+#define GPU_SHARED_MEM_PER_MP(properties) ((properties).sharedMemPerMultiprocessor)
+
+#endif
+
+#endif
@@ -1,36 +1,87 @@
-#include <cuda.h>
-#include <cuda_runtime.h>
-#include <device_launch_parameters.h>
 #include <stdlib.h>
+#include "gpu.h"
 #include "Fp.cu"
+#include "kernels.h"
 #include <stdio.h>
 
-#define NUM_R_POINTS 32 // Must be a power of 2
-#define R_POINT_MASK (NUM_R_POINTS - 1)
+/**
+ * Bit mask for identifying distinguished points
+ */
+__constant__ unsigned int _MASK[ 2 ];
+
+/**
+ * Number of R points and the mask for selecting one. The count is a power of 2
+ */
+__constant__ unsigned int _NUM_R_POINTS;
+__constant__ unsigned int _R_POINT_MASK;
+
+/**
+ * The R points in global memory, the words of each point next to each other
+ */
+__constant__ const unsigned int *_RX_TABLE;
+__constant__ const unsigned int *_RY_TABLE;
 
+/**
+ * Non-zero when every block keeps a copy of the R points in shared memory
+ */
+__constant__ unsigned int _SHARED_R_POINTS;
 
+/**
+ * Shared memory to hold the R points. Word i of Rx[j] is at i * count + j so
+ * threads reading different points use different banks. The Ry words follow
+ * the Rx words
+ */
+extern __shared__ unsigned int _shared_r[];
 
 /**
- * Bit mask for identifying distinguished points
+ * Bytes of shared memory each block needs for the R points, for each device.
+ * Devices with more shared memory keep larger tables in it
  */
-__constant__ unsigned int _MASK[ 2 ];
+static size_t _sharedRPointBytes[MAX_DEVICES];
 
 /**
- * The X coordinates of the R points
+ * Gets the shared memory for the R points on the current device
  */
-__constant__ unsigned int _rx[ 10 * NUM_R_POINTS ];
+static size_t getSharedRPointBytes()
+{
+    int device = 0;
+
+    if(cudaGetDevice(&device) != cudaSuccess || device >= MAX_DEVICES) {
+        return 0;
+    }
+
+    return _sharedRPointBytes[device];
+}
+
+
+/**
+ * Order of G, for drawing random coefficients and for updating them when a
+ * walk is restarted
+ */
+__constant__ unsigned int _ORDER[ 10 ];
 
 /**
- * The Y coordinates of the Y points
+ * Point T = aG + bQ that is added to the starting point of a walk to get the next one
  */
-__constant__ unsigned int _ry[ 10 * NUM_R_POINTS ];
+__constant__ unsigned int _TX[ 10 ];
+__constant__ unsigned int _TY[ 10 ];
+__constant__ unsigned int _TA[ 10 ];
+__constant__ unsigned int _TB[ 10 ];
 
 /**
- * Shared memory to hold the R points
+ * Interval of a kangaroo job: its width and the lowest coefficient of a tame
+ * and of a wild starting point
  */
-__shared__ unsigned int _shared_rx[ 10 * NUM_R_POINTS ];
-__shared__ unsigned int _shared_ry[ 10 * NUM_R_POINTS ];
+__constant__ unsigned int _WIDTH[ 10 ];
+__constant__ unsigned int _TAME_BASE[ 10 ];
+__constant__ unsigned int _WILD_BASE[ 10 ];
 
+/**
+ * Non-zero when walking with the negation map, and the curve parameter a for
+ * doubling when leaving a fruitless cycle
+ */
+__constant__ unsigned int _NEGATION = 0;
+__constant__ unsigned int _CURVE_A[ 10 ];
 
 /**
  * Point at infinity
@@ -39,38 +90,69 @@ __device__ unsigned int _pointAtInfinity[10] = { 0xffffffff, 0xffffffff, 0xfffff
                                                  0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff};
 
 /**
- * Reads Rx[i] from shared memory
+ * Reads a word of an R point through the read-only data cache where the
+ * device has one
+ */
+__device__ unsigned int readRPointWord(const unsigned int *ptr)
+{
+#if __CUDA_ARCH__ >= 350
+    return __ldg(ptr);
+#else
+    return *ptr;
+#endif
+}
+
+/**
+ * Reads Rx[i] from shared memory, or from global memory for large tables
  */
 template<int N> __device__ void getRX(int index, unsigned int *rx)
 {
-    for(int i = 0; i < N; i++) {
-        rx[i] = _shared_rx[32 * i + index];
+    if(_SHARED_R_POINTS) {
+        for(int i = 0; i < N; i++) {
+            rx[i] = _shared_r[_NUM_R_POINTS * i + index];
+        }
+    } else {
+        for(int i = 0; i < N; i++) {
+            rx[i] = readRPointWord(&_RX_TABLE[N * index + i]);
+        }
     }
 }
 
 /**
- * Reads Ry[i] from shared memory
+ * Reads Ry[i] from shared memory, or from global memory for large tables
  */
 template<int N> __device__ void getRY(int index, unsigned int *ry)
 {
-    for(int i = 0; i < N; i++) {
-        ry[ i ] = _shared_ry[32 * i + index];
+    if(_SHARED_R_POINTS) {
+        for(int i = 0; i < N; i++) {
+            ry[i] = _shared_r[_NUM_R_POINTS * (N + i) + index];
+        }
+    } else {
+        for(int i = 0; i < N; i++) {
+            ry[i] = readRPointWord(&_RY_TABLE[N * index + i]);
+        }
     }
 }
 
 
 /**
- * Reads Rx and Ry from constant memory and writes them to shared memory
+ * Copies Rx and Ry from global memory to shared memory if the table is small
+ * enough. The threads of the block share the copying
  */
 __device__ void initSharedMem(unsigned int len)
 {
-    if(threadIdx.x == 0) {
-        for(int i = 0; i < len; i++) {
-            for(int j = 0; j < 32; j++) {
-                _shared_rx[i * 32 + j] = _rx[ len * j + i];
-                _shared_ry[i * 32 + j] = _ry[ len * j + i];
-            }
-        }
+    if(!_SHARED_R_POINTS) {
+        return;
+    }
+
+    unsigned int count = _NUM_R_POINTS;
+
+    for(unsigned int k = threadIdx.x; k < len * count; k += blockDim.x) {
+        unsigned int j = k / len;
+        unsigned int i = k % len;
+
+        _shared_r[i * count + j] = _RX_TABLE[len * j + i];
+        _shared_r[(len + i) * count + j] = _RY_TABLE[len * j + i];
     }
     __syncthreads();
 }
@@ -104,7 +186,7 @@ template<int N> __device__ void doMultiplyStep(const unsigned int *aMultiplier,
         unsigned int am = readBigIntWord<N>(aMultiplier, i, word);
         unsigned int bm = readBigIntWord<N>(bMultiplier, i, word);
 
-        if( (am | bm) & mask == 0 || equalTo<N>(x, _pointAtInfinity) ) {
+        if( ((am | bm) & mask) == 0 || equalTo<N>(x, _pointAtInfinity) ) {
             zero<N>(diff);
             diff[0] = 2;
         } else {
@@ -214,7 +296,6 @@ __global__ void startingPointGenKernel(const unsigned int *a, const unsigned int
                                        int step, unsigned int pointsPerThread)
 {
     initFp();
-    initSharedMem(_PWORDS);
 
     switch(_PWORDS) {
         case 2:
@@ -261,11 +342,151 @@ __global__ void resetPointsKernel( unsigned int *rx, unsigned int *ry, int point
     resetPointsFunc(rx, ry, pointsPerThread);
 }
 
+/**
+ * Returns the next 64 bits of a splitmix64 stream
+ */
+__device__ unsigned long long splitMix64(unsigned long long &state)
+{
+    unsigned long long z = (state += 0x9e3779b97f4a7c15ULL);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+
+    return z ^ (z >> 31);
+}
+
+/**
+ * Draws 0 < k < n from the stream by rejection. The words above the most
+ * significant bit of n are masked off, so at most half of the draws are
+ * rejected
+ */
+template<int N> __device__ void randomModN(unsigned long long &state, unsigned int *k)
+{
+    unsigned int n[N];
+    copy<N>(_ORDER, n);
+
+    int top = N - 1;
+    while(top > 0 && n[top] == 0) {
+        top--;
+    }
+    unsigned int mask = 0xffffffff >> __clz(n[top]);
+
+    bool valid = false;
+    while(!valid) {
+        for(int i = 0; i < N; i += 2) {
+            unsigned long long r = splitMix64(state);
+
+            k[i] = (unsigned int)r;
+            if(i + 1 < N) {
+                k[i + 1] = (unsigned int)(r >> 32);
+            }
+        }
+
+        k[top] &= mask;
+        for(int i = top + 1; i < N; i++) {
+            k[i] = 0;
+        }
+
+        unsigned int nonZero = 0;
+        for(int i = 0; i < N; i++) {
+            nonZero |= k[i];
+        }
+
+        valid = nonZero != 0 && !greaterThanEqualTo<N>(k, n);
+    }
+}
+
+/**
+ * Sets the coefficients a and b of every point to random values mod n. Each
+ * thread draws from its own stream, seeded with the seed and its index
+ */
+template<int N> __global__ void generateExponentsKernel(unsigned int *aAra, unsigned int *bAra,
+                                                        unsigned long long seed, unsigned int pointsPerThread)
+{
+    unsigned long long state = seed + blockIdx.x * blockDim.x + threadIdx.x;
+    state = splitMix64(state);
+
+    for(unsigned int i = 0; i < pointsPerThread; i++) {
+        unsigned int a[N];
+        unsigned int b[N];
+
+        randomModN<N>(state, a);
+        randomModN<N>(state, b);
+
+        writeBigInt<N>(aAra, i, a);
+        writeBigInt<N>(bAra, i, b);
+    }
+}
+
+/**
+ * Index of word w of integer idx of thread t in an array laid out for a grid
+ * of numThreads threads. For kernels that are launched on another grid
+ */
+template<int N> __device__ unsigned int getWordIndex(unsigned int numThreads, unsigned int t, unsigned int idx, int w)
+{
+#ifdef INTERLEAVED_LAYOUT
+    return N * (numThreads * idx + t) + w;
+#else
+    return LAYOUT_GROUP_WORDS * ((LAYOUT_GROUPS(N) * idx + w / LAYOUT_GROUP_WORDS) * numThreads + t) + w % LAYOUT_GROUP_WORDS;
+#endif
+}
+
+/**
+ * Copies an integer between arrays laid out for a grid of numThreads
+ * threads. Slot s is integer s / numThreads of thread s % numThreads
+ */
+template<int N> __device__ void copyBigIntSlot(const unsigned int *src, unsigned int srcSlot,
+                                               unsigned int *dest, unsigned int destSlot, unsigned int numThreads)
+{
+    for(int w = 0; w < N; w++) {
+        dest[getWordIndex<N>(numThreads, destSlot % numThreads, destSlot / numThreads, w)] =
+            src[getWordIndex<N>(numThreads, srcSlot % numThreads, srcSlot / numThreads, w)];
+    }
+}
+
+/**
+ * Restarts walk slots[j] at spare point firstSpare + j, one walk per thread.
+ * The walks and the spare points are laid out for a grid of numThreads
+ * threads
+ */
+template<int N> __global__ void refillWalksKernel(const unsigned int *slots, unsigned int count,
+                                                  unsigned int *xAra, unsigned int *yAra,
+                                                  unsigned int *aAra, unsigned int *bAra,
+                                                  unsigned int *negation,
+                                                  const unsigned int *spareX, const unsigned int *spareY,
+                                                  const unsigned int *spareA, const unsigned int *spareB,
+                                                  unsigned int firstSpare, unsigned int numThreads)
+{
+    unsigned int j = blockIdx.x * blockDim.x + threadIdx.x;
+
+    if(j >= count) {
+        return;
+    }
+
+    unsigned int slot = slots[j];
+    unsigned int spare = firstSpare + j;
+
+    copyBigIntSlot<N>(spareX, spare, xAra, slot, numThreads);
+    copyBigIntSlot<N>(spareY, spare, yAra, slot, numThreads);
+    copyBigIntSlot<N>(spareA, spare, aAra, slot, numThreads);
+    copyBigIntSlot<N>(spareB, spare, bAra, slot, numThreads);
+
+    // Same as resetNegationState for the new starting point
+    if(negation != NULL) {
+        unsigned int x = spareX[getWordIndex<N>(numThreads, spare % numThreads, spare / numThreads, 0)];
+        unsigned int *state = &negation[LAYOUT_WORDS(NEGATION_STATE_WORDS) * slot];
+
+        state[0] = (x >> 16) & 0xffff;
+        state[1] = 0;
+        state[2] = 0;
+    }
+}
+
 
 /**
  * Sets the number of distinguished bits to look for
  */
-static cudaError_t setNumDistinguishedBits(unsigned int dBits)
+cudaError_t setNumDistinguishedBits(unsigned int dBits)
 {
     unsigned int mask[2] = {0xffffffff, 0xffffffff};
     if(dBits > 32) {
@@ -301,6 +522,58 @@ static void sub2(const unsigned int *a, unsigned int *c, int len)
     }
 }
 
+/**
+ * Builds the sliding window schedule of the exponent e for inverseModP.
+ * Returns the number of steps
+ */
+static unsigned int buildInverseSchedule(const unsigned int *e, int len, unsigned int *steps)
+{
+    int bit = len * 32 - 1;
+    while(bit >= 0 && !((e[bit / 32] >> (bit % 32)) & 1)) {
+        bit--;
+    }
+
+    unsigned int count = 0;
+    unsigned int squarings = 0;
+
+    while(bit >= 0) {
+        if(!((e[bit / 32] >> (bit % 32)) & 1)) {
+            squarings++;
+            bit--;
+            continue;
+        }
+
+        // Take up to INVERSE_WINDOW bits, ending on a 1 so the digit is odd
+        int low = bit - INVERSE_WINDOW + 1;
+        if(low < 0) {
+            low = 0;
+        }
+        while(!((e[low / 32] >> (low % 32)) & 1)) {
+            low++;
+        }
+
+        unsigned int digit = 0;
+        for(int i = bit; i >= low; i--) {
+            digit = (digit << 1) | ((e[i / 32] >> (i % 32)) & 1);
+        }
+
+        // The first window needs no squarings
+        if(count > 0) {
+            squarings += bit - low + 1;
+        }
+
+        steps[count++] = (squarings << 16) | digit;
+        squarings = 0;
+        bit = low - 1;
+    }
+
+    if(squarings > 0) {
+        steps[count++] = squarings << 16;
+    }
+
+    return count;
+}
+
 /**
  * Shift a big integer left by n bits
  */
@@ -342,7 +615,44 @@ static void addInt(const unsigned int *a, const unsigned int *b, unsigned int *c
 }
 
 /**
- * Set parameters for the prime field library
+ * Computes c = 2^pBits - p. Returns the length of c in words if c is short
+ * enough for the pseudo-Mersenne reduction, c < 2^(pBits/2 - 1), and 0
+ * otherwise
+ */
+static unsigned int getPseudoMersenneC(const unsigned int *p, unsigned int pBits, unsigned int *c, int len)
+{
+    // Two's complement of p, truncated to pBits bits
+    unsigned int carry = 1;
+    for(int i = 0; i < len; i++) {
+        c[i] = ~p[i] + carry;
+        carry = (carry && c[i] == 0) ? 1 : 0;
+
+        if((unsigned int)i * 32 >= pBits) {
+            c[i] = 0;
+        } else if(pBits - i * 32 < 32) {
+            c[i] &= (1u << (pBits - i * 32)) - 1;
+        }
+    }
+
+    int cBits = 0;
+    for(int i = len * 32 - 1; i >= 0; i--) {
+        if((c[i / 32] >> (i % 32)) & 1) {
+            cBits = i + 1;
+            break;
+        }
+    }
+
+    if(pBits < 4 || cBits > (int)pBits / 2 - 1) {
+        return 0;
+    }
+
+    return (cBits + 31) / 32;
+}
+
+/**
+ * Set parameters for the prime field library. A modulus of the form 2^k - c
+ * with a short c selects the pseudo-Mersenne reduction, anything else the
+ * Barrett reduction
  */
 static cudaError_t setFpParameters(const unsigned int *pPtr, unsigned int pBits, const unsigned int *mPtr, unsigned int mBits)
 {
@@ -351,19 +661,27 @@ static cudaError_t setFpParameters(const unsigned int *pPtr, unsigned int pBits,
     unsigned int mWords = (mBits + 31) / 32;
     unsigned int p2Words = (pBits + 1 + 31) / 32;
     unsigned int p3Words = (pBits + 2 + 31) / 32;
+    unsigned int p4Words = (pBits + 2 + 31) / 32;
 
     unsigned int p[10] = {0};
     unsigned int pTimes2[10] = {0};
     unsigned int pTimes3[10] = {0};
+    unsigned int pTimes4[10] = {0};
     unsigned int pMinus2[10] = {0};
+    unsigned int inverseSteps[INVERSE_MAX_STEPS] = {0};
+    unsigned int inverseStepCount = 0;
+    unsigned int c[10] = {0};
+    unsigned int cWords = 0;
+    unsigned int pmMask = pBits % 32 ? (1u << (pBits % 32)) - 1 : 0xffffffff;
 
     // copy p into buffer
     for(unsigned int i = 0; i < pWords; i++) {
         p[i] = pPtr[i];
     }
 
-    // compute p - 2
+    // compute p - 2 and its exponentiation schedule
     sub2(p, pMinus2, 10);
+    inverseStepCount = buildInverseSchedule(pMinus2, 10, inverseSteps);
 
     // compute 2 * p
     shiftLeft(p, 1, pTimes2, 10);
@@ -371,12 +689,23 @@ static cudaError_t setFpParameters(const unsigned int *pPtr, unsigned int pBits,
     // compute 3 * p
     addInt(p, pTimes2, pTimes3, 10);
 
+    // compute 4 * p
+    shiftLeft(p, 2, pTimes4, 10);
+
+    // compute c = 2^k - p
+    cWords = getPseudoMersenneC(p, pBits, c, 10);
+
     cudaError = cudaMemcpyToSymbol(_P_CONST, p, sizeof(unsigned int)*pWords, 0, cudaMemcpyHostToDevice);
     if(cudaError != cudaSuccess) {
         goto end;
     }
     
-    cudaError = cudaMemcpyToSymbol(_PMINUS2_CONST, pMinus2, sizeof(unsigned int)*pWords, 0, cudaMemcpyHostToDevice);
+    cudaError = cudaMemcpyToSymbol(_INVERSE_STEPS, inverseSteps, sizeof(unsigned int) * inverseStepCount, 0, cudaMemcpyHostToDevice);
+    if(cudaError != cudaSuccess) {
+        goto end;
+    }
+
+    cudaError = cudaMemcpyToSymbol(_INVERSE_STEP_COUNT, &inverseStepCount, sizeof(inverseStepCount), 0, cudaMemcpyHostToDevice);
     if(cudaError != cudaSuccess) {
         goto end;
     }
@@ -401,6 +730,11 @@ static cudaError_t setFpParameters(const unsigned int *pPtr, unsigned int pBits,
         goto end;
     }
 
+    cudaError = cudaMemcpyToSymbol(_4P_CONST, pTimes4, sizeof(unsigned int) * p4Words, 0, cudaMemcpyHostToDevice);
+    if(cudaError != cudaSuccess) {
+        goto end;
+    }
+
     cudaError = cudaMemcpyToSymbol(_PWORDS, &pWords, sizeof(unsigned int), 0, cudaMemcpyHostToDevice);
     if(cudaError != cudaSuccess) {
         goto end;
@@ -413,7 +747,22 @@ static cudaError_t setFpParameters(const unsigned int *pPtr, unsigned int pBits,
 
 
     cudaError = cudaMemcpyToSymbol(_MBITS_CONST, &mBits, sizeof(mBits), 0, cudaMemcpyHostToDevice);
-    
+    if(cudaError != cudaSuccess) {
+        goto end;
+    }
+
+    cudaError = cudaMemcpyToSymbol(_PM_C, c, sizeof(c), 0, cudaMemcpyHostToDevice);
+    if(cudaError != cudaSuccess) {
+        goto end;
+    }
+
+    cudaError = cudaMemcpyToSymbol(_PM_MASK, &pmMask, sizeof(pmMask), 0, cudaMemcpyHostToDevice);
+    if(cudaError != cudaSuccess) {
+        goto end;
+    }
+
+    cudaError = cudaMemcpyToSymbol(_PM_CWORDS, &cWords, sizeof(cWords), 0, cudaMemcpyHostToDevice);
+
 end:
     return cudaError;
 }
@@ -436,19 +785,80 @@ end:
 }
 
 /**
- * Copy a, b, Rx and Ry to constant memory
+ * Largest R point table in bytes that a device keeps in shared memory. This
+ * grows with the shared memory per multiprocessor of the architecture, up to
+ * what a block can use without opting in
+ */
+size_t getSharedRPointLimit(int device)
+{
+    cudaDeviceProp properties;
+
+    if(cudaGetDeviceProperties(&properties, device) != cudaSuccess) {
+        return 0;
+    }
+
+    size_t limit = GPU_SHARED_MEM_PER_MP(properties) / SHARED_R_POINT_BLOCKS;
+
+    return limit < properties.sharedMemPerBlock ? limit : properties.sharedMemPerBlock;
+}
+
+/**
+ * Copies Rx and Ry to the device buffers devRx and devRy, which hold count * length
+ * words each, and decides whether the blocks keep them in shared memory
  */
-cudaError_t copyRPointsToDevice(const unsigned int *rx, const unsigned int *ry, int length, int count)
+cudaError_t copyRPointsToDevice(const unsigned int *rx, const unsigned int *ry, int length, int count,
+                                unsigned int *devRx, unsigned int *devRy)
 {
     cudaError_t cudaError = cudaSuccess;
     size_t size = sizeof(unsigned int) * length * count;
+    unsigned int mask = count - 1;
+    unsigned int shared = 0;
+    int device = 0;
+
+    cudaError = cudaGetDevice(&device);
+    if( cudaError != cudaSuccess ) {
+        goto end;
+    }
+
+    if(device >= MAX_DEVICES) {
+        cudaError = cudaErrorInvalidDevice;
+        goto end;
+    }
+
+    shared = (2 * size <= getSharedRPointLimit(device)) ? 1 : 0;
+    _sharedRPointBytes[device] = shared ? 2 * size : 0;
+
+    cudaError = cudaMemcpy(devRx, rx, size, cudaMemcpyHostToDevice);
+    if( cudaError != cudaSuccess ) {
+        goto end;
+    }
+
+    cudaError = cudaMemcpy(devRy, ry, size, cudaMemcpyHostToDevice);
+    if( cudaError != cudaSuccess ) {
+        goto end;
+    }
+
+    cudaError = cudaMemcpyToSymbol(_RX_TABLE, &devRx, sizeof(devRx), 0, cudaMemcpyHostToDevice);
+    if( cudaError != cudaSuccess ) {
+        goto end;
+    }
+
+    cudaError = cudaMemcpyToSymbol(_RY_TABLE, &devRy, sizeof(devRy), 0, cudaMemcpyHostToDevice);
+    if( cudaError != cudaSuccess ) {
+        goto end;
+    }
+
+    cudaError = cudaMemcpyToSymbol(_NUM_R_POINTS, &count, sizeof(count), 0, cudaMemcpyHostToDevice);
+    if( cudaError != cudaSuccess ) {
+        goto end;
+    }
 
-    cudaError = cudaMemcpyToSymbol(_rx, rx, size, 0, cudaMemcpyHostToDevice );
+    cudaError = cudaMemcpyToSymbol(_R_POINT_MASK, &mask, sizeof(mask), 0, cudaMemcpyHostToDevice);
     if( cudaError != cudaSuccess ) {
         goto end;
     }
 
-    cudaError = cudaMemcpyToSymbol(_ry, ry, size, 0, cudaMemcpyHostToDevice );
+    cudaError = cudaMemcpyToSymbol(_SHARED_R_POINTS, &shared, sizeof(shared), 0, cudaMemcpyHostToDevice);
     if( cudaError != cudaSuccess ) {
         goto end;
     }
@@ -479,56 +889,573 @@ cudaError_t resetPoints(unsigned int blocks, unsigned int threads, unsigned int
     return cudaDeviceSynchronize();
 }
 
-void __device__ cuPrintBigInt(const unsigned int *x, int len)
+/**
+ * Draws random coefficients a and b for pointsPerThread points of each
+ * thread on the device
+ */
+cudaError_t cudaGenerateExponents(int pLen, unsigned int blocks, unsigned int threads, unsigned int pointsPerThread,
+                                  unsigned int *a, unsigned int *b, unsigned long long seed)
 {
-    for(int i = 0; i < len; i++) {
-        printf("%x ", x[i]);
+    switch(pLen) {
+        case 1:
+            generateExponentsKernel<1><<<blocks, threads>>>(a, b, seed, pointsPerThread);
+            break;
+        case 2:
+            generateExponentsKernel<2><<<blocks, threads>>>(a, b, seed, pointsPerThread);
+            break;
+        case 3:
+            generateExponentsKernel<3><<<blocks, threads>>>(a, b, seed, pointsPerThread);
+            break;
+        case 4:
+            generateExponentsKernel<4><<<blocks, threads>>>(a, b, seed, pointsPerThread);
+            break;
+        case 5:
+            generateExponentsKernel<5><<<blocks, threads>>>(a, b, seed, pointsPerThread);
+            break;
+        case 6:
+            generateExponentsKernel<6><<<blocks, threads>>>(a, b, seed, pointsPerThread);
+            break;
+        case 7:
+            generateExponentsKernel<7><<<blocks, threads>>>(a, b, seed, pointsPerThread);
+            break;
+        case 8:
+            generateExponentsKernel<8><<<blocks, threads>>>(a, b, seed, pointsPerThread);
+            break;
+        default:
+            throw "Unsupported word size";
     }
-    printf("\n");
-}
-
-template<int N> __device__ void doStep(
-                            unsigned int *xAra,
-                            unsigned int *yAra,
-                            unsigned int *diffBuf,
-                            unsigned int *chainBuf,
-                            unsigned int *blockFlags,
-                            unsigned int *pointFlags,
-                            unsigned int pointsInParallel) {
-
-    // Initalize to 1
-    unsigned int product[N] = {0};
-    product[0] = 1;
-
-    // Multiply differences together
-    for(int i = 0; i < pointsInParallel; i++) {
-        unsigned int x[N];
-        readBigInt<N>(xAra, i, x);
-        unsigned int rIdx = x[0] & R_POINT_MASK;
 
-        unsigned int diff[N];
-        unsigned int rx[N];
-        getRX<N>(rIdx, rx);
-        subModP<N>(x, rx, diff);
+    return cudaDeviceSynchronize();
+}
 
-        writeBigInt<N>(diffBuf, i, diff);
+/**
+ * Queues the restart of count walks at spare points on the stream. Returns
+ * without waiting for it
+ */
+cudaError_t cudaRefillWalksAsync(int pLen, const unsigned int *slots, unsigned int count,
+                                 unsigned int *x, unsigned int *y, unsigned int *a, unsigned int *b,
+                                 unsigned int *negation,
+                                 const unsigned int *spareX, const unsigned int *spareY,
+                                 const unsigned int *spareA, const unsigned int *spareB,
+                                 unsigned int firstSpare, unsigned int numThreads, cudaStream_t stream)
+{
+    unsigned int threads = 256;
+    unsigned int blocks = (count + threads - 1) / threads;
 
-        multiplyModP<N>(product, diff, product);
-        writeBigInt<N>(chainBuf, i, product);
-    }
+    switch(pLen) {
+        case 1:
+            refillWalksKernel<1><<<blocks, threads, 0, stream>>>(slots, count, x, y, a, b, negation, spareX, spareY, spareA, spareB, firstSpare, numThreads);
+            break;
+        case 2:
+            refillWalksKernel<2><<<blocks, threads, 0, stream>>>(slots, count, x, y, a, b, negation, spareX, spareY, spareA, spareB, firstSpare, numThreads);
+            break;
+        case 3:
+            refillWalksKernel<3><<<blocks, threads, 0, stream>>>(slots, count, x, y, a, b, negation, spareX, spareY, spareA, spareB, firstSpare, numThreads);
+            break;
+        case 4:
+            refillWalksKernel<4><<<blocks, threads, 0, stream>>>(slots, count, x, y, a, b, negation, spareX, spareY, spareA, spareB, firstSpare, numThreads);
+            break;
+        case 5:
+            refillWalksKernel<5><<<blocks, threads, 0, stream>>>(slots, count, x, y, a, b, negation, spareX, spareY, spareA, spareB, firstSpare, numThreads);
+            break;
+        case 6:
+            refillWalksKernel<6><<<blocks, threads, 0, stream>>>(slots, count, x, y, a, b, negation, spareX, spareY, spareA, spareB, firstSpare, numThreads);
+            break;
+        case 7:
+            refillWalksKernel<7><<<blocks, threads, 0, stream>>>(slots, count, x, y, a, b, negation, spareX, spareY, spareA, spareB, firstSpare, numThreads);
+            break;
+        case 8:
+            refillWalksKernel<8><<<blocks, threads, 0, stream>>>(slots, count, x, y, a, b, negation, spareX, spareY, spareA, spareB, firstSpare, numThreads);
+            break;
+        default:
+            throw "Unsupported word size";
+    }
+
+    return cudaGetLastError();
+}
+
+/**
+ * Computes c = a + b mod n for a, b < n
+ */
+template<int N> __device__ void addModN(const unsigned int *a, const unsigned int *b, unsigned int *c)
+{
+    unsigned int sum[N+1];
+    unsigned int n[N+1];
+    unsigned int carry = 0;
+
+    copy<N>(_ORDER, n);
+    n[N] = 0;
+
+    add_cc(sum[ 0 ], a[ 0 ], b[ 0 ], carry);
+    for(int i = 1; i < N; i++) {
+        addc_cc(sum[ i ], a[ i ], b[ i ], carry);
+    }
+    addc(sum[ N ], 0, 0, carry);
+
+    if(greaterThanEqualTo<N+1>(sum, n)) {
+        sub<N>(sum, n, c);
+    } else {
+        copy<N>(sum, c);
+    }
+}
+
+/**
+ * Computes c = n - a for 0 < a < n
+ */
+template<int N> __device__ void negModN(const unsigned int *a, unsigned int *c)
+{
+    unsigned int n[N];
+
+    copy<N>(_ORDER, n);
+    sub<N>(n, a, c);
+}
+
+/**
+ * Draws 0 <= k < bound from the stream by rejection, like randomModN
+ */
+template<int N> __device__ void randomBelow(unsigned long long &state, const unsigned int *bound, unsigned int *k)
+{
+    int top = N - 1;
+    while(top > 0 && bound[top] == 0) {
+        top--;
+    }
+    unsigned int mask = 0xffffffff >> __clz(bound[top]);
+
+    do {
+        for(int i = 0; i < N; i += 2) {
+            unsigned long long r = splitMix64(state);
+
+            k[i] = (unsigned int)r;
+            if(i + 1 < N) {
+                k[i + 1] = (unsigned int)(r >> 32);
+            }
+        }
+
+        k[top] &= mask;
+        for(int i = top + 1; i < N; i++) {
+            k[i] = 0;
+        }
+    }while(greaterThanEqualTo<N>(k, bound));
+}
+
+/**
+ * Sets the coefficients of the points of a kangaroo job. Points alternate
+ * between tame points aG with a in the interval and wild points aG + Q with
+ * a within half the width of 0
+ */
+template<int N> __global__ void generateIntervalExponentsKernel(unsigned int *aAra, unsigned int *bAra,
+                                                                unsigned long long seed, unsigned int pointsPerThread)
+{
+    unsigned int idx = blockIdx.x * blockDim.x + threadIdx.x;
+    unsigned long long state = seed + idx;
+    state = splitMix64(state);
+
+    unsigned int width[N];
+    copy<N>(_WIDTH, width);
+
+    for(unsigned int i = 0; i < pointsPerThread; i++) {
+        unsigned int r[N];
+        unsigned int a[N];
+        unsigned int b[N];
+
+        randomBelow<N>(state, width, r);
+
+        for(int j = 0; j < N; j++) {
+            b[j] = 0;
+        }
+
+        if((idx + i) & 1) {
+            addModN<N>(r, _WILD_BASE, a);
+            b[0] = 1;
+        } else {
+            addModN<N>(r, _TAME_BASE, a);
+        }
+
+        writeBigInt<N>(aAra, i, a);
+        writeBigInt<N>(bAra, i, b);
+    }
+}
+
+/**
+ * Draws the coefficients of pointsPerThread points of each thread of a
+ * kangaroo job on the device. n, width, tameBase and wildBase are pLen words
+ */
+cudaError_t cudaGenerateIntervalExponents(int pLen, unsigned int blocks, unsigned int threads, unsigned int pointsPerThread,
+                                          unsigned int *a, unsigned int *b, unsigned long long seed,
+                                          const unsigned int *n, const unsigned int *width,
+                                          const unsigned int *tameBase, const unsigned int *wildBase)
+{
+    size_t size = sizeof(unsigned int) * pLen;
+
+    cudaError_t cudaError = cudaMemcpyToSymbol(_ORDER, n, size, 0, cudaMemcpyHostToDevice);
+    if(cudaError == cudaSuccess) {
+        cudaError = cudaMemcpyToSymbol(_WIDTH, width, size, 0, cudaMemcpyHostToDevice);
+    }
+    if(cudaError == cudaSuccess) {
+        cudaError = cudaMemcpyToSymbol(_TAME_BASE, tameBase, size, 0, cudaMemcpyHostToDevice);
+    }
+    if(cudaError == cudaSuccess) {
+        cudaError = cudaMemcpyToSymbol(_WILD_BASE, wildBase, size, 0, cudaMemcpyHostToDevice);
+    }
+    if(cudaError != cudaSuccess) {
+        return cudaError;
+    }
+
+    switch(pLen) {
+        case 1:
+            generateIntervalExponentsKernel<1><<<blocks, threads>>>(a, b, seed, pointsPerThread);
+            break;
+        case 2:
+            generateIntervalExponentsKernel<2><<<blocks, threads>>>(a, b, seed, pointsPerThread);
+            break;
+        case 3:
+            generateIntervalExponentsKernel<3><<<blocks, threads>>>(a, b, seed, pointsPerThread);
+            break;
+        case 4:
+            generateIntervalExponentsKernel<4><<<blocks, threads>>>(a, b, seed, pointsPerThread);
+            break;
+        case 5:
+            generateIntervalExponentsKernel<5><<<blocks, threads>>>(a, b, seed, pointsPerThread);
+            break;
+        case 6:
+            generateIntervalExponentsKernel<6><<<blocks, threads>>>(a, b, seed, pointsPerThread);
+            break;
+        case 7:
+            generateIntervalExponentsKernel<7><<<blocks, threads>>>(a, b, seed, pointsPerThread);
+            break;
+        case 8:
+            generateIntervalExponentsKernel<8><<<blocks, threads>>>(a, b, seed, pointsPerThread);
+            break;
+        default:
+            throw "Unsupported word size";
+    }
+
+    return cudaDeviceSynchronize();
+}
+
+/**
+ * Computes (rx, ry) = (px, py) + (qx, qy) for P != +/-Q with its own inversion.
+ * Only used outside the batched step
+ */
+template<int N> __device__ void addPoints(const unsigned int *px, const unsigned int *py,
+                                          const unsigned int *qx, const unsigned int *qy,
+                                          unsigned int *rx, unsigned int *ry)
+{
+    unsigned int diff[N];
+    unsigned int inv[N];
+    unsigned int s[N];
+    unsigned int s2[N];
+    subModP<N>(qx, px, diff);
+    inverseModP<N>(diff, inv);
+    subModP<N>(qy, py, s);
+    multiplyModP<N>(s, inv, s);
+    squareModP<N>(s, s2);
+
+    unsigned int x[N];
+    subModP<N>(s2, px, x);
+    subModP<N>(x, qx, x);
+
+    unsigned int k[N];
+    subModP<N>(px, x, k);
+    multiplyModP<N>(k, s, k);
+    subModP<N>(k, py, ry);
+    copy<N>(x, rx);
+}
+
+/**
+ * Computes (rx, ry) = 2(px, py)
+ */
+template<int N> __device__ void doublePoint(const unsigned int *px, const unsigned int *py,
+                                            unsigned int *rx, unsigned int *ry)
+{
+    // s = (3x^2 + a) / 2y
+    unsigned int a[N];
+    unsigned int x2[N];
+    unsigned int rise[N];
+    unsigned int run[N];
+    copy<N>(_CURVE_A, a);
+    squareModP<N>(px, x2);
+    addModP<N>(x2, x2, rise);
+    addModP<N>(rise, x2, rise);
+    addModP<N>(rise, a, rise);
+    addModP<N>(py, py, run);
+    inverseModP<N>(run, run);
+
+    unsigned int s[N];
+    unsigned int s2[N];
+    multiplyModP<N>(rise, run, s);
+    squareModP<N>(s, s2);
+
+    unsigned int x[N];
+    subModP<N>(s2, px, x);
+    subModP<N>(x, px, x);
+
+    unsigned int k[N];
+    subModP<N>(px, x, k);
+    multiplyModP<N>(k, s, k);
+    subModP<N>(k, py, ry);
+    copy<N>(x, rx);
+}
+
+/**
+ * Replaces y by -y when y is odd, so that the point is the one of P and -P
+ * with an even y. Returns true if the point was negated
+ */
+template<int N> __device__ bool negateOddY(unsigned int *y)
+{
+    if((y[0] & 1) == 0) {
+        return false;
+    }
+
+    unsigned int zero[N] = {0};
+    subModP<N>(zero, y, y);
+
+    return true;
+}
+
+/**
+ * The negation map iteration with its own inversions: adds the first R point,
+ * starting from the one selected by x, whose sum does not select the same R
+ * point again
+ */
+template<int N> __device__ void negationMap(unsigned int *x, unsigned int *y)
+{
+    unsigned int idx = x[0] & _R_POINT_MASK;
+    unsigned int nx[N];
+    unsigned int ny[N];
+
+    for(unsigned int i = 0; i < _NUM_R_POINTS; i++) {
+        unsigned int j = (idx + i) & _R_POINT_MASK;
+        unsigned int rx[N];
+        unsigned int ry[N];
+        getRX<N>(j, rx);
+        getRY<N>(j, ry);
+
+        addPoints<N>(x, y, rx, ry, nx, ny);
+        negateOddY<N>(ny);
+
+        if((nx[0] & _R_POINT_MASK) != j) {
+            break;
+        }
+    }
+
+    copy<N>(nx, x);
+    copy<N>(ny, y);
+}
+
+/**
+ * Leaves the fruitless cycle through (x, y). The cycle is walked once and the
+ * point with the smallest x is doubled, so every walk that falls into the
+ * cycle leaves it at the same point. This is the same as the CPU and the server
+ */
+template<int N> __device__ void escapeCycle(unsigned int *x, unsigned int *y)
+{
+    unsigned int px[N];
+    unsigned int py[N];
+    unsigned int minX[N];
+    unsigned int minY[N];
+    copy<N>(x, px);
+    copy<N>(y, py);
+    copy<N>(x, minX);
+    copy<N>(y, minY);
+
+    for(int i = 0; i < NEGATION_CYCLE_MAX; i++) {
+        negationMap<N>(px, py);
+
+        if(equalTo<N>(px, x)) {
+            break;
+        }
+
+        if(!greaterThanEqualTo<N>(px, minX)) {
+            copy<N>(px, minX);
+            copy<N>(py, minY);
+        }
+    }
+
+    doublePoint<N>(minX, minY, x, y);
+    negateOddY<N>(y);
+}
+
+/**
+ * Applies the negation map to the sum (x, y) of point i and R point rIdx.
+ * Returns false when the R point has to be skipped, in which case the point
+ * stays where it is and the next R point is tried on the next step
+ */
+template<int N> __device__ bool negationStep(unsigned int *negation, int i, unsigned int rIdx,
+                                             unsigned int *x, unsigned int *y, DPQueue *queue)
+{
+    unsigned int state[NEGATION_STATE_WORDS];
+    readBigInt<NEGATION_STATE_WORDS>(negation, i, state);
+
+    // Landing on the same R point again is how most fruitless 2-cycles start
+    if((x[0] & _R_POINT_MASK) == rIdx) {
+        state[2]++;
+        writeBigInt<NEGATION_STATE_WORDS>(negation, i, state);
+
+        // A skipped R point does not count towards the walk length
+        if(queue != NULL) {
+            queue->walkStart[gridDim.x * blockDim.x * i + blockIdx.x * blockDim.x + threadIdx.x]++;
+        }
+        return false;
+    }
+
+    negateOddY<N>(y);
+
+    // Same point as 2 or 4 steps ago means the walk is in a fruitless cycle
+    unsigned long long history = ((unsigned long long)state[1] << 32) | state[0];
+    unsigned int f = (x[0] >> 16) & 0xffff;
+
+    if(f == ((history >> 16) & 0xffff) || f == (history >> 48)) {
+        escapeCycle<N>(x, y);
+        f = (x[0] >> 16) & 0xffff;
+    }
+
+    history = (history << 16) | f;
+    state[0] = (unsigned int)history;
+    state[1] = (unsigned int)(history >> 32);
+    state[2] = 0;
+    writeBigInt<NEGATION_STATE_WORDS>(negation, i, state);
+
+    return true;
+}
+
+/**
+ * Sets the negation map state of a walk that starts at x
+ */
+template<int N> __device__ void resetNegationState(unsigned int *negation, int i, const unsigned int *x)
+{
+    unsigned int state[NEGATION_STATE_WORDS];
+    state[0] = (x[0] >> 16) & 0xffff;
+    state[1] = 0;
+    state[2] = 0;
+    writeBigInt<NEGATION_STATE_WORDS>(negation, i, state);
+}
+
+/**
+ * Appends a distinguished point to the queue and moves the walk to its next
+ * starting point. If the queue is full the point is dropped and the walk
+ * continues. Returns true if the walk was restarted
+ */
+template<int N> __device__ bool queueDistinguishedPoint(DPQueue &queue, int i, unsigned long long step,
+                                                        unsigned int *x, unsigned int *y)
+{
+    unsigned int slot = atomicAdd(queue.tail, 1);
+
+    if(slot - queue.head >= queue.capacity) {
+        atomicSub(queue.tail, 1);
+        atomicAdd(queue.dropped, 1);
+        return false;
+    }
+
+    unsigned int idx = gridDim.x * blockDim.x * i + blockIdx.x * blockDim.x + threadIdx.x;
+    DPRecord *record = &queue.records[slot & (queue.capacity - 1)];
+
+    unsigned int sx[N];
+    unsigned int sy[N];
+    unsigned int a[N];
+    unsigned int b[N];
+
+    readBigInt<N>(queue.startX, i, sx);
+    readBigInt<N>(queue.startY, i, sy);
+    readBigInt<N>(queue.a, i, a);
+    readBigInt<N>(queue.b, i, b);
+
+    for(int j = 0; j < N; j++) {
+        record->x[j] = x[j];
+        record->y[j] = y[j];
+        record->a[j] = a[j];
+        record->b[j] = b[j];
+    }
+    record->length = step - queue.walkStart[idx];
+
+    // Next starting point is S + T
+    unsigned int tx[N];
+    unsigned int ty[N];
+    copy<N>(_TX, tx);
+    copy<N>(_TY, ty);
+    addPoints<N>(sx, sy, tx, ty, x, y);
+
+    addModN<N>(a, _TA, a);
+    addModN<N>(b, _TB, b);
+
+    writeBigInt<N>(queue.startX, i, x);
+    writeBigInt<N>(queue.startY, i, y);
+    writeBigInt<N>(queue.a, i, a);
+    writeBigInt<N>(queue.b, i, b);
+    queue.walkStart[idx] = step;
+
+    // The saved starting point is not canonicalized. Otherwise -(S + T) + T = -S
+    // would restart the walk at S again
+    if(_NEGATION) {
+        negateOddY<N>(y);
+    }
+
+    return true;
+}
+
+void __device__ cuPrintBigInt(const unsigned int *x, int len)
+{
+    for(int i = 0; i < len; i++) {
+        printf("%x ", x[i]);
+    }
+    printf("\n");
+}
+
+template<int N> __device__ void doStep(
+                            unsigned int *xAra,
+                            unsigned int *yAra,
+                            unsigned int *diffBuf,
+                            unsigned int *chainBuf,
+                            unsigned int *negation,
+                            unsigned int *blockFlags,
+                            unsigned int *pointFlags,
+                            unsigned int firstPoint,
+                            unsigned int pointsInParallel,
+                            DPQueue *queue = NULL,
+                            unsigned long long step = 0) {
+
+    // Points firstPoint to end - 1 of this thread are processed
+    int end = firstPoint + pointsInParallel;
+
+    bool useNegation = _NEGATION && negation != NULL;
+
+    // Initalize to 1
+    unsigned int product[N] = {0};
+    product[0] = 1;
+
+    // Multiply differences together
+    for(int i = firstPoint; i < end; i++) {
+        unsigned int x[N];
+        readBigInt<N>(xAra, i, x);
+        unsigned int rIdx = x[0] & _R_POINT_MASK;
+
+        if(useNegation) {
+            rIdx = (rIdx + readBigIntWord<NEGATION_STATE_WORDS>(negation, i, 2)) & _R_POINT_MASK;
+        }
+
+        unsigned int diff[N];
+        unsigned int rx[N];
+        getRX<N>(rIdx, rx);
+        subModP<N>(x, rx, diff);
+
+        writeBigInt<N>(diffBuf, i, diff);
+
+        multiplyModP<N>(product, diff, product);
+        writeBigInt<N>(chainBuf, i, product);
+    }
 
     // Compute inverse
     unsigned int inverse[N];
     inverseModP<N>(product, inverse);
 
     // Extract inverse of the differences
-    for(int i = pointsInParallel - 1; i >= 0; i--) {
+    for(int i = end - 1; i >= (int)firstPoint; i--) {
 
         // Get the inverse of the last difference by multiplying the inverse of the product of all the differences
         // with the product of all but the last difference
         unsigned int invDiff[N];
 
-        if(i >= 1) {
+        if(i > (int)firstPoint) {
             unsigned int tmp[N];
             readBigInt<N>(chainBuf, i-1, tmp);
             multiplyModP<N>(inverse, tmp, invDiff);
@@ -547,7 +1474,12 @@ template<int N> __device__ void doStep(
         readBigInt<N>(xAra, i, px);
         readBigInt<N>(yAra, i, py);
 
-        unsigned int rIdx = px[0] & R_POINT_MASK;
+        unsigned int rIdx = px[0] & _R_POINT_MASK;
+
+        if(useNegation) {
+            rIdx = (rIdx + readBigIntWord<NEGATION_STATE_WORDS>(negation, i, 2)) & _R_POINT_MASK;
+        }
+
         unsigned int s[N];
         unsigned int s2[N];
 
@@ -573,86 +1505,764 @@ template<int N> __device__ void doStep(
         unsigned int newY[N];
         subModP<N>(k, py, newY);
 
+        if(useNegation && !negationStep<N>(negation, i, rIdx, newX, newY, queue)) {
+            continue;
+        }
+
+        // Check for distinguished point. The persistent kernel queues it and restarts
+        // the walk, otherwise set the flag for the host
+        if(((newX[ 0 ] & _MASK[ 0 ]) == 0) && ((newX[ 1 ] & _MASK[ 1 ]) == 0)) {
+            if(queue != NULL) {
+                if(queueDistinguishedPoint<N>(*queue, i, step, newX, newY) && useNegation) {
+                    resetNegationState<N>(negation, i, newX);
+                }
+            } else {
+                blockFlags[blockIdx.x] = 1;
+                pointFlags[gridDim.x * blockDim.x * i + blockIdx.x * blockDim.x + threadIdx.x] = 1;
+            }
+        }
+
         // Write result to memory
         writeBigInt<N>(xAra, i, newX);
         writeBigInt<N>(yAra, i, newY);
-       
-        // Check for distinguished point, set flag if found
-        if(((newX[ 0 ] & _MASK[ 0 ]) == 0) && ((newX[ 1 ] & _MASK[ 1 ]) == 0)) {
-            blockFlags[blockIdx.x] = 1;
-            pointFlags[gridDim.x * blockDim.x * i + blockIdx.x * blockDim.x + threadIdx.x] = 1;
-        }
     }
 }
 
-template<int N> __global__ void doStepKernel( unsigned int *xAra,
-                              unsigned int *yAra,
-                              unsigned int *diffBuf,
-                              unsigned int *chainBuf,
-                              unsigned int *blockFlags,
-                              unsigned int *pointFlags,
-                              unsigned int pointsPerThread)
+/**
+ * One step on points held in registers. Point j of x and y is point
+ * firstPoint + j of this thread. Unlike doStep nothing but the negation
+ * state and distinguished points goes to global memory, and the
+ * differences are computed again instead of being stored
+ */
+template<int N> __device__ void doStepResident(unsigned int x[][N],
+                            unsigned int y[][N],
+                            unsigned int count,
+                            unsigned int firstPoint,
+                            unsigned int *negation,
+                            DPQueue &queue,
+                            unsigned long long step)
 {
-    // Initialize shared memory constants
-    initFp();
-    initSharedMem(_PWORDS);
-    doStep<N>(xAra, yAra, diffBuf, chainBuf, blockFlags, pointFlags, pointsPerThread);
-}
+    const int maxPoints = RESIDENT_MAX_WORDS / N;
 
-cudaError_t initDeviceConstants(unsigned int numPoints)
-{
-    cudaError_t cudaError = cudaSuccess;
+    bool useNegation = _NEGATION && negation != NULL;
 
-    cudaError = cudaMemcpyToSymbol(_NUM_POINTS, &numPoints, sizeof(unsigned int), 0, cudaMemcpyHostToDevice);
+    unsigned int rIdx[maxPoints];
+    unsigned int chain[maxPoints][N];
 
-    if(cudaError != cudaSuccess) {
-        goto end;
-    }
+    unsigned int product[N] = {0};
+    product[0] = 1;
 
-end:
-    return cudaSuccess;
-}
+    // Fully unrolled so that the arrays stay in registers
+    #pragma unroll
+    for(int j = 0; j < maxPoints; j++) {
+        if(j < count) {
+            unsigned int idx = x[j][0] & _R_POINT_MASK;
 
-cudaError_t cudaDoStep(int pLen,
-                    int blocks,
-                    int threads,
+            if(useNegation) {
+                idx = (idx + readBigIntWord<NEGATION_STATE_WORDS>(negation, firstPoint + j, 2)) & _R_POINT_MASK;
+            }
+            rIdx[j] = idx;
+
+            unsigned int rx[N];
+            unsigned int diff[N];
+            getRX<N>(idx, rx);
+            subModP<N>(x[j], rx, diff);
+
+            multiplyModP<N>(product, diff, product);
+            copy<N>(product, chain[j]);
+        }
+    }
+
+    unsigned int inverse[N];
+    inverseModP<N>(product, inverse);
+
+    #pragma unroll
+    for(int j = maxPoints - 1; j >= 0; j--) {
+        if(j < count) {
+            unsigned int rx[N];
+            getRX<N>(rIdx[j], rx);
+
+            unsigned int invDiff[N];
+
+            if(j > 0) {
+                multiplyModP<N>(inverse, chain[j - 1], invDiff);
+
+                // Cancel out the last difference
+                unsigned int diff[N];
+                subModP<N>(x[j], rx, diff);
+                multiplyModP<N>(inverse, diff, inverse);
+            } else {
+                copy<N>(inverse, invDiff);
+            }
+
+            unsigned int s[N];
+            unsigned int s2[N];
+
+            // s^2 = (Py - Qy / Px - Qx)^2
+            unsigned int ry[N];
+            getRY<N>(rIdx[j], ry);
+            subModP<N>(y[j], ry, s);
+            multiplyModP<N>(s, invDiff, s);
+            squareModP<N>(s, s2);
+
+            // Rx = s^2 - Px - Qx
+            unsigned int newX[N];
+            subModP<N>(s2, x[j], newX);
+            subModP<N>(newX, rx, newX);
+
+            // Ry = -Py + s(Px - Rx)
+            unsigned int k[N];
+            subModP<N>(x[j], newX, k);
+            multiplyModP<N>(k, s, k);
+            unsigned int newY[N];
+            subModP<N>(k, y[j], newY);
+
+            if(useNegation && !negationStep<N>(negation, firstPoint + j, rIdx[j], newX, newY, &queue)) {
+                continue;
+            }
+
+            if(((newX[ 0 ] & _MASK[ 0 ]) == 0) && ((newX[ 1 ] & _MASK[ 1 ]) == 0)) {
+                if(queueDistinguishedPoint<N>(queue, firstPoint + j, step, newX, newY) && useNegation) {
+                    resetNegationState<N>(negation, firstPoint + j, newX);
+                }
+            }
+
+            copy<N>(newX, x[j]);
+            copy<N>(newY, y[j]);
+        }
+    }
+}
+
+template<int N> __global__ void doStepKernel( unsigned int *xAra,
+                              unsigned int *yAra,
+                              unsigned int *diffBuf,
+                              unsigned int *chainBuf,
+                              unsigned int *negation,
+                              unsigned int *blockFlags,
+                              unsigned int *pointFlags,
+                              unsigned int firstPoint,
+                              unsigned int count)
+{
+    // Initialize shared memory constants
+    initFp();
+    initSharedMem(_PWORDS);
+    doStep<N>(xAra, yAra, diffBuf, chainBuf, negation, blockFlags, pointFlags, firstPoint, count);
+}
+
+/**
+ * Runs many steps per launch. Distinguished points are written to the queue
+ * and the walks are restarted on the device
+ */
+template<int N> __global__ void doStepPersistentKernel( unsigned int *xAra,
+                              unsigned int *yAra,
+                              unsigned int *diffBuf,
+                              unsigned int *chainBuf,
+                              unsigned int *negation,
+                              unsigned int firstPoint,
+                              unsigned int count,
+                              unsigned int steps,
+                              DPQueue queue)
+{
+    // Initialize shared memory constants
+    initFp();
+    initSharedMem(_PWORDS);
+
+    for(unsigned int i = 0; i < steps; i++) {
+        doStep<N>(xAra, yAra, diffBuf, chainBuf, negation, NULL, NULL, firstPoint, count, &queue, queue.step + i + 1);
+    }
+}
+
+/**
+ * Persistent kernel for launches whose points fit in registers. The points
+ * are read once, walked for all steps and written back once
+ */
+template<int N> __global__ void doStepResidentKernel( unsigned int *xAra,
+                              unsigned int *yAra,
+                              unsigned int *negation,
+                              unsigned int firstPoint,
+                              unsigned int count,
+                              unsigned int steps,
+                              DPQueue queue)
+{
+    const int maxPoints = RESIDENT_MAX_WORDS / N;
+
+    // Initialize shared memory constants
+    initFp();
+    initSharedMem(_PWORDS);
+
+    unsigned int x[maxPoints][N];
+    unsigned int y[maxPoints][N];
+
+    #pragma unroll
+    for(int j = 0; j < maxPoints; j++) {
+        if(j < count) {
+            readBigInt<N>(xAra, firstPoint + j, x[j]);
+            readBigInt<N>(yAra, firstPoint + j, y[j]);
+        }
+    }
+
+    for(unsigned int i = 0; i < steps; i++) {
+        doStepResident<N>(x, y, count, firstPoint, negation, queue, queue.step + i + 1);
+    }
+
+    #pragma unroll
+    for(int j = 0; j < maxPoints; j++) {
+        if(j < count) {
+            writeBigInt<N>(xAra, firstPoint + j, x[j]);
+            writeBigInt<N>(yAra, firstPoint + j, y[j]);
+        }
+    }
+}
+
+/**
+ * Launches the persistent kernel on points firstPoint to firstPoint + count - 1
+ * of each thread. Returns without waiting for the kernel to finish
+ */
+cudaError_t cudaDoStepPersistentAsync(int pLen,
+                    int blocks,
+                    int threads,
+                    unsigned int firstPoint,
+                    unsigned int count,
+                    unsigned int steps,
+                    unsigned int *rx,
+                    unsigned int *ry,
+                    unsigned int *diffBuf,
+                    unsigned int *chainBuf,
+                    unsigned int *negation,
+                    DPQueue queue,
+                    cudaStream_t stream)
+{
+    // Keep the points in registers when they fit
+    bool resident = count * pLen <= RESIDENT_MAX_WORDS;
+    size_t sharedBytes = getSharedRPointBytes();
+
+    switch(pLen) {
+        case 1:
+            if(resident) {
+                doStepResidentKernel<1><<<blocks, threads, sharedBytes, stream>>>(rx, ry, negation, firstPoint, count, steps, queue);
+            } else {
+                doStepPersistentKernel<1><<<blocks, threads, sharedBytes, stream>>>(rx, ry, diffBuf, chainBuf, negation, firstPoint, count, steps, queue);
+            }
+            break;
+        case 2:
+            if(resident) {
+                doStepResidentKernel<2><<<blocks, threads, sharedBytes, stream>>>(rx, ry, negation, firstPoint, count, steps, queue);
+            } else {
+                doStepPersistentKernel<2><<<blocks, threads, sharedBytes, stream>>>(rx, ry, diffBuf, chainBuf, negation, firstPoint, count, steps, queue);
+            }
+            break;
+        case 3:
+            if(resident) {
+                doStepResidentKernel<3><<<blocks, threads, sharedBytes, stream>>>(rx, ry, negation, firstPoint, count, steps, queue);
+            } else {
+                doStepPersistentKernel<3><<<blocks, threads, sharedBytes, stream>>>(rx, ry, diffBuf, chainBuf, negation, firstPoint, count, steps, queue);
+            }
+            break;
+        case 4:
+            if(resident) {
+                doStepResidentKernel<4><<<blocks, threads, sharedBytes, stream>>>(rx, ry, negation, firstPoint, count, steps, queue);
+            } else {
+                doStepPersistentKernel<4><<<blocks, threads, sharedBytes, stream>>>(rx, ry, diffBuf, chainBuf, negation, firstPoint, count, steps, queue);
+            }
+            break;
+        case 5:
+            if(resident) {
+                doStepResidentKernel<5><<<blocks, threads, sharedBytes, stream>>>(rx, ry, negation, firstPoint, count, steps, queue);
+            } else {
+                doStepPersistentKernel<5><<<blocks, threads, sharedBytes, stream>>>(rx, ry, diffBuf, chainBuf, negation, firstPoint, count, steps, queue);
+            }
+            break;
+        case 6:
+            if(resident) {
+                doStepResidentKernel<6><<<blocks, threads, sharedBytes, stream>>>(rx, ry, negation, firstPoint, count, steps, queue);
+            } else {
+                doStepPersistentKernel<6><<<blocks, threads, sharedBytes, stream>>>(rx, ry, diffBuf, chainBuf, negation, firstPoint, count, steps, queue);
+            }
+            break;
+        case 7:
+            if(resident) {
+                doStepResidentKernel<7><<<blocks, threads, sharedBytes, stream>>>(rx, ry, negation, firstPoint, count, steps, queue);
+            } else {
+                doStepPersistentKernel<7><<<blocks, threads, sharedBytes, stream>>>(rx, ry, diffBuf, chainBuf, negation, firstPoint, count, steps, queue);
+            }
+            break;
+        case 8:
+            if(resident) {
+                doStepResidentKernel<8><<<blocks, threads, sharedBytes, stream>>>(rx, ry, negation, firstPoint, count, steps, queue);
+            } else {
+                doStepPersistentKernel<8><<<blocks, threads, sharedBytes, stream>>>(rx, ry, diffBuf, chainBuf, negation, firstPoint, count, steps, queue);
+            }
+            break;
+        default:
+            throw "Unsupported word size";
+
+    }
+
+    return cudaGetLastError();
+}
+
+cudaError_t cudaDoStepPersistent(int pLen,
+                    int blocks,
+                    int threads,
                     int pointsPerThread,
+                    unsigned int steps,
                     unsigned int *rx,
                     unsigned int *ry,
                     unsigned int *diffBuf,
                     unsigned int *chainBuf,
+                    DPQueue queue)
+{
+    cudaError_t cudaError = cudaDoStepPersistentAsync(pLen, blocks, threads, 0, pointsPerThread, steps, rx, ry, diffBuf, chainBuf, NULL, queue, 0);
+
+    if(cudaError != cudaSuccess) {
+        return cudaError;
+    }
+
+    return cudaDeviceSynchronize();
+}
+
+/**
+ * Sets the group order and the point added to a starting point to restart a walk
+ */
+cudaError_t initDeviceRestartParams(const unsigned int *n, const unsigned int *tx, const unsigned int *ty,
+                                     const unsigned int *ta, const unsigned int *tb, unsigned int len)
+{
+    cudaError_t cudaError = cudaSuccess;
+
+    cudaError = cudaMemcpyToSymbol(_ORDER, n, sizeof(unsigned int) * len, 0, cudaMemcpyHostToDevice);
+    if(cudaError != cudaSuccess) {
+        goto end;
+    }
+
+    cudaError = cudaMemcpyToSymbol(_TX, tx, sizeof(unsigned int) * len, 0, cudaMemcpyHostToDevice);
+    if(cudaError != cudaSuccess) {
+        goto end;
+    }
+
+    cudaError = cudaMemcpyToSymbol(_TY, ty, sizeof(unsigned int) * len, 0, cudaMemcpyHostToDevice);
+    if(cudaError != cudaSuccess) {
+        goto end;
+    }
+
+    cudaError = cudaMemcpyToSymbol(_TA, ta, sizeof(unsigned int) * len, 0, cudaMemcpyHostToDevice);
+    if(cudaError != cudaSuccess) {
+        goto end;
+    }
+
+    cudaError = cudaMemcpyToSymbol(_TB, tb, sizeof(unsigned int) * len, 0, cudaMemcpyHostToDevice);
+
+end:
+    return cudaError;
+}
+
+/**
+ * Sets the group order for drawing coefficients on the device
+ */
+cudaError_t initDeviceOrder(const unsigned int *n, unsigned int len)
+{
+    return cudaMemcpyToSymbol(_ORDER, n, sizeof(unsigned int) * len, 0, cudaMemcpyHostToDevice);
+}
+
+cudaError_t initDeviceConstants(unsigned int numPoints)
+{
+    cudaError_t cudaError = cudaSuccess;
+
+    cudaError = cudaMemcpyToSymbol(_NUM_POINTS, &numPoints, sizeof(unsigned int), 0, cudaMemcpyHostToDevice);
+
+    if(cudaError != cudaSuccess) {
+        goto end;
+    }
+
+end:
+    return cudaSuccess;
+}
+
+/**
+ * Launches one step on points firstPoint to firstPoint + count - 1 of each
+ * thread. Returns without waiting for the kernel to finish
+ */
+cudaError_t cudaDoStepAsync(int pLen,
+                    int blocks,
+                    int threads,
+                    unsigned int firstPoint,
+                    unsigned int count,
+                    unsigned int *rx,
+                    unsigned int *ry,
+                    unsigned int *diffBuf,
+                    unsigned int *chainBuf,
+                    unsigned int *negation,
                     unsigned int *blockFlags,
-                    unsigned int *pointFlags)
+                    unsigned int *pointFlags,
+                    cudaStream_t stream)
 {
+    size_t sharedBytes = getSharedRPointBytes();
+
     switch(pLen) {
         case 1:
-            doStepKernel<1><<<blocks, threads>>>(rx, ry, diffBuf, chainBuf, blockFlags, pointFlags, pointsPerThread);
+            doStepKernel<1><<<blocks, threads, sharedBytes, stream>>>(rx, ry, diffBuf, chainBuf, negation, blockFlags, pointFlags, firstPoint, count);
             break;
         case 2:
-            doStepKernel<2><<<blocks, threads>>>(rx, ry, diffBuf, chainBuf, blockFlags, pointFlags, pointsPerThread);
+            doStepKernel<2><<<blocks, threads, sharedBytes, stream>>>(rx, ry, diffBuf, chainBuf, negation, blockFlags, pointFlags, firstPoint, count);
             break;
         case 3:
-            doStepKernel<3><<<blocks, threads>>>(rx, ry, diffBuf, chainBuf, blockFlags, pointFlags, pointsPerThread);
+            doStepKernel<3><<<blocks, threads, sharedBytes, stream>>>(rx, ry, diffBuf, chainBuf, negation, blockFlags, pointFlags, firstPoint, count);
             break;
         case 4:
-            doStepKernel<4><<<blocks, threads>>>(rx, ry, diffBuf, chainBuf, blockFlags, pointFlags, pointsPerThread);
+            doStepKernel<4><<<blocks, threads, sharedBytes, stream>>>(rx, ry, diffBuf, chainBuf, negation, blockFlags, pointFlags, firstPoint, count);
             break;
         case 5:
-            doStepKernel<5><<<blocks, threads>>>(rx, ry, diffBuf, chainBuf, blockFlags, pointFlags, pointsPerThread);
+            doStepKernel<5><<<blocks, threads, sharedBytes, stream>>>(rx, ry, diffBuf, chainBuf, negation, blockFlags, pointFlags, firstPoint, count);
             break;
         case 6:
-            doStepKernel<6><<<blocks, threads>>>(rx, ry, diffBuf, chainBuf, blockFlags, pointFlags, pointsPerThread);
+            doStepKernel<6><<<blocks, threads, sharedBytes, stream>>>(rx, ry, diffBuf, chainBuf, negation, blockFlags, pointFlags, firstPoint, count);
             break;
         case 7:
-            doStepKernel<7><<<blocks, threads>>>(rx, ry, diffBuf, chainBuf, blockFlags, pointFlags, pointsPerThread);
+            doStepKernel<7><<<blocks, threads, sharedBytes, stream>>>(rx, ry, diffBuf, chainBuf, negation, blockFlags, pointFlags, firstPoint, count);
             break;
         case 8:
-            doStepKernel<8><<<blocks, threads>>>(rx, ry, diffBuf, chainBuf, blockFlags, pointFlags, pointsPerThread);
+            doStepKernel<8><<<blocks, threads, sharedBytes, stream>>>(rx, ry, diffBuf, chainBuf, negation, blockFlags, pointFlags, firstPoint, count);
             break;
         default:
             throw "Unsupported word size";
 
     }
 
+    return cudaGetLastError();
+}
+
+cudaError_t cudaDoStep(int pLen,
+                    int blocks,
+                    int threads,
+                    int pointsPerThread,
+                    unsigned int *rx,
+                    unsigned int *ry,
+                    unsigned int *diffBuf,
+                    unsigned int *chainBuf,
+                    unsigned int *blockFlags,
+                    unsigned int *pointFlags)
+{
+    cudaError_t cudaError = cudaDoStepAsync(pLen, blocks, threads, 0, pointsPerThread, rx, ry, diffBuf, chainBuf, NULL, blockFlags, pointFlags, 0);
+
+    if(cudaError != cudaSuccess) {
+        return cudaError;
+    }
+
+    return cudaDeviceSynchronize();
+}
+
+template<int N> static cudaError_t getStepKernelInfo(bool persistent, int threads, size_t sharedBytes, cudaFuncAttributes *attributes, int *blocksPerMP)
+{
+    cudaError_t cudaError = cudaSuccess;
+
+    if(persistent) {
+        cudaError = cudaFuncGetAttributes(attributes, (const void *)doStepPersistentKernel<N>);
+        if(cudaError == cudaSuccess) {
+            cudaError = cudaOccupancyMaxActiveBlocksPerMultiprocessor(blocksPerMP, doStepPersistentKernel<N>, threads, sharedBytes);
+        }
+    } else {
+        cudaError = cudaFuncGetAttributes(attributes, (const void *)doStepKernel<N>);
+        if(cudaError == cudaSuccess) {
+            cudaError = cudaOccupancyMaxActiveBlocksPerMultiprocessor(blocksPerMP, doStepKernel<N>, threads, sharedBytes);
+        }
+    }
+
+    return cudaError;
+}
+
+/**
+ * Gets the attributes of the step kernel for integers of pLen words on the
+ * current device, and how many blocks of the given size fit on one
+ * multiprocessor at once
+ */
+cudaError_t getDoStepKernelInfo(int pLen, bool persistent, int threads, size_t sharedBytes, cudaFuncAttributes *attributes, int *blocksPerMP)
+{
+    switch(pLen) {
+        case 1:
+            return getStepKernelInfo<1>(persistent, threads, sharedBytes, attributes, blocksPerMP);
+        case 2:
+            return getStepKernelInfo<2>(persistent, threads, sharedBytes, attributes, blocksPerMP);
+        case 3:
+            return getStepKernelInfo<3>(persistent, threads, sharedBytes, attributes, blocksPerMP);
+        case 4:
+            return getStepKernelInfo<4>(persistent, threads, sharedBytes, attributes, blocksPerMP);
+        case 5:
+            return getStepKernelInfo<5>(persistent, threads, sharedBytes, attributes, blocksPerMP);
+        case 6:
+            return getStepKernelInfo<6>(persistent, threads, sharedBytes, attributes, blocksPerMP);
+        case 7:
+            return getStepKernelInfo<7>(persistent, threads, sharedBytes, attributes, blocksPerMP);
+        case 8:
+            return getStepKernelInfo<8>(persistent, threads, sharedBytes, attributes, blocksPerMP);
+        default:
+            throw "Unsupported word size";
+    }
+}
+
+/**
+ * Moves every starting point to the one of P and -P with an even y, negating
+ * its coefficients to match, and sets up the negation map state. negation is
+ * NULL for points that are not walked yet
+ */
+template<int N> __global__ void initNegationKernel(unsigned int *xAra,
+                              unsigned int *yAra,
+                              unsigned int *aAra,
+                              unsigned int *bAra,
+                              unsigned int *negation,
+                              unsigned int pointsPerThread)
+{
+    initFp();
+
+    for(unsigned int i = 0; i < pointsPerThread; i++) {
+        unsigned int x[N];
+        unsigned int y[N];
+        readBigInt<N>(xAra, i, x);
+        readBigInt<N>(yAra, i, y);
+
+        if(negateOddY<N>(y)) {
+            unsigned int a[N];
+            unsigned int b[N];
+            readBigInt<N>(aAra, i, a);
+            readBigInt<N>(bAra, i, b);
+            negModN<N>(a, a);
+            negModN<N>(b, b);
+
+            writeBigInt<N>(yAra, i, y);
+            writeBigInt<N>(aAra, i, a);
+            writeBigInt<N>(bAra, i, b);
+        }
+
+        if(negation != NULL) {
+            resetNegationState<N>(negation, i, x);
+        }
+    }
+}
+
+cudaError_t cudaInitNegation(int pLen,
+                    unsigned int blocks,
+                    unsigned int threads,
+                    unsigned int pointsPerThread,
+                    unsigned int *x,
+                    unsigned int *y,
+                    unsigned int *a,
+                    unsigned int *b,
+                    unsigned int *negation)
+{
+    switch(pLen) {
+        case 1:
+            initNegationKernel<1><<<blocks, threads>>>(x, y, a, b, negation, pointsPerThread);
+            break;
+        case 2:
+            initNegationKernel<2><<<blocks, threads>>>(x, y, a, b, negation, pointsPerThread);
+            break;
+        case 3:
+            initNegationKernel<3><<<blocks, threads>>>(x, y, a, b, negation, pointsPerThread);
+            break;
+        case 4:
+            initNegationKernel<4><<<blocks, threads>>>(x, y, a, b, negation, pointsPerThread);
+            break;
+        case 5:
+            initNegationKernel<5><<<blocks, threads>>>(x, y, a, b, negation, pointsPerThread);
+            break;
+        case 6:
+            initNegationKernel<6><<<blocks, threads>>>(x, y, a, b, negation, pointsPerThread);
+            break;
+        case 7:
+            initNegationKernel<7><<<blocks, threads>>>(x, y, a, b, negation, pointsPerThread);
+            break;
+        case 8:
+            initNegationKernel<8><<<blocks, threads>>>(x, y, a, b, negation, pointsPerThread);
+            break;
+        default:
+            throw "Unsupported word size";
+    }
+
     return cudaDeviceSynchronize();
 }
+
+/**
+ * Turns on the negation map. Sets the curve parameter a and the group order
+ */
+cudaError_t initDeviceNegationParams(const unsigned int *a, const unsigned int *n, unsigned int len)
+{
+    cudaError_t cudaError = cudaSuccess;
+    unsigned int negation = 1;
+
+    cudaError = cudaMemcpyToSymbol(_CURVE_A, a, sizeof(unsigned int) * len, 0, cudaMemcpyHostToDevice);
+    if(cudaError != cudaSuccess) {
+        goto end;
+    }
+
+    cudaError = cudaMemcpyToSymbol(_ORDER, n, sizeof(unsigned int) * len, 0, cudaMemcpyHostToDevice);
+    if(cudaError != cudaSuccess) {
+        goto end;
+    }
+
+    cudaError = cudaMemcpyToSymbol(_NEGATION, &negation, sizeof(unsigned int), 0, cudaMemcpyHostToDevice);
+
+end:
+    return cudaError;
+}
+
+/**
+ * Turns off the negation map, which a context on the same device may have
+ * turned on
+ */
+cudaError_t disableDeviceNegation()
+{
+    unsigned int negation = 0;
+
+    return cudaMemcpyToSymbol(_NEGATION, &negation, sizeof(unsigned int), 0, cudaMemcpyHostToDevice);
+}
+
+/**
+ * Applies a field operation iterations times, each time to the result of the
+ * one before, so the operations of a thread cannot overlap. Every thread
+ * starts from the same x and y and writes its result so that the work is
+ * not optimized away
+ */
+template<int N> __global__ void fpBenchmarkKernel(int op, unsigned int iterations, const unsigned int *xIn, const unsigned int *yIn, unsigned int *out)
+{
+    initFp();
+
+    unsigned int x[N];
+    unsigned int y[N];
+
+    for(int i = 0; i < N; i++) {
+        x[i] = xIn[i];
+        y[i] = yIn[i];
+    }
+
+    switch(op) {
+        case FP_BENCHMARK_SUB:
+            for(unsigned int i = 0; i < iterations; i++) {
+                subModP<N>(x, y, x);
+            }
+            break;
+        case FP_BENCHMARK_MULTIPLY:
+            for(unsigned int i = 0; i < iterations; i++) {
+                multiplyModP<N>(x, y, x);
+            }
+            break;
+        case FP_BENCHMARK_SQUARE:
+            for(unsigned int i = 0; i < iterations; i++) {
+                squareModP<N>(x, x);
+            }
+            break;
+        case FP_BENCHMARK_INVERSE:
+            for(unsigned int i = 0; i < iterations; i++) {
+                inverseModP<N>(x, x);
+            }
+            break;
+    }
+
+    int tid = blockIdx.x * blockDim.x + threadIdx.x;
+
+    for(int i = 0; i < N; i++) {
+        out[tid * N + i] = x[i];
+    }
+}
+
+template<int N> static cudaError_t benchmarkFp(int op, unsigned int blocks, unsigned int threads, unsigned int iterations,
+                    const unsigned int *x, const unsigned int *y, float *ms)
+{
+    cudaError_t cudaError = cudaSuccess;
+    unsigned int *devX = NULL;
+    unsigned int *devY = NULL;
+    unsigned int *devOut = NULL;
+    cudaEvent_t start = NULL;
+    cudaEvent_t stop = NULL;
+
+    cudaError = cudaMalloc(&devX, sizeof(unsigned int) * N);
+    if(cudaError != cudaSuccess) {
+        goto end;
+    }
+
+    cudaError = cudaMalloc(&devY, sizeof(unsigned int) * N);
+    if(cudaError != cudaSuccess) {
+        goto end;
+    }
+
+    cudaError = cudaMalloc(&devOut, sizeof(unsigned int) * N * blocks * threads);
+    if(cudaError != cudaSuccess) {
+        goto end;
+    }
+
+    cudaError = cudaMemcpy(devX, x, sizeof(unsigned int) * N, cudaMemcpyHostToDevice);
+    if(cudaError != cudaSuccess) {
+        goto end;
+    }
+
+    cudaError = cudaMemcpy(devY, y, sizeof(unsigned int) * N, cudaMemcpyHostToDevice);
+    if(cudaError != cudaSuccess) {
+        goto end;
+    }
+
+    cudaError = cudaEventCreate(&start);
+    if(cudaError != cudaSuccess) {
+        goto end;
+    }
+
+    cudaError = cudaEventCreate(&stop);
+    if(cudaError != cudaSuccess) {
+        goto end;
+    }
+
+    cudaEventRecord(start);
+    fpBenchmarkKernel<N><<<blocks, threads>>>(op, iterations, devX, devY, devOut);
+    cudaEventRecord(stop);
+
+    cudaError = cudaEventSynchronize(stop);
+    if(cudaError != cudaSuccess) {
+        goto end;
+    }
+
+    cudaError = cudaGetLastError();
+    if(cudaError != cudaSuccess) {
+        goto end;
+    }
+
+    cudaError = cudaEventElapsedTime(ms, start, stop);
+
+end:
+    if(start != NULL) {
+        cudaEventDestroy(start);
+    }
+    if(stop != NULL) {
+        cudaEventDestroy(stop);
+    }
+    cudaFree(devX);
+    cudaFree(devY);
+    cudaFree(devOut);
+
+    return cudaError;
+}
+
+/**
+ * Times iterations of a field operation on integers of pLen words in every
+ * thread of the grid. initDeviceParams must have been called with a modulus
+ * of that length on the current device
+ */
+cudaError_t cudaBenchmarkFp(int pLen, int op, unsigned int blocks, unsigned int threads, unsigned int iterations,
+                    const unsigned int *x, const unsigned int *y, float *ms)
+{
+    switch(pLen) {
+        case 1:
+            return benchmarkFp<1>(op, blocks, threads, iterations, x, y, ms);
+        case 2:
+            return benchmarkFp<2>(op, blocks, threads, iterations, x, y, ms);
+        case 3:
+            return benchmarkFp<3>(op, blocks, threads, iterations, x, y, ms);
+        case 4:
+            return benchmarkFp<4>(op, blocks, threads, iterations, x, y, ms);
+        case 5:
+            return benchmarkFp<5>(op, blocks, threads, iterations, x, y, ms);
+        case 6:
+            return benchmarkFp<6>(op, blocks, threads, iterations, x, y, ms);
+        case 7:
+            return benchmarkFp<7>(op, blocks, threads, iterations, x, y, ms);
+        case 8:
+            return benchmarkFp<8>(op, blocks, threads, iterations, x, y, ms);
+        default:
+            throw "Unsupported word size";
+    }
+}
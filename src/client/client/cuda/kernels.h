@@ -1,10 +1,91 @@
 #ifndef _ECDL_CUDA_KERNELS_H
 #define _ECDL_CUDA_KERNELS_H
 
-#include <cuda_runtime.h>
+#include "gpu.h"
 
-#define NUM_R_POINTS 32 // Must be a power of 2
-#define FIXED_R_MASK (NUM_R_POINTS-1)
+// Every block keeps the R points in shared memory when they take up at most
+// 1/SHARED_R_POINT_BLOCKS of the shared memory of a multiprocessor, so that
+// several blocks still fit. Larger tables are read from global memory through
+// the read-only data cache
+#define SHARED_R_POINT_BLOCKS 4
+
+// Most devices the kernels run on in one process
+#define MAX_DEVICES 64
+
+// Largest integer in words supported by the kernels
+#define MAX_WORDS 10
+
+// Words of negation map state per point: the fingerprints of the last four
+// points and the offset of the R point to try next
+#define NEGATION_STATE_WORDS 3
+
+// Longest fruitless cycle that is walked when escaping from it. The server
+// uses the same value
+#define NEGATION_CYCLE_MAX 16
+
+// Words of x and y per thread the persistent kernel keeps in registers. A
+// launch whose points fit stays in registers for all of its steps
+#define RESIDENT_MAX_WORDS 32
+
+// The integers of each thread are stored in groups of 4 words that are read
+// and written with 128-bit loads and stores, and the last group of an integer
+// is padded with zeros. Group g of integer i of every thread is stored
+// together, in thread order. Defining INTERLEAVED_LAYOUT for both the host
+// and device compilers stores the words of each integer next to each other
+// instead
+#ifdef INTERLEAVED_LAYOUT
+#define LAYOUT_GROUP_WORDS MAX_WORDS
+#define LAYOUT_WORDS(n) (n)
+#else
+#define LAYOUT_GROUP_WORDS 4
+#define LAYOUT_WORDS(n) (LAYOUT_GROUP_WORDS * LAYOUT_GROUPS(n))
+#endif
+
+// Number of word groups in an integer of n words
+#define LAYOUT_GROUPS(n) (((n) + LAYOUT_GROUP_WORDS - 1) / LAYOUT_GROUP_WORDS)
+
+/**
+ * Distinguished point written to the queue by the persistent kernel. a and b
+ * are the coefficients of the starting point of the walk
+ */
+typedef struct {
+    unsigned int x[MAX_WORDS];
+    unsigned int y[MAX_WORDS];
+    unsigned int a[MAX_WORDS];
+    unsigned int b[MAX_WORDS];
+    unsigned long long length;
+}DPRecord;
+
+/**
+ * State used by the persistent kernel. Distinguished points are appended to a
+ * ring buffer of records. The device advances tail and the host advances head
+ * after reading the records. A walk that reaches a distinguished point is
+ * restarted on the device at its starting point plus T, where T = aG + bQ
+ * for the a and b set by initDeviceRestartParams
+ */
+typedef struct {
+    DPRecord *records;
+    unsigned int *tail;
+    unsigned int head;
+
+    // Number of records in the buffer. Must be a power of 2
+    unsigned int capacity;
+
+    // Number of points that were dropped because the buffer was full
+    unsigned int *dropped;
+
+    // Starting points and their coefficients
+    unsigned int *startX;
+    unsigned int *startY;
+    unsigned int *a;
+    unsigned int *b;
+
+    // Step count when each walk started
+    unsigned long long *walkStart;
+
+    // Step count at the start of the launch
+    unsigned long long step;
+}DPQueue;
 
 cudaError_t copyMultiplesToDevice( const unsigned int *px,
                                    const unsigned int *py,
@@ -15,7 +96,10 @@ cudaError_t copyMultiplesToDevice( const unsigned int *px,
                                    unsigned int len,
                                    unsigned int count );
 
-cudaError_t copyRPointsToDevice(const unsigned int *rx, const unsigned int *ry, int length, int count);
+size_t getSharedRPointLimit(int device);
+
+cudaError_t copyRPointsToDevice(const unsigned int *rx, const unsigned int *ry, int length, int count,
+                                unsigned int *devRx, unsigned int *devRy);
 
 cudaError_t multiplyAddG( unsigned int blocks,
                           unsigned int threads,
@@ -40,6 +124,47 @@ cudaError_t resetPoints( unsigned int blocks,
                          unsigned int *rx,
                          unsigned int *ry);
 
+cudaError_t cudaGenerateExponents( int pLen,
+                         unsigned int blocks,
+                         unsigned int threads,
+                         unsigned int pointsPerThread,
+                         unsigned int *a,
+                         unsigned int *b,
+                         unsigned long long seed);
+
+cudaError_t cudaGenerateIntervalExponents( int pLen,
+                         unsigned int blocks,
+                         unsigned int threads,
+                         unsigned int pointsPerThread,
+                         unsigned int *a,
+                         unsigned int *b,
+                         unsigned long long seed,
+                         const unsigned int *n,
+                         const unsigned int *width,
+                         const unsigned int *tameBase,
+                         const unsigned int *wildBase);
+
+/**
+ * Restarts walk slots[j] at spare point firstSpare + j for j < count. Slot s
+ * is point s / numThreads of thread s % numThreads. The spare points are laid
+ * out like the walks. negation is NULL to walk without the negation map
+ */
+cudaError_t cudaRefillWalksAsync( int pLen,
+                         const unsigned int *slots,
+                         unsigned int count,
+                         unsigned int *x,
+                         unsigned int *y,
+                         unsigned int *a,
+                         unsigned int *b,
+                         unsigned int *negation,
+                         const unsigned int *spareX,
+                         const unsigned int *spareY,
+                         const unsigned int *spareA,
+                         const unsigned int *spareB,
+                         unsigned int firstSpare,
+                         unsigned int numThreads,
+                         cudaStream_t stream);
+
 cudaError_t cudaDoStep( int pLen,
                     int blocks,
                     int threads,
@@ -51,8 +176,87 @@ cudaError_t cudaDoStep( int pLen,
                     unsigned int *blockFlags,
                     unsigned int *pointFlags);
 
+cudaError_t cudaDoStepPersistent( int pLen,
+                    int blocks,
+                    int threads,
+                    int pointsPerThread,
+                    unsigned int steps,
+                    unsigned int *rx,
+                    unsigned int *ry,
+                    unsigned int *diffBuf,
+                    unsigned int *chainBuf,
+                    DPQueue queue);
+
+/**
+ * Asynchronous versions of cudaDoStep and cudaDoStepPersistent. Only points
+ * firstPoint to firstPoint + count - 1 of each thread are advanced so the
+ * points can be split between streams. negation is the negation map state of
+ * the points, or NULL to walk without it
+ */
+cudaError_t cudaDoStepAsync( int pLen,
+                    int blocks,
+                    int threads,
+                    unsigned int firstPoint,
+                    unsigned int count,
+                    unsigned int *rx,
+                    unsigned int *ry,
+                    unsigned int *diffBuf,
+                    unsigned int *chainBuf,
+                    unsigned int *negation,
+                    unsigned int *blockFlags,
+                    unsigned int *pointFlags,
+                    cudaStream_t stream);
+
+cudaError_t cudaDoStepPersistentAsync( int pLen,
+                    int blocks,
+                    int threads,
+                    unsigned int firstPoint,
+                    unsigned int count,
+                    unsigned int steps,
+                    unsigned int *rx,
+                    unsigned int *ry,
+                    unsigned int *diffBuf,
+                    unsigned int *chainBuf,
+                    unsigned int *negation,
+                    DPQueue queue,
+                    cudaStream_t stream);
+
+cudaError_t getDoStepKernelInfo(int pLen, bool persistent, int threads, size_t sharedBytes, cudaFuncAttributes *attributes, int *blocksPerMP);
+
+/**
+ * Field operations that cudaBenchmarkFp can time
+ */
+enum {
+    FP_BENCHMARK_SUB,
+    FP_BENCHMARK_MULTIPLY,
+    FP_BENCHMARK_SQUARE,
+    FP_BENCHMARK_INVERSE
+};
+
+cudaError_t cudaBenchmarkFp(int pLen, int op, unsigned int blocks, unsigned int threads, unsigned int iterations,
+                    const unsigned int *x, const unsigned int *y, float *ms);
+
+cudaError_t initDeviceRestartParams(const unsigned int *n, const unsigned int *tx, const unsigned int *ty,
+                    const unsigned int *ta, const unsigned int *tb, unsigned int len);
+
 cudaError_t initDeviceParams(const unsigned int *p, unsigned int pBits, const unsigned int *m, unsigned int mBits, unsigned int dBits);
+cudaError_t setNumDistinguishedBits(unsigned int dBits);
+
+cudaError_t initDeviceOrder(const unsigned int *n, unsigned int len);
 
 cudaError_t initDeviceConstants(unsigned int numPoints);
 
+cudaError_t initDeviceNegationParams(const unsigned int *a, const unsigned int *n, unsigned int len);
+cudaError_t disableDeviceNegation();
+
+cudaError_t cudaInitNegation(int pLen,
+                    unsigned int blocks,
+                    unsigned int threads,
+                    unsigned int pointsPerThread,
+                    unsigned int *x,
+                    unsigned int *y,
+                    unsigned int *a,
+                    unsigned int *b,
+                    unsigned int *negation);
+
 #endif
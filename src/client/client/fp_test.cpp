@@ -1,59 +1,333 @@
+#include <stdio.h>
+#include <stdlib.h>
+
 #include "Fp.h"
+#include "FpIFMA.h"
+
+// Longest modulus getFp() handles
+#define TEST_MAX_WORDS 8
+
+/**
+ * Primes of 1 to 8 words. For each length there is one that fills its top
+ * word, where the reductions need an extra word, and one that does not. The
+ * last one is the 73-bit prime the test started with
+ */
+static const char *_primes[] = {
+    "d1c9bc701e7ea451",
+    "1e7165f80a4df71",
+    "f3f49249dc28ff90a5aec7978306d071",
+    "1ca242939292d22e255accb1a4668fb",
+    "d293de8fc88b28756bad6be28e7aa6e99f19950499dd25cf",
+    "1fb57d2c4a334bfc6cd75e9bb049a79d7a7a3cc8c3d6041",
+    "d4aa4e719d3c7dec00a61f933d6c51e370eb9a0a96263ae6c5e818fac0433d13",
+    "1c82c64d094499602f0ee99731c94521919e93ad11745ad498893101c593bf9",
+    "ffb88309fadb890859001ac9406329bc65b00a2d35d148805071950eadec6f117d836e77af67d543",
+    "1723bbb1389b372a341738c837a7935bef7e268ffe976ab60581ccace1d62e05b4c8012ede7bd59",
+    "f766ff10b437bdb5a51149bbe060a72424114258751b4c8349a047dc4ac87fc089be9c1c8eb5140f16f4488157241b1b",
+    "1c82d0d66160227173714726c1672297608d9425d111a9d5e6c9992b5fb12e0d9090b89065550964f1a8a1d93d2051d",
+    "e5ed0de47db4304de01c683e99a46df0dde3a361c0099ebacd73de0081a0ba056ce9da661dcf884cde0279e17f9ac0988df05f2595f19a55",
+    "126aa10067f0cfcce1fd3d9849acfb58350a73f7aac319ffb759e0fed1d9d1690624fe36b82e6c9d82fb0f1423674a6864fa3f3eab06fdb",
+    "e475263c785490146dedc86a9f4fb02bb7a1774f1a42721eaba4c70ee306f0c485f184e0b464c554f675299b0c83e786d1711cbd2106119ec40d31b5397a78bb",
+    "1f52e00fcbad167f5a9ca5fedf165dab6eafff5782afe6bac9f21df74f09af5b3618e1ca06d7a691f3c42b2e2cbbb93d98145593a9afa39e261e34a7b6bc525",
+    "1c5b132f0d283880009"
+};
 
-void printInt(const unsigned long *x, int len)
+/**
+ * Primes 2^k - c with a short c, which getFp() reduces with FpPseudoMersenne
+ */
+static const char *_specialPrimes[] = {
+    // 2^61 - 1
+    "1fffffffffffffff",
+    // 2^64 - 59
+    "ffffffffffffffc5",
+    // 2^127 - 1
+    "7fffffffffffffffffffffffffffffff",
+    // 2^128 - 159
+    "ffffffffffffffffffffffffffffff61",
+    // 2^185 - 303
+    "1fffffffffffffffffffffffffffffffffffffffffffed1",
+    // P-192
+    "fffffffffffffffffffffffffffffffeffffffffffffffff",
+    // P-224
+    "ffffffffffffffffffffffffffffffff000000000000000000000001",
+    // 2^255 - 19
+    "7fffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffed",
+    // secp256k1
+    "fffffffffffffffffffffffffffffffffffffffffffffffffffffffefffffc2f",
+    // 2^313 - 139
+    "1ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff75",
+    // 2^320 - 197
+    "ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff3b",
+    // 2^377 - 259
+    "1fffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffefd",
+    // P-384
+    "fffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffeffffffff0000000000000000ffffffff",
+    // 2^441 - 361
+    "1fffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffe97",
+    // 2^448 - 203
+    "ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff35",
+    // 2^505 - 91
+    "1ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffa5",
+    // 2^512 - 569
+    "fffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffdc7"
+};
+
+static const char *typeName(int type)
 {
-    for(int i = len - 1; i >= 0; i--) {
-#ifdef _X86
-        printf("%.8x", x[i]);
-#else
-        printf("%.16lx", x[i]);
-#endif
+    switch(type) {
+        case FP_BARRETT:
+            return "Barrett";
+        case FP_MONTGOMERY:
+            return "Montgomery";
+        case FP_PSEUDO_MERSENNE:
+            return "pseudo-Mersenne";
     }
-    printf("\n");
+
+    return "";
 }
 
-int main(int argc, char **argv)
+static void printError(const char *op, const char *name, const BigInteger &p, const BigInteger &a, const BigInteger &b)
+{
+    printf("%s %s mod %s is wrong for\n", name, op, p.toString(16).c_str());
+    printf("%s\n", a.toString(16).c_str());
+    printf("%s\n", b.toString(16).c_str());
+}
+
+/**
+ * Compares multiplication, squaring, subtraction and inversion of the field
+ * with GMP for random residues. Returns false on the first mismatch
+ */
+static bool testField(FpBase *fp, const char *name, const BigInteger &p, int iterations)
 {
-    for(int i = 0; i < 100000000; i++) {
-        //BigInteger a("1c0d76b18c305fbd771", 16);
-        //BigInteger b("1c0d76b18c305fbd771", 16);
-        BigInteger p("8369143598070916186121", 10);
-        BigInteger a = randomBigInteger(2, p);
-        //BigInteger b = randomBigInteger(2, p);
-        BigInteger b = a;
+    int n = p.getWordLength();
 
-        /*
-        printf("%s\n", a.toString().c_str());
-        printf("%s\n", b.toString().c_str());
-        printf("%s\n", p.toString().c_str());
-        */
+    // The largest residue gives the product most likely to be reduced
+    // wrongly. The inverter takes the fewest steps for the small ones
+    BigInteger first[] = {p - 1, BigInteger(1), BigInteger(2)};
+    int numFirst = sizeof(first) / sizeof(first[0]);
 
-        unsigned long x[2] = {0};
-        unsigned long y[2] = {0};
-        unsigned long z[2] = {0};
+    for(int i = 0; i < iterations; i++) {
+        BigInteger a = i < numFirst ? first[i] : randomBigInteger(1, p);
+        BigInteger b = i < numFirst ? p - 1 : randomBigInteger(1, p);
 
+        unsigned long x[TEST_MAX_WORDS] = {0};
+        unsigned long y[TEST_MAX_WORDS] = {0};
+        unsigned long z[TEST_MAX_WORDS] = {0};
+        unsigned long w[TEST_MAX_WORDS] = {0};
 
-        a.getWords(x, 2);
-        b.getWords(y, 2);
+        a.getWords(x, n);
+        b.getWords(y, n);
+        fp->encode(x, x);
+        fp->encode(y, y);
 
-        Fp<2> fp(p);
+        fp->multiplyModP(x, y, z);
+        fp->decode(z, w);
+        if(BigInteger(w, n) != (a * b) % p) {
+            printError("multiplication", name, p, a, b);
+            return false;
+        }
 
-        //fp.multiplyModP(x, y, z);
-        fp.squareModP(x, z);
+        fp->squareModP(x, z);
+        fp->decode(z, w);
+        if(BigInteger(w, n) != (a * a) % p) {
+            printError("squaring", name, p, a, b);
+            return false;
+        }
 
-        BigInteger zBig(z, 2);
-        BigInteger product = (a * b) % p;
+        fp->subModP(x, y, z);
+        fp->decode(z, w);
+        if(BigInteger(w, n) != (a - b) % p) {
+            printError("subtraction", name, p, a, b);
+            return false;
+        }
 
-        if(zBig != product) {
-            printf("%s\n", a.toString().c_str());
-            printf("%s\n", b.toString().c_str());
-            printf("%s\n", p.toString().c_str());
-            printf("%s\n", zBig.toString().c_str());
-            printf("%s\n", product.toString().c_str());
-            printf("Error!\n");
-            break;
+        fp->inverseModP(x, z);
+        fp->decode(z, w);
+        if(BigInteger(w, n) != a.invm(p)) {
+            printError("inverse", name, p, a, b);
+            return false;
         }
+    }
+
+    return true;
+}
+
+#ifdef FP_IFMA_SUPPORTED
+/**
+ * Gets the n-word value in a lane of [limb][lane] storage
+ */
+template<int L> static BigInteger getLane(const unsigned long long *limbs, int lane, int n)
+{
+    unsigned long long laneLimbs[L];
+    unsigned long words[TEST_MAX_WORDS];
 
+    for(int j = 0; j < L; j++) {
+        laneLimbs[j] = limbs[j * IFMA_LANES + lane];
     }
-    return 0;
-}
\ No newline at end of file
+    fromLimbs<L>(laneLimbs, words, n);
+
+    return BigInteger(words, n);
+}
+
+/**
+ * Compares multiplication, squaring and subtraction of the IFMA field with
+ * GMP for 8 random residues at a time. Returns false on the first mismatch
+ */
+template<int N> IFMA_TARGET static bool testIFMA(const BigInteger &p, int iterations)
+{
+    const int L = IFMA_LIMBS(N);
+    FpIFMA<L> fp(p);
+
+    for(int i = 0; i < iterations; i += IFMA_LANES) {
+        unsigned long long aLimbs[L * IFMA_LANES];
+        unsigned long long bLimbs[L * IFMA_LANES];
+
+        // The largest product is the one most likely to be reduced wrongly
+        for(int k = 0; k < IFMA_LANES; k++) {
+            unsigned long words[N] = {0};
+            unsigned long long laneLimbs[L];
+
+            (i == 0 && k == 0 ? p - 1 : randomBigInteger(1, p)).getWords(words, N);
+            toLimbs<L>(words, N, laneLimbs);
+            for(int j = 0; j < L; j++) {
+                aLimbs[j * IFMA_LANES + k] = laneLimbs[j];
+            }
+
+            (i == 0 && k == 0 ? p - 1 : randomBigInteger(1, p)).getWords(words, N);
+            toLimbs<L>(words, N, laneLimbs);
+            for(int j = 0; j < L; j++) {
+                bLimbs[j * IFMA_LANES + k] = laneLimbs[j];
+            }
+        }
+
+        __m512i a[L];
+        __m512i b[L];
+        for(int j = 0; j < L; j++) {
+            a[j] = _mm512_loadu_si512(&aLimbs[j * IFMA_LANES]);
+            b[j] = _mm512_loadu_si512(&bLimbs[j * IFMA_LANES]);
+        }
+
+        // Multiply and square in Montgomery form, subtract the plain values
+        __m512i aR[L];
+        __m512i bR[L];
+        __m512i c[L];
+        unsigned long long product[L * IFMA_LANES];
+        unsigned long long square[L * IFMA_LANES];
+        unsigned long long diff[L * IFMA_LANES];
+
+        fp.encode(a, aR);
+        fp.encode(b, bR);
+
+        fp.multiplyModP(aR, bR, c);
+        fp.decode(c, c);
+        for(int j = 0; j < L; j++) {
+            _mm512_storeu_si512(&product[j * IFMA_LANES], c[j]);
+        }
+
+        fp.squareModP(aR, c);
+        fp.decode(c, c);
+        for(int j = 0; j < L; j++) {
+            _mm512_storeu_si512(&square[j * IFMA_LANES], c[j]);
+        }
+
+        fp.subModP(a, b, c);
+        for(int j = 0; j < L; j++) {
+            _mm512_storeu_si512(&diff[j * IFMA_LANES], c[j]);
+        }
+
+        for(int k = 0; k < IFMA_LANES; k++) {
+            BigInteger x = getLane<L>(aLimbs, k, N);
+            BigInteger y = getLane<L>(bLimbs, k, N);
+
+            if(getLane<L>(product, k, N) != (x * y) % p) {
+                printError("multiplication", "IFMA", p, x, y);
+                return false;
+            }
+
+            if(getLane<L>(square, k, N) != (x * x) % p) {
+                printError("squaring", "IFMA", p, x, y);
+                return false;
+            }
+
+            if(getLane<L>(diff, k, N) != (x - y) % p) {
+                printError("subtraction", "IFMA", p, x, y);
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static bool testIFMA(const BigInteger &p, int iterations)
+{
+    switch(p.getWordLength()) {
+        case 1:
+            return testIFMA<1>(p, iterations);
+        case 2:
+            return testIFMA<2>(p, iterations);
+        case 3:
+            return testIFMA<3>(p, iterations);
+        case 4:
+            return testIFMA<4>(p, iterations);
+        case 5:
+            return testIFMA<5>(p, iterations);
+        case 6:
+            return testIFMA<6>(p, iterations);
+        case 7:
+            return testIFMA<7>(p, iterations);
+        case 8:
+            return testIFMA<8>(p, iterations);
+    }
+
+    return false;
+}
+#endif
+
+int main(int argc, char **argv)
+{
+    int iterations = argc > 1 ? atoi(argv[1]) : 25000;
+    int types[] = {FP_BARRETT, FP_MONTGOMERY};
+    bool ok = true;
+
+    for(unsigned int i = 0; i < sizeof(_primes) / sizeof(_primes[0]); i++) {
+        BigInteger p(_primes[i], 16);
+
+        for(unsigned int j = 0; j < sizeof(types) / sizeof(types[0]); j++) {
+            FpBase *fp = getFp(p, types[j]);
+            ok &= testField(fp, typeName(types[j]), p, iterations);
+            delete fp;
+        }
+    }
+
+    for(unsigned int i = 0; i < sizeof(_specialPrimes) / sizeof(_specialPrimes[0]); i++) {
+        BigInteger p(_specialPrimes[i], 16);
+
+        // getFp() would quietly use Montgomery reduction instead
+        if(!isPseudoMersenne(p)) {
+            printf("%s is not pseudo-Mersenne\n", p.toString(16).c_str());
+            ok = false;
+            continue;
+        }
+
+        FpBase *fp = getFp(p, FP_PSEUDO_MERSENNE);
+        ok &= testField(fp, typeName(FP_PSEUDO_MERSENNE), p, iterations);
+        delete fp;
+    }
+
+#ifdef FP_IFMA_SUPPORTED
+    if(ifmaSupported()) {
+        for(unsigned int i = 0; i < sizeof(_primes) / sizeof(_primes[0]); i++) {
+            ok &= testIFMA(BigInteger(_primes[i], 16), iterations);
+        }
+    } else {
+        printf("AVX-512 IFMA is not supported, skipping the IFMA field\n");
+    }
+#endif
+
+    if(ok) {
+        printf("OK\n");
+    }
+
+    return ok ? 0 : 1;
+}
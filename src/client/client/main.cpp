@@ -2,33 +2,86 @@
 #include <string.h>
 #include <unistd.h>
 #include <vector>
+#include <algorithm>
 #include "client.h"
 #include "util.h"
 #include "logger.h"
 #include "threads.h"
 #include "ServerConnection.h"
+#include "PointQueue.h"
+#include "PointSpool.h"
+#include "WalkCheckpoint.h"
+#include "UploadScheduler.h"
+#include "JobScheduler.h"
+#include "Metrics.h"
 #include "config.h"
 #include "client.h"
 #include "ECDLContext.h"
 #include "ecc.h"
+#include "FixedEcc.h"
 
 #ifdef _CUDA
 #include "ECDLCuda.h"
-#else
-#include "ECDLCPU.h"
+#include "ECDLHybrid.h"
 #endif
+#include "ECDLCPU.h"
+
+// Records taken from the point queue at a time
+#define POINT_DRAIN_BATCH 256
+
+// Milliseconds over which the distinguished point rate is measured
+#define UPLOAD_RATE_WINDOW 1000
+
+// Shortest sleep of the upload thread in milliseconds
+#define UPLOAD_MIN_WAIT 100
+
+// Milliseconds between upload summaries in the log
+#define UPLOAD_REPORT_INTERVAL 600000
+
+// Seconds the server may hold a status request
+#define STATUS_WAIT 60
+
+// Seconds between status requests to a server without long polling
+#define STATUS_POLL_INTERVAL 30
+
+// Milliseconds between checks of the checkpoint interval
+#define CHECKPOINT_WAIT 1000
+
+// Milliseconds between checks of the stats interval
+#define STATS_WAIT 1000
+
+// Longest time in milliseconds between two scheduling decisions. Status
+// changes wake the scheduler before that
+#define SCHEDULE_WAIT 1000
+
+// Status of a job before the server sent one
+#define JOB_STATUS_UNKNOWN 0xffffffff
 
 
 ECDLContext *getNewContext(const ECDLPParams *params, BigInteger *rx, BigInteger *ry, int numRPoints, void (*callback)(struct CallbackParameters *))
 {
     ECDLContext *ctx = NULL;
+
+    CpuPlacement placement;
+    placement.affinity = _config.cpuAffinity;
+    placement.physicalCores = _config.cpuPhysicalCores;
+    placement.localAlloc = _config.cpuNumaAlloc;
 #ifdef _CUDA
     Logger::logInfo("Creating CUDA context...");
-    ctx = new ECDLCudaContext(_config.device, _config.blocks, _config.threads, _config.pointsPerThread, params, rx, ry, numRPoints, callback);
+    std::string tuneCache = _config.autoTune ? _config.tuneCache : "";
+    ctx = new ECDLCudaContext(_config.devices, _config.blocks, _config.threads, _config.pointsPerThread, params, rx, ry, numRPoints, callback, _config.stepsPerLaunch, _config.streams, tuneCache);
+
+    // Use the idle host cores
+    int cpuThreads = ECDLHybridContext::getCpuThreadCount(_config.cpuThreads, _config.devices.size(), _config.cpuPhysicalCores);
+    if(cpuThreads > 0) {
+        Logger::logInfo("Running %d CPU threads next to the GPUs", cpuThreads);
+        ECDLContext *cpu = new ECDLCpuContext(cpuThreads, _config.cpuPointsPerThread, params, rx, ry, numRPoints, callback, _config.offsetRestarts, &placement);
+        ctx = new ECDLHybridContext(ctx, cpu);
+    }
 #endif
           
 #ifdef _CPU
-    ctx = new ECDLCpuContext(_config.threads, _config.pointsPerThread, params, rx, ry, numRPoints, callback);
+    ctx = new ECDLCpuContext(_config.threads, _config.pointsPerThread, params, rx, ry, numRPoints, callback, _config.offsetRestarts, &placement);
 #endif
 
     return ctx;
@@ -37,115 +90,269 @@ ECDLContext *getNewContext(const ECDLPParams *params, BigInteger *rx, BigInteger
 #ifdef _CUDA
 bool cudaInit()
 {
-    CUDA::DeviceInfo devInfo;
+    int count = CUDA::getDeviceCount();
 
-    if(CUDA::getDeviceCount() == 0) {
+    if(count == 0) {
         Logger::logError("No CUDA devices detected\n");
         return false;
     }
 
-    // Get device info
-    try {
-        CUDA::getDeviceInfo(_config.device, devInfo);
-    }catch(cudaError_t cudaError) {
-        Logger::logError("Error getting info for device %d: %s\n", _config.device, cudaGetErrorString(cudaError));
-        return false;
+    // An empty list means all devices
+    if(_config.devices.size() == 0) {
+        for(int i = 0; i < count; i++) {
+            _config.devices.push_back(i);
+        }
+    }
+
+    for(unsigned int i = 0; i < _config.devices.size(); i++) {
+        CUDA::DeviceInfo devInfo;
+        int device = _config.devices[i];
+
+        // Get device info
+        try {
+            CUDA::getDeviceInfo(device, devInfo);
+        }catch(cudaError_t cudaError) {
+            Logger::logError("Error getting info for device %d: %s\n", device, cudaGetErrorString(cudaError));
+            return false;
+        }
+      
+        Logger::logInfo("Device %d info:", device);
+        Logger::logInfo("Name:     %s", devInfo.name.c_str());
+        Logger::logInfo("version:  %d.%d", devInfo.major, devInfo.minor);
+        Logger::logInfo("MP count: %d", devInfo.mpCount);
+        Logger::logInfo("Cores:    %d", devInfo.mpCount * devInfo.cores);
+        Logger::logInfo("Memory:   %lldMB", devInfo.globalMemory/(2<<19));
+        Logger::logInfo("");
     }
-  
-    Logger::logInfo("Device info:");
-    Logger::logInfo("Name:     %s", devInfo.name.c_str());
-    Logger::logInfo("version:  %d.%d", devInfo.major, devInfo.minor);
-    Logger::logInfo("MP count: %d", devInfo.mpCount);
-    Logger::logInfo("Cores:    %d", devInfo.mpCount * devInfo.cores);
-    Logger::logInfo("Memory:   %lldMB", devInfo.globalMemory/(2<<19));
-    Logger::logInfo("");
 
     return true;
 }
 #endif
 
 
-ECDLContext *_context;
+/**
+ * A job the client works on. The context of a paused job is kept, with its
+ * walks, field parameters and R point tables, so it continues where it was
+ * when its turn comes again
+ */
+typedef struct {
+    std::string id;
+    unsigned int weight;
+
+    // Index of the job in the job scheduler
+    int index;
+
+    // Last status the server sent, written by the status thread of the job
+    volatile unsigned int status;
+
+    // Distinguished bits the server wants the walks to stop at, 0 until it
+    // says, and the bits the context was given
+    volatile unsigned int dBits;
+    unsigned int contextBits;
+
+    // Parameters and R points, set once. paramsLoaded is set after them, so
+    // the upload thread reads them once it sees it
+    ECDLPParams params;
+    std::vector<BigInteger> rx;
+    std::vector<BigInteger> ry;
+    unsigned int maxBatchSize;
+    volatile unsigned int paramsLoaded;
+
+    // Distinguished points found by the walks, waiting to be written to the
+    // spool, and the spooled points waiting to be sent to the server
+    PointQueue *queue;
+    PointSpool *spool;
 
-#define NUM_R_POINTS 32
+    // NULL until the job first runs, and after its walks were put away to
+    // make room for other jobs
+    ECDLContext *context;
 
-// X and Y values for the random walk points
-BigInteger _rx[NUM_R_POINTS];
-BigInteger _ry[NUM_R_POINTS];
+    // Walks saved by an earlier run of the job, which the context continues
+    WalkCheckpoint *resumeWalks;
 
-// Problem parameters
-ECDLPParams _params;
+    // Thread running the context while the job runs, and a flag that is set
+    // until run() returns
+    Thread runThread;
+    volatile unsigned int running;
 
-// problem id
-std::string _id;
+    // Time the job was last switched out, for picking the context to put away
+    unsigned int pausedAt;
 
-Mutex _pointsMutex;
+    // Set once the server stopped the job
+    bool done;
+
+    // Fixed-width curve routines for verifying points. Only used by the
+    // upload thread
+    ECFixedCurveBase *verifyCurve;
+
+    // Walks dropped while the job ran before, and the drops of all jobs
+    // when it last started. Both change under _dropsMutex. reportedDrops
+    // are the ones the server was told of, only used by the upload thread
+    unsigned long long drops;
+    unsigned long long dropsAtStart;
+    unsigned long long reportedDrops;
+}Job;
+
+// Jobs given on the command line. The list does not change once the
+// client runs
+std::vector<Job *> _jobs;
+
+// Job whose context is running, NULL for none. Only changes while no walks
+// run, so the walks read it without a lock
+Job *volatile _currentJob = NULL;
 
 ServerConnection *_serverConnection = NULL;
 
 // Declared extern in client.h
 ClientConfig _config;
 
-// Collection of distinguished points to be sent to the server
-std::vector<DistinguishedPoint> _pointsCache;
+// The walks wake the upload thread once _wakeThreshold points were
+// queued since it last drained the queues
+ConditionVariable _uploadWake;
+Mutex _uploadMutex;
+volatile unsigned int _queuedPoints = 0;
+volatile unsigned int _wakeThreshold = 1;
+
+// The status threads wake the scheduler when the status of a job changes
+ConditionVariable _scheduleWake;
+Mutex _scheduleMutex;
 
 bool _running = true;
 
-Thread *_ecdlThread = NULL;
+// Held while the walks of the running job are saved, and while the running
+// job changes
+Mutex _contextMutex;
+
+// Held while the drops of a job are counted up, and while the running job
+// changes
+Mutex _dropsMutex;
+
+/**
+ Verifies a point of a job is on its curve. x and y are POINT_WORDS words
+ */
+bool verifyPoint(Job *job, const unsigned int *x, const unsigned int *y)
+{
+    const ECDLPParams &params = job->params;
+
+    if(job->verifyCurve == NULL) {
+        job->verifyCurve = getFixedCurve(ECCurve(params.p, params.n, params.a, params.b, params.gx, params.gy));
+    }
+
+    if(job->verifyCurve == NULL) {
+        ECCurve curve(params.p, params.n, params.a, params.b, params.gx, params.gy);
+        ECPoint p(BigInteger(x, POINT_WORDS), BigInteger(y, POINT_WORDS));
+
+        return curve.pointExists(p);
+    }
+
+    // The words above the length of the curve must be 0
+    for(int i = job->verifyCurve->getWords(); i < POINT_WORDS; i++) {
+        if(x[i] != 0 || y[i] != 0) {
+            return false;
+        }
+    }
+
+    unsigned int px[FIXED_ECC_MAX_WORDS] = {0};
+    unsigned int py[FIXED_ECC_MAX_WORDS] = {0};
+
+    memcpy(px, x, sizeof(unsigned int) * POINT_WORDS);
+    memcpy(py, y, sizeof(unsigned int) * POINT_WORDS);
+
+    return job->verifyCurve->pointExists(px, py);
+}
 
 /**
- Verifies a point is on the curve
+ * Called from every walk thread. Only queues the point for the running
+ * job, so it never locks or allocates. The upload thread verifies it
  */
-bool verifyPoint(BigInteger &x, BigInteger &y)
+void pointFoundCallback(struct CallbackParameters *p)
 {
-    ECCurve curve(_params.p, _params.n, _params.a, _params.b, _params.gx, _params.gy);
-    ECPoint p(x, y);
+    if(!_currentJob->queue->push(p)) {
+        return;
+    }
 
-    return curve.pointExists(p);
+    // Wake the upload thread once per batch
+    if(atomicAdd(&_queuedPoints, 1) + 1 == atomicLoad(&_wakeThreshold)) {
+        _uploadWake.signal();
+    }
 }
 
 /**
- * Adds distinguished point to cache
+ * Moves the queued points of a job to its spool. Returns the number of
+ * points moved
  */
-void addPointToCache(BigInteger a, BigInteger b, BigInteger x, BigInteger y, unsigned int length)
+unsigned int spoolQueuedPoints(Job *job)
 {
-    DistinguishedPoint p(a, b, x, y, length);
-    _pointsMutex.grab();
-    _pointsCache.push_back(p);
-    _pointsMutex.release();
+    std::vector<PointRecord> records(POINT_DRAIN_BATCH);
+    unsigned int count = 0;
+    unsigned int total = 0;
+
+    while((count = job->queue->pop(&records[0], POINT_DRAIN_BATCH)) > 0) {
+        try {
+            job->spool->append(&records[0], count);
+            total += count;
+        } catch(std::string err) {
+            Logger::logError("Error: %s. Lost %d points", err.c_str(), count);
+        }
+    }
+
+    unsigned int dropped = job->queue->takeDropped();
+    if(dropped > 0) {
+        Logger::logError("Point queue of %s full, dropped %d points", job->id.c_str(), dropped);
+    }
+
+    return total;
 }
 
-void pointFoundCallback(struct CallbackParameters *p)
+/**
+ * Reads up to count of the oldest spooled points of a job into points and
+ * returns how many records were read. Points that are not on the curve are
+ * logged and left out
+ */
+unsigned int readSpooledPoints(Job *job, std::vector<DistinguishedPoint> &points, unsigned int count)
 {
-    bool valid = verifyPoint(p->x, p->y);
-    
-    if(!valid) {
-        Logger::logInfo("INVALID POINT\n");
-        Logger::logInfo("a: %s", p->aStart.toString(16).c_str());
-        Logger::logInfo("b: %s", p->bStart.toString(16).c_str());
-        Logger::logInfo("x: %s", p->x.toString(16).c_str());
-        Logger::logInfo("y: %s", p->y.toString(16).c_str());
-        Logger::logInfo("length: %d", p->length);
-        return;
+    std::vector<PointRecord> records;
+
+    count = job->spool->read(records, count);
+
+    for(unsigned int i = 0; i < count; i++) {
+        BigInteger a(records[i].a, POINT_WORDS);
+        BigInteger b(records[i].b, POINT_WORDS);
+        BigInteger x(records[i].x, POINT_WORDS);
+        BigInteger y(records[i].y, POINT_WORDS);
+
+        if(!verifyPoint(job, records[i].x, records[i].y)) {
+            Logger::logInfo("INVALID POINT\n");
+            Logger::logInfo("a: %s", a.toString(16).c_str());
+            Logger::logInfo("b: %s", b.toString(16).c_str());
+            Logger::logInfo("x: %s", x.toString(16).c_str());
+            Logger::logInfo("y: %s", y.toString(16).c_str());
+            Logger::logInfo("length: %llu", records[i].length);
+            continue;
+        }
+
+        points.push_back(DistinguishedPoint(a, b, x, y, records[i].length));
     }
 
-    addPointToCache(p->aStart, p->bStart, p->x, p->y, p->length);
+    return count;
 }
 
 /**
- * Gets the problem parameters and R points from the server
+ * Gets the problem parameters and R points of a job from the server
  */
-bool getParameters(ECDLPParams &params, BigInteger *rx, BigInteger *ry)
+bool getParameters(Job *job)
 {
     ParamsMsg paramsMsg;
 
     try {
-        paramsMsg = _serverConnection->getParameters(_id);
+        paramsMsg = _serverConnection->getParameters(job->id);
     } catch(std::string e) {
         Logger::logInfo("Error: %s\n", e.c_str()); 
         return false;
     }
 
+    ECDLPParams &params = job->params;
+
     params.p = paramsMsg.p;
     params.n = paramsMsg.n;
     params.a = paramsMsg.a;
@@ -155,69 +362,575 @@ bool getParameters(ECDLPParams &params, BigInteger *rx, BigInteger *ry)
     params.qx = paramsMsg.qx;
     params.qy = paramsMsg.qy;
     params.dBits = paramsMsg.dBits;
-    
-    for(int i = 0; i < 32; i++) {
-        rx[ i ] = paramsMsg.rx[i];
-        ry[ i ] = paramsMsg.ry[i];
+    params.negation = paramsMsg.negation;
+    params.kangaroo = paramsMsg.kangaroo;
+    params.lower = paramsMsg.lower;
+    params.upper = paramsMsg.upper;
+    params.walks = paramsMsg.walks;
+
+    job->maxBatchSize = paramsMsg.maxBatchSize;
+
+    job->rx = paramsMsg.rx;
+    job->ry = paramsMsg.ry;
+
+    return true;
+}
+
+/**
+ * Points waiting in the spools of the jobs whose points can be verified
+ */
+unsigned long long spooledPoints()
+{
+    unsigned long long count = 0;
+
+    for(unsigned int i = 0; i < _jobs.size(); i++) {
+        if(atomicLoad(&_jobs[i]->paramsLoaded)) {
+            count += _jobs[i]->spool->size();
+        }
+    }
+
+    return count;
+}
+
+/**
+ * Job with the most points waiting to be sent, NULL if none are
+ */
+Job *nextUploadJob()
+{
+    Job *next = NULL;
+
+    for(unsigned int i = 0; i < _jobs.size(); i++) {
+        Job *job = _jobs[i];
+
+        if(atomicLoad(&job->paramsLoaded) && job->spool->size() > 0 && (next == NULL || job->spool->size() > next->spool->size())) {
+            next = job;
+        }
+    }
+
+    return next;
+}
+
+/**
+ * Walks dropped by all jobs since the client started
+ */
+unsigned long long totalDrops()
+{
+    MetricsCounters totals = Metrics::getTotals();
+
+    return totals.cycleDrops + totals.queueDrops;
+}
+
+/**
+ * Walks of a job that were dropped. Only one job runs at a time, so the
+ * drops while it runs are its own
+ */
+unsigned long long jobDrops(Job *job)
+{
+    _dropsMutex.grab();
+
+    unsigned long long drops = job->drops;
+    if(job == _currentJob) {
+        drops += totalDrops() - job->dropsAtStart;
+    }
+
+    _dropsMutex.release();
+
+    return drops;
+}
+
+/**
+ * Submits one batch of the spooled points of a job. Returns false if the
+ * submission failed or the server asked the client to wait.
+ *
+ * The walks of the job dropped since the server was last told go with the
+ * batch, so they are counted once even when it is sent again
+ */
+bool submitSpooledPoints(Job *job, UploadScheduler &scheduler, unsigned int &sent, MetricsCounters *metrics)
+{
+    scheduler.setMaxBatchSize(job->maxBatchSize);
+
+    std::vector<DistinguishedPoint> points;
+    unsigned int count = readSpooledPoints(job, points, scheduler.batchSize());
+
+    if(points.size() > 0) {
+        unsigned int retryAfter = 0;
+        unsigned long long start = util::getTimeMicros();
+
+        unsigned long long drops = jobDrops(job);
+
+        try {
+            if(!_serverConnection->submitPoints(job->id, points, drops - job->reportedDrops, retryAfter)) {
+                scheduler.recordBusy(retryAfter);
+                Logger::logInfo("Server is busy. Will try again in %d seconds", scheduler.backoff() / 1000);
+                return false;
+            }
+        } catch(std::string err) {
+            scheduler.recordFailure();
+            metrics->uploadFailures++;
+            Logger::logInfo("Error sending points to server: %s. Will try again in %d seconds\n", err.c_str(), scheduler.backoff() / 1000);
+            return false;
+        }
+
+        unsigned long long elapsed = util::getTimeMicros() - start;
+
+        scheduler.recordSubmission((unsigned int)(elapsed / 1000));
+        sent += points.size();
+        job->reportedDrops = drops;
+
+        metrics->uploads++;
+        metrics->uploadedPoints += points.size();
+        metrics->uploadMicros += elapsed;
+    }
+
+    try {
+        job->spool->consume(count);
+    } catch(std::string err) {
+        Logger::logError("Error: %s", err.c_str());
+        return false;
     }
 
     return true;
 }
 
 /**
- * Thread to poll the cache of distinguished points. Will send them to the server
- * when there are enough
+ * Thread that moves distinguished points from the queues to the spools and
+ * sends them to the server. It sleeps until a batch is waiting or the
+ * flush interval has passed
  */
-void *sendPointsThread(void *p)
+void *sendPointsThread(void *)
 {
+    UploadScheduler scheduler(_config.pointCacheSize);
+    MetricsCounters *metrics = Metrics::acquire();
+
+    unsigned int lastFlush = util::getSystemTime();
+    unsigned int lastReport = lastFlush;
+
+    // Points spooled since the rate was last measured
+    unsigned int rateStart = lastFlush;
+    unsigned int ratePoints = 0;
+
+    unsigned int sent = 0;
+    unsigned int submissions = 0;
+
+    unsigned int wait = scheduler.flushInterval();
+
+    _uploadMutex.grab();
 
     while(_running) {
-        _pointsMutex.grab();
+        _uploadWake.wait(_uploadMutex, wait);
+        _uploadMutex.release();
 
-        if(_pointsCache.size() >= _config.pointCacheSize) {
+        atomicExchange(&_queuedPoints, 0);
+        for(unsigned int i = 0; i < _jobs.size(); i++) {
+            ratePoints += spoolQueuedPoints(_jobs[i]);
+        }
 
-            Logger::logInfo("Sending %d points to server", _pointsCache.size());
-            bool success = true;
+        unsigned int now = util::getSystemTime();
 
-            std::vector<DistinguishedPoint> points;
+        if(now - rateStart >= UPLOAD_RATE_WINDOW) {
+            scheduler.recordPoints(ratePoints, now - rateStart);
+            rateStart = now;
+            ratePoints = 0;
+        }
 
-            for(int i = 0; i < _pointsCache.size(); i++) {
-                points.push_back(_pointsCache[i]);
+        // Spooled points are verified against the parameters of their job,
+        // so the points of a job wait until its parameters are known
+        unsigned int backoff = scheduler.backoff();
+        bool due = now - lastFlush >= (backoff > 0 ? backoff : scheduler.flushInterval());
+
+        // A batch that is due goes out even if it is not full. Full
+        // batches go out right away unless the server needs a break
+        while(spooledPoints() > 0 && (due || (backoff == 0 && spooledPoints() >= scheduler.batchSize()))) {
+            lastFlush = util::getSystemTime();
+            due = false;
+
+            if(!submitSpooledPoints(nextUploadJob(), scheduler, sent, metrics)) {
+                break;
             }
+            submissions++;
+            backoff = 0;
+        }
+
+        if(spooledPoints() == 0 && scheduler.backoff() == 0) {
+            lastFlush = util::getSystemTime();
+        }
+
+        now = util::getSystemTime();
+
+        if(now - lastReport >= UPLOAD_REPORT_INTERVAL) {
+            Logger::logInfo("Sent %d points in %d submissions. %.2f points per second, %.0f ms per submission",
+                            sent, submissions, scheduler.rate(), scheduler.latency());
+            lastReport = now;
+            sent = 0;
+            submissions = 0;
+        }
+
+        // Sleep until the next batch is due, or until the walks have
+        // queued a full batch
+        unsigned int interval = scheduler.backoff() > 0 ? scheduler.backoff() : scheduler.flushInterval();
+        unsigned int elapsed = now - lastFlush;
+        wait = elapsed < interval ? interval - elapsed : UPLOAD_MIN_WAIT;
+
+        atomicStore(&_wakeThreshold, std::min(scheduler.batchSize(), (unsigned int)POINT_QUEUE_SIZE / 4));
+
+        _uploadMutex.grab();
+    }
+
+    _uploadMutex.release();
+
+    Metrics::release(metrics);
+
+    return NULL;
+}
+
+/**
+ * Saves the walks of the context of a job to the checkpoint of the job
+ */
+void saveCheckpoint(Job *job)
+{
+    WalkCheckpoint checkpoint(&job->params, &job->rx[0], &job->ry[0], job->rx.size());
+    unsigned int start = util::getSystemTime();
+
+    try {
+        job->context->saveWalks(checkpoint);
+        checkpoint.save(job->id + WALK_CHECKPOINT_EXTENSION);
+    } catch(std::string err) {
+        Logger::logError("Error saving the walks: %s", err.c_str());
+        return;
+    }
+
+    Logger::logInfo("Saved %llu walks of %s in %d ms", checkpoint.size(), job->id.c_str(), util::getSystemTime() - start);
+}
+
+/**
+ * Thread that saves the walks of the running job every checkpoint interval
+ */
+void *checkpointThread(void *)
+{
+    unsigned int lastSave = util::getSystemTime();
+
+    while(_running) {
+        util::sleep(CHECKPOINT_WAIT);
+
+        if(util::getSystemTime() - lastSave < _config.checkpointInterval * 1000) {
+            continue;
+        }
+
+        _contextMutex.grab();
+        Job *job = _currentJob;
+        if(job != NULL && job->context->isRunning()) {
+            saveCheckpoint(job);
+        }
+        _contextMutex.release();
+
+        lastSave = util::getSystemTime();
+    }
+
+    return NULL;
+}
+
+/**
+ * Names of the jobs, for labelling the metrics
+ */
+std::string getJobNames()
+{
+    std::string names;
+
+    for(unsigned int i = 0; i < _jobs.size(); i++) {
+        names += (i > 0 ? "," : "") + _jobs[i]->id;
+    }
+
+    return names;
+}
+
+/**
+ * Thread that logs the counters every stats interval, and writes them to
+ * the metrics file
+ */
+void *statsThread(void *)
+{
+    MetricsCounters last = Metrics::getTotals();
+    unsigned int lastTime = util::getSystemTime();
+
+    while(_running) {
+        util::sleep(STATS_WAIT);
+
+        unsigned int now = util::getSystemTime();
+        if(now - lastTime < _config.statsInterval * 1000) {
+            continue;
+        }
+
+        MetricsCounters totals = Metrics::getTotals();
+        Logger::logInfo("Stats %s", Metrics::toJson(totals, last, now - lastTime).c_str());
 
+        if(!_config.metricsFile.empty()) {
             try {
-                Logger::logInfo("Sending to server\n");
-                _serverConnection->submitPoints(_id, points);
+                Metrics::writePrometheus(_config.metricsFile, getJobNames(), totals);
             } catch(std::string err) {
-                success = false;
-                Logger::logInfo("Error sending points to server: %s. Will try again later\n", err.c_str());
+                Logger::logError("Error: %s", err.c_str());
             }
+        }
 
-            if(success) {
-                _pointsCache.clear();
-            }
+        last = totals;
+        lastTime = now;
+    }
+
+    return NULL;
+}
+
+/**
+ * Thread that follows the status of a job on the server. The server answers
+ * as soon as the status differs from the one the thread has
+ */
+void *statusThread(void *p)
+{
+    Job *job = (Job *)p;
+
+    // Last status and distinguished bits the server sent, -1 and 0 before
+    // the first
+    int status = -1;
+    unsigned int bits = 0;
+
+    while(_running) {
+
+        if(status == -1) {
+            Logger::logInfo("Connecting to server for %s...", job->id.c_str()); 
         }
-        _pointsMutex.release();
 
-        sleep(30);
+        int newStatus = 0;
+        unsigned int newBits = 0;
+        try {
+            newStatus = _serverConnection->getStatus(job->id, status, STATUS_WAIT, bits, &newBits);
+        }catch(std::string s) {
+            Logger::logInfo("Connection error: %s\n", s.c_str());
+            Logger::logInfo("Retrying in 60 seconds...\n");
+            status = -1;
+            sleep(60);
+            continue;
+        }
+
+        if(newStatus != status) {
+            Logger::logInfo("%s: status = %d\n", job->id.c_str(), newStatus);
+
+            atomicStore(&job->status, (unsigned int)newStatus);
+            _scheduleWake.signal();
+        }
+        status = newStatus;
+
+        if(newBits != bits) {
+            atomicStore(&job->dBits, newBits);
+            _scheduleWake.signal();
+        }
+        bits = newBits;
+
+        if(status == SERVER_STATUS_STOPPED) {
+            break;
+        }
+
+        // A server without long polling answers right away
+        if(!_serverConnection->supportsLongPoll()) {
+            sleep(STATUS_POLL_INTERVAL);
+        }
     }
 
     return NULL;
 }
 
 /**
- * Holding thread for running the context
+ * Holding thread for running the context of a job
  */
 void *runningThread(void *p)
 {
+    Job *job = (Job *)p;
+
     // This is a blocking call
-   _context->run();
+   job->context->run();
+
+   atomicStore(&job->running, 0);
+   _scheduleWake.signal();
 
    return NULL;
 }
 
 /**
- * Main loop of the program. It periodically polls the server
+ * Gets the parameters of a job from the server. Returns false if they
+ * could not be read
+ */
+bool loadJob(Job *job)
+{
+    if(!getParameters(job)) {
+        Logger::logError("Error getting the parameters of %s from server\n", job->id.c_str());
+        return false;
+    }
+
+    const ECDLPParams &params = job->params;
+
+    Logger::logInfo("Received parameters of %s from server", job->id.c_str());
+    Logger::logInfo("GF(p) = %s", params.p.toString().c_str());
+    Logger::logInfo("y^2 = x^3 + %sx + %s", params.a.toString().c_str(), params.b.toString().c_str());
+    Logger::logInfo("n = %s", params.n.toString().c_str());
+    Logger::logInfo("G = [%s, %s]", params.gx.toString().c_str(), params.gy.toString().c_str());
+    Logger::logInfo("Q = [%s, %s]", params.qx.toString().c_str(), params.qy.toString().c_str());
+    Logger::logInfo("%d distinguished bits", params.dBits);
+    Logger::logInfo("%d R points", job->rx.size());
+
+    atomicStore(&job->paramsLoaded, 1);
+    _uploadWake.signal();
+
+    return true;
+}
+
+/**
+ * Creates the context of a job, continuing the walks saved by an earlier
+ * run
+ */
+void createContext(Job *job)
+{
+    ECDLContext *ctx = getNewContext(&job->params, &job->rx[0], &job->ry[0], job->rx.size(), pointFoundCallback);
+
+    if(_config.checkpointInterval > 0) {
+        job->resumeWalks = new WalkCheckpoint(&job->params, &job->rx[0], &job->ry[0], job->rx.size());
+
+        if(job->resumeWalks->load(job->id + WALK_CHECKPOINT_EXTENSION)) {
+            Logger::logInfo("Resuming %llu saved walks of %s", job->resumeWalks->size(), job->id.c_str());
+            ctx->resumeWalks(job->resumeWalks);
+        }
+    }
+
+    ctx->init();
+
+    job->context = ctx;
+    job->contextBits = job->params.dBits;
+}
+
+/**
+ * Passes a change of the distinguished bits from the server on to the
+ * context of a job. Its walks continue
+ */
+void updateDistinguishedBits(Job *job)
+{
+    unsigned int dBits = atomicLoad(&job->dBits);
+
+    if(job->context == NULL || dBits == 0 || dBits == job->contextBits) {
+        return;
+    }
+    job->contextBits = dBits;
+
+    if(dBits < job->params.dBits || dBits > MAX_DISTINGUISHED_BITS) {
+        Logger::logError("%s: invalid number of distinguished bits %d", job->id.c_str(), dBits);
+        return;
+    }
+
+    Logger::logInfo("%s: walks stop at %d distinguished bits", job->id.c_str(), dBits);
+    job->context->setDistinguishedBits(dBits);
+}
+
+/**
+ * Deletes the context of a job. Its walks are saved first unless deleted
+ * is set, in which case the checkpoint is removed
+ */
+void deleteContext(Job *job, bool deleted)
+{
+    if(job->context == NULL) {
+        return;
+    }
+
+    if(!deleted && _config.checkpointInterval > 0) {
+        saveCheckpoint(job);
+    }
+
+    delete job->context;
+    job->context = NULL;
+
+    delete job->resumeWalks;
+    job->resumeWalks = NULL;
+
+    if(deleted) {
+        remove((job->id + WALK_CHECKPOINT_EXTENSION).c_str());
+    }
+}
+
+/**
+ * Stops the running job. Returns once its walks stopped
+ */
+void pauseJob()
+{
+    Job *job = _currentJob;
+
+    if(job == NULL) {
+        return;
+    }
+
+    job->context->stop();
+    job->runThread.wait();
+    job->pausedAt = util::getSystemTime();
+
+    _contextMutex.grab();
+    _dropsMutex.grab();
+    job->drops += totalDrops() - job->dropsAtStart;
+    _currentJob = NULL;
+    _dropsMutex.release();
+    _contextMutex.release();
+}
+
+/**
+ * Starts or continues the walks of a job
+ */
+void runJob(Job *job)
+{
+    if(job->context == NULL) {
+        createContext(job);
+    }
+    updateDistinguishedBits(job);
+
+    _contextMutex.grab();
+    _dropsMutex.grab();
+    job->dropsAtStart = totalDrops();
+    _currentJob = job;
+    _dropsMutex.release();
+    _contextMutex.release();
+
+    Logger::logInfo("Running %s", job->id.c_str());
+
+    job->running = 1;
+    job->runThread = Thread(runningThread, job);
+}
+
+/**
+ * Puts away the contexts of the paused jobs that were paused longest ago
+ * until at most the configured number is left
+ */
+void trimPausedContexts()
+{
+    for(;;) {
+        unsigned int count = 0;
+        Job *oldest = NULL;
+
+        for(unsigned int i = 0; i < _jobs.size(); i++) {
+            Job *job = _jobs[i];
+
+            if(job == _currentJob || job->context == NULL) {
+                continue;
+            }
+
+            count++;
+            if(oldest == NULL || (int)(job->pausedAt - oldest->pausedAt) < 0) {
+                oldest = job;
+            }
+        }
+
+        if(count <= _config.pausedContexts) {
+            return;
+        }
+
+        Logger::logInfo("Putting away the walks of %s", oldest->id.c_str());
+        deleteContext(oldest, false);
+    }
+}
+
+/**
+ * Main loop of the program. Follows the status of the jobs and runs one of
+ * them at a time, as the job scheduler decides
  */
 void pollConnections()
 {
@@ -225,72 +938,156 @@ void pollConnections()
 
     Thread pointsThread(sendPointsThread, NULL);
 
-    while(_running) {
+    if(_config.checkpointInterval > 0) {
+        Thread t(checkpointThread, NULL);
+    }
 
-        unsigned int status = 0;
-     
-        Logger::logInfo("Connecting to server..."); 
-        // Attempt to connect to the server 
-        try {
-            status = _serverConnection->getStatus(_id);
-        }catch(std::string s) {
-            Logger::logInfo("Connection error: %s\n", s.c_str());
-            Logger::logInfo("Retrying in 60 seconds...\n");
-            sleep(60);
-            continue;
-        }
+    if(_config.statsInterval > 0) {
+        Thread t(statsThread, NULL);
+    }
 
-        Logger::logInfo("Status = %d\n", status);
+    JobScheduler scheduler(_config.jobTimeSlice * 1000);
 
-        // If not currently running, then get the parameters and start
-        if(status == SERVER_STATUS_RUNNING) {
-            if(_context == NULL) {
+    for(unsigned int i = 0; i < _jobs.size(); i++) {
+        _jobs[i]->index = scheduler.addJob(_jobs[i]->weight);
 
-                // Get parameters from the server
-                if(!getParameters(_params, _rx, _ry)) {
-                    Logger::logError("Error getting the parameters from server\n");
-                } else {
-                    Logger::logInfo("Received parameters from server");
-                    Logger::logInfo("GF(p) = %s", _params.p.toString().c_str());
-                    Logger::logInfo("y^2 = x^3 + %sx + %s", _params.a.toString().c_str(), _params.b.toString().c_str());
-                    Logger::logInfo("n = %s", _params.n.toString().c_str());
-                    Logger::logInfo("G = [%s, %s]", _params.gx.toString().c_str(), _params.gy.toString().c_str());
-                    Logger::logInfo("Q = [%s, %s]", _params.qx.toString().c_str(), _params.qy.toString().c_str());
-                    Logger::logInfo("%d distinguished bits", _params.dBits);
+        Thread t(statusThread, _jobs[i]);
+    }
 
-                    _context = getNewContext(&_params, _rx, _ry, NUM_R_POINTS, pointFoundCallback);
-                    _context->init();
+    _scheduleMutex.grab();
 
-                    Thread t(runningThread, NULL);
+    while(_running) {
+        bool active = false;
+
+        for(unsigned int i = 0; i < _jobs.size(); i++) {
+            Job *job = _jobs[i];
+            unsigned int status = atomicLoad(&job->status);
+
+            if(job->done) {
+                continue;
+            }
+
+            // The job is over, so its walks are not continued
+            if(status == SERVER_STATUS_STOPPED) {
+                Logger::logInfo("Stopping %s", job->id.c_str()); 
+                if(job == _currentJob) {
+                    pauseJob();
                 }
-            } else if(!_context->isRunning()) {
-                Thread t(runningThread, NULL);
+                deleteContext(job, true);
+
+                job->done = true;
+                scheduler.setRunnable(job->index, false);
+                continue;
             }
-        } else if(status == SERVER_STATUS_STOPPED) {
-            Logger::logInfo("Stopping"); 
-            if(_context != NULL) {
-                _context->stop();
-                delete _context;
+
+            active = true;
+
+            if(status == SERVER_STATUS_RUNNING && !atomicLoad(&job->paramsLoaded)) {
+                loadJob(job);
             }
+
+            scheduler.setRunnable(job->index, status == SERVER_STATUS_RUNNING && atomicLoad(&job->paramsLoaded));
+
+            updateDistinguishedBits(job);
+        }
+
+        if(!active) {
             break;
         }
 
-        // Sleep 5 minutes
-        sleep(300);
+        int next = scheduler.next(util::getSystemTime());
+        Job *job = next >= 0 ? _jobs[next] : NULL;
+
+        if(job != _currentJob) {
+            // Switch right away so the hardware does not sit idle
+            pauseJob();
+
+            if(job != NULL) {
+                runJob(job);
+            }
+
+            trimPausedContexts();
+        } else if(job != NULL && !atomicLoad(&job->running)) {
+            job->runThread.wait();
+            runJob(job);
+        }
+
+        _scheduleWake.wait(_scheduleMutex, SCHEDULE_WAIT);
     }
+
+    _scheduleMutex.release();
 }
 
+/**
+ * Parses a job given as id or id:weight
+ */
+Job *parseJob(const std::string &arg)
+{
+    Job *job = new Job();
+
+    size_t colon = arg.find(':');
+
+    job->id = arg.substr(0, colon);
+    job->weight = JOB_DEFAULT_WEIGHT;
+
+    if(colon != std::string::npos) {
+        int weight = atoi(arg.substr(colon + 1).c_str());
+
+        if(weight < 1) {
+            delete job;
+            throw std::string("Invalid job weight: " + arg);
+        }
+        job->weight = weight;
+    }
+
+    job->index = -1;
+    job->status = JOB_STATUS_UNKNOWN;
+    job->dBits = 0;
+    job->contextBits = 0;
+    job->maxBatchSize = 0;
+    job->paramsLoaded = 0;
+    job->queue = new PointQueue();
+    job->spool = NULL;
+    job->context = NULL;
+    job->resumeWalks = NULL;
+    job->running = 0;
+    job->pausedAt = 0;
+    job->done = false;
+    job->verifyCurve = NULL;
+    job->drops = 0;
+    job->dropsAtStart = 0;
+    job->reportedDrops = 0;
+
+    return job;
+}
 
 void enterEventLoop ()
 {
     // Enter main loop
     try {
         _serverConnection = new ServerConnection(_config.serverHost, _config.serverPort);
+        _serverConnection->setClientId(_config.clientId);
     }catch(std::string err) {
         Logger::logError("Error: %s", err.c_str());
         return;
     }
 
+    // Points that were not sent when the client last stopped are sent first
+    for(unsigned int i = 0; i < _jobs.size(); i++) {
+        Job *job = _jobs[i];
+
+        try {
+            job->spool = new PointSpool(job->id + POINT_SPOOL_EXTENSION);
+        }catch(std::string err) {
+            Logger::logError("Error: %s", err.c_str());
+            return;
+        }
+
+        if(job->spool->size() > 0) {
+            Logger::logInfo("Replaying %llu spooled points of %s", job->spool->size(), job->id.c_str());
+        }
+    }
+
     pollConnections();
 }
 
@@ -310,6 +1107,8 @@ int main(int argc, char **argv)
         return 1; 
     }
 
+    Logger::setLevel(_config.logLevel);
+
     // Check for CUDA devices
 #ifdef _CUDA
     if (!cudaInit())
@@ -319,16 +1118,30 @@ int main(int argc, char **argv)
 #endif
     
 //TODO: Properly parse arguments (getopt?)
-    // Run benchmark on -b option
+    // Run benchmark on -b option. With a file name the benchmark suite is run
+    // and its results are written to the file
     if(argc >= 2 && strcmp(argv[1], "-b") == 0) {
-        doBenchmark();
+        if(argc >= 3) {
+            doBenchmarkSuite(argv[2]);
+        } else {
+            doBenchmark();
+        }
         return 0;
     } else {
         if(argc < 2) {
-            Logger::logInfo("usage: [options] id\n");
+            Logger::logInfo("usage: [options] id[:weight] [id[:weight] ...]\n");
             return 0;
-        } else {
-            _id = std::string(argv[1]);
+        }
+
+        // Each job is worked on in turn, for a share of the time that
+        // follows its weight
+        try {
+            for(int i = 1; i < argc; i++) {
+                _jobs.push_back(parseJob(argv[i]));
+            }
+        } catch(std::string err) {
+            Logger::logError(err);
+            return 1;
         }
     }
 
@@ -33,7 +33,7 @@ ECCurve& ECCurve::operator=(const ECCurve& curve)
     _a = curve._a;
     _b = curve._b;
     _bpx = curve._bpx;
-    _bpy = curve._bpx;
+    _bpy = curve._bpy;
 
     return *this;
 }
@@ -145,6 +145,49 @@ ECPoint ECCurve::toAffine( ECPointJacobian &p )
     return ECPoint( (x * z2Inv) % _p, (y * z3Inv) % _p );
 }
 
+/**
+ * Converts count points to affine with one inversion. Points at infinity
+ * are converted to ECPoint()
+ */
+void ECCurve::toAffine( ECPointJacobian *p, ECPoint *out, int count )
+{
+    if( count <= 0 ) {
+        return;
+    }
+
+    // products[i] is the product of the z values of points 0 to i
+    std::vector<BigInteger> products( count );
+    BigInteger product( 1 );
+
+    for( int i = 0; i < count; i++ ) {
+        if( !p[ i ].isPointAtInfinity() ) {
+            product = (product * p[ i ].getZ()) % _p;
+        }
+        products[ i ] = product;
+    }
+
+    BigInteger inverse = product.invm( _p );
+
+    for( int i = count - 1; i >= 0; i-- ) {
+        if( p[ i ].isPointAtInfinity() ) {
+            out[ i ] = ECPoint();
+            continue;
+        }
+
+        // Inverse of z[i] is the inverse of the product up to i times the product up to i - 1
+        BigInteger zInv = inverse;
+        if( i > 0 ) {
+            zInv = (zInv * products[ i - 1 ]) % _p;
+        }
+        inverse = (inverse * p[ i ].getZ()) % _p;
+
+        BigInteger z2Inv = (zInv * zInv) % _p;
+        BigInteger z3Inv = (z2Inv * zInv) % _p;
+
+        out[ i ] = ECPoint( (p[ i ].getX() * z2Inv) % _p, (p[ i ].getY() * z3Inv) % _p );
+    }
+}
+
 ECPoint ECCurve::getBasepoint()
 {
     return ECPoint( _bpx, _bpy );
@@ -1,4 +1,6 @@
+#include <vector>
 #include "ecc.h"
+#include "FixedEcc.h"
 #include "BigInteger.h"
 
 /**
@@ -70,7 +72,7 @@ int squareRootModP(const BigInteger &n, const BigInteger &p, BigInteger *out)
         return 0;
     } 
 
-    if(n % 4 == 3) {
+    if(p % 4 == 3) {
         BigInteger r = n.pow((p+1)/4, p);
         out[0] = r;
         out[1] = p - r;
@@ -99,17 +101,19 @@ int squareRootModP(const BigInteger &n, const BigInteger &p, BigInteger *out)
      
     while(t != 1) {
 
-        //Find lowest i where t^(2^i) = 1
-        unsigned int i = 1;
-        unsigned int e = 1;
-        while(e < m) {
-            if(t.pow(BigInteger(2).pow(i), p) == 1) {
-                break;
-            }
-            i = i * 2;
+        //Find lowest i where t^(2^i) = 1, by repeated squaring
+        unsigned int i = 0;
+        BigInteger t2i = t;
+        while(t2i != 1) {
+            t2i = (t2i * t2i) % p;
+            i++;
         }
 
-        BigInteger b = c.pow(BigInteger(2).pow(m - i - 1), p);
+        // b = c^(2^(m - i - 1))
+        BigInteger b = c;
+        for(unsigned int j = 0; j < m - i - 1; j++) {
+            b = (b * b) % p;
+        }
         r = (r * b) % p;
         t = (t * b * b) % p;
         c = (b * b) % p;
@@ -143,6 +147,30 @@ bool decompressPoint(const ECCurve &curve, const unsigned char *encoded, int enc
 
     BigInteger x(&encoded[1], encodedLen-1);
 
+    // The square root is taken on fixed-width integers when the curve is
+    // small enough for them
+    ECFixedCurveBase *fixed = getFixedCurve(curve);
+
+    if(fixed != NULL) {
+        int words = fixed->getWords();
+        std::vector<unsigned int> xWords(words);
+        std::vector<unsigned int> yWords(words);
+
+        bool found = false;
+        if((int)x.getLength32() <= words) {
+            x.getWords(&xWords[0], words);
+            found = fixed->decompressPoint(&xWords[0], sign ? 1 : 0, &yWords[0]);
+        }
+        delete fixed;
+
+        if(found) {
+            out.x = x;
+            out.y = BigInteger(&yWords[0], words);
+        }
+
+        return found;
+    }
+
     BigInteger a = curve.a();
     BigInteger b = curve.b(); 
     BigInteger p = curve.p();
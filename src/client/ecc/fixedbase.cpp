@@ -0,0 +1,76 @@
+#include <vector>
+#include "BigInteger.h"
+#include "ecc.h"
+
+ECFixedBaseTable::ECFixedBaseTable()
+{
+    _windowBits = 0;
+    _windows = 0;
+}
+
+/**
+ * Builds the table for point p. The window size must divide 32 so that no
+ * window of k crosses a word boundary
+ */
+ECFixedBaseTable::ECFixedBaseTable( ECCurve &curve, ECPoint &p, int windowBits )
+{
+    if( windowBits <= 0 || windowBits > 8 || 32 % windowBits != 0 ) {
+        throw std::string( "Invalid window size" );
+    }
+
+    int entries = 1 << windowBits;
+
+    _windowBits = windowBits;
+    _windows = ((int)curve.n().getBitLength() + windowBits - 1) / windowBits;
+
+    std::vector<ECPointJacobian> table( _windows * entries );
+
+    ECPointJacobian base = curve.toJacobian( p );
+
+    for( int i = 0; i < _windows; i++ ) {
+        ECPointJacobian *row = &table[ i * entries ];
+
+        row[ 1 ] = base;
+        for( int j = 2; j < entries; j++ ) {
+            row[ j ] = curve.addJacobian( row[ j - 1 ], base );
+        }
+
+        // Base for the next window is 2^w times the base of this one
+        base = curve.addJacobian( row[ entries - 1 ], base );
+    }
+
+    // Store every entry with z = 1 so that building the table costs one inversion
+    std::vector<ECPoint> affine( table.size() );
+    curve.toAffine( &table[ 0 ], &affine[ 0 ], (int)table.size() );
+
+    _table.resize( table.size() );
+    for( size_t i = 0; i < table.size(); i++ ) {
+        if( !affine[ i ].isPointAtInfinity() ) {
+            _table[ i ] = curve.toJacobian( affine[ i ] );
+        }
+    }
+}
+
+/**
+ * Adds kP to sum. k is reduced mod n and each window of k adds one table entry
+ */
+void ECFixedBaseTable::multiplyAdd( ECCurve &curve, const BigInteger &k, ECPointJacobian &sum )
+{
+    BigInteger m = k % curve.n();
+
+    int numWords = (_windows * _windowBits + 31) / 32;
+    std::vector<unsigned int> words( numWords );
+    m.getWords( &words[ 0 ], numWords );
+
+    int entries = 1 << _windowBits;
+    unsigned int mask = entries - 1;
+
+    for( int i = 0; i < _windows; i++ ) {
+        int bit = i * _windowBits;
+        unsigned int digit = (words[ bit / 32 ] >> (bit % 32)) & mask;
+
+        if( digit != 0 ) {
+            sum = curve.addJacobian( sum, _table[ i * entries + digit ] );
+        }
+    }
+}
@@ -0,0 +1,164 @@
+#include "BigInteger.h"
+#include "FixedEcc.h"
+#include "util.h"
+
+/**
+ * ECFixedCurveBase for values of N words
+ */
+template<int N> class ECFixedCurve : public ECFixedCurveBase {
+
+private:
+    FixedCurve<N> _curve;
+
+    FixedBaseTable<N> _gTable;
+    FixedBaseTable<N> _qTable;
+
+    // Words of n, and the mask for the most significant one, for making
+    // random scalars
+    int _nWords;
+    unsigned int _nMask;
+
+public:
+    ECFixedCurve( const ECCurve &curve ) : _curve( curve )
+    {
+        int bits = _curve.n().getBitLength();
+
+        _nWords = (bits + 31) / 32;
+        _nMask = bits % 32 == 0 ? ~0u : (1u << (bits % 32)) - 1;
+    }
+
+    virtual int getWords()
+    {
+        return N;
+    }
+
+    virtual bool pointExists( const unsigned int *x, const unsigned int *y )
+    {
+        FixedBigInt<N> px( x );
+        FixedBigInt<N> py( y );
+
+        if( px >= _curve.fp().p() || py >= _curve.fp().p() ) {
+            return false;
+        }
+
+        return _curve.pointExists( _curve.encodePoint( px, py ) );
+    }
+
+    virtual bool decompressPoint( const unsigned int *x, int odd, unsigned int *y )
+    {
+        FixedPoint<N> p;
+
+        if( !_curve.decompressPoint( FixedBigInt<N>( x ), odd, p ) ) {
+            return false;
+        }
+
+        FixedBigInt<N> px;
+        FixedBigInt<N> py;
+        _curve.decodePoint( p, px, py );
+        py.getWords( y );
+
+        return true;
+    }
+
+    virtual void setBasePoints( ECPoint &g, ECPoint &q )
+    {
+        _gTable = FixedBaseTable<N>( _curve, _curve.encodePoint( FixedBigInt<N>( g.x ), FixedBigInt<N>( g.y ) ) );
+        _qTable = FixedBaseTable<N>( _curve, _curve.encodePoint( FixedBigInt<N>( q.x ), FixedBigInt<N>( q.y ) ) );
+    }
+
+    /**
+     * Random 1 < k < n, by rejection
+     */
+    virtual void randomScalar( unsigned int *k )
+    {
+        FixedBigInt<N> r;
+
+        do {
+            util::getRandomBytes( (unsigned char *)r.words, sizeof( unsigned int ) * _nWords );
+            r.words[ _nWords - 1 ] &= _nMask;
+        } while( r >= _curve.n() || r < FixedBigInt<N>( 2 ) );
+
+        r.getWords( k );
+    }
+
+    /**
+     * Computes a[i]G + b[i]Q for count pairs with the tables set by
+     * setBasePoints and one inversion. A sum that is the point at infinity
+     * is returned as (0, 0). With canonical set, a sum with an odd y is
+     * negated, together with its a and b
+     */
+    virtual void multiplyAdd( unsigned int *a, unsigned int *b, unsigned int *x, unsigned int *y, int count, bool canonical )
+    {
+        std::vector<FixedJacobian<N> > sums( count );
+        std::vector<FixedPoint<N> > affine( count );
+
+        for( int i = 0; i < count; i++ ) {
+            _gTable.multiplyAdd( _curve, FixedBigInt<N>( &a[ i * N ] ), sums[ i ] );
+            _qTable.multiplyAdd( _curve, FixedBigInt<N>( &b[ i * N ] ), sums[ i ] );
+        }
+
+        _curve.toAffine( &sums[ 0 ], &affine[ 0 ], count );
+
+        for( int i = 0; i < count; i++ ) {
+            FixedBigInt<N> px;
+            FixedBigInt<N> py;
+
+            if( !affine[ i ].infinity ) {
+                _curve.decodePoint( affine[ i ], px, py );
+            }
+
+            if( canonical && py.lsb() ) {
+                FixedBigInt<N>::sub( _curve.fp().p(), py, py );
+
+                FixedBigInt<N> k( &a[ i * N ] );
+                FixedBigInt<N>::sub( _curve.n(), k, k );
+                k.getWords( &a[ i * N ] );
+
+                k = FixedBigInt<N>( &b[ i * N ] );
+                FixedBigInt<N>::sub( _curve.n(), k, k );
+                k.getWords( &b[ i * N ] );
+            }
+
+            px.getWords( &x[ i * N ] );
+            py.getWords( &y[ i * N ] );
+        }
+    }
+};
+
+/**
+ * Gets the fixed-width routines for a curve, sized for the longer of p and
+ * n. Returns NULL if the curve is too large for them
+ */
+ECFixedCurveBase *getFixedCurve( const ECCurve &curve )
+{
+    int words = (int)curve.p().getLength32();
+
+    if( (int)curve.n().getLength32() > words ) {
+        words = (int)curve.n().getLength32();
+    }
+
+    if( words > FIXED_ECC_MAX_WORDS ) {
+        return NULL;
+    }
+
+    switch( words ) {
+        case 1: return new ECFixedCurve<1>( curve );
+        case 2: return new ECFixedCurve<2>( curve );
+        case 3: return new ECFixedCurve<3>( curve );
+        case 4: return new ECFixedCurve<4>( curve );
+        case 5: return new ECFixedCurve<5>( curve );
+        case 6: return new ECFixedCurve<6>( curve );
+        case 7: return new ECFixedCurve<7>( curve );
+        case 8: return new ECFixedCurve<8>( curve );
+        case 9: return new ECFixedCurve<9>( curve );
+        case 10: return new ECFixedCurve<10>( curve );
+        case 11: return new ECFixedCurve<11>( curve );
+        case 12: return new ECFixedCurve<12>( curve );
+        case 13: return new ECFixedCurve<13>( curve );
+        case 14: return new ECFixedCurve<14>( curve );
+        case 15: return new ECFixedCurve<15>( curve );
+        case 16: return new ECFixedCurve<16>( curve );
+        case 17: return new ECFixedCurve<17>( curve );
+        default: return NULL;
+    }
+}
@@ -1,8 +1,6 @@
 #ifndef _ECDL_PARAMS_H
 #define _ECDL_PARAMS_H
 
-#define NUM_R_POINTS 32
-
 #include <vector>
 #include "BigInteger.h"
 
@@ -16,6 +14,17 @@ typedef struct {
     BigInteger qx;
     BigInteger qy;
     unsigned int dBits;
+
+    // Walk on the classes {P, -P} instead of points
+    bool negation;
+
+    // Kangaroo walks for a logarithm known to be in [lower, upper), and how
+    // many of them the job expects to run at once
+    bool kangaroo;
+    BigInteger lower;
+    BigInteger upper;
+    unsigned int walks;
+
     std::vector<BigInteger> rx;
     std::vector<BigInteger> ry;
 }ECDLPParams;
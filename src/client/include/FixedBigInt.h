@@ -0,0 +1,411 @@
+#ifndef _FIXED_BIG_INT_H
+#define _FIXED_BIG_INT_H
+
+#include <string.h>
+#include "BigInteger.h"
+
+/**
+ * Unsigned integer of N 32-bit words, least significant first. It has value
+ * semantics and lives on the stack, so arithmetic on it never allocates.
+ * Conversion to and from BigInteger is for the boundaries only
+ */
+template<int N> class FixedBigInt {
+
+public:
+    unsigned int words[N];
+
+    FixedBigInt()
+    {
+        memset(words, 0, sizeof(words));
+    }
+
+    FixedBigInt(unsigned int value)
+    {
+        memset(words, 0, sizeof(words));
+        words[0] = value;
+    }
+
+    explicit FixedBigInt(const unsigned int *src)
+    {
+        memcpy(words, src, sizeof(words));
+    }
+
+    /**
+     * The value must fit in N words
+     */
+    explicit FixedBigInt(const BigInteger &value)
+    {
+        value.getWords(words, N);
+    }
+
+    BigInteger toBigInteger() const
+    {
+        return BigInteger(words, N);
+    }
+
+    void getWords(unsigned int *dest) const
+    {
+        memcpy(dest, words, sizeof(words));
+    }
+
+    bool isZero() const
+    {
+        for(int i = 0; i < N; i++) {
+            if(words[i] != 0) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    int lsb() const
+    {
+        return words[0] & 1;
+    }
+
+    int getBit(int i) const
+    {
+        return (words[i / 32] >> (i % 32)) & 1;
+    }
+
+    int getBitLength() const
+    {
+        for(int i = N - 1; i >= 0; i--) {
+            if(words[i] != 0) {
+                int bits = 32;
+                while(!(words[i] & (1u << (bits - 1)))) {
+                    bits--;
+                }
+                return i * 32 + bits;
+            }
+        }
+
+        return 0;
+    }
+
+    /**
+     * Returns -1, 0 or 1 as this is less than, equal to or greater than x
+     */
+    int compare(const FixedBigInt &x) const
+    {
+        for(int i = N - 1; i >= 0; i--) {
+            if(words[i] != x.words[i]) {
+                return words[i] < x.words[i] ? -1 : 1;
+            }
+        }
+
+        return 0;
+    }
+
+    bool operator==(const FixedBigInt &x) const
+    {
+        return compare(x) == 0;
+    }
+
+    bool operator!=(const FixedBigInt &x) const
+    {
+        return compare(x) != 0;
+    }
+
+    bool operator<(const FixedBigInt &x) const
+    {
+        return compare(x) < 0;
+    }
+
+    bool operator>=(const FixedBigInt &x) const
+    {
+        return compare(x) >= 0;
+    }
+
+    void shiftRight(int bits)
+    {
+        int wordShift = bits / 32;
+        int bitShift = bits % 32;
+
+        for(int i = 0; i < N; i++) {
+            unsigned int low = i + wordShift < N ? words[i + wordShift] : 0;
+            unsigned int high = i + wordShift + 1 < N ? words[i + wordShift + 1] : 0;
+
+            words[i] = bitShift == 0 ? low : (low >> bitShift) | (high << (32 - bitShift));
+        }
+    }
+
+    /**
+     * sum = a + b. Returns the carry
+     */
+    static unsigned int add(const FixedBigInt &a, const FixedBigInt &b, FixedBigInt &sum)
+    {
+        unsigned long long carry = 0;
+
+        for(int i = 0; i < N; i++) {
+            carry += (unsigned long long)a.words[i] + b.words[i];
+            sum.words[i] = (unsigned int)carry;
+            carry >>= 32;
+        }
+
+        return (unsigned int)carry;
+    }
+
+    /**
+     * diff = a - b. Returns the borrow
+     */
+    static unsigned int sub(const FixedBigInt &a, const FixedBigInt &b, FixedBigInt &diff)
+    {
+        unsigned int borrow = 0;
+
+        for(int i = 0; i < N; i++) {
+            unsigned long long d = (unsigned long long)a.words[i] - b.words[i] - borrow;
+            diff.words[i] = (unsigned int)d;
+            borrow = (unsigned int)(d >> 63);
+        }
+
+        return borrow;
+    }
+};
+
+/**
+ * Arithmetic mod an odd p < 2^(32N) on values in Montgomery form aR mod p,
+ * R = 2^(32N). Only the constructor uses BigInteger
+ */
+template<int N> class FixedFp {
+
+private:
+    FixedBigInt<N> _p;
+
+    // -p^-1 mod 2^32
+    unsigned int _pInv;
+
+    // R^2 mod p, for encoding
+    FixedBigInt<N> _r2;
+
+    // R mod p, which is 1 in Montgomery form
+    FixedBigInt<N> _one;
+
+public:
+    FixedFp()
+    {
+    }
+
+    FixedFp(const BigInteger &p) : _p(p)
+    {
+        // Newton iteration for p^-1 mod 2^32. Each step doubles the correct bits
+        unsigned int inv = _p.words[0];
+        for(int i = 0; i < 5; i++) {
+            inv *= 2 - _p.words[0] * inv;
+        }
+        _pInv = 0u - inv;
+
+        BigInteger r = BigInteger(2).pow(32 * N) % p;
+        _one = FixedBigInt<N>(r);
+        _r2 = FixedBigInt<N>((r * r) % p);
+    }
+
+    const FixedBigInt<N> &p() const
+    {
+        return _p;
+    }
+
+    const FixedBigInt<N> &one() const
+    {
+        return _one;
+    }
+
+    void add(const FixedBigInt<N> &a, const FixedBigInt<N> &b, FixedBigInt<N> &sum) const
+    {
+        unsigned int carry = FixedBigInt<N>::add(a, b, sum);
+
+        if(carry || sum >= _p) {
+            FixedBigInt<N>::sub(sum, _p, sum);
+        }
+    }
+
+    void sub(const FixedBigInt<N> &a, const FixedBigInt<N> &b, FixedBigInt<N> &diff) const
+    {
+        if(FixedBigInt<N>::sub(a, b, diff)) {
+            FixedBigInt<N>::add(diff, _p, diff);
+        }
+    }
+
+    void neg(const FixedBigInt<N> &a, FixedBigInt<N> &out) const
+    {
+        sub(FixedBigInt<N>(), a, out);
+    }
+
+    /**
+     * Montgomery multiplication, c = abR^-1 mod p. The product and the
+     * reduction are interleaved one word of b at a time
+     */
+    void multiply(const FixedBigInt<N> &a, const FixedBigInt<N> &b, FixedBigInt<N> &c) const
+    {
+        unsigned int t[N + 2];
+        memset(t, 0, sizeof(t));
+
+        for(int i = 0; i < N; i++) {
+            unsigned long long carry = 0;
+
+            for(int j = 0; j < N; j++) {
+                carry += (unsigned long long)a.words[j] * b.words[i] + t[j];
+                t[j] = (unsigned int)carry;
+                carry >>= 32;
+            }
+            carry += t[N];
+            t[N] = (unsigned int)carry;
+            t[N + 1] = (unsigned int)(carry >> 32);
+
+            // Add m * p so the lowest word becomes 0, and shift it out
+            unsigned int m = t[0] * _pInv;
+
+            carry = ((unsigned long long)m * _p.words[0] + t[0]) >> 32;
+            for(int j = 1; j < N; j++) {
+                carry += (unsigned long long)m * _p.words[j] + t[j];
+                t[j - 1] = (unsigned int)carry;
+                carry >>= 32;
+            }
+            carry += t[N];
+            t[N - 1] = (unsigned int)carry;
+            t[N] = t[N + 1] + (unsigned int)(carry >> 32);
+        }
+
+        memcpy(c.words, t, sizeof(c.words));
+
+        if(t[N] != 0 || c >= _p) {
+            FixedBigInt<N>::sub(c, _p, c);
+        }
+    }
+
+    void square(const FixedBigInt<N> &a, FixedBigInt<N> &c) const
+    {
+        multiply(a, a, c);
+    }
+
+    void encode(const FixedBigInt<N> &a, FixedBigInt<N> &encoded) const
+    {
+        multiply(a, _r2, encoded);
+    }
+
+    void decode(const FixedBigInt<N> &encoded, FixedBigInt<N> &a) const
+    {
+        multiply(encoded, FixedBigInt<N>(1), a);
+    }
+
+    /**
+     * result = base^e, left to right
+     */
+    void pow(const FixedBigInt<N> &base, const FixedBigInt<N> &e, FixedBigInt<N> &result) const
+    {
+        FixedBigInt<N> r = _one;
+
+        for(int i = e.getBitLength() - 1; i >= 0; i--) {
+            square(r, r);
+
+            if(e.getBit(i)) {
+                multiply(r, base, r);
+            }
+        }
+
+        result = r;
+    }
+
+    /**
+     * a^-1 as a^(p - 2). a must not be 0
+     */
+    void inverse(const FixedBigInt<N> &a, FixedBigInt<N> &inv) const
+    {
+        FixedBigInt<N> e;
+        FixedBigInt<N>::sub(_p, FixedBigInt<N>(2), e);
+
+        pow(a, e, inv);
+    }
+
+    /**
+     * Finds a square root of a with Tonelli-Shanks. Returns false if a is not
+     * a square
+     */
+    bool squareRoot(const FixedBigInt<N> &a, FixedBigInt<N> &root) const
+    {
+        if(a.isZero()) {
+            root = a;
+            return true;
+        }
+
+        // Euler's criterion, a^((p-1)/2) = 1
+        FixedBigInt<N> pMinus1;
+        FixedBigInt<N>::sub(_p, FixedBigInt<N>(1), pMinus1);
+
+        FixedBigInt<N> e = pMinus1;
+        e.shiftRight(1);
+
+        FixedBigInt<N> ls;
+        pow(a, e, ls);
+        if(ls != _one) {
+            return false;
+        }
+
+        // p - 1 = q * 2^s with q odd
+        int s = 0;
+        FixedBigInt<N> q = pMinus1;
+        while(!q.lsb()) {
+            q.shiftRight(1);
+            s++;
+        }
+
+        // r = a^((q+1)/2), t = a^q
+        FixedBigInt<N> qPlus1Half;
+        FixedBigInt<N>::add(q, FixedBigInt<N>(1), qPlus1Half);
+        qPlus1Half.shiftRight(1);
+
+        FixedBigInt<N> r;
+        pow(a, qPlus1Half, r);
+
+        if(s == 1) {
+            root = r;
+            return true;
+        }
+
+        // c = z^q for a quadratic non-residue z
+        FixedBigInt<N> minusOne;
+        neg(_one, minusOne);
+
+        FixedBigInt<N> z = _one;
+        do {
+            add(z, _one, z);
+            pow(z, e, ls);
+        }while(ls != minusOne);
+
+        FixedBigInt<N> c;
+        pow(z, q, c);
+
+        FixedBigInt<N> t;
+        pow(a, q, t);
+
+        int m = s;
+
+        while(t != _one) {
+            // Lowest i where t^(2^i) = 1
+            int i = 0;
+            FixedBigInt<N> t2i = t;
+            while(t2i != _one) {
+                square(t2i, t2i);
+                i++;
+            }
+
+            // b = c^(2^(m - i - 1))
+            FixedBigInt<N> b = c;
+            for(int j = 0; j < m - i - 1; j++) {
+                square(b, b);
+            }
+
+            multiply(r, b, r);
+            square(b, c);
+            multiply(t, c, t);
+            m = i;
+        }
+
+        root = r;
+
+        return true;
+    }
+};
+
+#endif
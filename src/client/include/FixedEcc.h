@@ -0,0 +1,495 @@
+#ifndef _FIXED_ECC_H
+#define _FIXED_ECC_H
+
+#include <vector>
+#include "FixedBigInt.h"
+#include "ecc.h"
+
+// Largest value in 32-bit words the fixed-width curve routines are compiled
+// for. One word more than a 512-bit field, since n can be longer than p
+#define FIXED_ECC_MAX_WORDS 17
+
+// Window size of the fixed-base tables
+#define FIXED_BASE_WINDOW_BITS 4
+
+/**
+ * Affine point with coordinates in Montgomery form
+ */
+template<int N> struct FixedPoint {
+    FixedBigInt<N> x;
+    FixedBigInt<N> y;
+    bool infinity;
+
+    FixedPoint() : infinity(true)
+    {
+    }
+};
+
+/**
+ * Jacobian point (X/Z^2, Y/Z^3) with coordinates in Montgomery form. Z = 0
+ * is the point at infinity
+ */
+template<int N> struct FixedJacobian {
+    FixedBigInt<N> x;
+    FixedBigInt<N> y;
+    FixedBigInt<N> z;
+};
+
+/**
+ * The routines of ECCurve on FixedBigInt<N>. p and n must fit in N words
+ */
+template<int N> class FixedCurve {
+
+private:
+    FixedFp<N> _fp;
+    FixedBigInt<N> _a;
+    FixedBigInt<N> _b;
+    FixedBigInt<N> _n;
+
+public:
+    FixedCurve()
+    {
+    }
+
+    FixedCurve(const ECCurve &curve) : _fp(curve.p())
+    {
+        _fp.encode(FixedBigInt<N>(curve.a()), _a);
+        _fp.encode(FixedBigInt<N>(curve.b()), _b);
+        _n = FixedBigInt<N>(curve.n());
+    }
+
+    const FixedFp<N> &fp() const
+    {
+        return _fp;
+    }
+
+    const FixedBigInt<N> &n() const
+    {
+        return _n;
+    }
+
+    /**
+     * Converts canonical x and y to a point
+     */
+    FixedPoint<N> encodePoint(const FixedBigInt<N> &x, const FixedBigInt<N> &y) const
+    {
+        FixedPoint<N> p;
+
+        _fp.encode(x, p.x);
+        _fp.encode(y, p.y);
+        p.infinity = false;
+
+        return p;
+    }
+
+    void decodePoint(const FixedPoint<N> &p, FixedBigInt<N> &x, FixedBigInt<N> &y) const
+    {
+        _fp.decode(p.x, x);
+        _fp.decode(p.y, y);
+    }
+
+    /**
+     * x^3 + ax + b
+     */
+    void rightSide(const FixedBigInt<N> &x, FixedBigInt<N> &out) const
+    {
+        FixedBigInt<N> t;
+
+        _fp.square(x, t);
+        _fp.add(t, _a, t);
+        _fp.multiply(t, x, t);
+        _fp.add(t, _b, out);
+    }
+
+    bool pointExists(const FixedPoint<N> &p) const
+    {
+        if(p.infinity) {
+            return false;
+        }
+
+        FixedBigInt<N> left;
+        FixedBigInt<N> right;
+
+        _fp.square(p.y, left);
+        rightSide(p.x, right);
+
+        return left == right;
+    }
+
+    FixedPoint<N> doubl(const FixedPoint<N> &p) const
+    {
+        if(p.infinity || p.y.isZero()) {
+            return FixedPoint<N>();
+        }
+
+        // s = (3x^2 + a) / 2y
+        FixedBigInt<N> t;
+        FixedBigInt<N> s;
+
+        _fp.add(p.y, p.y, t);
+        _fp.inverse(t, t);
+
+        _fp.square(p.x, s);
+        FixedBigInt<N> s3;
+        _fp.add(s, s, s3);
+        _fp.add(s3, s, s);
+        _fp.add(s, _a, s);
+        _fp.multiply(s, t, s);
+
+        return line(p, p, s);
+    }
+
+    FixedPoint<N> add(const FixedPoint<N> &p, const FixedPoint<N> &q) const
+    {
+        if(p.infinity) {
+            return q;
+        }
+
+        if(q.infinity) {
+            return p;
+        }
+
+        if(p.x == q.x) {
+            return p.y == q.y ? doubl(p) : FixedPoint<N>();
+        }
+
+        // s = (py - qy) / (px - qx)
+        FixedBigInt<N> run;
+        FixedBigInt<N> s;
+
+        _fp.sub(p.x, q.x, run);
+        _fp.inverse(run, run);
+        _fp.sub(p.y, q.y, s);
+        _fp.multiply(s, run, s);
+
+        return line(p, q, s);
+    }
+
+    /**
+     * The third point on the line through p and q with slope s, negated
+     */
+    FixedPoint<N> line(const FixedPoint<N> &p, const FixedPoint<N> &q, const FixedBigInt<N> &s) const
+    {
+        FixedPoint<N> r;
+
+        // rx = s^2 - px - qx
+        _fp.square(s, r.x);
+        _fp.sub(r.x, p.x, r.x);
+        _fp.sub(r.x, q.x, r.x);
+
+        // ry = s(px - rx) - py
+        _fp.sub(p.x, r.x, r.y);
+        _fp.multiply(r.y, s, r.y);
+        _fp.sub(r.y, p.y, r.y);
+
+        r.infinity = false;
+
+        return r;
+    }
+
+    FixedJacobian<N> toJacobian(const FixedPoint<N> &p) const
+    {
+        FixedJacobian<N> j;
+
+        if(!p.infinity) {
+            j.x = p.x;
+            j.y = p.y;
+            j.z = _fp.one();
+        }
+
+        return j;
+    }
+
+    FixedJacobian<N> doubleJacobian(const FixedJacobian<N> &p) const
+    {
+        if(p.z.isZero() || p.y.isZero()) {
+            return FixedJacobian<N>();
+        }
+
+        FixedBigInt<N> y2;
+        FixedBigInt<N> s;
+        FixedBigInt<N> m;
+        FixedBigInt<N> t;
+
+        // S = 4XY^2
+        _fp.square(p.y, y2);
+        _fp.multiply(p.x, y2, s);
+        _fp.add(s, s, s);
+        _fp.add(s, s, s);
+
+        // M = 3X^2 + aZ^4
+        _fp.square(p.x, m);
+        _fp.add(m, m, t);
+        _fp.add(t, m, m);
+        _fp.square(p.z, t);
+        _fp.square(t, t);
+        _fp.multiply(t, _a, t);
+        _fp.add(m, t, m);
+
+        FixedJacobian<N> r;
+
+        // X' = M^2 - 2S
+        _fp.square(m, r.x);
+        _fp.sub(r.x, s, r.x);
+        _fp.sub(r.x, s, r.x);
+
+        // Z' = 2YZ
+        _fp.multiply(p.y, p.z, r.z);
+        _fp.add(r.z, r.z, r.z);
+
+        // Y' = M(S - X') - 8Y^4
+        _fp.square(y2, t);
+        _fp.add(t, t, t);
+        _fp.add(t, t, t);
+        _fp.add(t, t, t);
+        _fp.sub(s, r.x, r.y);
+        _fp.multiply(r.y, m, r.y);
+        _fp.sub(r.y, t, r.y);
+
+        return r;
+    }
+
+    /**
+     * p + q for an affine q, which saves the multiplications by Z2
+     */
+    FixedJacobian<N> addMixed(const FixedJacobian<N> &p, const FixedPoint<N> &q) const
+    {
+        if(q.infinity) {
+            return p;
+        }
+
+        if(p.z.isZero()) {
+            return toJacobian(q);
+        }
+
+        FixedBigInt<N> z2;
+        FixedBigInt<N> u2;
+        FixedBigInt<N> s2;
+
+        // U2 = X2*Z1^2, S2 = Y2*Z1^3
+        _fp.square(p.z, z2);
+        _fp.multiply(q.x, z2, u2);
+        _fp.multiply(z2, p.z, s2);
+        _fp.multiply(s2, q.y, s2);
+
+        if(u2 == p.x) {
+            return s2 == p.y ? doubleJacobian(p) : FixedJacobian<N>();
+        }
+
+        FixedBigInt<N> h;
+        FixedBigInt<N> r;
+        FixedBigInt<N> h2;
+        FixedBigInt<N> h3;
+        FixedBigInt<N> t;
+
+        _fp.sub(u2, p.x, h);
+        _fp.sub(s2, p.y, r);
+        _fp.square(h, h2);
+        _fp.multiply(h2, h, h3);
+        _fp.multiply(p.x, h2, t);
+
+        FixedJacobian<N> out;
+
+        // X' = R^2 - H^3 - 2*U1*H^2
+        _fp.square(r, out.x);
+        _fp.sub(out.x, h3, out.x);
+        _fp.sub(out.x, t, out.x);
+        _fp.sub(out.x, t, out.x);
+
+        // Y' = R*(U1*H^2 - X') - S1*H^3
+        _fp.sub(t, out.x, out.y);
+        _fp.multiply(out.y, r, out.y);
+        _fp.multiply(p.y, h3, t);
+        _fp.sub(out.y, t, out.y);
+
+        // Z' = H*Z1
+        _fp.multiply(h, p.z, out.z);
+
+        return out;
+    }
+
+    /**
+     * Converts count points to affine with one inversion
+     */
+    void toAffine(const FixedJacobian<N> *p, FixedPoint<N> *out, int count) const
+    {
+        if(count <= 0) {
+            return;
+        }
+
+        // products[i] is the product of the z values of points 0 to i
+        std::vector<FixedBigInt<N> > products(count);
+        FixedBigInt<N> product = _fp.one();
+
+        for(int i = 0; i < count; i++) {
+            if(!p[i].z.isZero()) {
+                _fp.multiply(product, p[i].z, product);
+            }
+            products[i] = product;
+        }
+
+        FixedBigInt<N> inverse;
+        _fp.inverse(product, inverse);
+
+        for(int i = count - 1; i >= 0; i--) {
+            if(p[i].z.isZero()) {
+                out[i] = FixedPoint<N>();
+                continue;
+            }
+
+            FixedBigInt<N> zInv = inverse;
+            if(i > 0) {
+                _fp.multiply(zInv, products[i - 1], zInv);
+            }
+            _fp.multiply(inverse, p[i].z, inverse);
+
+            FixedBigInt<N> z2Inv;
+            _fp.square(zInv, z2Inv);
+            _fp.multiply(p[i].x, z2Inv, out[i].x);
+            _fp.multiply(z2Inv, zInv, z2Inv);
+            _fp.multiply(p[i].y, z2Inv, out[i].y);
+            out[i].infinity = false;
+        }
+    }
+
+    FixedPoint<N> toAffine(const FixedJacobian<N> &p) const
+    {
+        FixedPoint<N> out;
+        toAffine(&p, &out, 1);
+
+        return out;
+    }
+
+    /**
+     * kP, most significant bit first
+     */
+    FixedPoint<N> multiply(const FixedBigInt<N> &k, const FixedPoint<N> &p) const
+    {
+        FixedJacobian<N> r;
+
+        for(int i = k.getBitLength() - 1; i >= 0; i--) {
+            r = doubleJacobian(r);
+
+            if(k.getBit(i)) {
+                r = addMixed(r, p);
+            }
+        }
+
+        return toAffine(r);
+    }
+
+    /**
+     * Finds the point with canonical x whose y has the given parity. Returns
+     * false if there is none
+     */
+    bool decompressPoint(const FixedBigInt<N> &x, int odd, FixedPoint<N> &out) const
+    {
+        if(x >= _fp.p()) {
+            return false;
+        }
+
+        FixedBigInt<N> z;
+        FixedBigInt<N> root;
+
+        _fp.encode(x, out.x);
+        rightSide(out.x, z);
+
+        if(!_fp.squareRoot(z, root)) {
+            return false;
+        }
+
+        FixedBigInt<N> y;
+        _fp.decode(root, y);
+
+        if(y.lsb() != odd) {
+            _fp.neg(root, root);
+        }
+
+        out.y = root;
+        out.infinity = false;
+
+        return true;
+    }
+};
+
+/**
+ * Multiples of a fixed point for computing kP with additions only, like
+ * ECFixedBaseTable. Entry (i, j) is j * 2^(w * i) * P
+ */
+template<int N> class FixedBaseTable {
+
+private:
+    int _windows;
+    std::vector<FixedPoint<N> > _table;
+
+public:
+    FixedBaseTable() : _windows(0)
+    {
+    }
+
+    FixedBaseTable(const FixedCurve<N> &curve, const FixedPoint<N> &p)
+    {
+        int entries = 1 << FIXED_BASE_WINDOW_BITS;
+
+        _windows = (curve.n().getBitLength() + FIXED_BASE_WINDOW_BITS - 1) / FIXED_BASE_WINDOW_BITS;
+
+        std::vector<FixedJacobian<N> > table(_windows * entries);
+
+        FixedPoint<N> base = p;
+
+        for(int i = 0; i < _windows; i++) {
+            FixedJacobian<N> *row = &table[i * entries];
+
+            row[1] = curve.toJacobian(base);
+            for(int j = 2; j < entries; j++) {
+                row[j] = curve.addMixed(row[j - 1], base);
+            }
+
+            // Base for the next window is 2^w times the base of this one
+            base = curve.toAffine(curve.addMixed(row[entries - 1], base));
+        }
+
+        _table.resize(table.size());
+        curve.toAffine(&table[0], &_table[0], (int)table.size());
+    }
+
+    /**
+     * Adds kP to sum. k must be less than n
+     */
+    void multiplyAdd(const FixedCurve<N> &curve, const FixedBigInt<N> &k, FixedJacobian<N> &sum) const
+    {
+        int entries = 1 << FIXED_BASE_WINDOW_BITS;
+        unsigned int mask = entries - 1;
+
+        for(int i = 0; i < _windows; i++) {
+            int bit = i * FIXED_BASE_WINDOW_BITS;
+            unsigned int digit = (k.words[bit / 32] >> (bit % 32)) & mask;
+
+            if(digit != 0) {
+                sum = curve.addMixed(sum, _table[i * entries + digit]);
+            }
+        }
+    }
+};
+
+/**
+ * Fixed-width curve routines for a curve chosen at run time. Values are
+ * arrays of getWords() 32-bit words, least significant first
+ */
+class ECFixedCurveBase {
+
+public:
+    virtual ~ECFixedCurveBase() {}
+
+    virtual int getWords() = 0;
+    virtual bool pointExists(const unsigned int *x, const unsigned int *y) = 0;
+    virtual bool decompressPoint(const unsigned int *x, int odd, unsigned int *y) = 0;
+
+    virtual void setBasePoints(ECPoint &g, ECPoint &q) = 0;
+    virtual void randomScalar(unsigned int *k) = 0;
+    virtual void multiplyAdd(unsigned int *a, unsigned int *b, unsigned int *x, unsigned int *y, int count, bool canonical) = 0;
+};
+
+ECFixedCurveBase *getFixedCurve(const ECCurve &curve);
+
+#endif
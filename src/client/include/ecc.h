@@ -1,6 +1,7 @@
 #ifndef _ECC_H
 #define _ECC_H
 
+#include <vector>
 #include "BigInteger.h"
 
 typedef struct {
@@ -70,6 +71,7 @@ public:
     ECPoint multiply(BigInteger &k, ECPoint &p);
     ECPointJacobian toJacobian(ECPoint &p);
     ECPoint toAffine(ECPointJacobian &p);
+    void toAffine(ECPointJacobian *p, ECPoint *out, int count);
     ECPointJacobian addJacobian(ECPointJacobian &p, ECPointJacobian &q);
     ECPointJacobian doubleJacobian(ECPointJacobian &p);
 
@@ -85,6 +87,25 @@ public:
     ECCurve &operator=(const ECCurve &p);
 };
 
+/**
+ * Multiples of a fixed point for computing kP with additions only. Entry
+ * (i, j) is j * 2^(w * i) * P for a window of w bits, so kP is the sum of one
+ * entry per window of k
+ */
+class ECFixedBaseTable {
+
+private:
+    int _windowBits;
+    int _windows;
+    std::vector<ECPointJacobian> _table;
+
+public:
+    ECFixedBaseTable();
+    ECFixedBaseTable(ECCurve &curve, ECPoint &p, int windowBits = 4);
+
+    void multiplyAdd(ECCurve &curve, const BigInteger &k, ECPointJacobian &sum);
+};
+
 void generateRPoints(ECCurve &curve, ECPoint &q, BigInteger *aAra, BigInteger *bAra, BigInteger *xAra, BigInteger *yAra, int n);
 void compressPoint(ECPoint &point, unsigned char *encoded);
 bool decompressPoint(const ECCurve &curve, const unsigned char *encoded, int len, ECPoint &out);
@@ -2,14 +2,87 @@
 #define _LOGGER_H
 
 #include<string>
+#include<stdarg.h>
 
+#define LOG_LEVEL_ERROR 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_DEBUG 2
+
+// Most verbose level compiled in. Calls above it compile to nothing
+#ifndef LOG_MAX_LEVEL
+#define LOG_MAX_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+/**
+ * Logger for all threads. A message is formatted by the thread logging it
+ * into a fixed-size ring buffer, and a background thread writes the buffer
+ * out, so logging never waits for stdout or for another thread. When the
+ * buffer is full the message is dropped and the writer reports how many
+ * were. Messages still in the buffer are written when the program exits.
+ *
+ * Levels above LOG_MAX_LEVEL cost nothing, and levels above the one set
+ * with setLevel cost one comparison
+ */
 class Logger {
+
+private:
+    static int _level;
+
+    static void write(int level, const char *format, va_list args);
+
 public:
-    static void logInfo(std::string s);
-    static void logInfo(const char *format, ...);
+    static void setLevel(int level);
+    static int getLevel();
+    static int parseLevel(const std::string &name);
+
+    static void flush();
 
-    static void logError(std::string s);
-    static void logError(const char *format, ...);
+    static bool isEnabled(int level)
+    {
+        return level <= LOG_MAX_LEVEL && level <= _level;
+    }
+
+    static void logInfo(std::string s)
+    {
+        logInfo("%s", s.c_str());
+    }
+
+    static void logInfo(const char *format, ...)
+    {
+#if LOG_MAX_LEVEL >= LOG_LEVEL_INFO
+        if(isEnabled(LOG_LEVEL_INFO)) {
+            va_list args;
+            va_start(args, format);
+            write(LOG_LEVEL_INFO, format, args);
+            va_end(args);
+        }
+#endif
+    }
+
+    static void logError(std::string s)
+    {
+        logError("%s", s.c_str());
+    }
+
+    static void logError(const char *format, ...)
+    {
+        va_list args;
+        va_start(args, format);
+        write(LOG_LEVEL_ERROR, format, args);
+        va_end(args);
+    }
+
+    static void logDebug(const char *format, ...)
+    {
+#if LOG_MAX_LEVEL >= LOG_LEVEL_DEBUG
+        if(isEnabled(LOG_LEVEL_DEBUG)) {
+            va_list args;
+            va_start(args, format);
+            write(LOG_LEVEL_DEBUG, format, args);
+            va_end(args);
+        }
+#endif
+    }
 };
 
 #endif
@@ -38,9 +38,11 @@ public:
 };
 
 class Mutex {
+    friend class ConditionVariable;
+
 private:
 #ifdef WIN32
-	HANDLE handle;
+	CRITICAL_SECTION handle;
 #else
     pthread_mutex_t handle;
 #endif
@@ -53,4 +55,39 @@ public:
     void destroy();
 };
 
+class ConditionVariable {
+private:
+#ifdef WIN32
+    CONDITION_VARIABLE handle;
+#else
+    pthread_cond_t handle;
+#endif
+
+public:
+    ConditionVariable();
+    ~ConditionVariable();
+    void wait(Mutex &mutex);
+    bool wait(Mutex &mutex, unsigned int ms);
+    void signal();
+    void broadcast();
+    void destroy();
+};
+
+/*
+ * Atomic operations on 32-bit values. Loads have acquire and stores
+ * release semantics. The read-modify-write operations are full barriers
+ * and return the value held before
+ */
+unsigned int atomicLoad(volatile unsigned int *ptr);
+void atomicStore(volatile unsigned int *ptr, unsigned int value);
+unsigned int atomicCompareAndSwap(volatile unsigned int *ptr, unsigned int oldValue, unsigned int newValue);
+unsigned int atomicAdd(volatile unsigned int *ptr, unsigned int value);
+unsigned int atomicExchange(volatile unsigned int *ptr, unsigned int value);
+
+/*
+ * Restricts the calling thread to run on one logical core. Returns false
+ * when the platform does not support it or the core does not exist
+ */
+bool setThreadAffinity(int core);
+
 #endif
@@ -1,6 +1,8 @@
 #ifndef _UTIL_H
 #define _UTIL_H
 
+#include<stdio.h>
+#include<vector>
 #include"BigInteger.h"
 
 namespace util {
@@ -17,6 +19,12 @@ public:
 };
 
 unsigned int getSystemTime();
+unsigned long long getTimeMicros();
+int getNumCores();
+std::vector<int> getCpuList(bool physicalCores = false);
+int getNumaNode(int cpu);
+void sleep(unsigned int ms);
+void syncFile(FILE *fp);
 std::string hexEncode(const unsigned char *bytes, unsigned int len);
 void hexDecode(std::string hex, unsigned char *bytes);
 void printHex(unsigned long x);
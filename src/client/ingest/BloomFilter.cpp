@@ -0,0 +1,137 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "BloomFilter.h"
+
+#define BLOOM_MAGIC "ECBF"
+#define BLOOM_VERSION 1
+
+#define BLOOM_HEADER_SIZE 64
+
+// Words in a block, one cache line
+#define BLOOM_BLOCK_WORDS 8
+#define BLOOM_BLOCK_BITS 512
+
+#define BLOOM_HASHES 7
+
+/**
+ * The block comes from the low bits of the hash. The bits in it come from
+ * a second hash, 9 bits each, so they do not depend on the block
+ */
+static unsigned long long bitHash(unsigned long long hash)
+{
+    hash ^= hash >> 31;
+    hash *= 0x7fb5d329728ea185ULL;
+    hash ^= hash >> 27;
+
+    return hash;
+}
+
+/**
+ * Opens the filter, or creates it empty with at least the given number of
+ * bits. An existing filter of another size is replaced
+ */
+BloomFilter::BloomFilter(const std::string &path, unsigned long long bits)
+{
+    unsigned long long blocks = 1;
+    while(blocks * BLOOM_BLOCK_BITS < bits) {
+        blocks *= 2;
+    }
+    bits = blocks * BLOOM_BLOCK_BITS;
+
+    _mapSize = BLOOM_HEADER_SIZE + bits / 8;
+
+    _fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if(_fd < 0) {
+        throw std::string("Cannot open " + path + ": " + strerror(errno));
+    }
+
+    struct stat st;
+    fstat(_fd, &st);
+
+    bool valid = (size_t)st.st_size == _mapSize;
+
+    if(!valid && (ftruncate(_fd, 0) != 0 || ftruncate(_fd, _mapSize) != 0)) {
+        std::string err = strerror(errno);
+        close(_fd);
+        throw std::string("Cannot size " + path + ": " + err);
+    }
+
+    void *map = mmap(NULL, _mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+    if(map == MAP_FAILED) {
+        std::string err = strerror(errno);
+        close(_fd);
+        throw std::string("Cannot map " + path + ": " + err);
+    }
+
+    _header = (Header *)map;
+    _blocks = (unsigned long long *)((char *)map + BLOOM_HEADER_SIZE);
+    _blockMask = blocks - 1;
+
+    if(valid && (memcmp(_header->magic, BLOOM_MAGIC, 4) != 0 || _header->version != BLOOM_VERSION || _header->bits != bits)) {
+        memset(map, 0, _mapSize);
+        valid = false;
+    }
+
+    if(!valid) {
+        memcpy(_header->magic, BLOOM_MAGIC, 4);
+        _header->version = BLOOM_VERSION;
+        _header->bits = bits;
+        _header->logSize = 0;
+    }
+}
+
+BloomFilter::~BloomFilter()
+{
+    munmap(_header, _mapSize);
+    close(_fd);
+}
+
+void BloomFilter::add(unsigned long long hash)
+{
+    unsigned long long *block = &_blocks[(hash & _blockMask) * BLOOM_BLOCK_WORDS];
+    unsigned long long h = bitHash(hash);
+
+    for(int i = 0; i < BLOOM_HASHES; i++) {
+        unsigned int bit = (h >> (9 * i)) & (BLOOM_BLOCK_BITS - 1);
+        block[bit / 64] |= 1ULL << (bit % 64);
+    }
+}
+
+bool BloomFilter::mayContain(unsigned long long hash)
+{
+    const unsigned long long *block = &_blocks[(hash & _blockMask) * BLOOM_BLOCK_WORDS];
+    unsigned long long h = bitHash(hash);
+
+    for(int i = 0; i < BLOOM_HASHES; i++) {
+        unsigned int bit = (h >> (9 * i)) & (BLOOM_BLOCK_BITS - 1);
+
+        if((block[bit / 64] & (1ULL << (bit % 64))) == 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+unsigned long long BloomFilter::getLogSize()
+{
+    return _header->logSize;
+}
+
+/**
+ * Writes the filter to disk, and then the log size it holds
+ */
+void BloomFilter::sync(unsigned long long logSize)
+{
+    if(msync(_header, _mapSize, MS_SYNC) != 0) {
+        return;
+    }
+
+    _header->logSize = logSize;
+    msync(_header, BLOOM_HEADER_SIZE, MS_SYNC);
+}
@@ -0,0 +1,41 @@
+#ifndef _BLOOM_FILTER_H
+#define _BLOOM_FILTER_H
+
+#include <string>
+
+/**
+ * Blocked Bloom filter of point hashes, mapped from a file. Each hash
+ * selects one 512-bit block, a cache line, and sets 7 bits in it, so a
+ * lookup costs one cache miss. At 10 bits per point about 1 in 100
+ * lookups of a new point is a false positive
+ */
+class BloomFilter {
+
+private:
+    typedef struct {
+        char magic[4];
+        unsigned int version;
+        unsigned long long bits;
+
+        // Log size the filter holds every point of
+        unsigned long long logSize;
+    }Header;
+
+    int _fd;
+    Header *_header;
+    unsigned long long *_blocks;
+    unsigned long long _blockMask;
+    size_t _mapSize;
+
+public:
+    BloomFilter(const std::string &path, unsigned long long bits);
+    ~BloomFilter();
+
+    void add(unsigned long long hash);
+    bool mayContain(unsigned long long hash);
+
+    unsigned long long getLogSize();
+    void sync(unsigned long long logSize);
+};
+
+#endif
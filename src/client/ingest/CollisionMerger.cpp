@@ -0,0 +1,222 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <map>
+#include <sstream>
+
+#include "CollisionMerger.h"
+#include "logger.h"
+
+// Milliseconds between merges when nothing new is added
+#define MERGE_INTERVAL 10000
+
+// Milliseconds before a failed merge is tried again
+#define MERGE_RETRY_DELAY 30000
+
+// Most collisions written in one statement
+#define MERGE_BATCH_SIZE 1000
+
+CollisionMerger::CollisionMerger(const std::string &dir, PointStore *store)
+{
+    _store = store;
+    _path = dir + "/collisions.log";
+    _donePath = dir + "/collisions.done";
+
+    if(mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+        throw std::string("Cannot create " + dir + ": " + strerror(errno));
+    }
+
+    _fd = open(_path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if(_fd < 0) {
+        throw std::string("Cannot open " + _path + ": " + strerror(errno));
+    }
+
+    _thread = new Thread(mergeThread, this);
+}
+
+/**
+ * Records collisions of a job. Returns once they are on disk
+ */
+void CollisionMerger::add(const std::string &name, const std::vector<PointCollision> &collisions)
+{
+    if(collisions.empty()) {
+        return;
+    }
+
+    // One line per collision, the fields of the Collisions table in hex
+    std::string lines;
+
+    for(size_t i = 0; i < collisions.size(); i++) {
+        const PointCollision &c = collisions[i];
+        char len1[32];
+        char len2[32];
+
+        snprintf(len1, sizeof(len1), "%llu", c.point.length);
+        snprintf(len2, sizeof(len2), "%llu", c.length);
+
+        lines += name + " " + c.point.a.toString(16) + " " + c.point.b.toString(16) + " " + len1 + " "
+               + c.a.toString(16) + " " + c.b.toString(16) + " " + len2 + " "
+               + c.point.x.toString(16) + " " + c.point.y.toString(16) + "\n";
+    }
+
+    _mutex.grab();
+
+    size_t written = 0;
+    while(written < lines.size()) {
+        ssize_t n = write(_fd, lines.data() + written, lines.size() - written);
+
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if(n <= 0) {
+            std::string err = strerror(errno);
+            _mutex.release();
+            throw std::string("Error writing " + _path + ": " + err);
+        }
+
+        written += n;
+    }
+
+    fdatasync(_fd);
+
+    _added.signal();
+    _mutex.release();
+}
+
+void *CollisionMerger::mergeThread(void *p)
+{
+    ((CollisionMerger *)p)->merge();
+
+    return NULL;
+}
+
+unsigned long long CollisionMerger::readDone()
+{
+    FILE *fp = fopen(_donePath.c_str(), "r");
+
+    if(fp == NULL) {
+        return 0;
+    }
+
+    unsigned long long offset = 0;
+    if(fscanf(fp, "%llu", &offset) != 1) {
+        offset = 0;
+    }
+    fclose(fp);
+
+    return offset;
+}
+
+/**
+ * Records how much of the file is in the table. The file is replaced, so a
+ * crash leaves the old offset or the new one
+ */
+void CollisionMerger::writeDone(unsigned long long offset)
+{
+    std::string tmp = _donePath + ".new";
+
+    FILE *fp = fopen(tmp.c_str(), "w");
+    if(fp == NULL) {
+        throw std::string("Cannot write " + tmp + ": " + strerror(errno));
+    }
+
+    fprintf(fp, "%llu\n", offset);
+    fflush(fp);
+    fdatasync(fileno(fp));
+    fclose(fp);
+
+    if(rename(tmp.c_str(), _donePath.c_str()) != 0) {
+        throw std::string("Cannot rename " + tmp + ": " + strerror(errno));
+    }
+}
+
+/**
+ * Copies the collisions after the recorded offset to the table. A crash
+ * after the copy and before the offset is written copies them again, and
+ * the solver checks the same collision twice
+ */
+void CollisionMerger::merge()
+{
+    unsigned long long done = readDone();
+
+    for(;;) {
+        struct stat st;
+        fstat(_fd, &st);
+
+        unsigned long long size = st.st_size;
+
+        if(size <= done) {
+            _mutex.grab();
+            _added.wait(_mutex, MERGE_INTERVAL);
+            _mutex.release();
+            continue;
+        }
+
+        try {
+            std::string data(size - done, '\0');
+            if(pread(_fd, &data[0], data.size(), done) != (ssize_t)data.size()) {
+                throw std::string("Error reading " + _path);
+            }
+
+            // Only whole lines
+            size_t end = data.rfind('\n');
+            if(end == std::string::npos) {
+                continue;
+            }
+            data.resize(end + 1);
+
+            std::map<std::string, std::vector<PointCollision> > byJob;
+            std::istringstream lines(data);
+            std::string line;
+            int count = 0;
+
+            while(std::getline(lines, line)) {
+                std::istringstream fields(line);
+                std::string name, a1, b1, a2, b2, x, y;
+                PointCollision c;
+
+                if(!(fields >> name >> a1 >> b1 >> c.point.length >> a2 >> b2 >> c.length >> x >> y)) {
+                    Logger::logError("Skipping invalid line in " + _path + ": " + line);
+                    continue;
+                }
+
+                c.point.a = BigInteger(a1, 16);
+                c.point.b = BigInteger(b1, 16);
+                c.a = BigInteger(a2, 16);
+                c.b = BigInteger(b2, 16);
+                c.point.x = BigInteger(x, 16);
+                c.point.y = BigInteger(y, 16);
+
+                std::vector<PointCollision> &job = byJob[name];
+                job.push_back(c);
+                count++;
+
+                if(job.size() >= MERGE_BATCH_SIZE) {
+                    _store->insertCollisions(name, job);
+                    job.clear();
+                }
+            }
+
+            for(std::map<std::string, std::vector<PointCollision> >::iterator i = byJob.begin(); i != byJob.end(); i++) {
+                _store->insertCollisions(i->first, i->second);
+            }
+
+            done += data.size();
+            writeDone(done);
+
+            Logger::logInfo("Moved %d collision(s) to the database", count);
+        } catch(std::string err) {
+            Logger::logError("Error moving collisions to the database: " + err);
+
+            _mutex.grab();
+            _added.wait(_mutex, MERGE_RETRY_DELAY);
+            _mutex.release();
+        }
+    }
+}
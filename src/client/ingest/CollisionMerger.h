@@ -0,0 +1,41 @@
+#ifndef _COLLISION_MERGER_H
+#define _COLLISION_MERGER_H
+
+#include <string>
+#include <vector>
+
+#include "PointStore.h"
+#include "threads.h"
+
+/**
+ * Moves the collisions found in the point indexes to the Collisions table.
+ * They are first appended to a file, so a submission does not wait on the
+ * database and nothing is lost while it is down. A thread copies what is
+ * new in the file to the table and records how far it got
+ */
+class CollisionMerger {
+
+private:
+    PointStore *_store;
+
+    std::string _path;
+    std::string _donePath;
+    int _fd;
+
+    Mutex _mutex;
+    ConditionVariable _added;
+
+    Thread *_thread;
+
+    static void *mergeThread(void *p);
+    void merge();
+    unsigned long long readDone();
+    void writeDone(unsigned long long offset);
+
+public:
+    CollisionMerger(const std::string &dir, PointStore *store);
+
+    void add(const std::string &name, const std::vector<PointCollision> &collisions);
+};
+
+#endif
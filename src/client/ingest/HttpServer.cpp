@@ -0,0 +1,343 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "HttpServer.h"
+#include "logger.h"
+#include "threads.h"
+
+// Longest request line and headers
+#define HTTP_MAX_HEADER_SIZE 16384
+
+// Seconds an idle connection is kept open
+#define HTTP_IDLE_TIMEOUT 60
+
+typedef struct {
+    HttpServer *server;
+    int fd;
+    std::string address;
+}Connection;
+
+static const char *statusText(int status)
+{
+    switch(status) {
+        case 200:
+            return "OK";
+        case 400:
+            return "Bad Request";
+        case 404:
+            return "Not Found";
+        case 405:
+            return "Method Not Allowed";
+        case 411:
+            return "Length Required";
+        case 413:
+            return "Payload Too Large";
+        case 415:
+            return "Unsupported Media Type";
+        case 429:
+            return "Too Many Requests";
+        case 500:
+            return "Internal Server Error";
+        case 503:
+            return "Service Unavailable";
+    }
+
+    return "Unknown";
+}
+
+static std::string toLower(const std::string &s)
+{
+    std::string lower = s;
+
+    for(size_t i = 0; i < lower.size(); i++) {
+        if(lower[i] >= 'A' && lower[i] <= 'Z') {
+            lower[i] = lower[i] - 'A' + 'a';
+        }
+    }
+
+    return lower;
+}
+
+static std::string trim(const std::string &s)
+{
+    size_t start = s.find_first_not_of(" \t");
+    size_t end = s.find_last_not_of(" \t\r");
+
+    if(start == std::string::npos) {
+        return "";
+    }
+
+    return s.substr(start, end - start + 1);
+}
+
+static bool sendAll(int fd, const std::string &data)
+{
+    size_t sent = 0;
+
+    while(sent < data.size()) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if(n <= 0) {
+            return false;
+        }
+
+        sent += n;
+    }
+
+    return true;
+}
+
+static bool sendResponse(int fd, const HttpResponse &response, bool keepAlive)
+{
+    char line[64];
+    snprintf(line, sizeof(line), "HTTP/1.1 %d %s\r\n", response.status, statusText(response.status));
+
+    std::string out = line;
+
+    if(!response.contentType.empty()) {
+        out += "Content-Type: " + response.contentType + "\r\n";
+    }
+
+    for(size_t i = 0; i < response.headers.size(); i++) {
+        out += response.headers[i].first + ": " + response.headers[i].second + "\r\n";
+    }
+
+    snprintf(line, sizeof(line), "Content-Length: %d\r\n", (int)response.body.size());
+    out += line;
+    out += keepAlive ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+    out += "\r\n";
+    out += response.body;
+
+    return sendAll(fd, out);
+}
+
+static HttpResponse errorResponse(int status)
+{
+    HttpResponse response;
+    response.status = status;
+
+    return response;
+}
+
+HttpServer::HttpServer(unsigned short port, size_t maxBodySize,
+                       void (*handler)(const HttpRequest &, HttpResponse &, void *),
+                       void *handlerData)
+{
+    _port = port;
+    _maxBodySize = maxBodySize;
+    _handler = handler;
+    _handlerData = handlerData;
+
+    _socket = socket(AF_INET, SOCK_STREAM, 0);
+    if(_socket < 0) {
+        throw std::string("Error creating socket: ") + strerror(errno);
+    }
+
+    int on = 1;
+    setsockopt(_socket, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+
+    if(bind(_socket, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(_socket, SOMAXCONN) != 0) {
+        std::string err = strerror(errno);
+        close(_socket);
+        throw std::string("Error listening on port: ") + err;
+    }
+}
+
+HttpServer::~HttpServer()
+{
+    close(_socket);
+}
+
+/**
+ * Accepts connections until the process exits
+ */
+void HttpServer::run()
+{
+    Logger::logInfo("Listening on port %d", _port);
+
+    for(;;) {
+        struct sockaddr_in peer;
+        socklen_t peerLength = sizeof(peer);
+
+        int fd = accept(_socket, (struct sockaddr *)&peer, &peerLength);
+
+        if(fd < 0) {
+            if(errno != EINTR) {
+                Logger::logError("Error accepting connection: %s", strerror(errno));
+            }
+            continue;
+        }
+
+        struct timeval timeout;
+        timeout.tv_sec = HTTP_IDLE_TIMEOUT;
+        timeout.tv_usec = 0;
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        Connection *c = new Connection;
+        c->server = this;
+        c->fd = fd;
+
+        char address[INET_ADDRSTRLEN] = {0};
+        if(inet_ntop(AF_INET, &peer.sin_addr, address, sizeof(address)) != NULL) {
+            c->address = address;
+        }
+
+        try {
+            Thread t(connectionThread, c);
+        } catch(...) {
+            Logger::logError("Error creating connection thread");
+            close(fd);
+            delete c;
+        }
+    }
+}
+
+void *HttpServer::connectionThread(void *p)
+{
+    Connection *c = (Connection *)p;
+
+    // Nothing joins the thread
+    pthread_detach(pthread_self());
+
+    c->server->serve(c->fd, c->address);
+
+    close(c->fd);
+    delete c;
+
+    return NULL;
+}
+
+/**
+ * Reads requests from the connection and answers them until the client
+ * closes it or a request cannot be read
+ */
+void HttpServer::serve(int fd, const std::string &address)
+{
+    std::string buf;
+    char chunk[8192];
+
+    for(;;) {
+        // Read the request line and headers
+        size_t headerEnd;
+        while((headerEnd = buf.find("\r\n\r\n")) == std::string::npos) {
+            if(buf.size() > HTTP_MAX_HEADER_SIZE) {
+                sendResponse(fd, errorResponse(400), false);
+                return;
+            }
+
+            ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+            if(n < 0 && errno == EINTR) {
+                continue;
+            }
+            if(n <= 0) {
+                return;
+            }
+            buf.append(chunk, n);
+        }
+
+        HttpRequest request;
+        request.remoteAddress = address;
+
+        size_t lineEnd = buf.find("\r\n");
+        std::string requestLine = buf.substr(0, lineEnd);
+
+        size_t s1 = requestLine.find(' ');
+        size_t s2 = requestLine.find(' ', s1 + 1);
+        if(s1 == std::string::npos || s2 == std::string::npos) {
+            sendResponse(fd, errorResponse(400), false);
+            return;
+        }
+
+        request.method = requestLine.substr(0, s1);
+        request.path = requestLine.substr(s1 + 1, s2 - s1 - 1);
+        std::string version = requestLine.substr(s2 + 1);
+
+        size_t pos = lineEnd + 2;
+        while(pos < headerEnd) {
+            size_t end = buf.find("\r\n", pos);
+            std::string line = buf.substr(pos, end - pos);
+            pos = end + 2;
+
+            size_t colon = line.find(':');
+            if(colon == std::string::npos) {
+                continue;
+            }
+
+            request.headers[toLower(trim(line.substr(0, colon)))] = trim(line.substr(colon + 1));
+        }
+
+        buf.erase(0, headerEnd + 4);
+
+        // HTTP/1.1 keeps the connection open unless the client asks not to
+        std::string connection = toLower(request.headers["connection"]);
+        bool keepAlive = version == "HTTP/1.1" ? connection != "close" : connection == "keep-alive";
+
+        if(request.headers.count("transfer-encoding") > 0) {
+            sendResponse(fd, errorResponse(411), false);
+            return;
+        }
+
+        size_t length = 0;
+        if(request.headers.count("content-length") > 0) {
+            length = strtoul(request.headers["content-length"].c_str(), NULL, 10);
+        }
+
+        if(length > _maxBodySize) {
+            sendResponse(fd, errorResponse(413), false);
+            return;
+        }
+
+        // A client that sent Expect: 100-continue waits for this before the body
+        if(toLower(request.headers["expect"]) == "100-continue" && buf.size() < length) {
+            if(!sendAll(fd, "HTTP/1.1 100 Continue\r\n\r\n")) {
+                return;
+            }
+        }
+
+        while(buf.size() < length) {
+            ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+            if(n < 0 && errno == EINTR) {
+                continue;
+            }
+            if(n <= 0) {
+                return;
+            }
+            buf.append(chunk, n);
+        }
+
+        request.body = buf.substr(0, length);
+        buf.erase(0, length);
+
+        HttpResponse response;
+        response.status = 500;
+
+        try {
+            _handler(request, response, _handlerData);
+        } catch(std::string err) {
+            Logger::logError("Error handling request: " + err);
+            response = errorResponse(500);
+        }
+
+        if(!sendResponse(fd, response, keepAlive) || !keepAlive) {
+            return;
+        }
+    }
+}
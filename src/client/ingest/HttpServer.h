@@ -0,0 +1,57 @@
+#ifndef _HTTP_SERVER_H
+#define _HTTP_SERVER_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+ * A request. Header names are lower case
+ */
+typedef struct {
+    std::string method;
+    std::string path;
+    std::map<std::string, std::string> headers;
+    std::string body;
+
+    // Address of the peer
+    std::string remoteAddress;
+}HttpRequest;
+
+typedef struct {
+    int status;
+    std::string contentType;
+    std::vector<std::pair<std::string, std::string> > headers;
+    std::string body;
+}HttpResponse;
+
+/**
+ * Minimal HTTP/1.1 server for the ingestion service. Each connection is
+ * served by its own thread and may carry several requests. Requests must
+ * give the length of their body, chunked bodies are not understood
+ */
+class HttpServer {
+
+private:
+    int _socket;
+    unsigned short _port;
+
+    // Longest body accepted. Longer requests get 413
+    size_t _maxBodySize;
+
+    void (*_handler)(const HttpRequest &, HttpResponse &, void *);
+    void *_handlerData;
+
+    static void *connectionThread(void *p);
+    void serve(int fd, const std::string &address);
+
+public:
+    HttpServer(unsigned short port, size_t maxBodySize,
+               void (*handler)(const HttpRequest &, HttpResponse &, void *),
+               void *handlerData);
+    ~HttpServer();
+
+    void run();
+};
+
+#endif
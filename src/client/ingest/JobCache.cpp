@@ -0,0 +1,134 @@
+#include "JobCache.h"
+#include "logger.h"
+#include "util.h"
+
+std::string Job::getStatus()
+{
+    mutex.grab();
+    std::string status = record.status;
+    mutex.release();
+
+    return status;
+}
+
+unsigned int Job::getMaxBits()
+{
+    mutex.grab();
+    unsigned int bits = record.maxBits;
+    mutex.release();
+
+    return bits;
+}
+
+JobCache::JobCache(PointStore *store, unsigned int ttl, const std::string &pointDir, unsigned long long filterBits)
+{
+    _store = store;
+    _ttl = ttl;
+    _pointDir = pointDir;
+    _filterBits = filterBits;
+}
+
+/**
+ * Reads the state of a job again. Other threads keep the old state until
+ * it is read
+ */
+void JobCache::refresh(Job *job)
+{
+    unsigned int now = util::getSystemTime();
+
+    job->mutex.grab();
+
+    if(now - job->refreshed < _ttl) {
+        job->mutex.release();
+        return;
+    }
+
+    // Only one thread reads it
+    job->refreshed = now;
+    JobRecord state = job->record;
+    job->mutex.release();
+
+    try {
+        if(!_store->loadJobState(job->name, state)) {
+            return;
+        }
+    } catch(std::string err) {
+        Logger::logError("Error reading the state of job %s: %s", job->name.c_str(), err.c_str());
+        return;
+    }
+
+    job->mutex.grab();
+    job->record.status = state.status;
+    job->record.activeBits = state.activeBits;
+    job->record.maxBits = state.maxBits;
+    job->mutex.release();
+}
+
+/**
+ * Returns the job with the given name, or NULL if there is none
+ */
+Job *JobCache::get(const std::string &name)
+{
+    _mutex.grab();
+    std::map<std::string, Job *>::iterator i = _jobs.find(name);
+    Job *job = i == _jobs.end() ? NULL : i->second;
+    _mutex.release();
+
+    if(job != NULL) {
+        refresh(job);
+        return job;
+    }
+
+    JobRecord record;
+    if(!_store->loadJob(name, record)) {
+        return NULL;
+    }
+
+    const ECDLPParams &params = record.params;
+
+    unsigned int numRPoints = params.rx.size();
+    if(numRPoints == 0 || (numRPoints & (numRPoints - 1)) != 0) {
+        throw std::string("Job " + name + " has an invalid number of R points");
+    }
+
+    job = new Job;
+    job->name = name;
+    job->record = record;
+    job->curve = ECCurve(params.p, params.n, params.a, params.b, params.gx, params.gy);
+    job->fixedCurve = getFixedCurve(job->curve);
+    job->points = NULL;
+    job->refreshed = util::getSystemTime();
+
+    // Another thread may have loaded it meanwhile. The index is opened under
+    // the lock so that it is opened once
+    _mutex.grab();
+    i = _jobs.find(name);
+    if(i != _jobs.end()) {
+        Job *loaded = i->second;
+        _mutex.release();
+
+        delete job->fixedCurve;
+        delete job;
+
+        return loaded;
+    }
+
+    if(!_pointDir.empty()) {
+        try {
+            job->points = new PointIndex(_pointDir + "/" + name, _filterBits);
+        } catch(std::string err) {
+            _mutex.release();
+            delete job->fixedCurve;
+            delete job;
+            throw;
+        }
+        Logger::logInfo("Job %s has %llu points", name.c_str(), job->points->size());
+    }
+
+    _jobs[name] = job;
+    _mutex.release();
+
+    Logger::logInfo("Loaded job %s", name.c_str());
+
+    return job;
+}
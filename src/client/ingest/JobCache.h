@@ -0,0 +1,69 @@
+#ifndef _JOB_CACHE_H
+#define _JOB_CACHE_H
+
+#include <map>
+#include <string>
+
+#include "ecc.h"
+#include "FixedEcc.h"
+#include "PointIndex.h"
+#include "PointStore.h"
+#include "threads.h"
+
+/**
+ * A job whose points are being submitted. The parameters do not change.
+ * The status and distinguished bits do, and are read under the mutex
+ */
+class Job {
+
+public:
+    std::string name;
+    JobRecord record;
+
+    ECCurve curve;
+
+    // Fixed-width routines for verifying points, or NULL when the curve is
+    // too large for them
+    ECFixedCurveBase *fixedCurve;
+
+    // Points of the job when they are not kept in the database
+    PointIndex *points;
+
+    Mutex mutex;
+
+    // When the state was last read, in milliseconds
+    unsigned int refreshed;
+
+    std::string getStatus();
+    unsigned int getMaxBits();
+};
+
+/**
+ * Jobs by name, loaded from the store when first used. Their state is read
+ * again when it is older than the TTL so that a solved job tells its
+ * clients to stop. Jobs are never freed
+ */
+class JobCache {
+
+private:
+    PointStore *_store;
+    unsigned int _ttl;
+
+    // Directory of the point indexes, empty to keep points in the database
+    std::string _pointDir;
+
+    // Bits of the filter in front of each index, 0 for none
+    unsigned long long _filterBits;
+
+    std::map<std::string, Job *> _jobs;
+    Mutex _mutex;
+
+    void refresh(Job *job);
+
+public:
+    JobCache(PointStore *store, unsigned int ttl, const std::string &pointDir, unsigned long long filterBits = 0);
+
+    Job *get(const std::string &name);
+};
+
+#endif
@@ -0,0 +1,228 @@
+#include <string.h>
+
+#include "MemoryPointStore.h"
+
+/**
+ * The key of a point, the compressed end point as the server stores it
+ */
+static std::string endPointKey(const StoredPoint &point)
+{
+    return (point.y.lsb() ? "03" : "02") + point.x.toString(16);
+}
+
+/**
+ * Adds a job and its empty table of points, or replaces its record and
+ * keeps the points
+ */
+void MemoryPointStore::addJob(const std::string &name, const JobRecord &job)
+{
+    _mutex.grab();
+    _jobs[name] = job;
+    _points[name];
+    _mutex.release();
+}
+
+/**
+ * The points of a job. Throws as a missing table would. Called with the
+ * mutex held
+ */
+std::map<std::string, StoredPoint> &MemoryPointStore::table(const std::string &name)
+{
+    std::map<std::string, std::map<std::string, StoredPoint> >::iterator i = _points.find(name);
+
+    if(i == _points.end()) {
+        throw std::string("Database error: no points table for " + name);
+    }
+
+    return i->second;
+}
+
+size_t MemoryPointStore::pointCount(const std::string &name)
+{
+    _mutex.grab();
+
+    size_t count = 0;
+    try {
+        count = table(name).size();
+    } catch(std::string err) {
+        _mutex.release();
+        throw;
+    }
+
+    _mutex.release();
+
+    return count;
+}
+
+std::vector<PointCollision> MemoryPointStore::collisions(const std::string &name)
+{
+    _mutex.grab();
+    std::vector<PointCollision> collisions = _collisions[name];
+    _mutex.release();
+
+    return collisions;
+}
+
+/**
+ * The walk stats recorded for a client. Returns false if there are none
+ */
+bool MemoryPointStore::walkStats(const std::string &name, const std::string &client, WalkStats &stats)
+{
+    _mutex.grab();
+
+    std::map<std::string, WalkStats> &clients = _walkStats[name];
+    std::map<std::string, WalkStats>::iterator i = clients.find(client);
+
+    bool found = i != clients.end();
+    if(found) {
+        stats = i->second;
+    }
+
+    _mutex.release();
+
+    return found;
+}
+
+bool MemoryPointStore::loadJob(const std::string &name, JobRecord &job)
+{
+    if(!isValidName(name)) {
+        return false;
+    }
+
+    _mutex.grab();
+
+    std::map<std::string, JobRecord>::iterator i = _jobs.find(name);
+
+    bool found = i != _jobs.end();
+    if(found) {
+        job = i->second;
+    }
+
+    _mutex.release();
+
+    return found;
+}
+
+bool MemoryPointStore::loadJobState(const std::string &name, JobRecord &job)
+{
+    if(!isValidName(name)) {
+        return false;
+    }
+
+    _mutex.grab();
+
+    std::map<std::string, JobRecord>::iterator i = _jobs.find(name);
+
+    bool found = i != _jobs.end();
+    if(found) {
+        job.status = i->second.status;
+        job.activeBits = i->second.activeBits;
+        job.maxBits = i->second.maxBits;
+    }
+
+    _mutex.release();
+
+    return found;
+}
+
+/**
+ * Stores the points the way MySQLPointStore does. The first walk to reach
+ * an end point is stored, also within one submission
+ */
+int MemoryPointStore::insertPoints(const std::string &name, const std::vector<StoredPoint> &points, unsigned int &duplicates)
+{
+    duplicates = 0;
+
+    _mutex.grab();
+
+    std::vector<PointCollision> found;
+
+    try {
+        std::map<std::string, StoredPoint> &stored = table(name);
+
+        for(size_t i = 0; i < points.size(); i++) {
+            std::string key = endPointKey(points[i]);
+            std::map<std::string, StoredPoint>::iterator s = stored.find(key);
+
+            if(s == stored.end()) {
+                stored[key] = points[i];
+            } else if(s->second.a == points[i].a && s->second.b == points[i].b) {
+                duplicates++;
+            } else {
+                PointCollision c;
+                c.point = points[i];
+                c.a = s->second.a;
+                c.b = s->second.b;
+                c.length = s->second.length;
+                found.push_back(c);
+            }
+        }
+    } catch(std::string err) {
+        _mutex.release();
+        throw;
+    }
+
+    std::vector<PointCollision> &collisions = _collisions[name];
+    collisions.insert(collisions.end(), found.begin(), found.end());
+
+    _mutex.release();
+
+    return (int)found.size();
+}
+
+void MemoryPointStore::insertCollisions(const std::string &name, const std::vector<PointCollision> &collisions)
+{
+    _mutex.grab();
+
+    std::vector<PointCollision> &stored = _collisions[name];
+    stored.insert(stored.end(), collisions.begin(), collisions.end());
+
+    _mutex.release();
+}
+
+void MemoryPointStore::deletePoint(const std::string &name, const StoredPoint &point)
+{
+    _mutex.grab();
+
+    try {
+        std::map<std::string, StoredPoint> &stored = table(name);
+        std::map<std::string, StoredPoint>::iterator s = stored.find(endPointKey(point));
+
+        if(s != stored.end() && s->second.a == point.a && s->second.b == point.b) {
+            stored.erase(s);
+        }
+    } catch(std::string err) {
+        _mutex.release();
+        throw;
+    }
+
+    _mutex.release();
+}
+
+void MemoryPointStore::recordWalkStats(const std::string &name, const std::string &client, const WalkStats &stats, unsigned long long)
+{
+    _mutex.grab();
+
+    std::map<std::string, WalkStats> &clients = _walkStats[name];
+    std::map<std::string, WalkStats>::iterator i = clients.find(client);
+
+    if(i == clients.end()) {
+        WalkStats zero;
+        memset(&zero, 0, sizeof(zero));
+        i = clients.insert(std::make_pair(client, zero)).first;
+    }
+
+    WalkStats &total = i->second;
+    total.submissions += stats.submissions;
+    total.points += stats.points;
+    total.steps += stats.steps;
+    total.duplicates += stats.duplicates;
+    total.collisions += stats.collisions;
+    total.dropped += stats.dropped;
+
+    for(int b = 0; b < WALK_LENGTH_BUCKETS; b++) {
+        total.histogram[b] += stats.histogram[b];
+    }
+
+    _mutex.release();
+}
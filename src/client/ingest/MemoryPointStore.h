@@ -0,0 +1,50 @@
+#ifndef _MEMORY_POINT_STORE_H
+#define _MEMORY_POINT_STORE_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "PointStore.h"
+#include "threads.h"
+
+/**
+ * Keeps jobs and points in memory, for testing what uses a PointStore
+ * without a database. Jobs are added with addJob. The collisions and walk
+ * stats written are kept for the test to read
+ */
+class MemoryPointStore : public PointStore {
+
+private:
+    std::map<std::string, JobRecord> _jobs;
+
+    // Points of each job by end point
+    std::map<std::string, std::map<std::string, StoredPoint> > _points;
+
+    std::map<std::string, std::vector<PointCollision> > _collisions;
+
+    // Walk stats by job and client
+    std::map<std::string, std::map<std::string, WalkStats> > _walkStats;
+
+    Mutex _mutex;
+
+    std::map<std::string, StoredPoint> &table(const std::string &name);
+
+public:
+    void addJob(const std::string &name, const JobRecord &job);
+
+    size_t pointCount(const std::string &name);
+    std::vector<PointCollision> collisions(const std::string &name);
+    bool walkStats(const std::string &name, const std::string &client, WalkStats &stats);
+
+    bool loadJob(const std::string &name, JobRecord &job);
+    bool loadJobState(const std::string &name, JobRecord &job);
+
+    int insertPoints(const std::string &name, const std::vector<StoredPoint> &points, unsigned int &duplicates);
+    void insertCollisions(const std::string &name, const std::vector<PointCollision> &collisions);
+    void deletePoint(const std::string &name, const StoredPoint &point);
+
+    void recordWalkStats(const std::string &name, const std::string &client, const WalkStats &stats, unsigned long long now);
+};
+
+#endif
@@ -0,0 +1,479 @@
+#include <stdlib.h>
+#include <map>
+#include <errmsg.h>
+
+#include "MySQLPointStore.h"
+
+static std::string toHex(const BigInteger &value)
+{
+    return value.toString(16);
+}
+
+/**
+ * The key of a point in a job's table, as the server writes it
+ */
+static std::string encodeEndPoint(const BigInteger &x, const BigInteger &y)
+{
+    return (y.lsb() ? "03" : "02") + toHex(x);
+}
+
+static BigInteger fromHex(const char *value)
+{
+    if(value == NULL) {
+        throw std::string("Unexpected NULL value");
+    }
+
+    return BigInteger(std::string(value), 16);
+}
+
+static std::string toString(unsigned long long value)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%llu", value);
+
+    return buf;
+}
+
+MySQLPointStore::MySQLPointStore(const std::string &host, const std::string &user, const std::string &password, int connections)
+{
+    _host = host;
+    _user = user;
+    _password = password;
+
+    // Must be done before any other thread uses the client library
+    if(mysql_library_init(0, NULL, NULL) != 0) {
+        throw std::string("Error initializing the MySQL library");
+    }
+
+    for(int i = 0; i < connections; i++) {
+        _idle.push_back(connect());
+    }
+}
+
+MySQLPointStore::~MySQLPointStore()
+{
+    for(size_t i = 0; i < _idle.size(); i++) {
+        mysql_close(_idle[i]);
+    }
+
+    mysql_library_end();
+}
+
+MYSQL *MySQLPointStore::connect()
+{
+    MYSQL *db = mysql_init(NULL);
+
+    if(db == NULL) {
+        throw std::string("Out of memory");
+    }
+
+    if(mysql_real_connect(db, _host.c_str(), _user.c_str(), _password.c_str(), ECDL_DB_NAME, 0, NULL, 0) == NULL) {
+        std::string err = mysql_error(db);
+        mysql_close(db);
+        throw std::string("Error connecting to the database: ") + err;
+    }
+
+    return db;
+}
+
+/**
+ * Takes a connection from the pool, waiting until one is idle
+ */
+MYSQL *MySQLPointStore::acquire()
+{
+    // Every thread that uses the client library needs its state. Does
+    // nothing when the thread already has it
+    mysql_thread_init();
+
+    _mutex.grab();
+
+    while(_idle.empty()) {
+        _available.wait(_mutex);
+    }
+
+    MYSQL *db = _idle.back();
+    _idle.pop_back();
+
+    _mutex.release();
+
+    return db;
+}
+
+void MySQLPointStore::release(MYSQL *db)
+{
+    _mutex.grab();
+    _idle.push_back(db);
+    _available.signal();
+    _mutex.release();
+}
+
+/**
+ * Runs a statement. A statement that failed because the connection was
+ * lost is run once more on a new connection
+ */
+void MySQLPointStore::query(MYSQL *&db, const std::string &sql)
+{
+    if(mysql_real_query(db, sql.data(), sql.size()) == 0) {
+        return;
+    }
+
+    unsigned int err = mysql_errno(db);
+
+    if(err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST) {
+        MYSQL *fresh = connect();
+        mysql_close(db);
+        db = fresh;
+
+        if(mysql_real_query(db, sql.data(), sql.size()) == 0) {
+            return;
+        }
+    }
+
+    throw std::string("Database error: ") + mysql_error(db);
+}
+
+MYSQL_RES *MySQLPointStore::select(MYSQL *&db, const std::string &sql)
+{
+    query(db, sql);
+
+    MYSQL_RES *result = mysql_store_result(db);
+
+    if(result == NULL) {
+        throw std::string("Database error: ") + mysql_error(db);
+    }
+
+    return result;
+}
+
+/**
+ * Reads the status and distinguished bits of a job. Returns false if there
+ * is no such job
+ */
+bool MySQLPointStore::readJobState(MYSQL *&db, const std::string &name, JobRecord &job)
+{
+    MYSQL_RES *result = select(db, "SELECT DBits, ActiveDBits, MaxDBits FROM JobParams WHERE Name='" + name + "';");
+    MYSQL_ROW row = mysql_fetch_row(result);
+
+    if(row == NULL) {
+        mysql_free_result(result);
+        return false;
+    }
+
+    unsigned int dBits = atoi(row[0]);
+    unsigned int activeBits = atoi(row[1]);
+    unsigned int maxBits = atoi(row[2]);
+    mysql_free_result(result);
+
+    // 0 means DBits, for jobs from before the bits could be changed
+    job.activeBits = activeBits == 0 ? dBits : activeBits;
+    job.maxBits = dBits;
+
+    if(maxBits > job.maxBits) {
+        job.maxBits = maxBits;
+    }
+    if(job.activeBits > job.maxBits) {
+        job.maxBits = job.activeBits;
+    }
+
+    result = select(db, "SELECT Status FROM JobInfo WHERE Name='" + name + "';");
+    row = mysql_fetch_row(result);
+    job.status = (row != NULL && row[0] != NULL) ? row[0] : "";
+    mysql_free_result(result);
+
+    return true;
+}
+
+/**
+ * Loads the parameters, R points and state of a job. Returns false if there
+ * is no such job
+ */
+bool MySQLPointStore::loadJob(const std::string &name, JobRecord &job)
+{
+    if(!isValidName(name)) {
+        return false;
+    }
+
+    MYSQL *db = acquire();
+
+    try {
+        MYSQL_RES *result = select(db, "SELECT P, A, B, N, Gx, Gy, Qx, Qy, DBits, Negation, Walk, Lower, Upper FROM JobParams WHERE Name='" + name + "';");
+        MYSQL_ROW row = mysql_fetch_row(result);
+
+        if(row == NULL) {
+            mysql_free_result(result);
+            release(db);
+            return false;
+        }
+
+        try {
+            job.params.p = fromHex(row[0]);
+            job.params.a = fromHex(row[1]);
+            job.params.b = fromHex(row[2]);
+            job.params.n = fromHex(row[3]);
+            job.params.gx = fromHex(row[4]);
+            job.params.gy = fromHex(row[5]);
+            job.params.qx = fromHex(row[6]);
+            job.params.qy = fromHex(row[7]);
+            job.params.dBits = atoi(row[8]);
+            job.params.negation = atoi(row[9]) != 0;
+            job.params.kangaroo = std::string(row[10]) == "kangaroo";
+            job.params.lower = fromHex(row[11]);
+            job.params.upper = fromHex(row[12]);
+        } catch(std::string err) {
+            mysql_free_result(result);
+            throw;
+        }
+        mysql_free_result(result);
+
+        job.params.rx.clear();
+        job.params.ry.clear();
+        job.ra.clear();
+        job.rb.clear();
+
+        result = select(db, "SELECT A, B, X, Y FROM RPoints WHERE Name='" + name + "' ORDER BY Idx;");
+
+        try {
+            while((row = mysql_fetch_row(result)) != NULL) {
+                job.ra.push_back(fromHex(row[0]));
+                job.rb.push_back(fromHex(row[1]));
+                job.params.rx.push_back(fromHex(row[2]));
+                job.params.ry.push_back(fromHex(row[3]));
+            }
+        } catch(std::string err) {
+            mysql_free_result(result);
+            throw;
+        }
+        mysql_free_result(result);
+
+        bool found = readJobState(db, name, job);
+        release(db);
+
+        return found;
+    } catch(std::string err) {
+        release(db);
+        throw;
+    }
+}
+
+/**
+ * Reloads the status and distinguished bits of a job
+ */
+bool MySQLPointStore::loadJobState(const std::string &name, JobRecord &job)
+{
+    if(!isValidName(name)) {
+        return false;
+    }
+
+    MYSQL *db = acquire();
+
+    try {
+        bool found = readJobState(db, name, job);
+        release(db);
+
+        return found;
+    } catch(std::string err) {
+        release(db);
+        throw;
+    }
+}
+
+/**
+ * Writes points to the table of a job with one statement. A point whose
+ * end point is already stored was reached by another walk. Those are found
+ * with a second statement and written to the collisions table, except for
+ * points a client sent twice, which are counted in duplicates. Returns the
+ * number of collisions
+ */
+int MySQLPointStore::insertPoints(const std::string &name, const std::vector<StoredPoint> &points, unsigned int &duplicates)
+{
+    duplicates = 0;
+
+    if(points.empty()) {
+        return 0;
+    }
+
+    std::vector<std::string> a(points.size());
+    std::vector<std::string> b(points.size());
+    std::vector<std::string> end(points.size());
+
+    std::string sql = "INSERT IGNORE INTO " + name + "(StartA, StartB, EndPoint, WalkLength) VALUES ";
+
+    for(size_t i = 0; i < points.size(); i++) {
+        a[i] = toHex(points[i].a);
+        b[i] = toHex(points[i].b);
+        end[i] = encodeEndPoint(points[i].x, points[i].y);
+
+        if(i > 0) {
+            sql += ",";
+        }
+        sql += "('" + a[i] + "','" + b[i] + "','" + end[i] + "'," + toString(points[i].length) + ")";
+    }
+    sql += ";";
+
+    MYSQL *db = acquire();
+
+    try {
+        query(db, sql);
+
+        my_ulonglong written = mysql_affected_rows(db);
+
+        if(written == (my_ulonglong)points.size()) {
+            release(db);
+            return 0;
+        }
+
+        // Every point that was not written now has a row from another walk
+        sql = "SELECT StartA, StartB, EndPoint, WalkLength FROM " + name + " WHERE EndPoint IN (";
+        for(size_t i = 0; i < points.size(); i++) {
+            if(i > 0) {
+                sql += ",";
+            }
+            sql += "'" + end[i] + "'";
+        }
+        sql += ");";
+
+        std::map<std::string, MYSQL_ROW> stored;
+
+        MYSQL_RES *result = select(db, sql);
+        MYSQL_ROW row;
+        while((row = mysql_fetch_row(result)) != NULL) {
+            stored[row[2]] = row;
+        }
+
+        std::vector<PointCollision> collisions;
+
+        for(size_t i = 0; i < points.size(); i++) {
+            std::map<std::string, MYSQL_ROW>::iterator s = stored.find(end[i]);
+
+            // The row is the point itself, or the same walk sent again
+            if(s == stored.end() || (a[i] == s->second[0] && b[i] == s->second[1])) {
+                continue;
+            }
+
+            PointCollision c;
+            c.point = points[i];
+            c.a = fromHex(s->second[0]);
+            c.b = fromHex(s->second[1]);
+            c.length = strtoull(s->second[3], NULL, 10);
+            collisions.push_back(c);
+        }
+
+        mysql_free_result(result);
+
+        if(!collisions.empty()) {
+            query(db, collisionsStatement(name, collisions));
+        }
+
+        release(db);
+
+        // The rest were not written because the walk was stored already
+        duplicates = (unsigned int)(points.size() - written - collisions.size());
+
+        return (int)collisions.size();
+    } catch(std::string err) {
+        release(db);
+        throw;
+    }
+}
+
+std::string MySQLPointStore::collisionsStatement(const std::string &name, const std::vector<PointCollision> &collisions)
+{
+    std::string sql = "INSERT INTO Collisions(Name, A1, B1, WalkLength1, A2, B2, WalkLength2, X, Y) VALUES ";
+
+    for(size_t i = 0; i < collisions.size(); i++) {
+        const PointCollision &c = collisions[i];
+
+        if(i > 0) {
+            sql += ",";
+        }
+        sql += "('" + name + "','" + toHex(c.point.a) + "','" + toHex(c.point.b) + "'," + toString(c.point.length) + ",'"
+             + toHex(c.a) + "','" + toHex(c.b) + "'," + toString(c.length) + ",'"
+             + toHex(c.point.x) + "','" + toHex(c.point.y) + "')";
+    }
+    sql += ";";
+
+    return sql;
+}
+
+/**
+ * Writes collisions found outside the database
+ */
+void MySQLPointStore::insertCollisions(const std::string &name, const std::vector<PointCollision> &collisions)
+{
+    if(collisions.empty()) {
+        return;
+    }
+
+    MYSQL *db = acquire();
+
+    try {
+        query(db, collisionsStatement(name, collisions));
+        release(db);
+    } catch(std::string err) {
+        release(db);
+        throw;
+    }
+}
+
+/**
+ * Adds the counters of a submission to the walk stats of a client, the way
+ * the server does
+ */
+void MySQLPointStore::recordWalkStats(const std::string &name, const std::string &client, const WalkStats &stats, unsigned long long now)
+{
+    std::string sql = "INSERT INTO WalkStats(Name, Client, Submissions, Points, Steps, Duplicates, Collisions, Dropped, FirstSeen, LastSeen) VALUES('"
+                    + name + "','" + client + "'," + toString(stats.submissions) + "," + toString(stats.points) + ","
+                    + toString(stats.steps) + "," + toString(stats.duplicates) + "," + toString(stats.collisions) + ","
+                    + toString(stats.dropped) + "," + toString(now) + "," + toString(now) + ") "
+                    + "ON DUPLICATE KEY UPDATE Submissions = Submissions + VALUES(Submissions), Points = Points + VALUES(Points), "
+                    + "Steps = Steps + VALUES(Steps), Duplicates = Duplicates + VALUES(Duplicates), "
+                    + "Collisions = Collisions + VALUES(Collisions), Dropped = Dropped + VALUES(Dropped), LastSeen = VALUES(LastSeen);";
+
+    std::string lengths;
+    for(int i = 0; i < WALK_LENGTH_BUCKETS; i++) {
+        if(stats.histogram[i] == 0) {
+            continue;
+        }
+
+        if(!lengths.empty()) {
+            lengths += ",";
+        }
+        lengths += "('" + name + "','" + client + "'," + toString(i) + "," + toString(stats.histogram[i]) + ")";
+    }
+
+    MYSQL *db = acquire();
+
+    try {
+        query(db, sql);
+
+        if(!lengths.empty()) {
+            query(db, "INSERT INTO WalkLengths(Name, Client, Bucket, Count) VALUES " + lengths
+                      + " ON DUPLICATE KEY UPDATE Count = Count + VALUES(Count);");
+        }
+
+        release(db);
+    } catch(std::string err) {
+        release(db);
+        throw;
+    }
+}
+
+/**
+ * Removes a point that failed a check. Only the row of that walk is
+ * removed, not one another walk wrote for the same end point
+ */
+void MySQLPointStore::deletePoint(const std::string &name, const StoredPoint &point)
+{
+    std::string sql = "DELETE FROM " + name + " WHERE EndPoint='" + encodeEndPoint(point.x, point.y)
+                    + "' AND StartA='" + toHex(point.a) + "' AND StartB='" + toHex(point.b) + "';";
+
+    MYSQL *db = acquire();
+
+    try {
+        query(db, sql);
+        release(db);
+    } catch(std::string err) {
+        release(db);
+        throw;
+    }
+}
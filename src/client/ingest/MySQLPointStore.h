@@ -0,0 +1,54 @@
+#ifndef _MYSQL_POINT_STORE_H
+#define _MYSQL_POINT_STORE_H
+
+#include <string>
+#include <vector>
+#include <mysql.h>
+
+#include "PointStore.h"
+#include "threads.h"
+
+// Database the server keeps its jobs in
+#define ECDL_DB_NAME "ecdl"
+
+/**
+ * The server's MySQL tables. Connections are pooled so that submissions
+ * are written in parallel, and a connection the server dropped is opened
+ * again
+ */
+class MySQLPointStore : public PointStore {
+
+private:
+    std::string _host;
+    std::string _user;
+    std::string _password;
+
+    std::vector<MYSQL *> _idle;
+    Mutex _mutex;
+    ConditionVariable _available;
+
+    MYSQL *connect();
+    MYSQL *acquire();
+    void release(MYSQL *db);
+
+    void query(MYSQL *&db, const std::string &sql);
+    MYSQL_RES *select(MYSQL *&db, const std::string &sql);
+
+    bool readJobState(MYSQL *&db, const std::string &name, JobRecord &job);
+    static std::string collisionsStatement(const std::string &name, const std::vector<PointCollision> &collisions);
+
+public:
+    MySQLPointStore(const std::string &host, const std::string &user, const std::string &password, int connections);
+    ~MySQLPointStore();
+
+    bool loadJob(const std::string &name, JobRecord &job);
+    bool loadJobState(const std::string &name, JobRecord &job);
+
+    int insertPoints(const std::string &name, const std::vector<StoredPoint> &points, unsigned int &duplicates);
+    void insertCollisions(const std::string &name, const std::vector<PointCollision> &collisions);
+    void deletePoint(const std::string &name, const StoredPoint &point);
+
+    void recordWalkStats(const std::string &name, const std::string &client, const WalkStats &stats, unsigned long long now);
+};
+
+#endif
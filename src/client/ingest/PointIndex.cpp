@@ -0,0 +1,862 @@
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "PointIndex.h"
+#include "logger.h"
+#include "util.h"
+
+#define INDEX_MAGIC "ECDI"
+#define INDEX_VERSION 1
+
+// The table starts after the header, on a cache line
+#define INDEX_HEADER_SIZE 64
+
+// Slots probed together, one cache line
+#define INDEX_BUCKET_SIZE 8
+
+#define INDEX_INITIAL_CAPACITY (1ULL << 20)
+
+// Milliseconds between checkpoints of the table
+#define INDEX_CHECKPOINT_INTERVAL 60000
+
+// A slot holds the top 24 bits of the hash and the log offset plus 1, so
+// that an empty slot is 0. An offset of all ones marks a removed point
+#define INDEX_OFFSET_BITS 40
+#define INDEX_OFFSET_MASK ((1ULL << INDEX_OFFSET_BITS) - 1)
+#define INDEX_REMOVED INDEX_OFFSET_MASK
+
+#define RECORD_POINT 1
+#define RECORD_REMOVED 2
+
+// Size and checksum before each record
+#define RECORD_HEADER_SIZE 8
+
+// Longest record body, for 512-bit values
+#define RECORD_MAX_SIZE 1024
+
+#define LOG_READ_SIZE (1 << 20)
+
+// Points the filter answered for that are held before being put in the
+// table
+#define INDEX_DEFERRED_POINTS 65536
+
+static unsigned int fnv32(const unsigned char *data, size_t len)
+{
+    unsigned int h = 2166136261u;
+
+    for(size_t i = 0; i < len; i++) {
+        h = (h ^ data[i]) * 16777619u;
+    }
+
+    return h;
+}
+
+/**
+ * 64-bit hash of a compressed point. The low bits of x are 0 for every
+ * distinguished point, so the bytes are mixed again at the end
+ */
+static unsigned long long hashPoint(const std::string &x, int parity)
+{
+    unsigned long long h = 14695981039346656037ULL;
+
+    for(size_t i = 0; i < x.size(); i++) {
+        h = (h ^ (unsigned char)x[i]) * 1099511628211ULL;
+    }
+    h = (h ^ (unsigned int)parity) * 1099511628211ULL;
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return h;
+}
+
+static std::string toBytes(const BigInteger &value)
+{
+    std::string bytes(value.getByteLength(), '\0');
+    value.getBytes((unsigned char *)&bytes[0], bytes.size());
+
+    return bytes;
+}
+
+static void appendVarint(std::string &buf, unsigned long long value)
+{
+    while(value >= 0x80) {
+        buf += (char)((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    buf += (char)value;
+}
+
+static void appendField(std::string &buf, const std::string &bytes)
+{
+    buf += (char)bytes.size();
+    buf += bytes;
+}
+
+static void appendInt(std::string &buf, unsigned int value)
+{
+    for(int i = 0; i < 4; i++) {
+        buf += (char)(value >> (8 * i));
+    }
+}
+
+static unsigned int readInt(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+/**
+ * Reads a record body. Returns false if it is not valid
+ */
+static bool parseBody(const unsigned char *p, size_t len, int &type, unsigned long long &length,
+                      std::string &a, std::string &b, std::string &x, int &parity)
+{
+    size_t i = 0;
+
+    if(len < 1) {
+        return false;
+    }
+    type = p[i++];
+
+    length = 0;
+    for(int shift = 0; ; shift += 7) {
+        if(i >= len || shift > 63) {
+            return false;
+        }
+        length |= (unsigned long long)(p[i] & 0x7f) << shift;
+        if((p[i++] & 0x80) == 0) {
+            break;
+        }
+    }
+
+    std::string *fields[] = {&a, &b, &x};
+    for(int f = 0; f < 3; f++) {
+        if(i >= len || i + 1 + p[i] > len) {
+            return false;
+        }
+        fields[f]->assign((const char *)p + i + 1, p[i]);
+        i += 1 + p[i];
+    }
+
+    if(i + 1 != len) {
+        return false;
+    }
+    parity = p[i];
+
+    return type == RECORD_POINT || type == RECORD_REMOVED;
+}
+
+/**
+ * Opens the points in a directory, creating it if needed. With filterBits
+ * a Bloom filter of that size is kept in front of the table
+ */
+PointIndex::PointIndex(const std::string &dir, unsigned long long filterBits)
+{
+    _dir = dir;
+    _header = NULL;
+    _table = NULL;
+    _tableFd = -1;
+    _filter = NULL;
+
+    if(mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+        throw std::string("Cannot create " + dir + ": " + strerror(errno));
+    }
+
+    std::string logPath = dir + "/points.log";
+    _logFd = open(logPath.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if(_logFd < 0) {
+        throw std::string("Cannot open " + logPath + ": " + strerror(errno));
+    }
+
+    struct stat st;
+    fstat(_logFd, &st);
+    _logSize = st.st_size;
+
+    if(filterBits > 0) {
+        _filter = new BloomFilter(dir + "/points.bloom", filterBits);
+    }
+
+    recover();
+
+    _lastCheckpoint = util::getSystemTime();
+}
+
+PointIndex::~PointIndex()
+{
+    checkpoint();
+    closeTable();
+    close(_logFd);
+
+    delete _filter;
+}
+
+unsigned long long PointIndex::hash(const BigInteger &x, int parity)
+{
+    return hashPoint(toBytes(x), parity);
+}
+
+/**
+ * Maps the table. A new one is created empty. Returns false if an existing
+ * one is not valid
+ */
+bool PointIndex::openTable(const std::string &path, unsigned long long capacity, bool create)
+{
+    _tableFd = open(path.c_str(), create ? (O_RDWR | O_CREAT | O_TRUNC) : O_RDWR, 0644);
+    if(_tableFd < 0) {
+        if(!create && errno == ENOENT) {
+            return false;
+        }
+        throw std::string("Cannot open " + path + ": " + strerror(errno));
+    }
+
+    if(create) {
+        if(ftruncate(_tableFd, INDEX_HEADER_SIZE + capacity * sizeof(unsigned long long)) != 0) {
+            std::string err = strerror(errno);
+            close(_tableFd);
+            throw std::string("Cannot size " + path + ": " + err);
+        }
+    }
+
+    struct stat st;
+    fstat(_tableFd, &st);
+    _mapSize = st.st_size;
+
+    void *map = MAP_FAILED;
+    if(_mapSize >= INDEX_HEADER_SIZE) {
+        map = mmap(NULL, _mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, _tableFd, 0);
+    }
+
+    if(map == MAP_FAILED) {
+        close(_tableFd);
+        if(!create) {
+            return false;
+        }
+        throw std::string("Cannot map " + path + ": " + strerror(errno));
+    }
+
+    _header = (Header *)map;
+    _table = (unsigned long long *)((char *)map + INDEX_HEADER_SIZE);
+
+    if(create) {
+        memcpy(_header->magic, INDEX_MAGIC, 4);
+        _header->version = INDEX_VERSION;
+        _header->capacity = capacity;
+        _header->used = 0;
+        _header->points = 0;
+        _header->logSize = 0;
+
+        return true;
+    }
+
+    capacity = _header->capacity;
+
+    if(memcmp(_header->magic, INDEX_MAGIC, 4) != 0 || _header->version != INDEX_VERSION
+       || capacity < INDEX_BUCKET_SIZE || (capacity & (capacity - 1)) != 0
+       || _mapSize != INDEX_HEADER_SIZE + capacity * sizeof(unsigned long long)) {
+        closeTable();
+        return false;
+    }
+
+    return true;
+}
+
+void PointIndex::closeTable()
+{
+    if(_header != NULL) {
+        munmap(_header, _mapSize);
+        close(_tableFd);
+        _header = NULL;
+        _table = NULL;
+    }
+}
+
+/**
+ * Opens the table and brings it up to the end of the log. Slots written
+ * after the last checkpoint may or may not have reached the disk, so they
+ * are dropped and their records added again
+ */
+void PointIndex::recover()
+{
+    std::string path = _dir + "/points.idx";
+
+    if(!openTable(path, 0, false) || _header->logSize > _logSize) {
+        closeTable();
+        Logger::logInfo("Building the point index in %s", _dir.c_str());
+        rebuild(INDEX_INITIAL_CAPACITY);
+        return;
+    }
+
+    unsigned long long capacity = _header->capacity;
+    unsigned long long limit = _header->logSize;
+    unsigned long long used = 0;
+    unsigned long long points = 0;
+
+    for(unsigned long long i = 0; i < capacity; i++) {
+        unsigned long long e = _table[i];
+
+        if(e == 0) {
+            continue;
+        }
+        used++;
+
+        unsigned long long offset = e & INDEX_OFFSET_MASK;
+        if(offset == INDEX_REMOVED) {
+            continue;
+        }
+
+        // Keeping the slot keeps the probe sequences of others intact
+        if(offset - 1 >= limit) {
+            _table[i] = (e & ~INDEX_OFFSET_MASK) | INDEX_REMOVED;
+            continue;
+        }
+        points++;
+    }
+
+    _header->used = used;
+    _header->points = points;
+
+    // The filter may have been checkpointed at another time. Adding what
+    // the table already has again changes nothing
+    unsigned long long from = limit;
+    if(_filter != NULL && _filter->getLogSize() < from) {
+        from = _filter->getLogSize();
+    }
+
+    if(!replay(from)) {
+        rebuild(capacity * 2);
+        return;
+    }
+
+    checkpoint();
+}
+
+/**
+ * Builds a new table from the whole log, doubling it until it holds all of
+ * it
+ */
+void PointIndex::rebuild(unsigned long long capacity)
+{
+    std::string path = _dir + "/points.idx";
+    std::string tmp = path + ".new";
+
+    closeTable();
+    _deferred.clear();
+
+    for(;;) {
+        openTable(tmp, capacity, true);
+
+        if(replay(0)) {
+            break;
+        }
+
+        closeTable();
+        capacity *= 2;
+    }
+
+    checkpoint();
+
+    if(rename(tmp.c_str(), path.c_str()) != 0) {
+        throw std::string("Cannot rename " + tmp + ": " + strerror(errno));
+    }
+}
+
+/**
+ * Adds the records of the log from an offset to the table. A record cut
+ * short by a crash ends the log, and is removed. Returns false if the
+ * table became too full
+ */
+bool PointIndex::replay(unsigned long long from)
+{
+    std::vector<unsigned char> buf;
+    unsigned long long bufStart = from;
+    unsigned long long offset = from;
+
+    while(offset < _logSize) {
+        size_t pos = offset - bufStart;
+
+        // Read more when the buffer does not hold the next record
+        bool complete = buf.size() >= pos + RECORD_HEADER_SIZE
+                        && (readInt(&buf[pos]) > RECORD_MAX_SIZE
+                            || buf.size() >= pos + RECORD_HEADER_SIZE + readInt(&buf[pos]));
+
+        if(!complete) {
+            buf.erase(buf.begin(), buf.begin() + pos);
+            bufStart = offset;
+
+            size_t have = buf.size();
+            size_t want = LOG_READ_SIZE;
+            if(bufStart + want > _logSize) {
+                want = _logSize - bufStart;
+            }
+            if(want <= have) {
+                break;
+            }
+
+            buf.resize(want);
+            ssize_t n = pread(_logFd, &buf[have], want - have, bufStart + have);
+            if(n <= 0) {
+                break;
+            }
+            buf.resize(have + n);
+            continue;
+        }
+
+        unsigned int size = readInt(&buf[pos]);
+        if(size > RECORD_MAX_SIZE) {
+            break;
+        }
+        const unsigned char *body = &buf[pos + RECORD_HEADER_SIZE];
+
+        Record r;
+        std::string a;
+        std::string b;
+
+        if(readInt(&buf[pos + 4]) != fnv32(body, size)
+           || !parseBody(body, size, r.type, r.length, a, b, r.x, r.parity)) {
+            break;
+        }
+
+        if(r.type == RECORD_POINT) {
+            if((_header->used + 1) * 4 > _header->capacity * 3) {
+                return false;
+            }
+            add(offset, r, NULL);
+
+            if(_filter != NULL) {
+                _filter->add(hashPoint(r.x, r.parity));
+            }
+        } else {
+            bool found;
+            unsigned long long slot = find(r, NULL, found);
+            if(found) {
+                _table[slot] |= INDEX_REMOVED;
+                _header->points--;
+            }
+        }
+
+        offset += RECORD_HEADER_SIZE + size;
+    }
+
+    if(offset < _logSize) {
+        Logger::logError("Dropping %llu bytes from the end of %s/points.log", _logSize - offset, _dir.c_str());
+
+        if(ftruncate(_logFd, offset) != 0) {
+            throw std::string("Cannot truncate the log: ") + strerror(errno);
+        }
+        _logSize = offset;
+    }
+
+    return true;
+}
+
+/**
+ * Writes the table to disk, and then the log size it holds
+ */
+void PointIndex::checkpoint()
+{
+    addDeferred();
+
+    if(msync(_header, _mapSize, MS_SYNC) != 0) {
+        Logger::logError("Error writing the point index: %s", strerror(errno));
+        return;
+    }
+
+    _header->logSize = _logSize;
+    msync(_header, INDEX_HEADER_SIZE, MS_SYNC);
+
+    if(_filter != NULL) {
+        _filter->sync(_logSize);
+    }
+
+    _lastCheckpoint = util::getSystemTime();
+}
+
+void PointIndex::readRecord(unsigned long long offset, Record &record)
+{
+    std::string data;
+
+    if(offset >= _logSize) {
+        size_t pos = offset - _logSize;
+        data = _pending.substr(pos + RECORD_HEADER_SIZE, readInt((const unsigned char *)&_pending[pos]));
+    } else {
+        unsigned char header[RECORD_HEADER_SIZE];
+
+        if(pread(_logFd, header, RECORD_HEADER_SIZE, offset) != RECORD_HEADER_SIZE) {
+            throw std::string("Error reading the point log");
+        }
+
+        data.resize(readInt(header));
+        if(pread(_logFd, &data[0], data.size(), offset + RECORD_HEADER_SIZE) != (ssize_t)data.size()) {
+            throw std::string("Error reading the point log");
+        }
+    }
+
+    std::string a;
+    std::string b;
+
+    if(!parseBody((const unsigned char *)data.data(), data.size(), record.type, record.length, a, b, record.x, record.parity)) {
+        throw std::string("Invalid record in the point log");
+    }
+
+    record.a = BigInteger((const unsigned char *)a.data(), a.size());
+    record.b = BigInteger((const unsigned char *)b.data(), b.size());
+}
+
+/**
+ * Finds the slot of a point. Returns it with found set, or the empty slot
+ * where it belongs
+ */
+unsigned long long PointIndex::find(const Record &record, Record *stored, bool &found)
+{
+    unsigned long long hash = hashPoint(record.x, record.parity);
+    unsigned long long tag = hash >> INDEX_OFFSET_BITS;
+    unsigned long long mask = _header->capacity - 1;
+
+    unsigned long long slot = hash & mask & ~(unsigned long long)(INDEX_BUCKET_SIZE - 1);
+
+    for(;;) {
+        unsigned long long e = _table[slot];
+
+        if(e == 0) {
+            found = false;
+            return slot;
+        }
+
+        unsigned long long offset = e & INDEX_OFFSET_MASK;
+
+        if(offset != INDEX_REMOVED && (e >> INDEX_OFFSET_BITS) == tag) {
+            Record r;
+            readRecord(offset - 1, r);
+
+            if(r.x == record.x && r.parity == record.parity) {
+                if(stored != NULL) {
+                    *stored = r;
+                }
+                found = true;
+                return slot;
+            }
+        }
+
+        slot = (slot + 1) & mask;
+    }
+}
+
+/**
+ * Finds a point among the ones not in the table yet
+ */
+bool PointIndex::findDeferred(const Record &record, Record *stored, std::multimap<unsigned long long, unsigned long long>::iterator &entry)
+{
+    unsigned long long hash = hashPoint(record.x, record.parity);
+
+    std::pair<std::multimap<unsigned long long, unsigned long long>::iterator,
+              std::multimap<unsigned long long, unsigned long long>::iterator> range = _deferred.equal_range(hash);
+
+    for(entry = range.first; entry != range.second; entry++) {
+        Record r;
+        readRecord(entry->second, r);
+
+        if(r.x == record.x && r.parity == record.parity) {
+            if(stored != NULL) {
+                *stored = r;
+            }
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Puts a point known to be new in the first empty slot of its sequence
+ */
+void PointIndex::place(unsigned long long hash, unsigned long long offset)
+{
+    unsigned long long mask = _header->capacity - 1;
+    unsigned long long slot = hash & mask & ~(unsigned long long)(INDEX_BUCKET_SIZE - 1);
+
+    while(_table[slot] != 0) {
+        slot = (slot + 1) & mask;
+    }
+
+    _table[slot] = ((hash >> INDEX_OFFSET_BITS) << INDEX_OFFSET_BITS) | (offset + 1);
+    _header->used++;
+}
+
+static bool bySlot(const std::pair<unsigned long long, unsigned long long> &a,
+                   const std::pair<unsigned long long, unsigned long long> &b)
+{
+    return a.first < b.first;
+}
+
+/**
+ * Puts the deferred points in the table in the order of their slots
+ */
+void PointIndex::addDeferred()
+{
+    if(_deferred.empty()) {
+        return;
+    }
+
+    unsigned long long mask = _header->capacity - 1;
+
+    // Slot first, then the hash and offset
+    std::vector<std::pair<unsigned long long, unsigned long long> > order;
+    std::vector<std::pair<unsigned long long, unsigned long long> > points;
+
+    for(std::multimap<unsigned long long, unsigned long long>::iterator i = _deferred.begin(); i != _deferred.end(); i++) {
+        order.push_back(std::make_pair(i->first & mask, (unsigned long long)points.size()));
+        points.push_back(*i);
+    }
+
+    std::sort(order.begin(), order.end(), bySlot);
+
+    for(size_t i = 0; i < order.size(); i++) {
+        place(points[order[i].second].first, points[order[i].second].second);
+    }
+
+    _deferred.clear();
+}
+
+/**
+ * Puts a point logged at an offset in the table. Returns false if the end
+ * point is already there, with the stored record
+ */
+bool PointIndex::add(unsigned long long offset, const Record &record, Record *stored)
+{
+    bool found;
+    unsigned long long slot = find(record, stored, found);
+
+    if(found) {
+        return false;
+    }
+
+    unsigned long long tag = hashPoint(record.x, record.parity) >> INDEX_OFFSET_BITS;
+
+    _table[slot] = (tag << INDEX_OFFSET_BITS) | (offset + 1);
+    _header->used++;
+    _header->points++;
+
+    return true;
+}
+
+void PointIndex::appendRecord(const Record &record)
+{
+    std::string body;
+    body += (char)record.type;
+    appendVarint(body, record.length);
+    appendField(body, toBytes(record.a));
+    appendField(body, toBytes(record.b));
+    appendField(body, record.x);
+    body += (char)record.parity;
+
+    appendInt(_pending, body.size());
+    appendInt(_pending, fnv32((const unsigned char *)body.data(), body.size()));
+    _pending += body;
+}
+
+/**
+ * Writes the pending records and waits until they are on disk. On an error
+ * the table is built again from what the log holds
+ */
+void PointIndex::writePending()
+{
+    size_t written = 0;
+
+    while(written < _pending.size()) {
+        ssize_t n = write(_logFd, _pending.data() + written, _pending.size() - written);
+
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if(n <= 0) {
+            std::string err = strerror(errno);
+
+            _pending.clear();
+            if(ftruncate(_logFd, _logSize) == 0) {
+                rebuild(_header->capacity);
+            }
+
+            throw std::string("Error writing the point log: " + err);
+        }
+
+        written += n;
+    }
+
+    fdatasync(_logFd);
+
+    _logSize += _pending.size();
+    _pending.clear();
+
+    if(util::getSystemTime() - _lastCheckpoint >= INDEX_CHECKPOINT_INTERVAL) {
+        checkpoint();
+    }
+}
+
+/**
+ * Stores points. A point whose end point is stored already is returned as
+ * a collision, unless it is the same walk sent again. Returns the number of
+ * points that were sent again
+ */
+unsigned int PointIndex::insert(const std::vector<StoredPoint> &points, std::vector<PointCollision> &collisions)
+{
+    unsigned int duplicates = 0;
+
+    _mutex.grab();
+
+    try {
+        // Kept under 3/4 full so that probe sequences stay short
+        if((_header->used + _deferred.size() + points.size()) * 4 > _header->capacity * 3) {
+            unsigned long long capacity = _header->capacity * 2;
+            while((_header->points + points.size()) * 4 > capacity * 3) {
+                capacity *= 2;
+            }
+
+            Logger::logInfo("Growing the point index in %s to %llu slots", _dir.c_str(), capacity);
+            rebuild(capacity);
+        }
+
+        for(size_t i = 0; i < points.size(); i++) {
+            const StoredPoint &p = points[i];
+
+            Record r;
+            r.type = RECORD_POINT;
+            r.a = p.a;
+            r.b = p.b;
+            r.x = toBytes(p.x);
+            r.parity = p.y.lsb();
+            r.length = p.length;
+
+            unsigned long long offset = _logSize + _pending.size();
+
+            if(offset >= INDEX_REMOVED - 1) {
+                throw std::string("The point log is full");
+            }
+
+            Record stored;
+
+            if(_filter != NULL) {
+                unsigned long long h = hashPoint(r.x, r.parity);
+                bool found = false;
+
+                if(_filter->mayContain(h)) {
+                    std::multimap<unsigned long long, unsigned long long>::iterator entry;
+
+                    find(r, &stored, found);
+                    if(!found) {
+                        found = findDeferred(r, &stored, entry);
+                    }
+                }
+
+                if(!found) {
+                    _deferred.insert(std::make_pair(h, offset));
+                    _filter->add(h);
+                    _header->points++;
+                    appendRecord(r);
+                    continue;
+                }
+            } else if(add(offset, r, &stored)) {
+                appendRecord(r);
+                continue;
+            }
+
+            if(stored.a == p.a && stored.b == p.b) {
+                duplicates++;
+                continue;
+            }
+
+            PointCollision c;
+            c.point = p;
+            c.a = stored.a;
+            c.b = stored.b;
+            c.length = stored.length;
+            collisions.push_back(c);
+        }
+
+        writePending();
+
+        if(_deferred.size() >= INDEX_DEFERRED_POINTS) {
+            addDeferred();
+        }
+    } catch(std::string err) {
+        // The table may hold points that were not logged
+        if(!_pending.empty()) {
+            _pending.clear();
+
+            try {
+                rebuild(_header->capacity);
+            } catch(std::string rebuildErr) {
+                Logger::logError(rebuildErr);
+            }
+        }
+
+        _mutex.release();
+        throw;
+    }
+
+    _mutex.release();
+
+    return duplicates;
+}
+
+/**
+ * Removes a point that failed a check, if it is the one the walk stored
+ */
+void PointIndex::remove(const StoredPoint &point)
+{
+    _mutex.grab();
+
+    try {
+        Record r;
+        r.type = RECORD_REMOVED;
+        r.a = point.a;
+        r.b = point.b;
+        r.x = toBytes(point.x);
+        r.parity = point.y.lsb();
+        r.length = point.length;
+
+        Record stored;
+        bool found;
+        unsigned long long slot = find(r, &stored, found);
+
+        if(found && stored.a == point.a && stored.b == point.b) {
+            _table[slot] |= INDEX_REMOVED;
+            _header->points--;
+
+            appendRecord(r);
+            writePending();
+        }
+
+        std::multimap<unsigned long long, unsigned long long>::iterator entry;
+
+        if(!found && findDeferred(r, &stored, entry) && stored.a == point.a && stored.b == point.b) {
+            _deferred.erase(entry);
+            _header->points--;
+
+            appendRecord(r);
+            writePending();
+        }
+    } catch(std::string err) {
+        _mutex.release();
+        throw;
+    }
+
+    _mutex.release();
+}
+
+unsigned long long PointIndex::size()
+{
+    _mutex.grab();
+    unsigned long long points = _header->points;
+    _mutex.release();
+
+    return points;
+}
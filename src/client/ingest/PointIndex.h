@@ -0,0 +1,108 @@
+#ifndef _POINT_INDEX_H
+#define _POINT_INDEX_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "BloomFilter.h"
+#include "PointStore.h"
+#include "threads.h"
+
+/**
+ * The points of one job, kept out of the database. Records are appended to
+ * a log file and found through an open-addressing table that is mapped
+ * from a second file.
+ *
+ * The table is keyed on a 64-bit hash of the compressed end point. An
+ * entry is 8 bytes: the top 24 bits of the hash and the offset of the
+ * record in the log. Entries are probed in buckets of 8, one cache line,
+ * and the record is only read when the 24 bits match, so a new point
+ * costs one or two cache misses and no disk read. The log is the record of
+ * what is stored; the table is checkpointed now and then and whatever was
+ * logged after the checkpoint is added again on opening.
+ *
+ * When the table is larger than memory, probing it reads the disk. A Bloom
+ * filter in front of it then answers for most new points, which are only
+ * logged. They are put in the table later, in the order of their slots,
+ * so the pages are read once for many points
+ */
+class PointIndex {
+
+private:
+    typedef struct {
+        char magic[4];
+        unsigned int version;
+
+        // Slots in the table, a power of 2
+        unsigned long long capacity;
+
+        // Slots in use, including removed points
+        unsigned long long used;
+        unsigned long long points;
+
+        // Log size the table holds every record of
+        unsigned long long logSize;
+    }Header;
+
+    typedef struct {
+        int type;
+        BigInteger a;
+        BigInteger b;
+        std::string x;
+        int parity;
+        unsigned long long length;
+    }Record;
+
+    std::string _dir;
+
+    int _logFd;
+    unsigned long long _logSize;
+
+    // Records appended and not yet written to the log
+    std::string _pending;
+
+    int _tableFd;
+    Header *_header;
+    unsigned long long *_table;
+    size_t _mapSize;
+
+    unsigned int _lastCheckpoint;
+
+    // NULL when every point goes straight to the table
+    BloomFilter *_filter;
+
+    // Points the filter answered for that are not in the table yet, by hash
+    std::multimap<unsigned long long, unsigned long long> _deferred;
+
+    Mutex _mutex;
+
+    bool openTable(const std::string &path, unsigned long long capacity, bool create);
+    void closeTable();
+    void recover();
+    void rebuild(unsigned long long capacity);
+    bool replay(unsigned long long from);
+    void checkpoint();
+    void writePending();
+    void addDeferred();
+
+    void readRecord(unsigned long long offset, Record &record);
+    unsigned long long find(const Record &record, Record *stored, bool &found);
+    bool findDeferred(const Record &record, Record *stored, std::multimap<unsigned long long, unsigned long long>::iterator &entry);
+    bool add(unsigned long long offset, const Record &record, Record *stored);
+    void place(unsigned long long hash, unsigned long long offset);
+    void appendRecord(const Record &record);
+
+public:
+    PointIndex(const std::string &dir, unsigned long long filterBits = 0);
+    ~PointIndex();
+
+    static unsigned long long hash(const BigInteger &x, int parity);
+
+    unsigned int insert(const std::vector<StoredPoint> &points, std::vector<PointCollision> &collisions);
+    void remove(const StoredPoint &point);
+
+    unsigned long long size();
+};
+
+#endif
@@ -0,0 +1,21 @@
+#include "PointStore.h"
+
+/**
+ * Job names are used as table names, so only these characters are allowed
+ */
+bool PointStore::isValidName(const std::string &name)
+{
+    if(name.empty() || name.size() > 32) {
+        return false;
+    }
+
+    for(size_t i = 0; i < name.size(); i++) {
+        char c = name[i];
+
+        if(!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_')) {
+            return false;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,113 @@
+#ifndef _POINT_STORE_H
+#define _POINT_STORE_H
+
+#include <string>
+#include <vector>
+
+#include "BigInteger.h"
+#include "ECDLPParams.h"
+
+/**
+ * A job as the server stored it
+ */
+typedef struct {
+    ECDLPParams params;
+
+    // Exponents of the R points. Their coordinates are in params
+    std::vector<BigInteger> ra;
+    std::vector<BigInteger> rb;
+
+    std::string status;
+
+    // Distinguished bits the walks stop at, and the most they were ever
+    // set to
+    unsigned int activeBits;
+    unsigned int maxBits;
+}JobRecord;
+
+typedef struct {
+    BigInteger a;
+    BigInteger b;
+    BigInteger x;
+    BigInteger y;
+    unsigned long long length;
+}StoredPoint;
+
+/**
+ * A point whose end point was already stored by another walk
+ */
+typedef struct {
+    StoredPoint point;
+
+    // The walk that was stored
+    BigInteger a;
+    BigInteger b;
+    unsigned long long length;
+}PointCollision;
+
+// Walk lengths are counted in buckets of powers of 2, as by the server
+#define WALK_LENGTH_BUCKETS 64
+
+/**
+ * Counters a submission adds to the walk stats of its client
+ */
+typedef struct {
+    unsigned long long submissions;
+    unsigned long long points;
+    unsigned long long steps;
+    unsigned long long duplicates;
+    unsigned long long collisions;
+    unsigned long long dropped;
+
+    // Bucket i holds the walks of 2^(i-1) to 2^i - 1 steps
+    unsigned long long histogram[WALK_LENGTH_BUCKETS];
+}WalkStats;
+
+/**
+ * Where the jobs, points and collisions of the server are kept, the
+ * server's MySQL tables in the service. The methods are called from many
+ * threads at once. Errors are thrown as strings
+ */
+class PointStore {
+
+public:
+    virtual ~PointStore() {}
+
+    static bool isValidName(const std::string &name);
+
+    /**
+     * Loads the parameters, R points and state of a job. Returns false if
+     * there is no such job
+     */
+    virtual bool loadJob(const std::string &name, JobRecord &job) = 0;
+
+    /**
+     * Reloads the status and distinguished bits of a job
+     */
+    virtual bool loadJobState(const std::string &name, JobRecord &job) = 0;
+
+    /**
+     * Stores the points of a submission. A point whose end point another
+     * walk reached is written to the collisions instead, and a walk that is
+     * stored already is counted in duplicates. Returns the number of
+     * collisions
+     */
+    virtual int insertPoints(const std::string &name, const std::vector<StoredPoint> &points, unsigned int &duplicates) = 0;
+
+    /**
+     * Writes collisions found outside the store
+     */
+    virtual void insertCollisions(const std::string &name, const std::vector<PointCollision> &collisions) = 0;
+
+    /**
+     * Removes a point that failed a check, if its walk is the one stored
+     */
+    virtual void deletePoint(const std::string &name, const StoredPoint &point) = 0;
+
+    /**
+     * Adds the counters of a submission to the walk stats of a client
+     */
+    virtual void recordWalkStats(const std::string &name, const std::string &client, const WalkStats &stats, unsigned long long now) = 0;
+};
+
+#endif
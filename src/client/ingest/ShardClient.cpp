@@ -0,0 +1,131 @@
+#include "PointIndex.h"
+#include "ShardClient.h"
+#include "logger.h"
+
+// Seconds to wait on another node
+#define SHARD_CONNECT_TIMEOUT 5
+#define SHARD_TIMEOUT 30
+
+static size_t discardCallback(void *, size_t size, size_t count, void *)
+{
+    return size * count;
+}
+
+ShardClient::ShardClient(const std::vector<std::string> &urls, int self)
+{
+    if(self < 0 || self >= (int)urls.size()) {
+        throw std::string("Invalid shard index");
+    }
+
+    _urls = urls;
+    _self = self;
+}
+
+ShardClient::~ShardClient()
+{
+    for(size_t i = 0; i < _handles.size(); i++) {
+        curl_easy_cleanup(_handles[i]);
+    }
+
+    _mutex.destroy();
+}
+
+int ShardClient::getCount()
+{
+    return (int)_urls.size();
+}
+
+int ShardClient::getSelf()
+{
+    return _self;
+}
+
+/**
+ * Node a point belongs to. The index hash is mixed again first, since the
+ * tables and filters of a node use its low bits and they would otherwise
+ * all be the same on one node
+ */
+int ShardClient::owner(const BigInteger &x, int parity)
+{
+    unsigned long long h = PointIndex::hash(x, parity) ^ 0x9e3779b97f4a7c15ULL;
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+
+    return (int)(((h >> 32) * _urls.size()) >> 32);
+}
+
+CURL *ShardClient::acquireHandle()
+{
+    CURL *curl = NULL;
+
+    _mutex.grab();
+    if(!_handles.empty()) {
+        curl = _handles.back();
+        _handles.pop_back();
+    }
+    _mutex.release();
+
+    if(curl == NULL) {
+        curl = curl_easy_init();
+    }
+
+    if(curl == NULL) {
+        throw std::string("Error initializing curl");
+    }
+
+    return curl;
+}
+
+void ShardClient::releaseHandle(CURL *curl)
+{
+    _mutex.grab();
+    _handles.push_back(curl);
+    _mutex.release();
+}
+
+/**
+ * Posts a body to a node and returns the HTTP status code, or 0 if the
+ * node did not answer. extraHeaders are whole header lines
+ */
+long ShardClient::post(int shard, const std::string &path, const std::string &body, const std::string &contentType,
+                       const std::vector<std::string> &extraHeaders)
+{
+    CURL *curl = acquireHandle();
+
+    std::string url = _urls[shard] + path;
+    std::string header = "Content-Type: " + contentType;
+    struct curl_slist *headers = curl_slist_append(NULL, header.c_str());
+
+    for(size_t i = 0; i < extraHeaders.size(); i++) {
+        headers = curl_slist_append(headers, extraHeaders[i].c_str());
+    }
+
+    // Clears the options of the last request but keeps its connection
+    curl_easy_reset(curl);
+
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, discardCallback);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, (long)SHARD_CONNECT_TIMEOUT);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT, (long)SHARD_TIMEOUT);
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body.data());
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)body.size());
+
+    long httpCode = 0;
+
+    CURLcode res = curl_easy_perform(curl);
+    if(res == CURLE_OK) {
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpCode);
+    } else {
+        Logger::logError("Error posting to %s: %s", url.c_str(), curl_easy_strerror(res));
+    }
+
+    curl_slist_free_all(headers);
+    releaseHandle(curl);
+
+    return httpCode;
+}
@@ -0,0 +1,43 @@
+#ifndef _SHARD_CLIENT_H
+#define _SHARD_CLIENT_H
+
+#include <string>
+#include <vector>
+#include <curl/curl.h>
+
+#include "BigInteger.h"
+#include "threads.h"
+
+/**
+ * The ingestion nodes of a sharded setup. Each point belongs to the node
+ * chosen by the hash of its end point, so that two walks that reach the
+ * same point meet in the same index. Points that belong to another node
+ * are posted to it
+ */
+class ShardClient {
+
+private:
+    std::vector<std::string> _urls;
+    int _self;
+
+    // Idle curl handles, each keeping its connection open
+    std::vector<CURL *> _handles;
+    Mutex _mutex;
+
+    CURL *acquireHandle();
+    void releaseHandle(CURL *curl);
+
+public:
+    ShardClient(const std::vector<std::string> &urls, int self);
+    ~ShardClient();
+
+    int getCount();
+    int getSelf();
+
+    int owner(const BigInteger &x, int parity);
+
+    long post(int shard, const std::string &path, const std::string &body, const std::string &contentType,
+              const std::vector<std::string> &extraHeaders);
+};
+
+#endif
@@ -0,0 +1,117 @@
+#include <map>
+
+#include "SpotChecker.h"
+#include "logger.h"
+
+// Checks between reports of the totals
+#define SPOT_CHECK_REPORT_INTERVAL 1000
+
+SpotChecker::SpotChecker(PointStore *store, int threads, size_t maxQueued)
+{
+    _store = store;
+    _maxQueued = maxQueued;
+    _checked = 0;
+    _failed = 0;
+    _dropped = 0;
+
+    for(int i = 0; i < threads; i++) {
+        _threads.push_back(new Thread(workerThread, this));
+    }
+}
+
+void *SpotChecker::workerThread(void *p)
+{
+    ((SpotChecker *)p)->work();
+
+    return NULL;
+}
+
+/**
+ * Queues a stored point to be checked. The point is dropped when too many
+ * are waiting
+ */
+void SpotChecker::push(Job *job, const StoredPoint &point)
+{
+    _mutex.grab();
+
+    if(_queue.size() >= _maxQueued) {
+        _mutex.release();
+        atomicAdd(&_dropped, 1);
+        return;
+    }
+
+    SpotCheck c;
+    c.job = job;
+    c.point = point;
+
+    _queue.push_back(c);
+    _work.signal();
+
+    _mutex.release();
+}
+
+void SpotChecker::work()
+{
+    // Each thread replays on its own instances
+    std::map<Job *, WalkReplay *> replays;
+
+    for(;;) {
+        _mutex.grab();
+
+        while(_queue.empty()) {
+            _work.wait(_mutex);
+        }
+
+        SpotCheck c = _queue.front();
+        _queue.pop_front();
+
+        _mutex.release();
+
+        WalkReplay *replay = replays[c.job];
+
+        try {
+            if(replay == NULL) {
+                const JobRecord &r = c.job->record;
+
+                replay = newWalkReplay(r.params, &r.params.rx[0], &r.params.ry[0], &r.ra[0], &r.rb[0], r.params.rx.size());
+                replays[c.job] = replay;
+            }
+
+            check(replay, c);
+        } catch(std::string err) {
+            Logger::logError("Error checking a point of job %s: %s", c.job->name.c_str(), err.c_str());
+        }
+    }
+}
+
+void SpotChecker::check(WalkReplay *replay, const SpotCheck &c)
+{
+    const StoredPoint &p = c.point;
+
+    // Clients drop walks at 4 times the expected length for the most
+    // distinguished bits the job had
+    unsigned long long maxLength = (unsigned long long)4 << c.job->getMaxBits();
+
+    bool valid = replay->reaches(p.a, p.b, p.x, p.y, maxLength);
+
+    if(!valid) {
+        atomicAdd(&_failed, 1);
+
+        Logger::logError("Point of job %s is not reached from its exponents, removing it: a=%s b=%s x=%s y=%s",
+                         c.job->name.c_str(), p.a.toString(16).c_str(), p.b.toString(16).c_str(),
+                         p.x.toString(16).c_str(), p.y.toString(16).c_str());
+
+        if(c.job->points != NULL) {
+            c.job->points->remove(p);
+        } else {
+            _store->deletePoint(c.job->name, p);
+        }
+    }
+
+    unsigned int checked = atomicAdd(&_checked, 1) + 1;
+
+    if(checked % SPOT_CHECK_REPORT_INTERVAL == 0) {
+        Logger::logInfo("Spot checks: %u done, %u failed, %u dropped",
+                        checked, atomicLoad(&_failed), atomicLoad(&_dropped));
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef _SPOT_CHECKER_H
+#define _SPOT_CHECKER_H
+
+#include <deque>
+#include <vector>
+
+#include "JobCache.h"
+#include "PointStore.h"
+#include "threads.h"
+#include "WalkReplay.h"
+
+/**
+ * Replays the walks of a sample of the stored points to see that each one
+ * reaches its point from its exponents. A point that does not is removed,
+ * since it would only give a false collision. Checks run in the background
+ * and are dropped when the queue is full, so they never slow submissions
+ */
+class SpotChecker {
+
+private:
+    typedef struct {
+        Job *job;
+        StoredPoint point;
+    }SpotCheck;
+
+    PointStore *_store;
+
+    std::deque<SpotCheck> _queue;
+    size_t _maxQueued;
+    Mutex _mutex;
+    ConditionVariable _work;
+
+    std::vector<Thread *> _threads;
+
+    volatile unsigned int _checked;
+    volatile unsigned int _failed;
+    volatile unsigned int _dropped;
+
+    static void *workerThread(void *p);
+    void work();
+    void check(WalkReplay *replay, const SpotCheck &c);
+
+public:
+    SpotChecker(PointStore *store, int threads, size_t maxQueued);
+
+    void push(Job *job, const StoredPoint &point);
+};
+
+#endif
@@ -0,0 +1,214 @@
+#include <string.h>
+#include "Submission.h"
+#include "json/json.h"
+
+/**
+ * Reads an unsigned LEB128 integer at offset and moves offset past it
+ */
+static unsigned long long readVarint(const std::string &data, size_t &offset)
+{
+    unsigned long long value = 0;
+
+    for(int shift = 0; shift <= 63; shift += 7) {
+        if(offset >= data.size()) {
+            break;
+        }
+
+        unsigned char byte = (unsigned char)data[offset++];
+        value |= (unsigned long long)(byte & 0x7f) << shift;
+
+        if((byte & 0x80) == 0) {
+            return value;
+        }
+    }
+
+    throw std::string("Invalid varint");
+}
+
+/**
+ * Appends an unsigned LEB128 integer
+ */
+static void writeVarint(std::string &buf, unsigned long long value)
+{
+    while(value >= 0x80) {
+        buf += (char)((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+
+    buf += (char)value;
+}
+
+/**
+ * Appends the low len bytes of value, little endian
+ */
+static void writeInt(std::string &buf, const BigInteger &value, unsigned int len)
+{
+    size_t size = value.getByteLength() > len ? value.getByteLength() : len;
+    std::vector<unsigned char> bytes(size);
+
+    value.getBytes(&bytes[0], size);
+
+    buf.append((const char *)&bytes[0], len);
+}
+
+/**
+ * Number of bits of a value, 0 for 0
+ */
+static unsigned int bitLength(const BigInteger &value)
+{
+    return value.isZero() ? 0 : (unsigned int)value.getBitLength();
+}
+
+/**
+ * Decodes a binary submission:
+ *
+ *  "ECDP", version byte, varint count and then for each point
+ *  varint length, a and b in nLen bytes, x in xLen bytes
+ *
+ * All integers are little endian. The x field holds x >> dBits, with the
+ * parity of y in the bit above it
+ */
+void decodeBinaryPoints(const ECDLPParams &params, const std::string &data, std::vector<SubmittedPoint> &points)
+{
+    size_t magicLen = strlen(BINARY_MAGIC);
+
+    if(data.size() < magicLen + 1 || data.compare(0, magicLen, BINARY_MAGIC) != 0) {
+        throw std::string("Not a binary submission");
+    }
+
+    int version = (unsigned char)data[magicLen];
+    if(version != BINARY_VERSION) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "Unsupported version %d", version);
+        throw UnsupportedFormatError(buf);
+    }
+
+    unsigned int pBits = bitLength(params.p);
+    unsigned int nLen = (bitLength(params.n) + 7) / 8;
+    unsigned int paritySize = pBits - params.dBits;
+    unsigned int xLen = (paritySize + 8) / 8;
+
+    size_t offset = magicLen + 1;
+    unsigned long long count = readVarint(data, offset);
+
+    // Every point takes at least this much, so a count that does not fit
+    // is rejected before anything is allocated for it
+    size_t minSize = 1 + 2 * nLen + xLen;
+    if(count > (data.size() - offset) / minSize) {
+        throw std::string("Truncated point");
+    }
+
+    points.resize(count);
+
+    std::vector<unsigned char> field(xLen);
+
+    for(unsigned long long i = 0; i < count; i++) {
+        SubmittedPoint &p = points[i];
+
+        p.length = readVarint(data, offset);
+
+        if(offset + 2 * nLen + xLen > data.size()) {
+            throw std::string("Truncated point");
+        }
+
+        p.a = BigInteger((const unsigned char *)data.data() + offset, nLen);
+        offset += nLen;
+        p.b = BigInteger((const unsigned char *)data.data() + offset, nLen);
+        offset += nLen;
+
+        memcpy(&field[0], data.data() + offset, xLen);
+        offset += xLen;
+
+        // Take out the parity bit. Nothing may be set above it
+        unsigned int byte = paritySize / 8;
+        unsigned char bit = 1 << (paritySize % 8);
+
+        p.parity = (field[byte] & bit) ? 1 : 0;
+        field[byte] &= ~bit;
+
+        if(field[byte] >= bit || (byte + 1 < xLen && field[byte + 1] != 0)) {
+            throw std::string("Invalid x field");
+        }
+
+        int shift = params.dBits;
+        p.x = BigInteger(&field[0], xLen) << shift;
+
+        if(!(p.x < params.p)) {
+            throw std::string("Invalid x field");
+        }
+    }
+
+    if(offset != data.size()) {
+        throw std::string("Trailing data");
+    }
+}
+
+/**
+ * Encodes verified points in the binary format, for passing them to
+ * another node. Their x has at least dBits low bits clear, so nothing is
+ * lost
+ */
+std::string encodeBinaryPoints(const ECDLPParams &params, const std::vector<SubmittedPoint> &points)
+{
+    unsigned int pBits = bitLength(params.p);
+    unsigned int nLen = (bitLength(params.n) + 7) / 8;
+    unsigned int paritySize = pBits - params.dBits;
+    unsigned int xLen = (paritySize + 8) / 8;
+
+    std::string buf(BINARY_MAGIC);
+    buf += (char)BINARY_VERSION;
+
+    writeVarint(buf, points.size());
+
+    BigInteger parityBit = BigInteger(2).pow(paritySize);
+
+    for(size_t i = 0; i < points.size(); i++) {
+        writeVarint(buf, points[i].length);
+        writeInt(buf, points[i].a, nLen);
+        writeInt(buf, points[i].b, nLen);
+
+        BigInteger x = points[i].x.rshift(params.dBits);
+        if(points[i].y.lsb()) {
+            x = x + parityBit;
+        }
+        writeInt(buf, x, xLen);
+    }
+
+    return buf;
+}
+
+static BigInteger readBigInt(const Json::Value &root, const char *field)
+{
+    std::string s = root.get(field, "").asString();
+    if(s == "") {
+        throw std::string("Parsing error: ") + field + " is not an integer";
+    }
+    return BigInteger(s);
+}
+
+/**
+ * Decodes a JSON submission, a list of points with a, b, x, y and length
+ */
+void decodeJsonPoints(const std::string &data, std::vector<SubmittedPoint> &points)
+{
+    Json::Value root;
+    Json::Reader reader;
+
+    if(!reader.parse(data, root) || !root.isArray()) {
+        throw std::string("JSON parsing error: ") + reader.getFormattedErrorMessages();
+    }
+
+    points.resize(root.size());
+
+    for(unsigned int i = 0; i < root.size(); i++) {
+        const Json::Value &e = root[i];
+        SubmittedPoint &p = points[i];
+
+        p.a = readBigInt(e, "a");
+        p.b = readBigInt(e, "b");
+        p.x = readBigInt(e, "x");
+        p.y = readBigInt(e, "y");
+        p.parity = -1;
+        p.length = e.get("length", 0).asUInt64();
+    }
+}
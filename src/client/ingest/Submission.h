@@ -0,0 +1,53 @@
+#ifndef _SUBMISSION_H
+#define _SUBMISSION_H
+
+#include <string>
+#include <vector>
+#include "BigInteger.h"
+#include "ECDLPParams.h"
+
+// Submission formats, as in the server
+#define BINARY_CONTENT_TYPE "application/x-ecdl-points"
+#define BINARY_MAGIC "ECDP"
+#define BINARY_VERSION 1
+
+// Headers naming the client of a submission and giving the walks it
+// dropped since its last one, as in the server
+#define CLIENT_HEADER "X-ECDL-Client"
+#define DROPPED_HEADER "X-ECDL-Dropped"
+
+/**
+ * A point from a submission. Binary submissions give the parity of y only,
+ * and y is recovered when the point is verified
+ */
+typedef struct {
+    BigInteger a;
+    BigInteger b;
+    BigInteger x;
+    BigInteger y;
+
+    // Parity of y, or -1 when y was given
+    int parity;
+
+    unsigned long long length;
+}SubmittedPoint;
+
+/**
+ * Thrown for a binary submission in a version this service does not know
+ */
+class UnsupportedFormatError {
+
+public:
+    std::string message;
+
+    UnsupportedFormatError(const std::string &message)
+    {
+        this->message = message;
+    }
+};
+
+void decodeBinaryPoints(const ECDLPParams &params, const std::string &data, std::vector<SubmittedPoint> &points);
+void decodeJsonPoints(const std::string &data, std::vector<SubmittedPoint> &points);
+std::string encodeBinaryPoints(const ECDLPParams &params, const std::vector<SubmittedPoint> &points);
+
+#endif
@@ -0,0 +1,194 @@
+#include <string.h>
+
+#include "Verifier.h"
+
+// Points a thread takes from a submission at a time
+#define VERIFY_CHUNK_SIZE 64
+
+Verifier::Verifier(int threads)
+{
+    for(int i = 0; i < threads; i++) {
+        _threads.push_back(new Thread(workerThread, this));
+    }
+}
+
+void *Verifier::workerThread(void *p)
+{
+    ((Verifier *)p)->work();
+
+    return NULL;
+}
+
+void Verifier::work()
+{
+    for(;;) {
+        _mutex.grab();
+
+        while(_queue.empty()) {
+            _work.wait(_mutex);
+        }
+
+        Batch *batch = _queue.front();
+
+        unsigned int start = batch->next;
+        unsigned int end = start + VERIFY_CHUNK_SIZE;
+        if(end >= batch->count) {
+            end = batch->count;
+            _queue.pop_front();
+        }
+        batch->next = end;
+
+        // Nothing more needs checking once a point is invalid
+        bool skip = !batch->valid;
+
+        _mutex.release();
+
+        bool valid = true;
+        for(unsigned int i = start; i < end && valid && !skip; i++) {
+            valid = verifyPoint(batch->job, batch->points[i]);
+        }
+
+        _mutex.grab();
+
+        if(!valid) {
+            batch->valid = false;
+        }
+
+        batch->done += end - start;
+        if(batch->done == batch->count) {
+            batch->finished->signal();
+        }
+
+        _mutex.release();
+    }
+}
+
+/**
+ * Checks the points of a submission. Returns false if any is invalid. The
+ * y of points from binary submissions is recovered
+ */
+bool Verifier::verify(Job *job, std::vector<SubmittedPoint> &points)
+{
+    if(points.empty()) {
+        return true;
+    }
+
+    ConditionVariable finished;
+
+    Batch batch;
+    batch.job = job;
+    batch.points = &points[0];
+    batch.count = points.size();
+    batch.next = 0;
+    batch.done = 0;
+    batch.valid = true;
+    batch.finished = &finished;
+
+    _mutex.grab();
+
+    _queue.push_back(&batch);
+    _work.broadcast();
+
+    while(batch.done < batch.count) {
+        finished.wait(_mutex);
+    }
+
+    _mutex.release();
+
+    return batch.valid;
+}
+
+/**
+ * Checks a point the way the server does: the exponents and coordinates
+ * are in range, kangaroo walks start at aG or aG + Q, x ends with the
+ * distinguished bits, y is even with the negation map, and the point is on
+ * the curve. Whether the walk from the exponents reaches the point is only
+ * checked for a sample of the points, by the spot checker
+ */
+bool Verifier::verifyPoint(Job *job, SubmittedPoint &point)
+{
+    const ECDLPParams &params = job->record.params;
+    BigInteger zero(0);
+
+    if(params.kangaroo) {
+        if(point.a < zero || !(point.a < params.n) || !(point.b == 0 || point.b == 1)) {
+            return false;
+        }
+    } else if(!(zero < point.a) || !(point.a < params.n) || !(zero < point.b) || !(point.b < params.n)) {
+        return false;
+    }
+
+    if(point.x < zero || !(point.x < params.p)) {
+        return false;
+    }
+
+    if(point.parity < 0 && (point.y < zero || !(point.y < params.p))) {
+        return false;
+    }
+
+    unsigned int xWords[FIXED_ECC_MAX_WORDS];
+    unsigned int yWords[FIXED_ECC_MAX_WORDS];
+
+    // x is below p, so it fits the words of the curve
+    int words = job->fixedCurve != NULL ? job->fixedCurve->getWords() : 0;
+    size_t size = point.x.getLength32();
+
+    if(size < (size_t)words) {
+        size = words;
+    }
+    if(size < (params.dBits + 31) / 32 + 1) {
+        size = (params.dBits + 31) / 32 + 1;
+    }
+
+    std::vector<unsigned int> x(size);
+    point.x.getWords(&x[0], x.size());
+
+    for(unsigned int i = 0; i < params.dBits; i++) {
+        if(x[i / 32] & (1u << (i % 32))) {
+            return false;
+        }
+    }
+
+    if(job->fixedCurve != NULL) {
+        memcpy(xWords, &x[0], sizeof(unsigned int) * words);
+
+        if(point.parity >= 0) {
+            if(!job->fixedCurve->decompressPoint(xWords, point.parity, yWords)) {
+                return false;
+            }
+            point.y = BigInteger(yWords, words);
+        } else {
+            point.y.getWords(yWords, words);
+
+            if(!job->fixedCurve->pointExists(xWords, yWords)) {
+                return false;
+            }
+        }
+    } else {
+        if(point.parity >= 0) {
+            std::vector<unsigned char> encoded(point.x.getByteLength() + 1);
+            ECPoint p;
+
+            encoded[0] = (unsigned char)point.parity;
+            point.x.getBytes(&encoded[1], encoded.size() - 1);
+
+            if(!decompressPoint(job->curve, &encoded[0], encoded.size(), p)) {
+                return false;
+            }
+            point.y = p.y;
+        } else {
+            ECPoint p(point.x, point.y);
+
+            if(!job->curve.pointExists(p)) {
+                return false;
+            }
+        }
+    }
+
+    // With the negation map every point on a walk has an even y
+    if(params.negation && point.y.lsb()) {
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,49 @@
+#ifndef _VERIFIER_H
+#define _VERIFIER_H
+
+#include <deque>
+#include <vector>
+
+#include "JobCache.h"
+#include "Submission.h"
+#include "threads.h"
+
+/**
+ * Checks submitted points on a pool of threads. A submission is split in
+ * chunks that any idle thread takes, so one large submission uses every
+ * core and several small ones are checked side by side
+ */
+class Verifier {
+
+private:
+    typedef struct {
+        Job *job;
+        SubmittedPoint *points;
+        unsigned int count;
+
+        // Next point to hand out, and points checked
+        unsigned int next;
+        unsigned int done;
+
+        bool valid;
+        ConditionVariable *finished;
+    }Batch;
+
+    std::deque<Batch *> _queue;
+    Mutex _mutex;
+    ConditionVariable _work;
+
+    std::vector<Thread *> _threads;
+
+    static void *workerThread(void *p);
+    void work();
+
+public:
+    Verifier(int threads);
+
+    bool verify(Job *job, std::vector<SubmittedPoint> &points);
+
+    static bool verifyPoint(Job *job, SubmittedPoint &point);
+};
+
+#endif
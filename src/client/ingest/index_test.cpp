@@ -0,0 +1,262 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "PointIndex.h"
+#include "util.h"
+
+// Points inserted, enough for the table to grow past its first size
+#define TEST_POINTS 1000000
+
+#define TEST_BATCH_SIZE 4096
+
+// Bloom filter size for the second pass, 0 for none in the first
+#define TEST_FILTER_BITS (1ULL << 24)
+
+static const char *_files[] = { "points.log", "points.idx", "points.bloom" };
+
+/**
+ * Point i of the test. walk picks a different walk to the same end point
+ */
+static StoredPoint testPoint(unsigned long long i, int walk = 0)
+{
+    char buf[64];
+    sprintf(buf, "%llx%08llx00000", i * 2654435761ULL, i);
+
+    StoredPoint p = { BigInteger((int)(i + 1 + walk)), BigInteger((int)(i * 3 + 1)),
+                      BigInteger(std::string(buf), 16), BigInteger((int)(i & 1) + 14), i };
+
+    return p;
+}
+
+static std::string path(const std::string &dir, const char *file)
+{
+    return dir + "/" + file;
+}
+
+static void removeFiles(const std::string &dir)
+{
+    for(int i = 0; i < (int)(sizeof(_files) / sizeof(_files[0])); i++) {
+        unlink(path(dir, _files[i]).c_str());
+    }
+}
+
+static bool check(bool ok, const char *what)
+{
+    if(!ok) {
+        printf("Error: %s\n", what);
+    }
+
+    return ok;
+}
+
+static bool insertRange(PointIndex &index, unsigned long long start, unsigned long long end)
+{
+    for(unsigned long long s = start; s < end; s += TEST_BATCH_SIZE) {
+        std::vector<StoredPoint> points;
+        std::vector<PointCollision> collisions;
+
+        for(unsigned long long i = s; i < s + TEST_BATCH_SIZE && i < end; i++) {
+            points.push_back(testPoint(i));
+        }
+
+        if(index.insert(points, collisions) != 0 || !collisions.empty()) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Points sent again are skipped, other walks to a stored end point are
+ * collisions that come with the stored walk
+ */
+static bool testCollisions(PointIndex &index, unsigned long long n, unsigned long long fresh)
+{
+    std::vector<StoredPoint> points;
+    std::vector<PointCollision> collisions;
+
+    unsigned long long size = index.size();
+
+    for(unsigned long long i = 0; i < n; i += n / 100) {
+        points.push_back(testPoint(i));
+    }
+    unsigned int resent = (unsigned int)points.size();
+
+    for(unsigned long long i = 1; i < n; i += n / 10) {
+        points.push_back(testPoint(i, 5));
+    }
+    unsigned int colliding = (unsigned int)(points.size() - resent);
+
+    // Two walks to a new end point in the same submission
+    points.push_back(testPoint(fresh));
+    points.push_back(testPoint(fresh, 9));
+
+    bool ok = check(index.insert(points, collisions) == resent, "resent points not skipped");
+    ok &= check(collisions.size() == colliding + 1, "wrong number of collisions");
+    ok &= check(index.size() == size + 1, "wrong size after collisions");
+
+    for(size_t i = 0; i < collisions.size(); i++) {
+        StoredPoint stored = testPoint(collisions[i].point.length);
+        if(collisions[i].a != stored.a || collisions[i].b != stored.b || collisions[i].length != stored.length) {
+            return check(false, "collision has the wrong stored walk");
+        }
+    }
+
+    return ok;
+}
+
+/**
+ * Only the walk that stored a point removes it, and the end point can be
+ * stored again afterwards
+ */
+static bool testRemove(PointIndex &index)
+{
+    unsigned long long size = index.size();
+
+    index.remove(testPoint(3, 1));
+    bool ok = check(index.size() == size, "point removed by another walk");
+
+    index.remove(testPoint(3));
+    ok &= check(index.size() == size - 1, "point not removed");
+
+    std::vector<StoredPoint> points;
+    std::vector<PointCollision> collisions;
+    points.push_back(testPoint(3, 4));
+    index.insert(points, collisions);
+    ok &= check(collisions.empty() && index.size() == size, "removed point still collides");
+
+    return ok;
+}
+
+/**
+ * Inserts without closing the index, as when the service is killed. The
+ * points were logged, so opening the index again finds them
+ */
+static bool testUncleanExit(const std::string &dir, unsigned long long filterBits, unsigned long long size)
+{
+    pid_t pid = fork();
+    if(pid == 0) {
+        PointIndex *index = new PointIndex(dir, filterBits);
+        _exit(insertRange(*index, 10000000, 10000000 + TEST_BATCH_SIZE) ? 0 : 1);
+    }
+
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if(!check(WIFEXITED(status) && WEXITSTATUS(status) == 0, "insert before the unclean exit failed")) {
+        return false;
+    }
+
+    PointIndex index(dir, filterBits);
+    bool ok = check(index.size() == size + TEST_BATCH_SIZE, "points lost in the unclean exit");
+    ok &= check(insertRange(index, 10000000, 10000000 + TEST_BATCH_SIZE) == false, "points not found after the unclean exit");
+
+    return ok;
+}
+
+/**
+ * A record cut off at the end of the log is dropped, and a table that does
+ * not match is rebuilt from the log
+ */
+static bool testDamage(const std::string &dir, unsigned long long filterBits, unsigned long long n, unsigned long long size)
+{
+    int fd = open(path(dir, "points.log").c_str(), O_WRONLY | O_APPEND);
+    const char torn[] = "\x01\x00\x00\x00\x40";
+    bool ok = check(fd >= 0 && write(fd, torn, sizeof(torn) - 1) == (ssize_t)(sizeof(torn) - 1), "cannot write the log");
+    close(fd);
+
+    {
+        PointIndex index(dir, filterBits);
+        ok &= check(index.size() == size, "wrong size after a torn log");
+        ok &= check(insertRange(index, 20000000, 20000000 + 10), "cannot insert after a torn log");
+    }
+
+    fd = open(path(dir, "points.idx").c_str(), O_WRONLY);
+    ok &= check(fd >= 0 && write(fd, "XXXX", 4) == 4, "cannot write the table");
+    close(fd);
+
+    PointIndex index(dir, filterBits);
+    ok &= check(index.size() == size + 10, "wrong size after rebuilding the table");
+    ok &= check(testCollisions(index, n, n + 3), "collisions wrong after rebuilding the table");
+
+    return ok;
+}
+
+static bool testIndex(const std::string &dir, unsigned long long filterBits, unsigned long long n)
+{
+    removeFiles(dir);
+
+    bool ok = true;
+    unsigned long long size = 0;
+
+    {
+        PointIndex index(dir, filterBits);
+
+        unsigned int t0 = util::getSystemTime();
+        ok &= check(insertRange(index, 0, n), "new points collide");
+        printf("%llu points in %ums\n", n, util::getSystemTime() - t0);
+
+        ok &= check(index.size() == n, "wrong size");
+        ok &= testCollisions(index, n, n + 1);
+        ok &= testRemove(index);
+
+        size = index.size();
+    }
+
+    {
+        PointIndex index(dir, filterBits);
+        ok &= check(index.size() == size, "wrong size after opening again");
+        ok &= testCollisions(index, n, n + 2);
+        size = index.size();
+    }
+
+    ok &= testUncleanExit(dir, filterBits, size);
+    ok &= testDamage(dir, filterBits, n, size + TEST_BATCH_SIZE);
+
+    removeFiles(dir);
+
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long long n = TEST_POINTS;
+
+    if(argc > 1) {
+        n = strtoull(argv[1], NULL, 0);
+    }
+
+    char dir[] = "/tmp/index_test.XXXXXX";
+    if(mkdtemp(dir) == NULL) {
+        printf("Cannot create a directory\n");
+        return 1;
+    }
+
+    bool ok = true;
+
+    try {
+        printf("Without a Bloom filter\n");
+        ok &= testIndex(dir, 0, n);
+
+        printf("With a Bloom filter\n");
+        ok &= testIndex(dir, TEST_FILTER_BITS, n);
+    } catch(std::string err) {
+        printf("Error: %s\n", err.c_str());
+        ok = false;
+    }
+
+    removeFiles(dir);
+    rmdir(dir);
+
+    if(!ok) {
+        return 1;
+    }
+
+    printf("OK\n");
+
+    return 0;
+}
@@ -0,0 +1,573 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+
+#include "CollisionMerger.h"
+#include "HttpServer.h"
+#include "JobCache.h"
+#include "MySQLPointStore.h"
+#include "ShardClient.h"
+#include "SpotChecker.h"
+#include "Submission.h"
+#include "Verifier.h"
+#include "logger.h"
+#include "util.h"
+#include "json/json.h"
+
+/**
+ * Takes point submissions in place of the Python server's /submit route.
+ * Points are checked on every core and written to the server's database
+ * in one statement per submission. The server's config file is read, so
+ * both use the same database and limits.
+ *
+ * Several of them can share the points of a job. Each keeps the points
+ * whose hash falls in its shard, and passes on the rest of a submission
+ * to the nodes they belong to
+ */
+
+// Milliseconds the status of a job is cached
+#define JOB_STATE_TTL 5000
+
+// Checks waiting for the spot checker before more are dropped
+#define SPOT_CHECK_QUEUE_SIZE 10000
+
+// Longest body accepted for each point a submission may hold. Enough for
+// a JSON point on a 512-bit curve
+#define MAX_BYTES_PER_POINT 1024
+
+// Longest client name kept, and the most dropped walks a submission can
+// report, as in the server
+#define MAX_CLIENT_LENGTH 64
+#define MAX_DROPPED (1ULL << 32)
+
+typedef struct {
+    std::string dbHost;
+    std::string dbUser;
+    std::string dbPassword;
+
+    unsigned short port;
+
+    unsigned int maxBatchSize;
+    unsigned int maxSubmissions;
+    unsigned int retryAfter;
+
+    // Threads checking points. 0 for one per core
+    int threads;
+
+    // Fraction of the points whose walk is replayed
+    double spotCheckRate;
+    int spotCheckThreads;
+
+    // Directory points are kept in instead of the database
+    std::string pointStoreDir;
+
+    // Size of the filter in front of the index of a job, 0 for none
+    unsigned int bloomFilterMB;
+
+    // Base URLs of all the nodes and the index of this one, for sharding
+    std::vector<std::string> shards;
+    int shardIndex;
+}IngestConfig;
+
+typedef struct {
+    IngestConfig config;
+    PointStore *store;
+    JobCache *jobs;
+    Verifier *verifier;
+    SpotChecker *spotChecker;
+
+    // NULL unless points are sharded
+    ShardClient *shards;
+
+    // NULL unless points are kept in indexes
+    CollisionMerger *merger;
+
+    // Submissions being handled
+    volatile unsigned int active;
+    volatile unsigned int submissions;
+}Service;
+
+static IngestConfig readConfig(const std::string &path)
+{
+    std::ifstream file(path.c_str());
+    if(!file.is_open()) {
+        throw std::string("Cannot open " + path);
+    }
+
+    std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    Json::Value root;
+    Json::Reader reader;
+
+    if(!reader.parse(text, root)) {
+        throw std::string("JSON parsing error: " + reader.getFormattedErrorMessages());
+    }
+
+    IngestConfig config;
+    config.dbHost = root.get("dbHost", "").asString();
+    config.dbUser = root.get("dbUser", "").asString();
+    config.dbPassword = root.get("dbPassword", "").asString();
+    config.port = (unsigned short)root.get("ingestPort", 9998).asUInt();
+    config.maxBatchSize = root.get("maxBatchSize", 4096).asUInt();
+    config.maxSubmissions = root.get("maxSubmissions", 8).asUInt();
+    config.retryAfter = root.get("retryAfter", 30).asUInt();
+    config.threads = root.get("ingestThreads", 0).asInt();
+    config.spotCheckRate = root.get("spotCheckRate", 0.001).asDouble();
+    config.spotCheckThreads = root.get("spotCheckThreads", 1).asInt();
+    config.pointStoreDir = root.get("pointStoreDir", "").asString();
+    config.bloomFilterMB = root.get("bloomFilterMB", 0).asUInt();
+    config.shardIndex = root.get("shardIndex", 0).asInt();
+
+    const Json::Value &shards = root["shards"];
+    for(unsigned int i = 0; i < shards.size(); i++) {
+        config.shards.push_back(shards[i].asString());
+    }
+
+    if(config.threads <= 0) {
+        config.threads = util::getNumCores();
+    }
+
+    if(config.spotCheckThreads < 0) {
+        config.spotCheckThreads = 0;
+    }
+
+    // Each node needs an index of its own
+    if(!config.shards.empty() && config.pointStoreDir.empty()) {
+        throw std::string("shards requires pointStoreDir");
+    }
+
+    return config;
+}
+
+static void jsonStatus(HttpResponse &response, const std::string &status)
+{
+    Json::Value root(Json::objectValue);
+    root["status"] = status;
+
+    Json::FastWriter writer;
+
+    response.status = 200;
+    response.contentType = "application/json";
+    response.body = writer.write(root);
+}
+
+/**
+ * Media type of a request, without its parameters
+ */
+static std::string mediaType(const HttpRequest &request)
+{
+    std::map<std::string, std::string>::const_iterator i = request.headers.find("content-type");
+
+    if(i == request.headers.end()) {
+        return "";
+    }
+
+    std::string type = i->second.substr(0, i->second.find(';'));
+    size_t end = type.find_last_not_of(" \t");
+
+    return end == std::string::npos ? "" : type.substr(0, end + 1);
+}
+
+/**
+ * Value of a header, or an empty string
+ */
+static std::string headerValue(const HttpRequest &request, const std::string &name)
+{
+    std::string key = name;
+    for(size_t j = 0; j < key.size(); j++) {
+        key[j] = (char)tolower((unsigned char)key[j]);
+    }
+
+    std::map<std::string, std::string>::const_iterator i = request.headers.find(key);
+
+    return i == request.headers.end() ? "" : i->second;
+}
+
+/**
+ * Only the characters of a name that are safe in a statement
+ */
+static std::string safeName(const std::string &name)
+{
+    std::string safe;
+
+    for(size_t i = 0; i < name.size() && safe.size() < MAX_CLIENT_LENGTH; i++) {
+        char c = name[i];
+
+        if((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '.' || c == ':' || c == '-') {
+            safe += c;
+        }
+    }
+
+    return safe;
+}
+
+/**
+ * Name the walk stats of the client of a request are kept under. Clients
+ * that give none are named by address
+ */
+static std::string clientName(const HttpRequest &request)
+{
+    std::string name = safeName(headerValue(request, CLIENT_HEADER));
+
+    if(name.empty()) {
+        name = safeName(request.remoteAddress);
+    }
+
+    return name.empty() ? "unknown" : name;
+}
+
+static int walkLengthBucket(unsigned long long length)
+{
+    int bucket = 0;
+
+    while(length > 0 && bucket < WALK_LENGTH_BUCKETS - 1) {
+        length >>= 1;
+        bucket++;
+    }
+
+    return bucket;
+}
+
+typedef struct {
+    Service *service;
+    int shard;
+    std::string path;
+    std::string body;
+    std::string client;
+    long status;
+}Forward;
+
+static void *forwardThread(void *p)
+{
+    Forward *f = (Forward *)p;
+
+    // The node that stores the points counts their duplicates and
+    // collisions for the client
+    std::vector<std::string> headers;
+    headers.push_back(std::string(CLIENT_HEADER) + ": " + f->client);
+
+    f->status = f->service->shards->post(f->shard, f->path, f->body, BINARY_CONTENT_TYPE, headers);
+
+    return NULL;
+}
+
+/**
+ * Posts the points that belong to other nodes to them, all at once.
+ * Returns false if any of them did not take its points
+ */
+static bool forwardPoints(Service *service, Job *job, const std::string &client, std::vector<std::vector<SubmittedPoint> > &byShard)
+{
+    std::vector<Forward> forwards;
+
+    for(size_t i = 0; i < byShard.size(); i++) {
+        if(!byShard[i].empty()) {
+            Forward f;
+            f.service = service;
+            f.shard = (int)i;
+            f.path = "/shard/" + job->name;
+            f.body = encodeBinaryPoints(job->record.params, byShard[i]);
+            f.client = client;
+            f.status = 0;
+
+            forwards.push_back(f);
+        }
+    }
+
+    std::vector<Thread *> threads;
+
+    for(size_t i = 0; i < forwards.size(); i++) {
+        try {
+            threads.push_back(new Thread(forwardThread, &forwards[i]));
+        } catch(...) {
+            Logger::logError("Error creating forwarding thread");
+        }
+    }
+
+    for(size_t i = 0; i < threads.size(); i++) {
+        threads[i]->wait();
+        delete threads[i];
+    }
+
+    bool ok = true;
+
+    for(size_t i = 0; i < forwards.size(); i++) {
+        if(forwards[i].status != 200) {
+            Logger::logError("Shard %d did not take %d points for job %s: HTTP %ld", forwards[i].shard,
+                             (int)byShard[forwards[i].shard].size(), job->name.c_str(), forwards[i].status);
+            ok = false;
+        }
+    }
+
+    return ok;
+}
+
+static void busyResponse(Service *service, HttpResponse &response)
+{
+    char retry[16];
+    snprintf(retry, sizeof(retry), "%u", service->config.retryAfter);
+
+    response.status = 429;
+    response.headers.push_back(std::make_pair(std::string("Retry-After"), std::string(retry)));
+}
+
+/**
+ * Handles a submission from a client, or from another node when forwarded
+ * is true. Forwarded points must all belong to this node
+ */
+static void handleSubmission(Service *service, const std::string &id, const HttpRequest &request, HttpResponse &response, bool forwarded)
+{
+    Job *job = service->jobs->get(id);
+
+    if(job == NULL) {
+        Logger::logInfo("Could not find job %s", id.c_str());
+        response.status = 404;
+        return;
+    }
+
+    // Points for a solved job are not needed. The status tells the client
+    // to stop
+    std::string status = job->getStatus();
+    if(status != "unsolved") {
+        jsonStatus(response, status);
+        return;
+    }
+
+    std::vector<SubmittedPoint> points;
+
+    try {
+        if(mediaType(request) == BINARY_CONTENT_TYPE) {
+            decodeBinaryPoints(job->record.params, request.body, points);
+        } else {
+            decodeJsonPoints(request.body, points);
+        }
+    } catch(UnsupportedFormatError e) {
+        Logger::logInfo("Invalid binary submission: " + e.message);
+        response.status = 415;
+        return;
+    } catch(std::string err) {
+        Logger::logInfo("Invalid submission: " + err);
+        response.status = 400;
+        return;
+    }
+
+    if(points.size() > service->config.maxBatchSize) {
+        Logger::logInfo("Too many points in submission: %d", (int)points.size());
+        response.status = 413;
+        return;
+    }
+
+    if(!service->verifier->verify(job, points)) {
+        Logger::logInfo("Invalid point in submission for job %s", id.c_str());
+        response.status = 400;
+        return;
+    }
+
+    std::string client = clientName(request);
+
+    // A submission counts for the node the client sent it to. Forwarded
+    // points only add their duplicates and collisions
+    WalkStats stats;
+    memset(&stats, 0, sizeof(stats));
+
+    if(!forwarded) {
+        stats.submissions = 1;
+        stats.points = points.size();
+        stats.dropped = std::min(strtoull(headerValue(request, DROPPED_HEADER).c_str(), NULL, 10), MAX_DROPPED);
+
+        for(size_t i = 0; i < points.size(); i++) {
+            stats.steps += points[i].length;
+            stats.histogram[walkLengthBucket(points[i].length)]++;
+        }
+    }
+
+    // The points of other nodes are kept by them. If one of them cannot
+    // take its points the client sends them all again later, and the ones
+    // that were stored are found to be the same points
+    bool forwardFailed = false;
+
+    if(service->shards != NULL) {
+        int self = service->shards->getSelf();
+        std::vector<std::vector<SubmittedPoint> > byShard(service->shards->getCount());
+
+        for(size_t i = 0; i < points.size(); i++) {
+            byShard[service->shards->owner(points[i].x, points[i].y.lsb())].push_back(points[i]);
+        }
+
+        if(forwarded && byShard[self].size() != points.size()) {
+            Logger::logError("Forwarded points for job %s do not belong to this shard", id.c_str());
+            response.status = 400;
+            return;
+        }
+
+        if(!forwarded) {
+            forwardFailed = !forwardPoints(service, job, client, byShard);
+        }
+
+        points.swap(byShard[self]);
+    }
+
+    std::vector<StoredPoint> stored(points.size());
+    for(size_t i = 0; i < points.size(); i++) {
+        stored[i].a = points[i].a;
+        stored[i].b = points[i].b;
+        stored[i].x = points[i].x;
+        stored[i].y = points[i].y;
+        stored[i].length = points[i].length;
+    }
+
+    int collisions = 0;
+    unsigned int duplicates = 0;
+
+    if(job->points != NULL) {
+        std::vector<PointCollision> found;
+        duplicates = job->points->insert(stored, found);
+        service->merger->add(id, found);
+
+        collisions = (int)found.size();
+    } else {
+        collisions = service->store->insertPoints(id, stored, duplicates);
+    }
+
+    if(collisions > 0) {
+        Logger::logInfo("==== FOUND %d COLLISION(S) FOR JOB %s ====", collisions, id.c_str());
+    }
+
+    stats.duplicates = duplicates;
+    stats.collisions = collisions;
+
+    // The points are stored, so a failure here must not make the client
+    // send them again
+    if(stats.submissions > 0 || duplicates > 0 || collisions > 0) {
+        try {
+            service->store->recordWalkStats(id, client, stats, (unsigned long long)time(NULL));
+        } catch(std::string err) {
+            Logger::logError("Error recording walk stats for job %s: %s", id.c_str(), err.c_str());
+        }
+    }
+
+    // Points are checked once they are stored, so that a failed one can be
+    // removed
+    if(service->spotChecker != NULL) {
+        unsigned int seed = util::getSystemTime() ^ (atomicAdd(&service->submissions, 1) * 2654435761u);
+        double threshold = service->config.spotCheckRate * RAND_MAX;
+
+        for(size_t i = 0; i < stored.size(); i++) {
+            if(rand_r(&seed) < threshold) {
+                service->spotChecker->push(job, stored[i]);
+            }
+        }
+    }
+
+    if(forwardFailed) {
+        busyResponse(service, response);
+        return;
+    }
+
+    jsonStatus(response, status);
+}
+
+static void handleRequest(const HttpRequest &request, HttpResponse &response, void *data)
+{
+    Service *service = (Service *)data;
+
+    const std::string prefix = "/submit/";
+    const std::string shardPrefix = "/shard/";
+
+    bool forwarded = service->shards != NULL && request.path.compare(0, shardPrefix.size(), shardPrefix) == 0;
+
+    if(!forwarded && request.path.compare(0, prefix.size(), prefix) != 0) {
+        response.status = 404;
+        return;
+    }
+
+    if(request.method != "POST") {
+        response.status = 405;
+        return;
+    }
+
+    // Points from other nodes are not limited. They come from submissions
+    // the other nodes are handling, and refusing them would fail those
+    if(forwarded) {
+        handleSubmission(service, request.path.substr(shardPrefix.size()), request, response, true);
+        return;
+    }
+
+    // Tell the client to come back later when too many submissions are
+    // being handled
+    if(atomicAdd(&service->active, 1) >= service->config.maxSubmissions) {
+        atomicAdd(&service->active, -1);
+        busyResponse(service, response);
+        return;
+    }
+
+    try {
+        handleSubmission(service, request.path.substr(prefix.size()), request, response, false);
+    } catch(std::string err) {
+        atomicAdd(&service->active, -1);
+        throw;
+    }
+
+    atomicAdd(&service->active, -1);
+}
+
+int main(int argc, char **argv)
+{
+    std::string path = argc > 1 ? argv[1] : "../../server/config/config.json";
+
+    Service service;
+    service.active = 0;
+    service.submissions = 0;
+
+    try {
+        service.config = readConfig(path);
+
+        // Nodes can share a config file and be told their shard here
+        if(argc > 2) {
+            service.config.shardIndex = atoi(argv[2]);
+        }
+
+        const IngestConfig &config = service.config;
+
+        // Each submission and spot check thread holds one connection at most
+        service.store = new MySQLPointStore(config.dbHost, config.dbUser, config.dbPassword,
+                                            config.maxSubmissions + config.spotCheckThreads);
+        service.jobs = new JobCache(service.store, JOB_STATE_TTL, config.pointStoreDir,
+                                    (unsigned long long)config.bloomFilterMB << 23);
+        service.verifier = new Verifier(config.threads);
+
+        service.spotChecker = NULL;
+        if(config.spotCheckRate > 0.0 && config.spotCheckThreads > 0) {
+            service.spotChecker = new SpotChecker(service.store, config.spotCheckThreads, SPOT_CHECK_QUEUE_SIZE);
+        }
+
+        service.merger = NULL;
+        if(!config.pointStoreDir.empty()) {
+            service.merger = new CollisionMerger(config.pointStoreDir, service.store);
+        }
+
+        service.shards = NULL;
+        if(!config.shards.empty()) {
+            curl_global_init(CURL_GLOBAL_ALL);
+            service.shards = new ShardClient(config.shards, config.shardIndex);
+
+            Logger::logInfo("Shard %d of %d", config.shardIndex, (int)config.shards.size());
+        }
+
+        Logger::logInfo("Checking points on %d threads, replaying %g of the walks",
+                        config.threads, config.spotCheckRate);
+
+        HttpServer server(config.port, (size_t)config.maxBatchSize * MAX_BYTES_PER_POINT + 1024,
+                          handleRequest, &service);
+        server.run();
+    } catch(std::string err) {
+        Logger::logError(err);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,338 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "JobCache.h"
+#include "MemoryPointStore.h"
+
+#ifdef STORE_TEST_MYSQL
+#include "MySQLPointStore.h"
+#endif
+
+// Job the tests write to
+#define TEST_JOB "store_test"
+
+#define TEST_R_POINTS 16
+
+/**
+ * Point i of the test. walk picks a different walk to the same end point
+ */
+static StoredPoint testPoint(int i, int walk = 0)
+{
+    StoredPoint p = { BigInteger(1000 + i + walk * 100000), BigInteger(7 * i + walk + 1),
+                      BigInteger(0x10000 + i), BigInteger(i & 1), (unsigned long long)(i + 1) };
+
+    return p;
+}
+
+/**
+ * y^2 = x^3 + x + 1 over F_23, with the generator (3, 10) of order 28
+ */
+static JobRecord testJob()
+{
+    JobRecord job;
+
+    job.params.p = BigInteger(23);
+    job.params.a = BigInteger(1);
+    job.params.b = BigInteger(1);
+    job.params.n = BigInteger(28);
+    job.params.gx = BigInteger(3);
+    job.params.gy = BigInteger(10);
+    job.params.qx = BigInteger(9);
+    job.params.qy = BigInteger(7);
+    job.params.dBits = 2;
+    job.params.negation = false;
+    job.params.kangaroo = false;
+
+    for(int i = 0; i < TEST_R_POINTS; i++) {
+        job.ra.push_back(BigInteger(i + 2));
+        job.rb.push_back(BigInteger(i + 3));
+        job.params.rx.push_back(BigInteger(i));
+        job.params.ry.push_back(BigInteger(i + 1));
+    }
+
+    job.status = "unsolved";
+    job.activeBits = 4;
+    job.maxBits = 6;
+
+    return job;
+}
+
+static bool check(bool ok, const char *what)
+{
+    if(!ok) {
+        printf("Error: %s\n", what);
+    }
+
+    return ok;
+}
+
+static int insert(PointStore &store, const std::vector<StoredPoint> &points, unsigned int &duplicates)
+{
+    return store.insertPoints(TEST_JOB, points, duplicates);
+}
+
+static bool testLoad(PointStore &store)
+{
+    JobRecord expected = testJob();
+    JobRecord job;
+
+    bool ok = check(!store.loadJob("no_such_job", job), "unknown job loaded");
+    ok &= check(!store.loadJob("store_test;", job) && !store.loadJobState("", job), "invalid name loaded");
+
+    if(!check(store.loadJob(TEST_JOB, job), "job not loaded")) {
+        return false;
+    }
+
+    ok &= check(job.params.p == expected.params.p && job.params.n == expected.params.n
+                && job.params.qy == expected.params.qy && job.params.dBits == expected.params.dBits, "wrong parameters");
+    ok &= check(job.params.rx.size() == TEST_R_POINTS && job.ra.size() == TEST_R_POINTS, "wrong number of R points");
+    ok &= check(job.ra[5] == expected.ra[5] && job.rb[5] == expected.rb[5] && job.params.ry[5] == expected.params.ry[5], "wrong R point");
+    ok &= check(job.status == "unsolved" && job.activeBits == 4 && job.maxBits == 6, "wrong state");
+
+    job.status = "";
+    ok &= check(store.loadJobState(TEST_JOB, job) && job.status == "unsolved", "state not loaded");
+
+    return ok;
+}
+
+/**
+ * Resent walks are duplicates and other walks to a stored end point are
+ * collisions, also within one submission. Only the walk that stored a point
+ * removes it
+ */
+static bool testInsert(PointStore &store)
+{
+    std::vector<StoredPoint> points;
+    unsigned int duplicates = 0;
+
+    for(int i = 0; i < 8; i++) {
+        points.push_back(testPoint(i));
+    }
+    bool ok = check(insert(store, points, duplicates) == 0 && duplicates == 0, "new points collide");
+
+    points.clear();
+    for(int i = 0; i < 4; i++) {
+        points.push_back(testPoint(i));
+    }
+    points.push_back(testPoint(5, 1));
+    points.push_back(testPoint(6, 1));
+    points.push_back(testPoint(20));
+    points.push_back(testPoint(20, 2));
+    points.push_back(testPoint(20));
+
+    ok &= check(insert(store, points, duplicates) == 3, "wrong number of collisions");
+    ok &= check(duplicates == 5, "wrong number of duplicates");
+
+    store.deletePoint(TEST_JOB, testPoint(7, 1));
+    points.clear();
+    points.push_back(testPoint(7, 3));
+    ok &= check(insert(store, points, duplicates) == 1, "point removed by another walk");
+
+    store.deletePoint(TEST_JOB, testPoint(7));
+    ok &= check(insert(store, points, duplicates) == 0 && duplicates == 0, "removed point still collides");
+
+    try {
+        store.insertPoints("no_such_job", points, duplicates);
+        ok &= check(false, "points of an unknown job stored");
+    } catch(std::string err) {
+    }
+
+    std::vector<PointCollision> collisions(1);
+    collisions[0].point = testPoint(30, 1);
+    collisions[0].a = testPoint(30).a;
+    collisions[0].b = testPoint(30).b;
+    collisions[0].length = 31;
+    store.insertCollisions(TEST_JOB, collisions);
+
+    WalkStats stats;
+    memset(&stats, 0, sizeof(stats));
+    stats.submissions = 1;
+    stats.points = 9;
+    stats.histogram[3] = 9;
+    store.recordWalkStats(TEST_JOB, "client", stats, 1000);
+    store.recordWalkStats(TEST_JOB, "client", stats, 1001);
+
+    return ok;
+}
+
+/**
+ * What only the fake can tell: the collisions and walk stats it was given
+ */
+static bool testRecorded(MemoryPointStore &store)
+{
+    std::vector<PointCollision> collisions = store.collisions(TEST_JOB);
+
+    bool ok = check(collisions.size() == 5, "wrong number of collisions recorded");
+    ok &= check(store.pointCount(TEST_JOB) == 9, "wrong number of points");
+
+    if(collisions.size() == 5) {
+        ok &= check(collisions[0].point.a == testPoint(5, 1).a && collisions[0].a == testPoint(5).a
+                    && collisions[0].length == 6, "collision has the wrong stored walk");
+        ok &= check(collisions[2].point.a == testPoint(20, 2).a && collisions[2].a == testPoint(20).a, "collision within a submission is wrong");
+        ok &= check(collisions[4].length == 31, "inserted collision is wrong");
+    }
+
+    WalkStats stats;
+    ok &= check(store.walkStats(TEST_JOB, "client", stats) && stats.submissions == 2 && stats.points == 18
+                && stats.histogram[3] == 18, "wrong walk stats");
+
+    return ok;
+}
+
+/**
+ * The jobs the service uses come from the store, and their state is read
+ * again once it is older than the TTL
+ */
+static bool testJobCache(MemoryPointStore &store)
+{
+    JobCache jobs(&store, 0, "");
+
+    bool ok = check(jobs.get("no_such_job") == NULL, "unknown job in the cache");
+
+    Job *job = jobs.get(TEST_JOB);
+    if(!check(job != NULL, "job not in the cache")) {
+        return false;
+    }
+    ok &= check(job->getStatus() == "unsolved" && job->getMaxBits() == 6, "wrong state in the cache");
+
+    JobRecord solved = testJob();
+    solved.status = "solved";
+    solved.maxBits = 8;
+    store.addJob(TEST_JOB, solved);
+
+    ok &= check(jobs.get(TEST_JOB) == job, "job loaded twice");
+    ok &= check(job->getStatus() == "solved" && job->getMaxBits() == 8, "state not read again");
+
+    return ok;
+}
+
+static bool testMemory()
+{
+    printf("In memory\n");
+
+    MemoryPointStore store;
+    store.addJob(TEST_JOB, testJob());
+
+    bool ok = testLoad(store);
+    ok &= testInsert(store);
+    ok &= testRecorded(store);
+    ok &= testJobCache(store);
+
+    return ok;
+}
+
+#ifdef STORE_TEST_MYSQL
+static void execute(MYSQL *db, const std::string &sql)
+{
+    if(mysql_real_query(db, sql.data(), sql.size()) != 0) {
+        throw std::string("Database error: ") + mysql_error(db);
+    }
+}
+
+static void removeJob(MYSQL *db)
+{
+    const char *tables[] = { "JobParams", "JobInfo", "RPoints", "Collisions", "WalkStats", "WalkLengths" };
+
+    for(int i = 0; i < (int)(sizeof(tables) / sizeof(tables[0])); i++) {
+        execute(db, std::string("DELETE FROM ") + tables[i] + " WHERE Name='" TEST_JOB "';");
+    }
+    execute(db, "DROP TABLE IF EXISTS " TEST_JOB ";");
+}
+
+/**
+ * Writes the test job the way server.py creates a job
+ */
+static void createJob(MYSQL *db)
+{
+    JobRecord job = testJob();
+    const ECDLPParams &p = job.params;
+
+    char buf[64];
+    sprintf(buf, "%d, 0, 'rho', '0', '0', %d, %d", p.dBits, job.activeBits, job.maxBits);
+
+    execute(db, "INSERT INTO JobParams(Name, P, A, B, N, Gx, Gy, Qx, Qy, DBits, Negation, Walk, Lower, Upper, ActiveDBits, MaxDBits) VALUES('" TEST_JOB "','"
+                + p.p.toString(16) + "','" + p.a.toString(16) + "','" + p.b.toString(16) + "','" + p.n.toString(16) + "','"
+                + p.gx.toString(16) + "','" + p.gy.toString(16) + "','" + p.qx.toString(16) + "','" + p.qy.toString(16) + "',"
+                + buf + ");");
+    execute(db, "INSERT INTO JobInfo(Name, NotificationEmail, Status, Solution) VALUES('" TEST_JOB "', '', 'unsolved', '');");
+
+    for(int i = 0; i < TEST_R_POINTS; i++) {
+        sprintf(buf, "%d", i);
+        execute(db, std::string("INSERT INTO RPoints(Name, Idx, A, B, X, Y) VALUES('" TEST_JOB "',") + buf + ",'"
+                    + job.ra[i].toString(16) + "','" + job.rb[i].toString(16) + "','"
+                    + p.rx[i].toString(16) + "','" + p.ry[i].toString(16) + "');");
+    }
+
+    execute(db, "CREATE TABLE " TEST_JOB "(StartA VARCHAR(256) NOT NULL, StartB VARCHAR(256) NOT NULL, "
+                "EndPoint VARCHAR(256) NOT NULL, WalkLength INT(10) UNSIGNED NOT NULL, PRIMARY KEY(EndPoint));");
+}
+
+/**
+ * Runs the same tests on a database server.py has set up. The test job is
+ * removed again afterwards
+ */
+static bool testMySQL(const char *host, const char *user, const char *password)
+{
+    printf("MySQL on %s\n", host);
+
+    MySQLPointStore store(host, user, password, 2);
+
+    MYSQL *db = mysql_init(NULL);
+    if(mysql_real_connect(db, host, user, password, ECDL_DB_NAME, 0, NULL, 0) == NULL) {
+        std::string err = mysql_error(db);
+        mysql_close(db);
+        throw std::string("Error connecting to the database: ") + err;
+    }
+
+    bool ok = true;
+
+    try {
+        removeJob(db);
+        createJob(db);
+
+        ok = testLoad(store);
+        ok &= testInsert(store);
+
+        removeJob(db);
+    } catch(std::string err) {
+        mysql_close(db);
+        throw;
+    }
+
+    mysql_close(db);
+
+    return ok;
+}
+#endif
+
+int main(int argc, char **argv)
+{
+    bool ok = true;
+
+    try {
+        ok &= testMemory();
+
+#ifdef STORE_TEST_MYSQL
+        if(argc != 4) {
+            printf("Usage: %s host user password\n", argv[0]);
+            return 1;
+        }
+        ok &= testMySQL(argv[1], argv[2], argv[3]);
+#else
+        (void)argc;
+        (void)argv;
+#endif
+    } catch(std::string err) {
+        printf("Error: %s\n", err.c_str());
+        ok = false;
+    }
+
+    if(!ok) {
+        return 1;
+    }
+
+    printf("OK\n");
+
+    return 0;
+}
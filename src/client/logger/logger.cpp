@@ -1,66 +1,237 @@
 #include"logger.h"
+#include"threads.h"
 #include <string>
-#include <iostream>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <ctime>
 
-static std::string getDateString()
+// Messages the buffer holds. A power of 2
+#define LOG_QUEUE_SIZE 1024
+
+// Longest message. Longer ones are cut
+#define LOG_MESSAGE_SIZE 1024
+
+// Milliseconds the writer sleeps when the buffer is empty
+#define LOG_WRITER_WAIT 10
+
+/**
+ * One message in the buffer. sequence is the position the record can be
+ * claimed at while it is free, and that position + 1 once the message in
+ * it is complete
+ */
+typedef struct {
+    volatile unsigned int sequence;
+    int level;
+    time_t time;
+    char text[LOG_MESSAGE_SIZE];
+}LogRecord;
+
+// Stages of starting the writer
+#define LOG_STOPPED 0
+#define LOG_STARTING 1
+#define LOG_RUNNING 2
+
+int Logger::_level = LOG_LEVEL_INFO;
+
+static LogRecord _records[LOG_QUEUE_SIZE];
+
+// Next position to claim, shared by the threads that log
+static volatile unsigned int _head = 0;
+
+// Next position to write, used by the writer only
+static unsigned int _tail = 0;
+
+// Messages dropped because the buffer was full
+static volatile unsigned int _dropped = 0;
+
+static volatile unsigned int _state = LOG_STOPPED;
+
+// Held while writing out the buffer. Allocated when the writer starts so
+// that logging works during static initialization
+static Mutex *_writeMutex = NULL;
+static ConditionVariable *_writerWake = NULL;
+
+static std::string getDateString(time_t rawtime)
 {
-  time_t rawtime;
   struct tm * timeinfo;
   char buffer[128];
 
-  time (&rawtime);
   timeinfo = localtime(&rawtime);
 
   strftime(buffer,128,"%d-%m-%Y %I:%M:%S",timeinfo);
-  
+
   return std::string(buffer);
 
 }
 
-void Logger::logInfo(std::string s)
+static void writeRecord(const LogRecord *record)
 {
-    std::string dateTime = getDateString();
+    std::string dateTime = getDateString(record->time);
+
+    if(record->level == LOG_LEVEL_ERROR) {
+        fprintf(stderr, "[%s] [ERROR] %s\n", dateTime.c_str(), record->text);
+    } else {
+        fprintf(stdout, "[%s] %s\n", dateTime.c_str(), record->text);
+    }
+}
+
+/**
+ * Writes the complete messages in the buffer. Returns false if there were
+ * none. Called with _writeMutex held
+ */
+static bool drain()
+{
+    bool wrote = false;
+
+    for(;;) {
+        LogRecord *record = &_records[_tail & (LOG_QUEUE_SIZE - 1)];
+
+        if(atomicLoad(&record->sequence) != _tail + 1) {
+            break;
+        }
 
-    fprintf(stdout, "[%s] ", dateTime.c_str());
-    fprintf(stdout, "%s\n", s.c_str());
+        writeRecord(record);
+        wrote = true;
+
+        // Free the record for the position one lap ahead
+        atomicStore(&record->sequence, _tail + LOG_QUEUE_SIZE);
+        _tail++;
+    }
+
+    unsigned int dropped = atomicExchange(&_dropped, 0);
+    if(dropped > 0) {
+        time_t now = time(NULL);
+        fprintf(stderr, "[%s] [ERROR] Log buffer full, dropped %d messages\n", getDateString(now).c_str(), dropped);
+        wrote = true;
+    }
+
+    if(wrote) {
+        fflush(stdout);
+        fflush(stderr);
+    }
+
+    return wrote;
 }
 
-void Logger::logInfo(const char *format, ...)
+static void *writerThread(void *p)
 {
-    va_list args;
+    _writeMutex->grab();
+
+    for(;;) {
+        if(!drain()) {
+            _writerWake->wait(*_writeMutex, LOG_WRITER_WAIT);
+        }
+    }
 
-    std::string dateTime = getDateString();
+    return NULL;
+}
 
-    fprintf(stdout, "[%s] ", dateTime.c_str());
-    va_start(args, format);
-    vfprintf(stdout,format, args);
-    fprintf(stdout, "\n");
-    va_end(args);
+/**
+ * Writes what is left in the buffer when the program exits
+ */
+static void flushAtExit()
+{
+    Logger::flush();
 }
 
-void Logger::logError(std::string s)
+/**
+ * Starts the writer on the first message. Threads that log while another
+ * one starts it wait for it
+ */
+static void start()
 {
-    std::string dateTime = getDateString();
+    if(atomicCompareAndSwap(&_state, LOG_STOPPED, LOG_STARTING) != LOG_STOPPED) {
+        while(atomicLoad(&_state) != LOG_RUNNING) {
+        }
+        return;
+    }
+
+    for(unsigned int i = 0; i < LOG_QUEUE_SIZE; i++) {
+        _records[i].sequence = i;
+    }
+
+    _writeMutex = new Mutex();
+    _writerWake = new ConditionVariable();
+
+    Thread t(writerThread, NULL);
+    atexit(flushAtExit);
 
-    fprintf(stdout, "[%s] ", dateTime.c_str());
-    fprintf(stdout, "%s\n", s.c_str());
+    atomicStore(&_state, LOG_RUNNING);
 }
 
+void Logger::write(int level, const char *format, va_list args)
+{
+    if(atomicLoad(&_state) != LOG_RUNNING) {
+        start();
+    }
+
+    // Claim the next free record. A record that is not free yet means the
+    // buffer is full
+    unsigned int pos = atomicLoad(&_head);
+    LogRecord *record = NULL;
+
+    for(;;) {
+        record = &_records[pos & (LOG_QUEUE_SIZE - 1)];
+        int diff = (int)(atomicLoad(&record->sequence) - pos);
+
+        if(diff == 0) {
+            unsigned int old = atomicCompareAndSwap(&_head, pos, pos + 1);
+            if(old == pos) {
+                break;
+            }
+            pos = old;
+        } else if(diff < 0) {
+            atomicAdd(&_dropped, 1);
+            return;
+        } else {
+            pos = atomicLoad(&_head);
+        }
+    }
+
+    record->level = level;
+    record->time = time(NULL);
+    vsnprintf(record->text, LOG_MESSAGE_SIZE, format, args);
+
+    atomicStore(&record->sequence, pos + 1);
+}
 
-void Logger::logError(const char *format, ...)
+/**
+ * Writes the messages logged so far. Waits for the writer if it is busy
+ */
+void Logger::flush()
 {
-    std::string dateTime = getDateString();
+    if(atomicLoad(&_state) != LOG_RUNNING) {
+        return;
+    }
 
-    fprintf(stderr, "[%s] ", dateTime.c_str());
+    _writeMutex->grab();
+    drain();
+    _writeMutex->release();
+}
 
-    va_list args;
-    va_start(args, format);
-    fprintf(stderr, "[ERROR] ");
-    vfprintf(stderr, format, args);
-    fprintf(stderr, "\n");
-    va_end(args);
+void Logger::setLevel(int level)
+{
+    _level = level;
 }
 
+int Logger::getLevel()
+{
+    return _level;
+}
+
+/**
+ * Level for "error", "info" or "debug"
+ */
+int Logger::parseLevel(const std::string &name)
+{
+    if(name == "error") {
+        return LOG_LEVEL_ERROR;
+    } else if(name == "info") {
+        return LOG_LEVEL_INFO;
+    } else if(name == "debug") {
+        return LOG_LEVEL_DEBUG;
+    }
+
+    throw std::string("Invalid log level: " + name);
+}
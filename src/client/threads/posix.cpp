@@ -1,8 +1,14 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include "threads.h"
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <sys/time.h>
 
 Thread::Thread()
 {
@@ -34,6 +40,19 @@ void Thread::wait()
     pthread_join(this->handle, NULL);
 }
 
+bool setThreadAffinity(int core)
+{
+#ifdef __linux__
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(core, &cpus);
+
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0;
+#else
+    return false;
+#endif
+}
+
 
 Mutex::Mutex()
 {
@@ -64,3 +83,89 @@ void Mutex::release()
         printf("Error unlocking mutex: %s\n", strerror(errno));
     }
 }
+
+ConditionVariable::ConditionVariable()
+{
+    if(pthread_cond_init(&this->handle, NULL)) {
+        throw "Error creating condition variable";
+    }
+}
+
+ConditionVariable::~ConditionVariable()
+{
+}
+
+void ConditionVariable::destroy()
+{
+    pthread_cond_destroy(&this->handle);
+}
+
+void ConditionVariable::wait(Mutex &mutex)
+{
+    if(pthread_cond_wait(&this->handle, &mutex.handle)) {
+        printf("Error waiting on condition variable: %s\n", strerror(errno));
+    }
+}
+
+/**
+ * Waits at most ms milliseconds. Returns false on a timeout
+ */
+bool ConditionVariable::wait(Mutex &mutex, unsigned int ms)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    unsigned long long usec = (unsigned long long)now.tv_usec + (unsigned long long)ms * 1000;
+
+    struct timespec deadline;
+    deadline.tv_sec = now.tv_sec + usec / 1000000;
+    deadline.tv_nsec = (usec % 1000000) * 1000;
+
+    return pthread_cond_timedwait(&this->handle, &mutex.handle, &deadline) == 0;
+}
+
+void ConditionVariable::signal()
+{
+    pthread_cond_signal(&this->handle);
+}
+
+void ConditionVariable::broadcast()
+{
+    pthread_cond_broadcast(&this->handle);
+}
+
+unsigned int atomicLoad(volatile unsigned int *ptr)
+{
+    unsigned int value = *ptr;
+    __sync_synchronize();
+
+    return value;
+}
+
+void atomicStore(volatile unsigned int *ptr, unsigned int value)
+{
+    __sync_synchronize();
+    *ptr = value;
+}
+
+unsigned int atomicCompareAndSwap(volatile unsigned int *ptr, unsigned int oldValue, unsigned int newValue)
+{
+    return __sync_val_compare_and_swap(ptr, oldValue, newValue);
+}
+
+unsigned int atomicAdd(volatile unsigned int *ptr, unsigned int value)
+{
+    return __sync_fetch_and_add(ptr, value);
+}
+
+unsigned int atomicExchange(volatile unsigned int *ptr, unsigned int value)
+{
+    unsigned int old = *ptr;
+    unsigned int prev;
+
+    while((prev = __sync_val_compare_and_swap(ptr, old, value)) != old) {
+        old = prev;
+    }
+
+    return old;
+}
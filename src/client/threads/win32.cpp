@@ -28,23 +28,98 @@ void Thread::wait()
 
 Mutex::Mutex()
 {
-    this->handle = CreateMutex(NULL, FALSE, NULL);
+    InitializeCriticalSection(&this->handle);
 }
 
 Mutex::~Mutex()
 {
-    CloseHandle(this->handle);
+}
+
+void Mutex::destroy()
+{
+    DeleteCriticalSection(&this->handle);
 }
 
 void Mutex::grab()
 {
-	if(WaitForSingleObject( mutex->handle, INFINITE) != 0) {
-        throw "Error waiting for mutex";	
-    }
+    EnterCriticalSection(&this->handle);
 }
 
 void Mutex::release()
 {
-    ReleaseMutex(this->handle); 
+    LeaveCriticalSection(&this->handle);
+}
+
+ConditionVariable::ConditionVariable()
+{
+    InitializeConditionVariable(&this->handle);
+}
+
+ConditionVariable::~ConditionVariable()
+{
 }
 
+void ConditionVariable::destroy()
+{
+}
+
+void ConditionVariable::wait(Mutex &mutex)
+{
+    SleepConditionVariableCS(&this->handle, &mutex.handle, INFINITE);
+}
+
+/**
+ * Waits at most ms milliseconds. Returns false on a timeout
+ */
+bool ConditionVariable::wait(Mutex &mutex, unsigned int ms)
+{
+    return SleepConditionVariableCS(&this->handle, &mutex.handle, ms) != 0;
+}
+
+void ConditionVariable::signal()
+{
+    WakeConditionVariable(&this->handle);
+}
+
+void ConditionVariable::broadcast()
+{
+    WakeAllConditionVariable(&this->handle);
+}
+
+unsigned int atomicLoad(volatile unsigned int *ptr)
+{
+    unsigned int value = *ptr;
+    MemoryBarrier();
+
+    return value;
+}
+
+void atomicStore(volatile unsigned int *ptr, unsigned int value)
+{
+    MemoryBarrier();
+    *ptr = value;
+}
+
+unsigned int atomicCompareAndSwap(volatile unsigned int *ptr, unsigned int oldValue, unsigned int newValue)
+{
+    return (unsigned int)InterlockedCompareExchange((volatile LONG *)ptr, (LONG)newValue, (LONG)oldValue);
+}
+
+unsigned int atomicAdd(volatile unsigned int *ptr, unsigned int value)
+{
+    return (unsigned int)InterlockedExchangeAdd((volatile LONG *)ptr, (LONG)value);
+}
+
+unsigned int atomicExchange(volatile unsigned int *ptr, unsigned int value)
+{
+    return (unsigned int)InterlockedExchange((volatile LONG *)ptr, (LONG)value);
+}
+
+bool setThreadAffinity(int core)
+{
+    if(core >= (int)sizeof(DWORD_PTR) * 8) {
+        return false;
+    }
+
+    return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << core) != 0;
+}
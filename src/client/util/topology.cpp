@@ -0,0 +1,134 @@
+#include"util.h"
+#include<stdlib.h>
+#include<string>
+#include<vector>
+#ifndef _WIN32
+    #include<dirent.h>
+#endif
+
+namespace util {
+
+#ifndef _WIN32
+/**
+ * Reads the first line of a file. Returns an empty string when the file
+ * cannot be read
+ */
+static std::string readLine(const std::string &fileName)
+{
+    char buf[4096] = {0};
+
+    FILE *fp = fopen(fileName.c_str(), "r");
+    if(fp == NULL) {
+        return "";
+    }
+
+    if(fgets(buf, sizeof(buf), fp) == NULL) {
+        buf[0] = '\0';
+    }
+    fclose(fp);
+
+    return std::string(buf);
+}
+
+/**
+ * Parses a CPU list in the kernel's format, e.g. "0-3,8,10-11"
+ */
+static std::vector<int> parseCpuList(const std::string &list)
+{
+    std::vector<int> cpus;
+    const char *ptr = list.c_str();
+
+    while(*ptr >= '0' && *ptr <= '9') {
+        char *end = NULL;
+        int first = (int)strtol(ptr, &end, 10);
+        int last = first;
+
+        if(*end == '-') {
+            last = (int)strtol(end + 1, &end, 10);
+        }
+
+        for(int cpu = first; cpu <= last; cpu++) {
+            cpus.push_back(cpu);
+        }
+
+        ptr = *end == ',' ? end + 1 : end;
+    }
+
+    return cpus;
+}
+
+static std::string getCpuDirectory(int cpu)
+{
+    char buf[64];
+    sprintf(buf, "/sys/devices/system/cpu/cpu%d", cpu);
+
+    return std::string(buf);
+}
+#endif
+
+/**
+ * Gets the logical CPUs that are online in ascending order. With
+ * physicalCores only the first logical CPU of each physical core is
+ * included, so that no two threads pinned to the list share a core
+ */
+std::vector<int> getCpuList(bool physicalCores)
+{
+    std::vector<int> cpus;
+
+#ifndef _WIN32
+    std::vector<int> online = parseCpuList(readLine("/sys/devices/system/cpu/online"));
+
+    for(unsigned int i = 0; i < online.size(); i++) {
+        if(physicalCores) {
+            std::vector<int> siblings = parseCpuList(readLine(getCpuDirectory(online[i]) + "/topology/thread_siblings_list"));
+
+            if(!siblings.empty() && siblings[0] != online[i]) {
+                continue;
+            }
+        }
+        cpus.push_back(online[i]);
+    }
+#endif
+
+    // Without the topology every processor is taken to be its own core
+    if(cpus.empty()) {
+        int count = getNumCores();
+        for(int i = 0; i < count; i++) {
+            cpus.push_back(i);
+        }
+    }
+
+    return cpus;
+}
+
+/**
+ * Gets the NUMA node of a logical CPU, or -1 when it is not known
+ */
+int getNumaNode(int cpu)
+{
+#ifndef _WIN32
+    DIR *dir = opendir(getCpuDirectory(cpu).c_str());
+    if(dir == NULL) {
+        return -1;
+    }
+
+    int node = -1;
+    struct dirent *entry = NULL;
+
+    while((entry = readdir(dir)) != NULL) {
+        std::string name = entry->d_name;
+
+        if(name.compare(0, 4, "node") == 0 && name.size() > 4 && name[4] >= '0' && name[4] <= '9') {
+            node = atoi(name.c_str() + 4);
+            break;
+        }
+    }
+    closedir(dir);
+
+    return node;
+#else
+    return -1;
+#endif
+}
+
+}
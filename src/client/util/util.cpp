@@ -1,6 +1,7 @@
 #include"util.h"
 #ifdef _WIN32
     #include<windows.h>
+    #include<io.h>
 #else
     #include<unistd.h>
     #include<sys/stat.h>
@@ -20,6 +21,68 @@ unsigned int getSystemTime()
 #endif
 }
 
+/**
+ * Microseconds since an arbitrary point in time, for timing short intervals
+ */
+unsigned long long getTimeMicros()
+{
+#ifdef _WIN32
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER count;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&count);
+
+    unsigned long long ticks = (unsigned long long)count.QuadPart;
+    unsigned long long perSecond = (unsigned long long)frequency.QuadPart;
+
+    return ticks / perSecond * 1000000 + ticks % perSecond * 1000000 / perSecond;
+#else
+    struct timeval t;
+    gettimeofday( &t, NULL );
+    return (unsigned long long)t.tv_sec * 1000000 + t.tv_usec;
+#endif
+}
+
+/**
+ * Gets the number of processors that are online
+ */
+int getNumCores()
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+#endif
+}
+
+/**
+ * Suspends the calling thread for ms milliseconds
+ */
+void sleep(unsigned int ms)
+{
+#ifdef _WIN32
+    Sleep(ms);
+#else
+    usleep(ms * 1000);
+#endif
+}
+
+/**
+ * Flushes a file and waits until its contents are on disk
+ */
+void syncFile(FILE *fp)
+{
+    fflush(fp);
+#ifdef _WIN32
+    _commit(_fileno(fp));
+#else
+    fsync(fileno(fp));
+#endif
+}
+
 Timer::Timer()
 {
     _startTime = 0;
@@ -64,7 +64,7 @@ class MySQLPointDatabase:
     '''
     Inserts parameters into the PARAMS table
     '''
-    def insertParams(self, cursor, name, p, a, b, n, gx, gy, qx, qy, dBits):
+    def insertParams(self, cursor, name, p, a, b, n, gx, gy, qx, qy, dBits, negation, walk, lower, upper, walks):
         pHex = util.toHex(p)
         aHex = util.toHex(a)
         bHex = util.toHex(b)
@@ -73,9 +73,11 @@ class MySQLPointDatabase:
         gyHex = util.toHex(gy)
         qxHex = util.toHex(qx)
         qyHex = util.toHex(qy)
+        lowerHex = util.toHex(lower)
+        upperHex = util.toHex(upper)
 
-        s = ("INSERT INTO JobParams(Name, P, A, B, N, Gx, Gy, Qx, Qy, DBits) "
-            "VALUES('%s', '%s', '%s', '%s', '%s', '%s', '%s', '%s', '%s', %d);") % (name, pHex, aHex, bHex, nHex, gxHex, gyHex, qxHex, qyHex, dBits)
+        s = ("INSERT INTO JobParams(Name, P, A, B, N, Gx, Gy, Qx, Qy, DBits, Negation, Walk, Lower, Upper, Walks) "
+            "VALUES('%s', '%s', '%s', '%s', '%s', '%s', '%s', '%s', '%s', %d, %d, '%s', '%s', '%s', %d);") % (name, pHex, aHex, bHex, nHex, gxHex, gyHex, qxHex, qyHex, dBits, int(negation), walk, lowerHex, upperHex, walks)
         cursor.execute(s)
     
     '''
@@ -135,11 +137,39 @@ class MySQLPointDatabase:
             "Gy VARCHAR(256) NOT NULL,"
             "Qx VARCHAR(256) NOT NULL,"
             "Qy VARCHAR(256) NOT NULL,"
-            "DBITS INTEGER NOT NULL);")
+            "DBITS INTEGER NOT NULL,"
+            "Negation INTEGER NOT NULL DEFAULT 0,"
+            "Walk VARCHAR(16) NOT NULL DEFAULT 'rho',"
+            "Lower VARCHAR(256) NOT NULL DEFAULT '0',"
+            "Upper VARCHAR(256) NOT NULL DEFAULT '0',"
+            "Walks INTEGER NOT NULL DEFAULT 1,"
+            "ActiveDBits INTEGER NOT NULL DEFAULT 0,"
+            "MaxDBits INTEGER NOT NULL DEFAULT 0);")
 
         cursor.execute(s) 
 
-        # Create table to store collisions
+        # Databases created before the negation map have no Negation column
+        cursor.execute("SELECT COUNT(*) FROM information_schema.COLUMNS WHERE TABLE_SCHEMA='%s' AND TABLE_NAME='JobParams' AND COLUMN_NAME='Negation';" % (dbName))
+        if int(cursor.fetchone()[0]) == 0:
+            cursor.execute("ALTER TABLE JobParams ADD COLUMN Negation INTEGER NOT NULL DEFAULT 0;")
+
+        # Nor do databases created before the distinguished bits could be
+        # changed. 0 means DBits
+        for column in ['ActiveDBits', 'MaxDBits']:
+            cursor.execute("SELECT COUNT(*) FROM information_schema.COLUMNS WHERE TABLE_SCHEMA='%s' AND TABLE_NAME='JobParams' AND COLUMN_NAME='%s';" % (dbName, column))
+            if int(cursor.fetchone()[0]) == 0:
+                cursor.execute("ALTER TABLE JobParams ADD COLUMN %s INTEGER NOT NULL DEFAULT 0;" % (column))
+
+        # Or before kangaroo walks. Their jobs are rho jobs
+        cursor.execute("SELECT COUNT(*) FROM information_schema.COLUMNS WHERE TABLE_SCHEMA='%s' AND TABLE_NAME='JobParams' AND COLUMN_NAME='Walk';" % (dbName))
+        if int(cursor.fetchone()[0]) == 0:
+            cursor.execute("ALTER TABLE JobParams ADD COLUMN Walk VARCHAR(16) NOT NULL DEFAULT 'rho';")
+            cursor.execute("ALTER TABLE JobParams ADD COLUMN Lower VARCHAR(256) NOT NULL DEFAULT '0';")
+            cursor.execute("ALTER TABLE JobParams ADD COLUMN Upper VARCHAR(256) NOT NULL DEFAULT '0';")
+            cursor.execute("ALTER TABLE JobParams ADD COLUMN Walks INTEGER NOT NULL DEFAULT 1;")
+
+        # Create table to store collisions. Checked is 'T' for the one that
+        # solved the job and 'R' for Robin Hoods
         s = ("CREATE TABLE IF NOT EXISTS Collisions("
             "Id INT NOT NULL AUTO_INCREMENT,"
             "Name VARCHAR(32) NOT NULL,"
@@ -155,6 +185,61 @@ class MySQLPointDatabase:
             "PRIMARY KEY(ID));")
 
         cursor.execute(s)
+
+        # Jobs split into sub-jobs, one for each prime power factor of n
+        s = ("CREATE TABLE IF NOT EXISTS Decompositions("
+            "Name VARCHAR(32) NOT NULL,"
+            "P VARCHAR(256) NOT NULL,"
+            "A VARCHAR(256) NOT NULL,"
+            "B VARCHAR(256) NOT NULL,"
+            "N VARCHAR(256) NOT NULL,"
+            "Gx VARCHAR(256) NOT NULL,"
+            "Gy VARCHAR(256) NOT NULL,"
+            "Qx VARCHAR(256) NOT NULL,"
+            "Qy VARCHAR(256) NOT NULL);")
+
+        cursor.execute(s)
+
+        # Their factors p^e. The residue is mod p^Digit, and the sub-job finds
+        # the next digit until all e are found
+        s = ("CREATE TABLE IF NOT EXISTS Factors("
+            "Name VARCHAR(32) NOT NULL,"
+            "Idx INTEGER NOT NULL,"
+            "Modulus VARCHAR(256) NOT NULL,"
+            "Prime VARCHAR(256) NOT NULL,"
+            "Digit INTEGER NOT NULL,"
+            "Job VARCHAR(32) NULL,"
+            "Residue VARCHAR(256) NOT NULL);")
+
+        cursor.execute(s)
+
+        # Walk stats of each client of a job, added to on every submission.
+        # Times are in seconds since the epoch
+        s = ("CREATE TABLE IF NOT EXISTS WalkStats("
+            "Name VARCHAR(32) NOT NULL,"
+            "Client VARCHAR(64) NOT NULL,"
+            "Submissions BIGINT UNSIGNED NOT NULL DEFAULT 0,"
+            "Points BIGINT UNSIGNED NOT NULL DEFAULT 0,"
+            "Steps BIGINT UNSIGNED NOT NULL DEFAULT 0,"
+            "Duplicates BIGINT UNSIGNED NOT NULL DEFAULT 0,"
+            "Collisions BIGINT UNSIGNED NOT NULL DEFAULT 0,"
+            "Dropped BIGINT UNSIGNED NOT NULL DEFAULT 0,"
+            "FirstSeen BIGINT NOT NULL,"
+            "LastSeen BIGINT NOT NULL,"
+            "PRIMARY KEY(Name, Client));")
+
+        cursor.execute(s)
+
+        # And the histogram of their walk lengths
+        s = ("CREATE TABLE IF NOT EXISTS WalkLengths("
+            "Name VARCHAR(32) NOT NULL,"
+            "Client VARCHAR(64) NOT NULL,"
+            "Bucket INTEGER NOT NULL,"
+            "Count BIGINT UNSIGNED NOT NULL DEFAULT 0,"
+            "PRIMARY KEY(Name, Client, Bucket));")
+
+        cursor.execute(s)
+
         s = ("CREATE TABLE IF NOT EXISTS JobInfo("
             "Name varchar(256) NOT NULL,"
             "NotificationEmail varchar(256) NULL,"
@@ -205,7 +290,7 @@ class MySQLPointDatabase:
             y = rPoints[i]['y']
             self.insertRPoint(cursor, name, i, a, b, x, y)
 
-        self.insertParams(cursor, name, params.p, params.a, params.b, params.n, params.gx, params.gy, params.qx, params.qy, params.dBits)
+        self.insertParams(cursor, name, params.p, params.a, params.b, params.n, params.gx, params.gy, params.qx, params.qy, params.dBits, params.negation, params.walk, params.lower, params.upper, params.walks)
         self.insertInfo(cursor, name, email)
 
         self.createPointsTable(cursor, name)
@@ -213,6 +298,122 @@ class MySQLPointDatabase:
 
         db.close()
 
+    '''
+    Records a job split into sub-jobs. factors is a list of dictionaries with
+    the 'modulus' p^e, the 'prime' p, the 'residue' mod p^'digit' and the
+    name of the 'job' that finds the next digit, or None when all are found
+    '''
+    def createDecomposition(self, name, email, params, factors):
+        db = connectToSQLDatabase(self.creds, ECDL_DB_NAME)
+        cursor = db.cursor()
+
+        s = ("INSERT INTO Decompositions(Name, P, A, B, N, Gx, Gy, Qx, Qy) "
+            "VALUES('%s', '%s', '%s', '%s', '%s', '%s', '%s', '%s', '%s');") % (name, util.toHex(params.p), util.toHex(params.a), util.toHex(params.b), util.toHex(params.n), util.toHex(params.gx), util.toHex(params.gy), util.toHex(params.qx), util.toHex(params.qy))
+        cursor.execute(s)
+
+        for i in xrange(len(factors)):
+            f = factors[i]
+            job = "'%s'" % (f['job']) if f['job'] != None else "NULL"
+
+            s = "INSERT INTO Factors(Name, Idx, Modulus, Prime, Digit, Job, Residue) VALUES('%s', %d, '%s', '%s', %d, %s, '%s');" % (name, i, util.toHex(f['modulus']), util.toHex(f['prime']), f['digit'], job, util.toHex(f['residue']))
+            cursor.execute(s)
+
+        self.insertInfo(cursor, name, email)
+
+        db.commit()
+        db.close()
+
+    '''
+    Gets a list of the names of jobs split into sub-jobs
+    '''
+    def getDecompositionNames(self):
+        db = connectToSQLDatabase(self.creds, ECDL_DB_NAME)
+        cursor = db.cursor()
+
+        cursor.execute("SELECT Name FROM Decompositions;")
+
+        names = []
+        for n in cursor:
+            names.append(n[0])
+
+        db.close()
+
+        return names
+
+    '''
+    Gets a job split into sub-jobs. Returns a dictionary with its 'params',
+    'factors' as given to createDecomposition, 'status' and 'solution', or
+    None if there is no such job
+    '''
+    def getDecomposition(self, name):
+        db = connectToSQLDatabase(self.creds, ECDL_DB_NAME)
+        cursor = db.cursor()
+
+        cursor.execute("SELECT P, A, B, N, Gx, Gy, Qx, Qy FROM Decompositions WHERE Name='%s';" % (name))
+        result = cursor.fetchone()
+
+        if result == None:
+            db.close()
+            return None
+
+        params = ECDLPParams()
+        (params.p, params.a, params.b, params.n, params.gx, params.gy, params.qx, params.qy) = [int(v, 16) for v in result]
+        params.field = "prime"
+
+        cursor.execute("SELECT Modulus, Prime, Digit, Job, Residue FROM Factors WHERE Name='%s' ORDER BY Idx;" % (name))
+
+        factors = []
+        for (modulus, prime, digit, job, residue) in cursor:
+            f = {}
+            f['modulus'] = int(modulus, 16)
+            f['prime'] = int(prime, 16)
+            f['digit'] = int(digit)
+            f['job'] = job
+            f['residue'] = int(residue, 16)
+            factors.append(f)
+
+        cursor.execute("SELECT Status, Solution FROM JobInfo WHERE Name='%s';" % (name))
+        (status, solution) = cursor.fetchone()
+
+        db.close()
+
+        decomposition = {}
+        decomposition['params'] = params
+        decomposition['factors'] = factors
+        decomposition['status'] = status
+        decomposition['solution'] = int(solution, 16) if solution else None
+
+        return decomposition
+
+    '''
+    Stores the digits found of a factor of a job split into sub-jobs and the
+    job that finds the next one
+    '''
+    def updateFactor(self, name, idx, factor):
+        db = connectToSQLDatabase(self.creds, ECDL_DB_NAME)
+        cursor = db.cursor()
+
+        job = "'%s'" % (factor['job']) if factor['job'] != None else "NULL"
+
+        s = "UPDATE Factors SET Digit = %d, Job = %s, Residue = '%s' WHERE Name = '%s' AND Idx = %d;" % (factor['digit'], job, util.toHex(factor['residue']), name, idx)
+        cursor.execute(s)
+
+        db.commit()
+        db.close()
+
+    '''
+    Sets the logarithm of a job split into sub-jobs
+    '''
+    def setDecompositionSolution(self, name, value):
+        db = connectToSQLDatabase(self.creds, ECDL_DB_NAME)
+        cursor = db.cursor()
+
+        s = "UPDATE JobInfo SET Solution = '%s', Status = 'solved' WHERE Name = '%s';" % (util.toHex(value), name)
+        cursor.execute(s)
+
+        db.commit()
+        db.close()
+
 
 '''
 Holds an open connection to the database
@@ -307,11 +508,11 @@ class MySQLPointDatabaseConnection(PointDatabaseConnection):
     def getParams(self):
         cursor = self.db.cursor()
 
-        s = "SELECT P, A, B, N, Gx, Gy, Qx, Qy, DBits FROM JobParams WHERE Name='%s';" % (self.name)
+        s = "SELECT P, A, B, N, Gx, Gy, Qx, Qy, DBits, Negation, Walk, Lower, Upper, Walks FROM JobParams WHERE Name='%s';" % (self.name)
 
         cursor.execute(s)
 
-        (p, a, b, n, gx, gy, qx, qy, dBits) = cursor.fetchone()
+        (p, a, b, n, gx, gy, qx, qy, dBits, negation, walk, lower, upper, walks) = cursor.fetchone()
 
         params = ECDLPParams()
         params.p = int(p, 16)
@@ -323,10 +524,42 @@ class MySQLPointDatabaseConnection(PointDatabaseConnection):
         params.qx = int(qx, 16)
         params.qy = int(qy, 16)
         params.dBits = dBits
+        params.negation = (negation != 0)
+        params.walk = walk
+        params.lower = int(lower, 16)
+        params.upper = int(upper, 16)
+        params.walks = walks
         params.field = "prime"
 
         return params
 
+    '''
+    Gets the distinguished bits the walks stop at, and the most they were
+    ever set to
+    '''
+    def getDistinguishedBits(self):
+        cursor = self.db.cursor()
+
+        s = "SELECT DBits, ActiveDBits, MaxDBits FROM JobParams WHERE Name='%s';" % (self.name)
+
+        cursor.execute(s)
+
+        (dBits, activeBits, maxBits) = cursor.fetchone()
+
+        if activeBits == 0:
+            activeBits = dBits
+
+        return activeBits, max(dBits, maxBits, activeBits)
+
+    '''
+    Sets the distinguished bits the walks stop at
+    '''
+    def setDistinguishedBits(self, bits):
+        cursor = self.db.cursor()
+
+        s = "UPDATE JobParams SET ActiveDBits = %d, MaxDBits = GREATEST(MaxDBits, %d) WHERE Name = '%s';" % (bits, bits, self.name)
+        cursor.execute(s)
+
     '''
     Get the R points for this context
     '''
@@ -380,7 +613,8 @@ class MySQLPointDatabaseConnection(PointDatabaseConnection):
     def getNextCollision(self):
         cursor = self.db.cursor()
 
-        s = "SELECT * FROM Collisions WHERE Name='%s' AND Checked != 'T' LIMIT 1;" % (self.name);
+        # Robin Hoods never solve, so they are not tried again
+        s = "SELECT * FROM Collisions WHERE Name='%s' AND Checked NOT IN ('T', 'R') LIMIT 1;" % (self.name);
 
         cursor.execute(s)
 
@@ -483,6 +717,80 @@ class MySQLPointDatabaseConnection(PointDatabaseConnection):
 
         return result[0]
 
+    '''
+    Gets the number of collisions the solver found to be Robin Hoods
+    '''
+    def getNumRobinHoods(self):
+        cursor = self.db.cursor()
+
+        s = "SELECT count(*) as count FROM Collisions WHERE Name = '%s' AND Checked = 'R';" % (self.name);
+
+        cursor.execute(s)
+
+        result = cursor.fetchone()
+
+        if result == None:
+            return 0
+
+        return int(result[0])
+
+    '''
+    Adds the counters of a submission from telemetry.submissionStats to the
+    walk stats of a client
+    '''
+    def recordWalkStats(self, client, stats, now):
+        cursor = self.db.cursor()
+
+        s = ("INSERT INTO WalkStats(Name, Client, Submissions, Points, Steps, Duplicates, Collisions, Dropped, FirstSeen, LastSeen) "
+             "VALUES('%s', '%s', 1, %d, %d, %d, %d, %d, %d, %d) "
+             "ON DUPLICATE KEY UPDATE Submissions = Submissions + 1, Points = Points + VALUES(Points), Steps = Steps + VALUES(Steps), "
+             "Duplicates = Duplicates + VALUES(Duplicates), Collisions = Collisions + VALUES(Collisions), "
+             "Dropped = Dropped + VALUES(Dropped), LastSeen = VALUES(LastSeen);") % (self.name, client, stats['points'], stats['steps'], stats['duplicates'], stats['collisions'], stats['dropped'], now, now)
+        cursor.execute(s)
+
+        if len(stats['histogram']) == 0:
+            return
+
+        values = ["('%s', '%s', %d, %d)" % (self.name, client, i, count) for i, count in sorted(stats['histogram'].items())]
+
+        s = "INSERT INTO WalkLengths(Name, Client, Bucket, Count) VALUES %s ON DUPLICATE KEY UPDATE Count = Count + VALUES(Count);" % (",".join(values))
+        cursor.execute(s)
+
+    '''
+    Gets the walk stats of every client of the job. Each is a dictionary
+    with the counters and a histogram of telemetry.HISTOGRAM_BUCKETS
+    buckets
+    '''
+    def getWalkStats(self, buckets):
+        cursor = self.db.cursor()
+
+        s = "SELECT Client, Submissions, Points, Steps, Duplicates, Collisions, Dropped, FirstSeen, LastSeen FROM WalkStats WHERE Name = '%s';" % (self.name)
+        cursor.execute(s)
+
+        clients = {}
+        for (client, submissions, points, steps, duplicates, collisions, dropped, firstSeen, lastSeen) in cursor:
+            c = {}
+            c['client'] = client
+            c['submissions'] = int(submissions)
+            c['points'] = int(points)
+            c['steps'] = int(steps)
+            c['duplicates'] = int(duplicates)
+            c['collisions'] = int(collisions)
+            c['dropped'] = int(dropped)
+            c['first_seen'] = int(firstSeen)
+            c['last_seen'] = int(lastSeen)
+            c['histogram'] = [0] * buckets
+            clients[client] = c
+
+        s = "SELECT Client, Bucket, Count FROM WalkLengths WHERE Name = '%s';" % (self.name)
+        cursor.execute(s)
+
+        for (client, bucket, count) in cursor:
+            if client in clients and bucket < buckets:
+                clients[client]['histogram'][bucket] += int(count)
+
+        return [clients[c] for c in sorted(clients)]
+
     '''
     Check if the databse contains a particular distinguished point
     '''
@@ -7,6 +7,15 @@ class PointDatabase:
     def getConnection(self, name):
         raise NotImplementedError("This should be implemented in subclass")
 
+    def createDecomposition(self, name, email, params, factors):
+        raise NotImplementedError("This should be implemented in subclass")
+
+    def getDecomposition(self, name):
+        raise NotImplementedError("This should be implemented in subclass")
+
+    def updateFactor(self, name, idx, factor):
+        raise NotImplementedError("This should be implemented in subclass")
+
 '''
 Abstract class for hashtable to storing distinguished points
 '''
@@ -47,6 +56,24 @@ class PointDatabaseConnection:
     def get(self, x, y):
         raise NotImplementedError("This should be implemented in subclass")
 
+    '''
+    Add the counters of a submission to the walk stats of a client
+    '''
+    def recordWalkStats(self, client, stats, now):
+        raise NotImplementedError("This should be implemented in subclass")
+
+    '''
+    Get the walk stats of every client of the job
+    '''
+    def getWalkStats(self, buckets):
+        raise NotImplementedError("This should be implemented in subclass")
+
+    '''
+    Get the number of collisions that were Robin Hoods
+    '''
+    def getNumRobinHoods(self):
+        raise NotImplementedError("This should be implemented in subclass")
+
     def getSize():
         raise NotImplementedError("This should be implemented in subclass")
 
@@ -0,0 +1,182 @@
+'''
+Pohlig-Hellman decomposition of a job whose group order is composite. The
+logarithm mod n follows from the logarithms mod each prime power p^e of n,
+which are found in the subgroup of order p^e, generated by (n/p^e)G. Those
+are lifted one base p digit at a time, each digit the logarithm in the
+subgroup of order p, so the work is about e times the square root of p for
+the factor p^e and about the square root of the largest prime factor for n
+'''
+
+import ecc
+from ecc import ECCurve, ECPoint
+import util
+from util import ECDLPParams
+
+# Factors whose prime has at most this many bits are solved on the server.
+# Larger ones become jobs of their own
+SERVER_FACTOR_BITS = 32
+
+# Walks of a sub-job stop at most at this many bits below half the size of
+# its order, so they are short enough not to run into a cycle of the
+# smaller group before they reach a distinguished point
+SUBJOB_BITS_MARGIN = 4
+
+'''
+Negates a point
+'''
+def _negate(curve, point):
+    if point.isPointAtInfinity():
+        return point
+
+    return ECPoint(point.x, (-point.y) % curve.p)
+
+'''
+Finds the prime power subgroups of a job. Returns a list of dictionaries
+with the prime 'p', 'e', the 'modulus' p^e and the points 'g' and 'q' of
+the subgroup. Raises ValueError when n cannot be factored or is not the
+order of G
+'''
+def subgroups(params):
+
+    curve = ECCurve(params.a, params.b, params.p, params.n, params.gx, params.gy)
+    pointG = ECPoint(params.gx, params.gy)
+    pointQ = ECPoint(params.qx, params.qy)
+
+    factors = ecc.factor(params.n)
+    if factors == None:
+        raise ValueError("Could not factor n")
+
+    parts = []
+    for p, e in factors:
+        modulus = pow(p, e)
+        cofactor = params.n // modulus
+
+        g = curve.multiply(cofactor, pointG)
+        q = curve.multiply(cofactor, pointQ)
+
+        # The subgroup must have order p^e, not a divisor of it
+        if curve.multiply(modulus // p, g).isPointAtInfinity():
+            raise ValueError("n is not the order of G")
+
+        if not curve.multiply(modulus, q).isPointAtInfinity():
+            raise ValueError("Q is not in the group generated by G")
+
+        parts.append({'p':p, 'e':e, 'modulus':modulus, 'g':g, 'q':q})
+
+    return parts
+
+'''
+Checks if the logarithm in a subgroup is found on the server rather than by
+a job of its own
+'''
+def isSmall(part):
+    return part['p'].bit_length() <= SERVER_FACTOR_BITS or part['q'].isPointAtInfinity()
+
+'''
+Logarithm of h to the base g, which has prime order p, with baby-step
+giant-step
+'''
+def _babyStepGiantStep(curve, g, h, p):
+    m = util.isqrt(p) + 1
+
+    babySteps = {}
+    point = ECPoint()
+    for j in range(m):
+        babySteps.setdefault((point.x, point.y), j)
+        point = curve.add(point, g)
+
+    giantStep = _negate(curve, curve.multiply(m, g))
+    point = h
+    for i in range(m + 1):
+        j = babySteps.get((point.x, point.y))
+        if j != None:
+            return (i * m + j) % p
+        point = curve.add(point, giantStep)
+
+    raise ValueError("No logarithm")
+
+'''
+Logarithm of q to the base g in a subgroup of order p^e. Finds it one base p
+digit at a time, each in the subgroup of order p
+'''
+def discreteLog(curve, part):
+    p = part['p']
+    e = part['e']
+    g = part['g']
+    q = part['q']
+
+    gamma = curve.multiply(pow(p, e - 1), g)
+
+    k = 0
+    for i in range(e):
+        h = curve.add(q, _negate(curve, curve.multiply(k, g)))
+        h = curve.multiply(pow(p, e - 1 - i), h)
+
+        k = k + _babyStepGiantStep(curve, gamma, h, p) * pow(p, i)
+
+    return k
+
+'''
+The subgroup of order p that digit k of the logarithm mod p^e is found in,
+given the residue mod p^k of the digits below it. Its points are (n/p)G and
+(n/p^(k+1))(Q - residue*G), whose logarithm is the digit. Returns a
+dictionary like those of subgroups
+'''
+def digitPart(params, p, k, residue):
+
+    curve = ECCurve(params.a, params.b, params.p, params.n, params.gx, params.gy)
+    pointG = ECPoint(params.gx, params.gy)
+    pointQ = ECPoint(params.qx, params.qy)
+
+    g = curve.multiply(params.n // p, pointG)
+
+    q = curve.add(pointQ, _negate(curve, curve.multiply(residue, pointG)))
+    q = curve.multiply(params.n // pow(p, k + 1), q)
+
+    return {'p':p, 'e':1, 'modulus':p, 'g':g, 'q':q}
+
+'''
+Name of the job that finds digit k of the logarithm mod the factor with the
+given index. The first digit keeps the name of the factor
+'''
+def subJobName(name, idx, k):
+    if k == 0:
+        return name + "_" + str(idx)
+
+    return name + "_" + str(idx) + "_" + str(k)
+
+'''
+Parameters of the job for a subgroup
+'''
+def subJobParams(params, part):
+    sub = ECDLPParams()
+    sub.field = params.field
+    sub.p = params.p
+    sub.a = params.a
+    sub.b = params.b
+    sub.n = part['modulus']
+    sub.gx = part['g'].x
+    sub.gy = part['g'].y
+    sub.qx = part['q'].x
+    sub.qy = part['q'].y
+    sub.negation = params.negation
+    sub.numRPoints = params.numRPoints
+    sub.dBits = min(int(params.dBits), max(0, sub.n.bit_length() // 2 - SUBJOB_BITS_MARGIN))
+
+    return sub
+
+'''
+Combines logarithms mod coprime moduli with the Chinese remainder theorem.
+Takes a list of (residue, modulus) pairs
+'''
+def crt(residues):
+    k = 0
+    n = 1
+
+    for r, m in residues:
+        # k + n*t = r (mod m)
+        t = ((r - k) * ecc.invModP(n % m, m)) % m
+        k = k + n * t
+        n = n * m
+
+    return k % n
@@ -78,6 +78,96 @@ def isPrime(p):
         
     return True
 
+def _gcd(a, b):
+    while b != 0:
+        a, b = b, a % b
+    return a
+
+# Largest prime found by trial division when factoring
+TRIAL_DIVISION_BOUND = 1 << 16
+
+# Steps of Pollard's rho tried for each factor before giving up. About
+# the square root of the factors it finds
+FACTOR_MAX_STEPS = 1 << 20
+
+# Integer k-th root of n, rounded down
+def _root(n, k):
+    x = 1 << ((n.bit_length() + k - 1) // k)
+    while True:
+        y = ((k - 1) * x + n // pow(x, k - 1)) // k
+        if y >= x:
+            return x
+        x = y
+
+# Returns (r, k) with r^k = n for the largest such k. Pollard's rho does not
+# split a power of a prime. n has no factor below TRIAL_DIVISION_BOUND
+def _perfectPower(n):
+    for k in range(n.bit_length() // 16, 1, -1):
+        r = _root(n, k)
+        if pow(r, k) == n:
+            return r, k
+
+    return n, 1
+
+# Finds a factor of the composite n with Brent's variant of Pollard's rho.
+# Returns None when none is found within FACTOR_MAX_STEPS steps
+def _findFactor(n):
+    for c in range(1, 3):
+        x = y = 2
+        d = 1
+        power = 1
+        steps = 0
+
+        while d == 1 and steps < FACTOR_MAX_STEPS:
+            # Move x to y once every power steps, so y catches up with the
+            # cycle without storing the walk
+            if steps == power:
+                x = y
+                power = power * 2
+
+            y = (y * y + c) % n
+            d = _gcd(abs(x - y), n)
+            steps = steps + 1
+
+        if d != 1 and d != n:
+            return d
+
+    return None
+
+# Factors n into primes. Returns a list of (p, e) pairs in increasing order
+# of p, or None when a factor is too large to be found
+def factor(n):
+    factors = {}
+
+    p = 2
+    while p < TRIAL_DIVISION_BOUND and p * p <= n:
+        while n % p == 0:
+            factors[p] = factors.get(p, 0) + 1
+            n = n // p
+        p = p + 1 if p == 2 else p + 2
+
+    composites = [(n, 1)] if n > 1 else []
+    while len(composites) > 0:
+        m, e = composites.pop()
+
+        if m < TRIAL_DIVISION_BOUND * TRIAL_DIVISION_BOUND or isPrime(m):
+            factors[m] = factors.get(m, 0) + e
+            continue
+
+        r, k = _perfectPower(m)
+        if k > 1:
+            composites.append((r, e * k))
+            continue
+
+        d = _findFactor(m)
+        if d == None:
+            return None
+
+        composites.append((d, e))
+        composites.append((m // d, e))
+
+    return sorted(factors.items())
+
 # Checks that elliptic curve parameters are correct
 def verifyCurveParameters(a, b, p, n, x, y):
 
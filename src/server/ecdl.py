@@ -2,9 +2,8 @@ import json
 from MySQLPointDatabase import MySQLPointDatabase
 
 from ecc import ECCurve, ECPoint
-import random
-
-NUM_R_POINTS = 32
+import decompose
+import util
 
 '''
 Converts a string to integer by guessing the base
@@ -25,6 +24,19 @@ class ServerConfig:
     dbHost = ""
     port = 9999
 
+    # Most points a client may send in one submission
+    maxBatchSize = 4096
+
+    # Submissions handled at once. Clients are told to retry later beyond this
+    maxSubmissions = 8
+
+    # Seconds a busy server asks clients to wait
+    retryAfter = 30
+
+    # Native collision solver built with the client. Without it the solver
+    # walks in Python
+    collisionSolver = None
+
     def __init__(self, path):
 
         with open(path) as data_file:
@@ -35,6 +47,18 @@ class ServerConfig:
         self.dbHost = data['dbHost']
         self.port = data['port']
 
+        if 'maxBatchSize' in data:
+            self.maxBatchSize = data['maxBatchSize']
+
+        if 'maxSubmissions' in data:
+            self.maxSubmissions = data['maxSubmissions']
+
+        if 'retryAfter' in data:
+            self.retryAfter = data['retryAfter']
+
+        if 'collisionSolver' in data:
+            self.collisionSolver = data['collisionSolver']
+
 '''
 Loads the config
 '''
@@ -56,6 +80,12 @@ class ECDLPContext:
         self.rPoints = []
         self.curve = None
         self.params = None
+
+        # Distinguished bits the walks stop at, which the server may raise
+        # above params.dBits while the job runs, and the most they were
+        # ever set to. Points are reported at params.dBits
+        self.activeBits = 0
+        self.maxBits = 0
         self.status = "running"
         self.email = None
         self.collisions = 0
@@ -63,35 +93,6 @@ class ECDLPContext:
     def getConnection(self):
         return database.getConnection(self.name)
 
-'''
-Generates the R points for the random walk from the ECDLP parameters
-'''
-def generateRPoints(params):
-
-    curve = ECCurve(params.a, params.b, params.p, params.n, params.gx, params.gy)
-    pointG = ECPoint(params.gx, params.gy)
-    pointQ = ECPoint(params.qx, params.qy)
-
-    rPoints = []
-     
-    for i in range(NUM_R_POINTS):
-        a = random.randint(2, curve.n)
-        b = random.randint(2, curve.n)
-
-        aG = curve.multiply(a, pointG)
-        bQ = curve.multiply(b, pointQ)
-
-        r = curve.add(aG, bQ)
-
-        e = {}
-        e['a'] = a
-        e['b'] = b
-        e['x'] = r.x
-        e['y'] = r.y
-        rPoints.append(e)
-
-    return rPoints
-
 '''
  Creates a new context
 '''
@@ -100,7 +101,9 @@ def createContext(params, name, email):
     ctx = ECDLPContext(name)
 
     ctx.params = params
-    ctx.rPoints = generateRPoints(ctx.params)
+    ctx.activeBits = params.dBits
+    ctx.maxBits = params.dBits
+    ctx.rPoints = util.generateRPoints(ctx.params)
 
     Database.createContext(ctx.name, ctx.email, ctx.params, ctx.rPoints)
 
@@ -112,6 +115,63 @@ def createContext(params, name, email):
 
     return ctx
 
+'''
+ Creates the sub-job for the next digit of the logarithm mod a factor of a
+ job split into sub-jobs, skipping digits that are 0. factor holds the
+ 'residue' mod p^digit of the digits found so far. Its 'job' is set to the
+ new sub-job, or to None when all digits are found
+'''
+def createDigitJob(params, name, idx, factor):
+
+    p = factor['prime']
+    while pow(p, factor['digit']) < factor['modulus']:
+        part = decompose.digitPart(params, p, factor['digit'], factor['residue'])
+
+        if not part['q'].isPointAtInfinity():
+            factor['job'] = decompose.subJobName(name, idx, factor['digit'])
+            createContext(decompose.subJobParams(params, part), factor['job'], '')
+            return
+
+        factor['digit'] = factor['digit'] + 1
+
+    factor['job'] = None
+
+'''
+ Splits a job with the Pohlig-Hellman decomposition. The logarithms in
+ small subgroups are found here. Those in the others are found one base p
+ digit at a time, by sub-jobs of order p named after the job, the index of
+ the factor and the digit. parts are the subgroups from decompose.subgroups.
+ Returns the names of the sub-jobs
+'''
+def createDecomposition(params, name, email, parts):
+
+    curve = ECCurve(params.a, params.b, params.p, params.n, params.gx, params.gy)
+
+    factors = []
+    jobs = []
+    for i in range(len(parts)):
+        f = {'modulus':parts[i]['modulus'], 'prime':parts[i]['p'], 'digit':0, 'job':None, 'residue':0}
+
+        if decompose.isSmall(parts[i]):
+            f['residue'] = decompose.discreteLog(curve, parts[i])
+            f['digit'] = parts[i]['e']
+        else:
+            createDigitJob(params, name, i, f)
+            if f['job'] != None:
+                jobs.append(f['job'])
+
+        factors.append(f)
+
+    Database.createDecomposition(name, email, params, factors)
+
+    return jobs
+
+'''
+ Loads a job split into sub-jobs, or returns None if there is no such job
+'''
+def loadDecomposition(name):
+    return Database.getDecomposition(name)
+
 '''
  Loads an existing context
 '''
@@ -123,6 +183,8 @@ def loadContext(name):
     ctx.database.open()
     ctx.rPoints = ctx.database.getRPoints()
     ctx.params = ctx.database.getParams()
+    ctx.params.numRPoints = len(ctx.rPoints)
+    ctx.activeBits, ctx.maxBits = ctx.database.getDistinguishedBits()
     ctx.status = ctx.database.getStatus()
     ctx.solution = ctx.database.getSolution()
     ctx.collisions = ctx.database.getNumCollisions()
@@ -4,7 +4,11 @@ from ecc import ECCurve, ECPoint
 import os
 import random
 import sys
+import threading
+import time
+import decompose
 import ecdl
+import telemetry
 import util
 from util import ECDLPParams
 
@@ -18,6 +22,25 @@ app.config['PROPAGATE_EXCEPTIONS'] = True
 
 jsonschema = JsonSchema(app)
 
+# Longest time a status request is held, and how often the status is
+# checked while it is held, in seconds
+MAX_STATUS_WAIT = 60
+STATUS_CHECK_INTERVAL = 2
+
+# Most distinguished bits a job can be set to while it runs. The clients
+# check them in one 32-bit word
+MAX_DISTINGUISHED_BITS = 32
+
+# Longest job name the database holds
+MAX_NAME_LENGTH = 32
+
+# Most dropped walks a submission can report
+MAX_DROPPED = 1 << 32
+
+# Number of submissions being handled
+activeSubmissions = 0
+submissionLock = threading.Lock()
+
 '''
 Look up a context based on id
 '''
@@ -37,6 +60,11 @@ def encodeContextParams(ctx):
     content = {}
     content['params'] = ctx.params.encode()
 
+    # Binary submission format this server accepts
+    content['binary_version'] = util.BINARY_VERSION
+
+    content['max_batch_size'] = ecdl.Config.maxBatchSize
+
     # Convert R points to string values
     content['points'] = []
     for e in ctx.rPoints:
@@ -52,7 +80,11 @@ def encodeContextParams(ctx):
 '''
 Route for /status/<id>
 
-Gets the status of a job
+Gets the status of a job and the distinguished bits its walks stop at.
+With the status and wait arguments the request is held until the status is
+no longer the given one, or the bits are no longer the ones given with the
+bits argument, for at most wait seconds, so clients learn about a change
+within seconds without polling
 '''
 @app.route("/status/<id>", methods=['GET'])
 def status(id):
@@ -60,15 +92,65 @@ def status(id):
     # Get the context
     ctx = getContext(id)
     if ctx == None:
-        return "", 404
+        return decompositionStatus(id)
+
+    current = request.args.get('status', None)
+    currentBits = request.args.get('bits', None, type=int)
+    wait = min(request.args.get('wait', 0, type=int), MAX_STATUS_WAIT)
+    deadline = time.time() + wait
+
+    while ctx.status == current and (currentBits == None or ctx.activeBits == currentBits) and time.time() < deadline:
+        time.sleep(STATUS_CHECK_INTERVAL)
+
+        ctx = getContext(id)
+        if ctx == None:
+            return "", 404
 
     # Get the status
     response = {}
     response['status'] = ctx.status;
+    response['bits'] = ctx.activeBits
+    response['long_poll'] = True
 
     # Return the status
     return jsonify(response)
 
+'''
+Status of a job split into sub-jobs, and the sub-jobs the clients run
+'''
+def decompositionStatus(id):
+
+    decomposition = ecdl.loadDecomposition(id)
+    if decomposition == None:
+        return "", 404
+
+    response = {}
+    response['status'] = decomposition['status']
+    response['jobs'] = [f['job'] for f in decomposition['factors'] if f['job'] != None]
+
+    return jsonify(response)
+
+'''
+Route for /stats/<id>
+
+Walk stats of a job and of each of its clients, the projected time until
+it is solved and flags for clients and R points that waste work. For a job
+split into sub-jobs the sub-jobs are listed, whose stats are kept apart
+'''
+@app.route("/stats/<id>", methods=['GET'])
+def stats(id):
+
+    ctx = getContext(id)
+    if ctx == None:
+        return decompositionStatus(id)
+
+    ctx.database.open()
+    clients = ctx.database.getWalkStats(telemetry.HISTOGRAM_BUCKETS)
+    robinHoods = ctx.database.getNumRobinHoods()
+    ctx.database.close()
+
+    return jsonify(telemetry.report(ctx, clients, robinHoods))
+
 '''
 Route for /create/<id>
 
@@ -78,7 +160,7 @@ Create a news job with the specified id
 def create(id):
 
     # Make sure it doesn't already exist
-    if getContext(id) != None:
+    if getContext(id) != None or ecdl.loadDecomposition(id) != None:
         return "", 500
 
     content = request.json
@@ -96,11 +178,138 @@ def create(id):
     if not ecc.verifyCurveParameters(params.a, params.b, params.p, params.n, params.gx, params.gy):
         return "Invalid ECC parameters", 400
 
+    if params.walk == 'kangaroo':
+        error = checkKangarooParams(params)
+        if error != None:
+            return error, 400
+
+        # The jumps depend on the interval, so the number of R points does too
+        params.numRPoints = util.kangarooJumps(params)[1]
+    elif params.walk != 'rho':
+        return "Invalid walk", 400
+
+    if not util.isValidRPointCount(params.numRPoints):
+        return "Invalid number of R points", 400
+
+    if content.get('decompose', False):
+        return createDecomposition(id, params, email)
+
     # Create the context
     ctx = ecdl.createContext(params, id, email)
 
     return ""
 
+'''
+Creates a job whose group order is composite as sub-jobs for the digits of
+the logarithm mod each prime power factor of n. The solver creates them one
+digit after another and combines the logarithms
+'''
+def createDecomposition(id, params, email):
+
+    if params.walk != 'rho':
+        return "Only rho jobs can be decomposed", 400
+
+    try:
+        parts = decompose.subgroups(params)
+    except ValueError as e:
+        return str(e), 400
+
+    # Nothing to split when n is prime
+    if len(parts) == 1 and parts[0]['e'] == 1:
+        ecdl.createContext(params, id, email)
+        return jsonify({'jobs': [id]})
+
+    # Sub-jobs are named after the job, the index of their factor and the digit
+    names = []
+    for i in range(len(parts)):
+        if not decompose.isSmall(parts[i]):
+            names.extend([decompose.subJobName(id, i, k) for k in range(parts[i]['e'])])
+
+    if len(names) > 0 and max([len(n) for n in names]) > MAX_NAME_LENGTH:
+        return "Name is too long for the sub-jobs", 400
+
+    for n in names:
+        if getContext(n) != None:
+            return "", 500
+
+    jobs = ecdl.createDecomposition(params, id, email, parts)
+
+    print(id + " is split into " + str(len(parts)) + " factors, with sub-jobs " + ", ".join(jobs))
+
+    return jsonify({'jobs': jobs})
+
+'''
+Most distinguished bits for the interval of a kangaroo job. Walks of 2^bits
+steps then cover about an eighth of the interval at most, so tame and wild
+walks that start far apart can still meet. Negative when even one step of
+the mean jump is longer than that
+'''
+def kangarooMaxBits(params):
+    return ((params.upper - params.lower) // 8 // util.kangarooMeanJump(params)).bit_length() - 1
+
+'''
+Checks the parameters of a kangaroo job. Returns an error message, or None if
+they are valid
+'''
+def checkKangarooParams(params):
+
+    if params.negation:
+        return "Kangaroo walks do not use the negation map"
+
+    if params.lower < 1 or params.lower >= params.upper or params.upper > params.n:
+        return "Interval must be within [1, n]"
+
+    if params.walks < 1:
+        return "Number of walks must be at least 1"
+
+    maxBits = kangarooMaxBits(params)
+    if maxBits < 0:
+        return "Interval is too small for the number of walks"
+
+    if params.dBits > maxBits:
+        return "Distinguished bits must be at most %d for the interval" % (maxBits)
+
+    return None
+
+'''
+Route for /bits/<id>
+
+Sets the distinguished bits the walks of a job stop at. Clients pick up the
+new value from the status and change it without restarting their walks.
+Points are still reported and checked at the bits the job was created with,
+so the value can be from those up to MAX_DISTINGUISHED_BITS, or the most
+the interval of a kangaroo job allows
+'''
+@app.route("/bits/<id>", methods=['POST'])
+def set_bits(id):
+
+    ctx = getContext(id)
+    if ctx == None:
+        return "", 404
+
+    content = request.json
+
+    try:
+        bits = int(content['bits'])
+    except (TypeError, KeyError, ValueError):
+        return "Invalid number of distinguished bits", 400
+
+    maxBits = MAX_DISTINGUISHED_BITS
+    if ctx.params.walk == 'kangaroo':
+        maxBits = min(maxBits, kangarooMaxBits(ctx.params))
+    maxBits = max(ctx.params.dBits, maxBits)
+
+    if bits < ctx.params.dBits or bits > maxBits:
+        return "Distinguished bits must be from %d to %d" % (ctx.params.dBits, maxBits), 400
+
+    ctx.database.open()
+    ctx.database.setDistinguishedBits(bits)
+    ctx.database.close()
+
+    print("Walks of " + id + " stop at " + str(bits) + " distinguished bits")
+
+    return ""
+
 '''
 Route for /params/<id>
 
@@ -128,6 +337,25 @@ This route is for submitting distinguished points to the server
 '''
 @app.route("/submit/<id>", methods=['POST'])
 def submit_points(id):
+    global activeSubmissions
+
+    # Tell the client to come back later when too many submissions are
+    # being handled
+    with submissionLock:
+        if activeSubmissions >= ecdl.Config.maxSubmissions:
+            return "", 429, {'Retry-After': str(ecdl.Config.retryAfter)}
+        activeSubmissions += 1
+
+    try:
+        return handleSubmission(id)
+    finally:
+        with submissionLock:
+            activeSubmissions -= 1
+
+'''
+Verifies a submission and adds its points to the database
+'''
+def handleSubmission(id):
 
     # Get the context
     ctx = getContext(id)
@@ -136,11 +364,26 @@ def submit_points(id):
         print("Count not find context " + id)
         return "", 404
 
-    # Check if the job is still running
-    if ctx.status == "stopped":
-        return "", 500
+    # Points for a solved job are not needed. The status tells the client
+    # to stop
+    if ctx.status != "unsolved":
+        return jsonify({'status': ctx.status})
+
+    if request.mimetype == util.BINARY_CONTENT_TYPE:
+        try:
+            content = util.decodeBinaryPoints(ctx.params, request.get_data())
+        except util.UnsupportedFormatError as e:
+            print("Invalid binary submission: " + str(e))
+            return "", 415
+        except ValueError as e:
+            print("Invalid binary submission: " + str(e))
+            return "", 400
+    else:
+        content = decodeJsonPoints(request.json)
 
-    content = request.json
+    if len(content) > ecdl.Config.maxBatchSize:
+        print("Too many points in submission: " + str(len(content)))
+        return "", 413
 
     modulus = pow(2, ctx.params.dBits)
 
@@ -149,14 +392,20 @@ def submit_points(id):
     # Verify all points
     for i in range(len(content)):
         
-        a = util.parseInt(content[i]['a'])
-        b = util.parseInt(content[i]['b'])
-        x = util.parseInt(content[i]['x'])
-        y = util.parseInt(content[i]['y'])
+        a = content[i]['a']
+        b = content[i]['b']
+        x = content[i]['x']
+        y = content[i]['y']
         length = content[i]['length']
 
-        # Verify the exponents are within range
-        if a <= 0 or a >= ctx.curve.n or b <= 0 or b >= ctx.curve.n:
+        # Verify the exponents are within range. Kangaroo walks start at aG
+        # or aG + Q
+        if ctx.params.walk == 'kangaroo':
+            invalid = a < 0 or a >= ctx.curve.n or (b != 0 and b != 1)
+        else:
+            invalid = a <= 0 or a >= ctx.curve.n or b <= 0 or b >= ctx.curve.n
+
+        if invalid:
             print("Invalid exponents:")
             print(str(a))
             print(str(b))
@@ -175,6 +424,12 @@ def submit_points(id):
             print("Not distinguished point! Rejecting!")
             return "", 400
 
+        # With the negation map every point on a walk has an even y
+        if ctx.params.negation and y & 0x01 == 0x01:
+            print("[" + hex(x) + "," + hex(y) +"]")
+            print("Not a canonical point! Rejecting!")
+            return "", 400
+
         # Verify aG = bQ = (x,y)
         endPoint = ECPoint(x, y)
         if verifyPoint(ctx.curve, ctx.pointG, ctx.pointQ, a, b, endPoint) == False:
@@ -198,10 +453,22 @@ def submit_points(id):
     # Write list to database
     collisions = ctx.database.insertMultiple(points)
 
+    duplicates = 0
+    found = 0
+
     # If there are any collisions, add them to the collisions table
     if collisions != None:
         for c in collisions:
             dp = ctx.database.get(c['x'], c['y'])
+
+            # A client that died before recording a submission sends the
+            # same points again
+            if dp['a'] == c['a'] and dp['b'] == c['b']:
+                duplicates += 1
+                continue
+
+            found += 1
+
             print("==== FOUND COLLISION ====")
             print("a1:     " + hex(c['a']))
             print("b1:     " + hex(c['b']))
@@ -216,9 +483,32 @@ def submit_points(id):
 
             ctx.database.insertCollision(c['a'], c['b'], c['length'], dp['a'], dp['b'], dp['length'], c['x'], c['y'])
 
+    client = telemetry.clientName(request.headers.get(telemetry.CLIENT_HEADER), request.remote_addr)
+    dropped = min(max(request.headers.get(telemetry.DROPPED_HEADER, 0, type=int), 0), MAX_DROPPED)
+
+    stats = telemetry.submissionStats([p['length'] for p in points], duplicates, found, dropped)
+    ctx.database.recordWalkStats(client, stats, int(time.time()))
+
     ctx.database.close()
 
-    return ""
+    return jsonify({'status': ctx.status})
+
+'''
+Converts the points of a JSON submission to integers
+'''
+def decodeJsonPoints(content):
+
+    points = []
+    for e in content:
+        dp = {}
+        dp['a'] = util.parseInt(e['a'])
+        dp['b'] = util.parseInt(e['b'])
+        dp['x'] = util.parseInt(e['x'])
+        dp['y'] = util.parseInt(e['y'])
+        dp['length'] = e['length']
+        points.append(dp)
+
+    return points
 
 '''
 Verify that a point is on the curve
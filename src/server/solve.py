@@ -211,7 +211,9 @@ def main():
     ctx = ecdl.loadContext(name)
     curve = ctx.curve
     rPoints = ctx.rPoints
-    dBits = ctx.params.dBits
+
+    # Walks may be as long as the most distinguished bits the job had allow
+    dBits = ctx.maxBits
 
     # Get G and Q
     g = ECPoint(ctx.params.gx, ctx.params.gy)
@@ -1,8 +1,10 @@
 import json
 from ecc import ECCurve, ECPoint
 import os
+import decompose
 import ecdl
 import sys
+import subprocess
 
 import util
 import time
@@ -19,6 +21,45 @@ def invm(x, m):
 def swap(a, b):
     return b, a
 
+# Longest fruitless cycle that is walked when escaping from it
+CYCLE_MAX = 16
+
+# Most logarithms a collision can give that are checked against Q
+MAX_CANDIDATES = 1024
+
+# Number of recent points of each walk kept while looking for the collision
+COLLISION_WINDOW = 64
+
+'''
+Fingerprint of a point used for fruitless cycle detection. The client uses
+the same bits, so both sides leave a cycle at the same step.
+'''
+def cycleFingerprint(x):
+    return (x >> 16) & 0xffff
+
+'''
+Remembers the last few points of a walk, indexed by x
+'''
+class RecentPoints:
+
+    def __init__(self, size):
+        self.size = size
+        self.order = []
+        self.points = {}
+
+    def add(self, a, b, point):
+        if len(self.order) == self.size:
+            del self.points[self.order.pop(0)]
+
+        self.order.append(point.x)
+        self.points[point.x] = (a, b, point)
+
+    def contains(self, point):
+        return point.x in self.points
+
+    def get(self, point):
+        return self.points[point.x]
+
 class RhoSolver:
     point1 = None
     p1Len = 0
@@ -35,13 +76,17 @@ class RhoSolver:
     solved = False
     k = None
 
+    # Set when the walks are a Robin Hood
+    robinHood = False
+
     '''
     Constructs a new RhoSolver object
     '''
-    def __init__(self, params, rPoints, a1, b1, a2, b2, endPoint):
+    def __init__(self, params, rPoints, a1, b1, a2, b2, endPoint, maxBits = None):
 
         # Get params
         self.params = params
+        self.maxBits = maxBits if maxBits != None else params.dBits
         self.a1 = a1
         self.b1 = b1
         self.a2 = a2
@@ -75,72 +120,148 @@ class RhoSolver:
     '''
     def _isRobinHood(self):
 
-        currentPoint = self.point1
-        count = 0
+        state = self._startState(self.a1, self.b1, self.point1)
+        start2 = self._startState(self.a2, self.b2, self.point2)[2]
         while True:
-            idx = currentPoint.x & 0x1f
+            point = state[2]
 
-            if currentPoint.x == self.point2.x and currentPoint.y == self.point2.y:
+            if point.x == start2.x and point.y == start2.y:
                 return True
 
-            if currentPoint.x == self.endPoint.x and currentPoint.y == self.endPoint.y:
+            if point.x == self.endPoint.x and point.y == self.endPoint.y:
                 return False
 
             # Iterate to next point
-            currentPoint = self.curve.add(currentPoint, ECPoint(self.rPoints[idx]['x'], self.rPoints[idx]['y']))
+            state = self._nextState(state)
 
     '''
     Gets the total length of the random walk
     '''
     def _getWalkLength(self, startA, startB, startPoint):
 
-        point = startPoint
-        a = startA
-        b = startB
-        i = 0
+        state = self._startState(startA, startB, startPoint)
         length = 1
 
-        # We want to terminate the walk if it is statistically too long
-        limit = (2**self.params.dBits) * 4
+        # We want to terminate the walk if it is statistically too long. The
+        # clients allow for the most distinguished bits the job had
+        limit = (2**self.maxBits) * 4
 
         while True:
-            idx = point.x & 0x1f
-          
+            point = state[2]
+
             length = length + 1
 
             if point.x == self.endPoint.x and point.y == self.endPoint.y:
                 print("Found endpoint")
                 return length
-                break
 
             # Increment the point and coefficients
-            r = ECPoint(self.rPoints[idx]['x'], self.rPoints[idx]['y'])
-            point = self.curve.add(point, r)
+            state = self._nextState(state)
 
-            a = (a + self.rPoints[idx]['a']) % self.curve.n
-            b = (b + self.rPoints[idx]['b']) % self.curve.n
-
-            if i > limit:
+            if length > limit:
                 print("Walk is too long. Terminating")
                 return -1
 
         return length
 
+    '''
+    Adds R point idx to the point. With the negation map the sum is replaced
+    by whichever of P and -P has an even y, and the coefficients follow it.
+    '''
+    def _addRPoint(self, a, b, point, idx):
+        r = self.rPoints[idx]
+
+        newPoint = self.curve.add(point, ECPoint(r['x'], r['y']))
+        newA = (a + r['a']) % self.curve.n
+        newB = (b + r['b']) % self.curve.n
+
+        return self._canonical(newA, newB, newPoint)
+
+    def _canonical(self, a, b, point):
+
+        if self.params.negation and point.y & 0x01 == 0x01:
+            return (-a) % self.curve.n, (-b) % self.curve.n, ECPoint(point.x, self.curve.p - point.y)
 
+        return a, b, point
 
     '''
-    Gets the next point in the random walk
+    The iteration function. With the negation map an R point is skipped when
+    the sum maps back to the same R point, which is how most fruitless
+    2-cycles start.
     '''
-    def _nextPoint(self, a, b, point):
+    def _mapPoint(self, a, b, point):
 
-        idx = point.x & 0x1f
+        mask = len(self.rPoints) - 1
+        idx = point.x & mask
 
-        newPoint = self.curve.add(point, ECPoint(self.rPoints[idx]['x'], self.rPoints[idx]['y']))
-        newA = (a + self.rPoints[idx]['a']) % self.curve.n
-        newB = (b + self.rPoints[idx]['b']) % self.curve.n
+        if not self.params.negation:
+            return self._addRPoint(a, b, point, idx)
+
+        for i in xrange(len(self.rPoints)):
+            j = (idx + i) & mask
+            newA, newB, newPoint = self._addRPoint(a, b, point, j)
+
+            if newPoint.x & mask != j:
+                break
 
         return newA, newB, newPoint
 
+    '''
+    Leaves the fruitless cycle through the given point. The cycle is walked
+    once and the point with the smallest x is doubled, so every walk that
+    falls into the same cycle leaves it at the same point.
+    '''
+    def _escapeCycle(self, a, b, point):
+
+        startX = point.x
+        minA, minB, minPoint = a, b, point
+
+        for i in xrange(CYCLE_MAX):
+            a, b, point = self._mapPoint(a, b, point)
+
+            if point.x == startX:
+                break
+
+            if point.x < minPoint.x:
+                minA, minB, minPoint = a, b, point
+
+        a = (minA << 1) % self.curve.n
+        b = (minB << 1) % self.curve.n
+
+        return self._canonical(a, b, self.curve.double(minPoint))
+
+    '''
+    A walk starts at aG + bQ. With the negation map it starts at the class of
+    that point, since clients may report a starting point that is not canonical
+    '''
+    def _startState(self, a, b, point):
+        a, b, point = self._canonical(a, b, point)
+        return (a, b, point, cycleFingerprint(point.x))
+
+    '''
+    Gets the next state of the random walk. A state is (a, b, point, history)
+    where history holds the fingerprints of the last four points. Only the
+    negation map uses the history.
+    '''
+    def _nextState(self, state):
+
+        a, b, point, history = state
+
+        a, b, point = self._mapPoint(a, b, point)
+
+        if not self.params.negation:
+            return (a, b, point, history)
+
+        # Same point as 2 or 4 steps ago means the walk is in a fruitless cycle
+        f = cycleFingerprint(point.x)
+        if f == (history >> 16) & 0xffff or f == (history >> 48) & 0xffff:
+            a, b, point = self._escapeCycle(a, b, point)
+            f = cycleFingerprint(point.x)
+
+        history = ((history << 16) | f) & 0xffffffffffffffff
+
+        return (a, b, point, history)
+
 
     def _countWalkLengths(self):
 
@@ -153,7 +274,7 @@ class RhoSolver:
 
         print("Counting walk #2 length")
         self.p2Len = self._getWalkLength(self.a2, self.b2, self.point2)
-       
+
         #if p2Len < 0:
         #    return None, None, None, None, None, None
         print(str(self.p2Len))
@@ -168,8 +289,11 @@ class RhoSolver:
 
     '''
     Given two walks with the same ending point, it finds where the walks collide.
+
+    Two walks that fall into the same fruitless cycle at different times can
+    leave it a few steps out of step with each other, so the most recent points
+    of both walks are kept and checked as well.
     '''
-    #curve, g, q, a1Start, b1Start, p1Start, a2Start, b2Start, p2Start, endPoint, rPoints, dBits):
     def _findCollision(self):
 
         self._countWalkLengths()
@@ -178,69 +302,155 @@ class RhoSolver:
 
         if self._isRobinHood():
             print("It's a Robin Hood :(")
+            self.robinHood = True
             return None, None, None, None, None, None
         else:
-            print("Not a Robin Hood :)") 
+            print("Not a Robin Hood :)")
 
-        point1 = self.point1
-        point2 = self.point2
+        state1 = self._startState(self.a1, self.b1, self.point1)
+        state2 = self._startState(self.a2, self.b2, self.point2)
 
         diff = self.p1Len - self.p2Len
         print("Stepping " + str(diff) + " times")
 
-        a1 = self.a1
-        b1 = self.b1
-
-        a2 = self.a2
-        b2 = self.b2
-
         for i in xrange(diff):
-            a1, b1, point1 = self._nextPoint(a1, b1, point1)
+            state1 = self._nextState(state1)
+
+        recent1 = RecentPoints(COLLISION_WINDOW)
+        recent2 = RecentPoints(COLLISION_WINDOW)
 
         print("Searching for collision")
         while True:
 
+            point1 = state1[2]
+            point2 = state2[2]
+
             if (point1.x == self.endPoint.x and point1.y == self.endPoint.y) or (point2.x == self.endPoint.x and point2.y == self.endPoint.y):
                 print("Reached the end :(")
-                return None
+                return None, None, None, None, None, None
 
-            a1Old = a1
-            b1Old = b1
-            point1Old = point1
+            state1 = self._nextState(state1)
+            state2 = self._nextState(state2)
 
-            a2Old = a2
-            b2Old = b2
-            point2Old = point2
+            a1, b1, point1 = state1[0:3]
+            a2, b2, point2 = state2[0:3]
 
-            a1, b1, point1 = self._nextPoint(a1, b1, point1)
-            a2, b2, point2 = self._nextPoint(a2, b2, point2)
+            match = None
+            if point1.x == point2.x:
+                match = (a1, b1, point1, a2, b2, point2)
+            elif recent2.contains(point1):
+                match = (a1, b1, point1) + recent2.get(point1)
+            elif recent1.contains(point2):
+                match = recent1.get(point2) + (a2, b2, point2)
 
-            if point1.x == point2.x and point1.y == point2.y:
+            if match != None:
+                a1, b1, point1, a2, b2, point2 = match
                 print("Found collision!")
                 print(hex(a1) + " " + hex(b1) + " " + hex(point1.x) + " " + hex(point1.y))
                 print(hex(a2) + " " + hex(b2) + " " + hex(point2.x) + " " + hex(point2.y))
                 return a1, b1, point1, a2, b2, point2
 
+            recent1.add(a1, b1, point1)
+            recent2.add(a2, b2, point2)
+
+    '''
+    Finds the collision with the native collision solver at path, which walks
+    the same way. Returns None when it cannot be run, so that the walks are
+    replayed in Python instead
+    '''
+    def _findCollisionNative(self, path):
+
+        request = {}
+        request['params'] = self.params.encode()
+        request['points'] = []
+        for e in self.rPoints:
+            request['points'].append({'a':str(e['a']), 'b':str(e['b']), 'x':str(e['x']), 'y':str(e['y'])})
+
+        request['walks'] = [{'a':str(self.a1), 'b':str(self.b1)}, {'a':str(self.a2), 'b':str(self.b2)}]
+        request['end'] = {'x':str(self.endPoint.x), 'y':str(self.endPoint.y)}
+        request['max_bits'] = self.maxBits
+
+        print("Running " + path)
+
+        try:
+            proc = subprocess.Popen([path], stdin=subprocess.PIPE, stdout=subprocess.PIPE)
+            output = proc.communicate(json.dumps(request))[0]
+        except OSError as e:
+            print("Error running collision solver: " + str(e))
+            return None
+
+        if proc.returncode != 0:
+            print("Collision solver failed")
+            return None
+
+        result = json.loads(output)
+
+        self.p1Len, self.p2Len = result['lengths']
+        print("Walk lengths " + str(self.p1Len) + " and " + str(self.p2Len) + ", " + str(result['seconds']) + " seconds")
+
+        status = result['status']
+
+        if status == 'robin_hood':
+            print("It's a Robin Hood :(")
+            self.robinHood = True
+        elif status == 'too_long':
+            print("Walk is too long. Terminating")
+        elif status == 'no_collision':
+            print("Reached the end :(")
+
+        if status != 'collision':
+            return None, None, None, None, None, None
+
+        collision = ()
+        for p in (result['p1'], result['p2']):
+            collision += (int(p['a']), int(p['b']), ECPoint(int(p['x']), int(p['y'])))
+
+        a1, b1, point1, a2, b2, point2 = collision
+        print("Found collision!")
+        print(hex(a1) + " " + hex(b1) + " " + hex(point1.x) + " " + hex(point1.y))
+        print(hex(a2) + " " + hex(b2) + " " + hex(point2.x) + " " + hex(point2.y))
+
+        return collision
+
     def solve(self):
-        a1, b1, point1, a2, b2, point2 = self._findCollision()
+        collision = None
+
+        if ecdl.Config != None and ecdl.Config.collisionSolver:
+            collision = self._findCollisionNative(ecdl.Config.collisionSolver)
+
+        if collision == None:
+            collision = self._findCollision()
+
+        a1, b1, point1, a2, b2, point2 = collision
 
         if a1 == None:
             self.solved = False
             return
 
-        k = (((a1 - a2)%self.curve.n) * invm(b2 - b1, self.curve.n)) % self.curve.n
-       
-        # Verify 
-        r = self.curve.multiply(k, self.curve.bp)
+        n = self.curve.n
 
-        if r.x != self.params.qx or r.y != self.params.qy:
-            print("Verification failed")
-            self.solved = False
+        # a1G + b1Q = +/-(a2G + b2Q). When n is not prime, b2 - b1 need not
+        # be invertible and k is one of a few solutions
+        if point1.y == point2.y:
+            candidates = util.solveCongruence(b2 - b1, a1 - a2, n, MAX_CANDIDATES)
         else:
-            print("Verification successful")
-            self.solved = True
+            candidates = util.solveCongruence(b1 + b2, -a1 - a2, n, MAX_CANDIDATES)
 
-        self.k = k
+        # Verify 
+        self.solved = False
+        self.k = None
+        for k in candidates:
+            r = self.curve.multiply(k, self.curve.bp)
+
+            if r.x == self.params.qx and r.y == self.params.qy:
+                self.solved = True
+                self.k = k
+                break
+
+        if self.solved:
+            print("Verification successful")
+        else:
+            print("Verification failed")
 
 def sendNotificationEmail(ctx):
     print("Sending email to " + ctx.email)
@@ -255,7 +465,16 @@ def solveNextCollision(ctx):
     if coll == None:
         return
 
-    solver = RhoSolver(ctx.params, ctx.rPoints, coll['a1'], coll['b1'], coll['a2'], coll['b2'], ECPoint(coll['x'], coll['y']))
+    # Two tame or two wild kangaroos meet at a point whose logarithm is
+    # already known, so the collision says nothing about Q
+    if ctx.params.walk == 'kangaroo' and coll['b1'] == coll['b2']:
+        print("Collision between two " + ("tame" if coll['b1'] == 0 else "wild") + " walks")
+        ctx.database.open()
+        ctx.database.updateCollisionStatus(coll['id'], 'F')
+        ctx.database.close()
+        return
+
+    solver = RhoSolver(ctx.params, ctx.rPoints, coll['a1'], coll['b1'], coll['a2'], coll['b2'], ECPoint(coll['x'], coll['y']), ctx.maxBits)
 
     solver.solve()
 
@@ -265,15 +484,73 @@ def solveNextCollision(ctx):
         print("The solution is " + util.toHex(solver.k))
         ctx.database.setSolution(solver.k)
         ctx.database.updateCollisionStatus(coll['id'], 'T')
+    elif solver.robinHood:
+        ctx.database.updateCollisionStatus(coll['id'], 'R')
     else:
         ctx.database.updateCollisionStatus(coll['id'], 'F')
 
     ctx.database.close()
 
+'''
+Lifts the logarithms of a job split into sub-jobs by the digits their
+sub-jobs found, creates the sub-jobs for the next digits, and combines the
+logarithms once all of them are found
+'''
+def solveDecomposition(name):
+
+    decomposition = ecdl.loadDecomposition(name)
+
+    if decomposition == None or decomposition['status'].lower() != 'unsolved':
+        return
+
+    params = decomposition['params']
+    factors = decomposition['factors']
+
+    done = True
+    for i in range(len(factors)):
+        f = factors[i]
+
+        if f['job'] == None:
+            continue
+
+        ctx = ecdl.loadContext(f['job'])
+        if ctx.status.lower() != 'solved':
+            done = False
+            continue
+
+        f['residue'] = f['residue'] + ctx.solution * pow(f['prime'], f['digit'])
+        f['digit'] = f['digit'] + 1
+        ecdl.createDigitJob(params, name, i, f)
+        ecdl.Database.updateFactor(name, i, f)
+
+        if f['job'] != None:
+            print("Digit " + str(f['digit']) + " of factor " + str(i) + " of " + name + " is found by " + f['job'])
+            done = False
+
+    if not done:
+        return
+
+    residues = [(f['residue'], f['modulus']) for f in factors]
+    k = decompose.crt(residues)
+
+    curve = ECCurve(params.a, params.b, params.p, params.n, params.gx, params.gy)
+    r = curve.multiply(k, curve.bp)
+
+    if r.x != params.qx or r.y != params.qy:
+        print("Verification of the combined logarithm of " + name + " failed")
+        return
+
+    print("The solution of " + name + " is " + util.toHex(k))
+    ecdl.Database.setDecompositionSolution(name, k)
+
 def mainLoop():
 
     while True:
 
+        # Jobs split into sub-jobs are solved when their sub-jobs are
+        for name in ecdl.Database.getDecompositionNames():
+            solveDecomposition(name)
+
         contextNames = ecdl.Database.getNames()
 
         if contextNames != None and len(contextNames) != 0:
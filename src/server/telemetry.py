@@ -0,0 +1,279 @@
+'''
+Walk quality of a job. Every submission adds to the counters of the client
+that sent it: the points and the steps their walks took, a histogram of the
+walk lengths, the points it sent before, the collisions its points made and
+the walks it dropped. From them the work left is projected, and clients or
+R points that waste work are flagged
+'''
+
+import math
+import re
+import time
+
+# Headers of a submission naming the client, and giving the walks it dropped
+# since its last submission
+CLIENT_HEADER = 'X-ECDL-Client'
+DROPPED_HEADER = 'X-ECDL-Dropped'
+
+# Longest client name kept. Clients that give none are named by address
+MAX_CLIENT_LENGTH = 64
+
+# Walk lengths are counted in buckets of powers of 2. Bucket i holds the
+# walks of 2^(i-1) to 2^i - 1 steps
+HISTOGRAM_BUCKETS = 64
+
+# Points a client sends before its walks are judged
+MIN_CLIENT_POINTS = 100
+
+# Walks are short or long when their mean is this far from the mean length
+# 2^dBits of a walk to a distinguished point
+WALK_LENGTH_FACTOR = 2
+
+# Share of the points sent twice, and of the walks dropped, beyond which a
+# client is flagged. A walk is dropped at four times the mean length, which
+# e^-4 of the walks reach
+MAX_DUPLICATE_RATE = 0.01
+MAX_DROP_RATE = 0.05
+
+# Share of the collisions that may be Robin Hoods
+MAX_ROBIN_HOOD_RATE = 0.25
+
+# A rho job is overdue when its walks took this many times the expected
+# steps. The chance of that is below 0.1%
+OVERDUE_FACTOR = 3
+
+# Clients that sent points in this many seconds count towards the step rate
+RATE_WINDOW = 3600
+
+'''
+Name the stats of a client are kept under. Only characters that are safe
+in a statement are kept
+'''
+def clientName(name, address):
+    name = re.sub(r'[^A-Za-z0-9_.:-]', '', name or '')[:MAX_CLIENT_LENGTH]
+
+    if name == '':
+        name = re.sub(r'[^A-Za-z0-9_.:-]', '', address or '')[:MAX_CLIENT_LENGTH]
+
+    return name or 'unknown'
+
+'''
+Histogram bucket of a walk length
+'''
+def bucket(length):
+    return min(int(length).bit_length(), HISTOGRAM_BUCKETS - 1)
+
+'''
+Counters of one submission. lengths are the lengths of its walks
+'''
+def submissionStats(lengths, duplicates, collisions, dropped):
+    histogram = {}
+    for length in lengths:
+        i = bucket(length)
+        histogram[i] = histogram.get(i, 0) + 1
+
+    stats = {}
+    stats['points'] = len(lengths)
+    stats['steps'] = sum(lengths)
+    stats['duplicates'] = duplicates
+    stats['collisions'] = collisions
+    stats['dropped'] = dropped
+    stats['histogram'] = histogram
+
+    return stats
+
+'''
+Size of the group the walks of a rho job move in. The negation map walks
+on classes of P and -P
+'''
+def _groupSize(params):
+    if params.negation:
+        return params.n / 2.0
+
+    return float(params.n)
+
+'''
+Expected steps of all walks until the logarithm is found
+'''
+def expectedSteps(params):
+    if params.walk == 'kangaroo':
+        return 2.0 * math.sqrt(params.upper - params.lower)
+
+    return math.sqrt(math.pi * _groupSize(params) / 2.0)
+
+'''
+Expected steps still to be taken after steps were taken without finding
+the logarithm. For rho the chance of no collision after s steps is
+exp(-s^2 / 2N), so the work left grows less than the work done
+'''
+def remainingSteps(params, steps):
+    if params.walk == 'kangaroo':
+        return max(expectedSteps(params) - steps, 0.0)
+
+    scale = math.sqrt(2.0 * _groupSize(params))
+    x = steps / scale
+
+    # exp(x^2) erfc(x) overflows for large x, where it is 1 / (x sqrt(pi))
+    if x > 10:
+        return scale / (2.0 * x) * (1.0 - 1.0 / (2.0 * x * x))
+
+    return scale * math.exp(x * x) * math.sqrt(math.pi) / 2.0 * math.erfc(x)
+
+'''
+Collisions expected between walks that took steps in all. Kangaroo walks
+only solve when a tame and a wild walk meet, so none are given for them
+'''
+def expectedCollisions(params, steps):
+    if params.walk == 'kangaroo':
+        return None
+
+    return float(steps) * steps / (2.0 * _groupSize(params))
+
+'''
+Share of count in total, 0 when total is 0
+'''
+def _rate(count, total):
+    if total == 0:
+        return 0.0
+
+    return float(count) / total
+
+'''
+Flags of a client. Walks that are too short or too long for the
+distinguished bits the job ran at, points sent over and over and walks
+dropped in cycles point to a broken client
+'''
+def clientFlags(client, minBits, maxBits):
+    flags = []
+
+    if client['points'] < MIN_CLIENT_POINTS:
+        return flags
+
+    mean = float(client['steps']) / client['points']
+
+    if mean * WALK_LENGTH_FACTOR < 2 ** minBits:
+        flags.append('short_walks')
+
+    if mean > WALK_LENGTH_FACTOR * 2 ** maxBits:
+        flags.append('long_walks')
+
+    if _rate(client['duplicates'], client['points']) > MAX_DUPLICATE_RATE:
+        flags.append('duplicates')
+
+    if _rate(client['dropped'], client['points'] + client['dropped']) > MAX_DROP_RATE:
+        flags.append('drops')
+
+    return flags
+
+'''
+Steps per second of a client over the time it has been sending points
+'''
+def _stepRate(client):
+    seconds = client['last_seen'] - client['first_seen']
+
+    if seconds <= 0:
+        return 0.0
+
+    return float(client['steps']) / seconds
+
+'''
+Report of a job from the counters of its clients. ctx is the job, clients
+the counters from the database and robinHoods the collisions the solver
+found to be Robin Hoods
+'''
+def report(ctx, clients, robinHoods, now = None):
+    if now == None:
+        now = int(time.time())
+
+    params = ctx.params
+    minBits = params.dBits
+    maxBits = max(params.dBits, ctx.maxBits)
+
+    totals = {'points':0, 'steps':0, 'duplicates':0, 'collisions':0, 'dropped':0}
+    histogram = [0] * HISTOGRAM_BUCKETS
+    rate = 0.0
+    flagged = 0
+    judged = 0
+
+    clientReports = []
+    for client in clients:
+        for key in totals:
+            totals[key] += client[key]
+
+        for i in range(HISTOGRAM_BUCKETS):
+            histogram[i] += client['histogram'][i]
+
+        if now - client['last_seen'] <= RATE_WINDOW:
+            rate += _stepRate(client)
+
+        flags = clientFlags(client, minBits, maxBits)
+        if client['points'] >= MIN_CLIENT_POINTS:
+            judged += 1
+            if 'drops' in flags or 'long_walks' in flags:
+                flagged += 1
+
+        r = {}
+        r['client'] = client['client']
+        r['submissions'] = client['submissions']
+        r['points'] = client['points']
+        r['steps'] = client['steps']
+        r['duplicates'] = client['duplicates']
+        r['collisions'] = client['collisions']
+        r['dropped'] = client['dropped']
+        r['mean_walk_length'] = _rate(client['steps'], client['points'])
+        r['duplicate_rate'] = _rate(client['duplicates'], client['points'])
+        r['drop_rate'] = _rate(client['dropped'], client['points'] + client['dropped'])
+        r['steps_per_second'] = _stepRate(client)
+        r['first_seen'] = client['first_seen']
+        r['last_seen'] = client['last_seen']
+        r['histogram'] = client['histogram']
+        r['flags'] = flags
+        clientReports.append(r)
+
+    steps = totals['steps']
+    expected = expectedSteps(params)
+    remaining = remainingSteps(params, steps)
+    expectedColl = expectedCollisions(params, steps)
+
+    # Walks caught in cycles on most clients are caught because of the R
+    # points they share, not because of the clients. With one client the
+    # two cannot be told apart and both are flagged
+    flags = []
+    if flagged > 0 and flagged * 2 > judged:
+        flags.append('degenerate_rpoints')
+
+    if robinHoods >= 2 and robinHoods > MAX_ROBIN_HOOD_RATE * totals['collisions']:
+        flags.append('robin_hoods')
+
+    # Far more collisions than random walks make are walks that merge for
+    # other reasons, and do not solve the job
+    if expectedColl != None and totals['collisions'] > expectedColl + 3 * math.sqrt(expectedColl) + 3:
+        flags.append('excess_collisions')
+
+    if params.walk != 'kangaroo' and ctx.status == 'unsolved' and steps > OVERDUE_FACTOR * expected:
+        flags.append('overdue')
+
+    r = {}
+    r['status'] = ctx.status
+    r['walk'] = params.walk
+    r['bits'] = ctx.activeBits
+    r['points'] = totals['points']
+    r['steps'] = steps
+    r['duplicates'] = totals['duplicates']
+    r['collisions'] = totals['collisions']
+    r['robin_hoods'] = robinHoods
+    r['dropped'] = totals['dropped']
+    r['mean_walk_length'] = _rate(steps, totals['points'])
+    r['expected_walk_length'] = 2 ** ctx.activeBits
+    r['duplicate_rate'] = _rate(totals['duplicates'], totals['points'])
+    r['drop_rate'] = _rate(totals['dropped'], totals['points'] + totals['dropped'])
+    r['histogram'] = histogram
+    r['expected_steps'] = expected
+    r['remaining_steps'] = remaining
+    r['expected_collisions'] = expectedColl
+    r['steps_per_second'] = rate
+    r['projected_seconds'] = remaining / rate if rate > 0 and ctx.status == 'unsolved' else None
+    r['flags'] = flags
+    r['clients'] = clientReports
+
+    return r
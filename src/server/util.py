@@ -1,6 +1,27 @@
+import ecc
 from ecc import ECCurve, ECPoint
 import random
 
+'''
+Limits on the number of R points in a job. The count must be a power of 2
+'''
+MIN_R_POINTS = 16
+MAX_R_POINTS = 4096
+DEFAULT_R_POINTS = 32
+
+'''
+Binary format for submitting distinguished points. The server lists the
+version it accepts in /params and clients that do not know it send JSON
+'''
+BINARY_CONTENT_TYPE = 'application/x-ecdl-points'
+BINARY_MAGIC = b'ECDP'
+BINARY_VERSION = 1
+
+'''
+Raised for a binary submission in a version this server does not know
+'''
+class UnsupportedFormatError(ValueError):
+    pass
 
 '''
 Converts a string to integer by guessing the base
@@ -18,7 +39,76 @@ def intToString(n):
     return str(n).rstrip("L")
 
 '''
-Generates the R points for the random walk from the ECDLP parameters
+Mean jump of a kangaroo job's R point table of count points, whose jumps are
+1, 2, 4 ... 2^(k-1) repeated
+'''
+def _meanJump(k, count):
+    return sum([1 << (i % k) for i in range(count)]) // count
+
+'''
+Picks the jumps of a kangaroo job. The R points are sG for jumps s that are
+powers of 2, up to whichever gives a mean jump of m*sqrt(w)/2 for m walks
+running at once on an interval of width w. A smaller mean jump has each walk
+cover only its own part of the interval, so walks rarely land on each
+other's trails. Returns k, the number of distinct jumps, and the number of
+R points
+'''
+def kangarooJumps(params):
+    target = params.walks * isqrt(params.upper - params.lower) // 2
+
+    k = 1
+    while True:
+        count = MIN_R_POINTS
+        while count < k:
+            count = count * 2
+
+        if _meanJump(k, count) >= target:
+            return k, count
+        k = k + 1
+
+'''
+Mean jump of the R points of a kangaroo job
+'''
+def kangarooMeanJump(params):
+    k, count = kangarooJumps(params)
+
+    return _meanJump(k, count)
+
+'''
+Integer square root
+'''
+def isqrt(n):
+    if n <= 0:
+        return 0
+
+    x = 1 << ((n.bit_length() + 1) // 2)
+    while True:
+        y = (x + n // x) // 2
+        if y >= x:
+            return x
+        x = y
+
+'''
+Solutions x mod n of c*x = d (mod n). There are gcd(c, n) of them or none.
+Returns an empty list when there are none or more than limit
+'''
+def solveCongruence(c, d, n, limit):
+    g = n
+    r = c % n
+    while r != 0:
+        g, r = r, g % r
+
+    if d % g != 0 or g > limit:
+        return []
+
+    m = n // g
+    x = ((d // g) * ecc.invModP((c // g) % m, m)) % m if m > 1 else 0
+
+    return [x + i * m for i in range(g)]
+
+'''
+Generates the R points for the random walk from the ECDLP parameters. A
+kangaroo job gets jumps R = sG with b = 0
 '''
 def generateRPoints(params):
 
@@ -27,8 +117,18 @@ def generateRPoints(params):
     pointQ = ECPoint(params.qx, params.qy)
 
     rPoints = []
-     
-    for i in range(NUM_R_POINTS):
+
+    if params.walk == 'kangaroo':
+        k = kangarooJumps(params)[0]
+
+        for i in range(params.numRPoints):
+            a = 1 << (i % k)
+            r = curve.multiply(a, pointG)
+            rPoints.append({'a':a, 'b':0, 'x':r.x, 'y':r.y})
+
+        return rPoints
+
+    for i in range(params.numRPoints):
         a = random.randint(2, curve.n)
         b = random.randint(2, curve.n)
 
@@ -46,6 +146,117 @@ def generateRPoints(params):
 
     return rPoints
 
+'''
+Checks that the number of R points is a power of 2 within the limits
+'''
+def isValidRPointCount(n):
+    return n >= MIN_R_POINTS and n <= MAX_R_POINTS and (n & (n - 1)) == 0
+
+'''
+Reads an unsigned LEB128 integer. Returns the value and the new offset
+'''
+def _readVarint(data, offset):
+    value = 0
+    shift = 0
+
+    while True:
+        if offset >= len(data) or shift > 63:
+            raise ValueError("Invalid varint")
+
+        byte = data[offset]
+        offset = offset + 1
+        value = value | ((byte & 0x7f) << shift)
+        shift = shift + 7
+
+        if byte & 0x80 == 0:
+            return value, offset
+
+'''
+Reads a little endian integer of the given length in bytes
+'''
+def _readInt(data, offset, length):
+    if offset + length > len(data):
+        raise ValueError("Truncated point")
+
+    value = 0
+    for i in reversed(range(length)):
+        value = (value << 8) | data[offset + i]
+
+    return value, offset + length
+
+'''
+Sizes in bytes of the coefficients and of the x field in the binary format
+'''
+def binaryFieldLengths(params):
+    pBits = len(bin(params.p)) - 2
+    nLen = (len(bin(params.n)) - 2 + 7) // 8
+
+    # x without its distinguished bits, plus the parity of y
+    xLen = (pBits - params.dBits + 8) // 8
+
+    return nLen, xLen
+
+'''
+Decodes a binary submission:
+
+    "ECDP", version byte, varint count and then for each point
+    varint length, a and b in nLen bytes, x in xLen bytes
+
+All integers are little endian. The x field holds x >> dBits, with the
+parity of y in the bit above it. Returns a list of points as dictionaries
+'''
+def decodeBinaryPoints(params, data):
+    data = bytearray(data)
+
+    if len(data) < 5 or bytes(data[0:4]) != BINARY_MAGIC:
+        raise ValueError("Not a binary submission")
+
+    if data[4] != BINARY_VERSION:
+        raise UnsupportedFormatError("Unsupported version " + str(data[4]))
+
+    nLen, xLen = binaryFieldLengths(params)
+    pBits = len(bin(params.p)) - 2
+    paritySize = pBits - params.dBits
+
+    count, offset = _readVarint(data, 5)
+
+    points = []
+    for i in xrange(count):
+        length, offset = _readVarint(data, offset)
+        a, offset = _readInt(data, offset, nLen)
+        b, offset = _readInt(data, offset, nLen)
+        field, offset = _readInt(data, offset, xLen)
+
+        x = (field & ((1 << paritySize) - 1)) << params.dBits
+        parity = field >> paritySize
+        if parity > 1:
+            raise ValueError("Invalid x field")
+
+        if x >= params.p:
+            raise ValueError("Invalid x field")
+
+        # y^2 = x^3 + ax + b
+        roots = squareRootModP((x * x * x + params.a * x + params.b) % params.p, params.p)
+        if len(roots) == 0:
+            raise ValueError("Point is not on the curve")
+
+        y = roots[0]
+        if y & 0x01 != parity:
+            y = (params.p - y) % params.p
+
+        dp = {}
+        dp['a'] = a
+        dp['b'] = b
+        dp['x'] = x
+        dp['y'] = y
+        dp['length'] = length
+        points.append(dp)
+
+    if offset != len(data):
+        raise ValueError("Trailing data")
+
+    return points
+
 '''
 Class to hold ECDLP parameters
 '''
@@ -66,6 +277,12 @@ class ECDLPParams:
         self.qx = 0
         self.qy = 0
         self.dBits = 0
+        self.negation = False
+        self.walk = 'rho'
+        self.lower = 0
+        self.upper = 0
+        self.walks = 1
+        self.numRPoints = DEFAULT_R_POINTS
 
     def decode(self, params):
         self.field = params['field']
@@ -79,6 +296,17 @@ class ECDLPParams:
         self.qy = parseInt(params['qy'])
         self.dBits = params['bits']
 
+        # Optional, older jobs walk without the negation map
+        self.negation = bool(params.get('negation', False))
+        self.numRPoints = int(params.get('rpoints', DEFAULT_R_POINTS))
+
+        # A kangaroo job looks for a logarithm in [lower, upper)
+        self.walk = params.get('walk', 'rho')
+        if self.walk == 'kangaroo':
+            self.lower = parseInt(str(params['lower']))
+            self.upper = parseInt(str(params['upper']))
+            self.walks = int(params.get('walks', 0))
+
     '''
     Encode into json format
     '''
@@ -94,6 +322,14 @@ class ECDLPParams:
         encoded['qx'] = str(self.qx)
         encoded['qy'] = str(self.qy)
         encoded['bits'] = self.dBits
+        encoded['negation'] = self.negation
+        encoded['rpoints'] = self.numRPoints
+        encoded['walk'] = self.walk
+
+        if self.walk == 'kangaroo':
+            encoded['lower'] = str(self.lower)
+            encoded['upper'] = str(self.upper)
+            encoded['walks'] = self.walks
 
         return encoded
 
@@ -162,8 +398,8 @@ def squareRootModP(n,p):
         return []
 
     # Check for easy case
-    if(n % 4 == 3):
-        r = pow(n, (p+1)/4, p)
+    if(p % 4 == 3):
+        r = pow(n, (p+1)//4, p)
         return [r, p - r]
 
     # Factor out powers of 2 from p - 1
@@ -188,13 +424,12 @@ def squareRootModP(n,p):
     while(t != 1):
 
         # Find lowest i where t^(2^i) = 1
-        i = 1
-        e = 0
-        for e in range(1,m):
-            if(pow(t, pow(2,i), p) == 1):
-                break
-            i = i * 2
-        
+        i = 0
+        t2 = t
+        while(t2 != 1):
+            t2 = (t2 * t2) % p
+            i = i + 1
+
         b = pow(c, 2**(m - i - 1), p)
         r = (r * b) % p
         t = (t * b * b) % p